@@ -24,18 +24,26 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <algorithm>
 
 #include <vdr/plugin.h>
 #include <vdr/videodir.h>
 
 #include "config.h"
-#include "live/livequeue.h"
+#include "live/latencytrace.h"
+#include "live/relaysource.h"
+#include "live/timeshiftfilepool.h"
+#include "live/timeshiftstore.h"
+#include "net/bandwidthshaper.h"
+#include "tools/cpuplacement.h"
+#include "tools/ioengine.h"
+#include "tools/memorybudget.h"
 
 RoboTVServerConfig::RoboTVServerConfig() : listenPort(LISTEN_PORT) {
 }
 
 void RoboTVServerConfig::Load() {
-    LiveQueue::setTimeShiftDir(cVideoDirectory::Name());
+    TimeShiftStore::setTimeShiftDir(cVideoDirectory::Name());
 
     if(!cConfig<cSetupLine>::Load(AddDirectory(configDirectory.c_str(), GENERAL_CONFIG_FILE), true, false)) {
         return;
@@ -47,15 +55,48 @@ void RoboTVServerConfig::Load() {
         }
     }
 
-    LiveQueue::removeTimeShiftFiles();
+    TimeShiftStore::setupTimeShiftFiles();
 }
 
 bool RoboTVServerConfig::Parse(const char* Name, const char* Value) {
     if(!strcasecmp(Name, "TimeShiftDir")) {
-        LiveQueue::setTimeShiftDir(Value);
+        TimeShiftStore::setTimeShiftDir(Value);
     }
     else if(!strcasecmp(Name, "MaxTimeShiftSize")) {
-        LiveQueue::setBufferSize(strtoull(Value, NULL, 10));
+        TimeShiftStore::setBufferSize(strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "TimeShiftStorage")) {
+        TimeShiftStore::setStorageMode(strcasecmp(Value, "mmap") == 0 ? TimeShiftStore::smMmap : TimeShiftStore::smFile);
+    }
+    else if(!strcasecmp(Name, "TimeShiftMemorySize")) {
+        TimeShiftStore::setMemorySize(strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "MaxMemorySize")) {
+        MemoryBudget::setLimit(strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "TimeShiftPoolFiles")) {
+        TimeShiftFilePool::setMaxIdleFiles(atoi(Value));
+    }
+    else if(!strcasecmp(Name, "MaxTimeShiftDiskSize")) {
+        TimeShiftFilePool::setDiskBudget(strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "MaxTimeShiftBandwidth")) {
+        TimeShiftFilePool::setBandwidthBudget(strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "ClientLiveRate")) {
+        BandwidthShaper::setClientRate(BandwidthShaper::tcLive, strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "ClientTimeShiftRate")) {
+        BandwidthShaper::setClientRate(BandwidthShaper::tcTimeShift, strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "ClientRecordingRate")) {
+        BandwidthShaper::setClientRate(BandwidthShaper::tcRecording, strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "MaxStreamRate")) {
+        BandwidthShaper::setGlobalRate(strtoull(Value, NULL, 10));
+    }
+    else if(!strcasecmp(Name, "IoUring")) {
+        IoEngine::setEnabled(strcmp(Value, "true") == 0);
     }
     else if(!strcasecmp(Name, "PiconsURL")) {
         piconsUrl = Value;
@@ -74,6 +115,39 @@ bool RoboTVServerConfig::Parse(const char* Name, const char* Value) {
     else if(!strcasecmp(Name, "FilterChannels")) {
         filterChannels = (strcmp(Value, "true") == 0);
     }
+    else if(!strcasecmp(Name, "ParallelDemuxing")) {
+        parallelDemuxing = (strcmp(Value, "true") == 0);
+    }
+    else if(!strcasecmp(Name, "CpuAffinity")) {
+        CpuPlacement::configure(Value);
+    }
+    else if(!strcasecmp(Name, "StandbyChannels")) {
+        standbyChannels = atoi(Value);
+    }
+    else if(!strcasecmp(Name, "ChannelProbe")) {
+        channelProbe = (strcmp(Value, "true") == 0);
+    }
+    else if(!strcasecmp(Name, "MaintenanceInterval")) {
+        maintenanceInterval = std::max(atoi(Value), 50);
+    }
+    else if(!strcasecmp(Name, "CleanupInterval")) {
+        cleanupInterval = std::max(atoi(Value), 1);
+    }
+    else if(!strcasecmp(Name, "SessionGracePeriod")) {
+        sessionGracePeriod = atoi(Value);
+    }
+    else if(!strcasecmp(Name, "ClusterPort")) {
+        clusterPort = atoi(Value);
+    }
+    else if(!strcasecmp(Name, "ClusterPeers")) {
+        clusterPeers = Value;
+    }
+    else if(!strcasecmp(Name, "ClusterRelay")) {
+        RelaySource::setEnabled(strcmp(Value, "true") == 0);
+    }
+    else if(!strcasecmp(Name, "LatencyTrace")) {
+        LatencyTrace::setEnabled(strcmp(Value, "true") == 0);
+    }
     else {
         return false;
     }
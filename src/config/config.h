@@ -85,6 +85,14 @@ public:
     std::string epgImageUrl;
     std::string seriesFolder;
     bool filterChannels = false;
+    bool parallelDemuxing = false;
+    int standbyChannels = 0;
+    bool channelProbe = false;
+    int maintenanceInterval = 250;
+    int cleanupInterval = 12;
+    int sessionGracePeriod = 30;
+    uint16_t clusterPort = 0;
+    std::string clusterPeers;
 };
 
 #endif // ROBOTV_CONFIG_H
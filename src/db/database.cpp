@@ -24,27 +24,140 @@
 
 #include "database.h"
 #include "config/config.h"
+#include "tools/metrics.h"
+
+#include <math.h>
+#include <strings.h>
+#include <sys/stat.h>
 
 using namespace roboTV;
 
-Database::Database() : m_db(NULL) {
+// maximum number of idle prepared statements
+#define STATEMENT_CACHE_SIZE 64
+
+// number of read-only connections
+#define DATABASE_READERS 4
+
+// no writes for this time (ms) -> database is idle
+#define DATABASE_IDLE_MS (30 * 1000)
+
+// interval for updating the query planner statistics (ms)
+#define DATABASE_ANALYZE_INTERVAL_MS (24 * 60 * 60 * 1000)
+
+// size limit of the WAL file after a checkpoint
+#define DATABASE_WAL_LIMIT (64 * 1024 * 1024)
+
+// pages written to each FTS table during an idle merge
+#define DATABASE_FTS_MERGE_PAGES 200
+
+// bm25 ranking parameters
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+static void bm25(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if(argc < 1) {
+        sqlite3_result_error(context, "wrong number of arguments to function bm25()", -1);
+        return;
+    }
+
+    // matchinfo 'pcnalx' layout
+    const unsigned int* info = (const unsigned int*)sqlite3_value_blob(argv[0]);
+    int bytes = sqlite3_value_bytes(argv[0]);
+
+    if(info == NULL || bytes < (int)(3 * sizeof(unsigned int))) {
+        sqlite3_result_double(context, 0.0);
+        return;
+    }
+
+    unsigned int phrases = info[0];
+    unsigned int columns = info[1];
+    double rows = info[2];
+
+    if(bytes < (int)((3 + 2 * columns + 3 * columns * phrases) * sizeof(unsigned int))) {
+        sqlite3_result_double(context, 0.0);
+        return;
+    }
+
+    const unsigned int* avgLength = &info[3];
+    const unsigned int* length = &info[3 + columns];
+    const unsigned int* hits = &info[3 + 2 * columns];
+
+    double score = 0.0;
+
+    for(unsigned int p = 0; p < phrases; p++) {
+        for(unsigned int c = 0; c < columns; c++) {
+            const unsigned int* x = &hits[3 * (c + p * columns)];
+            double tf = x[0];
+            double docs = x[2];
+
+            if(tf == 0) {
+                continue;
+            }
+
+            double weight = ((int)c + 1 < argc) ? sqlite3_value_double(argv[c + 1]) : 1.0;
+            // always positive idf (as in Lucene), frequent terms still add a little
+            double idf = log(1.0 + (rows - docs + 0.5) / (docs + 0.5));
+
+            double norm = (avgLength[c] > 0) ? (double)length[c] / avgLength[c] : 1.0;
+            score += weight * idf * (tf * (BM25_K1 + 1)) / (tf + BM25_K1 * (1 - BM25_B + BM25_B * norm));
+        }
+    }
+
+    sqlite3_result_double(context, -score);
+}
+
+Database::Database() : m_db(NULL), m_lastWrite(0), m_nextReader(0) {
+    auto timing = [](const Timing & t) {
+        return nlohmann::json {
+            {"count", (uint64_t)t.count},
+            {"totalMs", t.totalUs / 1000.0},
+            {"avgMs", (t.count > 0) ? (t.totalUs / 1000.0) / t.count : 0},
+            {"maxMs", t.maxUs / 1000.0}
+        };
+    };
+
+    Metrics::instance().add(this, "database", [ = ]() {
+        return nlohmann::json {
+            {"file", m_filename},
+            {"databaseBytes", getDatabaseSize()},
+            {"walBytes", getWalSize()},
+            {"exec", timing(m_execTiming)},
+            {"query", timing(m_queryTiming)},
+            {"maintenance", timing(m_maintenanceTiming)}
+        };
+    });
 }
 
 Database::~Database() {
+    Metrics::instance().remove(this);
     close();
 }
 
+void Database::Timing::add(uint64_t us) {
+    count++;
+    totalUs += us;
+
+    uint64_t m = maxUs;
+
+    while(us > m && !maxUs.compare_exchange_weak(m, us));
+}
+
+uint64_t Database::now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 bool Database::open(const std::string& db) {
     {
-        std::lock_guard<std::mutex> lock(m_lock);
+        std::lock_guard<std::recursive_mutex> writeLock(m_writeLock);
+        std::lock_guard<ProfiledMutex> lock(m_lock);
 
         if(m_db != NULL) {
             return false;
         }
 
         INFOLOG("Opening database: %s", db.c_str());
+        m_filename = db;
         int rc = sqlite3_open_v2(db.c_str(), &m_db,
-                                 SQLITE_OPEN_SHAREDCACHE |
                                  SQLITE_OPEN_FULLMUTEX |
                                  SQLITE_OPEN_READWRITE |
                                  SQLITE_OPEN_CREATE,
@@ -59,11 +172,48 @@ bool Database::open(const std::string& db) {
     }
 
     sqlite3_busy_timeout(m_db, 500);
-    return (exec("PRAGMA journal_mode = WAL;") == SQLITE_OK);
+    registerFunctions(m_db);
+
+    // only has an effect on new databases (before any table is created)
+    exec("PRAGMA auto_vacuum = INCREMENTAL;");
+
+    if(exec("PRAGMA journal_mode = WAL;") != SQLITE_OK) {
+        return false;
+    }
+
+    exec("PRAGMA journal_size_limit = %i;", DATABASE_WAL_LIMIT);
+
+    // open read-only connections
+    std::lock_guard<ProfiledMutex> lock(m_lock);
+
+    for(int i = 0; i < DATABASE_READERS; i++) {
+        sqlite3* reader = NULL;
+        int rc = sqlite3_open_v2(db.c_str(), &reader,
+                                 SQLITE_OPEN_FULLMUTEX |
+                                 SQLITE_OPEN_READONLY,
+                                 NULL);
+
+        if(rc != SQLITE_OK) {
+            ERRORLOG("Can't open read-only connection: %s", sqlite3_errmsg(reader));
+            sqlite3_close(reader);
+            break;
+        }
+
+        sqlite3_busy_timeout(reader, 500);
+        registerFunctions(reader);
+        m_readers.push_back(reader);
+    }
+
+    return true;
+}
+
+void Database::registerFunctions(sqlite3* db) {
+    sqlite3_create_function(db, "bm25", -1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, bm25, NULL, NULL);
 }
 
 bool Database::close() {
-    std::lock_guard<std::mutex> lock(m_lock);
+    std::lock_guard<std::recursive_mutex> writeLock(m_writeLock);
+    std::lock_guard<ProfiledMutex> lock(m_lock);
 
     if(m_db == NULL) {
         return false;
@@ -71,6 +221,14 @@ bool Database::close() {
 
     INFOLOG("Closing database.");
 
+    clearStatementCache();
+
+    for(auto reader : m_readers) {
+        sqlite3_close_v2(reader);
+    }
+
+    m_readers.clear();
+
     sqlite3_close_v2(m_db);
     m_db = NULL;
 
@@ -78,10 +236,30 @@ bool Database::close() {
 }
 
 bool Database::isOpen() {
-    std::lock_guard<std::mutex> lock(m_lock);
+    std::lock_guard<ProfiledMutex> lock(m_lock);
     return (m_db != NULL);
 }
 
+sqlite3* Database::reader() {
+    std::lock_guard<ProfiledMutex> lock(m_lock);
+
+    if(m_readers.empty()) {
+        return m_db;
+    }
+
+    return m_readers[m_nextReader++ % m_readers.size()];
+}
+
+bool Database::isReadOnly(const std::string& sql) {
+    size_t i = sql.find_first_not_of(" \t\r\n(");
+
+    if(i == std::string::npos) {
+        return false;
+    }
+
+    return (strncasecmp(sql.c_str() + i, "SELECT", 6) == 0 || strncasecmp(sql.c_str() + i, "PRAGMA", 6) == 0);
+}
+
 char* Database::prepareQueryBuffer(const std::string& query, va_list ap) {
     return sqlite3_vmprintf(query.c_str(), ap);
 }
@@ -91,7 +269,7 @@ void Database::releaseQueryBuffer(char* querybuffer) {
 }
 
 int Database::exec(const std::string& query, ...) {
-    std::lock_guard<std::mutex> lock(m_lock);
+    std::lock_guard<std::recursive_mutex> lock(m_writeLock);
 
     if(m_db == NULL) {
         return SQLITE_NOTADB;
@@ -105,6 +283,7 @@ int Database::exec(const std::string& query, ...) {
     std::chrono::milliseconds duration(10);
 
     int rc = SQLITE_OK;
+    auto start = std::chrono::steady_clock::now();
 
     for(;;) {
         if(errmsg != NULL) {
@@ -124,6 +303,9 @@ int Database::exec(const std::string& query, ...) {
 
     releaseQueryBuffer(querybuffer);
 
+    m_execTiming.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    m_lastWrite = now();
+
     if(rc != SQLITE_OK && errmsg != NULL) {
         ERRORLOG("SQLite: %s", errmsg);
         sqlite3_free(errmsg);
@@ -133,9 +315,9 @@ int Database::exec(const std::string& query, ...) {
 }
 
 sqlite3_stmt* Database::query(const std::string& query, ...) {
-    std::lock_guard<std::mutex> lock(m_lock);
+    sqlite3* db = reader();
 
-    if(m_db == NULL) {
+    if(db == NULL) {
         return NULL;
     }
 
@@ -148,7 +330,7 @@ sqlite3_stmt* Database::query(const std::string& query, ...) {
     std::chrono::milliseconds duration(10);
 
     for(;;) {
-        rc = sqlite3_prepare_v2(m_db, querybuffer, -1, &stmt, NULL);
+        rc = sqlite3_prepare_v2(db, querybuffer, -1, &stmt, NULL);
 
         if(rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
             std::this_thread::sleep_for(duration);
@@ -161,7 +343,7 @@ sqlite3_stmt* Database::query(const std::string& query, ...) {
     releaseQueryBuffer(querybuffer);
 
     if(rc != SQLITE_OK) {
-        ERRORLOG("SQLite: %s", sqlite3_errmsg(m_db));
+        ERRORLOG("SQLite: %s", sqlite3_errmsg(db));
 
         if(stmt != NULL) {
             sqlite3_finalize(stmt);
@@ -174,7 +356,7 @@ sqlite3_stmt* Database::query(const std::string& query, ...) {
 }
 
 sqlite3_blob* Database::openBlob(const std::string& table, const std::string& column, int64_t rowid, bool write) {
-    std::lock_guard<std::mutex> lock(m_lock);
+    std::lock_guard<ProfiledMutex> lock(m_lock);
 
     if(m_db == NULL) {
         return NULL;
@@ -191,15 +373,63 @@ sqlite3_blob* Database::openBlob(const std::string& table, const std::string& co
 }
 
 bool Database::begin() {
-    return (exec("BEGIN;") == SQLITE_OK);
+    // keep the writer locked until commit / rollback
+    m_writeLock.lock();
+
+    // transactions can't be nested
+    if(m_transaction) {
+        ERRORLOG("SQLite: transaction already started");
+        m_writeLock.unlock();
+        return false;
+    }
+
+    if(exec("BEGIN;") != SQLITE_OK) {
+        m_writeLock.unlock();
+        return false;
+    }
+
+    m_transaction = true;
+    return true;
 }
 
 bool Database::commit() {
-    return (exec("COMMIT;") == SQLITE_OK);
+    std::lock_guard<std::recursive_mutex> lock(m_writeLock);
+
+    // only the thread that started the transaction holds the lock here
+    if(!m_transaction) {
+        ERRORLOG("SQLite: commit without transaction");
+        return false;
+    }
+
+    bool rc = (exec("COMMIT;") == SQLITE_OK);
+
+    // a failed commit leaves the transaction open, don't let other writers in
+    if(!rc && sqlite3_get_autocommit(m_db) == 0) {
+        exec("ROLLBACK;");
+    }
+
+    endTransaction();
+    return rc;
 }
 
 bool Database::rollback() {
-    return (exec("ROLLBACK;") == SQLITE_OK);
+    std::lock_guard<std::recursive_mutex> lock(m_writeLock);
+
+    if(!m_transaction) {
+        ERRORLOG("SQLite: rollback without transaction");
+        return false;
+    }
+
+    bool rc = (exec("ROLLBACK;") == SQLITE_OK);
+
+    endTransaction();
+    return rc;
+}
+
+void Database::endTransaction() {
+    // release the lock taken by begin()
+    m_transaction = false;
+    m_writeLock.unlock();
 }
 
 bool Database::tableHasColumn(const std::string& table, const std::string& column) {
@@ -223,3 +453,180 @@ bool Database::tableHasColumn(const std::string& table, const std::string& colum
     sqlite3_finalize(s);
     return columnFound;
 }
+
+int64_t Database::getDatabaseSize() {
+    struct stat st;
+    return (!m_filename.empty() && stat(m_filename.c_str(), &st) == 0) ? (int64_t)st.st_size : 0;
+}
+
+int64_t Database::getWalSize() {
+    struct stat st;
+    return (!m_filename.empty() && stat((m_filename + "-wal").c_str(), &st) == 0) ? (int64_t)st.st_size : 0;
+}
+
+void Database::mergeFtsSegments() {
+    std::list<std::string> tables;
+    sqlite3_stmt* s = query("SELECT name FROM sqlite_master WHERE type='table' AND sql LIKE 'CREATE VIRTUAL TABLE%%USING fts4%%'");
+
+    if(s == NULL) {
+        return;
+    }
+
+    while(sqlite3_step(s) == SQLITE_ROW) {
+        tables.push_back((const char*)sqlite3_column_text(s, 0));
+    }
+
+    sqlite3_finalize(s);
+
+    for(const auto& table : tables) {
+        exec("INSERT INTO \"%w\"(\"%w\") VALUES('merge=%i,8');", table.c_str(), table.c_str(), DATABASE_FTS_MERGE_PAGES);
+    }
+}
+
+void Database::maintenance() {
+    if(!isOpen()) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t lastWrite = m_lastWrite;
+    bool idle = (now() - lastWrite >= DATABASE_IDLE_MS);
+
+    // a new write since the last idle maintenance
+    if(!idle) {
+        m_idleDone = false;
+    }
+
+    int walFrames = 0;
+    int checkpointed = 0;
+    int rc = SQLITE_OK;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_writeLock);
+
+        // passive checkpoints don't wait for readers or writers,
+        // while idle the WAL is checkpointed completely and truncated
+        rc = sqlite3_wal_checkpoint_v2(
+                 m_db,
+                 NULL,
+                 (idle && !m_idleDone) ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE,
+                 &walFrames,
+                 &checkpointed);
+    }
+
+    if(rc != SQLITE_OK && rc != SQLITE_BUSY) {
+        ERRORLOG("WAL checkpoint failed: %s", sqlite3_errstr(rc));
+    }
+
+    if(!idle || m_idleDone) {
+        m_maintenanceTiming.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        return;
+    }
+
+    mergeFtsSegments();
+    exec("PRAGMA incremental_vacuum(1000);");
+
+    if(m_lastAnalyze == 0 || now() - m_lastAnalyze >= DATABASE_ANALYZE_INTERVAL_MS) {
+        INFOLOG("updating database statistics");
+        exec("ANALYZE;");
+        m_lastAnalyze = now();
+    }
+
+    // checkpoint our own changes
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_writeLock);
+        sqlite3_wal_checkpoint_v2(m_db, NULL, SQLITE_CHECKPOINT_TRUNCATE, &walFrames, &checkpointed);
+    }
+
+    // maintenance doesn't count as activity
+    m_lastWrite = lastWrite;
+    m_idleDone = true;
+
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    m_maintenanceTiming.add(us);
+
+    DEBUGLOG("database maintenance took %.1f ms (wal: %i frames)", us / 1000.0, walFrames);
+}
+
+sqlite3_stmt* Database::acquireStatement(const std::string& sql) {
+    bool readOnly = isReadOnly(sql);
+
+    {
+        std::lock_guard<ProfiledMutex> lock(m_lock);
+
+        if(m_db == NULL) {
+            return NULL;
+        }
+
+        // reuse idle statement (of any read-only connection, or the writer)
+        for(auto i = m_statementCache.begin(); i != m_statementCache.end(); i++) {
+            if(i->first == sql) {
+                sqlite3_stmt* stmt = i->second;
+                m_statementCache.erase(i);
+                return stmt;
+            }
+        }
+    }
+
+    sqlite3* db = readOnly ? reader() : m_db;
+
+    sqlite3_stmt* stmt = NULL;
+    int rc = SQLITE_OK;
+    std::chrono::milliseconds duration(10);
+
+    for(;;) {
+        rc = sqlite3_prepare_v2(db, sql.c_str(), sql.size(), &stmt, NULL);
+
+        if(rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            std::this_thread::sleep_for(duration);
+        }
+        else {
+            break;
+        }
+    }
+
+    if(rc != SQLITE_OK) {
+        ERRORLOG("SQLite: %s", sqlite3_errmsg(db));
+
+        if(stmt != NULL) {
+            sqlite3_finalize(stmt);
+        }
+
+        return NULL;
+    }
+
+    return stmt;
+}
+
+void Database::releaseStatement(const std::string& sql, sqlite3_stmt* stmt) {
+    if(stmt == NULL) {
+        return;
+    }
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    std::lock_guard<ProfiledMutex> lock(m_lock);
+
+    // database already closed
+    if(m_db == NULL) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+
+    m_statementCache.push_front({sql, stmt});
+
+    // drop least recently used statements
+    while(m_statementCache.size() > STATEMENT_CACHE_SIZE) {
+        sqlite3_finalize(m_statementCache.back().second);
+        m_statementCache.pop_back();
+    }
+}
+
+void Database::clearStatementCache() {
+    for(auto& i : m_statementCache) {
+        sqlite3_finalize(i.second);
+    }
+
+    m_statementCache.clear();
+}
@@ -26,18 +26,26 @@
 #define ROBOTV_DATABASE_H
 
 #include "sqlite3.h"
+#include "tools/lockprofiler.h"
 
 #include <thread>
 #include <mutex>
 #include <string>
+#include <list>
+#include <vector>
+#include <atomic>
 
 namespace roboTV {
 
 /** @short Database backend.
- * This class build the interface to SQLite
+ * This class build the interface to SQLite.
+ * All writes go through a dedicated writer connection, queries are
+ * distributed over a pool of read-only connections (WAL mode).
  */
 
 class Database {
+    friend class Statement;
+
 public:
 
     /** @short Database constructor.
@@ -74,12 +82,15 @@ public:
     /** @short Begin transaction.
      * Starts a new transaction block. Writing many configuration values can
      * be accelerated by using Begin() and Commit()
+     * Other threads can't write until the transaction is committed or rolled back.
+     * @return true - on success (commit() or rollback() must follow), false - no transaction
      */
     bool begin();
 
     /** @short Commit transaction.
      * Commits a previously started transaction block. Writing many configuration values can
      * be accelerated by using Begin() and Commit()
+     * A transaction that fails to commit is rolled back.
      */
     bool commit();
 
@@ -89,7 +100,8 @@ public:
     bool rollback();
 
     /** @short Execute a SQL query.
-     * Executes the statement and returns a SQLite resultset.
+     * Executes the statement on a read-only connection and returns a SQLite resultset.
+     * Queries only see committed data.
      * @param query The SQL statement to execute. Accepts "printf" style formatting.
      * @return pointer to sqlite3_stmt containing the resultset or NULL on failure
      */
@@ -113,15 +125,105 @@ public:
      */
     bool tableHasColumn(const std::string& table, const std::string& column);
 
+    /** @short Run database maintenance.
+     * Should be called periodically (e.g. every minute). Runs a passive WAL
+     * checkpoint. If there haven't been any writes for a while the WAL is
+     * checkpointed and truncated, FTS segments are merged and the query
+     * planner statistics are updated (ANALYZE, once a day).
+     */
+    void maintenance();
+
+    /** @short Get the size of the database file (in bytes). */
+    int64_t getDatabaseSize();
+
+    /** @short Get the size of the write-ahead log (in bytes). */
+    int64_t getWalSize();
+
 private:
 
+    struct Timing {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> totalUs{0};
+        std::atomic<uint64_t> maxUs{0};
+
+        void add(uint64_t us);
+    };
+
     char* prepareQueryBuffer(const std::string& query, va_list ap);
 
     void releaseQueryBuffer(char* querybuffer);
 
+    /** @short Get a prepared statement.
+     * Returns an idle statement from the cache or prepares a new one.
+     * @param sql SQL text of the statement
+     * @return prepared statement or NULL on failure
+     */
+    sqlite3_stmt* acquireStatement(const std::string& sql);
+
+    /** @short Return a statement to the cache.
+     * The statement is reset. The least recently used statements are
+     * finalized if the cache is full.
+     * @param sql SQL text of the statement
+     * @param stmt prepared statement
+     */
+    void releaseStatement(const std::string& sql, sqlite3_stmt* stmt);
+
+    void clearStatementCache();
+
+    /** @short Leave the current transaction and release the writer. */
+    void endTransaction();
+
+    /** @short Get a read-only connection.
+     * Connections are used round-robin, falls back to the writer connection.
+     */
+    sqlite3* reader();
+
+    static bool isReadOnly(const std::string& sql);
+
+    /** @short Register custom SQL functions on a connection.
+     * bm25(matchinfo(table, 'pcnalx') [, weight, ...]) ranks FTS4 matches
+     * like the FTS5 bm25() function (lower values rank better).
+     */
+    static void registerFunctions(sqlite3* db);
+
+    /** @short Merge the segments of all FTS tables (limited work per table). */
+    void mergeFtsSegments();
+
+    static uint64_t now();
+
     sqlite3* m_db;
 
-    std::mutex m_lock;
+    std::string m_filename;
+
+    // time of the last write (ms)
+    std::atomic<uint64_t> m_lastWrite;
+
+    // time of the last ANALYZE (ms)
+    uint64_t m_lastAnalyze = 0;
+
+    // checkpointing / optimizing since the last write
+    bool m_idleDone = false;
+
+    Timing m_execTiming;
+
+    Timing m_queryTiming;
+
+    Timing m_maintenanceTiming;
+
+    std::vector<sqlite3*> m_readers;
+
+    std::atomic<unsigned int> m_nextReader;
+
+    ProfiledMutex m_lock{"database"};
+
+    // serialises the writers (held during transactions)
+    std::recursive_mutex m_writeLock;
+
+    // a transaction is open (guarded by m_writeLock)
+    bool m_transaction = false;
+
+    // idle prepared statements of all connections (most recently used first)
+    std::list<std::pair<std::string, sqlite3_stmt*>> m_statementCache;
 };
 
 } // namespace RoboTV
@@ -0,0 +1,149 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "statement.h"
+#include "config/config.h"
+
+#include <chrono>
+
+using namespace roboTV;
+
+Statement::Statement(Database& db, const std::string& sql) : m_db(db), m_sql(sql) {
+    m_writer = !Database::isReadOnly(m_sql);
+
+    // writing statements hold the writer connection
+    if(m_writer) {
+        m_db.m_writeLock.lock();
+    }
+
+    m_stmt = m_db.acquireStatement(m_sql);
+}
+
+Statement::~Statement() {
+    m_db.releaseStatement(m_sql, m_stmt);
+
+    if(m_writer) {
+        m_db.m_execTiming.add(m_us);
+        m_db.m_lastWrite = Database::now();
+        m_db.m_writeLock.unlock();
+    }
+    else {
+        m_db.m_queryTiming.add(m_us);
+    }
+}
+
+bool Statement::isValid() const {
+    return (m_stmt != NULL);
+}
+
+Statement& Statement::bind(int index, int value) {
+    if(m_stmt != NULL) {
+        sqlite3_bind_int(m_stmt, index, value);
+    }
+
+    return *this;
+}
+
+Statement& Statement::bind(int index, uint32_t value) {
+    return bind(index, (int64_t)value);
+}
+
+Statement& Statement::bind(int index, int64_t value) {
+    if(m_stmt != NULL) {
+        sqlite3_bind_int64(m_stmt, index, value);
+    }
+
+    return *this;
+}
+
+Statement& Statement::bind(int index, const char* value) {
+    if(m_stmt != NULL) {
+        if(value == NULL) {
+            sqlite3_bind_null(m_stmt, index);
+        }
+        else {
+            sqlite3_bind_text(m_stmt, index, value, -1, SQLITE_TRANSIENT);
+        }
+    }
+
+    return *this;
+}
+
+Statement& Statement::bind(int index, const std::string& value) {
+    if(m_stmt != NULL) {
+        sqlite3_bind_text(m_stmt, index, value.c_str(), value.size(), SQLITE_TRANSIENT);
+    }
+
+    return *this;
+}
+
+bool Statement::step() {
+    if(m_stmt == NULL) {
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int rc = sqlite3_step(m_stmt);
+    m_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    return (rc == SQLITE_ROW);
+}
+
+int Statement::exec() {
+    if(m_stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    int rc = SQLITE_OK;
+    auto start = std::chrono::steady_clock::now();
+
+    while((rc = sqlite3_step(m_stmt)) == SQLITE_ROW);
+
+    m_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    if(rc != SQLITE_DONE) {
+        ERRORLOG("SQLite: %s", sqlite3_errstr(rc));
+        return rc;
+    }
+
+    return SQLITE_OK;
+}
+
+void Statement::reset() {
+    if(m_stmt != NULL) {
+        sqlite3_reset(m_stmt);
+    }
+}
+
+int Statement::getInt(int column) {
+    return sqlite3_column_int(m_stmt, column);
+}
+
+int64_t Statement::getInt64(int column) {
+    return sqlite3_column_int64(m_stmt, column);
+}
+
+const char* Statement::getText(int column) {
+    return (const char*)sqlite3_column_text(m_stmt, column);
+}
@@ -0,0 +1,122 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_STATEMENT_H
+#define ROBOTV_STATEMENT_H
+
+#include "database.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace roboTV {
+
+/** @short Prepared SQL statement.
+ * Fetches a prepared statement from the statement cache of the database
+ * and returns it to the cache on destruction. Parameters are bound
+ * instead of formatted into the SQL text.
+ * Queries (SELECT) run on one of the read-only connections.
+ */
+
+class Statement {
+public:
+
+    /** @short Statement constructor.
+     * @param db database
+     * @param sql SQL text with parameters ("?")
+     */
+    Statement(Database& db, const std::string& sql);
+
+    /** @short Statement destructor.
+     * Resets the statement and returns it to the cache.
+     */
+    ~Statement();
+
+    /** @short Check if the statement has been prepared successfully.
+     * @return true - on success
+     */
+    bool isValid() const;
+
+    /** @short Bind a parameter.
+     * @param index index of the parameter (starting at 1)
+     * @param value value to bind
+     * @return reference to the statement
+     */
+    Statement& bind(int index, int value);
+
+    Statement& bind(int index, uint32_t value);
+
+    Statement& bind(int index, int64_t value);
+
+    Statement& bind(int index, const char* value);
+
+    Statement& bind(int index, const std::string& value);
+
+    /** @short Step to the next row.
+     * @return true - if a row is available
+     */
+    bool step();
+
+    /** @short Execute the statement.
+     * Steps through the statement until it's done.
+     * @return the SQLite return code (SQLITE_OK on success).
+     */
+    int exec();
+
+    /** @short Reset the statement.
+     * The statement can be executed again, bound parameters are kept.
+     */
+    void reset();
+
+    int getInt(int column);
+
+    int64_t getInt64(int column);
+
+    const char* getText(int column);
+
+    sqlite3_stmt* get() const {
+        return m_stmt;
+    }
+
+private:
+
+    Database& m_db;
+
+    std::string m_sql;
+
+    sqlite3_stmt* m_stmt;
+
+    bool m_writer;
+
+    // time spent in sqlite3_step (us)
+    uint64_t m_us = 0;
+
+    Statement(const Statement&) = delete;
+
+    Statement& operator=(const Statement&) = delete;
+};
+
+} // namespace roboTV
+
+#endif // ROBOTV_STATEMENT_H
@@ -0,0 +1,177 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "bytescan.h"
+
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static inline int firstBit(uint32_t mask) {
+    return __builtin_ctz(mask);
+}
+
+int findZeroPair(const uint8_t* buffer, int offset, int length) {
+    int i = offset;
+
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+
+    for(; i + 32 < length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(buffer + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(buffer + i + 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero)));
+
+        if(mask != 0) {
+            return i + firstBit(mask);
+        }
+    }
+
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+
+    for(; i + 16 < length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(buffer + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(buffer + i + 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)));
+
+        if(mask != 0) {
+            return i + firstBit(mask);
+        }
+    }
+
+#elif defined(__ARM_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+
+    for(; i + 16 < length; i += 16) {
+        uint8x16_t a = vld1q_u8(buffer + i);
+        uint8x16_t b = vld1q_u8(buffer + i + 1);
+        uint8x16_t eq = vandq_u8(vceqq_u8(a, zero), vceqq_u8(b, zero));
+
+        // 4 bits per byte
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+
+        if(mask != 0) {
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+
+#endif
+
+    // scalar (remaining bytes)
+    while(i + 1 < length) {
+        if(buffer[i + 1] != 0) {
+            i += 2;
+            continue;
+        }
+
+        if(buffer[i] == 0) {
+            return i;
+        }
+
+        i++;
+    }
+
+    return -1;
+}
+
+int findSyncWord(const uint8_t* buffer, int offset, int length, uint16_t syncWord, uint16_t mask) {
+    uint8_t first = syncWord >> 8;
+    uint8_t second = syncWord & mask & 0xFF;
+    uint8_t secondMask = mask & 0xFF;
+    int i = offset;
+
+#if defined(__AVX2__)
+    const __m256i a0 = _mm256_set1_epi8(first);
+    const __m256i b0 = _mm256_set1_epi8(second);
+    const __m256i m0 = _mm256_set1_epi8(secondMask);
+
+    for(; i + 32 < length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(buffer + i));
+        __m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(buffer + i + 1)), m0);
+        uint32_t bits = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, a0), _mm256_cmpeq_epi8(b, b0)));
+
+        if(bits != 0) {
+            return i + firstBit(bits);
+        }
+    }
+
+#elif defined(__SSE2__)
+    const __m128i a0 = _mm_set1_epi8(first);
+    const __m128i b0 = _mm_set1_epi8(second);
+    const __m128i m0 = _mm_set1_epi8(secondMask);
+
+    for(; i + 16 < length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(buffer + i));
+        __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(buffer + i + 1)), m0);
+        uint32_t bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, a0), _mm_cmpeq_epi8(b, b0)));
+
+        if(bits != 0) {
+            return i + firstBit(bits);
+        }
+    }
+
+#elif defined(__ARM_NEON)
+    const uint8x16_t a0 = vdupq_n_u8(first);
+    const uint8x16_t b0 = vdupq_n_u8(second);
+    const uint8x16_t m0 = vdupq_n_u8(secondMask);
+
+    for(; i + 16 < length; i += 16) {
+        uint8x16_t a = vld1q_u8(buffer + i);
+        uint8x16_t b = vandq_u8(vld1q_u8(buffer + i + 1), m0);
+        uint8x16_t eq = vandq_u8(vceqq_u8(a, a0), vceqq_u8(b, b0));
+
+        // 4 bits per byte
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+
+        if(bits != 0) {
+            return i + (__builtin_ctzll(bits) >> 2);
+        }
+    }
+
+#endif
+
+    // scalar (remaining bytes)
+    while(i + 1 < length) {
+        const uint8_t* p = (const uint8_t*)memchr(buffer + i, first, length - 1 - i);
+
+        if(p == NULL) {
+            break;
+        }
+
+        i = p - buffer;
+
+        if((buffer[i + 1] & secondMask) == second) {
+            return i;
+        }
+
+        i++;
+    }
+
+    return -1;
+}
@@ -0,0 +1,53 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_BYTESCAN_H
+#define ROBOTV_BYTESCAN_H
+
+#include <stdint.h>
+
+/**
+ * Find two consecutive zero bytes.
+ * Uses SSE2 / AVX2 / NEON if available (scalar fallback otherwise).
+ * @param buffer data to search
+ * @param offset start offset
+ * @param length length of the buffer
+ * @return offset of the first zero byte of the pair or -1 if not found
+ */
+int findZeroPair(const uint8_t* buffer, int offset, int length);
+
+/**
+ * Find a 16 bit sync word.
+ * The first byte of the sync word must match exactly, the second byte
+ * is compared with the lower byte of the mask applied.
+ * @param buffer data to search
+ * @param offset start offset
+ * @param length length of the buffer
+ * @param syncWord sync word (e.g. 0x0B77)
+ * @param mask mask for the sync word (e.g. 0xFFF0), upper byte must be 0xFF
+ * @return offset of the sync word or -1 if not found
+ */
+int findSyncWord(const uint8_t* buffer, int offset, int length, uint16_t syncWord, uint16_t mask);
+
+#endif // ROBOTV_BYTESCAN_H
@@ -24,8 +24,11 @@
 
 #include <vdr/remux.h>
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
 #include "config/config.h"
-#include "live/livestreamer.h"
 #include "parser.h"
 #include "pes.h"
 #include "demuxer_LATM.h"
@@ -36,16 +39,98 @@
 #include "demuxer_MPEGAudio.h"
 #include "demuxer_MPEGVideo.h"
 #include "demuxer_Subtitle.h"
+#include "tools/metrics.h"
+#include "tools/tracepoints.h"
 
 #define DVD_TIME_BASE 1000000
 
+// every n-th TS packet is timed to estimate the parser load
+#define DEMUXER_TIMING_INTERVAL 16
+
+// parser statistics are published every n TS packets
+#define DEMUXER_PUBLISH_INTERVAL 1024
+
+// parser statistics per stream type (all demuxers)
+struct ParserStats {
+    std::atomic<uint64_t> packets;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> sampledPackets;
+    std::atomic<uint64_t> sampledNs;
+};
+
+static ParserStats parserStats[StreamInfo::stH265 + 1];
+
+static const char* parserNames[] = {
+    "NONE", "MPEG2AUDIO", "AC3", "EAC3", "ADTS", "LATM", "MPEG2VIDEO", "H264", "DVBSUB", "TELETEXT", "H265"
+};
+
+void TsDemuxer::registerStats() {
+    static std::once_flag registered;
+
+    std::call_once(registered, []() {
+        Metrics::instance().add(parserStats, "demuxers", []() {
+            nlohmann::json j = nlohmann::json::object();
+
+            for(int i = StreamInfo::stMPEG2AUDIO; i <= StreamInfo::stH265; i++) {
+                ParserStats& s = parserStats[i];
+                uint64_t packets = s.packets;
+                uint64_t sampledPackets = s.sampledPackets;
+
+                uint64_t bufferBytes = Parser::getBufferBytes((StreamInfo::Type)i);
+
+                if(packets == 0 || sampledPackets == 0) {
+                    if(bufferBytes > 0) {
+                        j[parserNames[i]] = {{"bufferBytes", bufferBytes}};
+                    }
+
+                    continue;
+                }
+
+                // extrapolate the processing time from the timed packets
+                double seconds = ((double)s.sampledNs * packets / sampledPackets) / 1e9;
+
+                j[parserNames[i]] = {
+                    {"packets", packets},
+                    {"bytes", (uint64_t)s.bytes},
+                    {"busyMs", (uint64_t)(seconds * 1000)},
+                    {"mbPerSecond", (seconds > 0) ? (s.bytes / seconds) / (1024 * 1024) : 0},
+                    {"packetsPerSecond", (seconds > 0) ? (uint64_t)(packets / seconds) : 0},
+                    {"bufferBytes", bufferBytes}
+                };
+            }
+
+            return j;
+        });
+    });
+}
+
+void TsDemuxer::publishStats() const {
+    if(m_type <= stNONE || m_type > stH265 || m_statPackets == 0) {
+        return;
+    }
+
+    ParserStats& s = parserStats[m_type];
+
+    s.packets.fetch_add(m_statPackets, std::memory_order_relaxed);
+    s.bytes.fetch_add(m_statBytes, std::memory_order_relaxed);
+    s.sampledPackets.fetch_add(m_statSampledPackets, std::memory_order_relaxed);
+    s.sampledNs.fetch_add(m_statSampledNs, std::memory_order_relaxed);
+
+    m_statPackets = 0;
+    m_statBytes = 0;
+    m_statSampledPackets = 0;
+    m_statSampledNs = 0;
+}
+
 TsDemuxer::TsDemuxer(TsDemuxer::Listener* streamer, const StreamInfo& info) : StreamInfo(info), m_streamer(streamer) {
     m_pesParser = createParser(m_type);
     setContent();
+    registerStats();
 }
 
 TsDemuxer::TsDemuxer(TsDemuxer::Listener* streamer, StreamInfo::Type type, int pid) : StreamInfo(pid, type), m_streamer(streamer) {
     m_pesParser = createParser(m_type);
+    registerStats();
 }
 
 Parser* TsDemuxer::createParser(StreamInfo::Type type) {
@@ -90,6 +175,7 @@ Parser* TsDemuxer::createParser(StreamInfo::Type type) {
 }
 
 TsDemuxer::~TsDemuxer() {
+    publishStats();
     delete m_pesParser;
 }
 
@@ -116,6 +202,7 @@ void TsDemuxer::sendPacket(StreamPacket* pkt) {
     pkt->pts      = pts;
     pkt->duration = rescale(pkt->duration);
 
+    ROBOTV_TRACE5(demuxer_packet, pkt->pid, (int)pkt->content, (int)pkt->frameType, pkt->size, pkt->rawPts);
     m_streamer->sendStreamPacket(pkt);
 }
 
@@ -155,8 +242,25 @@ bool TsDemuxer::processTsPacket(unsigned char* data) const {
     }
 
     /* Parse the data */
-    if(m_pesParser) {
+    if(m_pesParser == NULL) {
+        return true;
+    }
+
+    m_statBytes += TS_SIZE;
+
+    if((++m_statPackets % DEMUXER_TIMING_INTERVAL) != 0) {
         m_pesParser->parse(data, bytes, pusi);
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    m_pesParser->parse(data, bytes, pusi);
+
+    m_statSampledNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    m_statSampledPackets++;
+
+    if(m_statPackets >= DEMUXER_PUBLISH_INTERVAL) {
+        publishStats();
     }
 
     return true;
@@ -201,6 +305,7 @@ void TsDemuxer::setVideoInformation(int FpsScale, int FpsRate, int Height, int W
     m_width    = Width;
     m_aspect   = Aspect;
     m_parsed   = true;
+    m_revision++;
 
     m_streamer->requestStreamChange();
 }
@@ -228,24 +333,29 @@ void TsDemuxer::setAudioInformation(int Channels, int SampleRate, int BitRate, i
     m_bitRate       = BitRate;
     m_bitsPerSample = BitsPerSample;
     m_parsed        = true;
+    m_revision++;
 
     m_streamer->requestStreamChange();
 }
 
 void TsDemuxer::setVideoDecoderData(uint8_t* sps, int spsLength, uint8_t* pps, int ppsLength, uint8_t* vps, int vpsLength) {
-    if(sps != NULL) {
+    // decoder data is repeated with every keyframe, count changes only
+    if(sps != NULL && (spsLength != m_spsLength || memcmp(m_sps, sps, spsLength) != 0)) {
         m_spsLength = spsLength;
         memcpy(m_sps, sps, spsLength);
+        m_revision++;
     }
 
-    if(pps != NULL) {
+    if(pps != NULL && (ppsLength != m_ppsLength || memcmp(m_pps, pps, ppsLength) != 0)) {
         m_ppsLength = ppsLength;
         memcpy(m_pps, pps, ppsLength);
+        m_revision++;
     }
 
-    if(vps != NULL) {
+    if(vps != NULL && (vpsLength != m_vpsLength || memcmp(m_vps, vps, vpsLength) != 0)) {
         m_vpsLength = vpsLength;
         memcpy(m_vps, vps, vpsLength);
+        m_revision++;
     }
 }
 
@@ -167,6 +167,11 @@ public:
 
     uint8_t* getVideoDecoderVps(int& length);
 
+    /** Revision of the stream information (incremented on every change) */
+    uint32_t getRevision() const {
+        return m_revision;
+    }
+
 protected:
 
     void sendPacket(StreamPacket* pkt);
@@ -177,6 +182,21 @@ private:
 
     Parser* createParser(StreamInfo::Type type);
 
+    /** Add the pending parser statistics to the totals of the stream type */
+    void publishStats() const;
+
+    static void registerStats();
+
+    mutable uint64_t m_statPackets = 0;
+
+    mutable uint64_t m_statBytes = 0;
+
+    mutable uint64_t m_statSampledPackets = 0;
+
+    mutable uint64_t m_statSampledNs = 0;
+
+    uint32_t m_revision = 0;
+
 };
 
 #endif // ROBOTV_DEMUXER_H
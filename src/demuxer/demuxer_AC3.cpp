@@ -25,8 +25,10 @@
 #include "demuxer_AC3.h"
 #include "ac3common.h"
 
-ParserAc3::ParserAc3(TsDemuxer* demuxer) : Parser(demuxer, 64 * 1024, 4096) {
+ParserAc3::ParserAc3(TsDemuxer* demuxer) : FrameParser<ParserAc3>(demuxer, 64 * 1024, 4096) {
     m_headerSize = AC3_HEADER_SIZE;
+    m_syncWord = 0x0B77;
+    m_syncMask = 0xFFFF;
     m_enhanced = false;
 }
 
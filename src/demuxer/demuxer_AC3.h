@@ -25,15 +25,17 @@
 #ifndef ROBOTV_DEMUXER_AC3_H
 #define ROBOTV_DEMUXER_AC3_H
 
-#include "parser.h"
+#include "frameparser.h"
 
-class ParserAc3 : public Parser {
+class ParserAc3 final : public FrameParser<ParserAc3> {
 public:
 
     ParserAc3(TsDemuxer* demuxer);
 
 protected:
 
+    friend class FrameParser<ParserAc3>;
+
     int parsePayload(unsigned char* payload, int length);
 
     bool checkAlignmentHeader(unsigned char* buffer, int& framesize);
@@ -25,8 +25,10 @@
 #include "demuxer_ADTS.h"
 #include "aaccommon.h"
 
-ParserAdts::ParserAdts(TsDemuxer* demuxer) : Parser(demuxer, 64 * 1024, 8192) {
+ParserAdts::ParserAdts(TsDemuxer* demuxer) : FrameParser<ParserAdts>(demuxer, 64 * 1024, 8192) {
     m_headerSize = 9; // header is 9 bytes long (with CRC)
+    m_syncWord = 0xFFF0; // sync + layer 0
+    m_syncMask = 0xFFF6;
 }
 
 bool ParserAdts::ParseAudioHeader(uint8_t* buffer, int& channels, int& samplerate, int& framesize) {
@@ -48,7 +50,8 @@ bool ParserAdts::ParseAudioHeader(uint8_t* buffer, int& channels, int& samplerat
     bs.SkipBits(2); // AOT
     int samplerateindex = bs.GetBits(4); // sample rate index
 
-    if(samplerateindex == 15) {
+    // 13 - 15 are reserved / invalid in ADTS headers
+    if(samplerateindex > 12) {
         return false;
     }
 
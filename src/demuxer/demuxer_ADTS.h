@@ -25,15 +25,17 @@
 #ifndef ROBOTV_DEMUXER_ADTS_H
 #define ROBOTV_DEMUXER_ADTS_H
 
-#include "parser.h"
+#include "frameparser.h"
 
-class ParserAdts : public Parser {
+class ParserAdts final : public FrameParser<ParserAdts> {
 public:
 
     ParserAdts(TsDemuxer* demuxer);
 
 protected:
 
+    friend class FrameParser<ParserAdts>;
+
     int parsePayload(unsigned char* payload, int length);
 
     bool checkAlignmentHeader(unsigned char* buffer, int& framesize);
@@ -24,6 +24,10 @@
 
 #include "config/config.h"
 #include "demuxer_H264.h"
+#include "bytescan.h"
+
+#include <string.h>
+#include <algorithm>
 
 // H264 profiles
 #define PROFILE_BASELINE  66
@@ -35,6 +39,9 @@
 #define PROFILE_HI444     244
 #define PROFILE_CAVLC444   44
 
+// slice header bytes needed to get the slice type
+#define SLH_PREFIX_SIZE 32
+
 // NAL SPS ID
 #define NAL_SLH 0x01
 #define NAL_SEI 0x06
@@ -99,6 +106,45 @@ uint8_t* ParserH264::extractNal(uint8_t* packet, int length, int nal_offset, int
     return nal_data;
 }
 
+bool ParserH264::nalChanged(uint8_t* packet, int length, int nal_offset, std::vector<uint8_t>& last) {
+    int e = findStartCode(packet, length, nal_offset, 0x00000001);
+
+    if(e == -1) {
+        e = length;
+    }
+
+    int l = e - nal_offset;
+
+    if(l <= 0) {
+        return true;
+    }
+
+    if(l == (int)last.size() && memcmp(last.data(), packet + nal_offset, l) == 0) {
+        return false;
+    }
+
+    last.assign(packet + nal_offset, packet + e);
+    return true;
+}
+
+int ParserH264::extractNal(uint8_t* packet, int length, int nal_offset, uint8_t* dst, int maxLength) {
+    // only search the end of the NAL unit within the prefix
+    int end = std::min(length, nal_offset + maxLength);
+    int e = findStartCode(packet, end, nal_offset, 0x00000001);
+
+    if(e == -1) {
+        e = end;
+    }
+
+    int l = e - nal_offset;
+
+    if(l <= 0) {
+        return 0;
+    }
+
+    return nalUnescape(dst, packet + nal_offset, l);
+}
+
 int ParserH264::parsePayload(unsigned char* data, int length) {
     int o = 0;
     int sps_start = -1;
@@ -122,11 +168,11 @@ int ParserH264::parsePayload(unsigned char* data, int length) {
         // NAL_SLH
         if(nal_type == NAL_SLH && length - o > 1) {
             o++;
-            uint8_t* nal_data = extractNal(data, length, o, nal_len);
+            uint8_t slh[SLH_PREFIX_SIZE];
+            int slh_len = extractNal(data, length, o, slh, sizeof(slh));
 
-            if(nal_data != NULL) {
-                parseSlh(nal_data, nal_len);
-                delete[] nal_data;
+            if(slh_len > 0) {
+                parseSlh(slh, slh_len);
             }
         }
 
@@ -148,8 +194,8 @@ int ParserH264::parsePayload(unsigned char* data, int length) {
         }
     }
 
-    // extract and register PPS data (decoder specific data)
-    if(pps_start != -1) {
+    // extract and register changed PPS data (decoder specific data)
+    if(pps_start != -1 && nalChanged(data, length, pps_start, m_lastPps)) {
         uint8_t* pps_data = extractNal(data, length, pps_start, nal_len);
 
         if(pps_data != NULL) {
@@ -163,6 +209,13 @@ int ParserH264::parsePayload(unsigned char* data, int length) {
         return length;
     }
 
+    // skip repeated SPS (usually sent with every GOP)
+    bool changed = nalChanged(data, length, sps_start, m_lastSps);
+
+    if(!changed && m_demuxer->isParsed()) {
+        return length;
+    }
+
     // extract SPS
     uint8_t* nal_data = extractNal(data, length, sps_start, nal_len);
 
@@ -192,20 +245,33 @@ int ParserH264::parsePayload(unsigned char* data, int length) {
 }
 
 int ParserH264::nalUnescape(uint8_t* dst, const uint8_t* src, int len) {
-    int s = 0, d = 0;
+    int s = 0, d = 0, p = 0;
 
-    while(s < len) {
-        if(s >= 2 && s < len - 1) {
-            // hit 00 00 03 ?
-            if(src[s - 2] == 0 && src[s - 1] == 0 && src[s] == 3) {
-                s++; // skip 03
-            }
+    // copy runs between 00 00 03 sequences
+    while((p = findZeroPair(src, p, len)) >= 0) {
+        int e = p + 2;
+
+        // trailing 03 is kept
+        if(e >= len - 1) {
+            break;
         }
 
-        dst[d++] = src[s++];
+        // hit 00 00 03 ?
+        if(src[e] != 3) {
+            p++;
+            continue;
+        }
+
+        memcpy(dst + d, src + s, e - s);
+        d += e - s;
+
+        // skip 03
+        s = e + 1;
+        p = s;
     }
 
-    return d;
+    memcpy(dst + d, src + s, len - s);
+    return d + len - s;
 }
 
 void ParserH264::parseSlh(uint8_t* buf, int len) {
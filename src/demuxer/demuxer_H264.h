@@ -28,6 +28,8 @@
 #include "demuxer_PES.h"
 #include "vdr/tools.h"
 
+#include <vector>
+
 class ParserH264 : public ParserPes {
 public:
 
@@ -47,8 +49,23 @@ protected:
 
     uint8_t* extractNal(uint8_t* packet, int length, int nal_offset, int& nal_len);
 
+    /** Extract the prefix of a NAL unit.
+     @param dst destination buffer (at least maxLength bytes)
+     @param maxLength number of (escaped) bytes to extract at most
+     @return length of the unescaped prefix
+     */
+    int extractNal(uint8_t* packet, int length, int nal_offset, uint8_t* dst, int maxLength);
+
     int nalUnescape(uint8_t* dst, const uint8_t* src, int len);
 
+    /** Check a parameter set for a change.
+     The escaped NAL data is compared with the last one seen, so repeated
+     parameter sets are neither unescaped nor parsed again.
+     @param last escaped data of the last parameter set (updated on a change)
+     @return true if the parameter set changed
+     */
+    bool nalChanged(uint8_t* packet, int length, int nal_offset, std::vector<uint8_t>& last);
+
     uint32_t readGolombUe(cBitStream* bs);
 
     int32_t readGolombSe(cBitStream* bs);
@@ -57,6 +74,10 @@ protected:
 
     int m_rate;
 
+    std::vector<uint8_t> m_lastSps;
+
+    std::vector<uint8_t> m_lastPps;
+
 private:
 
     bool parseSps(uint8_t* buf, int len, pixel_aspect_t& pixel_aspect, int& width, int& height);
@@ -69,6 +69,11 @@ int ParserH265::parsePayload(unsigned char* data, int length) {
         // PPS_NUT
         if(nal_type == PPS_NUT && length - o > 1) {
             o++;
+
+            if(!nalChanged(data, length, o, m_lastPps)) {
+                continue;
+            }
+
             uint8_t* pps_data = extractNal(data, length, o, nal_len);
 
             if(pps_data != NULL) {
@@ -80,6 +85,11 @@ int ParserH265::parsePayload(unsigned char* data, int length) {
         // VPS_NUT
         else if(nal_type == VPS_NUT && length - o > 1) {
             o++;
+
+            if(!nalChanged(data, length, o, m_lastVps)) {
+                continue;
+            }
+
             uint8_t* vps_data = extractNal(data, length, o, nal_len);
 
             if(vps_data != NULL) {
@@ -100,6 +110,13 @@ int ParserH265::parsePayload(unsigned char* data, int length) {
         return length;
     }
 
+    // skip repeated SPS (usually sent with every GOP)
+    bool changed = nalChanged(data, length, sps_start, m_lastSps);
+
+    if(!changed && m_demuxer->isParsed()) {
+        return length;
+    }
+
     // extract SPS
     uint8_t* nal_data = extractNal(data, length, sps_start, nal_len);
 
@@ -42,6 +42,8 @@ private:
 
     bool parseSps(uint8_t* buf, int len, pixel_aspect_t& pixel_aspect, int& width, int& height);
 
+    std::vector<uint8_t> m_lastVps;
+
 };
 
 
@@ -44,7 +44,9 @@ static void putBits(uint8_t* buffer, int& offset, int val, int num) {
     }
 }
 
-ParserLatm::ParserLatm(TsDemuxer* demuxer) : Parser(demuxer, 64 * 1024, 8192) { //, m_framelength(0)
+ParserLatm::ParserLatm(TsDemuxer* demuxer) : FrameParser<ParserLatm>(demuxer, 64 * 1024, 8192) { //, m_framelength(0)
+    m_syncWord = 0x56E0; // 0x2B7 (11 bits)
+    m_syncMask = 0xFFE0;
 }
 
 bool ParserLatm::checkAlignmentHeader(unsigned char* buffer, int& framesize) {
@@ -211,7 +213,8 @@ void ParserLatm::readAudioSpecificConfig(cBitStream* bs) {
 
     m_sampleRateIndex = bs->GetBits(4);
 
-    if(m_sampleRateIndex == 0xf) {
+    // explicit sample rate (0xf) or reserved
+    if(m_sampleRateIndex > 12) {
         return;
     }
 
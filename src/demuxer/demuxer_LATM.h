@@ -25,17 +25,19 @@
 #ifndef ROBOTV_DEMUXER_LATM_H
 #define ROBOTV_DEMUXER_LATM_H
 
-#include "parser.h"
+#include "frameparser.h"
 
 class cBitStream;
 
-class ParserLatm : public Parser {
+class ParserLatm final : public FrameParser<ParserLatm> {
 public:
 
     ParserLatm(TsDemuxer* demuxer);
 
 protected:
 
+    friend class FrameParser<ParserLatm>;
+
     int parsePayload(unsigned char* data, int len);
 
     void sendPayload(unsigned char* payload, int length);
@@ -25,17 +25,19 @@
 #ifndef ROBOTV_DEMUXER_MPEGAUDIO_H
 #define ROBOTV_DEMUXER_MPEGAUDIO_H
 
-#include "parser.h"
+#include "frameparser.h"
 
 // --- ParserMpeg2Audio -------------------------------------------------
 
-class ParserMpeg2Audio : public Parser {
+class ParserMpeg2Audio final : public FrameParser<ParserMpeg2Audio> {
 public:
 
     ParserMpeg2Audio(TsDemuxer* demuxer);
 
 protected:
 
+    friend class FrameParser<ParserMpeg2Audio>;
+
     int parsePayload(unsigned char* payload, int length);
 
     bool checkAlignmentHeader(unsigned char* buffer, int& framesize);
@@ -71,6 +71,19 @@ void ParserPes::parse(unsigned char* data, int size, bool pusi) {
 
         // reset buffer
         Clear();
+
+        // the complete payload is inside this TS packet -> send it without copy
+        if(m_length > 0 && size >= m_length) {
+            int len = parsePayload(data, m_length);
+            sendPayload(data, len);
+
+            m_curDts = DVD_NOPTS_VALUE;
+            m_curPts = DVD_NOPTS_VALUE;
+
+            // wait for the next packet
+            m_startup = true;
+            return;
+        }
     }
 
     // we start with the beginning of a packet
@@ -24,16 +24,32 @@
 
 #include "config/config.h"
 #include "demuxerbundle.h"
+#include "demuxerworker.h"
 
-DemuxerBundle::DemuxerBundle(TsDemuxer::Listener* listener) : m_listener(listener) {
+#include <string.h>
+
+DemuxerBundle::DemuxerBundle(TsDemuxer::Listener* listener) : m_listener(listener), m_serializedListener(listener), m_workerStalls(0) {
+    memset(m_slots, 0, sizeof(m_slots));
+
+    for(int i = 0; i < MAXPID; i++) {
+        m_muted[i] = false;
+    }
+
+    updatePidTable();
 }
 
 DemuxerBundle::~DemuxerBundle() {
     clear();
+
+    for(auto& entry : m_cache) {
+        delete entry.packet;
+    }
 }
 
 
 void DemuxerBundle::clear() {
+    stopWorkers();
+
     for(auto i = begin(); i != end(); i++) {
         if((*i) != NULL) {
             DEBUGLOG("Deleting stream demuxer for pid=%i and type=%i", (*i)->getPid(), (*i)->getType());
@@ -41,42 +57,132 @@ void DemuxerBundle::clear() {
         }
     }
 
-    std::list<TsDemuxer*>::clear();
+    std::vector<TsDemuxer*>::clear();
+    updatePidTable();
 }
 
-TsDemuxer* DemuxerBundle::findDemuxer(int Pid) const {
+void DemuxerBundle::updatePidTable() {
+    // the streams changed
+    m_revision++;
+
+    memset(m_pidSlot, 0, sizeof(m_pidSlot));
+    memset(m_slots, 0, sizeof(m_slots));
+
+    int slot = 1;
+
+    // the first demuxer of a pid wins
     for(auto i = begin(); i != end(); i++) {
-        if((*i) != NULL && (*i)->getPid() == Pid) {
-            return (*i);
+        TsDemuxer* dmx = *i;
+
+        if(dmx == NULL || dmx->getPid() < 0 || dmx->getPid() >= MAXPID || m_pidSlot[dmx->getPid()] != 0) {
+            continue;
+        }
+
+        if(slot >= MaxSlots) {
+            ERRORLOG("too many streams (only %i streams are demuxed)", MaxSlots - 1);
+            break;
         }
+
+        m_slots[slot].demuxer = dmx;
+        m_pidSlot[dmx->getPid()] = slot++;
     }
 
-    return NULL;
+    // the workers stay with their streams (if the streams are reordered)
+    for(auto w : m_workers) {
+        int pid = w->getDemuxer()->getPid();
+
+        if(m_pidSlot[pid] != 0) {
+            m_slots[m_pidSlot[pid]].worker = w;
+        }
+    }
 }
 
-void DemuxerBundle::reorderStreams(int lang, StreamInfo::Type type) {
-    std::map<uint32_t, TsDemuxer*> weight;
+void DemuxerBundle::setParallel(bool parallel) {
+    m_parallel = parallel;
+}
 
-    // compute weights
-    int i = 0;
+void DemuxerBundle::setChannelUid(uint32_t channelUid) {
+    m_channelUid = channelUid;
+}
 
-    for(auto idx = begin(); idx != end(); idx++, i++) {
-        TsDemuxer* stream = (*idx);
+void DemuxerBundle::setMuted(const std::set<int>& pids) {
+    for(int i = 0; i < MAXPID; i++) {
+        m_muted[i] = (pids.find(i) != pids.end());
+    }
+}
 
-        if(stream == NULL) {
+uint64_t DemuxerBundle::getWorkerStalls() const {
+    return m_workerStalls;
+}
+
+void DemuxerBundle::startWorkers() {
+    if(!m_parallel) {
+        return;
+    }
+
+    for(int i = 1; i < MaxSlots && m_slots[i].demuxer != NULL; i++) {
+        if(m_slots[i].worker != NULL) {
             continue;
         }
 
-        // 32bit weight:
-        // V0000000ASLTXXXXPPPPPPPPPPPPPPPP
-        //
-        // VIDEO (V):      0x80000000
-        // AUDIO (A):      0x00800000
-        // SUBTITLE (S):   0x00400000
-        // LANGUAGE (L):   0x00200000
-        // STREAMTYPE (T): 0x00100000 (only audio)
-        // AUDIOTYPE (X):  0x000F0000 (only audio)
-        // PID (P):        0x0000FFFF
+        DemuxerWorker* worker = new DemuxerWorker(m_slots[i].demuxer, m_workerStalls, m_channelUid);
+        m_slots[i].worker = worker;
+        m_workers.push_back(worker);
+    }
+
+    INFOLOG("parallel demuxing with %lu workers", (unsigned long)m_workers.size());
+}
+
+void DemuxerBundle::stopWorkers() {
+    for(auto w : m_workers) {
+        delete w;
+    }
+
+    m_workers.clear();
+
+    for(int i = 0; i < MaxSlots; i++) {
+        m_slots[i].worker = NULL;
+    }
+}
+
+DemuxerBundle::SerializedListener::SerializedListener(TsDemuxer::Listener* listener) : m_listener(listener) {
+}
+
+void DemuxerBundle::SerializedListener::sendStreamPacket(StreamPacket* p) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listener->sendStreamPacket(p);
+}
+
+void DemuxerBundle::SerializedListener::requestStreamChange() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_listener->requestStreamChange();
+}
+
+TsDemuxer* DemuxerBundle::findDemuxer(int Pid) const {
+    if(Pid < 0 || Pid >= MAXPID) {
+        return NULL;
+    }
+
+    return m_slots[m_pidSlot[Pid]].demuxer;
+}
+
+void DemuxerBundle::reorderStreams(int lang, StreamInfo::Type type) {
+    std::vector<TsDemuxer*> ordered = orderedStreams(lang, type);
+    std::vector<TsDemuxer*>::swap(ordered);
+    updatePidTable();
+}
+
+uint32_t DemuxerBundle::streamWeight(int pid, StreamInfo::Content content, StreamInfo::Type streamType, int audioType, const char* language, int lang, StreamInfo::Type type) {
+    // 32bit weight:
+    // V0000000ASLTXXXXPPPPPPPPPPPPPPPP
+    //
+    // VIDEO (V):      0x80000000
+    // AUDIO (A):      0x00800000
+    // SUBTITLE (S):   0x00400000
+    // LANGUAGE (L):   0x00200000
+    // STREAMTYPE (T): 0x00100000 (only audio)
+    // AUDIOTYPE (X):  0x000F0000 (only audio)
+    // PID (P):        0x0000FFFF
 
 #define VIDEO_MASK      0x80000000
 #define AUDIO_MASK      0x00800000
@@ -86,50 +192,66 @@ void DemuxerBundle::reorderStreams(int lang, StreamInfo::Type type) {
 #define AUDIOTYPE_MASK  0x000F0000
 #define PID_MASK        0x0000FFFF
 
-        // last resort ordering, the PID
-        uint32_t w = 0xFFFF - (stream->getPid() & PID_MASK);
+    // last resort ordering, the PID
+    uint32_t w = 0xFFFF - (pid & PID_MASK);
+
+    // stream type weights
+    switch(content) {
+        case StreamInfo::scVIDEO:
+            w |= VIDEO_MASK;
+            break;
+
+        case StreamInfo::scAUDIO:
+            w |= AUDIO_MASK;
 
-        // stream type weights
-        switch(stream->getContent()) {
-            case StreamInfo::scVIDEO:
-                w |= VIDEO_MASK;
-                break;
+            // weight of audio stream type
+            w |= (streamType == type) ? STREAMTYPE_MASK : 0;
 
-            case StreamInfo::scAUDIO:
-                w |= AUDIO_MASK;
+            // weight of audio type
+            w |= ((4 - audioType) << 16) & AUDIOTYPE_MASK;
+            break;
 
-                // weight of audio stream type
-                w |= (stream->getType() == type) ? STREAMTYPE_MASK : 0;
+        case StreamInfo::scSUBTITLE:
+            w |= SUBTITLE_MASK;
+            break;
 
-                // weight of audio type
-                w |= ((4 - stream->getAudioType()) << 16) & AUDIOTYPE_MASK;
-                break;
+        default:
+            break;
+    }
+
+    // weight of language
+    int streamLangIndex = I18nLanguageIndex(language);
+    w |= (streamLangIndex == lang) ? LANGUAGE_MASK : 0;
+
+    return w;
+}
+
+std::vector<TsDemuxer*> DemuxerBundle::orderedStreams(int lang, StreamInfo::Type type) const {
+    std::map<uint32_t, TsDemuxer*> weight;
+    std::vector<TsDemuxer*> ordered;
 
-            case StreamInfo::scSUBTITLE:
-                w |= SUBTITLE_MASK;
-                break;
+    // compute weights
+    for(auto idx = begin(); idx != end(); idx++) {
+        TsDemuxer* stream = (*idx);
 
-            default:
-                break;
+        if(stream == NULL) {
+            continue;
         }
 
-        // weight of language
-        int streamLangIndex = I18nLanguageIndex(stream->getLanguage());
-        w |= (streamLangIndex == lang) ? LANGUAGE_MASK : 0;
+        uint32_t w = streamWeight(stream->getPid(), stream->getContent(), stream->getType(), stream->getAudioType(), stream->getLanguage(), lang, type);
 
         // summed weight
         weight[w] = stream;
     }
 
-    // reorder streams on weight
-    int idx = 0;
-    std::list<TsDemuxer*>::clear();
-
-    for(std::map<uint32_t, TsDemuxer*>::reverse_iterator i = weight.rbegin(); i != weight.rend(); i++, idx++) {
+    // order streams on weight
+    for(auto i = weight.rbegin(); i != weight.rend(); i++) {
         TsDemuxer* stream = i->second;
         DEBUGLOG("Stream : Type %s / %s Weight: %08X", stream->typeName(), stream->getLanguage(), i->first);
-        push_back(stream);
+        ordered.push_back(stream);
     }
+
+    return ordered;
 }
 
 bool DemuxerBundle::isReady() const {
@@ -146,13 +268,15 @@ bool DemuxerBundle::isReady() const {
 void DemuxerBundle::updateFrom(StreamBundle* bundle) {
     StreamBundle old;
 
+    stopWorkers();
+
     // remove old demuxers
     for(auto i = begin(); i != end(); i++) {
         old.addStream(*(*i));
         delete *i;
     }
 
-    std::list<TsDemuxer*>::clear();
+    std::vector<TsDemuxer*>::clear();
 
     // create new stream demuxers
     for(auto i = bundle->begin(); i != bundle->end(); i++) {
@@ -164,100 +288,277 @@ void DemuxerBundle::updateFrom(StreamBundle* bundle) {
             infonew = infoold;
         }
 
-        TsDemuxer* dmx = new TsDemuxer(m_listener, infonew);
+        // stream information is written by the worker of the stream before it
+        // requests the stream change (through the serialized listener)
+        TsDemuxer* dmx = new TsDemuxer(m_parallel ? &m_serializedListener : m_listener, infonew);
 
         if(dmx != NULL) {
             push_back(dmx);
             dmx->info();
         }
     }
+
+    updatePidTable();
+    startWorkers();
 }
 
 bool DemuxerBundle::processTsPacket(uint8_t* packet) const {
     unsigned int ts_pid = TsPid(packet);
-    TsDemuxer* demuxer = findDemuxer(ts_pid);
+    const Slot& slot = m_slots[m_pidSlot[ts_pid]];
+    TsDemuxer* demuxer = slot.demuxer;
 
     if(demuxer == NULL) {
         return false;
     }
 
+    // muted streams are parsed until the stream information is complete
+    if(m_muted[ts_pid] && demuxer->isParsed()) {
+        return true;
+    }
+
+    if(slot.worker != NULL) {
+        slot.worker->put(packet);
+        return true;
+    }
+
     return demuxer->processTsPacket(packet);
 }
 
+int DemuxerBundle::processTsBuffer(const uint8_t* data, int length) const {
+    int offset = 0;
+
+    while(offset + TS_SIZE <= length) {
+        const uint8_t* packet = data + offset;
+
+        // lost packet alignment -> resync
+        if(packet[0] != TS_SYNC_BYTE) {
+            const uint8_t* sync = (const uint8_t*)memchr(packet + 1, TS_SYNC_BYTE, length - offset - 1);
+
+            if(sync == NULL) {
+                return length;
+            }
+
+            offset = sync - data;
+            continue;
+        }
+
+        int pid = TsPid(packet);
+        offset += TS_SIZE;
+
+        // most packets of a transponder are not demuxed
+        int slot = m_pidSlot[pid];
+
+        if(slot == 0) {
+            continue;
+        }
+
+        TsDemuxer* demuxer = m_slots[slot].demuxer;
+
+        // muted streams are parsed until the stream information is complete
+        if(m_muted[pid] && demuxer->isParsed()) {
+            continue;
+        }
+
+        // the demuxers do not modify the packet data
+        if(m_slots[slot].worker != NULL) {
+            m_slots[slot].worker->put(packet);
+        }
+        else {
+            demuxer->processTsPacket((uint8_t*)packet);
+        }
+    }
+
+    return offset;
+}
+
 MsgPacket* DemuxerBundle::createStreamChangePacket(int protocolVersion) {
+    return cachedStreamChangePacket(false, -1, StreamInfo::stNONE, protocolVersion);
+}
+
+MsgPacket* DemuxerBundle::createStreamChangePacket(int lang, StreamInfo::Type type, int protocolVersion) const {
+    return cachedStreamChangePacket(true, lang, type, protocolVersion);
+}
+
+uint64_t DemuxerBundle::getSignature() const {
+    uint64_t revisions = 0;
+
+    for(auto i = begin(); i != end(); i++) {
+        revisions += (*i)->getRevision();
+    }
+
+    return ((uint64_t)m_revision << 32) + revisions;
+}
+
+MsgPacket* DemuxerBundle::cachedStreamChangePacket(bool ordered, int lang, StreamInfo::Type type, int protocolVersion) const {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+    uint64_t signature = getSignature();
+    CacheEntry* entry = NULL;
+
+    for(auto i = m_cache.begin(); i != m_cache.end();) {
+        // drop outdated packets
+        if(i->signature != signature) {
+            delete i->packet;
+            i = m_cache.erase(i);
+            continue;
+        }
+
+        if(i->ordered == ordered && i->protocolVersion == protocolVersion && (!ordered || (i->lang == lang && i->type == type))) {
+            entry = &(*i);
+        }
+
+        i++;
+    }
+
+    if(entry == NULL) {
+        MsgPacket* packet = ordered ? createStreamChangePacket(orderedStreams(lang, type), protocolVersion) : createStreamChangePacket(*this, protocolVersion);
+        m_cache.push_back({ordered, lang, type, protocolVersion, signature, packet});
+        entry = &m_cache.back();
+    }
+
+    // the cached packet stays with the bundle
+    MsgPacket* resp = new MsgPacket(ROBOTV_STREAM_CHANGE, ROBOTV_CHANNEL_STREAM);
+    resp->put_Blob(entry->packet->getPayload(), entry->packet->getPayloadLength());
+
+    return resp;
+}
+
+MsgPacket* DemuxerBundle::createStreamChangePacket(const std::vector<TsDemuxer*>& streams, int protocolVersion) {
     MsgPacket* resp = new MsgPacket(ROBOTV_STREAM_CHANGE, ROBOTV_CHANNEL_STREAM);
 
-    resp->put_U8(this->size());
+    resp->put_U8(streams.size());
+
+    for(auto idx = streams.begin(); idx != streams.end(); idx++) {
+        putStream(resp, *idx);
+    }
+
+    return resp;
+}
+
+void DemuxerBundle::putStream(MsgPacket* resp, TsDemuxer* stream) {
+    int streamid = stream->getPid();
+    resp->put_U32(streamid);
+
+    switch(stream->getContent()) {
+        case StreamInfo::scAUDIO:
+            resp->put_String(stream->typeName());
+            resp->put_String(stream->getLanguage());
+            resp->put_U32(stream->getChannels());
+            resp->put_U32(stream->getSampleRate());
+            resp->put_U32(stream->getBlockAlign());
+            resp->put_U32(stream->getBitRate());
+            resp->put_U32(stream->getBitsPerSample());
+
+            break;
+
+        case StreamInfo::scVIDEO:
+            resp->put_String(stream->typeName());
+            resp->put_U32(stream->getFpsScale());
+            resp->put_U32(stream->getFpsRate());
+            resp->put_U32(stream->getHeight());
+            resp->put_U32(stream->getWidth());
+            resp->put_S64(stream->getAspect());
+
+            {
+                int length = 0;
+
+                // put SPS
+                uint8_t* sps = stream->getVideoDecoderSps(length);
+                resp->put_U8(length);
+
+                if(sps != NULL) {
+                    resp->put_Blob(sps, length);
+                }
+
+                // put PPS
+                uint8_t* pps = stream->getVideoDecoderPps(length);
+                resp->put_U8(length);
+
+                if(pps != NULL) {
+                    resp->put_Blob(pps, length);
+                }
+
+                // put VPS
+                uint8_t* vps = stream->getVideoDecoderVps(length);
+                resp->put_U8(length);
+
+                if(pps != NULL) {
+                    resp->put_Blob(vps, length);
+                }
+            }
+            break;
+
+        case StreamInfo::scSUBTITLE:
+            resp->put_String(stream->typeName());
+            resp->put_String(stream->getLanguage());
+            resp->put_U32(stream->compositionPageId());
+            resp->put_U32(stream->ancillaryPageId());
+            break;
+
+        case StreamInfo::scTELETEXT:
+            resp->put_String(stream->typeName());
+            break;
+
+        default:
+            break;
+    }
+}
+
+MsgPacket* DemuxerBundle::createStreamLayoutPacket() const {
+    MsgPacket* layout = new MsgPacket(ROBOTV_STREAM_LAYOUT, ROBOTV_CHANNEL_STREAM);
+
+    layout->put_U8(size());
 
     for(auto idx = begin(); idx != end(); idx++) {
         TsDemuxer* stream = (*idx);
 
-        int streamid = stream->getPid();
-        resp->put_U32(streamid);
-
-        switch(stream->getContent()) {
-            case StreamInfo::scAUDIO:
-                resp->put_String(stream->typeName());
-                resp->put_String(stream->getLanguage());
-                resp->put_U32(stream->getChannels());
-                resp->put_U32(stream->getSampleRate());
-                resp->put_U32(stream->getBlockAlign());
-                resp->put_U32(stream->getBitRate());
-                resp->put_U32(stream->getBitsPerSample());
-
-                break;
-
-            case StreamInfo::scVIDEO:
-                resp->put_String(stream->typeName());
-                resp->put_U32(stream->getFpsScale());
-                resp->put_U32(stream->getFpsRate());
-                resp->put_U32(stream->getHeight());
-                resp->put_U32(stream->getWidth());
-                resp->put_S64(stream->getAspect());
-
-                {
-                    int length = 0;
-
-                    // put SPS
-                    uint8_t* sps = stream->getVideoDecoderSps(length);
-                    resp->put_U8(length);
-
-                    if(sps != NULL) {
-                        resp->put_Blob(sps, length);
-                    }
-
-                    // put PPS
-                    uint8_t* pps = stream->getVideoDecoderPps(length);
-                    resp->put_U8(length);
-
-                    if(pps != NULL) {
-                        resp->put_Blob(pps, length);
-                    }
-
-                    // put VPS
-                    uint8_t* vps = stream->getVideoDecoderVps(length);
-                    resp->put_U8(length);
-
-                    if(pps != NULL) {
-                        resp->put_Blob(vps, length);
-                    }
-                }
-                break;
+        // U16 pid, U8 content, U8 type, U8 audio type, String language (ordering)
+        layout->put_U16(stream->getPid());
+        layout->put_U8(stream->getContent());
+        layout->put_U8(stream->getType());
+        layout->put_U8(stream->getAudioType());
+        layout->put_String(stream->getLanguage());
 
-            case StreamInfo::scSUBTITLE:
-                resp->put_String(stream->typeName());
-                resp->put_String(stream->getLanguage());
-                resp->put_U32(stream->compositionPageId());
-                resp->put_U32(stream->ancillaryPageId());
-                break;
+        // U32 length, serialized stream entry
+        MsgPacket entry;
+        putStream(&entry, stream);
 
-            case StreamInfo::scTELETEXT:
-                resp->put_String(stream->typeName());
-                break;
+        layout->put_U32(entry.getPayloadLength());
+        layout->put_Blob(entry.getPayload(), entry.getPayloadLength());
+    }
 
-            default:
-                break;
+    return layout;
+}
+
+MsgPacket* DemuxerBundle::createStreamChangePacket(MsgPacket* layout, int lang, StreamInfo::Type type) {
+    std::map<uint32_t, std::pair<uint8_t*, uint32_t>> weight;
+
+    layout->rewind();
+    int count = layout->get_U8();
+
+    for(int i = 0; i < count && !layout->eop(); i++) {
+        int pid = layout->get_U16();
+        StreamInfo::Content content = (StreamInfo::Content)layout->get_U8();
+        StreamInfo::Type streamType = (StreamInfo::Type)layout->get_U8();
+        int audioType = layout->get_U8();
+        const char* language = layout->get_String();
+        uint32_t length = layout->get_U32();
+        uint8_t* entry = layout->consume(length);
+
+        if(entry == NULL) {
+            ERRORLOG("truncated stream layout packet");
+            break;
         }
+
+        weight[streamWeight(pid, content, streamType, audioType, language, lang, type)] = std::make_pair(entry, length);
+    }
+
+    MsgPacket* resp = new MsgPacket(ROBOTV_STREAM_CHANGE, ROBOTV_CHANNEL_STREAM);
+    resp->put_U8(weight.size());
+
+    // order streams on weight
+    for(auto i = weight.rbegin(); i != weight.rend(); i++) {
+        resp->put_Blob(i->second.first, i->second.second);
     }
 
     return resp;
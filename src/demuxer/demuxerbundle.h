@@ -30,9 +30,15 @@
 #include "net/msgpacket.h"
 #include "robotv/robotvcommand.h"
 
+#include <atomic>
 #include <list>
+#include <mutex>
+#include <set>
+#include <vector>
 
-class DemuxerBundle : public std::list<TsDemuxer*> {
+class DemuxerWorker;
+
+class DemuxerBundle : public std::vector<TsDemuxer*> {
 public:
 
     DemuxerBundle(TsDemuxer::Listener* listener);
@@ -51,12 +57,153 @@ public:
 
     bool processTsPacket(uint8_t* packet) const;
 
+    /** Process a block of TS packets.
+     Packets are looked up in the PID table, unknown PIDs are skipped. The
+     buffer is resynced at the next sync byte if the packet alignment is lost.
+     @param data buffer with TS packets
+     @param length length of the buffer
+     @return number of consumed bytes (trailing partial packets are left untouched)
+     */
+    int processTsBuffer(const uint8_t* data, int length) const;
+
+    /** Run the stream parsers on worker threads (one per stream).
+     Takes effect with the next update of the demuxers. The listener is
+     called by one worker at a time, the packets of a stream keep their order.
+     */
+    void setParallel(bool parallel);
+
+    /** Channel of the demuxers.
+     The worker threads follow the cpu placement of the channel.
+     */
+    void setChannelUid(uint32_t channelUid);
+
+    /** Mute streams nobody is watching.
+     Muted streams are parsed until their stream information is complete
+     and skipped afterwards (until they are unmuted).
+     @param pids pids of the muted streams (all other streams are unmuted)
+     */
+    void setMuted(const std::set<int>& pids);
+
+    /** Number of times the receiver had to wait for a worker */
+    uint64_t getWorkerStalls() const;
+
+    /** Create a stream change packet.
+     The serialized packets are cached (per stream order and protocol
+     version) until the stream information changes.
+     @return new packet (owned by the caller)
+     */
     MsgPacket* createStreamChangePacket(int protocolVersion = ROBOTV_PROTOCOLVERSION);
 
+    MsgPacket* createStreamChangePacket(int lang, StreamInfo::Type type, int protocolVersion = ROBOTV_PROTOCOLVERSION) const;
+
+    /** Create a stream layout packet (ROBOTV_STREAM_LAYOUT) for the timeshift store.
+     The layout holds the serialized streams and their ordering keys, so every
+     reader can turn it into a stream change packet in its own stream order.
+     @return new packet (owned by the caller)
+     */
+    MsgPacket* createStreamLayoutPacket() const;
+
+    /** Create a stream change packet from a stream layout packet.
+     @param layout stream layout packet
+     @param lang preferred language index
+     @param type preferred audio stream type
+     @return new packet (owned by the caller)
+     */
+    static MsgPacket* createStreamChangePacket(MsgPacket* layout, int lang, StreamInfo::Type type);
+
 protected:
 
+    std::vector<TsDemuxer*> orderedStreams(int lang, StreamInfo::Type type) const;
+
+    /** Ordering weight of a stream (higher weights first) */
+    static uint32_t streamWeight(int pid, StreamInfo::Content content, StreamInfo::Type streamType, int audioType, const char* language, int lang, StreamInfo::Type type);
+
+    static MsgPacket* createStreamChangePacket(const std::vector<TsDemuxer*>& streams, int protocolVersion);
+
+    static void putStream(MsgPacket* resp, TsDemuxer* stream);
+
+    /** Get a stream change packet from the cache (or create and cache it).
+     @param ordered order the streams by language and type (else bundle order)
+     */
+    MsgPacket* cachedStreamChangePacket(bool ordered, int lang, StreamInfo::Type type, int protocolVersion) const;
+
+    /** Signature of the stream setup (changes with the streams and their information) */
+    uint64_t getSignature() const;
+
     TsDemuxer::Listener* m_listener = NULL;
 
+    /** Serializes the listener calls of the workers */
+    class SerializedListener : public TsDemuxer::Listener {
+    public:
+
+        SerializedListener(TsDemuxer::Listener* listener);
+
+        void sendStreamPacket(StreamPacket* p);
+
+        void requestStreamChange();
+
+    private:
+
+        TsDemuxer::Listener* m_listener;
+
+        std::mutex m_mutex;
+
+    };
+
+private:
+
+    void updatePidTable();
+
+    void startWorkers();
+
+    void stopWorkers();
+
+    /** Demuxer (and worker) of a stream */
+    struct Slot {
+        TsDemuxer* demuxer;
+        DemuxerWorker* worker;
+    };
+
+    enum {
+        MaxSlots = 256
+    };
+
+    /** Slot of every pid (0: pid not demuxed).
+     The table is looked up for every TS packet, keep it small
+     to stay in the cache (8KB instead of two 64KB pointer tables).
+     */
+    uint8_t m_pidSlot[MAXPID];
+
+    /** Demuxers by slot (slot 0 is unused) */
+    Slot m_slots[MaxSlots];
+
+    std::atomic<bool> m_muted[MAXPID];
+
+    std::list<DemuxerWorker*> m_workers;
+
+    SerializedListener m_serializedListener;
+
+    std::atomic<uint64_t> m_workerStalls;
+
+    bool m_parallel = false;
+
+    uint32_t m_channelUid = 0;
+
+    struct CacheEntry {
+        bool ordered;
+        int lang;
+        StreamInfo::Type type;
+        int protocolVersion;
+        uint64_t signature;
+        MsgPacket* packet;
+    };
+
+    mutable std::list<CacheEntry> m_cache;
+
+    mutable std::mutex m_cacheMutex;
+
+    uint32_t m_revision = 0;
+
 };
 
 #endif // ROBOTV_DEMUXERBUNDLE_H
@@ -0,0 +1,113 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <vdr/remux.h>
+
+#include <string.h>
+
+#include <chrono>
+
+#include "demuxer.h"
+#include "demuxerworker.h"
+#include "tools/cpuplacement.h"
+
+DemuxerWorker::DemuxerWorker(TsDemuxer* demuxer, std::atomic<uint64_t>& stalls, uint32_t channelUid) : m_demuxer(demuxer), m_head(0), m_tail(0), m_running(true), m_waiting(false), m_stalls(stalls), m_channelUid(channelUid) {
+    m_ring = new uint8_t[RingSize * TS_SIZE];
+
+    m_thread = new std::thread([ = ]() {
+        action();
+    });
+}
+
+DemuxerWorker::~DemuxerWorker() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+
+    m_condition.notify_one();
+    m_thread->join();
+
+    delete m_thread;
+    delete[] m_ring;
+}
+
+void DemuxerWorker::put(const uint8_t* packet) {
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+
+    // ring full -> wait for the worker
+    if(head - m_tail.load(std::memory_order_acquire) >= RingSize) {
+        m_stalls++;
+        wakeup();
+
+        while(head - m_tail.load(std::memory_order_acquire) >= RingSize) {
+            std::this_thread::yield();
+        }
+    }
+
+    memcpy(m_ring + (head % RingSize) * TS_SIZE, packet, TS_SIZE);
+    m_head.store(head + 1, std::memory_order_release);
+
+    // packets arrive one by one, wake up the worker once for a batch
+    if(m_waiting && head + 1 - m_tail.load(std::memory_order_relaxed) >= WakeupThreshold) {
+        wakeup();
+    }
+}
+
+void DemuxerWorker::wakeup() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+
+    m_condition.notify_one();
+}
+
+void DemuxerWorker::action() {
+    while(m_running) {
+        CpuPlacement::follow(m_channelUid);
+
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        uint32_t head = m_head.load(std::memory_order_acquire);
+
+        // low bitrate streams are picked up after the timeout
+        if(head - tail < WakeupThreshold) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_waiting = true;
+
+            m_condition.wait_for(lock, std::chrono::milliseconds(WaitTimeout), [&]() {
+                return !m_running || m_head.load(std::memory_order_acquire) - tail >= WakeupThreshold;
+            });
+
+            m_waiting = false;
+            head = m_head.load(std::memory_order_acquire);
+        }
+
+        // the demuxers do not modify the packet data
+        while(tail != head) {
+            m_demuxer->processTsPacket(m_ring + (tail % RingSize) * TS_SIZE);
+            m_tail.store(++tail, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_DEMUXERWORKER_H
+#define ROBOTV_DEMUXERWORKER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class TsDemuxer;
+
+/**
+ * Runs the parser of a stream demuxer on its own thread.
+ * TS packets are passed from the receiver thread through a lock-free
+ * single producer / single consumer ring.
+ */
+class DemuxerWorker {
+public:
+
+    /** Create a worker for the demuxer.
+     @param demuxer stream demuxer (processed on the worker thread)
+     @param stalls counter of waits for a full ring
+     @param channelUid channel of the demuxer (cpu placement, 0 - none)
+     */
+    DemuxerWorker(TsDemuxer* demuxer, std::atomic<uint64_t>& stalls, uint32_t channelUid = 0);
+
+    virtual ~DemuxerWorker();
+
+    /** Queue a TS packet (receiver thread only).
+     Waits for the worker if the ring is full.
+     */
+    void put(const uint8_t* packet);
+
+    /** The demuxer of the worker */
+    TsDemuxer* getDemuxer() const {
+        return m_demuxer;
+    }
+
+protected:
+
+    void wakeup();
+
+    void action();
+
+    TsDemuxer* m_demuxer;
+
+    uint8_t* m_ring;
+
+    std::atomic<uint32_t> m_head;
+
+    std::atomic<uint32_t> m_tail;
+
+    std::atomic<bool> m_running;
+
+    std::atomic<bool> m_waiting;
+
+    std::atomic<uint64_t>& m_stalls;
+
+    uint32_t m_channelUid;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_condition;
+
+    std::thread* m_thread;
+
+    enum {
+        RingSize = 4096,
+        WakeupThreshold = 32,
+        WaitTimeout = 5
+    };
+
+};
+
+#endif // ROBOTV_DEMUXERWORKER_H
@@ -0,0 +1,167 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_FRAMEPARSER_H
+#define ROBOTV_FRAMEPARSER_H
+
+#include "config/config.h"
+#include "parser.h"
+#include "pes.h"
+#include "bytescan.h"
+
+#include <algorithm>
+
+/**
+ * Parser core for streams of self-delimiting frames (audio codecs).
+ * Sync search, frame validation and payload emission are compiled per
+ * codec: T must be a final subclass implementing
+ *
+ *   bool checkAlignmentHeader(unsigned char* buffer, int& framesize);
+ *   int parsePayload(unsigned char* payload, int length);
+ *
+ * (and optionally sendPayload). The calls are resolved statically and
+ * can be inlined into the per-byte and per-frame loops.
+ */
+template<class T>
+class FrameParser : public Parser {
+public:
+
+    FrameParser(TsDemuxer* demuxer, int buffersize, int packetsize) : Parser(demuxer, buffersize, packetsize), m_lastPts(DVD_NOPTS_VALUE), m_lastDts(DVD_NOPTS_VALUE) {
+    }
+
+    void parse(unsigned char* data, int datasize, bool pusi) {
+        T* codec = static_cast<T*>(this);
+
+        // get available data
+        int length = 0;
+        uint8_t* buffer = Get(length);
+
+        // do we have a sync ?
+        int framesize = 0;
+
+        if(length > m_headerSize && buffer != NULL && codec->checkAlignmentHeader(buffer, framesize)) {
+            // valid framesize ?
+            if(framesize > 0 && length >= framesize + m_headerSize) {
+
+                // check for the next frame (eliminate false positive header checks)
+                int next_framesize = 0;
+
+                if(!codec->checkAlignmentHeader(&buffer[framesize], next_framesize)) {
+                    ERRORLOG("next frame not found on expected position, searching ...");
+                }
+                else {
+                    // check if we should extrapolate the timestamps
+                    if(m_curPts == DVD_NOPTS_VALUE) {
+                        m_curPts = PtsAdd(m_lastPts, m_duration);
+                    }
+
+                    if(m_curDts == DVD_NOPTS_VALUE) {
+                        m_curDts = PtsAdd(m_lastDts, m_duration);
+                    }
+
+                    int length = codec->parsePayload(buffer, framesize);
+                    codec->sendPayload(buffer, length);
+
+                    // keep last timestamp
+                    m_lastPts = m_curPts;
+                    m_lastDts = m_curDts;
+
+                    // reset timestamps
+                    m_curPts = DVD_NOPTS_VALUE;
+                    m_curDts = DVD_NOPTS_VALUE;
+
+                    Del(framesize);
+                    putData(data, datasize, pusi);
+                    return;
+                }
+            }
+
+        }
+
+        // try to find sync
+        int offset = findAlignmentOffset(buffer, length, 1, framesize);
+
+        if(offset != -1) {
+            countResync();
+            INFOLOG("sync found at offset %i (streamtype: %s / %i bytes in buffer / framesize: %i bytes)", offset, m_demuxer->typeName(), Available(), framesize);
+            Del(offset);
+        }
+        else if(length > m_headerSize) {
+            Del(length - m_headerSize);
+        }
+
+        putData(data, datasize, pusi);
+    }
+
+protected:
+
+    int findAlignmentOffset(unsigned char* buffer, int buffersize, int o, int& framesize) {
+        T* codec = static_cast<T*>(this);
+        framesize = 0;
+
+        int end = buffersize - m_headerSize;
+
+        // seek sync
+        if(m_syncMask != 0) {
+            // jump to sync word candidates (second byte must be inside the buffer)
+            int limit = std::min(buffersize, end + 1);
+
+            while(o < end) {
+                o = findSyncWord(buffer, o, limit, m_syncWord, m_syncMask);
+
+                if(o == -1) {
+                    o = end;
+                    break;
+                }
+
+                if(codec->checkAlignmentHeader(buffer + o, framesize)) {
+                    break;
+                }
+
+                o++;
+            }
+        }
+        else {
+            while(o < end && !codec->checkAlignmentHeader(buffer + o, framesize)) {
+                o++;
+            }
+        }
+
+        // not found
+        if(o >= end || framesize <= 0) {
+            return -1;
+        }
+
+        return o;
+    }
+
+private:
+
+    int64_t m_lastPts;
+
+    int64_t m_lastDts;
+
+};
+
+#endif // ROBOTV_FRAMEPARSER_H
@@ -25,20 +25,31 @@
 #include "parser.h"
 #include "config/config.h"
 #include "pes.h"
+#include "bytescan.h"
 
-Parser::Parser(TsDemuxer* demuxer, int buffersize, int packetsize) : cRingBufferLinear(buffersize, packetsize), m_demuxer(demuxer), m_startup(true) {
+#include <atomic>
+
+static std::atomic<uint64_t> resyncCount[StreamInfo::stH265 + 1];
+
+static std::atomic<int64_t> bufferBytes[StreamInfo::stH265 + 1];
+
+static std::atomic<int64_t>* bufferUsage(TsDemuxer* demuxer) {
+    StreamInfo::Type type = demuxer->getType();
+    return (type > StreamInfo::stNONE && type <= StreamInfo::stH265) ? &bufferBytes[type] : NULL;
+}
+
+Parser::Parser(TsDemuxer* demuxer, int buffersize, int packetsize) : ParserBuffer(buffersize, packetsize, bufferUsage(demuxer)), m_demuxer(demuxer), m_startup(true) {
     m_sampleRate = 0;
     m_bitRate = 0;
     m_channels = 0;
     m_duration = 0;
     m_headerSize = 0;
+    m_syncWord = 0;
+    m_syncMask = 0;
     m_frameType = StreamInfo::ftUNKNOWN;
 
     m_curPts = DVD_NOPTS_VALUE;
     m_curDts = DVD_NOPTS_VALUE;
-
-    m_lastPts = DVD_NOPTS_VALUE;
-    m_lastDts = DVD_NOPTS_VALUE;
 }
 
 Parser::~Parser() {
@@ -101,93 +112,57 @@ void Parser::putData(unsigned char* data, int length, bool pusi) {
     }
 }
 
-void Parser::parse(unsigned char* data, int datasize, bool pusi) {
-    // get available data
-    int length = 0;
-    uint8_t* buffer = Get(length);
-
-    // do we have a sync ?
-    int framesize = 0;
-
-    if(length > m_headerSize && buffer != NULL && checkAlignmentHeader(buffer, framesize)) {
-        // valid framesize ?
-        if(framesize > 0 && length >= framesize + m_headerSize) {
-
-            // check for the next frame (eliminate false positive header checks)
-            int next_framesize = 0;
-
-            if(!checkAlignmentHeader(&buffer[framesize], next_framesize)) {
-                ERRORLOG("next frame not found on expected position, searching ...");
-            }
-            else {
-                // check if we should extrapolate the timestamps
-                if(m_curPts == DVD_NOPTS_VALUE) {
-                    m_curPts = PtsAdd(m_lastPts, m_duration);
-                }
-
-                if(m_curDts == DVD_NOPTS_VALUE) {
-                    m_curDts = PtsAdd(m_lastDts, m_duration);
-                }
-
-                int length = parsePayload(buffer, framesize);
-                sendPayload(buffer, length);
-
-                // keep last timestamp
-                m_lastPts = m_curPts;
-                m_lastDts = m_curDts;
-
-                // reset timestamps
-                m_curPts = DVD_NOPTS_VALUE;
-                m_curDts = DVD_NOPTS_VALUE;
-
-                Del(framesize);
-                putData(data, datasize, pusi);
-                return;
-            }
-        }
+int Parser::parsePayload(unsigned char* payload, int length) {
+    return length;
+}
 
-    }
+void Parser::countResync() {
+    resyncCount[m_demuxer->getType()]++;
+}
 
-    // try to find sync
-    int offset = findAlignmentOffset(buffer, length, 1, framesize);
+int Parser::findStartCode(unsigned char* buffer, int buffersize, int offset, uint32_t startcode, uint32_t mask) {
+    // position of two zero bytes the startcode begins with
+    int zeroPair = -1;
 
-    if(offset != -1) {
-        INFOLOG("sync found at offset %i (streamtype: %s / %i bytes in buffer / framesize: %i bytes)", offset, m_demuxer->typeName(), Available(), framesize);
-        Del(offset);
+    if((mask & 0xFFFF0000) == 0xFFFF0000 && (startcode & 0xFFFF0000) == 0) {
+        zeroPair = 0;
     }
-    else if(length > m_headerSize) {
-        Del(length - m_headerSize);
+    else if((mask & 0xFFFFFF00) == 0x00FFFF00 && (startcode & 0x00FFFF00) == 0) {
+        zeroPair = 1;
     }
 
-    putData(data, datasize, pusi);
-}
+    if(zeroPair == -1) {
+        return findStartCodeScalar(buffer, buffersize, offset, startcode, mask);
+    }
 
-int Parser::parsePayload(unsigned char* payload, int length) {
-    return length;
-}
+    // only check windows around zero byte pairs
+    int p = offset;
 
-int Parser::findAlignmentOffset(unsigned char* buffer, int buffersize, int o, int& framesize) {
-    framesize = 0;
+    while((p = findZeroPair(buffer, p, buffersize)) >= 0) {
+        int start = p - zeroPair;
 
-    // seek sync
-    while(o < (buffersize - m_headerSize) && !checkAlignmentHeader(buffer + o, framesize)) {
-        o++;
-    }
+        if(start + 4 > buffersize) {
+            break;
+        }
 
-    // not found
-    if(o >= buffersize - m_headerSize || framesize <= 0) {
-        return -1;
-    }
+        // bytes in front of the offset don't exist (0xFF)
+        uint32_t sc = 0;
 
-    return o;
-}
+        for(int i = start; i < start + 4; i++) {
+            sc = (sc << 8) | ((i < offset) ? 0xFF : buffer[i]);
+        }
+
+        if((uint32_t)(sc & mask) == startcode) {
+            return start;
+        }
 
-bool Parser::checkAlignmentHeader(unsigned char* buffer, int& framesize) {
-    framesize = 0;
-    return true;
+        p++;
+    }
+
+    return -1;
 }
 
-int Parser::findStartCode(unsigned char* buffer, int buffersize, int offset, uint32_t startcode, uint32_t mask) {
+int Parser::findStartCodeScalar(unsigned char* buffer, int buffersize, int offset, uint32_t startcode, uint32_t mask) {
     uint32_t sc = 0xFFFFFFFF;
 
     while(offset < buffersize) {
@@ -201,3 +176,28 @@ int Parser::findStartCode(unsigned char* buffer, int buffersize, int offset, uin
 
     return -1;
 }
+
+uint64_t Parser::getResyncCount(StreamInfo::Type type) {
+    return resyncCount[type];
+}
+
+uint64_t Parser::getBufferBytes(StreamInfo::Type type) {
+    int64_t bytes = bufferBytes[type];
+    return (bytes > 0) ? bytes : 0;
+}
+
+void Parser::logStatistics() {
+    for(int i = StreamInfo::stMPEG2AUDIO; i <= StreamInfo::stH265; i++) {
+        uint64_t count = resyncCount[i];
+
+        if(count > 0) {
+            INFOLOG("parser resyncs (%s): %llu", StreamInfo::typeName((StreamInfo::Type)i), (unsigned long long)count);
+        }
+
+        uint64_t bytes = getBufferBytes((StreamInfo::Type)i);
+
+        if(bytes > 0) {
+            INFOLOG("parser buffers (%s): %llu KB", StreamInfo::typeName((StreamInfo::Type)i), (unsigned long long)(bytes / 1024));
+        }
+    }
+}
@@ -26,16 +26,25 @@
 #define ROBOTV_DEMUXER_BASE_H
 
 #include "demuxer.h"
-#include "vdr/ringbuffer.h"
+#include "parserbuffer.h"
+#include "vdr/tools.h"
 
-class Parser : public cRingBufferLinear {
+class Parser : public ParserBuffer {
 public:
 
     Parser(TsDemuxer* demuxer, int buffersize = 64 * 1024, int packetsize = 4096);
 
     virtual ~Parser();
 
-    virtual void parse(unsigned char* data, int size, bool pusi);
+    virtual void parse(unsigned char* data, int size, bool pusi) = 0;
+
+    /** Number of sync losses of a stream type */
+    static uint64_t getResyncCount(StreamInfo::Type type);
+
+    /** Allocated parser buffer memory of a stream type (all parsers) */
+    static uint64_t getBufferBytes(StreamInfo::Type type);
+
+    static void logStatistics();
 
 protected:
 
@@ -45,10 +54,15 @@ protected:
 
     virtual int parsePayload(unsigned char* payload, int length);
 
-    virtual bool checkAlignmentHeader(unsigned char* buffer, int& framesize);
+    void putData(unsigned char* data, int size, bool pusi);
+
+    /** Count a sync loss of the stream */
+    void countResync();
 
     int findStartCode(unsigned char* buffer, int buffersize, int offset, uint32_t startcode, uint32_t mask = 0xFFFFFFFF);
 
+    int findStartCodeScalar(unsigned char* buffer, int buffersize, int offset, uint32_t startcode, uint32_t mask = 0xFFFFFFFF);
+
     TsDemuxer* m_demuxer;
 
     int64_t m_curPts;
@@ -65,19 +79,13 @@ protected:
 
     int m_headerSize;
 
-    StreamInfo::FrameType m_frameType;
-
-    bool m_startup;
-
-private:
-
-    int64_t m_lastPts;
+    uint16_t m_syncWord;
 
-    int64_t m_lastDts;
+    uint16_t m_syncMask;
 
-    void putData(unsigned char* data, int size, bool pusi);
+    StreamInfo::FrameType m_frameType;
 
-    int findAlignmentOffset(unsigned char* buffer, int buffersize, int startoffset, int& framesize);
+    bool m_startup;
 
 };
 
@@ -0,0 +1,169 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <string.h>
+#include <algorithm>
+
+#include "net/packetpool.h"
+#include "tools/memorybudget.h"
+#include "parserbuffer.h"
+
+// initial size of a buffer
+#define PARSERBUFFER_MINSIZE 4096
+
+ParserBuffer::ParserBuffer(int maxSize, int margin, std::atomic<int64_t>* usage) : m_maxSize(maxSize), m_margin(margin), m_usage(usage) {
+}
+
+ParserBuffer::~ParserBuffer() {
+    if(m_usage != NULL) {
+        *m_usage -= m_capacity;
+    }
+
+    MemoryBudget::add(MemoryBudget::msParser, -(int64_t)m_capacity);
+    PacketPool::release(m_buffer);
+}
+
+bool ParserBuffer::reserve(int size) {
+    if(size <= (int)m_capacity) {
+        return true;
+    }
+
+    if(size > m_maxSize) {
+        return false;
+    }
+
+    // grow in powers of two (the size classes of the pool)
+    int newSize = (m_capacity > 0) ? m_capacity : PARSERBUFFER_MINSIZE;
+
+    while(newSize < size) {
+        newSize *= 2;
+    }
+
+    if(newSize > m_maxSize) {
+        newSize = m_maxSize;
+    }
+
+    uint32_t oldCapacity = m_capacity;
+    uint8_t* buffer = PacketPool::reallocate(m_buffer, m_head, newSize, m_capacity);
+
+    if(buffer == NULL) {
+        return false;
+    }
+
+    m_buffer = buffer;
+
+    if(m_usage != NULL) {
+        *m_usage += (int64_t)m_capacity - oldCapacity;
+    }
+
+    MemoryBudget::add(MemoryBudget::msParser, (int64_t)m_capacity - oldCapacity);
+    return true;
+}
+
+void ParserBuffer::release() {
+    if(m_buffer == NULL) {
+        return;
+    }
+
+    if(m_usage != NULL) {
+        *m_usage -= m_capacity;
+    }
+
+    MemoryBudget::add(MemoryBudget::msParser, -(int64_t)m_capacity);
+    MemoryBudget::shed(MemoryBudget::msParser, m_capacity);
+
+    PacketPool::release(m_buffer);
+    m_buffer = NULL;
+    m_capacity = 0;
+}
+
+int ParserBuffer::Put(const uint8_t* data, int count) {
+    if(count <= 0) {
+        return 0;
+    }
+
+    // move the remaining data to the front
+    if(m_tail > 0 && m_head + count > (int)m_capacity) {
+        memmove(m_buffer, m_buffer + m_tail, m_head - m_tail);
+        m_head -= m_tail;
+        m_tail = 0;
+    }
+
+    if(!reserve(m_head + count)) {
+        // take what fits
+        reserve(m_maxSize);
+        count = std::min(count, std::min((int)m_capacity, m_maxSize) - m_head);
+
+        if(count <= 0) {
+            return 0;
+        }
+    }
+
+    memcpy(m_buffer + m_head, data, count);
+    m_head += count;
+
+    return count;
+}
+
+uint8_t* ParserBuffer::Get(int& count) {
+    int available = m_head - m_tail;
+
+    if(available <= 0 || available < m_margin) {
+        return NULL;
+    }
+
+    count = available;
+    return m_buffer + m_tail;
+}
+
+void ParserBuffer::Del(int count) {
+    if(count <= 0) {
+        return;
+    }
+
+    m_tail += count;
+
+    if(m_tail >= m_head) {
+        m_head = 0;
+        m_tail = 0;
+
+        if(MemoryBudget::exceeded()) {
+            release();
+        }
+    }
+}
+
+void ParserBuffer::Clear() {
+    m_head = 0;
+    m_tail = 0;
+}
+
+int ParserBuffer::Available() const {
+    return m_head - m_tail;
+}
+
+int ParserBuffer::capacity() const {
+    return m_capacity;
+}
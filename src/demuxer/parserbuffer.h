@@ -0,0 +1,103 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_PARSERBUFFER_H
+#define ROBOTV_PARSERBUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/**
+	@short Linear buffer of a stream parser
+
+	The buffer starts empty and grows on demand (up to a maximum size).
+	Memory is taken from the packet pool, so buffers of deleted parsers
+	are reused by the next parsers. The interface follows the subset of
+	cRingBufferLinear used by the parsers.
+*/
+
+class ParserBuffer {
+public:
+
+    /**
+    Create a buffer.
+
+    @param	maxSize		maximum size of the buffer
+    @param	margin		minimum number of bytes returned by Get()
+    @param	usage		counter of allocated bytes (may be NULL)
+    */
+    ParserBuffer(int maxSize, int margin = 0, std::atomic<int64_t>* usage = NULL);
+
+    virtual ~ParserBuffer();
+
+    /** Append data.
+     @return number of bytes stored (less than count if the buffer is full)
+     */
+    int Put(const uint8_t* data, int count);
+
+    /** Get the buffered data.
+     The pointer is valid until the next call of Put().
+     @param count set to the number of available bytes
+     @return pointer to the data or NULL (less than margin bytes available)
+     */
+    uint8_t* Get(int& count);
+
+    /** Remove bytes from the beginning of the buffer.
+     An emptied buffer is released if the memory budget is exceeded.
+     */
+    void Del(int count);
+
+    void Clear();
+
+    int Available() const;
+
+    /** Number of allocated bytes */
+    int capacity() const;
+
+private:
+
+    bool reserve(int size);
+
+    /** Release the (empty) buffer */
+    void release();
+
+    uint8_t* m_buffer = NULL;
+
+    uint32_t m_capacity = 0;
+
+    int m_maxSize;
+
+    int m_margin;
+
+    int m_head = 0;
+
+    int m_tail = 0;
+
+    std::atomic<int64_t>* m_usage;
+
+};
+
+#endif // ROBOTV_PARSERBUFFER_H
@@ -164,6 +164,8 @@ protected:
 
     friend class ChannelCache;
 
+    friend class ChannelCacheTable;
+
 private:
 
     void Initialize();
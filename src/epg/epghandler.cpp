@@ -25,14 +25,41 @@
 #include <robotv/robotvchannels.h>
 #include <tools/hash.h>
 #include "epghandler.h"
+#include "robotv/startup.h"
 
-EpgHandler::EpgHandler() : m_storage(roboTV::Storage::getInstance()) {
-    createDb();
-    triggerCleanup();
+// maximum number of events written in one transaction
+#define EPG_INDEX_BATCH_SIZE 5000
+
+// time to collect events before writing them
+#define EPG_INDEX_DELAY_MS 1000
+
+EpgHandler::EpgHandler() : m_storage(roboTV::Storage::getInstance()), m_index(m_storage) {
+    Startup::instance().begin("epg");
+
+    // the schema and the index state are set up by the indexer
+    m_indexerThread = std::thread([&]() {
+        m_index.createDb();
+        m_index.loadState();
+        triggerCleanup();
+        Startup::instance().end("epg");
+
+        indexer();
+    });
+}
+
+EpgHandler::~EpgHandler() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        m_cond.notify_all();
+    }
+
+    m_indexerThread.join();
 }
 
 bool EpgHandler::HandleEvent(cEvent* Event) {
     std::string channelName;
+    uint32_t channelUid = 0;
 
     RoboTVChannels& c = RoboTVChannels::instance();
     c.lock(false);
@@ -41,65 +68,74 @@ bool EpgHandler::HandleEvent(cEvent* Event) {
 
     if(channel != nullptr) {
         channelName = channel->Name();
+        channelUid = createChannelUid(channel);
     }
 
     c.unlock();
 
-    std::string docIdString = (const char*)Event->ChannelID().ToString();
-    docIdString += "-" + std::to_string(Event->EventID());
-
-    int docId = createStringHash(docIdString.c_str());
-
-    m_storage.exec(
-        "INSERT OR REPLACE INTO epgindex(docid,eventid,timestamp,channelid,channelname) VALUES(%i, %u, %llu, %Q, %Q)",
-        docId,
-        Event->EventID(),
-        (uint64_t)Event->StartTime(),
-        (const char*)Event->ChannelID().ToString(),
-        channelName.c_str()
-    );
-
-    m_storage.exec(
-        "INSERT OR REPLACE INTO epgsearch(docid, title, subject) VALUES(%i, %Q, %Q)",
-        docId,
-        Event->Title() ? Event->Title() : "",
-        Event->ShortText() ? Event->ShortText() : ""
-    );
+    std::string channelId = (const char*)Event->ChannelID().ToString();
+    std::string docIdString = channelId + "-" + std::to_string(Event->EventID());
+
+    EpgIndex::Entry entry;
+    entry.docId = createStringHash(docIdString.c_str());
+    entry.eventId = Event->EventID();
+    entry.timestamp = (uint64_t)Event->StartTime();
+    entry.channelId = channelId;
+    entry.channelName = channelName;
+    entry.channelUid = channelUid;
+    entry.title = Event->Title() ? Event->Title() : "";
+    entry.subject = Event->ShortText() ? Event->ShortText() : "";
+
+    // skip unchanged events
+    std::string content = entry.title + "\n" + entry.subject + "\n" + std::to_string(entry.timestamp) + "\n" + channelName;
+    entry.hash = createStringHash(content.c_str());
+
+    if(!m_index.changed(entry)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(std::move(entry));
+    m_cond.notify_all();
+
     return false;
 }
 
-void EpgHandler::createDb() {
-    std::string schema =
-        "CREATE TABLE IF NOT EXISTS epgindex (\n"
-        "  docid INTEGER PRIMARY KEY,\n"
-        "  eventid INTEGER NOT NULL,\n"
-        "  timestamp INTEGER NOT NULL,\n"
-        "  channelname TEXT NOT NULL,\n"
-        "  channelid TEXT NOT NULL\n"
-        ");\n"
-        "CREATE INDEX IF NOT EXISTS epgindex_timestamp on epgindex(timestamp);\n"
-        "CREATE VIRTUAL TABLE IF NOT EXISTS epgsearch USING fts4(\n"
-        "  content=\"\",\n"
-        "  title,\n"
-        "  subject\n"
-        ");\n";
-
-    if(m_storage.exec(schema) != SQLITE_OK) {
-        ERRORLOG("Unable to create database schema for epg search");
-    }
+void EpgHandler::indexer() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(m_running || !m_queue.empty()) {
+        if(m_queue.empty()) {
+            m_cond.wait(lock);
+            continue;
+        }
 
-    // update older version of table
-    if(!m_storage.tableHasColumn("epgindex", "eventid")) {
-        m_storage.exec("ALTER TABLE epgindex ADD COLUMN eventid INTEGER NOT NULL");
+        // collect events for a while
+        if(m_running && m_queue.size() < EPG_INDEX_BATCH_SIZE) {
+            m_cond.wait_for(lock, std::chrono::milliseconds(EPG_INDEX_DELAY_MS), [&]() {
+                return !m_running || m_queue.size() >= EPG_INDEX_BATCH_SIZE;
+            });
+        }
+
+        std::deque<EpgIndex::Entry> entries;
+
+        while(!m_queue.empty() && entries.size() < EPG_INDEX_BATCH_SIZE) {
+            entries.push_back(std::move(m_queue.front()));
+            m_queue.pop_front();
+        }
+
+        lock.unlock();
+        m_index.write(entries);
+        lock.lock();
     }
 }
 
 void EpgHandler::cleanup() {
-    INFOLOG("removing outdated epg entries");
+    m_index.cleanup(time(NULL));
+}
 
-    time_t now = time(NULL);
-    m_storage.exec("DELETE FROM epgsearch WHERE docid IN (SELECT docid FROM epgindex WHERE timestamp < %llu)", (uint64_t)now);
-    m_storage.exec("DELETE FROM epgindex WHERE timestamp < %llu", (uint64_t)now);
+void EpgHandler::mergeSegments() {
+    m_index.mergeSegments();
 }
 
 void EpgHandler::triggerCleanup() {
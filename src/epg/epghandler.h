@@ -27,23 +27,52 @@
 
 #include <vdr/epg.h>
 #include <db/storage.h>
+#include "epgindex.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 class EpgHandler : public cEpgHandler {
 public:
 
     EpgHandler();
 
+    virtual ~EpgHandler();
+
     bool HandleEvent(cEvent* Event);
 
     void triggerCleanup();
 
+    /** @short Merge FTS segments.
+     * Runs a limited incremental merge on all search partitions written
+     * since the last call (background maintenance).
+     */
+    void mergeSegments();
+
 private:
 
     void cleanup();
 
-    void createDb();
+    /** @short Background indexer.
+     * Writes the queued EPG events in large transactions.
+     */
+    void indexer();
 
     roboTV::Storage& m_storage;
+
+    EpgIndex m_index;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_cond;
+
+    std::thread m_indexerThread;
+
+    bool m_running = true;
+
+    std::deque<EpgIndex::Entry> m_queue;
 };
 
 
@@ -0,0 +1,375 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config/config.h"
+#include "db/statement.h"
+#include "epgindex.h"
+
+// number of pages written by a single incremental segment merge
+#define EPG_MERGE_PAGES 500
+
+// seconds per search partition
+#define EPG_PARTITION_SECONDS (24 * 60 * 60)
+
+EpgIndex::EpgIndex(roboTV::Database& storage) : m_storage(storage) {
+}
+
+EpgIndex::~EpgIndex() {
+}
+
+uint32_t EpgIndex::getPartition(uint64_t timestamp) {
+    return (uint32_t)(timestamp / EPG_PARTITION_SECONDS);
+}
+
+std::vector<uint32_t> EpgIndex::getPartitions(roboTV::Database& storage, uint32_t fromDay) {
+    std::vector<uint32_t> result;
+    sqlite3_stmt* s = storage.query("SELECT name FROM sqlite_master WHERE type='table' AND name GLOB 'epgsearch_[0-9]*'");
+
+    if(s == NULL) {
+        return result;
+    }
+
+    while(sqlite3_step(s) == SQLITE_ROW) {
+        const char* name = (const char*)sqlite3_column_text(s, 0) + 10;
+
+        // skip the FTS shadow tables (epgsearch_<day>_content, ...)
+        if(strspn(name, "0123456789") != strlen(name)) {
+            continue;
+        }
+
+        uint32_t day = (uint32_t)strtoul(name, NULL, 10);
+
+        if(day >= fromDay) {
+            result.push_back(day);
+        }
+    }
+
+    sqlite3_finalize(s);
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool EpgIndex::createPartition(uint32_t day) {
+    if(m_partitions.find(day) != m_partitions.end()) {
+        return true;
+    }
+
+    if(m_storage.exec(
+                "CREATE VIRTUAL TABLE IF NOT EXISTS epgsearch_%i USING fts4(content=\"\", title, subject)",
+                (int)day) != SQLITE_OK) {
+        ERRORLOG("Unable to create epg search partition %u", day);
+        return false;
+    }
+
+    m_partitions.insert(day);
+    return true;
+}
+
+bool EpgIndex::changed(const Entry& entry) {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    auto i = m_state.find(entry.docId);
+
+    return (i == m_state.end() || i->second.hash != entry.hash);
+}
+
+size_t EpgIndex::size() {
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+    return m_state.size();
+}
+
+void EpgIndex::write(const std::deque<Entry>& entries) {
+    std::lock_guard<std::mutex> partitionLock(m_partitionMutex);
+
+    // events that already started can't be found anymore
+    uint32_t today = getPartition(time(NULL));
+    std::map<uint32_t, std::vector<const Entry*>> partitions;
+
+    for(const auto& e : entries) {
+        uint32_t day = getPartition(e.timestamp);
+
+        if(day >= today) {
+            partitions[day].push_back(&e);
+        }
+    }
+
+    if(!m_storage.begin()) {
+        ERRORLOG("unable to start epg index transaction");
+        return;
+    }
+
+    // events written to the index
+    std::vector<const Entry*> indexed;
+
+    {
+        roboTV::Statement index(m_storage,
+                                "INSERT OR REPLACE INTO epgindex(docid,eventid,timestamp,channelid,channelname,channeluid,contenthash) VALUES(?, ?, ?, ?, ?, ?, ?)");
+
+        for(auto& e : entries) {
+            index.bind(1, e.docId)
+            .bind(2, e.eventId)
+            .bind(3, (int64_t)e.timestamp)
+            .bind(4, e.channelId)
+            .bind(5, e.channelName)
+            .bind(6, e.channelUid)
+            .bind(7, (int64_t)e.hash);
+
+            if(index.exec() == SQLITE_OK) {
+                indexed.push_back(&e);
+            }
+
+            index.reset();
+        }
+    }
+
+    // events without a search row and partitions written in this transaction
+    std::set<const Entry*> unsearchable;
+    std::vector<uint32_t> written;
+
+    for(const auto& p : partitions) {
+        if(!createPartition(p.first)) {
+            unsearchable.insert(p.second.begin(), p.second.end());
+            continue;
+        }
+
+        roboTV::Statement search(m_storage,
+                                 "INSERT OR REPLACE INTO epgsearch_" + std::to_string(p.first) + "(docid, title, subject) VALUES(?, ?, ?)");
+
+        for(const Entry* e : p.second) {
+            search.bind(1, e->docId)
+            .bind(2, e->title)
+            .bind(3, e->subject);
+
+            if(search.exec() != SQLITE_OK) {
+                unsearchable.insert(e);
+            }
+
+            search.reset();
+        }
+
+        written.push_back(p.first);
+    }
+
+    if(!m_storage.commit()) {
+        ERRORLOG("unable to commit epg index transaction");
+        return;
+    }
+
+    m_dirtyPartitions.insert(written.begin(), written.end());
+
+    // the events are skipped from now on (failed events are retried with the next update)
+    int count = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+
+        for(const Entry* e : indexed) {
+            if(unsearchable.find(e) != unsearchable.end()) {
+                continue;
+            }
+
+            m_state[e->docId] = { e->hash, e->timestamp };
+            count++;
+        }
+    }
+
+    DEBUGLOG("indexed %i epg events", count);
+}
+
+void EpgIndex::loadState() {
+    sqlite3_stmt* s = m_storage.query("SELECT docid, contenthash, timestamp FROM epgindex");
+
+    if(s == NULL) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_stateMutex);
+
+    // keep the state of events queued meanwhile
+    while(sqlite3_step(s) == SQLITE_ROW) {
+        State state = {
+            (uint32_t)sqlite3_column_int64(s, 1),
+            (uint64_t)sqlite3_column_int64(s, 2)
+        };
+
+        m_state.emplace(sqlite3_column_int(s, 0), state);
+    }
+
+    sqlite3_finalize(s);
+    INFOLOG("%i events in epg index", (int)m_state.size());
+}
+
+void EpgIndex::createDb() {
+    std::string schema =
+        "CREATE TABLE IF NOT EXISTS epgindex (\n"
+        "  docid INTEGER PRIMARY KEY,\n"
+        "  eventid INTEGER NOT NULL,\n"
+        "  timestamp INTEGER NOT NULL,\n"
+        "  channelname TEXT NOT NULL,\n"
+        "  channelid TEXT NOT NULL,\n"
+        "  channeluid INTEGER DEFAULT 0 NOT NULL,\n"
+        "  contenthash INTEGER DEFAULT 0 NOT NULL\n"
+        ");\n"
+        "CREATE INDEX IF NOT EXISTS epgindex_timestamp on epgindex(timestamp);\n";
+
+    if(m_storage.exec(schema) != SQLITE_OK) {
+        ERRORLOG("Unable to create database schema for epg search");
+    }
+
+    // the unpartitioned search table can't be expired (contentless FTS
+    // tables don't support DELETE), drop it and index all events again
+    sqlite3_stmt* s = m_storage.query("SELECT name FROM sqlite_master WHERE type='table' AND name='epgsearch'");
+
+    if(s != NULL) {
+        bool found = (sqlite3_step(s) == SQLITE_ROW);
+        sqlite3_finalize(s);
+
+        if(found) {
+            INFOLOG("migrating epg search index to daily partitions");
+            m_storage.exec("DROP TABLE epgsearch");
+            m_storage.exec("UPDATE epgindex SET contenthash=0");
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_partitionMutex);
+
+    for(uint32_t day : getPartitions(m_storage)) {
+        m_partitions.insert(day);
+    }
+
+    // update older version of table
+    if(!m_storage.tableHasColumn("epgindex", "eventid")) {
+        m_storage.exec("ALTER TABLE epgindex ADD COLUMN eventid INTEGER NOT NULL");
+    }
+
+    if(!m_storage.tableHasColumn("epgindex", "contenthash")) {
+        m_storage.exec("ALTER TABLE epgindex ADD COLUMN contenthash INTEGER DEFAULT 0 NOT NULL");
+    }
+
+    // existing rows get indexed again to fill in the channel uid
+    if(!m_storage.tableHasColumn("epgindex", "channeluid")) {
+        m_storage.exec("ALTER TABLE epgindex ADD COLUMN channeluid INTEGER DEFAULT 0 NOT NULL");
+        m_storage.exec("UPDATE epgindex SET contenthash=0");
+    }
+}
+
+void EpgIndex::cleanup(time_t now) {
+    INFOLOG("removing outdated epg entries");
+
+    // forget the state of outdated events
+    {
+        std::lock_guard<std::mutex> lock(m_stateMutex);
+
+        for(auto i = m_state.begin(); i != m_state.end();) {
+            if(i->second.timestamp < (uint64_t)now) {
+                i = m_state.erase(i);
+            }
+            else {
+                i++;
+            }
+        }
+    }
+
+    // drop outdated search partitions
+    {
+        std::lock_guard<std::mutex> lock(m_partitionMutex);
+        uint32_t today = getPartition(now);
+
+        for(auto i = m_partitions.begin(); i != m_partitions.end() && *i < today;) {
+            if(m_storage.exec("DROP TABLE IF EXISTS epgsearch_%i", (int)*i) != SQLITE_OK) {
+                ERRORLOG("Unable to drop epg search partition %u", *i);
+                i++;
+                continue;
+            }
+
+            INFOLOG("dropped epg search partition %u", *i);
+            m_dirtyPartitions.erase(*i);
+            i = m_partitions.erase(i);
+        }
+    }
+
+    m_storage.exec("DELETE FROM epgindex WHERE timestamp < %llu", (uint64_t)now);
+}
+
+void EpgIndex::mergeSegments() {
+    std::lock_guard<std::mutex> lock(m_partitionMutex);
+
+    for(uint32_t day : m_dirtyPartitions) {
+        m_storage.exec("INSERT INTO epgsearch_%i(epgsearch_%i) VALUES('merge=%i,8')", (int)day, (int)day, EPG_MERGE_PAGES);
+    }
+
+    m_dirtyPartitions.clear();
+}
+
+bool EpgIndex::search(roboTV::Database& storage, const std::string& searchTerm, time_t now, uint32_t offset, uint32_t limit, std::function<void(const Result&)> callback) {
+    // the search index is partitioned by day
+    std::vector<uint32_t> partitions = getPartitions(storage, getPartition(now));
+
+    if(partitions.empty()) {
+        return true;
+    }
+
+    std::string matches;
+
+    for(uint32_t day : partitions) {
+        std::string table = "epgsearch_" + std::to_string(day);
+        matches += matches.empty() ? "" : " UNION ALL ";
+        matches += "SELECT docid, bm25(matchinfo(" + table + ", 'pcnalx'), 2.0, 1.0) AS rank FROM " + table + " WHERE " + table + " MATCH ?1";
+    }
+
+    // an event moved to another day may be found in both partitions
+    roboTV::Statement s(storage,
+                        "SELECT epgindex.eventid,epgindex.timestamp,epgindex.channelid,epgindex.channeluid,epgindex.channelname "
+                        "FROM (SELECT docid, MIN(rank) AS rank FROM (" + matches + ") GROUP BY docid) AS m "
+                        "JOIN epgindex ON epgindex.docid=m.docid "
+                        "WHERE epgindex.timestamp >= ?2 "
+                        "ORDER BY m.rank "
+                        "LIMIT ?3 OFFSET ?4");
+
+    s.bind(1, searchTerm)
+    .bind(2, (int64_t)now)
+    .bind(3, limit)
+    .bind(4, offset);
+
+    while(s.step()) {
+        const char* channelId = s.getText(2);
+        const char* channelName = s.getText(4);
+
+        Result result;
+        result.eventId = (uint32_t)s.getInt64(0);
+        result.timeStamp = (time_t)s.getInt64(1);
+        result.channelId = channelId ? channelId : "";
+        result.channelUid = (uint32_t)s.getInt64(3);
+        result.channelName = channelName ? channelName : "";
+
+        callback(result);
+    }
+
+    return true;
+}
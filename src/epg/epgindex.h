@@ -0,0 +1,152 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_EPGINDEX_H
+#define ROBOTV_EPGINDEX_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "db/database.h"
+
+/** @short Storage of the EPG search index.
+ * The event rows ("epgindex") and the full text index, split into one
+ * table ("epgsearch_<day>") per day (UTC) of the event start time.
+ * Outdated days are dropped as a whole. This part doesn't depend on VDR,
+ * the EpgHandler feeds it with the events of VDR's EPG.
+ */
+class EpgIndex {
+public:
+
+    struct Entry {
+        int docId;
+        uint32_t eventId;
+        uint64_t timestamp;
+        std::string channelId;
+        std::string channelName;
+        uint32_t channelUid;
+        std::string title;
+        std::string subject;
+        uint32_t hash;
+    };
+
+    struct Result {
+        uint32_t eventId;
+        time_t timeStamp;
+        std::string channelId;
+        uint32_t channelUid;
+        std::string channelName;
+    };
+
+    EpgIndex(roboTV::Database& storage);
+
+    virtual ~EpgIndex();
+
+    /** @short Create (or migrate) the schema */
+    void createDb();
+
+    /** @short Load the content hashes of the indexed events */
+    void loadState();
+
+    /** @short Check if an event needs to be written.
+     * Unchanged events (same content hash) are skipped.
+     * @return true if the event changed
+     */
+    bool changed(const Entry& entry);
+
+    /** @short Write events in one transaction.
+     * The content hashes of the events are recorded once the transaction
+     * has been committed.
+     */
+    void write(const std::deque<Entry>& entries);
+
+    /** @short Remove events (and search partitions) before a point in time */
+    void cleanup(time_t now);
+
+    /** @short Merge FTS segments.
+     * Runs a limited incremental merge on all search partitions written
+     * since the last call.
+     */
+    void mergeSegments();
+
+    /** @short Number of events in the index */
+    size_t size();
+
+    /** @short Ranked full text search.
+     * Matches are ordered by relevance (bm25), titles weigh twice as much as subjects.
+     * @param storage database of the index
+     * @param searchTerm FTS4 match expression
+     * @param now events that started before are skipped
+     * @param offset number of results to skip
+     * @param limit maximum number of results
+     * @param callback called for every result
+     */
+    static bool search(roboTV::Database& storage, const std::string& searchTerm, time_t now, uint32_t offset, uint32_t limit, std::function<void(const Result&)> callback);
+
+    /** @short Get the search partitions.
+     * @param fromDay first day to include
+     * @return days of all existing partitions (ascending)
+     */
+    static std::vector<uint32_t> getPartitions(roboTV::Database& storage, uint32_t fromDay = 0);
+
+    /** @short Get the partition (day) of a timestamp */
+    static uint32_t getPartition(uint64_t timestamp);
+
+private:
+
+    struct State {
+        uint32_t hash;
+        uint64_t timestamp;
+    };
+
+    /** @short Create a search partition (if needed).
+     * Must be called with m_partitionMutex held.
+     */
+    bool createPartition(uint32_t day);
+
+    roboTV::Database& m_storage;
+
+    std::mutex m_stateMutex;
+
+    // content hash of all indexed events (by docid)
+    std::unordered_map<int, State> m_state;
+
+    // guards the creation / removal of search partitions
+    std::mutex m_partitionMutex;
+
+    std::set<uint32_t> m_partitions;
+
+    // partitions written since the last segment merge
+    std::set<uint32_t> m_dirtyPartitions;
+};
+
+#endif // ROBOTV_EPGINDEX_H
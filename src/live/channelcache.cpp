@@ -23,11 +23,33 @@
  */
 
 #include <thread>
+#include <vector>
 #include "channelcache.h"
 #include "tools/hash.h"
 
-ChannelCache::ChannelCache() {
-    createDb();
+// time to collect stream updates before writing them (coalescing)
+#define CHANNELCACHE_WRITE_DELAY_MS 500
+
+// number of stream bundles kept in memory (most recently used)
+#define CHANNELCACHE_BUNDLE_CACHE_SIZE 64
+
+ChannelCache::ChannelCache() : m_table(*this) {
+    m_table.createDb();
+    loadEnabled();
+
+    m_writerThread = std::thread([&]() {
+        writer();
+    });
+}
+
+ChannelCache::~ChannelCache() {
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        m_running = false;
+        m_writeCond.notify_all();
+    }
+
+    m_writerThread.join();
 }
 
 ChannelCache& ChannelCache::instance() {
@@ -54,204 +76,209 @@ void ChannelCache::gc() {
     // TODO - implement garbage collection
 }
 
-void ChannelCache::createDb() {
-    std::string schema =
-        "CREATE TABLE IF NOT EXISTS channelcache (\n"
-        "  channeluid INT NOT NULL,\n"
-        "  pid INT NOT NULL,\n"
-        "  content INT NOT NULL,\n"
-        "  type INT NOT NULL,\n"
-        "  language TEXT,\n"
-        "  audiotype INT DEFAULT 0,\n"
-        "  fpsscale INT DEFAULT 0,\n"
-        "  fpsrate INT DEFAULT 0,\n"
-        "  height INT DEFAULT 0,\n"
-        "  width INT DEFAULT 0,\n"
-        "  aspect INT DEFAULT 1,\n"
-        "  channels INT DEFAULT 0,\n"
-        "  samplerate INT DEFAULT 0,\n"
-        "  bitrate INT DEFAULT 0,\n"
-        "  bitspersample INT DEFAULT 0,\n"
-        "  blockalign INT DEFAULT 0,\n"
-        "  parsed BOOLEAN DEFAULT 0,\n"
-        "  subtitlingtype INT DEFAULT 0,\n"
-        "  compositionpageid INT DEFAULT 0,\n"
-        "  ancillarypageid INT DEFAULT 0,\n"
-        "  sps BLOB,\n"
-        "  pps BLOB,\n"
-        "  vps BLOB,\n"
-        "  PRIMARY KEY (channeluid, pid)"
-        ");\n"
-        "CREATE INDEX IF NOT EXISTS channelcache_channeluid ON channelcache(channeluid);\n"
-        "CREATE TABLE IF NOT EXISTS enabledchannels (\n"
-        "  channeluid INT NOT NULL,\n"
-        "  enabled INT DEFAULT 0 NOT NULL,\n"
-        "  PRIMARY KEY (channeluid)\n"
-        ");\n";
-
-    if(exec(schema) != SQLITE_OK) {
-        ERRORLOG("Unable to create database schema for channelcache");
+void ChannelCache::add(uint32_t channeluid, const StreamBundle& channel) {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    m_pending[channeluid] = channel;
+    m_writeCond.notify_all();
+}
+
+void ChannelCache::writer() {
+    prewarm();
+
+    std::unique_lock<std::mutex> lock(m_writeMutex);
+
+    while(m_running || !m_pending.empty()) {
+        if(m_pending.empty()) {
+            m_writeCond.wait(lock);
+            continue;
+        }
+
+        // collect updates for a while, only the latest bundle of a channel survives
+        if(m_running) {
+            m_writeCond.wait_for(lock, std::chrono::milliseconds(CHANNELCACHE_WRITE_DELAY_MS), [&]() {
+                return !m_running;
+            });
+        }
+
+        std::map<uint32_t, StreamBundle> pending;
+        pending.swap(m_pending);
+
+        for(auto& i : pending) {
+            StreamBundle stored;
+            bool known = cacheGet(i.first, stored);
+
+            cachePut(i.first, i.second);
+            lock.unlock();
+
+            // diff against the stored bundle
+            if(!known) {
+                stored = lookupDb(i.first);
+            }
+
+            if(!isEqual(stored, i.second)) {
+                addDb(i.first, i.second);
+            }
+
+            lock.lock();
+        }
+    }
+}
+
+void ChannelCache::prewarm() {
+    std::vector<uint32_t> uids;
+
+    {
+        std::lock_guard<std::mutex> lock(m_enabledMutex);
+        uids.assign(m_enabled.begin(), m_enabled.end());
+    }
+
+    if(uids.size() > CHANNELCACHE_BUNDLE_CACHE_SIZE) {
+        uids.resize(CHANNELCACHE_BUNDLE_CACHE_SIZE);
+    }
+
+    for(uint32_t uid : uids) {
+        StreamBundle bundle = lookupDb(uid);
+
+        if(bundle.empty()) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+
+        // don't overwrite a bundle that has been updated meanwhile
+        StreamBundle cached;
+
+        if(!cacheGet(uid, cached)) {
+            cachePut(uid, bundle);
+        }
     }
+
+    INFOLOG("prewarmed stream cache with %i channels", (int)m_bundleCache.size());
 }
 
-std::string ChannelCache::createStringLiteral(uint8_t* data, int length) {
-    char buffer[3];
-    std::string literal;
+bool ChannelCache::cacheGet(uint32_t channeluid, StreamBundle& bundle) {
+    auto i = m_bundleIndex.find(channeluid);
 
-    for(int i = 0; i < length; i++) {
-        snprintf(buffer, sizeof(buffer), "%02X", data[i]);
-        literal += buffer;
+    if(i == m_bundleIndex.end()) {
+        return false;
     }
 
-    return literal;
+    m_bundleCache.splice(m_bundleCache.begin(), m_bundleCache, i->second);
+    bundle = i->second->second;
+    return true;
 }
 
-void ChannelCache::add(uint32_t channeluid, const StreamBundle& channel) {
-    std::thread t([ = ]() {
-        addDb(channeluid, channel);
-    });
+void ChannelCache::cachePut(uint32_t channeluid, const StreamBundle& bundle) {
+    auto i = m_bundleIndex.find(channeluid);
+
+    if(i != m_bundleIndex.end()) {
+        i->second->second = bundle;
+        m_bundleCache.splice(m_bundleCache.begin(), m_bundleCache, i->second);
+        return;
+    }
+
+    m_bundleCache.push_front({channeluid, bundle});
+    m_bundleIndex[channeluid] = m_bundleCache.begin();
+
+    while(m_bundleCache.size() > CHANNELCACHE_BUNDLE_CACHE_SIZE) {
+        m_bundleIndex.erase(m_bundleCache.back().first);
+        m_bundleCache.pop_back();
+    }
+}
+
+bool ChannelCache::isEqual(const StreamBundle& a, const StreamBundle& b) {
+    if(a.size() != b.size()) {
+        return false;
+    }
+
+    for(auto i = a.begin(), j = b.begin(); i != a.end(); i++, j++) {
+        const StreamInfo& x = i->second;
+        const StreamInfo& y = j->second;
+
+        if(i->first != j->first ||
+           x.m_pid != y.m_pid ||
+           x.m_content != y.m_content ||
+           x.m_type != y.m_type ||
+           strncmp(x.m_language, y.m_language, sizeof(x.m_language)) != 0 ||
+           x.m_audioType != y.m_audioType ||
+           x.m_fpsScale != y.m_fpsScale ||
+           x.m_fpsRate != y.m_fpsRate ||
+           x.m_height != y.m_height ||
+           x.m_width != y.m_width ||
+           x.m_aspect != y.m_aspect ||
+           x.m_channels != y.m_channels ||
+           x.m_sampleRate != y.m_sampleRate ||
+           x.m_bitRate != y.m_bitRate ||
+           x.m_bitsPerSample != y.m_bitsPerSample ||
+           x.m_blockAlign != y.m_blockAlign ||
+           x.m_parsed != y.m_parsed ||
+           x.m_subTitlingType != y.m_subTitlingType ||
+           x.m_compositionPageId != y.m_compositionPageId ||
+           x.m_ancillaryPageId != y.m_ancillaryPageId ||
+           x.m_spsLength != y.m_spsLength ||
+           x.m_ppsLength != y.m_ppsLength ||
+           x.m_vpsLength != y.m_vpsLength ||
+           memcmp(x.m_sps, y.m_sps, x.m_spsLength) != 0 ||
+           memcmp(x.m_pps, y.m_pps, x.m_ppsLength) != 0 ||
+           memcmp(x.m_vps, y.m_vps, x.m_vpsLength) != 0) {
+            return false;
+        }
+    }
 
-    t.detach();
+    return true;
 }
 
 void ChannelCache::addDb(uint32_t channeluid, const StreamBundle& channel) {
-    begin();
-
-    exec("DELETE FROM channelcache WHERE channeluid=%i", channeluid);
-
-    for(auto i : channel) {
-        StreamInfo& info = i.second;
-
-        exec(
-            "INSERT INTO channelcache("
-            "channeluid,"
-            "pid,"
-            "content,"
-            "type,"
-            "language,"
-            "audiotype,"
-            "fpsscale,"
-            "fpsrate,"
-            "height,"
-            "width,"
-            "aspect,"
-            "channels,"
-            "samplerate,"
-            "bitrate,"
-            "bitspersample,"
-            "blockalign,"
-            "parsed,"
-            "subtitlingtype,"
-            "compositionpageid,"
-            "ancillarypageid,"
-            "sps,"
-            "pps,"
-            "vps) "
-            "VALUES ("
-            "%i,%i,%i,%i,%Q,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,x'%s',x'%s',x'%s'"
-            ")",
-            channeluid,
-            info.m_pid,
-            (int)info.m_content,
-            (int)info.m_type,
-            info.m_language,
-            info.m_audioType,
-            info.m_fpsScale,
-            info.m_fpsRate,
-            info.m_height,
-            info.m_width,
-            info.m_aspect,
-            info.m_channels,
-            info.m_sampleRate,
-            info.m_bitRate,
-            info.m_bitsPerSample,
-            info.m_blockAlign,
-            (int)info.m_parsed,
-            info.m_subTitlingType,
-            info.m_compositionPageId,
-            info.m_ancillaryPageId,
-            createStringLiteral(info.m_sps, info.m_spsLength).c_str(),
-            createStringLiteral(info.m_pps, info.m_ppsLength).c_str(),
-            createStringLiteral(info.m_vps, info.m_vpsLength).c_str()
-        );
+    std::vector<StreamInfo> streams;
+    streams.reserve(channel.size());
+
+    for(auto& i : channel) {
+        streams.push_back(i.second);
     }
 
-    commit();
+    m_table.write(channeluid, streams);
 }
 
 StreamBundle ChannelCache::lookup(uint32_t channeluid) {
-    sqlite3_stmt* s = query(
-                          "SELECT "
-                          "  pid,"
-                          "  content,"
-                          "  type,"
-                          "  language,"
-                          "  audiotype,"
-                          "  fpsscale,"
-                          "  fpsrate,"
-                          "  height,"
-                          "  width,"
-                          "  aspect,"
-                          "  channels,"
-                          "  samplerate,"
-                          "  bitrate,"
-                          "  bitspersample,"
-                          "  blockalign,"
-                          "  parsed,"
-                          "  subtitlingtype,"
-                          "  compositionpageid,"
-                          "  ancillarypageid,"
-                          "  sps,"
-                          "  pps,"
-                          "  vps "
-                          "FROM "
-                          "  channelcache "
-                          "WHERE"
-                          "  channeluid=%i",
-                          channeluid
-                      );
-
-    if(s == NULL) {
-        return StreamBundle();
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        auto i = m_pending.find(channeluid);
+
+        if(i != m_pending.end()) {
+            return i->second;
+        }
+
+        StreamBundle bundle;
+
+        if(cacheGet(channeluid, bundle)) {
+            return bundle;
+        }
     }
 
-    StreamBundle bundle;
+    StreamBundle bundle = lookupDb(channeluid);
+
+    if(bundle.empty()) {
+        return bundle;
+    }
 
-    while(sqlite3_step(s) == SQLITE_ROW) {
-        StreamInfo info;
-        info.m_pid = sqlite3_column_int(s, 0);
-        info.m_content = (StreamInfo::Content)sqlite3_column_int(s, 1);
-        info.m_type = (StreamInfo::Type)sqlite3_column_int(s, 2);
-        strncpy(info.m_language, (const char*)sqlite3_column_text(s, 3), sizeof(info.m_language));
-        info.m_audioType = sqlite3_column_int(s, 4);
-        info.m_fpsScale = sqlite3_column_int(s, 5);
-        info.m_fpsRate = sqlite3_column_int(s, 6);
-        info.m_height = sqlite3_column_int(s, 7);
-        info.m_width = sqlite3_column_int(s, 8);
-        info.m_aspect = sqlite3_column_int(s, 9);
-        info.m_channels = sqlite3_column_int(s, 10);
-        info.m_sampleRate = sqlite3_column_int(s, 11);
-        info.m_bitRate = sqlite3_column_int(s, 12);
-        info.m_bitsPerSample = sqlite3_column_int(s, 13);
-        info.m_blockAlign = sqlite3_column_int(s, 14);
-        info.m_parsed = (sqlite3_column_int(s, 15) == 1);
-        info.m_subTitlingType = sqlite3_column_int(s, 16);
-        info.m_compositionPageId = sqlite3_column_int(s, 17);
-        info.m_ancillaryPageId = sqlite3_column_int(s, 18);
-
-        info.m_spsLength = sqlite3_column_bytes(s, 19);
-        memcpy(info.m_sps, sqlite3_column_text(s, 19), info.m_spsLength);
-
-        info.m_ppsLength = sqlite3_column_bytes(s, 20);
-        memcpy(info.m_pps, sqlite3_column_text(s, 20), info.m_ppsLength);
-
-        info.m_vpsLength = sqlite3_column_bytes(s, 21);
-        memcpy(info.m_vps, sqlite3_column_text(s, 21), info.m_vpsLength);
+    // keep bundles that have been queued or written meanwhile
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    StreamBundle cached;
 
+    if(m_pending.find(channeluid) == m_pending.end() && !cacheGet(channeluid, cached)) {
+        cachePut(channeluid, bundle);
+    }
+
+    return bundle;
+}
+
+StreamBundle ChannelCache::lookupDb(uint32_t channeluid) {
+    StreamBundle bundle;
+
+    for(auto& info : m_table.read(channeluid)) {
         bundle.addStream(info);
     }
 
-    sqlite3_finalize(s);
     return bundle;
 }
 
@@ -260,11 +287,24 @@ void ChannelCache::enable(const cChannel* channel, bool enabled) {
 }
 
 void ChannelCache::enable(uint32_t channeluid, bool enabled) {
-    exec(
-        "INSERT OR REPLACE INTO enabledchannels(channeluid, enabled) VALUES(%i, %i)",
-        channeluid,
-        (int)enabled
-    );
+    m_table.setEnabled(channeluid, enabled);
+
+    {
+        std::lock_guard<std::mutex> lock(m_enabledMutex);
+
+        if(enabled) {
+            m_enabled.insert(channeluid);
+        }
+        else {
+            m_enabled.erase(channeluid);
+        }
+    }
+
+    m_enabledVersion++;
+}
+
+uint32_t ChannelCache::getEnabledVersion() const {
+    return m_enabledVersion;
 }
 
 bool ChannelCache::isEnabled(const cChannel* channel) {
@@ -272,22 +312,16 @@ bool ChannelCache::isEnabled(const cChannel* channel) {
 }
 
 bool ChannelCache::isEnabled(uint32_t channeluid) {
-    sqlite3_stmt* s = query(
-                          "SELECT enabled WHERE channeluid=%i",
-                          channeluid
-                      );
-
-    if(s == NULL) {
-        return false;
-    }
+    std::lock_guard<std::mutex> lock(m_enabledMutex);
+    return (m_enabled.find(channeluid) != m_enabled.end());
+}
 
-    if(sqlite3_step(s) != SQLITE_ROW) {
-        sqlite3_finalize(s);
-        return false;
-    }
+void ChannelCache::loadEnabled() {
+    std::vector<uint32_t> enabled = m_table.getEnabled();
+    std::lock_guard<std::mutex> lock(m_enabledMutex);
 
-    bool rc = (sqlite3_column_int(s, 0) == 1);
+    m_enabled.clear();
+    m_enabled.insert(enabled.begin(), enabled.end());
 
-    sqlite3_finalize(s);
-    return rc;
+    INFOLOG("loaded %i enabled channels", (int)m_enabled.size());
 }
@@ -25,16 +25,31 @@
 #ifndef ROBOTV_CHANNELCACHE_H
 #define ROBOTV_CHANNELCACHE_H
 
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "config/config.h"
 #include "db/storage.h"
 #include "demuxer/streambundle.h"
+#include "channelcachetable.h"
 
 class ChannelCache : public roboTV::Storage {
 public:
 
+    virtual ~ChannelCache();
+
+    /** Queue a stream bundle for a channel.
+     The bundle is written by a background thread. Repeated updates of
+     the same channel are coalesced, only the latest bundle is written
+     and unchanged bundles are skipped.
+     */
     void add(uint32_t channeluid, const StreamBundle& channel);
 
     StreamBundle add(const cChannel* channel);
@@ -49,6 +64,12 @@ public:
 
     bool isEnabled(uint32_t channeluid);
 
+    /** Version of the enabled channel state.
+     Incremented on every call to enable(), so cached channel lists
+     built from the enabled state can detect that they are outdated.
+     */
+    uint32_t getEnabledVersion() const;
+
     void gc();
 
     static ChannelCache& instance();
@@ -61,9 +82,43 @@ private:
 
     void addDb(uint32_t channeluid, const StreamBundle& channel);
 
-    void createDb();
+    StreamBundle lookupDb(uint32_t channeluid);
+
+    void writer();
+
+    void prewarm();
+
+    bool cacheGet(uint32_t channeluid, StreamBundle& bundle);
+
+    void cachePut(uint32_t channeluid, const StreamBundle& bundle);
+
+    static bool isEqual(const StreamBundle& a, const StreamBundle& b);
+
+    void loadEnabled();
+
+    ChannelCacheTable m_table;
+
+    std::atomic<uint32_t> m_enabledVersion{0};
+
+    std::unordered_set<uint32_t> m_enabled;
+
+    std::mutex m_enabledMutex;
+
+    std::mutex m_writeMutex;
+
+    std::condition_variable m_writeCond;
+
+    std::thread m_writerThread;
+
+    bool m_running = true;
+
+    std::map<uint32_t, StreamBundle> m_pending;
+
+    typedef std::list<std::pair<uint32_t, StreamBundle>> BundleList;
+
+    BundleList m_bundleCache;
 
-    std::string createStringLiteral(uint8_t* data, int length);
+    std::unordered_map<uint32_t, BundleList::iterator> m_bundleIndex;
 
 };
 
@@ -0,0 +1,68 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_CHANNELCACHETABLE_H
+#define ROBOTV_CHANNELCACHETABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "db/database.h"
+#include "demuxer/streaminfo.h"
+
+/** Rows of the channel cache.
+ The parsed streams of every channel and the enabled state of the
+ channels. This part doesn't depend on VDR, the ChannelCache adds the
+ coalescing writer and the in-memory bundle cache.
+ */
+class ChannelCacheTable {
+public:
+
+    ChannelCacheTable(roboTV::Database& storage);
+
+    virtual ~ChannelCacheTable();
+
+    void createDb();
+
+    /** Replace the streams of a channel (in one transaction) */
+    void write(uint32_t channeluid, const std::vector<StreamInfo>& streams);
+
+    /** Read the streams of a channel */
+    std::vector<StreamInfo> read(uint32_t channeluid);
+
+    void setEnabled(uint32_t channeluid, bool enabled);
+
+    /** Uids of all enabled channels */
+    std::vector<uint32_t> getEnabled();
+
+private:
+
+    static std::string createStringLiteral(const uint8_t* data, int length);
+
+    roboTV::Database& m_storage;
+
+};
+
+#endif // ROBOTV_CHANNELCACHETABLE_H
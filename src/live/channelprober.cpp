@@ -0,0 +1,147 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <vdr/channels.h>
+
+#include "channelprober.h"
+#include "channelcache.h"
+#include "livehub.h"
+#include "config/config.h"
+#include "tools/hash.h"
+
+// time a channel is received at most
+#define PROBE_TIMEOUT_MS (15 * 1000)
+
+// channels are probed again after this time (e.g. channels without a
+// running program or with streams that stay unparsed)
+#define PROBE_RETRY_INTERVAL_MS (6 * 60 * 60 * 1000)
+
+ChannelProber::ChannelProber() {
+    Metrics::instance().add(this, "prober", [ = ]() {
+        return getMetrics();
+    });
+}
+
+ChannelProber::~ChannelProber() {
+    Metrics::instance().remove(this);
+    stop();
+}
+
+ChannelProber& ChannelProber::instance() {
+    static ChannelProber prober;
+    return prober;
+}
+
+void ChannelProber::probe() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_hub == NULL) {
+        startProbe();
+        return;
+    }
+
+    // the hub stores the parsed streams in the cache
+    bool parsed = ChannelCache::instance().lookup(m_channelUid).isParsed();
+    bool timeout = (std::chrono::steady_clock::now() - m_started > std::chrono::milliseconds(PROBE_TIMEOUT_MS));
+
+    if(!parsed && !timeout) {
+        return;
+    }
+
+    if(parsed) {
+        m_completed++;
+    }
+    else {
+        m_timeouts++;
+    }
+
+    LiveHub::releaseStandby(m_hub);
+    m_hub = NULL;
+}
+
+void ChannelProber::stop() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    LiveHub::releaseStandby(m_hub);
+    m_hub = NULL;
+}
+
+bool ChannelProber::startProbe() {
+    ChannelCache& cache = ChannelCache::instance();
+    auto now = std::chrono::steady_clock::now();
+
+    Channels.Lock(false);
+
+    for(cChannel* channel = Channels.First(); channel != NULL; channel = Channels.Next(channel)) {
+        if(channel->GroupSep() || !cache.isEnabled(channel)) {
+            continue;
+        }
+
+        uint32_t uid = createChannelUid(channel);
+        auto i = m_probed.find(uid);
+
+        if(i != m_probed.end() && now - i->second < std::chrono::milliseconds(PROBE_RETRY_INTERVAL_MS)) {
+            continue;
+        }
+
+        if(cache.lookup(uid).isParsed()) {
+            continue;
+        }
+
+        // only piggyback on tuned transponders, tuners are never switched
+        cDevice* device = LiveHub::findTunedDevice(channel);
+
+        if(device == NULL) {
+            continue;
+        }
+
+        m_probed[uid] = now;
+        m_hub = LiveHub::acquireStandby(channel, device);
+
+        if(m_hub == NULL) {
+            continue;
+        }
+
+        INFOLOG("probing channel %i - %s", channel->Number(), channel->Name());
+
+        m_channelUid = uid;
+        m_started = now;
+        break;
+    }
+
+    Channels.Unlock();
+    return (m_hub != NULL);
+}
+
+nlohmann::json ChannelProber::getMetrics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return {
+        {"probing", m_hub != NULL},
+        {"channelUid", m_channelUid},
+        {"probed", m_probed.size()},
+        {"completed", m_completed},
+        {"timeouts", m_timeouts}
+    };
+}
@@ -0,0 +1,87 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_CHANNELPROBER_H
+#define ROBOTV_CHANNELPROBER_H
+
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include "tools/metrics.h"
+
+class LiveHub;
+
+/**
+ * Background prober for the channel cache.
+ * Enabled channels without fully parsed stream information are received
+ * one at a time on a device already tuned to their transponder (as a
+ * standby receiver with the lowest priority) until the demuxers have
+ * parsed all streams. The hub stores the parsed streams in the channel
+ * cache, so the first zap to the channel starts like a cached one.
+ * Enabled with ChannelProbe = true in robotv.conf.
+ */
+class ChannelProber {
+public:
+
+    static ChannelProber& instance();
+
+    /** Check the running probe or start the next one (scheduler task) */
+    void probe();
+
+    /** Stop the running probe */
+    void stop();
+
+protected:
+
+    ChannelProber();
+
+    virtual ~ChannelProber();
+
+    nlohmann::json getMetrics();
+
+private:
+
+    /** Start a probe of the next channel on a tuned transponder */
+    bool startProbe();
+
+    LiveHub* m_hub = NULL;
+
+    uint32_t m_channelUid = 0;
+
+    std::chrono::steady_clock::time_point m_started;
+
+    /** Start time of the last probe of a channel */
+    std::map<uint32_t, std::chrono::steady_clock::time_point> m_probed;
+
+    std::mutex m_mutex;
+
+    uint64_t m_completed = 0;
+
+    uint64_t m_timeouts = 0;
+
+};
+
+#endif // ROBOTV_CHANNELPROBER_H
@@ -0,0 +1,86 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include "latencytrace.h"
+#include "tools/time.h"
+
+std::atomic<bool> LatencyTrace::m_enabled(false);
+std::map<uint32_t, LatencyTrace::Channel*> LatencyTrace::m_channels;
+std::mutex LatencyTrace::m_mutex;
+
+static const char* stageNames[] = { "queue", "read", "aggregate", "send" };
+
+void LatencyTrace::setEnabled(bool enabled) {
+    m_enabled = enabled;
+}
+
+void LatencyTrace::add(uint32_t channelUid, Stage stage, int64_t us) {
+    if(!m_enabled || stage >= stCount) {
+        return;
+    }
+
+    Channel* channel = NULL;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto i = m_channels.find(channelUid);
+
+        // channels are kept once traced (bounded by the channel list)
+        if(i == m_channels.end()) {
+            channel = new Channel;
+            channel->channelUid = channelUid;
+            m_channels[channelUid] = channel;
+
+            Metrics::instance().add(channel, "latency", [ = ]() {
+                return report(*channel);
+            });
+        }
+        else {
+            channel = i->second;
+        }
+    }
+
+    channel->stages[stage].add(us < 0 ? 0 : us);
+}
+
+void LatencyTrace::addSince(uint32_t channelUid, Stage stage, int64_t wallclockTimeMs) {
+    if(!m_enabled || wallclockTimeMs == 0) {
+        return;
+    }
+
+    add(channelUid, stage, (roboTV::currentTimeMillis().count() - wallclockTimeMs) * 1000);
+}
+
+nlohmann::json LatencyTrace::report(const Channel& channel) {
+    nlohmann::json j = {
+        {"channelUid", channel.channelUid}
+    };
+
+    for(int i = 0; i < stCount; i++) {
+        j[stageNames[i]] = channel.stages[i].toJson();
+    }
+
+    return j;
+}
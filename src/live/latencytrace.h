@@ -0,0 +1,103 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_LATENCYTRACE_H
+#define ROBOTV_LATENCYTRACE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include "tools/metrics.h"
+
+/**
+ * Glass-to-glass latency tracing of live packets.
+ * Records the age of live packets (since they left the demuxer) at every
+ * hand-off of the pipeline, per channel:
+ *
+ * queue     - receiver thread -> timeshift writer thread (time spent in the writer queue)
+ * read      - timeshift storage -> client thread
+ * aggregate - oldest packet of a batch when the batch is complete
+ * send      - oldest packet of a batch when the batch has been written to the socket
+ *
+ * Reports are exported (group "latency") by the SVDRP command STAT.
+ * Tracing is disabled by default (LatencyTrace = true in robotv.conf).
+ */
+class LatencyTrace {
+public:
+
+    enum Stage {
+        stQueue = 0,
+        stRead,
+        stAggregate,
+        stSend,
+        stCount
+    };
+
+    static void setEnabled(bool enabled);
+
+    /** Monotonic time (in microseconds) for queue timestamps */
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static bool isEnabled() {
+        return m_enabled;
+    }
+
+    /** Add a sample.
+     @param channelUid uid of the channel
+     @param stage pipeline stage
+     @param us age of the packet (in microseconds)
+     */
+    static void add(uint32_t channelUid, Stage stage, int64_t us);
+
+    /** Add a sample from a wallclock timestamp.
+     @param channelUid uid of the channel
+     @param stage pipeline stage
+     @param wallclockTimeMs creation time of the packet (see roboTV::currentTimeMillis)
+     */
+    static void addSince(uint32_t channelUid, Stage stage, int64_t wallclockTimeMs);
+
+private:
+
+    struct Channel {
+        uint32_t channelUid;
+        LatencyHistogram stages[stCount];
+    };
+
+    static nlohmann::json report(const Channel& channel);
+
+    static std::atomic<bool> m_enabled;
+
+    static std::map<uint32_t, Channel*> m_channels;
+
+    static std::mutex m_mutex;
+
+};
+
+#endif // ROBOTV_LATENCYTRACE_H
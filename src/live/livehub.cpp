@@ -0,0 +1,1043 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <vdr/remux.h>
+#include <vdr/timers.h>
+
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "net/msgpacketwriter.h"
+#include "robotv/robotvcommand.h"
+#include "robotv/controllers/channelcontroller.h"
+#include "tools/cpuplacement.h"
+#include "tools/hash.h"
+#include "tools/time.h"
+#include "tools/tracepoints.h"
+
+#include "livehub.h"
+#include "timeshiftstore.h"
+#include "channelcache.h"
+#include "peerregistry.h"
+#include "relaysource.h"
+
+// minimum size of a passthrough TS batch (cut at frame borders)
+#define RAW_BATCH_SIZE (64 * 1024)
+
+// maximum size of a passthrough TS batch
+#define RAW_BATCH_MAX (1024 * 1024)
+
+// received data is analyzed in blocks (the frame detector looks ahead up to 100 TS packets)
+#define RAW_ANALYZE_SIZE (256 * TS_SIZE)
+
+// audio frames are coalesced into batches of 100 ms (90 kHz pts)
+#define AUDIO_BATCH_PTS (100 * 90)
+
+// maximum number of frames in an audio batch
+#define AUDIO_BATCH_FRAMES 64
+
+std::map<uint32_t, LiveHub*> LiveHub::m_hubs;
+std::mutex LiveHub::m_hubsMutex;
+std::set<LiveHub*> LiveHub::m_hubList;
+std::mutex LiveHub::m_hubListMutex;
+
+LiveHub::LiveHub(const cChannel* channel, int priority)
+    : cReceiver(NULL, priority)
+    , m_demuxers(this)
+    , m_demux(false)
+    , m_standby(false)
+    , m_bitRate(0)
+    , m_declaredBitRate(0)
+    , m_bytesReceived(0)
+    , m_packetsQueued(0)
+    , m_rawPacketsQueued(0)
+    , m_audioFramesQueued(0) {
+    m_uid = createChannelUid(channel);
+    m_audioOnly = ChannelController::isRadio(channel);
+    m_priority = priority;
+    m_demuxers.setParallel(RoboTVServerConfig::instance().parallelDemuxing);
+    m_demuxers.setChannelUid(m_uid);
+
+    // receiver, demuxer workers and timeshift writer share a core cluster
+    CpuPlacement::acquire(m_uid);
+
+    // the hub is the only writer of the channel's timeshift store
+    m_store = TimeShiftStore::acquire(m_uid);
+    m_store->claimWriter(this);
+
+    // radio starts at any audio packet (there are no keyframes to wait for)
+    m_store->setAudioOnly(m_audioOnly);
+
+    registerDeviceStats();
+
+    {
+        std::lock_guard<std::mutex> lock(m_hubListMutex);
+        m_hubList.insert(this);
+    }
+
+    Metrics::instance().add(this, "hubs", [ = ]() {
+        return getMetrics();
+    });
+}
+
+LiveHub::~LiveHub() {
+    Metrics::instance().remove(this);
+
+    {
+        std::lock_guard<std::mutex> lock(m_hubListMutex);
+        m_hubList.erase(this);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        detach();
+        m_demuxers.clear();
+    }
+
+    for(auto& i : m_audioBatches) {
+        delete i.second.packet;
+    }
+
+    m_store->releaseWriter(this);
+    TimeShiftStore::release(m_store);
+
+    {
+        std::lock_guard<std::mutex> lock(m_rawMutex);
+        releaseRawStore();
+    }
+
+    CpuPlacement::release(m_uid);
+
+    INFOLOG("live hub of channel %08x terminated", m_uid);
+}
+
+LiveHub* LiveHub::acquire(const cChannel* channel, int priority, int& status) {
+    LiveHub* hub = NULL;
+
+    // pick (or create) the hub of the channel, the reference keeps it alive
+    {
+        std::lock_guard<std::mutex> lock(m_hubsMutex);
+
+        uint32_t uid = createChannelUid(channel);
+        auto i = m_hubs.find(uid);
+
+        // channel already received
+        if(i != m_hubs.end()) {
+            hub = i->second;
+            INFOLOG("sharing receiver of channel %i - %s", channel->Number(), channel->Name());
+
+            // raise the priority of a standby receiver
+            if(hub->m_priority < priority) {
+                hub->m_priority = priority;
+                hub->SetPriority(priority);
+            }
+        }
+        else {
+            hub = new LiveHub(channel, priority);
+            m_hubs[uid] = hub;
+        }
+
+        hub->m_refCount++;
+    }
+
+    // tune outside of the hub list lock (other channels don't wait for us)
+    // clients of the same channel wait for the first one to switch
+    // standby receivers get detached if their device is needed elsewhere
+    {
+        std::lock_guard<std::mutex> hubLock(hub->m_mutex);
+        status = hub->isActive() ? ROBOTV_RET_OK : hub->switchChannel(channel);
+    }
+
+    if(status != ROBOTV_RET_OK) {
+        release(hub);
+        return NULL;
+    }
+
+    return hub;
+}
+
+void LiveHub::release(LiveHub* hub) {
+    if(hub == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_hubsMutex);
+
+        if(--hub->m_refCount > 0) {
+            return;
+        }
+
+        // back to standby, don't block the device for other channels
+        if(hub->m_standbyRefCount > 0) {
+            hub->m_priority = MINPRIORITY;
+            hub->SetPriority(MINPRIORITY);
+            return;
+        }
+
+        m_hubs.erase(hub->m_uid);
+    }
+
+    delete hub;
+}
+
+LiveHub* LiveHub::acquireStandby(const cChannel* channel, cDevice* device) {
+    std::lock_guard<std::mutex> lock(m_hubsMutex);
+
+    if(device == NULL || !device->IsTunedToTransponder(channel)) {
+        return NULL;
+    }
+
+    uint32_t uid = createChannelUid(channel);
+    auto i = m_hubs.find(uid);
+    LiveHub* hub = NULL;
+
+    // channel already received
+    if(i != m_hubs.end()) {
+        hub = i->second;
+
+        if(!hub->IsAttached()) {
+            std::lock_guard<std::mutex> hubLock(hub->m_mutex);
+
+            if(!hub->attachStandby(channel, device)) {
+                return NULL;
+            }
+        }
+    }
+    else {
+        hub = new LiveHub(channel, MINPRIORITY);
+        bool attached = false;
+
+        {
+            std::lock_guard<std::mutex> hubLock(hub->m_mutex);
+            attached = hub->attachStandby(channel, device);
+        }
+
+        if(!attached) {
+            delete hub;
+            return NULL;
+        }
+
+        INFOLOG("standby receiver for channel %i - %s", channel->Number(), channel->Name());
+        m_hubs[uid] = hub;
+    }
+
+    hub->m_standbyRefCount++;
+    hub->m_standby = true;
+    hub->m_demux = true;
+
+    return hub;
+}
+
+void LiveHub::releaseStandby(LiveHub* hub) {
+    if(hub == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_hubsMutex);
+
+        if(--hub->m_standbyRefCount > 0) {
+            return;
+        }
+
+        hub->m_standby = false;
+
+        if(hub->m_refCount > 0) {
+            std::lock_guard<std::mutex> subscriberLock(hub->m_subscriberMutex);
+            hub->m_demux = !hub->m_subscribers.empty();
+            return;
+        }
+
+        m_hubs.erase(hub->m_uid);
+    }
+
+    delete hub;
+}
+
+LiveHub* LiveHub::find(uint32_t channelUid) {
+    std::lock_guard<std::mutex> lock(m_hubsMutex);
+    auto i = m_hubs.find(channelUid);
+
+    return (i != m_hubs.end()) ? i->second : NULL;
+}
+
+std::vector<uint32_t> LiveHub::channels() {
+    std::lock_guard<std::mutex> lock(m_hubsMutex);
+    std::vector<uint32_t> result;
+
+    for(auto& i : m_hubs) {
+        result.push_back(i.first);
+    }
+
+    return result;
+}
+
+cDevice* LiveHub::findTunedDevice(const cChannel* channel) {
+    cDevice* result = NULL;
+
+    for(int i = 0; i < cDevice::NumDevices(); i++) {
+        cDevice* device = cDevice::GetDevice(i);
+
+        if(device == NULL || !device->IsTunedToTransponder(channel)) {
+            continue;
+        }
+
+        // the device must provide the channel as it is (e.g. CAM, pids)
+        bool needsDetachReceivers = false;
+
+        if(!device->ProvidesChannel(channel, LIVEPRIORITY, &needsDetachReceivers) || needsDetachReceivers) {
+            continue;
+        }
+
+        // an idle device may be retuned at any time
+        if(result == NULL || (device->Receiving() && !result->Receiving())) {
+            result = device;
+        }
+    }
+
+    return result;
+}
+
+void LiveHub::subscribe(Subscriber* subscriber, bool passthrough) {
+    if(passthrough) {
+        std::lock_guard<std::mutex> lock(m_rawMutex);
+
+        // the first passthrough subscriber starts the raw stream
+        if(m_rawStore == NULL) {
+            m_rawStore = TimeShiftStore::acquire(m_uid, true);
+            m_rawStore->claimWriter(this);
+
+            // start over (synced at the next independent frame)
+            m_frameDetector.SetPid(m_rawPid, m_rawPidType);
+            m_rawPending.clear();
+            m_rawBatch.clear();
+        }
+
+        m_rawSubscribers.push_back(subscriber);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_subscriberMutex);
+    m_subscribers.push_back(subscriber);
+    m_demux = true;
+
+    // new subscribers need the current stream setup
+    if(m_demuxers.isReady() && !m_requestStreamChange) {
+        subscriber->streamChange(m_demuxers);
+    }
+
+    updateMutedStreams();
+}
+
+void LiveHub::unsubscribe(Subscriber* subscriber) {
+    {
+        std::lock_guard<std::mutex> lock(m_subscriberMutex);
+        m_subscribers.remove(subscriber);
+        m_demux = !m_subscribers.empty() || m_standby;
+        updateMutedStreams();
+    }
+
+    std::lock_guard<std::mutex> lock(m_rawMutex);
+    m_rawSubscribers.remove(subscriber);
+
+    if(m_rawSubscribers.empty()) {
+        releaseRawStore();
+    }
+}
+
+void LiveHub::updateStreamSelection() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<std::mutex> subscriberLock(m_subscriberMutex);
+
+    updateMutedStreams();
+}
+
+void LiveHub::updateMutedStreams() {
+    std::set<int> selected;
+    std::set<int> muted;
+
+    // nothing is muted without subscribers (standby channels)
+    bool all = m_subscribers.empty();
+
+    for(auto s : m_subscribers) {
+        if(all) {
+            break;
+        }
+
+        all = !s->getSelectedStreams(selected);
+    }
+
+    for(auto i = m_demuxers.begin(); i != m_demuxers.end() && !all; i++) {
+        TsDemuxer* dmx = *i;
+        StreamInfo::Content content = dmx->getContent();
+
+        if(content != StreamInfo::scAUDIO && content != StreamInfo::scSUBTITLE) {
+            continue;
+        }
+
+        if(selected.find(dmx->getPid()) == selected.end()) {
+            muted.insert(dmx->getPid());
+        }
+    }
+
+    m_demuxers.setMuted(muted);
+}
+
+void LiveHub::releaseRawStore() {
+    if(m_rawStore == NULL) {
+        return;
+    }
+
+    m_rawStore->releaseWriter(this);
+    TimeShiftStore::release(m_rawStore);
+    m_rawStore = NULL;
+}
+
+cDevice* LiveHub::getDevice() {
+    return IsAttached() ? m_device : NULL;
+}
+
+uint32_t LiveHub::getChannelUid() {
+    return m_uid;
+}
+
+bool LiveHub::isAudioOnly() {
+    return m_audioOnly;
+}
+
+uint64_t LiveHub::getBitRate() {
+    uint64_t bitRate = m_bitRate;
+    return (bitRate != 0) ? bitRate : m_declaredBitRate.load();
+}
+
+void LiveHub::measureBitRate(uint32_t bytes, int64_t now) {
+    if(m_rateStart == 0) {
+        m_rateStart = now;
+    }
+
+    m_rateBytes += bytes;
+
+    // update once per second
+    int64_t elapsed = now - m_rateStart;
+
+    if(elapsed < 1000) {
+        return;
+    }
+
+    uint64_t bitRate = (m_rateBytes * 8 * 1000) / elapsed;
+    uint64_t previous = m_bitRate;
+
+    // smooth out bursts (keyframes)
+    m_bitRate = (previous == 0) ? bitRate : (previous * 3 + bitRate) / 4;
+
+    m_rateBytes = 0;
+    m_rateStart = now;
+}
+
+void LiveHub::requestStreamChange() {
+    m_requestStreamChange = true;
+}
+
+int LiveHub::switchChannel(const cChannel* channel) {
+
+    if(channel == NULL) {
+        ERRORLOG("unknown channel !");
+        return ROBOTV_RET_ERROR;
+    }
+
+    detach();
+
+    // share a tuner already carrying the transponder
+    m_device = findTunedDevice(channel);
+    bool tuned = (m_device != NULL);
+
+    // get device for this channel
+    if(!tuned) {
+        m_device = cDevice::GetDevice(channel, LIVEPRIORITY, false);
+    }
+
+    // relay the channel from a peer server
+    if(m_device == NULL && attachRelay(channel)) {
+        return ROBOTV_RET_OK;
+    }
+
+    if(m_device == NULL) {
+        // return status "recording running" if there is an active timer
+        time_t now = time(NULL);
+
+        for(cTimer* ti = Timers.First(); ti; ti = Timers.Next(ti)) {
+            if(ti->Recording() && ti->Matches(now)) {
+                ERRORLOG("Recording running !");
+                return ROBOTV_RET_RECRUNNING;
+            }
+        }
+
+        ERRORLOG("No device available !");
+        return ROBOTV_RET_DATALOCKED;
+    }
+
+    if(tuned) {
+        INFOLOG("Sharing device %d (transponder already tuned)", m_device->DeviceNumber() + 1);
+    }
+    else {
+        INFOLOG("Found available device %d", m_device->DeviceNumber() + 1);
+    }
+
+    if(!tuned && !m_device->SwitchChannel(channel, false)) {
+        ERRORLOG("Can't switch to channel %i - %s", channel->Number(), channel->Name());
+        return ROBOTV_RET_ERROR;
+    }
+
+    setupStreams(channel);
+
+    INFOLOG("Successfully switched to channel %i - %s", channel->Number(), channel->Name());
+
+    if(!attach()) {
+        return ROBOTV_RET_DATALOCKED;
+    }
+
+    INFOLOG("done switching.");
+    return ROBOTV_RET_OK;
+}
+
+bool LiveHub::attachStandby(const cChannel* channel, cDevice* device) {
+    detach();
+
+    m_device = device;
+    setupStreams(channel);
+
+    return attach();
+}
+
+void LiveHub::setupStreams(const cChannel* channel) {
+    // get cached demuxer data
+    ChannelCache& cache = ChannelCache::instance();
+    StreamBundle bundle = cache.lookup(m_uid);
+
+    // channel already in cache
+    if(bundle.size() != 0) {
+        INFOLOG("Channel information found in cache");
+    }
+    // channel not found in cache -> add it from vdr
+    else {
+        INFOLOG("adding channel to cache");
+        bundle = cache.add(channel);
+    }
+
+    // recheck cache item
+    StreamBundle currentitem = StreamBundle::createFromChannel(channel);
+
+    if(!currentitem.isMetaOf(bundle)) {
+        INFOLOG("current channel differs from cache item - updating");
+        bundle = currentitem;
+        cache.add(m_uid, bundle);
+    }
+
+    if(bundle.size() != 0) {
+        INFOLOG("Creating demuxers");
+        createDemuxers(&bundle);
+    }
+
+    // the passthrough stream detects frames on the video pid (or the first audio pid for radio)
+    {
+        std::lock_guard<std::mutex> lock(m_rawMutex);
+
+        m_rawVideo = (channel->Vpid() != 0);
+        m_rawPid = m_rawVideo ? channel->Vpid() : channel->Apid(0);
+        m_rawPidType = m_rawVideo ? channel->Vtype() : channel->Atype(0);
+
+        m_frameDetector.SetPid(m_rawPid, m_rawPidType);
+        m_patPmtGenerator.SetChannel(channel);
+        m_rawPending.clear();
+        m_rawBatch.clear();
+    }
+
+    requestStreamChange();
+}
+
+bool LiveHub::attach() {
+    if(m_device == NULL) {
+        return false;
+    }
+
+    if(IsAttached()) {
+        return true;
+    }
+
+    if(m_device->AttachReceiver(this)) {
+        INFOLOG("device attached to receiver");
+        return true;
+    }
+
+    ERRORLOG("failed to attach receiver !");
+    return false;
+}
+
+bool LiveHub::attachRelay(const cChannel* channel) {
+    std::string host;
+    int port = 0;
+
+    if(!RelaySource::isEnabled() || !PeerRegistry::instance().findSource(m_uid, host, port)) {
+        return false;
+    }
+
+    setupStreams(channel);
+    m_relay = new RelaySource(host, port, m_uid);
+
+    bool opened = m_relay->open([ = ](const uint8_t * data, int length) {
+        Receive((uchar*)data, length);
+    });
+
+    if(!opened) {
+        delete m_relay;
+        m_relay = NULL;
+        return false;
+    }
+
+    INFOLOG("Relaying channel %i - %s from %s:%i", channel->Number(), channel->Name(), host.c_str(), port);
+    return true;
+}
+
+bool LiveHub::isActive() {
+    return IsAttached() || m_relay != NULL;
+}
+
+void LiveHub::detach() {
+    if(m_relay != NULL) {
+        delete m_relay;
+        m_relay = NULL;
+        INFOLOG("relay detached");
+    }
+
+    if(m_device == NULL) {
+        return;
+    }
+
+    if(!IsAttached()) {
+        return;
+    }
+
+    m_device->Detach(this);
+    INFOLOG("device detached");
+}
+
+void LiveHub::createDemuxers(StreamBundle* bundle) {
+    // update demuxers
+    m_demuxers.updateFrom(bundle);
+
+    // update pids
+    SetPids(NULL);
+
+    for(auto i = m_demuxers.begin(); i != m_demuxers.end(); i++) {
+        TsDemuxer* dmx = *i;
+        AddPid(dmx->getPid());
+    }
+}
+
+void LiveHub::processChannelChange(const cChannel* channel) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!isActive()) {
+        return;
+    }
+
+    if(createChannelUid(channel) != m_uid) {
+        return;
+    }
+
+    // every subscriber forwards the change, switch only once
+    StreamBundle current;
+
+    for(auto i = m_demuxers.begin(); i != m_demuxers.end(); i++) {
+        current.addStream(*(*i));
+    }
+
+    if(StreamBundle::createFromChannel(channel).isMetaOf(current)) {
+        return;
+    }
+
+    INFOLOG("ChannelChange()");
+    switchChannel(channel);
+}
+
+void LiveHub::sendStreamPacket(StreamPacket* pkt) {
+    // skip empty packets
+    if(pkt == NULL || pkt->size == 0) {
+        return;
+    }
+
+    // skip non audio / video packets
+    if(!(pkt->content == StreamInfo::scAUDIO || pkt->content == StreamInfo::scVIDEO)) {
+        return;
+    }
+
+    // send stream change on demand
+    if(m_requestStreamChange && m_demuxers.isReady()) {
+        flushAudio();
+        sendStreamChange();
+    }
+
+    int64_t now = roboTV::currentTimeMillis().count();
+
+    // small audio frames are written in batches
+    if(pkt->content == StreamInfo::scAUDIO) {
+        queueAudioFrame(pkt, now);
+        measureBitRate(pkt->size, now);
+        return;
+    }
+
+    // initialise stream packet
+    // keep the payload checksum to detect corrupted timeshift storage
+    MsgPacket* packet = new MsgPacket(ROBOTV_STREAM_MUXPKT, ROBOTV_CHANNEL_STREAM);
+
+    // U16 pid, S64 pts, S64 dts, U32 duration, U32 size, payload, S64 wallclock time
+    MsgPacketWriter writer(packet, sizeof(uint16_t) + 2 * sizeof(int64_t) + 2 * sizeof(uint32_t) + pkt->size + sizeof(int64_t));
+
+    if(!writer.valid()) {
+        ERRORLOG("unable to allocate stream packet (%i bytes)", pkt->size);
+        delete packet;
+        return;
+    }
+
+    // write stream data
+    writer.put_U16(pkt->pid);
+    writer.put_S64(pkt->rawPts);
+    writer.put_S64(pkt->rawDts);
+    writer.put_U32(pkt->duration);
+
+    // write frame type into unused header field clientid
+    packet->setClientID((uint16_t)pkt->frameType);
+
+    // write payload into stream packet
+    writer.put_U32(pkt->size);
+    writer.put_Blob(pkt->data, pkt->size);
+
+    // add timestamp (wallclock time in ms)
+    writer.put_S64(now);
+    writer.commit();
+
+    // written once, read by all subscribers
+    {
+        LatencyTimer timer(m_queueLatency);
+        m_store->queue(packet, pkt->content, pkt->rawPts);
+    }
+
+    m_packetsQueued++;
+
+    // clients join at keyframes, pending audio follows them
+    if(pkt->frameType == StreamInfo::ftIFRAME) {
+        flushAudio();
+    }
+
+    measureBitRate(pkt->size, now);
+}
+
+void LiveHub::sendStreamChange() {
+    INFOLOG("stream change notification");
+
+    StreamBundle cache;
+    uint64_t declaredBitRate = 0;
+
+    for(auto i = m_demuxers.begin(); i != m_demuxers.end(); i++) {
+        cache.addStream(*(*i));
+        declaredBitRate += (*i)->getBitRate();
+    }
+
+    ChannelCache::instance().add(m_uid, cache);
+    m_declaredBitRate = declaredBitRate;
+
+    // readers of the timeshift replay the stream change at its position
+    m_store->queue(m_demuxers.createStreamLayoutPacket(), StreamInfo::scSTREAMINFO);
+
+    // every subscriber gets the streams in its preferred order
+    {
+        std::lock_guard<std::mutex> lock(m_subscriberMutex);
+
+        for(auto s : m_subscribers) {
+            s->streamChange(m_demuxers);
+        }
+
+        updateMutedStreams();
+    }
+
+    m_requestStreamChange = false;
+}
+
+#if VDRVERSNUM < 20300
+void LiveHub::Receive(uchar* Data, int Length)
+#else
+void LiveHub::Receive(const uchar* Data, int Length)
+#endif
+{
+    ROBOTV_TRACE2(livehub_receive, m_uid, Length);
+    m_bytesReceived += Length;
+
+    // the receiver thread of the device (may change with the device)
+    if(CpuPlacement::isEnabled() && !pthread_equal(m_receiverThread, pthread_self())) {
+        m_receiverThread = pthread_self();
+        CpuPlacement::attachThread(m_uid);
+    }
+
+    // no demuxing for passthrough subscribers
+    if(m_demux) {
+        LatencyTimer timer(m_demuxLatency);
+        m_demuxers.processTsBuffer(Data, Length);
+    }
+
+    queueRaw(Data, Length);
+}
+
+void LiveHub::queueRaw(const uchar* data, int length) {
+    std::lock_guard<std::mutex> lock(m_rawMutex);
+
+    if(m_rawStore == NULL) {
+        return;
+    }
+
+    // the frame detector needs to look ahead
+    m_rawPending.insert(m_rawPending.end(), data, data + length);
+
+    if(m_rawPending.size() < RAW_ANALYZE_SIZE) {
+        return;
+    }
+
+    size_t offset = 0;
+
+    while(offset + TS_SIZE <= m_rawPending.size()) {
+        uchar* p = &m_rawPending[offset];
+        int count = m_frameDetector.Analyze(p, m_rawPending.size() - offset);
+
+        // more data needed
+        if(count <= 0) {
+            break;
+        }
+
+        offset += count;
+
+        // streaming starts with an independent frame
+        if(!m_frameDetector.Synced()) {
+            continue;
+        }
+
+        // cut batches at frame borders, video batches always start with an independent frame
+        if(m_frameDetector.NewFrame()) {
+            bool independent = m_frameDetector.IndependentFrame();
+
+            if((independent && m_rawVideo) || m_rawBatch.size() >= RAW_BATCH_SIZE || m_rawBatch.empty()) {
+                flushRaw();
+
+                m_rawKeyFrame = independent;
+                m_rawPts = independent ? TsGetPts(p, count) : 0;
+
+                // clients can join at every keyframe
+                if(independent) {
+                    uchar* pat = m_patPmtGenerator.GetPat();
+                    m_rawBatch.insert(m_rawBatch.end(), pat, pat + TS_SIZE);
+
+                    int index = 0;
+
+                    while(uchar* pmt = m_patPmtGenerator.GetPmt(index)) {
+                        m_rawBatch.insert(m_rawBatch.end(), pmt, pmt + TS_SIZE);
+                    }
+                }
+            }
+        }
+        else if(m_rawBatch.size() >= RAW_BATCH_MAX) {
+            flushRaw();
+        }
+
+        m_rawBatch.insert(m_rawBatch.end(), p, p + count);
+    }
+
+    m_rawPending.erase(m_rawPending.begin(), m_rawPending.begin() + offset);
+}
+
+void LiveHub::queueAudioFrame(StreamPacket* pkt, int64_t now) {
+    AudioBatch& batch = m_audioBatches[pkt->pid];
+
+    // time budget exceeded (or timestamp discontinuity)
+    if(batch.packet != NULL) {
+        int64_t elapsed = pkt->rawPts - batch.pts;
+
+        if(elapsed < 0 || elapsed >= AUDIO_BATCH_PTS || batch.frames.size() >= AUDIO_BATCH_FRAMES) {
+            flushAudio(batch);
+        }
+    }
+
+    // U16 pid, frame data, frame table, U16 frame count, S64 wallclock time
+    if(batch.packet == NULL) {
+        batch.packet = new MsgPacket(ROBOTV_STREAM_MUXBATCH, ROBOTV_CHANNEL_STREAM);
+        batch.packet->setClientID((uint16_t)pkt->frameType);
+        batch.packet->put_U16(pkt->pid);
+        batch.pts = pkt->rawPts;
+        batch.wallclockTime = now;
+    }
+
+    batch.packet->put_Blob(pkt->data, pkt->size);
+    batch.frames.push_back({pkt->rawPts, pkt->rawDts, pkt->duration, pkt->size});
+}
+
+void LiveHub::flushAudio() {
+    for(auto& i : m_audioBatches) {
+        flushAudio(i.second);
+    }
+}
+
+void LiveHub::flushAudio(AudioBatch& batch) {
+    if(batch.packet == NULL) {
+        return;
+    }
+
+    // frame table, frame count and wallclock time
+    MsgPacketWriter writer(batch.packet, batch.frames.size() * (2 * sizeof(int64_t) + 2 * sizeof(uint32_t)) + sizeof(uint16_t) + sizeof(int64_t));
+
+    if(!writer.valid()) {
+        ERRORLOG("unable to allocate audio batch (%i frames)", (int)batch.frames.size());
+        delete batch.packet;
+        batch.packet = NULL;
+        batch.frames.clear();
+        return;
+    }
+
+    for(auto& frame : batch.frames) {
+        writer.put_S64(frame.pts);
+        writer.put_S64(frame.dts);
+        writer.put_U32(frame.duration);
+        writer.put_U32(frame.size);
+    }
+
+    writer.put_U16(batch.frames.size());
+    writer.put_S64(batch.wallclockTime);
+    writer.commit();
+
+    {
+        LatencyTimer timer(m_queueLatency);
+        m_store->queue(batch.packet, StreamInfo::scAUDIO, batch.pts);
+    }
+
+    m_packetsQueued++;
+    m_audioFramesQueued += batch.frames.size();
+
+    batch.packet = NULL;
+    batch.frames.clear();
+}
+
+void LiveHub::flushRaw() {
+    if(m_rawBatch.empty()) {
+        return;
+    }
+
+    MsgPacket* packet = new MsgPacket(ROBOTV_STREAM_TSPKT, ROBOTV_CHANNEL_STREAM);
+
+    // batches are tagged like video frames (for keyframe mode, seeking and backpressure)
+    packet->setClientID(m_rawKeyFrame ? StreamInfo::ftIFRAME : StreamInfo::ftPFRAME);
+
+    packet->put_U32(m_rawBatch.size());
+    packet->put_Blob(m_rawBatch.data(), m_rawBatch.size());
+
+    // add timestamp (wallclock time in ms)
+    packet->put_S64(roboTV::currentTimeMillis().count());
+
+    m_rawStore->queue(packet, StreamInfo::scVIDEO, m_rawPts);
+    m_rawPacketsQueued++;
+
+    m_rawBatch.clear();
+    m_rawKeyFrame = false;
+    m_rawPts = 0;
+}
+
+nlohmann::json LiveHub::getMetrics() {
+    return {
+        {"channelUid", m_uid},
+        {"standby", (bool)m_standby},
+        {"audioOnly", m_audioOnly},
+        {"bitRate", getBitRate()},
+        {"bytesReceived", (uint64_t)m_bytesReceived},
+        {"packetsQueued", (uint64_t)m_packetsQueued},
+        {"rawPacketsQueued", (uint64_t)m_rawPacketsQueued},
+        {"audioFramesQueued", (uint64_t)m_audioFramesQueued},
+        {"demuxStalls", m_demuxers.getWorkerStalls()},
+        {"demux", m_demuxLatency.toJson()},
+        {"queue", m_queueLatency.toJson()}
+    };
+}
+
+void LiveHub::registerDeviceStats() {
+    static std::once_flag registered;
+
+    std::call_once(registered, []() {
+        Metrics::instance().add(&m_hubList, "devices", []() {
+            return getDeviceMetrics();
+        });
+    });
+}
+
+nlohmann::json LiveHub::getDeviceMetrics() {
+    std::map<cDevice*, int> hubs;
+    std::map<cDevice*, int> standbyHubs;
+
+    // m_hubsMutex is held while hubs are created (and register their metrics)
+    {
+        std::lock_guard<std::mutex> lock(m_hubListMutex);
+
+        for(auto hub : m_hubList) {
+            cDevice* device = hub->getDevice();
+
+            if(device == NULL) {
+                continue;
+            }
+
+            hubs[device]++;
+
+            if(hub->m_standby) {
+                standbyHubs[device]++;
+            }
+        }
+    }
+
+    nlohmann::json j = nlohmann::json::array();
+
+    for(int i = 0; i < cDevice::NumDevices(); i++) {
+        cDevice* device = cDevice::GetDevice(i);
+
+        if(device == NULL) {
+            continue;
+        }
+
+        const cChannel* transponder = device->GetCurrentlyTunedTransponder();
+
+        j.push_back({
+            {"device", device->DeviceNumber() + 1},
+            {"name", (const char*)device->DeviceName()},
+            {"type", (const char*)device->DeviceType()},
+            {"receiving", device->Receiving()},
+            {"priority", device->Priority()},
+            {"frequency", (transponder != NULL) ? transponder->Frequency() : 0},
+            {"hubs", hubs[device]},
+            {"standbyHubs", standbyHubs[device]}
+        });
+    }
+
+    return j;
+}
@@ -0,0 +1,308 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_LIVEHUB_H
+#define ROBOTV_LIVEHUB_H
+
+#include <vdr/channels.h>
+#include <vdr/device.h>
+#include <vdr/receiver.h>
+#include <vdr/remux.h>
+
+#include "demuxer/demuxer.h"
+#include "demuxer/streambundle.h"
+#include "demuxer/demuxerbundle.h"
+#include "tools/metrics.h"
+
+#include <pthread.h>
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+class TimeShiftStore;
+class RelaySource;
+
+/**
+ * Channel hub.
+ * Receives and demuxes a channel once and writes the stream packets
+ * into the shared timeshift store read by all subscribed clients.
+ * Passthrough subscribers read the PID-filtered TS stream from a second
+ * store, demuxing is skipped while there are no other subscribers.
+ * Standby hubs keep demuxing neighbouring channels of an already tuned
+ * transponder, so zapping to them starts at the cached GOP.
+ * Without a free local tuner a hub may relay the channel from a peer
+ * server of the cluster (see RelaySource).
+ */
+class LiveHub : public cReceiver, public TsDemuxer::Listener {
+public:
+
+    class Subscriber {
+    public:
+
+        virtual ~Subscriber() {};
+
+        virtual void streamChange(const DemuxerBundle& demuxers) = 0;
+
+        /** Audio and subtitle streams selected by the subscriber.
+         @param pids selected pids
+         @return false if the subscriber receives all streams
+         */
+        virtual bool getSelectedStreams(std::set<int>& pids) {
+            return false;
+        }
+
+    };
+
+    static LiveHub* acquire(const cChannel* channel, int priority, int& status);
+
+    static void release(LiveHub* hub);
+
+    /** Receive a channel in warm standby.
+     The channel is received on a device already tuned to its transponder
+     (with the lowest receiver priority) and demuxed without subscribers, so
+     the timeshift store always holds the latest GOP of the channel.
+     @param channel channel to receive
+     @param device device tuned to the transponder of the channel
+     @return the hub or NULL if the channel can't be received without tuning
+     */
+    static LiveHub* acquireStandby(const cChannel* channel, cDevice* device);
+
+    static void releaseStandby(LiveHub* hub);
+
+    static LiveHub* find(uint32_t channelUid);
+
+    /** UIDs of the channels received by hubs (including standby hubs) */
+    static std::vector<uint32_t> channels();
+
+    /** Find a device already tuned to the transponder of a channel.
+     Such a device receives the channel without switching a tuner, so
+     clients of the same transponder share one tuner.
+     @return the device (receiving devices preferred) or NULL
+     */
+    static cDevice* findTunedDevice(const cChannel* channel);
+
+    /** Subscribe to the channel.
+     @param subscriber subscriber to add
+     @param passthrough read the raw TS stream (no stream changes are sent)
+     */
+    void subscribe(Subscriber* subscriber, bool passthrough = false);
+
+    void unsubscribe(Subscriber* subscriber);
+
+    /** Mute the audio and subtitle streams no subscriber has selected */
+    void updateStreamSelection();
+
+    void processChannelChange(const cChannel* channel);
+
+    cDevice* getDevice();
+
+    uint32_t getChannelUid();
+
+    /** Bitrate of the channel.
+     @return measured bitrate (bits per second), the bitrate signalled by the
+     stream parsers while no measurement is available or 0 if unknown
+     */
+    uint64_t getBitRate();
+
+    /** Check if the channel carries audio streams only (radio) */
+    bool isAudioOnly();
+
+    // TsDemuxer::Listener implementation
+
+    void sendStreamPacket(StreamPacket* pkt);
+
+    void requestStreamChange();
+
+protected:
+
+    LiveHub(const cChannel* channel, int priority);
+
+    virtual ~LiveHub();
+
+    int switchChannel(const cChannel* channel);
+
+    /** Attach to a device without switching its transponder */
+    bool attachStandby(const cChannel* channel, cDevice* device);
+
+    /** Setup demuxers and the passthrough stream for a channel */
+    void setupStreams(const cChannel* channel);
+
+    bool attach();
+
+    /** Relay the channel from a peer server (no local tuner available) */
+    bool attachRelay(const cChannel* channel);
+
+    void detach();
+
+    /** Check if the hub receives data (attached to a device or relayed) */
+    bool isActive();
+
+    void createDemuxers(StreamBundle* bundle);
+
+    void sendStreamChange();
+
+    /** Update the muted streams (m_subscriberMutex must be held) */
+    void updateMutedStreams();
+
+    void measureBitRate(uint32_t bytes, int64_t now);
+
+    /** Coalesce an audio frame into the batch of its stream */
+    void queueAudioFrame(StreamPacket* pkt, int64_t now);
+
+    /** Write the pending audio batches into the store */
+    void flushAudio();
+
+    struct AudioFrame {
+        int64_t pts;
+        int64_t dts;
+        uint32_t duration;
+        uint32_t size;
+    };
+
+    struct AudioBatch {
+        MsgPacket* packet = NULL;
+        std::vector<AudioFrame> frames;
+        int64_t pts = 0;
+        int64_t wallclockTime = 0;
+    };
+
+    void flushAudio(AudioBatch& batch);
+
+    /** Batch the received TS packets for the passthrough store */
+    void queueRaw(const uchar* data, int length);
+
+    /** Write the current TS batch into the passthrough store */
+    void flushRaw();
+
+    void releaseRawStore();
+
+    nlohmann::json getMetrics();
+
+    /** Register the tuner utilisation (metrics group "devices") */
+    static void registerDeviceStats();
+
+    static nlohmann::json getDeviceMetrics();
+
+#if VDRVERSNUM < 20300
+    void Receive(uchar* Data, int Length);
+#else
+    void Receive(const uchar* Data, int Length);
+#endif
+
+private:
+
+    cDevice* m_device = NULL;
+
+    RelaySource* m_relay = NULL;
+
+    DemuxerBundle m_demuxers;
+
+    TimeShiftStore* m_store = NULL;
+
+    std::list<Subscriber*> m_subscribers;
+
+    std::atomic<bool> m_demux;
+
+    std::atomic<bool> m_standby;
+
+    TimeShiftStore* m_rawStore = NULL;
+
+    std::list<Subscriber*> m_rawSubscribers;
+
+    cFrameDetector m_frameDetector;
+
+    cPatPmtGenerator m_patPmtGenerator;
+
+    int m_rawPid = 0;
+
+    int m_rawPidType = 0;
+
+    bool m_rawVideo = false;
+
+    std::vector<uint8_t> m_rawPending;
+
+    std::vector<uint8_t> m_rawBatch;
+
+    bool m_rawKeyFrame = false;
+
+    int64_t m_rawPts = 0;
+
+    std::mutex m_rawMutex;
+
+    uint32_t m_uid;
+
+    bool m_audioOnly;
+
+    // receiver thread placed on the cores of the channel
+    pthread_t m_receiverThread = 0;
+
+    int m_refCount = 0;
+
+    int m_standbyRefCount = 0;
+
+    int m_priority;
+
+    bool m_requestStreamChange = false;
+
+    std::map<int, AudioBatch> m_audioBatches;
+
+    std::atomic<uint64_t> m_audioFramesQueued;
+
+    uint64_t m_rateBytes = 0;
+
+    int64_t m_rateStart = 0;
+
+    std::atomic<uint64_t> m_bitRate;
+
+    std::atomic<uint64_t> m_declaredBitRate;
+
+    std::atomic<uint64_t> m_bytesReceived;
+
+    std::atomic<uint64_t> m_packetsQueued;
+
+    std::atomic<uint64_t> m_rawPacketsQueued;
+
+    LatencyHistogram m_demuxLatency;
+
+    LatencyHistogram m_queueLatency;
+
+    std::mutex m_mutex;
+
+    std::mutex m_subscriberMutex;
+
+    static std::map<uint32_t, LiveHub*> m_hubs;
+
+    static std::mutex m_hubsMutex;
+
+    static std::set<LiveHub*> m_hubList;
+
+    static std::mutex m_hubListMutex;
+
+};
+
+#endif // ROBOTV_LIVEHUB_H
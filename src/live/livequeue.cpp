@@ -22,331 +22,165 @@
  *
  */
 
-#include <sys/types.h>
-#include <dirent.h>
-#include <unistd.h>
-
 #include "config/config.h"
 #include "net/msgpacket.h"
+#include "tools/tracepoints.h"
 #include "livequeue.h"
-#include "tools/time.h"
-
-cString LiveQueue::m_timeShiftDir = "/video";
-uint64_t LiveQueue::m_bufferSize = 1024 * 1024 * 1024;
-
-LiveQueue::LiveQueue(int socket) : m_readFd(-1), m_writeFd(-1), m_socket(socket) {
-    cleanup();
-
-    m_wrapped = false;
-    m_hasWrapped = false;
-    m_writerRunning = true;
-    m_wrapCount = 0;
-
-    m_writeThread = new std::thread([&]() {
-        while(m_writerRunning) {
-
-            while(m_writerRunning && !m_writerQueue.empty()) {
-                PacketData p;
-
-                {
-                    std::lock_guard<std::mutex> lock(m_mutexQueue);
-                    p = m_writerQueue.front();
-                    m_writerQueue.pop_front();
-                }
 
-                write(p);
-            }
+LiveQueue::LiveQueue(uint32_t channelUid, bool passthrough) : m_channelUid(channelUid), m_pause(false), m_packetsRead(0), m_bytesRead(0) {
+    m_store = TimeShiftStore::acquire(channelUid, passthrough);
+    m_cursor = m_store->attach();
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
+    Metrics::instance().add(this, "queues", [ = ]() {
+        return getMetrics();
     });
 }
 
 LiveQueue::~LiveQueue() {
-    m_writerRunning = false;
-    close();
+    Metrics::instance().remove(this);
 
-    m_writeThread->join();
+    m_store->releaseWriter(this);
+    m_store->detach(m_cursor);
+    TimeShiftStore::release(m_store);
 
-    while(!m_writerQueue.empty()) {
-        const PacketData& p = m_writerQueue.front();
-        delete p.p;
-        m_writerQueue.pop_front();
+    for(auto p : m_pending) {
+        delete p;
     }
 
-    delete m_writeThread;
     INFOLOG("LiveQueue terminated");
 }
 
-void LiveQueue::cleanup() {
-    std::lock_guard<std::mutex> lock(m_mutex);
-
-    m_pause = false;
-
-    m_storage = cString::sprintf("%s/robotv-ringbuffer-%05i.data", (const char*)m_timeShiftDir, m_socket);
-    DEBUGLOG("timeshift file: %s", (const char*)m_storage);
-
-    m_writeFd = open(m_storage, O_CREAT | O_WRONLY | O_TRUNC, 0644);
-    m_readFd = open(m_storage, O_CREAT | O_RDONLY, 0644);
-
-    if(m_readFd == -1) {
-        ERRORLOG("Failed to create timeshift ringbuffer !");
-    }
-
-    lseek(m_readFd, 0, SEEK_SET);
-    lseek(m_writeFd, 0, SEEK_SET);
-
+bool LiveQueue::isWriter() {
+    return m_store->isWriter(this);
 }
 
-MsgPacket* LiveQueue::read(bool keyFrameMode) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-
-    if(m_pause) {
-        return NULL;
-    }
-
-    if(keyFrameMode) {
-        seekNextKeyFrame();
+void LiveQueue::setNotify(std::function<void()> notify) {
+    {
+        std::lock_guard<ProfiledMutex> lock(m_mutex);
+        m_notify = notify;
     }
 
-    return internalRead();
+    m_store->setNotify(m_cursor, notify);
 }
 
-MsgPacket* LiveQueue::internalRead() {
-    // check if read position wrapped
-
-    off_t readPosition = lseek(m_readFd, 0, SEEK_CUR);
-    off_t writePosition = lseek(m_writeFd, 0, SEEK_CUR);
-
-    if(readPosition >= (off_t)m_bufferSize) {
-        INFOLOG("timeshift: read buffer wrap");
-        lseek(m_readFd, 0, SEEK_SET);
-        readPosition = 0;
-        m_wrapped = !m_wrapped;
-        INFOLOG("wrapped: %s", m_wrapped ? "yes" : "no");
-    }
+void LiveQueue::queue(MsgPacket* p, StreamInfo::Content content, int64_t pts) {
+    // client specific packets
+    if(content == StreamInfo::scNONE || (content == StreamInfo::scSTREAMINFO && !isWriter())) {
+        std::lock_guard<ProfiledMutex> lock(m_mutex);
+        m_pending.push_back(p);
 
-    // check if read position is still behind write position (if not wrapped))
-    // if not -> skip packet (as we would start reading from the beginning of
-    // the buffer)
+        if(m_notify) {
+            m_notify();
+        }
 
-    if(readPosition >= writePosition && !m_wrapped) {
-        return NULL;
+        return;
     }
 
-    // read packet from storage
-    return MsgPacket::read(m_readFd, 1000);
-}
-
-bool LiveQueue::isPaused() {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    return m_pause;
-}
-
-void LiveQueue::queue(MsgPacket* p, StreamInfo::Content content, int64_t pts) {
-    std::lock_guard<std::mutex> lock(m_mutexQueue);
-
-    if(m_writerQueue.size() >= 400) {
+    // only the writer assigned by the hub writes into the shared store
+    if(!isWriter()) {
         delete p;
         return;
     }
 
-    m_writerQueue.push_back({p, content, pts});
+    ROBOTV_TRACE4(livequeue_queue, m_channelUid, (int)content, p->getPacketLength(), pts);
+    m_store->queue(p, content, pts);
 }
 
-bool LiveQueue::write(const PacketData& data) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-
-    auto timeStamp = roboTV::currentTimeMillis();
-    auto p = data.p;
-    auto content = data.content;
-    auto pts = data.pts;
-
-    // set queue start time
-
-    if(m_queueStartTime.count() == 0) {
-        m_queueStartTime = timeStamp;
-    }
-
-    // ring-buffer overrun ?
-
-    off_t writePosition = lseek(m_writeFd, 0, SEEK_CUR);
-    off_t readPosition = lseek(m_readFd, 0, SEEK_CUR);
-
-    if(writePosition >= (off_t) m_bufferSize) {
-        INFOLOG("timeshift: write buffer wrap");
-        lseek(m_writeFd, 0, SEEK_SET);
-        writePosition = 0;
-
-        m_wrapped = !m_wrapped;
-        m_hasWrapped = true;
-        m_wrapCount++;
-
-        INFOLOG("wrapped: %s", m_wrapped ? "yes" : "no");
-    }
-
-    off_t packetEndPosition = writePosition + p->getPacketLength();
-
-    // check if write position if still behind read position (if wrapped)
-    // if not -> shift read position forward
+MsgPacket* LiveQueue::read(bool keyFrameMode) {
+    {
+        std::lock_guard<ProfiledMutex> lock(m_mutex);
 
-    while(packetEndPosition >= readPosition && m_wrapped) {
-        if(internalRead() == NULL) {
+        if(m_pause) {
             return NULL;
         }
-    }
-
-    trim(packetEndPosition);
 
-    // add keyframe to map
-    bool keyFrame = (p->getClientID() == StreamInfo::FrameType::ftIFRAME);
-
-    if(keyFrame && content == StreamInfo::Content::scVIDEO) {
-        m_indexList.push_back({writePosition, timeStamp, pts, m_wrapCount});
+        if(!m_pending.empty()) {
+            MsgPacket* p = m_pending.front();
+            m_pending.pop_front();
+            return p;
+        }
     }
 
-    // write packet
-    bool success = p->write(m_writeFd, 1000);
+    auto start = std::chrono::steady_clock::now();
+    MsgPacket* p = m_store->read(m_cursor, keyFrameMode);
 
-    if(!success) {
-        ERRORLOG("Unable to write packet into timeshift ringbuffer !");
+    // count packets only (not polling for new data)
+    if(p != NULL) {
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        ROBOTV_TRACE3(livequeue_read, m_channelUid, p->getPacketLength(), us);
+
+        m_readLatency.add(us);
+        m_packetsRead++;
+        m_bytesRead += p->getPacketLength();
     }
 
-    delete p;
-    return success;
+    return p;
 }
 
-void LiveQueue::close() {
-    ::close(m_readFd);
-    ::close(m_writeFd);
-
-    if(*m_storage) {
-        unlink(m_storage);
-    }
-}
+int64_t LiveQueue::seek(int64_t wallclockPositionMs) {
+    INFOLOG("seek: %lu", wallclockPositionMs);
 
-void LiveQueue::trim(off_t position) {
-    if(!m_hasWrapped || m_indexList.empty()) {
-        return;
-    }
+    int64_t pts = m_store->seek(m_cursor, wallclockPositionMs);
+    ROBOTV_TRACE3(livequeue_seek, m_channelUid, wallclockPositionMs, pts);
 
-    auto p = m_indexList.front();
+    // the streams may have changed since the new position
+    MsgPacket* layout = m_store->getStreamLayout(m_cursor);
 
-    if(p.filePosition < position && p.wrapCount < m_wrapCount) {
-        m_indexList.pop_front();
+    if(layout != NULL) {
+        std::lock_guard<ProfiledMutex> lock(m_mutex);
+        m_pending.push_back(layout);
     }
 
-    if(!m_indexList.empty()) {
-        auto p = m_indexList.front();
-        m_queueStartTime = p.wallclockTime;
-    }
+    return pts;
 }
 
 bool LiveQueue::pause(bool on) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<ProfiledMutex> lock(m_mutex);
 
     if(m_pause == on) {
         return false;
     }
 
+    if(on) {
+        m_store->spill(m_cursor);
+    }
+
     m_pause = on;
     return true;
 }
 
-void LiveQueue::setTimeShiftDir(const cString& dir) {
-    m_timeShiftDir = dir;
-    DEBUGLOG("TIMESHIFTDIR: %s", (const char*)m_timeShiftDir);
+bool LiveQueue::isPaused() {
+    std::lock_guard<ProfiledMutex> lock(m_mutex);
+    return m_pause;
 }
 
-void LiveQueue::setBufferSize(uint64_t s) {
-    m_bufferSize = s;
-    INFOLOG("timeshift buffersize: %lu bytes", m_bufferSize);
+int64_t LiveQueue::getTimeshiftStartPosition() {
+    return m_store->getTimeshiftStartPosition();
 }
 
-void LiveQueue::removeTimeShiftFiles() {
-    DIR* dir = opendir((const char*)m_timeShiftDir);
-
-    if(dir == NULL) {
-        return;
-    }
-
-    struct dirent* entry = NULL;
-
-    while((entry = readdir(dir)) != NULL) {
-        if(strncmp(entry->d_name, "robotv-ringbuffer-", 16) == 0) {
-            INFOLOG("Removing old time-shift storage: %s", entry->d_name);
-            unlink(AddDirectory(m_timeShiftDir, entry->d_name));
-        }
-    }
-
-    closedir(dir);
+size_t LiveQueue::getQueueDepth() {
+    return m_store->getQueueDepth();
 }
 
-int64_t LiveQueue::seek(int64_t wallclockPositionMs) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-
-    INFOLOG("seek: %lu", wallclockPositionMs);
-
-    auto s = m_indexList.rbegin();
-    auto e = m_indexList.rend();
-    auto h = m_indexList.begin();
-
-    if(s == e) {
-        ERRORLOG("empty timeshift queue - unable to seek");
-        return 0;
-    }
-
-    // ahead of buffer
-    if(wallclockPositionMs >= s->wallclockTime.count()) {
-        lseek(m_readFd, s->filePosition, SEEK_SET);
-        return s->pts;
-    }
-
-    // behind buffer
-    else if(wallclockPositionMs <= h->wallclockTime.count()) {
-        lseek(m_readFd, h->filePosition, SEEK_SET);
-        return h->pts;
-    }
-
-    // in between ?
-    while(s != e) {
-        if(s->wallclockTime.count() <= wallclockPositionMs) {
-            lseek(m_readFd, s->filePosition, SEEK_SET);
-            return s->pts;
-        }
-
-        s++;
-    }
-
-    // not found
-    ERRORLOG("fileposition not found!");
-    return 0;
+uint64_t LiveQueue::getWriterWakeups() {
+    return m_store->getWriterWakeups();
 }
 
-void LiveQueue::seekNextKeyFrame() {
-    off_t readPosition = lseek(m_readFd, 0, SEEK_CUR);
-
-    auto i = m_indexList.begin();
-    auto j = i;
-
-    while(i != m_indexList.end()) {
-        j++;
-
-        if(j == m_indexList.end()) {
-            return;
-        }
-
-        if(i->filePosition < readPosition && readPosition <= j->filePosition) {
-            readPosition = j->filePosition;
-            break;
-        }
-
-        i++;
-    }
-
-    lseek(m_readFd, readPosition, SEEK_SET);
+uint64_t LiveQueue::getDroppedPackets() {
+    return m_store->getDroppedPackets();
 }
 
-int64_t LiveQueue::getTimeshiftStartPosition() {
-    return m_queueStartTime.count();
+nlohmann::json LiveQueue::getMetrics() {
+    return {
+        {"channelUid", m_channelUid},
+        {"packetsRead", (uint64_t)m_packetsRead},
+        {"bytesRead", (uint64_t)m_bytesRead},
+        {"queueDepth", getQueueDepth()},
+        {"queueCapacity", m_store->getQueueCapacity()},
+        {"queuePeak", m_store->getQueuePeak()},
+        {"writerWakeups", getWriterWakeups()},
+        {"droppedPackets", getDroppedPackets()},
+        {"cacheResident", m_store->getCacheResidency()},
+        {"read", m_readLatency.toJson()}
+    };
 }
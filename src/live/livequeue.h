@@ -26,20 +26,26 @@
 #define ROBOTV_LIVEQUEUE_H
 
 #include "demuxer/streaminfo.h"
+#include "timeshiftstore.h"
+#include "tools/metrics.h"
+#include "tools/lockprofiler.h"
 
+#include <atomic>
 #include <deque>
-#include <chrono>
+#include <functional>
 #include <mutex>
-#include <list>
-#include <thread>
-#include <atomic>
 
 class MsgPacket;
 
+/**
+ * Per-client view on the (shared) timeshift store of a channel.
+ * Client specific packets (stream changes of readers, signal information)
+ * are delivered in front of the shared packets.
+ */
 class LiveQueue {
 public:
 
-    LiveQueue(int socket);
+    LiveQueue(uint32_t channelUid, bool passthrough = false);
 
     virtual ~LiveQueue();
 
@@ -53,76 +59,44 @@ public:
 
     bool isPaused();
 
-    static void setTimeShiftDir(const cString& dir);
+    bool isWriter();
 
-    static void setBufferSize(uint64_t s);
-
-    static void removeTimeShiftFiles();
+    /** Set data notification.
+     The callback is invoked whenever new packets can be read.
+     */
+    void setNotify(std::function<void()> notify);
 
     int64_t getTimeshiftStartPosition();
 
-protected:
+    size_t getQueueDepth();
 
-    struct PacketData {
-        MsgPacket* p;
-        StreamInfo::Content content;
-        int64_t pts;
-    };
+    uint64_t getWriterWakeups();
 
-    struct PacketIndex {
-        off_t filePosition;
-        std::chrono::milliseconds wallclockTime;
-        int64_t pts;
-        int wrapCount;
-    };
+    uint64_t getDroppedPackets();
 
-    bool write(const PacketData& data);
-
-    void cleanup();
-
-    void close();
-
-    void trim(off_t position);
+protected:
 
-    MsgPacket* internalRead();
+    nlohmann::json getMetrics();
 
-    void seekNextKeyFrame();
+    uint32_t m_channelUid;
 
-    std::deque<struct PacketIndex> m_indexList;
+    TimeShiftStore* m_store;
 
-    int m_readFd;
+    TimeShiftStore::Cursor* m_cursor;
 
-    int m_writeFd;
+    std::deque<MsgPacket*> m_pending;
 
-    int m_socket;
+    std::function<void()> m_notify;
 
     bool m_pause;
 
-    std::mutex m_mutex;
-
-    cString m_storage;
-
-    std::chrono::milliseconds m_queueStartTime;
-
-    bool m_wrapped;
-
-    bool m_hasWrapped;
-
-    int m_wrapCount;
-
-    static cString m_timeShiftDir;
-
-    static uint64_t m_bufferSize;
-
-private:
-
-    std::thread* m_writeThread;
+    ProfiledMutex m_mutex{"livequeue"};
 
-    std::atomic<bool> m_writerRunning;
+    std::atomic<uint64_t> m_packetsRead;
 
-    std::deque<PacketData> m_writerQueue;
+    std::atomic<uint64_t> m_bytesRead;
 
-    std::mutex m_mutexQueue;
+    LatencyHistogram m_readLatency;
 
 };
 
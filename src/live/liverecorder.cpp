@@ -0,0 +1,490 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include <vdr/timers.h>
+#include <vdr/tools.h>
+
+#include "liverecorder.h"
+#include "livequeue.h"
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "robotv/robotvcommand.h"
+#include "tools/hash.h"
+
+// frame table entry of an audio batch (S64 pts, S64 dts, U32 duration, U32 size)
+#define MUXBATCH_FRAME_SIZE 24
+
+// size of the write buffer
+#define RECORDER_BUFFER_SIZE (256 * 1024)
+
+#define RECORDER_PRIORITY 50
+
+std::map<uint32_t, LiveRecorder*> LiveRecorder::m_recorders;
+
+std::mutex LiveRecorder::m_recordersMutex;
+
+static uint64_t getBigEndian(const uint8_t* data, int length) {
+    uint64_t value = 0;
+
+    for(int i = 0; i < length; i++) {
+        value = (value << 8) | data[i];
+    }
+
+    return value;
+}
+
+static void putTimestamp(uint8_t* p, int prefix, int64_t ts) {
+    p[0] = (prefix << 4) | (((ts >> 30) & 0x07) << 1) | 1;
+    p[1] = (ts >> 22) & 0xFF;
+    p[2] = (((ts >> 15) & 0x7F) << 1) | 1;
+    p[3] = (ts >> 7) & 0xFF;
+    p[4] = ((ts & 0x7F) << 1) | 1;
+}
+
+static uint8_t getStreamId(StreamInfo::Type type) {
+    switch(type) {
+        case StreamInfo::stMPEG2VIDEO:
+        case StreamInfo::stH264:
+        case StreamInfo::stH265:
+            return 0xE0;
+
+        case StreamInfo::stMPEG2AUDIO:
+        case StreamInfo::stAAC:
+        case StreamInfo::stLATM:
+            return 0xC0;
+
+        default:
+            // private stream 1 (AC3, EAC3)
+            return 0xBD;
+    }
+}
+
+LiveRecorder::LiveRecorder(const cChannel* channel) : m_running(false), m_bytesWritten(0), m_framesWritten(0) {
+    m_uid = createChannelUid(channel);
+    m_patPmtGenerator.SetChannel(channel);
+    m_indexPid = (channel->Vpid() != 0) ? channel->Vpid() : channel->Apid(0);
+    m_buffer.reserve(RECORDER_BUFFER_SIZE);
+
+    Metrics::instance().add(this, "recorders", [ = ]() {
+        return getMetrics();
+    });
+}
+
+LiveRecorder::~LiveRecorder() {
+    Metrics::instance().remove(this);
+
+    m_running = false;
+    m_cond.notify_all();
+
+    if(m_thread != NULL) {
+        m_thread->join();
+        delete m_thread;
+    }
+
+    if(m_hub != NULL) {
+        m_hub->unsubscribe(this);
+        LiveHub::release(m_hub);
+    }
+
+    delete m_queue;
+
+    flush();
+    delete m_index;
+    delete m_file;
+
+    if(!m_fileName.empty()) {
+        INFOLOG("instant recording '%s' finished", m_fileName.c_str());
+        Recordings.ChangeState();
+    }
+}
+
+std::string LiveRecorder::start(const cChannel* channel, int64_t startPosition, int& status) {
+    std::lock_guard<std::mutex> lock(m_recordersMutex);
+    uint32_t uid = createChannelUid(channel);
+
+    if(m_recorders.find(uid) != m_recorders.end()) {
+        status = ROBOTV_RET_RECRUNNING;
+        return "";
+    }
+
+    LiveRecorder* recorder = new LiveRecorder(channel);
+
+    if(!recorder->open(channel, startPosition, status)) {
+        delete recorder;
+        return "";
+    }
+
+    m_recorders[uid] = recorder;
+    return recorder->m_fileName;
+}
+
+bool LiveRecorder::stop(uint32_t channelUid) {
+    LiveRecorder* recorder = NULL;
+
+    {
+        std::lock_guard<std::mutex> lock(m_recordersMutex);
+        auto i = m_recorders.find(channelUid);
+
+        if(i == m_recorders.end()) {
+            return false;
+        }
+
+        recorder = i->second;
+        m_recorders.erase(i);
+    }
+
+    delete recorder;
+    return true;
+}
+
+bool LiveRecorder::isRecording(uint32_t channelUid) {
+    std::lock_guard<std::mutex> lock(m_recordersMutex);
+    return (m_recorders.find(channelUid) != m_recorders.end());
+}
+
+void LiveRecorder::stopAll() {
+    std::map<uint32_t, LiveRecorder*> recorders;
+
+    {
+        std::lock_guard<std::mutex> lock(m_recordersMutex);
+        recorders.swap(m_recorders);
+    }
+
+    for(auto& i : recorders) {
+        delete i.second;
+    }
+}
+
+bool LiveRecorder::open(const cChannel* channel, int64_t startPosition, int& status) {
+    // the hub keeps receiving the channel while recording
+    m_hub = LiveHub::acquire(channel, RECORDER_PRIORITY, status);
+
+    if(m_hub == NULL) {
+        return false;
+    }
+
+    // an instant timer names the recording like VDR does
+    cTimer timer(true, false, (cChannel*)channel);
+    cRecording recording(&timer, timer.Event());
+
+    m_fileName = recording.FileName();
+
+    if(!MakeDirs(m_fileName.c_str(), true)) {
+        ERRORLOG("unable to create recording directory '%s'", m_fileName.c_str());
+        status = ROBOTV_RET_ERROR;
+        m_fileName.clear();
+        return false;
+    }
+
+    recording.WriteInfo();
+
+    m_file = new cFileName(m_fileName.c_str(), true);
+    m_recordFile = m_file->Open();
+    m_index = new cIndexFile(m_fileName.c_str(), true);
+
+    if(m_recordFile == NULL) {
+        ERRORLOG("unable to create recording '%s'", m_fileName.c_str());
+        status = ROBOTV_RET_ERROR;
+        return false;
+    }
+
+    // read from the timeshift store (starting at the requested position)
+    m_queue = new LiveQueue(m_uid);
+
+    if(startPosition > 0) {
+        m_queue->seek(startPosition);
+    }
+
+    m_queue->setNotify([ = ]() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_dataAvailable = true;
+        m_cond.notify_one();
+    });
+
+    m_hub->subscribe(this);
+
+    Recordings.AddByName(m_fileName.c_str());
+    INFOLOG("instant recording of channel %i - %s: '%s'", channel->Number(), channel->Name(), m_fileName.c_str());
+
+    m_running = true;
+    m_thread = new std::thread([ = ]() {
+        run();
+    });
+
+    status = ROBOTV_RET_OK;
+    return true;
+}
+
+void LiveRecorder::streamChange(const DemuxerBundle& demuxers) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_streamTypes.clear();
+
+    for(auto i = demuxers.begin(); i != demuxers.end(); i++) {
+        m_streamTypes[(*i)->getPid()] = (*i)->getType();
+    }
+}
+
+void LiveRecorder::run() {
+    while(m_running) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait_for(lock, std::chrono::milliseconds(100), [&]() {
+                return m_dataAvailable || !m_running;
+            });
+
+            m_dataAvailable = false;
+        }
+
+        MsgPacket* p = NULL;
+
+        while(m_running && (p = m_queue->read()) != NULL) {
+            writePacket(p);
+            delete p;
+        }
+
+        flush();
+    }
+}
+
+void LiveRecorder::writePacket(MsgPacket* p) {
+    if(p->getMsgID() == ROBOTV_STREAM_MUXBATCH) {
+        writeFrameBatch(p);
+        return;
+    }
+
+    if(p->getMsgID() != ROBOTV_STREAM_MUXPKT) {
+        return;
+    }
+
+    // U16 pid, S64 pts, S64 dts, U32 duration, U32 size, frame data, S64 wallclock time
+    uint8_t* payload = p->getPayload();
+    uint32_t length = p->getPayloadLength();
+
+    if(length < 26) {
+        return;
+    }
+
+    uint32_t size = getBigEndian(payload + 22, 4);
+
+    if(26 + size > length) {
+        return;
+    }
+
+    writeFrame(getBigEndian(payload, 2), p->getClientID(), getBigEndian(payload + 2, 8), getBigEndian(payload + 10, 8), payload + 26, size);
+}
+
+void LiveRecorder::writeFrameBatch(MsgPacket* p) {
+    uint8_t* payload = p->getPayload();
+    uint32_t length = p->getPayloadLength();
+
+    // U16 pid, frame data, frame table, U16 frame count, S64 wallclock time
+    if(length < 12) {
+        return;
+    }
+
+    int pid = getBigEndian(payload, 2);
+    uint32_t count = getBigEndian(payload + length - 10, 2);
+
+    if(length < 2 + count * MUXBATCH_FRAME_SIZE + 10) {
+        return;
+    }
+
+    uint8_t* table = payload + length - 10 - count * MUXBATCH_FRAME_SIZE;
+    uint8_t* data = payload + 2;
+
+    for(uint32_t i = 0; i < count; i++, table += MUXBATCH_FRAME_SIZE) {
+        uint32_t size = getBigEndian(table + 20, 4);
+
+        if(data + size > payload + length - 10 - count * MUXBATCH_FRAME_SIZE) {
+            break;
+        }
+
+        writeFrame(pid, p->getClientID(), getBigEndian(table, 8), getBigEndian(table + 8, 8), data, size);
+        data += size;
+    }
+}
+
+void LiveRecorder::writeFrame(int pid, int frameType, int64_t pts, int64_t dts, const uint8_t* data, uint32_t size) {
+    StreamInfo::Type type = StreamInfo::stNONE;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto i = m_streamTypes.find(pid);
+
+        if(i != m_streamTypes.end()) {
+            type = i->second;
+        }
+    }
+
+    if(type == StreamInfo::stNONE) {
+        return;
+    }
+
+    bool video = (getStreamId(type) == 0xE0);
+    bool indexed = (pid == m_indexPid);
+    bool independent = indexed && (!video || frameType == StreamInfo::ftIFRAME);
+
+    // the recording starts with an independent frame
+    if(!m_synced && !independent) {
+        return;
+    }
+
+    m_synced = true;
+
+    // every frame of the indexed stream gets an index entry
+    if(indexed) {
+        // split files at independent frames
+        if(independent && m_fileSize + (off_t)m_buffer.size() > MEGABYTE(Setup.MaxVideoFileSize)) {
+            flush();
+            m_recordFile = m_file->NextFile();
+            m_fileSize = 0;
+        }
+
+        if(m_recordFile == NULL) {
+            return;
+        }
+
+        m_index->Write(independent, m_file->Number(), m_fileSize + m_buffer.size());
+
+        // players start at independent frames, they need the stream setup
+        if(independent) {
+            uint8_t* pat = m_patPmtGenerator.GetPat();
+            m_buffer.insert(m_buffer.end(), pat, pat + TS_SIZE);
+
+            int index = 0;
+
+            while(uint8_t* pmt = m_patPmtGenerator.GetPmt(index)) {
+                m_buffer.insert(m_buffer.end(), pmt, pmt + TS_SIZE);
+            }
+        }
+    }
+
+    // PES header (PTS / DTS in 90kHz units)
+    uint8_t pes[19];
+    bool hasPts = (pts >= 0);
+    bool hasDts = hasPts && (dts >= 0) && (dts != pts);
+    int headerLength = (hasPts ? 5 : 0) + (hasDts ? 5 : 0);
+    uint32_t pesLength = 3 + headerLength + size;
+
+    pes[0] = 0x00;
+    pes[1] = 0x00;
+    pes[2] = 0x01;
+    pes[3] = getStreamId(type);
+
+    // unbounded length for video
+    if(video || pesLength > 0xFFFF) {
+        pesLength = 0;
+    }
+
+    pes[4] = (pesLength >> 8) & 0xFF;
+    pes[5] = pesLength & 0xFF;
+    pes[6] = 0x80;
+    pes[7] = (hasPts ? 0x80 : 0x00) | (hasDts ? 0x40 : 0x00);
+    pes[8] = headerLength;
+
+    if(hasPts) {
+        putTimestamp(pes + 9, hasDts ? 0x03 : 0x02, pts);
+    }
+
+    if(hasDts) {
+        putTimestamp(pes + 14, 0x01, dts);
+    }
+
+    std::vector<uint8_t> frame;
+    frame.reserve(9 + headerLength + size);
+    frame.insert(frame.end(), pes, pes + 9 + headerLength);
+    frame.insert(frame.end(), data, data + size);
+
+    writeTs(pid, frame.data(), frame.size());
+    m_framesWritten++;
+
+    if(m_buffer.size() >= RECORDER_BUFFER_SIZE) {
+        flush();
+    }
+}
+
+void LiveRecorder::writeTs(int pid, const uint8_t* data, uint32_t size) {
+    uint8_t& cc = m_continuityCounters[pid];
+    bool start = true;
+
+    while(size > 0) {
+        uint8_t ts[TS_SIZE];
+        uint32_t payload = std::min<uint32_t>(size, TS_SIZE - 4);
+        int offset = 4;
+
+        ts[0] = TS_SYNC_BYTE;
+        ts[1] = (start ? 0x40 : 0x00) | ((pid >> 8) & 0x1F);
+        ts[2] = pid & 0xFF;
+        ts[3] = 0x10 | (cc++ & 0x0F);
+
+        // the last packet is filled with an adaptation field
+        if(payload < TS_SIZE - 4) {
+            int stuffing = TS_SIZE - 4 - payload;
+            ts[3] |= 0x20;
+            ts[4] = stuffing - 1;
+            offset = 4 + stuffing;
+
+            if(stuffing > 1) {
+                ts[5] = 0x00;
+                memset(ts + 6, 0xFF, stuffing - 2);
+            }
+        }
+
+        memcpy(ts + offset, data, payload);
+        m_buffer.insert(m_buffer.end(), ts, ts + TS_SIZE);
+
+        data += payload;
+        size -= payload;
+        start = false;
+    }
+}
+
+void LiveRecorder::flush() {
+    if(m_buffer.empty() || m_recordFile == NULL) {
+        m_buffer.clear();
+        return;
+    }
+
+    if(m_recordFile->Write(m_buffer.data(), m_buffer.size()) < 0) {
+        ERRORLOG("failed to write instant recording '%s'", m_fileName.c_str());
+    }
+    else {
+        m_fileSize += m_buffer.size();
+        m_bytesWritten += m_buffer.size();
+    }
+
+    m_buffer.clear();
+}
+
+nlohmann::json LiveRecorder::getMetrics() {
+    return {
+        {"channelUid", m_uid},
+        {"fileName", m_fileName},
+        {"bytesWritten", m_bytesWritten.load()},
+        {"framesWritten", m_framesWritten.load()}
+    };
+}
@@ -0,0 +1,153 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_LIVERECORDER_H
+#define ROBOTV_LIVERECORDER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vdr/channels.h>
+#include <vdr/recording.h>
+#include <vdr/remux.h>
+
+#include "live/livehub.h"
+#include "tools/metrics.h"
+
+class LiveQueue;
+class MsgPacket;
+
+/**
+ * Instant recording from the timeshift store of a live channel.
+ * The demuxed frames of the channel's (shared) timeshift store are muxed
+ * back into a transport stream and written as a VDR recording (with index),
+ * starting at a position in the timeshift window and continuing live.
+ * The channel's hub keeps receiving for the recorder, no second receiver
+ * is attached and the frames aren't written to disk twice.
+ */
+class LiveRecorder : public LiveHub::Subscriber {
+public:
+
+    /** Start recording a channel.
+     @param channel channel to record
+     @param startPosition wallclock time (ms) of the first frame (0 - latest keyframe)
+     @param status set to the return code (ROBOTV_RET_...)
+     @return the file name of the recording (empty on failure)
+     */
+    static std::string start(const cChannel* channel, int64_t startPosition, int& status);
+
+    /** Stop the recording of a channel */
+    static bool stop(uint32_t channelUid);
+
+    static bool isRecording(uint32_t channelUid);
+
+    /** Stop all recordings */
+    static void stopAll();
+
+    // LiveHub::Subscriber implementation
+
+    void streamChange(const DemuxerBundle& demuxers);
+
+protected:
+
+    LiveRecorder(const cChannel* channel);
+
+    virtual ~LiveRecorder();
+
+    bool open(const cChannel* channel, int64_t startPosition, int& status);
+
+    void run();
+
+    void writePacket(MsgPacket* p);
+
+    /** Split an audio batch into frames */
+    void writeFrameBatch(MsgPacket* p);
+
+    /** Write a frame as PES packet (in TS packets) */
+    void writeFrame(int pid, int frameType, int64_t pts, int64_t dts, const uint8_t* data, uint32_t size);
+
+    void writeTs(int pid, const uint8_t* data, uint32_t size);
+
+    void flush();
+
+    nlohmann::json getMetrics();
+
+private:
+
+    uint32_t m_uid;
+
+    std::string m_fileName;
+
+    LiveHub* m_hub = NULL;
+
+    LiveQueue* m_queue = NULL;
+
+    cFileName* m_file = NULL;
+
+    cUnbufferedFile* m_recordFile = NULL;
+
+    cIndexFile* m_index = NULL;
+
+    cPatPmtGenerator m_patPmtGenerator;
+
+    off_t m_fileSize = 0;
+
+    /** frames are indexed on this pid (video or first audio stream) */
+    int m_indexPid = 0;
+
+    bool m_synced = false;
+
+    std::map<int, StreamInfo::Type> m_streamTypes;
+
+    std::map<int, uint8_t> m_continuityCounters;
+
+    std::vector<uint8_t> m_buffer;
+
+    std::thread* m_thread = NULL;
+
+    std::atomic<bool> m_running;
+
+    bool m_dataAvailable = false;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_cond;
+
+    std::atomic<uint64_t> m_bytesWritten;
+
+    std::atomic<uint64_t> m_framesWritten;
+
+    static std::map<uint32_t, LiveRecorder*> m_recorders;
+
+    static std::mutex m_recordersMutex;
+
+};
+
+#endif // ROBOTV_LIVERECORDER_H
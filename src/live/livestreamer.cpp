@@ -24,7 +24,6 @@
 
 #include <stdlib.h>
 #include <vdr/remux.h>
-#include <vdr/timers.h>
 
 #ifdef __FreeBSD__
 #include <sys/endian.h>
@@ -41,241 +40,286 @@
 
 #include "livestreamer.h"
 #include "livequeue.h"
-#include "channelcache.h"
+#include "latencytrace.h"
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
 
-#define MIN_PACKET_SIZE (128 * 1024)
+#define STREAM_PACKET_HEADER_SIZE (2 * sizeof(int64_t))
 
-using namespace std::chrono;
+// seek positions closer to the live edge don't switch to timeshift
+#define LIVE_EDGE_MARGIN_MS 2000
 
-LiveStreamer::LiveStreamer(RoboTvClient* parent, const cChannel* channel, int priority)
-    : cReceiver(NULL, priority)
-    , m_demuxers(this)
-    , m_parent(parent) {
-    m_uid = createChannelUid(channel);
+// live clients lagging behind the live edge drop B-frames
+#define LAG_DROP_BFRAMES_MS 2000
 
-    // create send queue
-    m_queue = new LiveQueue(m_parent->getSocket());
-}
+// live clients lagging too far resync at the next keyframe
+#define LAG_RESYNC_MS 5000
 
-LiveStreamer::~LiveStreamer() {
-    // wait for pending channelchange
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        detach();
-        m_demuxers.clear();
-        delete m_queue;
-    }
+// header of a mux packet (pid, pts, dts, duration, size)
+#define MUXPKT_HEADER_SIZE 26
 
-    std::this_thread::yield();
+// streams per compact stream packet (7 bit stream index)
+#define COMPACT_MAX_STREAMS 127
 
-    m_uid = 0;
-    m_device = NULL;
-    delete m_streamPacket;
+// frame table entry of an audio batch (pts, dts, duration, size)
+#define MUXBATCH_FRAME_SIZE 24
 
-    INFOLOG("live streamer terminated");
-}
-
-void LiveStreamer::setWaitForKeyFrame(bool waitforiframe) {
-    m_waitForKeyFrame = waitforiframe;
-}
+using namespace std::chrono;
 
-void LiveStreamer::requestStreamChange() {
-    m_requestStreamChange = true;
-}
+/** Deletes detached streamers on a background thread */
+class StreamerReaper {
+public:
 
-int LiveStreamer::switchChannel(const cChannel* channel) {
+    ~StreamerReaper() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+            m_cond.notify_all();
+        }
 
-    if(channel == NULL) {
-        ERRORLOG("unknown channel !");
-        return ROBOTV_RET_ERROR;
+        if(m_thread.joinable()) {
+            m_thread.join();
+        }
     }
 
-    detach();
-
-    // get device for this channel
-    m_device = cDevice::GetDevice(channel, LIVEPRIORITY, false);
-
-    if(m_device == NULL) {
-        // return status "recording running" if there is an active timer
-        time_t now = time(NULL);
+    void add(LiveStreamer* streamer) {
+        std::lock_guard<std::mutex> lock(m_mutex);
 
-        for(cTimer* ti = Timers.First(); ti; ti = Timers.Next(ti)) {
-            if(ti->Recording() && ti->Matches(now)) {
-                ERRORLOG("Recording running !");
-                return ROBOTV_RET_RECRUNNING;
-            }
+        if(!m_thread.joinable()) {
+            m_thread = std::thread([&]() {
+                action();
+            });
         }
 
-        ERRORLOG("No device available !");
-        return ROBOTV_RET_DATALOCKED;
+        m_streamers.push_back(streamer);
+        m_cond.notify_all();
     }
 
-    INFOLOG("Found available device %d", m_device->DeviceNumber() + 1);
+private:
 
-    if(!m_device->SwitchChannel(channel, false)) {
-        ERRORLOG("Can't switch to channel %i - %s", channel->Number(), channel->Name());
-        return ROBOTV_RET_ERROR;
-    }
+    void action() {
+        std::unique_lock<std::mutex> lock(m_mutex);
 
-    // get cached demuxer data
-    ChannelCache& cache = ChannelCache::instance();
-    StreamBundle bundle = cache.lookup(m_uid);
+        while(m_running || !m_streamers.empty()) {
+            if(m_streamers.empty()) {
+                m_cond.wait(lock);
+                continue;
+            }
 
-    // channel already in cache
-    if(bundle.size() != 0) {
-        INFOLOG("Channel information found in cache");
-    }
-    // channel not found in cache -> add it from vdr
-    else {
-        INFOLOG("adding channel to cache");
-        bundle = cache.add(channel);
+            LiveStreamer* streamer = m_streamers.front();
+            m_streamers.pop_front();
+
+            lock.unlock();
+            delete streamer;
+            lock.lock();
+        }
     }
 
-    // recheck cache item
-    StreamBundle currentitem = StreamBundle::createFromChannel(channel);
+    std::mutex m_mutex;
 
-    if(!currentitem.isMetaOf(bundle)) {
-        INFOLOG("current channel differs from cache item - updating");
-        bundle = currentitem;
-        cache.add(m_uid, bundle);
-    }
+    std::condition_variable m_cond;
 
-    if(bundle.size() != 0) {
-        INFOLOG("Creating demuxers");
-        createDemuxers(&bundle);
-    }
+    std::thread m_thread;
 
-    requestStreamChange();
+    std::deque<LiveStreamer*> m_streamers;
 
-    INFOLOG("Successfully switched to channel %i - %s", channel->Number(), channel->Name());
+    bool m_running = true;
+};
 
-    if(m_waitForKeyFrame) {
-        INFOLOG("Will wait for first key frame ...");
+// created on first use (after the metrics), destroyed before them
+static StreamerReaper& reaper() {
+    static StreamerReaper instance;
+    return instance;
+}
+
+static uint64_t getBigEndian(const uint8_t* data, int length) {
+    uint64_t value = 0;
+
+    for(int i = 0; i < length; i++) {
+        value = (value << 8) | data[i];
     }
 
+    return value;
+}
+
+LiveStreamer::LiveStreamer(RoboTvClient* parent, const cChannel* channel, int priority, bool passthrough)
+    : m_parent(parent)
+    , m_priority(priority)
+    , m_passthrough(passthrough)
+    , m_droppedBFrames(0)
+    , m_droppedFrames(0)
+    , m_resyncs(0)
+    , m_packetsSent(0)
+    , m_bytesSent(0)
+    , m_unselectedPackets(0)
+    , m_compactBytesSaved(0) {
     m_uid = createChannelUid(channel);
 
-    if(!attach()) {
-        return ROBOTV_RET_DATALOCKED;
-    }
+    // create send queue (attached to the shared timeshift store of the channel)
+    m_queue = new LiveQueue(m_uid, passthrough);
 
-    INFOLOG("done switching.");
-    return ROBOTV_RET_OK;
+    Metrics::instance().add(this, "streamers", [ = ]() {
+        return getMetrics();
+    });
 }
 
-bool LiveStreamer::attach(void) {
-    if(m_device == NULL) {
-        return false;
-    }
+LiveStreamer::~LiveStreamer() {
+    detach();
+    Metrics::instance().remove(this);
 
-    if(IsAttached()) {
-        return true;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        delete m_queue;
+        m_queue = NULL;
     }
 
-    if(m_device->AttachReceiver(this)) {
-        INFOLOG("device attached to receiver");
-        return true;
+    std::this_thread::yield();
+
+    if(m_droppedBFrames > 0 || m_droppedFrames > 0) {
+        INFOLOG("slow client: %lu B-frames dropped, %lu frames dropped in %lu resyncs", m_droppedBFrames.load(), m_droppedFrames.load(), m_resyncs.load());
     }
 
-    ERRORLOG("failed to attach receiver !");
-    return false;
+    m_uid = 0;
+    delete m_streamPacket;
+
+    INFOLOG("live streamer terminated");
 }
 
-void LiveStreamer::detach(void) {
-    if(m_device == NULL) {
-        return;
+void LiveStreamer::detach() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_hub != NULL) {
+        m_hub->unsubscribe(this);
+        LiveHub::release(m_hub);
+        m_hub = NULL;
     }
 
-    if(!IsAttached()) {
+    if(m_queue != NULL) {
+        m_queue->setNotify(nullptr);
+    }
+}
+
+void LiveStreamer::destroy(LiveStreamer* streamer) {
+    if(streamer == NULL) {
         return;
     }
 
-    m_device->Detach(this);
-    INFOLOG("device detached");
+    streamer->detach();
+    reaper().add(streamer);
 }
 
-void LiveStreamer::sendStreamPacket(StreamPacket* pkt) {
-    // skip empty packets
-    if(pkt == NULL || pkt->size == 0) {
-        return;
+void LiveStreamer::setWaitForKeyFrame(bool waitforiframe) {
+    m_waitForKeyFrame = waitforiframe;
+}
+
+void LiveStreamer::setProtocolVersion(int version) {
+    m_protocolVersion = version;
+}
+
+void LiveStreamer::setNotify(std::function<void()> notify) {
+    m_queue->setNotify(notify);
+}
+
+void LiveStreamer::setBatching(uint32_t latencyMs, uint32_t timeshiftLatencyMs, uint32_t maxSize) {
+    m_batchPolicy.setLatency(latencyMs, timeshiftLatencyMs);
+    m_batchPolicy.setMaxSize(maxSize);
+}
+
+int LiveStreamer::switchChannel(const cChannel* channel) {
+
+    if(channel == NULL) {
+        ERRORLOG("unknown channel !");
+        return ROBOTV_RET_ERROR;
     }
 
-    // skip non audio / video packets
-    if(!(pkt->content == StreamInfo::scAUDIO || pkt->content == StreamInfo::scVIDEO)) {
-        return;
+    if(m_hub != NULL) {
+        m_hub->unsubscribe(this);
+        LiveHub::release(m_hub);
+        m_hub = NULL;
     }
 
-    // send stream change on demand
-    if(m_requestStreamChange && m_demuxers.isReady()) {
-        sendStreamChange();
+    // receive the channel once for all clients
+    int status = ROBOTV_RET_OK;
+    m_hub = LiveHub::acquire(channel, m_priority, status);
+
+    if(m_hub == NULL) {
+        return status;
     }
 
-    // wait for first I-Frame (if enabled)
-    if(m_waitForKeyFrame && pkt->frameType != StreamInfo::ftIFRAME) {
-        return;
+    if(m_waitForKeyFrame) {
+        INFOLOG("Will wait for first key frame ...");
     }
 
-    m_waitForKeyFrame = false;
+    m_uid = createChannelUid(channel);
+    m_audioOnly = m_hub->isAudioOnly();
+    m_batchPolicy.setAudioOnly(m_audioOnly);
+    m_batchPolicy.setLive(true);
+    m_lagBaseline = -1;
+    m_hub->subscribe(this, m_passthrough);
 
-    // initialise stream packet
-    MsgPacket* packet = new MsgPacket(ROBOTV_STREAM_MUXPKT, ROBOTV_CHANNEL_STREAM);
-    packet->disablePayloadCheckSum();
+    return ROBOTV_RET_OK;
+}
 
-    // write stream data
-    packet->put_U16(pkt->pid);
-    packet->put_S64(pkt->rawPts);
-    packet->put_S64(pkt->rawDts);
-    packet->put_U32(pkt->duration);
+void LiveStreamer::streamChange(const DemuxerBundle& demuxers) {
+    INFOLOG("stream change notification");
+
+    {
+        std::lock_guard<std::mutex> lock(m_selectionMutex);
+        m_streams.clear();
 
-    // write frame type into unused header field clientid
-    packet->setClientID((uint16_t)pkt->frameType);
+        for(auto i = demuxers.begin(); i != demuxers.end(); i++) {
+            StreamInfo::Content content = (*i)->getContent();
 
-    // write payload into stream packet
-    packet->put_U32(pkt->size);
-    packet->put_Blob(pkt->data, pkt->size);
+            if(content == StreamInfo::scAUDIO || content == StreamInfo::scSUBTITLE) {
+                m_streams.insert((*i)->getPid());
+            }
+        }
+
+        updateUnselectedStreams();
+    }
 
-    // add timestamp (wallclock time in ms)
-    packet->put_S64(roboTV::currentTimeMillis().count());
+    // reorder streams as preferred
+    MsgPacket* resp = demuxers.createStreamChangePacket(m_languageIndex, m_langStreamType);
+    m_queue->queue(resp, StreamInfo::scSTREAMINFO);
+}
 
-    m_queue->queue(packet, pkt->content, pkt->rawPts);
+void LiveStreamer::setParent(RoboTvClient* parent) {
+    std::lock_guard<std::mutex> lock(m_parentMutex);
+    m_parent = parent;
 }
 
 void LiveStreamer::sendDetach() {
+    std::lock_guard<std::mutex> lock(m_parentMutex);
+
+    if(m_parent == NULL) {
+        return;
+    }
+
     INFOLOG("sending detach message");
     MsgPacket* resp = new MsgPacket(ROBOTV_STREAM_DETACH, ROBOTV_CHANNEL_STREAM);
     m_parent->queueMessage(resp);
 }
 
-void LiveStreamer::sendStreamChange() {
-    INFOLOG("stream change notification");
-
-    StreamBundle cache;
+void LiveStreamer::sendStatus(int status) {
+    std::lock_guard<std::mutex> lock(m_parentMutex);
 
-    for(auto i = m_demuxers.begin(); i != m_demuxers.end(); i++) {
-        cache.addStream(*(*i));
+    if(m_parent == NULL) {
+        return;
     }
 
-    ChannelCache::instance().add(m_uid, cache);
-
-    // reorder streams as preferred
-    m_demuxers.reorderStreams(m_languageIndex, m_langStreamType);
-
-    MsgPacket* resp = m_demuxers.createStreamChangePacket();
-    m_queue->queue(resp, StreamInfo::scSTREAMINFO);
-
-    m_requestStreamChange = false;
-}
-
-void LiveStreamer::sendStatus(int status) {
     MsgPacket* packet = new MsgPacket(ROBOTV_STREAM_STATUS, ROBOTV_CHANNEL_STREAM);
     packet->put_U32(status);
     m_parent->queueMessage(packet);
 }
 
 void LiveStreamer::requestSignalInfo() {
-    if(m_device == NULL || !IsAttached()) {
+    cDevice* device = (m_hub != NULL) ? m_hub->getDevice() : NULL;
+
+    if(device == NULL) {
         return;
     }
 
@@ -287,18 +331,18 @@ void LiveStreamer::requestSignalInfo() {
 
     MsgPacket* resp = new MsgPacket(ROBOTV_STREAM_SIGNALINFO, ROBOTV_CHANNEL_STREAM);
 
-    int DeviceNumber = m_device->DeviceNumber() + 1;
+    int DeviceNumber = device->DeviceNumber() + 1;
     int Strength = 0;
     int Quality = 0;
 
-    Strength = m_device->SignalStrength();
-    Quality = m_device->SignalQuality();
+    Strength = device->SignalStrength();
+    Quality = device->SignalQuality();
 
     resp->put_String(*cString::sprintf(
                          "%s #%d - %s",
-                         (const char*)m_device->DeviceType(),
+                         (const char*)device->DeviceType(),
                          DeviceNumber,
-                         (const char*)m_device->DeviceName()));
+                         (const char*)device->DeviceName()));
 
     // Quality:
     // 4 - NO LOCK
@@ -354,6 +398,58 @@ void LiveStreamer::setLanguage(int lang, StreamInfo::Type streamtype) {
     m_langStreamType = streamtype;
 }
 
+void LiveStreamer::selectStreams(const std::set<int>& pids) {
+    {
+        std::lock_guard<std::mutex> lock(m_selectionMutex);
+        m_selectedStreams = pids;
+        updateUnselectedStreams();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_hub != NULL) {
+        m_hub->updateStreamSelection();
+    }
+}
+
+bool LiveStreamer::getSelectedStreams(std::set<int>& pids) {
+    std::lock_guard<std::mutex> lock(m_selectionMutex);
+
+    if(m_selectedStreams.empty()) {
+        return false;
+    }
+
+    pids.insert(m_selectedStreams.begin(), m_selectedStreams.end());
+    return true;
+}
+
+void LiveStreamer::updateUnselectedStreams() {
+    m_unselectedStreams.clear();
+
+    if(m_selectedStreams.empty()) {
+        return;
+    }
+
+    for(int pid : m_streams) {
+        if(m_selectedStreams.find(pid) == m_selectedStreams.end()) {
+            m_unselectedStreams.insert(pid);
+        }
+    }
+}
+
+bool LiveStreamer::isUnselected(MsgPacket* p) {
+    if((p->getMsgID() != ROBOTV_STREAM_MUXPKT && p->getMsgID() != ROBOTV_STREAM_MUXBATCH) || p->getPayloadLength() < 2) {
+        return false;
+    }
+
+    // the packet starts with the pid of the stream
+    uint8_t* data = p->getPayload();
+    int pid = (data[0] << 8) | data[1];
+
+    std::lock_guard<std::mutex> lock(m_selectionMutex);
+    return (m_unselectedStreams.find(pid) != m_unselectedStreams.end());
+}
+
 bool LiveStreamer::isPaused() {
     if(m_queue == NULL) {
         return false;
@@ -368,10 +464,17 @@ void LiveStreamer::pause(bool on) {
     }
 
     m_queue->pause(on);
+
+    // the batch policy is read by requestPacket()
+    if(on) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_batchPolicy.setLive(false);
+    }
 }
 
-MsgPacket* LiveStreamer::requestPacket(bool keyFrameMode) {
+MsgPacket* LiveStreamer::requestPacket(bool keyFrameMode, uint32_t maxLength, bool flush) {
     std::lock_guard<std::mutex> lock(m_mutex);
+    auto start = std::chrono::steady_clock::now();
 
     // create payload packet
     if(m_streamPacket == NULL) {
@@ -379,6 +482,16 @@ MsgPacket* LiveStreamer::requestPacket(bool keyFrameMode) {
         m_streamPacket->put_S64(m_queue->getTimeshiftStartPosition());
         m_streamPacket->put_S64(0);
         m_streamPacket->disablePayloadCheckSum();
+
+        m_compactIndex.clear();
+        m_compactPts.clear();
+        m_compactWallclockTime = 0;
+    }
+
+    // adapt the batch size to the bitrate of the channel
+    if(maxLength == 0) {
+        m_batchPolicy.setBitRate((m_hub != NULL) ? m_hub->getBitRate() : 0);
+        maxLength = m_batchPolicy.threshold();
     }
 
     // request packet from queue
@@ -386,71 +499,379 @@ MsgPacket* LiveStreamer::requestPacket(bool keyFrameMode) {
 
     while(p = m_queue->read(keyFrameMode)) {
 
-        // add data
-        m_streamPacket->put_U16(p->getMsgID());
-        m_streamPacket->put_U16(p->getClientID());
+        // stream changes of the timeshift are sent in the client's stream order
+        if(p->getMsgID() == ROBOTV_STREAM_LAYOUT) {
+            MsgPacket* change = DemuxerBundle::createStreamChangePacket(p, m_languageIndex, m_langStreamType);
+            delete p;
+            p = change;
+        }
 
-        // add payload
-        uint8_t* data = p->getPayload();
-        int length = p->getPayloadLength();
-        m_streamPacket->put_Blob(data, length);
+        // the client already got this stream setup (hub notification, seek)
+        if(p->getMsgID() == ROBOTV_STREAM_CHANGE) {
+            std::vector<uint8_t> streamChange(p->getPayload(), p->getPayload() + p->getPayloadLength());
 
-        delete p;
+            if(streamChange == m_streamChange) {
+                delete p;
+                continue;
+            }
+
+            m_streamChange.swap(streamChange);
+        }
+
+        // audio tracks the client doesn't play (other clients may still watch them)
+        if(isUnselected(p)) {
+            m_unselectedPackets++;
+            delete p;
+            continue;
+        }
+
+        // slow client
+        if(dropPacket(p)) {
+            delete p;
+            continue;
+        }
+
+        // wait for first I-Frame (if enabled, radio starts at any packet)
+        if(m_waitForKeyFrame && isMediaPacket(p)) {
+            if(p->getClientID() != StreamInfo::ftIFRAME && !m_audioOnly) {
+                delete p;
+                continue;
+            }
+
+            m_waitForKeyFrame = false;
+        }
+
+        // trace the age of live packets
+        if(LatencyTrace::isEnabled()) {
+            int64_t wallclockTime = getWallclockTime(p);
+            LatencyTrace::addSince(m_uid, LatencyTrace::stRead, wallclockTime);
+
+            if(m_streamPacketTime == 0) {
+                m_streamPacketTime = wallclockTime;
+            }
+        }
+
+        bool compact = (m_protocolVersion >= ROBOTV_PROTOCOLVERSION_COMPACT && p->getMsgID() == ROBOTV_STREAM_MUXPKT);
+
+        // coalesced audio frames are sent one by one
+        if(p->getMsgID() == ROBOTV_STREAM_MUXBATCH) {
+            if(!putFrameBatch(p)) {
+                delete p;
+            }
+        }
+        else if(!compact || !putCompactPacket(p)) {
+            // add data
+            m_streamPacket->put_U16(p->getMsgID());
+            m_streamPacket->put_U16(p->getClientID());
+
+            // add payload
+            uint8_t* data = p->getPayload();
+            int length = p->getPayloadLength();
+
+            // packet views are only valid until the next read
+            if(p->isView()) {
+                m_streamPacket->put_Blob(data, length);
+                delete p;
+            }
+            else {
+                m_streamPacket->put_Segment(std::shared_ptr<MsgPacket>(p), data, length);
+            }
+        }
 
         // send payload packet if it's big enough
-        if(m_streamPacket->getPayloadLength() >= MIN_PACKET_SIZE) {
-            MsgPacket* result = m_streamPacket;
-            m_streamPacket = NULL;
-            return result;
+        if(m_streamPacket->getPayloadLength() >= maxLength) {
+            return takeStreamPacket(start);
         }
     }
 
-    if(m_queue->isPaused()) {
-        MsgPacket* result = m_streamPacket;
-        m_streamPacket = NULL;
-        return result;
+    // flush pending data (push-mode)
+    bool pending = (m_streamPacket->getPayloadLength() > STREAM_PACKET_HEADER_SIZE);
+
+    if((flush && pending) || m_queue->isPaused()) {
+        return takeStreamPacket(start);
     }
 
     return NULL;
 }
 
-#if VDRVERSNUM < 20300
-void LiveStreamer::Receive(uchar* Data, int Length)
-#else
-void LiveStreamer::Receive(const uchar* Data, int Length)
-#endif
-{
-    m_demuxers.processTsPacket(Data);
+bool LiveStreamer::putCompactPacket(MsgPacket* p) {
+    uint8_t* payload = p->getPayload();
+    uint32_t length = p->getPayloadLength();
+
+    if(length < MUXPKT_HEADER_SIZE + sizeof(int64_t)) {
+        return false;
+    }
+
+    // U16 pid, S64 pts, S64 dts, U32 duration, U32 size, data, S64 wallclock time
+    int pid = getBigEndian(payload, 2);
+    int64_t pts = getBigEndian(payload + 2, 8);
+    int64_t dts = getBigEndian(payload + 10, 8);
+    uint32_t duration = getBigEndian(payload + 18, 4);
+    uint32_t size = getBigEndian(payload + 22, 4);
+
+    if(MUXPKT_HEADER_SIZE + size + sizeof(int64_t) != length) {
+        return false;
+    }
+
+    int64_t wallclockTime = getBigEndian(payload + MUXPKT_HEADER_SIZE + size, 8);
+
+    // packet views are only valid until the next read
+    std::shared_ptr<MsgPacket> owner;
+
+    if(!p->isView()) {
+        owner.reset(p);
+    }
+
+    putFrame(owner, p->getClientID(), pid, pts, dts, duration, wallclockTime, payload + MUXPKT_HEADER_SIZE, size);
+    m_compactBytesSaved += (length + 4) - (m_frameHeaderSize + size);
+
+    if(p->isView()) {
+        delete p;
+    }
+
+    return true;
 }
 
-void LiveStreamer::processChannelChange(const cChannel* channel) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+bool LiveStreamer::putFrameBatch(MsgPacket* p) {
+    uint8_t* payload = p->getPayload();
+    uint32_t length = p->getPayloadLength();
 
-    if(!IsAttached()) {
-        return;
+    // U16 pid, frame data, frame table, U16 frame count, S64 wallclock time
+    if(length < 2 + sizeof(uint16_t) + sizeof(int64_t)) {
+        return false;
     }
 
-    if(createChannelUid(channel) != m_uid) {
-        return;
+    int pid = getBigEndian(payload, 2);
+    int64_t wallclockTime = getBigEndian(payload + length - 8, 8);
+    uint32_t count = getBigEndian(payload + length - 10, 2);
+
+    if(length < 2 + count * MUXBATCH_FRAME_SIZE + 10) {
+        return false;
+    }
+
+    uint8_t* table = payload + length - 10 - count * MUXBATCH_FRAME_SIZE;
+    uint8_t* data = payload + 2;
+
+    std::shared_ptr<MsgPacket> owner;
+
+    if(!p->isView()) {
+        owner.reset(p);
+    }
+
+    // S64 pts, S64 dts, U32 duration, U32 size per frame
+    for(uint32_t i = 0; i < count; i++, table += MUXBATCH_FRAME_SIZE) {
+        uint32_t size = getBigEndian(table + 20, 4);
+
+        if(data + size > payload + length - 10 - count * MUXBATCH_FRAME_SIZE) {
+            ERRORLOG("malformed audio batch of pid %i", pid);
+            break;
+        }
+
+        putFrame(owner, p->getClientID(), pid, getBigEndian(table, 8), getBigEndian(table + 8, 8), getBigEndian(table + 16, 4), wallclockTime, data, size);
+        data += size;
+    }
+
+    if(p->isView()) {
+        delete p;
+    }
+
+    return true;
+}
+
+void LiveStreamer::putFrame(const std::shared_ptr<MsgPacket>& owner, uint16_t frameType, int pid, int64_t pts, int64_t dts, uint32_t duration, int64_t wallclockTime, uint8_t* data, uint32_t size) {
+    uint32_t start = m_streamPacket->getPayloadLength();
+
+    // streams are numbered in the order of their first packet
+    auto i = m_compactIndex.find(pid);
+    bool defined = (i != m_compactIndex.end());
+    bool compact = (m_protocolVersion >= ROBOTV_PROTOCOLVERSION_COMPACT) && (defined || m_compactIndex.size() < COMPACT_MAX_STREAMS);
+
+    if(compact) {
+        int index = defined ? i->second : m_compactIndex.size();
+
+        if(!defined) {
+            m_compactIndex[pid] = index;
+            m_compactPts.push_back(0);
+        }
+
+        m_streamPacket->put_U16(ROBOTV_STREAM_DELTAPKT);
+        m_streamPacket->put_U16(frameType);
+
+        // the first packet of a stream carries the pid
+        if(defined) {
+            m_streamPacket->put_U8(index);
+        }
+        else {
+            m_streamPacket->put_U8(index | 0x80);
+            m_streamPacket->put_U16(pid);
+        }
+
+        m_streamPacket->put_VarS64(pts - m_compactPts[index]);
+        m_streamPacket->put_VarS64(dts - pts);
+        m_streamPacket->put_VarU64(duration);
+        m_streamPacket->put_VarS64(wallclockTime - m_compactWallclockTime);
+        m_streamPacket->put_VarU64(size);
+
+        m_compactPts[index] = pts;
+        m_compactWallclockTime = wallclockTime;
+    }
+    else {
+        m_streamPacket->put_U16(ROBOTV_STREAM_MUXPKT);
+        m_streamPacket->put_U16(frameType);
+        m_streamPacket->put_U16(pid);
+        m_streamPacket->put_S64(pts);
+        m_streamPacket->put_S64(dts);
+        m_streamPacket->put_U32(duration);
+        m_streamPacket->put_U32(size);
+    }
+
+    m_frameHeaderSize = m_streamPacket->getPayloadLength() - start;
+
+    // add frame data
+    if(owner) {
+        m_streamPacket->put_Segment(owner, data, size);
+    }
+    else {
+        m_streamPacket->put_Blob(data, size);
     }
 
-    INFOLOG("ChannelChange()");
-    switchChannel(channel);
+    if(!compact) {
+        m_streamPacket->put_S64(wallclockTime);
+        m_frameHeaderSize += sizeof(int64_t);
+    }
 }
 
-void LiveStreamer::createDemuxers(StreamBundle* bundle) {
-    // update demuxers
-    m_demuxers.updateFrom(bundle);
+MsgPacket* LiveStreamer::takeStreamPacket(const std::chrono::steady_clock::time_point& start) {
+    MsgPacket* result = m_streamPacket;
+    m_streamPacket = NULL;
 
-    // update pids
-    SetPids(NULL);
+    m_aggregateLatency.addSince(start);
+    m_packetsSent++;
+    m_bytesSent += result->getPayloadLength();
 
-    for(auto i = m_demuxers.begin(); i != m_demuxers.end(); i++) {
-        TsDemuxer* dmx = *i;
-        AddPid(dmx->getPid());
+    // the age of the oldest packet is traced until it has been sent
+    if(m_streamPacketTime != 0) {
+        LatencyTrace::addSince(m_uid, LatencyTrace::stAggregate, m_streamPacketTime);
+        result->setTrace(m_uid, m_streamPacketTime);
+        m_streamPacketTime = 0;
+    }
+
+    return result;
+}
+
+bool LiveStreamer::isMediaPacket(MsgPacket* p) {
+    return (p->getMsgID() == ROBOTV_STREAM_MUXPKT || p->getMsgID() == ROBOTV_STREAM_MUXBATCH || p->getMsgID() == ROBOTV_STREAM_TSPKT);
+}
+
+int64_t LiveStreamer::getWallclockTime(MsgPacket* p) {
+    if(!isMediaPacket(p) || p->getPayloadLength() < sizeof(int64_t)) {
+        return 0;
+    }
+
+    // wallclock time is stored at the end of the payload
+    int64_t wallclockTime = 0;
+    memcpy(&wallclockTime, p->getPayload() + p->getPayloadLength() - sizeof(int64_t), sizeof(int64_t));
+
+    return (int64_t)be64toh(wallclockTime);
+}
+
+nlohmann::json LiveStreamer::getMetrics() {
+    unsigned int client = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_parentMutex);
+        client = (m_parent != NULL) ? m_parent->getId() : 0;
+    }
+
+    return {
+        {"client", client},
+        {"channelUid", m_uid.load()},
+        {"packetsSent", (uint64_t)m_packetsSent},
+        {"bytesSent", (uint64_t)m_bytesSent},
+        {"unselectedPackets", (uint64_t)m_unselectedPackets},
+        {"compactBytesSaved", (uint64_t)m_compactBytesSaved},
+        {"droppedBFrames", (uint64_t)m_droppedBFrames},
+        {"droppedFrames", (uint64_t)m_droppedFrames},
+        {"resyncs", (uint64_t)m_resyncs},
+        {"aggregate", m_aggregateLatency.toJson()}
+    };
+}
+
+bool LiveStreamer::dropPacket(MsgPacket* p) {
+    // stream changes, status messages, ... are never dropped
+    if(!isMediaPacket(p) || p->getPayloadLength() < sizeof(int64_t)) {
+        return false;
+    }
+
+    uint16_t frameType = p->getClientID();
+    int64_t lag = roboTV::currentTimeMillis().count() - getWallclockTime(p);
+
+    // keyframe -> in sync again
+    if(frameType == StreamInfo::ftIFRAME) {
+        m_resync = false;
+
+        // clients start at the latest keyframe in the store (the cached GOP),
+        // its age isn't lag caused by the client
+        if(m_lagBaseline < 0) {
+            m_lagBaseline = std::max(lag, (int64_t)0);
+        }
+
+        return false;
+    }
+
+    // the allowance shrinks while the client catches up
+    if(m_lagBaseline > 0) {
+        m_lagBaseline = std::min(m_lagBaseline, std::max(lag, (int64_t)0));
+        lag -= m_lagBaseline;
+    }
+
+    // timeshift clients read at their own pace
+    if(!m_batchPolicy.isLive()) {
+        return false;
+    }
+
+    // frame types are only set for video packets
+    if(frameType == StreamInfo::ftUNKNOWN) {
+        return false;
+    }
+
+    if(m_resync) {
+        m_droppedFrames++;
+        return true;
+    }
+
+    if(lag > LAG_RESYNC_MS) {
+        INFOLOG("client lags %li ms behind live - resync at next keyframe", lag);
+        m_resync = true;
+        m_resyncs++;
+        m_droppedFrames++;
+        return true;
+    }
+
+    if(lag > LAG_DROP_BFRAMES_MS && frameType == StreamInfo::ftBFRAME) {
+        m_droppedBFrames++;
+        return true;
+    }
+
+    return false;
+}
+
+void LiveStreamer::processChannelChange(const cChannel* channel) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_hub != NULL) {
+        m_hub->processChannelChange(channel);
     }
 }
 
 int64_t LiveStreamer::seek(int64_t wallclockPositionMs) {
+    int64_t liveEdge = roboTV::currentTimeMillis().count() - LIVE_EDGE_MARGIN_MS;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_batchPolicy.setLive(wallclockPositionMs >= liveEdge);
+        m_lagBaseline = -1;
+    }
+
     return m_queue->seek(wallclockPositionMs);
 }
@@ -27,93 +27,231 @@
 
 #include <vdr/channels.h>
 #include <vdr/device.h>
-#include <vdr/receiver.h>
-#include <vdr/ringbuffer.h>
 
 #include "demuxer/demuxer.h"
 #include "demuxer/streambundle.h"
 #include "demuxer/demuxerbundle.h"
 #include "robotv/robotvcommand.h"
+#include "live/livehub.h"
+#include "tools/batchpolicy.h"
+#include "tools/metrics.h"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <list>
+#include <map>
 #include <mutex>
+#include <set>
+#include <vector>
 
 class cChannel;
-class TsDemuxer;
 class MsgPacket;
 class LiveQueue;
 class RoboTvClient;
 
-class LiveStreamer : public cReceiver, public TsDemuxer::Listener {
+class LiveStreamer : public LiveHub::Subscriber {
 private:
 
-    void detach(void);
+    void sendStatus(int status);
 
-    bool attach(void);
+    void sendDetach();
 
-    TsDemuxer* findDemuxer(int Pid);
+    /** Backpressure policy for slow clients.
+     Drops B-frames if the client lags behind the live edge and resyncs at
+     the next keyframe (dropping all non-keyframes) if it lags too far.
+     @return true if the packet should be dropped
+     */
+    bool dropPacket(MsgPacket* p);
 
-    void reorderStreams(int lang, StreamInfo::Type type);
+    /** Creation time of a live packet.
+     @return wallclock time (in ms) stamped by the hub or 0 for other packets
+     */
+    static int64_t getWallclockTime(MsgPacket* p);
 
-    void sendStreamChange();
+    /** Check for packets of streams the client didn't select */
+    bool isUnselected(MsgPacket* p);
 
-    void sendStatus(int status);
+    /** Update the pids of the unselected audio and subtitle streams */
+    void updateUnselectedStreams();
 
-    void sendDetach();
+    /** Check for packets with media data (demuxed frames or TS batches) */
+    static bool isMediaPacket(MsgPacket* p);
+
+    /** Add a mux packet with a compact (delta encoded) header.
+     Takes the ownership of the packet.
+     @return false if the packet can't be parsed (a plain packet must be sent)
+     */
+    bool putCompactPacket(MsgPacket* p);
 
-    cDevice* m_device = NULL;              /*!> The receiving device the channel depents to */
+    /** Add the frames of coalesced audio packet (ROBOTV_STREAM_MUXBATCH).
+     Takes the ownership of the packet.
+     @return false if the packet is malformed
+     */
+    bool putFrameBatch(MsgPacket* p);
 
-    DemuxerBundle m_demuxers = NULL;
+    /** Add a single frame to the stream packet.
+     Frames are written as ROBOTV_STREAM_DELTAPKT for compact clients (the
+     state of the encoding is reset with every stream packet, so each stream
+     packet can be decoded on its own) and as ROBOTV_STREAM_MUXPKT otherwise.
+     @param owner packet owning the frame data (empty: the data is copied)
+     */
+    void putFrame(const std::shared_ptr<MsgPacket>& owner, uint16_t frameType, int pid, int64_t pts, int64_t dts, uint32_t duration, int64_t wallclockTime, uint8_t* data, uint32_t size);
+
+    /** Complete the current stream packet (batch) */
+    MsgPacket* takeStreamPacket(const std::chrono::steady_clock::time_point& start);
+
+    nlohmann::json getMetrics();
+
+    LiveHub* m_hub = NULL;                 /*!> The channel hub receiving the channel */
 
     LiveQueue* m_queue = NULL;
 
     RoboTvClient* m_parent = NULL;
 
-    bool m_requestStreamChange = false;
+    std::mutex m_parentMutex;
 
     int m_languageIndex = -1;
 
     StreamInfo::Type m_langStreamType = StreamInfo::stAC3;
 
-    uint32_t m_uid;
+    /** Payload of the last stream change sent to the client */
+    std::vector<uint8_t> m_streamChange;
+
+    std::atomic<uint32_t> m_uid;
 
     bool m_waitForKeyFrame = false;
 
+    bool m_audioOnly = false;
+
     std::mutex m_mutex;
 
     MsgPacket* m_streamPacket = NULL;
 
-protected:
+    int64_t m_streamPacketTime = 0;
 
-    void Action(void);
+    int m_priority;
 
-#if VDRVERSNUM < 20300
-    void Receive(uchar* Data, int Length);
-#else
-    void Receive(const uchar* Data, int Length);
-#endif
+    BatchPolicy m_batchPolicy;
 
-private:
+    bool m_resync = false;
+
+    /** Age of the keyframe the client started with (-1: not started yet) */
+    int64_t m_lagBaseline = -1;
+
+    bool m_passthrough = false;
+
+    int m_protocolVersion = 0;
+
+    std::map<int, int> m_compactIndex;      /*!> Stream index (by pid) within the current stream packet */
+
+    std::vector<int64_t> m_compactPts;
+
+    int64_t m_compactWallclockTime = 0;
+
+    uint32_t m_frameHeaderSize = 0;         /*!> Header size of the last frame written by putFrame() */
 
-    void createDemuxers(StreamBundle* bundle);
+    std::set<int> m_selectedStreams;        /*!> Selected audio / subtitle pids (empty: all streams) */
+
+    std::set<int> m_streams;                /*!> Audio / subtitle pids of the channel */
+
+    std::set<int> m_unselectedStreams;
+
+    std::mutex m_selectionMutex;
+
+    std::atomic<uint64_t> m_droppedBFrames;
+
+    std::atomic<uint64_t> m_droppedFrames;
+
+    std::atomic<uint64_t> m_resyncs;
+
+    std::atomic<uint64_t> m_packetsSent;
+
+    std::atomic<uint64_t> m_bytesSent;
+
+    std::atomic<uint64_t> m_unselectedPackets;
+
+    std::atomic<uint64_t> m_compactBytesSaved;
+
+    LatencyHistogram m_aggregateLatency;
 
 public:
 
-    LiveStreamer(RoboTvClient* parent, const cChannel* channel, int priority);
+    /** Create a streamer.
+     @param passthrough stream the raw TS data of the channel (not demuxed)
+     */
+    LiveStreamer(RoboTvClient* parent, const cChannel* channel, int priority, bool passthrough = false);
 
     virtual ~LiveStreamer();
 
+    /** Stop receiving.
+     Unsubscribes from the channel hub (releasing the device) and stops
+     all client notifications. The streamer can't be used anymore.
+     */
+    void detach();
+
+    /** Destroy a streamer in the background.
+     The streamer is detached right away, the rest of the teardown (queue,
+     timeshift store, pending packets) runs on a reaper thread.
+     */
+    static void destroy(LiveStreamer* streamer);
+
+    /** Hand the streamer over to another client.
+     A parked streamer (parent NULL) keeps receiving into the timeshift,
+     status messages are dropped until a client resumes the stream.
+     */
+    void setParent(RoboTvClient* parent);
+
     void processChannelChange(const cChannel* Channel);
 
     bool isPaused();
 
+    uint32_t getChannelUid() const {
+        return m_uid;
+    }
+
+    /** Check if the client reads behind the live edge (paused or seeked back) */
+    bool isTimeShifting() const {
+        return !m_batchPolicy.isLive();
+    }
+
     void setLanguage(int lang, StreamInfo::Type streamtype = StreamInfo::stAC3);
 
     void setWaitForKeyFrame(bool waitForKeyFrame);
 
+    /** Set the protocol version of the client (compact packets with version 8+) */
+    void setProtocolVersion(int version);
+
+    /** Select the audio and subtitle streams sent to the client.
+     Unselected streams are dropped and aren't parsed by the hub if no
+     other client watches them (their stream information stays available).
+     @param pids selected pids (empty: all streams)
+     */
+    void selectStreams(const std::set<int>& pids);
+
+    /** Set data notification (push-mode).
+     The callback is invoked whenever new stream data is available.
+     */
+    void setNotify(std::function<void()> notify);
+
+    /** Set the batching policy requested by the client.
+     Passing 0 keeps the default value.
+     @param latencyMs latency budget (in ms) while live
+     @param timeshiftLatencyMs latency budget (in ms) while in timeshift
+     @param maxSize maximum size of an aggregated packet
+     */
+    void setBatching(uint32_t latencyMs, uint32_t timeshiftLatencyMs, uint32_t maxSize);
+
     void pause(bool on);
 
-    MsgPacket* requestPacket(bool keyFrameMode = false);
+    /** Request aggregated stream data.
+     @param keyFrameMode deliver keyframes only
+     @param maxLength return the packet as soon as its payload reaches this size
+     (0 - use the adaptive threshold of the batching policy)
+     @param flush return any pending data instead of waiting for maxLength
+     @return packet or NULL if no (or not enough) data is available
+     */
+    MsgPacket* requestPacket(bool keyFrameMode = false, uint32_t maxLength = 0, bool flush = false);
 
     void requestSignalInfo();
 
@@ -121,11 +259,11 @@ public:
 
     int64_t seek(int64_t wallclockPositionMs);
 
-    // TsDemuxer::Listener implementation
+    // LiveHub::Subscriber implementation
 
-    void sendStreamPacket(StreamPacket* pkt);
+    void streamChange(const DemuxerBundle& demuxers);
 
-    void requestStreamChange();
+    bool getSelectedStreams(std::set<int>& pids);
 
 };
 
@@ -0,0 +1,486 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <sys/types.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <sstream>
+
+#include <vdr/channels.h>
+#include <vdr/device.h>
+
+#include "peerregistry.h"
+#include "livehub.h"
+#include "timeshiftfilepool.h"
+#include "config/config.h"
+#include "tools/hash.h"
+
+// announcements: "roboTV-peer <version> <node id> <port> <devices> <free devices>
+// <clients> <timeshift files> <name> <channel uids (hex, comma separated)>"
+#define PEER_MAGIC "roboTV-peer"
+#define PEER_PROTOCOL_VERSION 1
+
+// peers are dropped if they didn't announce for this time
+#define PEER_TIMEOUT_MS (10 * 1000)
+
+#define PEER_MAX_DATAGRAM 8192
+
+PeerRegistry::PeerRegistry() {
+    Metrics::instance().add(this, "cluster", [ = ]() {
+        return getMetrics();
+    });
+}
+
+PeerRegistry::~PeerRegistry() {
+    Metrics::instance().remove(this);
+    stop();
+}
+
+PeerRegistry& PeerRegistry::instance() {
+    static PeerRegistry registry;
+    return registry;
+}
+
+bool PeerRegistry::start(uint16_t port, const std::string& peers) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_socket != -1) {
+        return true;
+    }
+
+    int fd = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+    if(fd == -1) {
+        ERRORLOG("cluster: unable to create socket (errno=%d: %s)", errno, strerror(errno));
+        return false;
+    }
+
+    // accept IPv4 announcements too
+    int off = 0;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    struct sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        ERRORLOG("cluster: unable to bind port %u (errno=%d: %s)", port, errno, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    // resolve the peers
+    std::stringstream list(peers);
+    std::string peer;
+
+    while(std::getline(list, peer, ',')) {
+        peer.erase(0, peer.find_first_not_of(" \t"));
+        peer.erase(peer.find_last_not_of(" \t") + 1);
+
+        if(peer.empty()) {
+            continue;
+        }
+
+        std::string host = peer;
+        std::string service = std::to_string(port);
+        size_t colon = peer.rfind(':');
+
+        if(colon != std::string::npos && peer.find(':') == colon) {
+            host = peer.substr(0, colon);
+            service = peer.substr(colon + 1);
+        }
+
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET6;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_V4MAPPED;
+
+        struct addrinfo* result = NULL;
+        int rc = getaddrinfo(host.c_str(), service.c_str(), &hints, &result);
+
+        if(rc != 0 || result == NULL) {
+            ERRORLOG("cluster: unable to resolve peer '%s' (%s)", peer.c_str(), gai_strerror(rc));
+            continue;
+        }
+
+        struct sockaddr_storage address;
+        memset(&address, 0, sizeof(address));
+        memcpy(&address, result->ai_addr, result->ai_addrlen);
+
+        m_peerAddresses.push_back(address);
+        m_peerAddressLengths.push_back(result->ai_addrlen);
+        freeaddrinfo(result);
+
+        INFOLOG("cluster: peer %s", peer.c_str());
+    }
+
+    char name[256];
+
+    if(gethostname(name, sizeof(name)) != 0) {
+        strcpy(name, "vdr");
+    }
+
+    name[sizeof(name) - 1] = 0;
+
+    // node names are sent as one token
+    for(char* p = name; *p != 0; p++) {
+        if(*p == ' ') {
+            *p = '_';
+        }
+    }
+
+    m_name = name;
+    m_nodeId = std::mt19937_64(std::random_device()())();
+    m_socket = fd;
+
+    INFOLOG("cluster: node '%s' listening on port %u", m_name.c_str(), port);
+    return true;
+}
+
+void PeerRegistry::stop() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_socket == -1) {
+        return;
+    }
+
+    ::close(m_socket);
+    m_socket = -1;
+
+    m_peerAddresses.clear();
+    m_peerAddressLengths.clear();
+    m_peers.clear();
+}
+
+void PeerRegistry::setClientCount(int count) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_clients = count;
+}
+
+void PeerRegistry::update() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_socket == -1) {
+        return;
+    }
+
+    receive();
+    expire();
+    announce();
+}
+
+void PeerRegistry::announce() {
+    int devices = 0;
+    int freeDevices = 0;
+
+    for(int i = 0; i < cDevice::NumDevices(); i++) {
+        cDevice* device = cDevice::GetDevice(i);
+
+        // tuners only (skip output devices)
+        if(device == NULL || device->NumProvidedSystems() == 0) {
+            continue;
+        }
+
+        devices++;
+
+        if(!device->Receiving()) {
+            freeDevices++;
+        }
+    }
+
+    char header[512];
+    snprintf(header, sizeof(header), "%s %i %016llx %u %i %i %i %i %s ",
+             PEER_MAGIC,
+             PEER_PROTOCOL_VERSION,
+             (unsigned long long)m_nodeId,
+             RoboTVServerConfig::instance().listenPort,
+             devices,
+             freeDevices,
+             m_clients,
+             TimeShiftFilePool::freeFiles(),
+             m_name.c_str());
+
+    std::string message = header;
+    char uid[16];
+
+    for(uint32_t channelUid : LiveHub::channels()) {
+        if(message.size() + sizeof(uid) > PEER_MAX_DATAGRAM) {
+            break;
+        }
+
+        snprintf(uid, sizeof(uid), "%08x,", channelUid);
+        message += uid;
+    }
+
+    for(size_t i = 0; i < m_peerAddresses.size(); i++) {
+        if(sendto(m_socket, message.c_str(), message.size(), 0, (struct sockaddr*)&m_peerAddresses[i], m_peerAddressLengths[i]) == -1) {
+            DEBUGLOG("cluster: unable to send announcement (errno=%d: %s)", errno, strerror(errno));
+            continue;
+        }
+
+        m_announcements++;
+    }
+}
+
+void PeerRegistry::receive() {
+    char buffer[PEER_MAX_DATAGRAM + 1];
+
+    for(;;) {
+        struct sockaddr_storage address;
+        socklen_t addressLength = sizeof(address);
+
+        ssize_t length = recvfrom(m_socket, buffer, PEER_MAX_DATAGRAM, 0, (struct sockaddr*)&address, &addressLength);
+
+        if(length <= 0) {
+            return;
+        }
+
+        // only the configured peers may announce
+        if(!isConfiguredPeer(address)) {
+            m_rejected++;
+            continue;
+        }
+
+        buffer[length] = 0;
+
+        char magic[16];
+        char name[256];
+        int version = 0;
+        unsigned long long nodeId = 0;
+        Peer peer;
+        int offset = 0;
+
+        if(sscanf(buffer, "%15s %i %llx %i %i %i %i %i %255s %n",
+                  magic, &version, &nodeId, &peer.port, &peer.devices, &peer.freeDevices,
+                  &peer.clients, &peer.timeShiftFiles, name, &offset) < 9 || offset == 0) {
+            continue;
+        }
+
+        if(strcmp(magic, PEER_MAGIC) != 0 || version != PEER_PROTOCOL_VERSION || nodeId == m_nodeId) {
+            continue;
+        }
+
+        // channel uids
+        char* p = buffer + offset;
+
+        while(*p != 0) {
+            char* end = NULL;
+            uint32_t channelUid = strtoul(p, &end, 16);
+
+            if(end == p) {
+                break;
+            }
+
+            peer.channels.insert(channelUid);
+            p = (*end == ',') ? end + 1 : end;
+        }
+
+        // redirects use the source address of the announcement
+        char host[INET6_ADDRSTRLEN];
+        struct sockaddr_in6* addr6 = (struct sockaddr_in6*)&address;
+
+        if(IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr)) {
+            inet_ntop(AF_INET, &addr6->sin6_addr.s6_addr[12], host, sizeof(host));
+        }
+        else {
+            inet_ntop(AF_INET6, &addr6->sin6_addr, host, sizeof(host));
+        }
+
+        if(m_peers.find(nodeId) == m_peers.end()) {
+            INFOLOG("cluster: peer '%s' (%s:%i) joined", name, host, peer.port);
+        }
+
+        peer.name = name;
+        peer.host = host;
+        peer.lastSeen = std::chrono::steady_clock::now();
+        peer.address = address;
+
+        m_peers[nodeId] = peer;
+        m_received++;
+    }
+}
+
+bool PeerRegistry::isConfiguredPeer(const struct sockaddr_storage& address) const {
+    const struct sockaddr_in6* source = (const struct sockaddr_in6*)&address;
+
+    if(source->sin6_family != AF_INET6) {
+        return false;
+    }
+
+    // the peers are resolved as IPv6 (IPv4 mapped) addresses
+    for(auto& peer : m_peerAddresses) {
+        const struct sockaddr_in6* configured = (const struct sockaddr_in6*)&peer;
+
+        if(memcmp(&configured->sin6_addr, &source->sin6_addr, sizeof(struct in6_addr)) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PeerRegistry::expire() {
+    auto now = std::chrono::steady_clock::now();
+
+    for(auto i = m_peers.begin(); i != m_peers.end();) {
+        if(now - i->second.lastSeen < std::chrono::milliseconds(PEER_TIMEOUT_MS)) {
+            i++;
+            continue;
+        }
+
+        INFOLOG("cluster: peer '%s' left", i->second.name.c_str());
+        i = m_peers.erase(i);
+    }
+}
+
+bool PeerRegistry::findRedirect(const cChannel* channel, int priority, std::string& host, int& port) {
+    if(m_socket == -1) {
+        return false;
+    }
+
+    uint32_t channelUid = createChannelUid(channel);
+
+    // the channel is already received locally
+    if(LiveHub::find(channelUid) != NULL) {
+        return false;
+    }
+
+    // peers with a free tuner only if the local tuners are busy
+    bool saturated = (cDevice::GetDevice(channel, priority, false, true) == NULL);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Peer* target = selectPeer(channelUid, saturated);
+
+    if(target == NULL) {
+        return false;
+    }
+
+    host = target->host;
+    port = target->port;
+    m_redirects++;
+
+    INFOLOG("cluster: redirecting channel %s to '%s' (%s:%i)", channel->Name(), target->name.c_str(), host.c_str(), port);
+    return true;
+}
+
+bool PeerRegistry::findSource(uint32_t channelUid, std::string& host, int& port) {
+    if(m_socket == -1) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Peer* source = selectPeer(channelUid, true);
+
+    if(source == NULL) {
+        return false;
+    }
+
+    host = source->host;
+    port = source->port;
+    return true;
+}
+
+const PeerRegistry::Peer* PeerRegistry::selectPeer(uint32_t channelUid, bool tuner) {
+    const Peer* result = NULL;
+    bool resultCarries = false;
+
+    // prefer a peer receiving the channel, otherwise the peer with most free tuners
+    for(auto& i : m_peers) {
+        const Peer& peer = i.second;
+
+        // streams are relayed from (and clients sent to) configured peers only
+        if(!isConfiguredPeer(peer.address)) {
+            continue;
+        }
+
+        if(peer.timeShiftFiles == 0) {
+            continue;
+        }
+
+        bool carries = (peer.channels.find(channelUid) != peer.channels.end());
+
+        if(!carries && (!tuner || peer.freeDevices == 0)) {
+            continue;
+        }
+
+        if(result == NULL || (carries && !resultCarries) || (carries == resultCarries && peer.freeDevices > result->freeDevices)) {
+            result = &peer;
+            resultCarries = carries;
+        }
+    }
+
+    return result;
+}
+
+std::vector<PeerRegistry::Peer> PeerRegistry::getPeers() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<Peer> peers;
+
+    for(auto& i : m_peers) {
+        peers.push_back(i.second);
+    }
+
+    return peers;
+}
+
+nlohmann::json PeerRegistry::getMetrics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    nlohmann::json peers = nlohmann::json::array();
+
+    for(auto& i : m_peers) {
+        const Peer& peer = i.second;
+
+        peers.push_back({
+            {"name", peer.name},
+            {"host", peer.host},
+            {"port", peer.port},
+            {"devices", peer.devices},
+            {"freeDevices", peer.freeDevices},
+            {"clients", peer.clients},
+            {"timeShiftFiles", peer.timeShiftFiles},
+            {"channels", peer.channels.size()}
+        });
+    }
+
+    return {
+        {"enabled", m_socket != -1},
+        {"node", m_name},
+        {"announcements", m_announcements},
+        {"received", m_received},
+        {"rejected", m_rejected},
+        {"redirects", m_redirects},
+        {"peers", peers}
+    };
+}
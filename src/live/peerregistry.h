@@ -0,0 +1,165 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_PEERREGISTRY_H
+#define ROBOTV_PEERREGISTRY_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "tools/metrics.h"
+
+class cChannel;
+
+/**
+ * Registry of the other roboTV servers of a cluster.
+ * Every server announces its load (tuners, received channels, timeshift
+ * budget) to the configured peers with small UDP datagrams and collects
+ * their announcements (datagrams of other hosts are dropped). Clients supporting redirects are sent to a peer
+ * if it already receives the requested channel or if no local tuner is
+ * available for it. Peers are dropped if they haven't announced for a while.
+ * Enabled with ClusterPort / ClusterPeers in robotv.conf.
+ */
+class PeerRegistry {
+public:
+
+    struct Peer {
+        std::string name;
+        std::string host;
+        int port = 0;
+        int devices = 0;
+        int freeDevices = 0;
+        int clients = 0;
+        /** ring files left in the timeshift budget (-1 - unlimited) */
+        int timeShiftFiles = -1;
+        std::set<uint32_t> channels;
+        std::chrono::steady_clock::time_point lastSeen;
+        /** source address of the announcements */
+        struct sockaddr_storage address = {};
+    };
+
+    static PeerRegistry& instance();
+
+    /** Start the registry.
+     @param port UDP port of the announcements
+     @param peers comma separated list of peers (host[:port])
+     @return true on success
+     */
+    bool start(uint16_t port, const std::string& peers);
+
+    void stop();
+
+    bool isEnabled() const {
+        return (m_socket != -1);
+    }
+
+    /** Set the number of connected clients (announced to the peers) */
+    void setClientCount(int count);
+
+    /** Announce the local status and collect the peer announcements (scheduler task) */
+    void update();
+
+    /** Find a peer a client should be redirected to.
+     @param channel requested channel
+     @param priority priority of the stream
+     @param host set to the address of the peer
+     @param port set to the roboTV port of the peer
+     @return true if the client should be redirected
+     */
+    bool findRedirect(const cChannel* channel, int priority, std::string& host, int& port);
+
+    /** Find a peer a channel can be relayed from.
+     Peers receiving the channel are preferred over peers with a free tuner.
+     @param channelUid channel to relay
+     @param host set to the address of the peer
+     @param port set to the roboTV port of the peer
+     @return true if a peer has been found
+     */
+    bool findSource(uint32_t channelUid, std::string& host, int& port);
+
+    /** Get the active peers */
+    std::vector<Peer> getPeers();
+
+protected:
+
+    PeerRegistry();
+
+    virtual ~PeerRegistry();
+
+    nlohmann::json getMetrics();
+
+private:
+
+    void announce();
+
+    void receive();
+
+    void expire();
+
+    /** Check if a datagram has been sent by one of the configured peers */
+    bool isConfiguredPeer(const struct sockaddr_storage& address) const;
+
+    /** Select the peer for a channel (m_mutex must be held).
+     Only configured peers are selected.
+     @param channelUid requested channel
+     @param tuner accept peers with a free tuner (not receiving the channel)
+     @return the peer or NULL
+     */
+    const Peer* selectPeer(uint32_t channelUid, bool tuner);
+
+    int m_socket = -1;
+
+    uint64_t m_nodeId = 0;
+
+    std::string m_name;
+
+    int m_clients = 0;
+
+    std::vector<struct sockaddr_storage> m_peerAddresses;
+
+    std::vector<socklen_t> m_peerAddressLengths;
+
+    /** active peers by node id */
+    std::map<uint64_t, Peer> m_peers;
+
+    std::mutex m_mutex;
+
+    uint64_t m_announcements = 0;
+
+    uint64_t m_received = 0;
+
+    /** datagrams of hosts that aren't configured as peers */
+    uint64_t m_rejected = 0;
+
+    uint64_t m_redirects = 0;
+
+};
+
+#endif // ROBOTV_PEERREGISTRY_H
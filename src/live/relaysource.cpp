@@ -0,0 +1,299 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <chrono>
+
+#include "relaysource.h"
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "robotv/robotvcommand.h"
+
+// timeout for connecting and for the responses of the peer
+#define RELAY_TIMEOUT_MS 3000
+
+// delay between stream requests while the peer has no data
+#define RELAY_IDLE_MS 20
+
+// delay before reconnecting to the peer
+#define RELAY_RECONNECT_MS 2000
+
+#define RELAY_PRIORITY 50
+
+bool RelaySource::m_enabled = false;
+
+RelaySource::RelaySource(const std::string& host, int port, uint32_t channelUid) : m_host(host), m_port(port), m_channelUid(channelUid), m_running(false), m_bytesReceived(0), m_reconnects(0) {
+    Metrics::instance().add(this, "relays", [ = ]() {
+        return getMetrics();
+    });
+}
+
+RelaySource::~RelaySource() {
+    Metrics::instance().remove(this);
+    close();
+}
+
+void RelaySource::setEnabled(bool enabled) {
+    m_enabled = enabled;
+}
+
+bool RelaySource::open(Sink sink) {
+    m_sink = sink;
+
+    if(!connectPeer()) {
+        return false;
+    }
+
+    INFOLOG("relaying channel %08x from %s:%i", m_channelUid, m_host.c_str(), m_port);
+
+    m_running = true;
+    m_thread = new std::thread([ = ]() {
+        run();
+    });
+
+    return true;
+}
+
+void RelaySource::close() {
+    m_running = false;
+
+    if(m_thread != NULL) {
+        m_thread->join();
+        delete m_thread;
+        m_thread = NULL;
+    }
+
+    disconnectPeer();
+}
+
+bool RelaySource::connectPeer() {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* result = NULL;
+    std::string service = std::to_string(m_port);
+
+    if(getaddrinfo(m_host.c_str(), service.c_str(), &hints, &result) != 0 || result == NULL) {
+        ERRORLOG("relay: unable to resolve %s", m_host.c_str());
+        return false;
+    }
+
+    m_socket = socket(result->ai_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+    if(m_socket == -1) {
+        freeaddrinfo(result);
+        return false;
+    }
+
+    int rc = ::connect(m_socket, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+
+    if(rc == -1 && errno == EINPROGRESS) {
+        struct pollfd p;
+        p.fd = m_socket;
+        p.events = POLLOUT;
+
+        int error = 0;
+        socklen_t length = sizeof(error);
+
+        if(poll(&p, 1, RELAY_TIMEOUT_MS) == 1 && getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+            rc = 0;
+        }
+    }
+
+    if(rc != 0) {
+        ERRORLOG("relay: unable to connect to %s:%i", m_host.c_str(), m_port);
+        disconnectPeer();
+        return false;
+    }
+
+    int on = 1;
+    setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    // login (no compression, no status messages, pull-mode)
+    MsgPacket login(ROBOTV_LOGIN, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+    login.setProtocolVersion(ROBOTV_PROTOCOLVERSION);
+    login.put_U8(0);
+    login.put_String("roboTV relay");
+    login.put_U8(0);
+
+    MsgPacket* response = request(&login);
+
+    if(response == NULL) {
+        ERRORLOG("relay: login at %s:%i failed", m_host.c_str(), m_port);
+        disconnectPeer();
+        return false;
+    }
+
+    delete response;
+
+    // open the passthrough stream
+    MsgPacket open(ROBOTV_CHANNELSTREAM_OPEN, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+    open.setProtocolVersion(ROBOTV_PROTOCOLVERSION);
+    open.put_U32(m_channelUid);
+    open.put_S32(RELAY_PRIORITY);
+    open.put_U8(1);
+    open.put_String("");
+    open.put_U8(0);
+    open.put_U32(0);
+    open.put_U32(0);
+    open.put_U32(0);
+    open.put_U8(1);
+
+    response = request(&open);
+    uint32_t status = (response != NULL) ? response->get_U32() : ROBOTV_RET_ERROR;
+    delete response;
+
+    if(status != ROBOTV_RET_OK) {
+        ERRORLOG("relay: %s:%i can't stream channel %08x (status: %u)", m_host.c_str(), m_port, m_channelUid, status);
+        disconnectPeer();
+        return false;
+    }
+
+    return true;
+}
+
+void RelaySource::disconnectPeer() {
+    if(m_socket == -1) {
+        return;
+    }
+
+    ::close(m_socket);
+    m_socket = -1;
+}
+
+MsgPacket* RelaySource::request(MsgPacket* request) {
+    if(!request->write(m_socket, RELAY_TIMEOUT_MS)) {
+        return NULL;
+    }
+
+    for(;;) {
+        bool closed = false;
+        MsgPacket* response = MsgPacket::read(m_socket, closed, RELAY_TIMEOUT_MS);
+
+        if(response == NULL) {
+            return NULL;
+        }
+
+        if(response->getType() == ROBOTV_CHANNEL_REQUEST_RESPONSE && response->getUID() == request->getUID()) {
+            return response;
+        }
+
+        delete response;
+    }
+}
+
+int RelaySource::forward(MsgPacket* response) {
+    // no data available
+    if(response->eop()) {
+        return 0;
+    }
+
+    // timeshift start and position
+    response->get_S64();
+    response->get_S64();
+
+    int count = 0;
+
+    while(!response->eop()) {
+        uint16_t msgId = response->get_U16();
+        response->get_U16();
+
+        if(msgId != ROBOTV_STREAM_TSPKT) {
+            break;
+        }
+
+        uint32_t length = response->get_U32();
+        uint8_t* data = response->consume(length);
+
+        if(data == NULL) {
+            break;
+        }
+
+        // wallclock time of the peer
+        response->get_S64();
+
+        m_bytesReceived += length;
+        m_sink(data, length);
+        count++;
+    }
+
+    return count;
+}
+
+void RelaySource::run() {
+    while(m_running) {
+        if(m_socket == -1) {
+            for(int i = 0; i < RELAY_RECONNECT_MS / 100 && m_running; i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+
+            if(!m_running || !connectPeer()) {
+                continue;
+            }
+
+            m_reconnects++;
+        }
+
+        MsgPacket packet(ROBOTV_CHANNELSTREAM_REQUEST, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+        packet.setProtocolVersion(ROBOTV_PROTOCOLVERSION);
+        packet.put_U8(0);
+
+        MsgPacket* response = request(&packet);
+
+        if(response == NULL) {
+            ERRORLOG("relay: lost connection to %s:%i", m_host.c_str(), m_port);
+            disconnectPeer();
+            continue;
+        }
+
+        int count = forward(response);
+        delete response;
+
+        if(count == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(RELAY_IDLE_MS));
+        }
+    }
+}
+
+nlohmann::json RelaySource::getMetrics() {
+    return {
+        {"channelUid", m_channelUid},
+        {"peer", m_host + ":" + std::to_string(m_port)},
+        {"connected", m_socket != -1},
+        {"bytesReceived", m_bytesReceived.load()},
+        {"reconnects", m_reconnects.load()}
+    };
+}
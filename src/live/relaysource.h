@@ -0,0 +1,117 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_RELAYSOURCE_H
+#define ROBOTV_RELAYSOURCE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "tools/metrics.h"
+
+class MsgPacket;
+
+/**
+ * Live stream relayed from a peer roboTV server.
+ * Opens a passthrough stream (PID-filtered TS) of a channel on the peer
+ * and feeds the received TS packets into the hub of the channel, like
+ * a local receiver. The hub demuxes and timeshifts the channel for any
+ * number of local clients, so a channel is pulled only once over the
+ * link to the peer. Lost connections are reestablished.
+ * Used by hubs without a free local tuner if ClusterRelay is enabled.
+ */
+class RelaySource {
+public:
+
+    typedef std::function<void(const uint8_t* data, int length)> Sink;
+
+    /**
+     @param host address of the peer
+     @param port roboTV port of the peer
+     @param channelUid channel to relay
+     */
+    RelaySource(const std::string& host, int port, uint32_t channelUid);
+
+    virtual ~RelaySource();
+
+    static void setEnabled(bool enabled);
+
+    static bool isEnabled() {
+        return m_enabled;
+    }
+
+    /** Open the stream on the peer and start relaying.
+     @param sink receiver of the TS packets (called from the relay thread)
+     @return false if the peer can't stream the channel
+     */
+    bool open(Sink sink);
+
+    void close();
+
+protected:
+
+    bool connectPeer();
+
+    void disconnectPeer();
+
+    /** Send a request and wait for its response (status messages are skipped) */
+    MsgPacket* request(MsgPacket* request);
+
+    /** Forward the TS packets of a stream response.
+     @return number of forwarded TS batches
+     */
+    int forward(MsgPacket* response);
+
+    void run();
+
+    nlohmann::json getMetrics();
+
+private:
+
+    std::string m_host;
+
+    int m_port;
+
+    uint32_t m_channelUid;
+
+    int m_socket = -1;
+
+    Sink m_sink;
+
+    std::thread* m_thread = NULL;
+
+    std::atomic<bool> m_running;
+
+    std::atomic<uint64_t> m_bytesReceived;
+
+    std::atomic<uint64_t> m_reconnects;
+
+    static bool m_enabled;
+
+};
+
+#endif // ROBOTV_RELAYSOURCE_H
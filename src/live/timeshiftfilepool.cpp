@@ -0,0 +1,261 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "config/config.h"
+#include "timeshiftfilepool.h"
+
+#define POOL_FILE_PREFIX "robotv-timeshift-"
+
+std::string TimeShiftFilePool::m_dir = "/video";
+uint64_t TimeShiftFilePool::m_fileSize = 0;
+int TimeShiftFilePool::m_maxIdleFiles = 4;
+int TimeShiftFilePool::m_nextIndex = 0;
+int TimeShiftFilePool::m_filesInUse = 0;
+uint64_t TimeShiftFilePool::m_diskBudget = 0;
+uint64_t TimeShiftFilePool::m_bandwidthBudget = 0;
+uint64_t TimeShiftFilePool::m_writeRate = 0;
+uint64_t TimeShiftFilePool::m_windowBytes = 0;
+std::chrono::steady_clock::time_point TimeShiftFilePool::m_windowStart = std::chrono::steady_clock::now();
+uint64_t TimeShiftFilePool::m_refused = 0;
+std::list<std::string> TimeShiftFilePool::m_idleFiles;
+std::mutex TimeShiftFilePool::m_mutex;
+
+void TimeShiftFilePool::setup(const std::string& dir, uint64_t fileSize) {
+    static std::once_flag registered;
+
+    std::call_once(registered, []() {
+        Metrics::instance().add(&m_idleFiles, "timeshift", []() {
+            return getMetrics();
+        });
+    });
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_dir = dir;
+    m_fileSize = fileSize;
+    m_nextIndex = 0;
+    m_idleFiles.clear();
+
+    // idle files must fit into the disk budget
+    int maxIdleFiles = m_maxIdleFiles;
+
+    if(m_diskBudget > 0 && m_fileSize > 0) {
+        maxIdleFiles = std::min<uint64_t>(maxIdleFiles, m_diskBudget / m_fileSize);
+    }
+
+    DIR* d = opendir(m_dir.c_str());
+
+    if(d == NULL) {
+        return;
+    }
+
+    struct dirent* entry = NULL;
+
+    while((entry = readdir(d)) != NULL) {
+        if(strncmp(entry->d_name, POOL_FILE_PREFIX, strlen(POOL_FILE_PREFIX)) != 0) {
+            continue;
+        }
+
+        std::string path = m_dir + "/" + entry->d_name;
+        int index = atoi(entry->d_name + strlen(POOL_FILE_PREFIX));
+        struct stat st;
+
+        // files of another size (or beyond the idle limit) are dropped
+        if(stat(path.c_str(), &st) != 0 || (uint64_t)st.st_size != m_fileSize || (int)m_idleFiles.size() >= maxIdleFiles) {
+            INFOLOG("Removing old time-shift storage: %s", entry->d_name);
+            unlink(path.c_str());
+            continue;
+        }
+
+        m_idleFiles.push_back(path);
+        m_nextIndex = std::max(m_nextIndex, index + 1);
+    }
+
+    closedir(d);
+
+    INFOLOG("timeshift file pool: %lu preallocated files in %s", (unsigned long)m_idleFiles.size(), m_dir.c_str());
+}
+
+void TimeShiftFilePool::setMaxIdleFiles(int count) {
+    m_maxIdleFiles = std::max(count, 0);
+}
+
+void TimeShiftFilePool::setDiskBudget(uint64_t bytes) {
+    m_diskBudget = bytes;
+    INFOLOG("timeshift disk budget: %lu bytes", (unsigned long)m_diskBudget);
+}
+
+void TimeShiftFilePool::setBandwidthBudget(uint64_t bytesPerSecond) {
+    m_bandwidthBudget = bytesPerSecond;
+    INFOLOG("timeshift bandwidth budget: %lu bytes/s", (unsigned long)m_bandwidthBudget);
+}
+
+std::string TimeShiftFilePool::acquire() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!admit()) {
+        m_refused++;
+        return "";
+    }
+
+    if(!m_idleFiles.empty()) {
+        std::string path = m_idleFiles.front();
+        m_idleFiles.pop_front();
+        m_filesInUse++;
+        DEBUGLOG("reusing timeshift file: %s", path.c_str());
+        return path;
+    }
+
+    std::string path = fileName(m_nextIndex++);
+
+    if(!allocate(path)) {
+        return "";
+    }
+
+    m_filesInUse++;
+    INFOLOG("allocated timeshift file: %s (%lu bytes)", path.c_str(), (unsigned long)m_fileSize);
+    return path;
+}
+
+int TimeShiftFilePool::freeFiles() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_diskBudget == 0 || m_fileSize == 0) {
+        return -1;
+    }
+
+    int files = (int)(m_diskBudget / m_fileSize) - m_filesInUse;
+    return std::max(files, 0);
+}
+
+bool TimeShiftFilePool::admit() {
+    updateWriteRate();
+
+    if(m_bandwidthBudget > 0 && m_writeRate > m_bandwidthBudget) {
+        INFOLOG("timeshift bandwidth budget exceeded (%lu bytes/s) - session without timeshift", (unsigned long)m_writeRate);
+        return false;
+    }
+
+    // idle files are reused (they are already accounted)
+    if(m_diskBudget == 0 || !m_idleFiles.empty()) {
+        return true;
+    }
+
+    if((m_filesInUse + 1) * m_fileSize > m_diskBudget) {
+        INFOLOG("timeshift disk budget exhausted (%i files in use) - session without timeshift", m_filesInUse);
+        return false;
+    }
+
+    return true;
+}
+
+void TimeShiftFilePool::release(const std::string& path) {
+    if(path.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_filesInUse--;
+
+    if((int)m_idleFiles.size() >= m_maxIdleFiles) {
+        unlink(path.c_str());
+        return;
+    }
+
+    m_idleFiles.push_back(path);
+}
+
+void TimeShiftFilePool::account(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_windowBytes += bytes;
+    updateWriteRate();
+}
+
+void TimeShiftFilePool::updateWriteRate() {
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_windowStart).count();
+
+    if(elapsed < 1000) {
+        return;
+    }
+
+    m_writeRate = m_windowBytes * 1000 / elapsed;
+    m_windowBytes = 0;
+    m_windowStart = now;
+}
+
+bool TimeShiftFilePool::allocate(const std::string& path) {
+    int fd = open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+
+    if(fd == -1) {
+        ERRORLOG("Failed to create timeshift file %s !", path.c_str());
+        return false;
+    }
+
+    // reserve all blocks now, writes into the ring never allocate
+    int rc = (m_fileSize > 0) ? posix_fallocate(fd, 0, m_fileSize) : 0;
+    ::close(fd);
+
+    if(rc != 0) {
+        ERRORLOG("Unable to preallocate timeshift file %s: %s", path.c_str(), strerror(rc));
+        unlink(path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+std::string TimeShiftFilePool::fileName(int index) {
+    char name[64];
+    snprintf(name, sizeof(name), POOL_FILE_PREFIX "%04d.data", index);
+    return m_dir + "/" + name;
+}
+
+nlohmann::json TimeShiftFilePool::getMetrics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    updateWriteRate();
+
+    return {
+        {"fileSize", m_fileSize},
+        {"filesInUse", m_filesInUse},
+        {"idleFiles", m_idleFiles.size()},
+        {"diskUsage", (m_filesInUse + m_idleFiles.size()) * m_fileSize},
+        {"diskBudget", m_diskBudget},
+        {"writeRate", m_writeRate},
+        {"bandwidthBudget", m_bandwidthBudget},
+        {"refused", m_refused}
+    };
+}
@@ -0,0 +1,124 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_TIMESHIFTFILEPOOL_H
+#define ROBOTV_TIMESHIFTFILEPOOL_H
+
+#include <stdint.h>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+
+#include "tools/metrics.h"
+
+/**
+ * Pool of preallocated timeshift ring files.
+ * All files have the same (fixed) size and are allocated once, so writing
+ * into the ring never extends a file or allocates blocks. Files are handed
+ * out to the timeshift stores and recycled when a store terminates. Idle
+ * files survive a restart and are picked up again by setup().
+ *
+ * The pool also enforces the global timeshift budget of all clients (disk
+ * space and write bandwidth). A store which doesn't get a file runs
+ * without timeshift (live only). Utilisation is exported (group
+ * "timeshift") by the SVDRP command STAT.
+ */
+class TimeShiftFilePool {
+public:
+
+    /** Initialize the pool.
+     Removes pool files with a different size, all other files are reused.
+     @param dir timeshift directory
+     @param fileSize size of a ring file
+     */
+    static void setup(const std::string& dir, uint64_t fileSize);
+
+    /** Set the number of idle files kept for reuse (default: 4) */
+    static void setMaxIdleFiles(int count);
+
+    /** Set the disk space used by all ring files (0 - unlimited) */
+    static void setDiskBudget(uint64_t bytes);
+
+    /** Set the write bandwidth of all stores (0 - unlimited).
+     New files are refused while the budget is exceeded.
+     @param bytesPerSecond bandwidth limit
+     */
+    static void setBandwidthBudget(uint64_t bytesPerSecond);
+
+    /** Get a preallocated ring file.
+     @return path of the file (empty on failure or if the budget is exhausted)
+     */
+    static std::string acquire();
+
+    /** Return a ring file to the pool */
+    static void release(const std::string& path);
+
+    /** Account bytes written into a ring file */
+    static void account(uint64_t bytes);
+
+    /** Number of further ring files fitting into the disk budget (-1 - unlimited) */
+    static int freeFiles();
+
+private:
+
+    static bool allocate(const std::string& path);
+
+    static bool admit();
+
+    static void updateWriteRate();
+
+    static nlohmann::json getMetrics();
+
+    static std::string fileName(int index);
+
+    static std::string m_dir;
+
+    static uint64_t m_fileSize;
+
+    static int m_maxIdleFiles;
+
+    static int m_nextIndex;
+
+    static int m_filesInUse;
+
+    static uint64_t m_diskBudget;
+
+    static uint64_t m_bandwidthBudget;
+
+    static uint64_t m_writeRate;
+
+    static uint64_t m_windowBytes;
+
+    static std::chrono::steady_clock::time_point m_windowStart;
+
+    static uint64_t m_refused;
+
+    static std::list<std::string> m_idleFiles;
+
+    static std::mutex m_mutex;
+
+};
+
+#endif // ROBOTV_TIMESHIFTFILEPOOL_H
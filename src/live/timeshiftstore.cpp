@@ -0,0 +1,1284 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <algorithm>
+
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "timeshiftstore.h"
+#include "timeshiftfilepool.h"
+#include "tools/cpuplacement.h"
+#include "tools/ioengine.h"
+#include "tools/time.h"
+#include "latencytrace.h"
+
+std::string TimeShiftStore::m_timeShiftDir = "/video";
+uint64_t TimeShiftStore::m_bufferSize = 1024 * 1024 * 1024;
+TimeShiftStore::StorageMode TimeShiftStore::m_storageMode = TimeShiftStore::smFile;
+uint64_t TimeShiftStore::m_memorySize = 0;
+std::map<std::pair<uint32_t, bool>, TimeShiftStore*> TimeShiftStore::m_stores;
+std::mutex TimeShiftStore::m_storesMutex;
+
+TimeShiftStore::TimeShiftStore(uint32_t channelUid, bool passthrough) : m_channelUid(channelUid), m_passthrough(passthrough), m_refCount(0), m_writer(NULL), m_writeFd(-1), m_writePosition(0), m_map(NULL), m_mapSize(0), m_writerQueue(WriterRingSize) {
+    cleanup();
+
+    m_hasWrapped = false;
+    m_writerRunning = true;
+    m_wrapCount = 0;
+    m_indexOffset = 0;
+    m_queueStartTime = std::chrono::milliseconds(0);
+    m_wakeups = 0;
+    m_droppedPackets = 0;
+    m_writerResync = false;
+    m_writerSleeping = false;
+    m_queuePeak = 0;
+    m_syncPosition = 0;
+
+    // serve live packets from memory until a client pauses or seeks
+    // (a store without ring file keeps a small live window in memory)
+    m_memoryUsage = 0;
+    m_memoryLimit = m_storage.empty() ? std::max<uint64_t>(m_memorySize, LiveOnlyMemorySize) : m_memorySize;
+    m_spilled = (m_memoryLimit == 0);
+    m_audioOnly = false;
+    m_indexPts = 0;
+
+    m_writeThread = new std::thread([&]() {
+        std::deque<PacketData> batch;
+
+        while(m_writerRunning) {
+
+            // wait for packets (receivers only take the lock to wake us up)
+            if(m_writerQueue.empty()) {
+                std::unique_lock<std::mutex> lock(m_mutexQueue);
+                m_writerSleeping = true;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                m_queueCondition.wait(lock, [&]() {
+                    return !m_writerRunning || !m_writerQueue.empty();
+                });
+
+                m_writerSleeping = false;
+            }
+
+            // stay on the cores of the channel
+            CpuPlacement::follow(m_channelUid);
+
+            // take over the whole batch at once
+            m_wakeups++;
+            PacketData data;
+
+            while(m_writerQueue.pop(data)) {
+                batch.push_back(data);
+            }
+
+            // receiver -> writer thread hand-off
+            if(LatencyTrace::isEnabled()) {
+                int64_t now = LatencyTrace::now();
+
+                for(auto& data : batch) {
+                    if(data.queueTime != 0) {
+                        LatencyTrace::add(m_channelUid, LatencyTrace::stQueue, now - data.queueTime);
+                    }
+                }
+            }
+
+            if(m_writerRunning) {
+                write(batch);
+            }
+
+            while(!batch.empty()) {
+                delete batch.front().p;
+                batch.pop_front();
+            }
+        }
+    });
+}
+
+TimeShiftStore::~TimeShiftStore() {
+    {
+        std::lock_guard<ProfiledMutex> lock(m_mutexQueue);
+        m_writerRunning = false;
+    }
+
+    m_queueCondition.notify_one();
+    m_writeThread->join();
+
+    for(auto c : m_cursors) {
+        ::close(c->readFd);
+        delete c;
+    }
+
+    close();
+
+    PacketData data;
+
+    while(m_writerQueue.pop(data)) {
+        delete data.p;
+    }
+
+    for(auto& m : m_memory) {
+        delete m.p;
+    }
+
+    for(auto p : m_retired) {
+        delete p;
+    }
+
+    for(auto& l : m_layouts) {
+        delete l.second;
+    }
+
+    delete m_writeThread;
+
+    INFOLOG("timeshift store %08x terminated (writer wakeups: %lu, dropped packets: %lu)",
+            m_channelUid, (unsigned long)m_wakeups, (unsigned long)m_droppedPackets);
+}
+
+TimeShiftStore* TimeShiftStore::acquire(uint32_t channelUid, bool passthrough) {
+    std::lock_guard<std::mutex> lock(m_storesMutex);
+
+    TimeShiftStore* store = NULL;
+    auto i = m_stores.find({channelUid, passthrough});
+
+    if(i != m_stores.end()) {
+        store = i->second;
+        INFOLOG("sharing timeshift store of channel %08x", channelUid);
+    }
+    else {
+        store = new TimeShiftStore(channelUid, passthrough);
+        m_stores[{channelUid, passthrough}] = store;
+    }
+
+    store->m_refCount++;
+    return store;
+}
+
+void TimeShiftStore::release(TimeShiftStore* store) {
+    if(store == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_storesMutex);
+
+        if(--store->m_refCount > 0) {
+            return;
+        }
+
+        m_stores.erase({store->m_channelUid, store->m_passthrough});
+    }
+
+    delete store;
+}
+
+void TimeShiftStore::cleanup() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // preallocated ring file (may contain stale data of a previous store)
+    m_storage = TimeShiftFilePool::acquire();
+
+    if(m_storage.empty()) {
+        INFOLOG("timeshift store %08x without ring file (live only)", m_channelUid);
+        return;
+    }
+
+    DEBUGLOG("timeshift file: %s", m_storage.c_str());
+    m_writeFd = open(m_storage.c_str(), m_storageMode == smMmap ? O_RDWR : O_WRONLY);
+
+    if(m_writeFd == -1) {
+        ERRORLOG("Failed to create timeshift ringbuffer !");
+    }
+
+    m_writePosition = 0;
+
+    if(m_storageMode == smMmap) {
+        createMapping();
+    }
+}
+
+bool TimeShiftStore::createMapping() {
+    // packets may exceed the buffer size before the write position wraps
+    m_mapSize = m_bufferSize + MapHeadroom;
+
+    if(ftruncate(m_writeFd, m_mapSize) == -1) {
+        ERRORLOG("Unable to resize timeshift ringbuffer - falling back to file storage");
+        m_mapSize = 0;
+        return false;
+    }
+
+    void* map = mmap(NULL, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_writeFd, 0);
+
+    if(map == MAP_FAILED) {
+        ERRORLOG("Unable to map timeshift ringbuffer - falling back to file storage");
+        m_mapSize = 0;
+        return false;
+    }
+
+    m_map = (uint8_t*)map;
+    INFOLOG("timeshift ringbuffer mapped (%lu bytes)", (unsigned long)m_mapSize);
+
+    return true;
+}
+
+TimeShiftStore::Cursor* TimeShiftStore::attach() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Cursor* cursor = new Cursor;
+
+    cursor->readFd = m_storage.empty() ? -1 : open(m_storage.c_str(), O_RDONLY);
+    cursor->viewPosition = 0;
+    cursor->viewLength = 0;
+    cursor->memoryLease = false;
+    cursor->memoryPacket = NULL;
+    cursor->onStorage = (m_memoryLimit == 0);
+    cursor->keyFrameHint = 0;
+    cursor->seekTime = 0;
+
+    if(cursor->readFd == -1 && !m_storage.empty()) {
+        ERRORLOG("Failed to open timeshift ringbuffer !");
+    }
+
+    // start at the latest keyframe (or the live edge)
+
+    cursor->memoryReadIndex = m_memory.size();
+
+    for(size_t index = m_memory.size(); index > 0; index--) {
+        if(isKeyFrame(m_memory[index - 1])) {
+            cursor->memoryReadIndex = index - 1;
+            break;
+        }
+    }
+
+    if(!m_indexList.empty()) {
+        seekIndex(cursor, m_indexList.back());
+        cursor->keyFrameHint = m_indexOffset + m_indexList.size();
+    }
+    else {
+        setReadPosition(cursor, m_writePosition);
+        cursor->readWrapCount = m_wrapCount;
+        cursor->wrapped = false;
+    }
+
+    m_cursors.push_back(cursor);
+    return cursor;
+}
+
+void TimeShiftStore::detach(Cursor* cursor) {
+    if(cursor == NULL) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    releaseLease(cursor);
+    m_cursors.remove(cursor);
+    ::close(cursor->readFd);
+    delete cursor;
+}
+
+void TimeShiftStore::setNotify(Cursor* cursor, std::function<void()> notify) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    cursor->notify = notify;
+}
+
+void TimeShiftStore::setAudioOnly(bool on) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_audioOnly == on) {
+        return;
+    }
+
+    m_audioOnly = on;
+
+    if(!on) {
+        return;
+    }
+
+    // a few minutes of radio fit into a small memory ring
+    // (packets already written to the ring file keep being written through)
+    m_memoryLimit = std::max<uint64_t>(m_memoryLimit, AudioOnlyMemorySize);
+
+    if(m_spilled && m_writePosition == 0 && m_indexList.empty()) {
+        m_spilled = false;
+
+        for(auto c : m_cursors) {
+            c->onStorage = false;
+            c->memoryReadIndex = 0;
+        }
+    }
+
+    INFOLOG("timeshift store %08x in audio-only mode", m_channelUid);
+}
+
+bool TimeShiftStore::claimWriter(const void* owner) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_writer == NULL) {
+        m_writer = owner;
+    }
+
+    return (m_writer == owner);
+}
+
+void TimeShiftStore::releaseWriter(const void* owner) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_writer == owner) {
+        m_writer = NULL;
+    }
+}
+
+bool TimeShiftStore::isWriter(const void* owner) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (m_writer == owner);
+}
+
+MsgPacket* TimeShiftStore::read(Cursor* cursor, bool keyFrameMode) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // the previously returned packet view is released now
+    releaseLease(cursor);
+
+    if(!cursor->onStorage) {
+        return readMemory(cursor, keyFrameMode);
+    }
+
+    if(keyFrameMode) {
+        seekNextKeyFrame(cursor);
+    }
+
+    off_t position = cursor->readPosition;
+    MsgPacket* p = internalRead(cursor);
+    releaseCache(cursor);
+
+    // views on the cursor's own read buffer don't need a lease
+    if(p != NULL && p->isView() && m_map != NULL) {
+        cursor->viewPosition = position;
+        cursor->viewLength = p->getPacketLength();
+    }
+
+    return p;
+}
+
+bool TimeShiftStore::checkReadPosition(Cursor* cursor) {
+    // check if read position wrapped
+
+    if(cursor->readPosition >= (off_t)m_bufferSize) {
+        INFOLOG("timeshift: read buffer wrap");
+        setReadPosition(cursor, 0);
+        cursor->readWrapCount++;
+        cursor->wrapped = !cursor->wrapped;
+        INFOLOG("wrapped: %s", cursor->wrapped ? "yes" : "no");
+    }
+
+    // check if read position is still behind write position (if not wrapped))
+    // if not -> skip packet (as we would start reading from the beginning of
+    // the buffer)
+
+    return (cursor->readPosition < m_writePosition || cursor->wrapped);
+}
+
+MsgPacket* TimeShiftStore::internalRead(Cursor* cursor) {
+    if(!checkReadPosition(cursor)) {
+        return NULL;
+    }
+
+    // read packet from mapping / storage
+    MsgPacket* p = NULL;
+
+    if(m_map != NULL) {
+        p = MsgPacket::view(m_map + cursor->readPosition, m_mapSize - cursor->readPosition);
+    }
+    else {
+        // read straight into the cursor's buffer
+        bool closed = false;
+        p = MsgPacket::read(cursor->readFd, cursor->readBuffer, closed, 1000);
+    }
+
+    if(p == NULL) {
+        // resync file offset after a partial read
+        lseek(cursor->readFd, cursor->readPosition, SEEK_SET);
+        return NULL;
+    }
+
+    // the mapped storage isn't checked on read
+    if(m_map != NULL && !p->validatePayloadCheckSum()) {
+        ERRORLOG("timeshift: corrupted packet at position %lld", (long long)cursor->readPosition);
+        cursor->readPosition += p->getPacketLength();
+        delete p;
+        return NULL;
+    }
+
+    cursor->readPosition += p->getPacketLength();
+    return p;
+}
+
+bool TimeShiftStore::skipPacket(Cursor* cursor) {
+    if(!checkReadPosition(cursor)) {
+        return false;
+    }
+
+    // only the header is needed to skip a packet
+    uint32_t length = 0;
+
+    if(m_map != NULL) {
+        MsgPacket* p = MsgPacket::view(m_map + cursor->readPosition, m_mapSize - cursor->readPosition);
+
+        if(p != NULL) {
+            length = p->getPacketLength();
+            delete p;
+        }
+    }
+    else {
+        uint8_t header[MsgPacket::HeaderLength];
+        bool closed = false;
+
+        if(MsgPacket::readHeader(cursor->readFd, header, closed, 1000)) {
+            length = MsgPacket::HeaderLength + MsgPacket::getPayloadLength(header);
+        }
+    }
+
+    if(length == 0) {
+        lseek(cursor->readFd, cursor->readPosition, SEEK_SET);
+        return false;
+    }
+
+    setReadPosition(cursor, cursor->readPosition + length);
+    return true;
+}
+
+void TimeShiftStore::setReadPosition(Cursor* cursor, off_t position) {
+    lseek(cursor->readFd, position, SEEK_SET);
+    cursor->readPosition = position;
+    cursor->dropPosition = position & ~(off_t)(CacheChunkSize - 1);
+}
+
+void TimeShiftStore::queue(MsgPacket* p, StreamInfo::Content content, int64_t pts) {
+    // called from the receiver threads - never block here
+
+    if(!admit(p, content)) {
+        m_droppedPackets++;
+        delete p;
+        return;
+    }
+
+    int64_t queueTime = (LatencyTrace::isEnabled() && content != StreamInfo::scSTREAMINFO) ? LatencyTrace::now() : 0;
+
+    if(!m_writerQueue.push({p, content, pts, std::chrono::milliseconds(0), queueTime, -1, 0})) {
+        if(m_droppedPackets++ == 0) {
+            ERRORLOG("timeshift writer queue full - dropping packets");
+        }
+
+        // a pending resync must survive dropped audio, only referenced frames start one
+        if(content == StreamInfo::scVIDEO && p->getClientID() != StreamInfo::ftBFRAME) {
+            m_writerResync = true;
+        }
+
+        delete p;
+        return;
+    }
+
+    size_t depth = m_writerQueue.size();
+
+    if(depth > m_queuePeak) {
+        m_queuePeak = depth;
+    }
+
+    // wake up the writer
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if(m_writerSleeping) {
+        std::lock_guard<ProfiledMutex> lock(m_mutexQueue);
+        m_queueCondition.notify_one();
+    }
+}
+
+bool TimeShiftStore::admit(MsgPacket* p, StreamInfo::Content content) {
+    // stream changes are never dropped
+    if(content == StreamInfo::scSTREAMINFO) {
+        return true;
+    }
+
+    bool video = (content == StreamInfo::scVIDEO);
+    bool keyFrame = (video && p->getClientID() == StreamInfo::ftIFRAME);
+
+    // reference frames have been dropped -> resync at the next keyframe
+    if(m_writerResync && video) {
+        if(!keyFrame) {
+            return false;
+        }
+
+        m_writerResync = false;
+    }
+
+    // the slots above MaxWriterQueue are kept for keyframes and stream changes
+    if(m_writerQueue.size() < MaxWriterQueue || keyFrame) {
+        return true;
+    }
+
+    if(m_droppedPackets == 0) {
+        ERRORLOG("timeshift writer queue full - dropping packets");
+    }
+
+    // B-frames aren't referenced by other frames, any other frame is
+    if(video && p->getClientID() != StreamInfo::ftBFRAME) {
+        m_writerResync = true;
+    }
+
+    return false;
+}
+
+size_t TimeShiftStore::getQueueDepth() {
+    return m_writerQueue.size();
+}
+
+size_t TimeShiftStore::getQueueCapacity() {
+    return m_writerQueue.capacity();
+}
+
+size_t TimeShiftStore::getQueuePeak() {
+    return m_queuePeak;
+}
+
+uint64_t TimeShiftStore::getWriterWakeups() {
+    return m_wakeups;
+}
+
+uint64_t TimeShiftStore::getDroppedPackets() {
+    return m_droppedPackets;
+}
+
+bool TimeShiftStore::write(std::deque<PacketData>& batch) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool result = true;
+
+    storeLayouts(batch);
+
+    // once spilled, packets are written through to the ring file
+    // (the memory window keeps serving the live readers)
+    if(m_spilled) {
+        result = internalWrite(batch);
+    }
+
+    if(m_memoryLimit > 0) {
+        storeMemory(batch);
+    }
+
+    // new data available for the readers
+    for(auto c : m_cursors) {
+        if(c->notify) {
+            c->notify();
+        }
+    }
+
+    return result;
+}
+
+void TimeShiftStore::storeLayouts(const std::deque<PacketData>& batch) {
+    auto timeStamp = roboTV::currentTimeMillis();
+
+    for(auto& data : batch) {
+        if(data.content != StreamInfo::scSTREAMINFO) {
+            continue;
+        }
+
+        MsgPacket* layout = new MsgPacket(data.p->getMsgID(), data.p->getType());
+        layout->put_Blob(data.p->getPayload(), data.p->getPayloadLength());
+        m_layouts.push_back({timeStamp.count(), layout});
+    }
+
+    // keep the layout in effect at the start of the timeshift
+    while(m_layouts.size() > 1 && (m_layouts.size() > (size_t)MaxStreamLayouts || m_layouts[1].first <= m_queueStartTime.count())) {
+        delete m_layouts.front().second;
+        m_layouts.pop_front();
+    }
+}
+
+MsgPacket* TimeShiftStore::getStreamLayout(Cursor* cursor) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    MsgPacket* layout = NULL;
+
+    for(auto& l : m_layouts) {
+        if(l.first > cursor->seekTime) {
+            break;
+        }
+
+        layout = l.second;
+    }
+
+    if(layout == NULL) {
+        return NULL;
+    }
+
+    MsgPacket* p = new MsgPacket(layout->getMsgID(), layout->getType());
+    p->put_Blob(layout->getPayload(), layout->getPayloadLength());
+
+    return p;
+}
+
+bool TimeShiftStore::isLeased(off_t startPosition, off_t endPosition) {
+    for(auto c : m_cursors) {
+        if(c->wrapped && c->viewLength > 0 &&
+                startPosition < c->viewPosition + c->viewLength && endPosition > c->viewPosition) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool TimeShiftStore::internalWrite(std::deque<PacketData>& batch) {
+    auto timeStamp = roboTV::currentTimeMillis();
+    bool success = true;
+
+    // set queue start time
+
+    if(m_queueStartTime.count() == 0) {
+        m_queueStartTime = batch.empty() || batch.front().wallclockTime.count() == 0 ? timeStamp : batch.front().wallclockTime;
+    }
+
+    std::vector<struct iovec> iov;
+    iov.reserve(batch.size());
+
+    off_t batchPosition = m_writePosition;
+
+    for(auto& data : batch) {
+        auto p = data.p;
+        p->freeze();
+
+        // keep the original arrival time of spilled packets
+        auto wallclockTime = (data.wallclockTime.count() != 0) ? data.wallclockTime : timeStamp;
+
+        // ring-buffer overrun ?
+
+        if(m_writePosition >= (off_t) m_bufferSize) {
+            success &= flush(iov, batchPosition);
+            writeBehind(m_writePosition, true);
+
+            INFOLOG("timeshift: write buffer wrap");
+            m_writePosition = 0;
+            batchPosition = 0;
+
+            m_hasWrapped = true;
+            m_wrapCount++;
+
+            for(auto c : m_cursors) {
+                if(!c->onStorage) {
+                    continue;
+                }
+
+                // readers at the end of the buffer continue at the start
+                // (in the same lap as before)
+                if(c->readPosition >= (off_t)m_bufferSize) {
+                    setReadPosition(c, 0);
+                    c->readWrapCount++;
+                    continue;
+                }
+
+                c->wrapped = !c->wrapped;
+            }
+        }
+
+        off_t packetEndPosition = m_writePosition + p->getPacketLength();
+
+        // don't overwrite packet views handed out to the readers
+        // and don't exceed the mapping
+
+        if(m_map != NULL && (packetEndPosition > (off_t)m_mapSize || isLeased(m_writePosition, packetEndPosition))) {
+            m_droppedPackets++;
+            continue;
+        }
+
+        // check if write position if still behind read positions (if wrapped)
+        // if not -> shift read positions forward
+
+        for(auto c : m_cursors) {
+            if(!c->onStorage || packetEndPosition < c->readPosition || !c->wrapped) {
+                continue;
+            }
+
+            success &= flush(iov, batchPosition);
+            batchPosition = m_writePosition;
+
+            while(packetEndPosition >= c->readPosition && c->wrapped) {
+                if(!skipPacket(c)) {
+                    return false;
+                }
+            }
+        }
+
+        trim(packetEndPosition);
+
+        // add keyframe to map
+        if(isIndexed(data)) {
+            m_indexList.push_back({m_writePosition, wallclockTime, data.pts, m_wrapCount});
+        }
+
+        // storage position (to move readers of the memory window)
+        data.filePosition = m_writePosition;
+        data.wrapCount = m_wrapCount;
+
+        // gather packet
+        iov.push_back({p->getPacket(), p->getPacketLength()});
+        m_writePosition = packetEndPosition;
+
+        if(iov.size() >= IOV_MAX) {
+            success &= flush(iov, batchPosition);
+            batchPosition = m_writePosition;
+        }
+    }
+
+    success &= flush(iov, batchPosition);
+    writeBehind(m_writePosition, false);
+
+    return success;
+}
+
+void TimeShiftStore::writeBehind(off_t position, bool force) {
+    if(m_map != NULL || m_writeFd == -1) {
+        return;
+    }
+
+    // wrapped
+    if(position < m_syncPosition) {
+        m_syncPosition = 0;
+    }
+
+    if(position == m_syncPosition || (!force && position - m_syncPosition < CacheChunkSize)) {
+        return;
+    }
+
+    // start writeback now, so the pages can be dropped behind the readers
+    sync_file_range(m_writeFd, m_syncPosition, position - m_syncPosition, SYNC_FILE_RANGE_WRITE);
+    m_syncPosition = (position >= (off_t)m_bufferSize) ? 0 : position;
+}
+
+void TimeShiftStore::releaseCache(Cursor* cursor) {
+    if(m_map != NULL || cursor->readFd == -1) {
+        return;
+    }
+
+    // whole chunks behind the cursor
+    off_t end = cursor->readPosition & ~(off_t)(CacheChunkSize - 1);
+
+    if(end - cursor->dropPosition < CacheChunkSize) {
+        return;
+    }
+
+    // keep pages other readers didn't get to yet (the slowest one drops them)
+    for(auto c : m_cursors) {
+        if(c == cursor || !c->onStorage) {
+            continue;
+        }
+
+        if(c->readWrapCount < cursor->readWrapCount || (c->readWrapCount == cursor->readWrapCount && c->readPosition < end)) {
+            return;
+        }
+    }
+
+    posix_fadvise(cursor->readFd, cursor->dropPosition, end - cursor->dropPosition, POSIX_FADV_DONTNEED);
+    cursor->dropPosition = end;
+}
+
+uint64_t TimeShiftStore::getCacheResidency() {
+    std::string storage;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        storage = m_storage;
+    }
+
+    if(storage.empty()) {
+        return 0;
+    }
+
+    int fd = open(storage.c_str(), O_RDONLY);
+
+    if(fd == -1) {
+        return 0;
+    }
+
+    struct stat st;
+    uint64_t resident = 0;
+
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if(map != MAP_FAILED) {
+            long pageSize = sysconf(_SC_PAGESIZE);
+            std::vector<unsigned char> pages((st.st_size + pageSize - 1) / pageSize);
+
+            if(mincore(map, st.st_size, pages.data()) == 0) {
+                for(auto page : pages) {
+                    resident += (page & 1);
+                }
+            }
+
+            munmap(map, st.st_size);
+            resident *= pageSize;
+        }
+    }
+
+    ::close(fd);
+    return resident;
+}
+
+bool TimeShiftStore::flush(std::vector<struct iovec>& iov, off_t position) {
+    size_t index = 0;
+    uint64_t bytes = 0;
+
+    for(auto& v : iov) {
+        bytes += v.iov_len;
+    }
+
+    TimeShiftFilePool::account(bytes);
+
+    // copy into mapping
+    if(m_map != NULL) {
+        for(auto& v : iov) {
+            memcpy(m_map + position, v.iov_base, v.iov_len);
+            position += v.iov_len;
+        }
+
+        iov.clear();
+        return true;
+    }
+
+    while(index < iov.size()) {
+        ssize_t rc = IoEngine::pwritev(m_writeFd, &iov[index], std::min(iov.size() - index, (size_t)IOV_MAX), position);
+
+        if(rc == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if(rc <= 0) {
+            ERRORLOG("Unable to write packet into timeshift ringbuffer !");
+            iov.clear();
+            return false;
+        }
+
+        position += rc;
+
+        // skip fully written buffers, adjust partially written one
+        while(index < iov.size() && rc >= (ssize_t)iov[index].iov_len) {
+            rc -= iov[index].iov_len;
+            index++;
+        }
+
+        if(rc > 0) {
+            iov[index].iov_base = (uint8_t*)iov[index].iov_base + rc;
+            iov[index].iov_len -= rc;
+        }
+    }
+
+    iov.clear();
+    return true;
+}
+
+void TimeShiftStore::storeMemory(std::deque<PacketData>& batch) {
+    auto timeStamp = roboTV::currentTimeMillis();
+
+    for(auto& data : batch) {
+        // readers get views on the stored packets
+        data.p->freeze();
+
+        data.wallclockTime = timeStamp;
+        m_memoryUsage += data.p->getPacketLength();
+        m_memory.push_back(data);
+        data.p = NULL;
+    }
+
+    // evict oldest packets (packets leased to readers are retired)
+    // shrink the window while the global memory budget is exceeded
+    bool shedding = MemoryBudget::exceeded();
+    uint64_t limit = shedding ? std::min<uint64_t>(m_memoryLimit, ShedMemorySize) : m_memoryLimit;
+
+    while(m_memoryUsage > limit && m_memory.size() > 1) {
+        for(auto c : m_cursors) {
+            if(c->onStorage) {
+                continue;
+            }
+
+            if(c->memoryReadIndex == 0) {
+                m_droppedPackets++;
+            }
+            else {
+                c->memoryReadIndex--;
+            }
+        }
+
+        auto& m = m_memory.front();
+        m_memoryUsage -= m.p->getPacketLength();
+
+        // only count what the regular limit would have kept
+        if(shedding && m_memoryUsage < m_memoryLimit) {
+            MemoryBudget::shed(MemoryBudget::msTimeShift, m.p->getPacketLength());
+        }
+
+        freeMemoryPacket(m.p);
+
+        m_memory.pop_front();
+    }
+
+    m_memoryAccount.set(m_memoryUsage);
+
+    // the ring file holds the timeshift buffer once spilled
+    if(!m_spilled) {
+        m_queueStartTime = m_memory.front().wallclockTime;
+    }
+}
+
+void TimeShiftStore::freeMemoryPacket(MsgPacket* p) {
+    for(auto c : m_cursors) {
+        if(c->memoryLease && c->memoryPacket == p) {
+            m_retired.insert(p);
+            return;
+        }
+    }
+
+    delete p;
+}
+
+void TimeShiftStore::releaseLease(Cursor* cursor) {
+    cursor->viewLength = 0;
+
+    if(!cursor->memoryLease) {
+        return;
+    }
+
+    MsgPacket* p = cursor->memoryPacket;
+    cursor->memoryLease = false;
+    cursor->memoryPacket = NULL;
+
+    auto i = m_retired.find(p);
+
+    if(i == m_retired.end()) {
+        return;
+    }
+
+    // other readers may still hold a view on the spilled packet
+    for(auto c : m_cursors) {
+        if(c->memoryLease && c->memoryPacket == p) {
+            return;
+        }
+    }
+
+    m_retired.erase(i);
+    delete p;
+}
+
+MsgPacket* TimeShiftStore::readMemory(Cursor* cursor, bool keyFrameMode) {
+    // skip to next keyframe
+    if(keyFrameMode) {
+        size_t index = cursor->memoryReadIndex;
+
+        while(index < m_memory.size() && !isKeyFrame(m_memory[index])) {
+            index++;
+        }
+
+        if(index == m_memory.size()) {
+            return NULL;
+        }
+
+        cursor->memoryReadIndex = index;
+    }
+
+    if(cursor->memoryReadIndex >= m_memory.size()) {
+        return NULL;
+    }
+
+    MsgPacket* p = m_memory[cursor->memoryReadIndex++].p;
+    cursor->memoryLease = true;
+    cursor->memoryPacket = p;
+
+    return MsgPacket::view(p->getPacket(), p->getPacketLength());
+}
+
+bool TimeShiftStore::seekMemory(Cursor* cursor, int64_t wallclockPositionMs, int64_t& pts) {
+    if(m_memory.empty() || wallclockPositionMs < m_memory.front().wallclockTime.count()) {
+        return false;
+    }
+
+    // find last keyframe before the requested position
+    for(size_t index = m_memory.size(); index > 0; index--) {
+        auto& m = m_memory[index - 1];
+
+        if(!isKeyFrame(m)) {
+            continue;
+        }
+
+        if(m.wallclockTime.count() <= wallclockPositionMs) {
+            cursor->memoryReadIndex = index - 1;
+            cursor->seekTime = m.wallclockTime.count();
+            pts = m.pts;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TimeShiftStore::spill(Cursor* cursor) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // nowhere to spill to (live only)
+    if(cursor->onStorage || m_storage.empty()) {
+        return;
+    }
+
+    // write the memory window once, later packets are written through
+    if(!m_spilled) {
+        INFOLOG("timeshift: spilling %lu packets to storage", (unsigned long)m_memory.size());
+        internalWrite(m_memory);
+        m_spilled = true;
+    }
+
+    moveToStorage(cursor);
+}
+
+void TimeShiftStore::moveToStorage(Cursor* cursor) {
+    size_t index = cursor->memoryReadIndex;
+
+    // skip packets which didn't make it into storage
+    while(index < m_memory.size() && m_memory[index].filePosition == -1) {
+        index++;
+    }
+
+    if(index < m_memory.size()) {
+        setReadPosition(cursor, m_memory[index].filePosition);
+        cursor->readWrapCount = m_memory[index].wrapCount;
+    }
+    else {
+        setReadPosition(cursor, m_writePosition);
+        cursor->readWrapCount = m_wrapCount;
+    }
+
+    cursor->wrapped = (cursor->readWrapCount != m_wrapCount);
+    cursor->keyFrameHint = m_indexOffset + m_indexList.size();
+    cursor->onStorage = true;
+}
+
+void TimeShiftStore::close() {
+    if(m_map != NULL) {
+        munmap(m_map, m_mapSize);
+        m_map = NULL;
+    }
+
+    ::close(m_writeFd);
+    TimeShiftFilePool::release(m_storage);
+}
+
+void TimeShiftStore::trim(off_t position) {
+    if(!m_hasWrapped || m_indexList.empty()) {
+        return;
+    }
+
+    auto p = m_indexList.front();
+
+    if(p.filePosition < position && p.wrapCount < m_wrapCount) {
+        m_indexList.pop_front();
+        m_indexOffset++;
+    }
+
+    if(!m_indexList.empty()) {
+        auto p = m_indexList.front();
+        m_queueStartTime = p.wallclockTime;
+    }
+}
+
+void TimeShiftStore::setTimeShiftDir(const std::string& dir) {
+    m_timeShiftDir = dir;
+    DEBUGLOG("TIMESHIFTDIR: %s", m_timeShiftDir.c_str());
+}
+
+void TimeShiftStore::setBufferSize(uint64_t s) {
+    m_bufferSize = s;
+    INFOLOG("timeshift buffersize: %lu bytes", m_bufferSize);
+}
+
+void TimeShiftStore::setStorageMode(StorageMode mode) {
+    m_storageMode = mode;
+    INFOLOG("timeshift storage: %s", (m_storageMode == smMmap) ? "mmap" : "file");
+}
+
+void TimeShiftStore::setMemorySize(uint64_t s) {
+    m_memorySize = s;
+    INFOLOG("timeshift memory size: %lu bytes", m_memorySize);
+}
+
+void TimeShiftStore::setupTimeShiftFiles() {
+    // ring files are reused (preallocated to the maximum mapping size)
+    TimeShiftFilePool::setup(m_timeShiftDir, m_bufferSize + MapHeadroom);
+
+    DIR* dir = opendir(m_timeShiftDir.c_str());
+
+    if(dir == NULL) {
+        return;
+    }
+
+    struct dirent* entry = NULL;
+
+    while((entry = readdir(dir)) != NULL) {
+        if(strncmp(entry->d_name, "robotv-ringbuffer-", 16) == 0) {
+            INFOLOG("Removing old time-shift storage: %s", entry->d_name);
+            unlink((m_timeShiftDir + "/" + entry->d_name).c_str());
+        }
+    }
+
+    closedir(dir);
+}
+
+int64_t TimeShiftStore::seek(Cursor* cursor, int64_t wallclockPositionMs) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int64_t pts = 0;
+
+        // positions inside the memory window are read from memory
+        if(seekMemory(cursor, wallclockPositionMs, pts)) {
+            cursor->onStorage = false;
+            return pts;
+        }
+    }
+
+    spill(cursor);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_indexList.empty()) {
+        ERRORLOG("empty timeshift queue - unable to seek");
+        return 0;
+    }
+
+    // entries are ordered by wallclock time
+    // find the last keyframe at (or before) the requested position
+
+    auto i = std::upper_bound(m_indexList.begin(), m_indexList.end(), wallclockPositionMs,
+    [](int64_t position, const PacketIndex & index) {
+        return position < index.wallclockTime.count();
+    });
+
+    // behind buffer
+    if(i != m_indexList.begin()) {
+        i--;
+    }
+
+    seekIndex(cursor, *i);
+    cursor->keyFrameHint = m_indexOffset + (i - m_indexList.begin()) + 1;
+    cursor->seekTime = i->wallclockTime.count();
+
+    return i->pts;
+}
+
+void TimeShiftStore::seekIndex(Cursor* cursor, const PacketIndex& index) {
+    setReadPosition(cursor, index.filePosition);
+    cursor->readWrapCount = index.wrapCount;
+
+    // reader is one lap behind the writer ?
+    cursor->wrapped = (index.wrapCount != m_wrapCount);
+}
+
+bool TimeShiftStore::indexBefore(const PacketIndex& index, int wrapCount, off_t position) {
+    if(index.wrapCount != wrapCount) {
+        return index.wrapCount < wrapCount;
+    }
+
+    return index.filePosition < position;
+}
+
+bool TimeShiftStore::isKeyFrame(const PacketData& data) const {
+    // radio has no I-frames - every audio packet is a start point
+    if(m_audioOnly) {
+        return (data.content == StreamInfo::Content::scAUDIO);
+    }
+
+    return (data.content == StreamInfo::Content::scVIDEO && data.p->getClientID() == StreamInfo::FrameType::ftIFRAME);
+}
+
+bool TimeShiftStore::isIndexed(const PacketData& data) {
+    if(!isKeyFrame(data)) {
+        return false;
+    }
+
+    if(!m_audioOnly) {
+        return true;
+    }
+
+    // audio packets are indexed in PTS intervals (or at a discontinuity)
+    int64_t elapsed = data.pts - m_indexPts;
+
+    if(!m_indexList.empty() && elapsed >= 0 && elapsed < AudioIndexInterval) {
+        return false;
+    }
+
+    m_indexPts = data.pts;
+    return true;
+}
+
+void TimeShiftStore::seekNextKeyFrame(Cursor* cursor) {
+    if(m_indexList.empty()) {
+        return;
+    }
+
+    // entries are ordered by (wrapCount, filePosition)
+    // try the entry following the last keyframe first
+
+    size_t next = m_indexList.size();
+
+    if(cursor->keyFrameHint >= m_indexOffset) {
+        next = cursor->keyFrameHint - m_indexOffset;
+    }
+
+    bool hit = (next < m_indexList.size()) &&
+               !indexBefore(m_indexList[next], cursor->readWrapCount, cursor->readPosition) &&
+               (next == 0 || indexBefore(m_indexList[next - 1], cursor->readWrapCount, cursor->readPosition));
+
+    if(!hit) {
+        auto i = std::lower_bound(m_indexList.begin(), m_indexList.end(), 0,
+        [&](const PacketIndex & index, int) {
+            return indexBefore(index, cursor->readWrapCount, cursor->readPosition);
+        });
+
+        next = i - m_indexList.begin();
+    }
+
+    if(next >= m_indexList.size()) {
+        return;
+    }
+
+    seekIndex(cursor, m_indexList[next]);
+    cursor->keyFrameHint = m_indexOffset + next + 1;
+}
+
+int64_t TimeShiftStore::getTimeshiftStartPosition() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queueStartTime.count();
+}
@@ -0,0 +1,345 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_TIMESHIFTSTORE_H
+#define ROBOTV_TIMESHIFTSTORE_H
+
+#include "demuxer/streaminfo.h"
+#include "tools/mpscring.h"
+#include "tools/lockprofiler.h"
+#include "tools/memorybudget.h"
+
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+class MsgPacket;
+
+struct iovec;
+
+/**
+ * Timeshift storage shared by all clients watching the same channel.
+ * The store is written once (by a single writer) and read by any
+ * number of clients through independent cursors.
+ */
+class TimeShiftStore {
+public:
+
+    enum StorageMode {
+        smFile,
+        smMmap
+    };
+
+    struct Cursor {
+        int readFd;
+        off_t readPosition;
+        off_t dropPosition;
+        int readWrapCount;
+        bool wrapped;
+        off_t viewPosition;
+        uint32_t viewLength;
+        size_t memoryReadIndex;
+        bool memoryLease;
+        MsgPacket* memoryPacket;
+        bool onStorage;
+        size_t keyFrameHint;
+        int64_t seekTime;
+        std::function<void()> notify;
+        std::vector<uint8_t> readBuffer;
+    };
+
+    /** Get the shared store of a channel.
+     @param channelUid uid of the channel
+     @param passthrough store of the raw TS stream (instead of demuxed packets)
+     */
+    static TimeShiftStore* acquire(uint32_t channelUid, bool passthrough = false);
+
+    static void release(TimeShiftStore* store);
+
+    Cursor* attach();
+
+    void detach(Cursor* cursor);
+
+    /** Set data notification of a cursor.
+     The callback is invoked from the writer thread whenever new packets
+     have been stored. It must not block or call into the store.
+     */
+    void setNotify(Cursor* cursor, std::function<void()> notify);
+
+    /** Switch the store into audio-only mode (radio channels).
+     Audio packets are valid start points and indexed by their PTS, the
+     live window is kept in memory. Must be set before the first packet
+     has been queued.
+     */
+    void setAudioOnly(bool on);
+
+    bool claimWriter(const void* owner);
+
+    void releaseWriter(const void* owner);
+
+    /** Check if owner is the writer of the store (never claims it) */
+    bool isWriter(const void* owner);
+
+    void queue(MsgPacket* p, StreamInfo::Content content, int64_t pts = 0);
+
+    MsgPacket* read(Cursor* cursor, bool keyFrameMode = false);
+
+    int64_t seek(Cursor* cursor, int64_t wallclockPositionMs);
+
+    /** Get the stream layout in effect at the keyframe of the last seek.
+     Stream layouts are the packets queued as StreamInfo::scSTREAMINFO.
+     @param cursor cursor of the reader
+     @return copy of the layout packet (owned by the caller) or NULL
+     */
+    MsgPacket* getStreamLayout(Cursor* cursor);
+
+    /** Move a cursor from the memory window to the ring file.
+     The memory window stays in use for the other cursors.
+     */
+    void spill(Cursor* cursor);
+
+    int64_t getTimeshiftStartPosition();
+
+    /** Number of packets waiting for the writer */
+    size_t getQueueDepth();
+
+    size_t getQueueCapacity();
+
+    /** Maximum number of packets waiting for the writer */
+    size_t getQueuePeak();
+
+    uint64_t getWriterWakeups();
+
+    uint64_t getDroppedPackets();
+
+    /** Size of the ring file in the page cache (in bytes) */
+    uint64_t getCacheResidency();
+
+    static void setTimeShiftDir(const std::string& dir);
+
+    static void setBufferSize(uint64_t s);
+
+    static void setStorageMode(StorageMode mode);
+
+    static void setMemorySize(uint64_t s);
+
+    /** Remove stale ringbuffers and set up the pool of ring files.
+     Must be called after the timeshift settings have been loaded.
+     */
+    static void setupTimeShiftFiles();
+
+protected:
+
+    TimeShiftStore(uint32_t channelUid, bool passthrough);
+
+    virtual ~TimeShiftStore();
+
+    struct PacketData {
+        MsgPacket* p;
+        StreamInfo::Content content;
+        int64_t pts;
+        std::chrono::milliseconds wallclockTime;
+        int64_t queueTime;
+        off_t filePosition;
+        int wrapCount;
+    };
+
+    struct PacketIndex {
+        off_t filePosition;
+        std::chrono::milliseconds wallclockTime;
+        int64_t pts;
+        int wrapCount;
+    };
+
+    bool write(std::deque<PacketData>& batch);
+
+    bool internalWrite(std::deque<PacketData>& batch);
+
+    bool flush(std::vector<struct iovec>& iov, off_t position);
+
+    void writeBehind(off_t position, bool force);
+
+    void releaseCache(Cursor* cursor);
+
+    void storeMemory(std::deque<PacketData>& batch);
+
+    /** Keep the stream layouts of a batch for seeks */
+    void storeLayouts(const std::deque<PacketData>& batch);
+
+    MsgPacket* readMemory(Cursor* cursor, bool keyFrameMode);
+
+    /** Release the packet view returned by the last read of a cursor */
+    void releaseLease(Cursor* cursor);
+
+    bool seekMemory(Cursor* cursor, int64_t wallclockPositionMs, int64_t& pts);
+
+    /** Continue reading the packets of the memory window from the ring file */
+    void moveToStorage(Cursor* cursor);
+
+    /** Free a packet of the memory window (or retire it while it's leased) */
+    void freeMemoryPacket(MsgPacket* p);
+
+    void setReadPosition(Cursor* cursor, off_t position);
+
+    bool createMapping();
+
+    void cleanup();
+
+    void close();
+
+    void trim(off_t position);
+
+    bool checkReadPosition(Cursor* cursor);
+
+    MsgPacket* internalRead(Cursor* cursor);
+
+    bool skipPacket(Cursor* cursor);
+
+    void seekNextKeyFrame(Cursor* cursor);
+
+    void seekIndex(Cursor* cursor, const PacketIndex& index);
+
+    bool isLeased(off_t startPosition, off_t endPosition);
+
+    static bool indexBefore(const PacketIndex& index, int wrapCount, off_t position);
+
+    bool isKeyFrame(const PacketData& data) const;
+
+    /** Check if a keyframe gets an entry in the seek index */
+    bool isIndexed(const PacketData& data);
+
+    uint32_t m_channelUid;
+
+    bool m_passthrough;
+
+    int m_refCount;
+
+    const void* m_writer;
+
+    std::list<Cursor*> m_cursors;
+
+    std::deque<struct PacketIndex> m_indexList;
+
+    int m_writeFd;
+
+    off_t m_writePosition;
+
+    off_t m_syncPosition;
+
+    uint8_t* m_map;
+
+    size_t m_mapSize;
+
+    std::mutex m_mutex;
+
+    std::string m_storage;
+
+    std::chrono::milliseconds m_queueStartTime;
+
+    bool m_hasWrapped;
+
+    int m_wrapCount;
+
+    size_t m_indexOffset;
+
+    std::deque<PacketData> m_memory;
+
+    uint64_t m_memoryUsage;
+
+    uint64_t m_memoryLimit;
+
+    MemoryAccount m_memoryAccount{MemoryBudget::msTimeShift};
+
+    bool m_spilled;
+
+    /** Spilled memory packets still leased to readers */
+    std::set<MsgPacket*> m_retired;
+
+    bool m_audioOnly;
+
+    int64_t m_indexPts;
+
+    /** Stream layouts of the timeshift (wallclock time in ms, layout packet) */
+    std::deque<std::pair<int64_t, MsgPacket*>> m_layouts;
+
+    static std::string m_timeShiftDir;
+
+    static uint64_t m_bufferSize;
+
+    static StorageMode m_storageMode;
+
+    static uint64_t m_memorySize;
+
+    static std::map<std::pair<uint32_t, bool>, TimeShiftStore*> m_stores;
+
+    static std::mutex m_storesMutex;
+
+    enum {
+        MapHeadroom = 16 * 1024 * 1024,
+        MaxWriterQueue = 400,
+        WriterRingSize = 512,
+        LiveOnlyMemorySize = 8 * 1024 * 1024,
+        AudioOnlyMemorySize = 4 * 1024 * 1024,
+        AudioIndexInterval = 500 * 90,
+        ShedMemorySize = 2 * 1024 * 1024,
+        CacheChunkSize = 8 * 1024 * 1024,
+        MaxStreamLayouts = 32
+    };
+
+private:
+
+    std::thread* m_writeThread;
+
+    std::atomic<bool> m_writerRunning;
+
+    MpscRing<PacketData> m_writerQueue;
+
+    bool admit(MsgPacket* p, StreamInfo::Content content);
+
+    std::atomic<bool> m_writerResync;
+
+    std::atomic<bool> m_writerSleeping;
+
+    std::atomic<size_t> m_queuePeak;
+
+    ProfiledMutex m_mutexQueue{"timeshift.queue"};
+
+    std::condition_variable m_queueCondition;
+
+    std::atomic<uint64_t> m_wakeups;
+
+    std::atomic<uint64_t> m_droppedPackets;
+
+};
+
+#endif // ROBOTV_TIMESHIFTSTORE_H
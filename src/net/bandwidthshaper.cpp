@@ -0,0 +1,165 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <algorithm>
+
+#include "bandwidthshaper.h"
+#include "config/config.h"
+
+// smallest burst (an aggregated stream packet must fit)
+#define BANDWIDTH_MIN_BURST (256 * 1024)
+
+TokenBucket::TokenBucket(uint64_t rate) : m_rate(0), m_burst(0), m_tokens(0) {
+    setRate(rate);
+}
+
+void TokenBucket::setRate(uint64_t rate) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(rate == m_rate) {
+        return;
+    }
+
+    // burst of one second (a formerly unlimited bucket starts full)
+    m_burst = std::max<int64_t>(rate, BANDWIDTH_MIN_BURST);
+    m_tokens = (m_rate == 0) ? m_burst : std::min(m_tokens, m_burst);
+    m_rate = rate;
+    m_lastRefill = std::chrono::steady_clock::now();
+}
+
+void TokenBucket::refill() {
+    auto now = std::chrono::steady_clock::now();
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - m_lastRefill).count();
+
+    // the bucket is full after the burst window (one second, longer for the
+    // minimum burst), longer idle times would overflow
+    elapsed = std::min<int64_t>(elapsed, (int64_t)(m_burst * 1000000 / m_rate));
+    int64_t tokens = (int64_t)(m_rate * elapsed / 1000000);
+
+    // keep the remainder for the next refill
+    if(tokens == 0) {
+        return;
+    }
+
+    m_tokens = std::min(m_tokens + tokens, m_burst);
+    m_lastRefill = now;
+}
+
+bool TokenBucket::available() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_rate == 0) {
+        return true;
+    }
+
+    refill();
+    return (m_tokens > 0);
+}
+
+void TokenBucket::consume(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_rate == 0) {
+        return;
+    }
+
+    refill();
+    m_tokens -= bytes;
+}
+
+TokenBucket BandwidthShaper::m_global;
+
+uint64_t BandwidthShaper::m_clientRate[BandwidthShaper::tcCount] = { 0, 0, 0 };
+
+std::atomic<uint64_t> BandwidthShaper::m_bytes[BandwidthShaper::tcCount];
+
+std::atomic<uint64_t> BandwidthShaper::m_throttled[BandwidthShaper::tcCount];
+
+static const char* classNames[BandwidthShaper::tcCount] = {
+    "live",
+    "timeShift",
+    "recording"
+};
+
+BandwidthShaper::BandwidthShaper() {
+    registerMetrics();
+}
+
+void BandwidthShaper::setClientRate(TrafficClass trafficClass, uint64_t bytesPerSecond) {
+    m_clientRate[trafficClass] = bytesPerSecond;
+    INFOLOG("%s bandwidth per client: %lu bytes/s", classNames[trafficClass], (unsigned long)bytesPerSecond);
+}
+
+void BandwidthShaper::setGlobalRate(uint64_t bytesPerSecond) {
+    m_global.setRate(bytesPerSecond);
+    INFOLOG("bandwidth of all clients: %lu bytes/s", (unsigned long)bytesPerSecond);
+}
+
+uint64_t BandwidthShaper::clientRate(TrafficClass trafficClass) {
+    return m_clientRate[trafficClass];
+}
+
+bool BandwidthShaper::admit(TrafficClass trafficClass) {
+    m_bucket.setRate(m_clientRate[trafficClass]);
+
+    if(m_bucket.available() && m_global.available()) {
+        return true;
+    }
+
+    m_throttled[trafficClass]++;
+    return false;
+}
+
+void BandwidthShaper::consume(TrafficClass trafficClass, uint64_t bytes) {
+    m_bucket.consume(bytes);
+    m_global.consume(bytes);
+    m_bytes[trafficClass] += bytes;
+}
+
+void BandwidthShaper::registerMetrics() {
+    static std::once_flag registered;
+
+    std::call_once(registered, []() {
+        Metrics::instance().add(&m_global, "bandwidth", []() {
+            return getMetrics();
+        });
+    });
+}
+
+nlohmann::json BandwidthShaper::getMetrics() {
+    nlohmann::json classes = nlohmann::json::object();
+
+    for(int i = 0; i < tcCount; i++) {
+        classes[classNames[i]] = {
+            {"clientRate", m_clientRate[i]},
+            {"bytes", m_bytes[i].load()},
+            {"throttled", m_throttled[i].load()}
+        };
+    }
+
+    return {
+        {"globalRate", m_global.rate()},
+        {"classes", classes}
+    };
+}
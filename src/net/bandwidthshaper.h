@@ -0,0 +1,129 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_BANDWIDTHSHAPER_H
+#define ROBOTV_BANDWIDTHSHAPER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include "tools/metrics.h"
+
+/**
+ * Token bucket.
+ * Tokens (bytes) refill at a constant rate up to the burst size. A request
+ * is admitted while tokens are left, the sent bytes may overdraw the bucket
+ * (packets have different sizes), the debt delays the next request.
+ */
+class TokenBucket {
+public:
+
+    /** @param rate bytes per second (0 - unlimited) */
+    TokenBucket(uint64_t rate = 0);
+
+    void setRate(uint64_t rate);
+
+    uint64_t rate() const {
+        return m_rate;
+    }
+
+    bool available();
+
+    void consume(uint64_t bytes);
+
+protected:
+
+    void refill();
+
+private:
+
+    std::mutex m_mutex;
+
+    uint64_t m_rate;
+
+    int64_t m_burst;
+
+    int64_t m_tokens;
+
+    std::chrono::steady_clock::time_point m_lastRefill;
+
+};
+
+/**
+ * Bandwidth shaping of the stream data sent to a client.
+ * Every client has a token bucket with the rate of its traffic class
+ * (live, timeshift / keyframe mode, recording), all clients share a global
+ * bucket. Throttled stream requests are answered without data (like a
+ * stream without pending packets), push-mode streams pause until tokens
+ * are available. Status messages and responses are never shaped.
+ * Rates and throttling are exported (group "bandwidth") by the SVDRP
+ * command STAT.
+ */
+class BandwidthShaper {
+public:
+
+    enum TrafficClass {
+        tcLive,
+        tcTimeShift,
+        tcRecording,
+        tcCount
+    };
+
+    BandwidthShaper();
+
+    /** Set the rate of a traffic class per client (0 - unlimited) */
+    static void setClientRate(TrafficClass trafficClass, uint64_t bytesPerSecond);
+
+    /** Set the rate of all clients (0 - unlimited) */
+    static void setGlobalRate(uint64_t bytesPerSecond);
+
+    static uint64_t clientRate(TrafficClass trafficClass);
+
+    /** Check if stream data of a traffic class may be sent now */
+    bool admit(TrafficClass trafficClass);
+
+    /** Account sent stream data */
+    void consume(TrafficClass trafficClass, uint64_t bytes);
+
+private:
+
+    static void registerMetrics();
+
+    static nlohmann::json getMetrics();
+
+    TokenBucket m_bucket;
+
+    static TokenBucket m_global;
+
+    static uint64_t m_clientRate[tcCount];
+
+    static std::atomic<uint64_t> m_bytes[tcCount];
+
+    static std::atomic<uint64_t> m_throttled[tcCount];
+
+};
+
+#endif // ROBOTV_BANDWIDTHSHAPER_H
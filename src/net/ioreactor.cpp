@@ -0,0 +1,263 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "config/config.h"
+#include "ioreactor.h"
+
+#define MAX_EVENTS 64
+
+IoReactor::IoReactor(int workerCount) : m_running(true) {
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(m_epollFd == -1) {
+        ERRORLOG("unable to create epoll instance (errno=%d: %s)", errno, strerror(errno));
+    }
+
+    for(int i = 0; i < workerCount; i++) {
+        m_workers.push_back(new std::thread([&]() {
+            workerLoop();
+        }));
+    }
+
+    m_eventThread = new std::thread([&]() {
+        eventLoop();
+    });
+}
+
+IoReactor::~IoReactor() {
+    m_running = false;
+    m_workCondition.notify_all();
+
+    m_eventThread->join();
+    delete m_eventThread;
+
+    for(auto t : m_workers) {
+        t->join();
+        delete t;
+    }
+
+    for(auto& i : m_connections) {
+        ::close(i.second->wakeupFd);
+        delete i.second;
+    }
+
+    for(auto c : m_removed) {
+        delete c;
+    }
+
+    if(m_epollFd != -1) {
+        ::close(m_epollFd);
+    }
+}
+
+int IoReactor::add(int fd, Handler* handler) {
+    int wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if(wakeupFd == -1) {
+        ERRORLOG("unable to create eventfd (errno=%d: %s)", errno, strerror(errno));
+        return -1;
+    }
+
+    Connection* connection = new Connection;
+    connection->fd = fd;
+    connection->wakeupFd = wakeupFd;
+    connection->handler = handler;
+    connection->busy = false;
+    connection->pending = false;
+    connection->closed = false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_connections[handler] = connection;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = connection;
+
+    if(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) == -1 ||
+            epoll_ctl(m_epollFd, EPOLL_CTL_ADD, wakeupFd, &ev) == -1) {
+        ERRORLOG("unable to register connection (errno=%d: %s)", errno, strerror(errno));
+        remove(handler);
+        return -1;
+    }
+
+    return wakeupFd;
+}
+
+void IoReactor::remove(Handler* handler) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto i = m_connections.find(handler);
+
+    if(i == m_connections.end()) {
+        return;
+    }
+
+    Connection* connection = i->second;
+    connection->closed = true;
+
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, connection->wakeupFd, NULL);
+
+    // wait for running event processing
+    m_idleCondition.wait(lock, [&]() {
+        return !connection->busy;
+    });
+
+    m_connections.erase(i);
+    ::close(connection->wakeupFd);
+
+    // the event loop may still hold events of this connection.
+    // it will be deleted after the current batch of events.
+    m_removed.push_back(connection);
+}
+
+void IoReactor::wakeup(int wakeupFd) {
+    if(wakeupFd == -1) {
+        return;
+    }
+
+    uint64_t value = 1;
+
+    if(::write(wakeupFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        ERRORLOG("unable to wake up connection (errno=%d: %s)", errno, strerror(errno));
+    }
+}
+
+void IoReactor::eventLoop() {
+    struct epoll_event events[MAX_EVENTS];
+
+    while(m_running) {
+        int count = epoll_wait(m_epollFd, events, MAX_EVENTS, 250);
+
+        if(count == -1) {
+            if(errno != EINTR) {
+                ERRORLOG("failed during epoll_wait (errno=%d: %s)", errno, strerror(errno));
+            }
+
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for(int i = 0; i < count; i++) {
+            schedule((Connection*)events[i].data.ptr);
+        }
+
+        for(auto c : m_removed) {
+            delete c;
+        }
+
+        m_removed.clear();
+    }
+}
+
+void IoReactor::schedule(Connection* connection) {
+    if(connection->closed) {
+        return;
+    }
+
+    // process again after the running pass
+    if(connection->busy) {
+        connection->pending = true;
+        return;
+    }
+
+    connection->busy = true;
+    m_work.push_back(connection);
+    m_workCondition.notify_one();
+}
+
+void IoReactor::workerLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(m_running) {
+        m_workCondition.wait(lock, [&]() {
+            return !m_work.empty() || !m_running;
+        });
+
+        if(!m_running) {
+            break;
+        }
+
+        Connection* connection = m_work.front();
+        m_work.pop_front();
+
+        while(!connection->closed) {
+            connection->pending = false;
+
+            lock.unlock();
+            process(connection);
+            lock.lock();
+
+            if(!connection->pending) {
+                break;
+            }
+        }
+
+        connection->busy = false;
+
+        if(!connection->closed) {
+            rearm(connection);
+        }
+
+        m_idleCondition.notify_all();
+    }
+}
+
+void IoReactor::process(Connection* connection) {
+    // reset wakeup counter
+    uint64_t value = 0;
+
+    if(::read(connection->wakeupFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        ERRORLOG("unable to read wakeup counter (errno=%d: %s)", errno, strerror(errno));
+    }
+
+    if(!connection->handler->processEvents()) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        connection->closed = true;
+    }
+}
+
+void IoReactor::rearm(Connection* connection) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = connection;
+
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, connection->wakeupFd, &ev);
+
+    if(connection->handler->wantWrite()) {
+        ev.events |= EPOLLOUT;
+    }
+
+    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, connection->fd, &ev);
+}
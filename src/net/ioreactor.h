@@ -0,0 +1,134 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_IOREACTOR_H
+#define ROBOTV_IOREACTOR_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Socket I/O reactor.
+ * Waits for events on all registered client sockets (epoll) and
+ * dispatches them to a small pool of worker threads. Every connection
+ * has an eventfd to wake it up (e.g. if a message was queued for the client).
+ * Events of a connection are never processed concurrently.
+ */
+class IoReactor {
+public:
+
+    class Handler {
+    public:
+
+        virtual ~Handler() {};
+
+        /** Process pending I/O.
+         Called from a worker thread if the socket is readable, writable or the
+         connection has been woken up.
+         @return false if the connection has been closed
+         */
+        virtual bool processEvents() = 0;
+
+        /** Pending output.
+         @return true if the reactor should wait for the socket to become writable
+         */
+        virtual bool wantWrite() = 0;
+
+    };
+
+    IoReactor(int workerCount = 4);
+
+    virtual ~IoReactor();
+
+    /** Register a connection.
+     @param fd socket of the connection
+     @param handler event handler of the connection
+     @return wakeup filedescriptor of the connection or -1 on error
+     */
+    int add(int fd, Handler* handler);
+
+    /** Unregister a connection.
+     Waits until running event processing of the connection has finished.
+     The wakeup filedescriptor is closed.
+     */
+    void remove(Handler* handler);
+
+    /** Wake up a connection.
+     @param wakeupFd wakeup filedescriptor returned by add()
+     */
+    static void wakeup(int wakeupFd);
+
+protected:
+
+    struct Connection {
+        int fd;
+        int wakeupFd;
+        Handler* handler;
+        bool busy;
+        bool pending;
+        bool closed;
+    };
+
+    void eventLoop();
+
+    void workerLoop();
+
+    void schedule(Connection* connection);
+
+    void process(Connection* connection);
+
+    void rearm(Connection* connection);
+
+private:
+
+    int m_epollFd;
+
+    std::atomic<bool> m_running;
+
+    std::thread* m_eventThread;
+
+    std::vector<std::thread*> m_workers;
+
+    std::map<Handler*, Connection*> m_connections;
+
+    std::deque<Connection*> m_work;
+
+    std::vector<Connection*> m_removed;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_workCondition;
+
+    std::condition_variable m_idleCondition;
+
+};
+
+#endif // ROBOTV_IOREACTOR_H
@@ -9,11 +9,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifndef __FreeBSD__
+#include <sys/sendfile.h>
+#endif
+#include <limits.h>
 #include <iostream>
+#include <algorithm>
 #include <unistd.h>
 
 #include "os-config.h"
 #include "msgpacket.h"
+#include "packetpool.h"
+#include "tools/crc32.h"
+#include "tools/tracepoints.h"
 
 #define get_impl(T, f) \
 	if((m_readposition + sizeof(T)) > m_usage) { \
@@ -35,67 +45,25 @@ pthread_mutex_t MsgPacket::uidmutex = PTHREAD_MUTEX_INITIALIZER;
 
 uint32_t MsgPacket::globalUID = 1;
 
-uint32_t MsgPacket::crc32_tab[] = {
-    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-    0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-    0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
-    0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
-    0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-    0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
-    0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-    0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-    0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-    0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-    0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-    0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-    0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-    0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-    0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-    0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-    0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-    0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-    0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-    0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-    0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-    0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
-};
-
-
-MsgPacket::MsgPacket() : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true) {
+MsgPacket::MsgPacket() : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true), m_ownsBuffer(true), m_segmentLength(0), m_writePosition(0) {
     Init(0, 0, 0);
 }
 
-MsgPacket::MsgPacket(uint16_t msgid, uint16_t type, uint32_t uid) : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true) {
+MsgPacket::MsgPacket(uint16_t msgid, uint16_t type, uint32_t uid) : m_packet(NULL), m_size(InitialPacketSize), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(false), m_payloadchecksum(true), m_ownsBuffer(true), m_segmentLength(0), m_writePosition(0) {
     Init(msgid, type, uid);
 }
 
+MsgPacket::MsgPacket(uint8_t* buffer, uint32_t length) : m_packet(buffer), m_size(length), m_usage(HeaderLength), m_readposition(HeaderLength), m_freezed(true), m_payloadchecksum(true), m_ownsBuffer(false), m_segmentLength(0), m_writePosition(0) {
+}
+
 MsgPacket::~MsgPacket() {
-    free(m_packet);
+    if(m_ownsBuffer) {
+        PacketPool::release(m_packet);
+    }
 }
 
 void MsgPacket::Init(uint16_t msgid, uint16_t type, uint32_t uid) {
-    m_packet = (uint8_t*)malloc(m_size);
+    m_packet = PacketPool::allocate(m_size, m_size);
 
     if(m_packet == NULL) {
         return;
@@ -185,6 +153,24 @@ bool MsgPacket::put_S64(int64_t ll) {
     put_impl(int64_t, htobe64, ll);
 }
 
+bool MsgPacket::put_VarU64(uint64_t ull) {
+    uint8_t buffer[10];
+    uint32_t length = 0;
+
+    while(ull >= 0x80) {
+        buffer[length++] = (ull & 0x7F) | 0x80;
+        ull >>= 7;
+    }
+
+    buffer[length++] = ull;
+
+    return put_Blob(buffer, length);
+}
+
+bool MsgPacket::put_VarS64(int64_t ll) {
+    return put_VarU64(((uint64_t)ll << 1) ^ (uint64_t)(ll >> 63));
+}
+
 bool MsgPacket::put_Blob(uint8_t source[], uint32_t length) {
     uint8_t* p = reserve(length);
 
@@ -196,9 +182,141 @@ bool MsgPacket::put_Blob(uint8_t source[], uint32_t length) {
     return true;
 }
 
+bool MsgPacket::put_Segment(const std::shared_ptr<MsgPacket>& owner, uint8_t* data, uint32_t length) {
+    if(!m_ownsBuffer) {
+        return false;
+    }
+
+    if(length == 0) {
+        return true;
+    }
+
+    m_segments.push_back({owner, data, length, m_usage, nullptr, 0});
+    m_segmentLength += length;
+
+    return true;
+}
+
+bool MsgPacket::put_FileSegment(const std::shared_ptr<int>& file, off_t offset, uint32_t length) {
+    if(!m_ownsBuffer || !file) {
+        return false;
+    }
+
+    if(length == 0) {
+        return true;
+    }
+
+    m_segments.push_back({nullptr, NULL, length, m_usage, file, offset});
+    m_segmentLength += length;
+
+    return true;
+}
+
+bool MsgPacket::hasFileSegments() const {
+    for(auto& s : m_segments) {
+        if(s.file) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool MsgPacket::readFileSegment(const Segment& s, uint8_t* buffer) {
+    uint32_t bytes = 0;
+
+    while(bytes < s.length) {
+        ssize_t rc = pread(*s.file, buffer + bytes, s.length - bytes, s.offset + bytes);
+
+        if(rc == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if(rc <= 0) {
+            return false;
+        }
+
+        bytes += rc;
+    }
+
+    return true;
+}
+
+bool MsgPacket::put_Payload(const std::shared_ptr<MsgPacket>& source) {
+    uint32_t position = HeaderLength;
+
+    // reference inline parts of the source and take over its segments
+    for(auto& s : source->m_segments) {
+        if(!put_Segment(source, source->m_packet + position, s.position - position)) {
+            return false;
+        }
+
+        if(s.file) {
+            if(!put_FileSegment(s.file, s.offset, s.length)) {
+                return false;
+            }
+        }
+        else if(!put_Segment(s.owner, s.data, s.length)) {
+            return false;
+        }
+
+        position = s.position;
+    }
+
+    return put_Segment(source, source->m_packet + position, source->m_usage - position);
+}
+
+void MsgPacket::flatten() {
+    if(m_segments.empty()) {
+        return;
+    }
+
+    uint32_t length = m_usage + m_segmentLength;
+    uint32_t capacity = 0;
+    uint8_t* buffer = PacketPool::allocate(length, capacity);
+
+    if(buffer == NULL) {
+        return;
+    }
+
+    uint32_t position = 0;
+    uint32_t size = 0;
+
+    for(auto& s : m_segments) {
+        memcpy(buffer + size, m_packet + position, s.position - position);
+        size += s.position - position;
+        position = s.position;
+
+        if(s.file) {
+            if(!readFileSegment(s, buffer + size)) {
+                PacketPool::release(buffer);
+                return;
+            }
+        }
+        else {
+            memcpy(buffer + size, s.data, s.length);
+        }
+
+        size += s.length;
+    }
+
+    memcpy(buffer + size, m_packet + position, m_usage - position);
+
+    PacketPool::release(m_packet);
+    m_packet = buffer;
+    m_size = capacity;
+    m_usage = length;
+
+    m_segments.clear();
+    m_segmentLength = 0;
+    m_writePosition = 0;
+}
+
 void MsgPacket::clear() {
     m_usage = HeaderLength;
     m_readposition = HeaderLength;
+    m_segments.clear();
+    m_segmentLength = 0;
 }
 
 void MsgPacket::rewind() {
@@ -285,6 +403,26 @@ int64_t MsgPacket::get_S64() {
     get_impl(int64_t, be64toh);
 }
 
+uint64_t MsgPacket::get_VarU64() {
+    uint64_t ull = 0;
+
+    for(int shift = 0; shift < 64 && m_readposition < m_usage; shift += 7) {
+        uint8_t c = m_packet[m_readposition++];
+        ull |= (uint64_t)(c & 0x7F) << shift;
+
+        if(!(c & 0x80)) {
+            break;
+        }
+    }
+
+    return ull;
+}
+
+int64_t MsgPacket::get_VarS64() {
+    uint64_t ull = get_VarU64();
+    return (int64_t)(ull >> 1) ^ -(int64_t)(ull & 1);
+}
+
 bool MsgPacket::get_Blob(uint8_t dest[], uint32_t length) {
     if((m_readposition + length) > m_usage) {
         return false;
@@ -297,19 +435,21 @@ bool MsgPacket::get_Blob(uint8_t dest[], uint32_t length) {
 }
 
 uint8_t* MsgPacket::getPacket() {
+    flatten();
     return m_packet;
 }
 
 uint32_t MsgPacket::getPacketLength() {
-    return m_usage;
+    return m_usage + m_segmentLength;
 }
 
 uint8_t* MsgPacket::getPayload() {
+    flatten();
     return m_packet + HeaderLength;
 }
 
 uint32_t MsgPacket::getPayloadLength() {
-    return m_usage - HeaderLength;
+    return m_usage + m_segmentLength - HeaderLength;
 }
 
 uint32_t MsgPacket::getUID() {
@@ -356,18 +496,54 @@ void MsgPacket::freeze() {
     uint32_t payloadCheckSum = 0;
 
     if(getPayloadLength() > 0 && m_payloadchecksum) {
-        payloadCheckSum = crc32(m_packet + HeaderLength, m_usage - HeaderLength);
+        payloadCheckSum = calcPayloadCheckSum();
     }
 
     writePacket<uint32_t>(PayloadCheckSumPos, htobe32(payloadCheckSum));
-    writePacket<uint32_t>(PayloadLengthPos, htobe32(m_usage - HeaderLength));
+    writePacket<uint32_t>(PayloadLengthPos, htobe32(getPayloadLength()));
     writePacket<uint32_t>(CheckSumPos, htobe32(crc32(m_packet, CheckSumPos)));
 
     m_freezed = true;
 }
 
+uint32_t MsgPacket::calcPayloadCheckSum() {
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t position = HeaderLength;
+
+    for(auto& s : m_segments) {
+        crc = crc32Update(crc, m_packet + position, s.position - position);
+        position = s.position;
+
+        if(!s.file) {
+            crc = crc32Update(crc, s.data, s.length);
+            continue;
+        }
+
+        // file data is read for the checksum only
+        uint32_t capacity = 0;
+        uint8_t* buffer = PacketPool::allocate(s.length, capacity);
+
+        if(buffer != NULL && readFileSegment(s, buffer)) {
+            crc = crc32Update(crc, buffer, s.length);
+        }
+
+        PacketPool::release(buffer);
+    }
+
+    crc = crc32Update(crc, m_packet + position, m_usage - position);
+    return (crc ^ ~0U);
+}
+
+bool MsgPacket::validatePayloadCheckSum() {
+    if(!m_payloadchecksum || getPayloadLength() == 0) {
+        return true;
+    }
+
+    return (getPayloadCheckSum() == calcPayloadCheckSum());
+}
+
 bool MsgPacket::checkPacketSize(uint32_t bytes) {
-    if(bytes == 0) {
+    if(bytes == 0 || !m_ownsBuffer) {
         return false;
     }
 
@@ -379,94 +555,193 @@ bool MsgPacket::checkPacketSize(uint32_t bytes) {
         bytes = IncrementPacketSize;
     }
 
-    uint8_t* buffer = (uint8_t*)realloc((void*)m_packet, m_usage + bytes);
+    uint32_t capacity = 0;
+    uint8_t* buffer = PacketPool::reallocate(m_packet, m_usage, m_usage + bytes, capacity);
 
     if(buffer == NULL) {
-        buffer = (uint8_t*)malloc(m_usage + bytes);
-
-        if(buffer == NULL) {
-            return false;
-        }
-
-        memcpy(buffer, m_packet, m_usage);
-        free(m_packet);
+        return false;
     }
 
     m_packet = buffer;
-    m_size = m_usage + bytes;
+    m_size = capacity;
     return true;
 }
 
 uint32_t MsgPacket::crc32(const uint8_t* buf, int size) {
-    uint32_t crc = 0xFFFFFFFF;
-    const uint8_t* p = buf;
-
-    while(size--) {
-        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-    }
+    return ::crc32(buf, size);
+}
 
-    return (crc ^ ~0U);
+uint32_t MsgPacket::crc32Update(uint32_t crc, const uint8_t* buf, int size) {
+    return ::crc32Update(crc, buf, size);
 }
 
 bool MsgPacket::write(int fd, int timeout_ms) {
-    freeze();
+    bool complete = false;
 
-    uint32_t written = 0;
+    while(writeNonBlocking(fd, complete)) {
+        if(complete) {
+            return true;
+        }
 
-    while(written < m_usage) {
         if(pollfd(fd, timeout_ms, false) == 0) {
             return false;
         }
+    }
+
+    return false;
+}
+
+bool MsgPacket::writeNonBlocking(int fd, bool& complete) {
+    freeze();
+
+    std::vector<struct iovec> iov;
+    iov.reserve(m_segments.size() * 2 + 1);
+
+    // file segments are sent with sendfile (their iov_base is NULL)
+    std::vector<const Segment*> files;
+    files.reserve(m_segments.size() * 2 + 1);
+
+    uint32_t position = 0;
+
+    for(auto& s : m_segments) {
+        iov.push_back({m_packet + position, s.position - position});
+        files.push_back(NULL);
+
+        iov.push_back({s.data, s.length});
+        files.push_back(s.file ? &s : NULL);
+
+        position = s.position;
+    }
+
+    iov.push_back({m_packet + position, m_usage - position});
+    files.push_back(NULL);
+
+    // skip data written by previous calls
+    size_t index = 0;
+    uint32_t skip = m_writePosition;
+
+    while(index < iov.size() && skip >= iov[index].iov_len) {
+        skip -= iov[index].iov_len;
+        index++;
+    }
+
+    if(index < iov.size()) {
+        iov[index].iov_base = (uint8_t*)iov[index].iov_base + skip;
+        iov[index].iov_len -= skip;
+    }
 
-        int rc = send(fd, (sendval_t*)(m_packet + written), m_usage - written, MSG_DONTWAIT | MSG_NOSIGNAL);
+    complete = false;
 
-        if(rc == -1 && sockerror() == ENOTSOCK) {
-            rc = ::write(fd, m_packet + written, m_usage - written);
+    while(index < iov.size()) {
+        // skip empty buffers
+        if(iov[index].iov_len == 0) {
+            index++;
+            continue;
+        }
+
+        ssize_t rc = 0;
+
+        if(files[index] != NULL) {
+            rc = writeFileSegment(fd, *files[index], files[index]->length - iov[index].iov_len, iov[index].iov_len);
+        }
+        else {
+            // send memory buffers up to the next file segment
+            size_t count = 0;
+
+            while(index + count < iov.size() && files[index + count] == NULL && count < IOV_MAX) {
+                count++;
+            }
+
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov[index];
+            msg.msg_iovlen = count;
+
+            rc = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+            if(rc == -1 && sockerror() == ENOTSOCK) {
+                rc = ::writev(fd, msg.msg_iov, msg.msg_iovlen);
+            }
         }
 
         if(rc == -1 || rc == 0) {
-            if(sockerror() == SEWOULDBLOCK) {
-                continue;
+            if(sockerror() == SEWOULDBLOCK || sockerror() == EINTR) {
+                ROBOTV_TRACE5(packet_write, fd, getMsgID(), getUID(), m_writePosition, 0);
+                return true;
             }
 
             return false;
         }
 
-        written += rc;
+        m_writePosition += rc;
+
+        // skip fully written buffers, adjust partially written one
+        while(index < iov.size() && rc >= (ssize_t)iov[index].iov_len) {
+            rc -= iov[index].iov_len;
+            index++;
+        }
+
+        if(rc > 0) {
+            iov[index].iov_base = (uint8_t*)iov[index].iov_base + rc;
+            iov[index].iov_len -= rc;
+        }
     }
 
+    complete = true;
+    ROBOTV_TRACE5(packet_write, fd, getMsgID(), getUID(), m_writePosition, 1);
+
     return true;
 }
 
+ssize_t MsgPacket::writeFileSegment(int fd, const Segment& s, uint32_t skip, uint32_t length) {
+#ifndef __FreeBSD__
+    off_t offset = s.offset + skip;
+    ssize_t rc = sendfile(fd, *s.file, &offset, length);
+
+    if(rc != -1 || (sockerror() != EINVAL && sockerror() != ENOSYS)) {
+        return rc;
+    }
+#endif
+
+    // no sendfile support for this descriptor: read and send a part of the range
+    uint8_t buffer[64 * 1024];
+    ssize_t bytes = pread(*s.file, buffer, std::min(length, (uint32_t)sizeof(buffer)), s.offset + skip);
+
+    if(bytes <= 0) {
+        return -1;
+    }
+
+    ssize_t sent = send(fd, buffer, bytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if(sent == -1 && sockerror() == ENOTSOCK) {
+        sent = ::write(fd, buffer, bytes);
+    }
+
+    return sent;
+}
+
 MsgPacket* MsgPacket::read(int fd, int timeout_ms) {
     bool bClosed;
     return read(fd, bClosed, timeout_ms);
 }
 
-MsgPacket* MsgPacket::read(int fd, bool& closed, int timeout_ms) {
+bool MsgPacket::readHeader(int fd, uint8_t* header, bool& closed, int timeout_ms, int dataTimeout_ms) {
     if(pollfd(fd, timeout_ms, true) <= 0) {
-        return NULL;
-    }
-
-    MsgPacket* p = new MsgPacket(0, 0, 1);
-
-    if(p == NULL) {
-        return NULL;
+        return false;
     }
 
-    uint8_t* header = p->getPacket();
-
-    if(header == NULL) {
-        return NULL;
+    if(dataTimeout_ms == -1) {
+        dataTimeout_ms = timeout_ms;
     }
 
     // try to find sync
     int rc = 0;
+    uint32_t sync = 0;
 
-    while((rc = socketread(fd, header, sizeof(uint32_t), timeout_ms)) == 0) {
-        uint32_t sync = be32toh(p->readPacket<uint32_t>(0));
+    while((rc = socketread(fd, header, sizeof(uint32_t), dataTimeout_ms)) == 0) {
+        memcpy(&sync, header, sizeof(sync));
 
-        if(sync == 0xAAAAAA) {
+        if(be32toh(sync) == 0xAAAAAA) {
             break;
         }
     }
@@ -474,63 +749,151 @@ MsgPacket* MsgPacket::read(int fd, bool& closed, int timeout_ms) {
     // not found / timeout
     if(rc != 0) {
         closed = (rc == ECONNRESET);
-        delete p;
-        return NULL;
+        return false;
     }
 
     // read remaining header bytes
-    uint8_t* data = header + sizeof(uint32_t);
-    uint32_t datalen = HeaderLength - sizeof(uint32_t);
-
-    if(socketread(fd, data, datalen, timeout_ms) != 0) {
-        delete p;
-        return NULL;
+    if(socketread(fd, header + sizeof(uint32_t), HeaderLength - sizeof(uint32_t), dataTimeout_ms) != 0) {
+        return false;
     }
 
     // header validation
-    uint32_t checksum = p->getCheckSum();
-    datalen = be32toh(p->readPacket<uint32_t>(PayloadLengthPos));
+    uint32_t checksum = 0;
+    memcpy(&checksum, header + CheckSumPos, sizeof(checksum));
+    checksum = be32toh(checksum);
+
     uint32_t test = crc32(header, CheckSumPos);
 
     if(checksum != test) {
         std::cerr << "checksum failed !" << std::endl;
         std::cerr << "PACKET CHECKSUM  : " << std::hex << checksum << std::endl;
         std::cerr << "COMPUTED CHECKSUM: " << std::hex << test << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t MsgPacket::getPayloadLength(const uint8_t* header) {
+    uint32_t length = 0;
+    memcpy(&length, header + PayloadLengthPos, sizeof(length));
+    return be32toh(length);
+}
+
+bool MsgPacket::readPayload(int fd, uint8_t* data, uint32_t length, int timeout_ms) {
+    if(length == 0) {
+        return true;
+    }
+
+    if(socketread(fd, data, length, timeout_ms) != 0) {
+        return false;
+    }
+
+    // payload checksum validation
+    uint32_t plcs = getPayloadCheckSum();
+    m_payloadchecksum = (plcs != 0);
+
+    if(m_payloadchecksum && plcs != crc32(data, length)) {
+        std::cerr << "wrong payload checksum !" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+MsgPacket* MsgPacket::read(int fd, bool& closed, int timeout_ms, int dataTimeout_ms) {
+    MsgPacket* p = new MsgPacket(0, 0, 1);
+    uint8_t* header = p->getPacket();
+
+    if(header == NULL || !readHeader(fd, header, closed, timeout_ms, dataTimeout_ms)) {
         delete p;
         return NULL;
     }
 
+    if(dataTimeout_ms == -1) {
+        dataTimeout_ms = timeout_ms;
+    }
+
     // no payload ?
+    uint32_t datalen = getPayloadLength(header);
+
     if(datalen == 0) {
         return p;
     }
 
     // read payload
-    data = p->reserve(datalen);
+    uint8_t* data = p->reserve(datalen);
 
-    if(data == NULL) {
+    if(data == NULL || !p->readPayload(fd, data, datalen, dataTimeout_ms)) {
         delete p;
         return NULL;
     }
 
-    if(socketread(fd, data, datalen, timeout_ms) != 0) {
+    return p;
+}
+
+MsgPacket* MsgPacket::read(int fd, std::vector<uint8_t>& buffer, bool& closed, int timeout_ms, int dataTimeout_ms) {
+    if(buffer.size() < HeaderLength) {
+        buffer.resize(HeaderLength);
+    }
+
+    if(!readHeader(fd, buffer.data(), closed, timeout_ms, dataTimeout_ms)) {
+        return NULL;
+    }
+
+    if(dataTimeout_ms == -1) {
+        dataTimeout_ms = timeout_ms;
+    }
+
+    // grow the buffer to hold the complete packet
+    uint32_t datalen = getPayloadLength(buffer.data());
+
+    if(buffer.size() < HeaderLength + datalen) {
+        buffer.resize(HeaderLength + datalen);
+    }
+
+    MsgPacket* p = new MsgPacket(buffer.data(), HeaderLength + datalen);
+    p->m_usage = p->m_size;
+
+    if(!p->readPayload(fd, buffer.data() + HeaderLength, datalen, dataTimeout_ms)) {
         delete p;
         return NULL;
     }
 
-    // payload checksum validation
-    uint32_t plcs = p->getPayloadCheckSum();
-    p->m_payloadchecksum = (plcs != 0);
+    return p;
+}
 
-    if(p->m_payloadchecksum && p->getPayloadCheckSum() != crc32(data, datalen)) {
-        std::cerr << "wrong payload checksum !" << std::endl;
+MsgPacket* MsgPacket::view(uint8_t* buffer, uint32_t length) {
+    if(buffer == NULL || length < HeaderLength) {
+        return NULL;
+    }
+
+    MsgPacket* p = new MsgPacket(buffer, length);
+
+    // header validation
+    if(be32toh(p->readPacket<uint32_t>(SyncPos)) != 0xAAAAAA || p->getCheckSum() != crc32(buffer, CheckSumPos)) {
         delete p;
         return NULL;
     }
 
+    uint32_t datalen = be32toh(p->readPacket<uint32_t>(PayloadLengthPos));
+
+    if(datalen > length - HeaderLength) {
+        delete p;
+        return NULL;
+    }
+
+    p->m_size = HeaderLength + datalen;
+    p->m_usage = p->m_size;
+    p->m_payloadchecksum = (p->getPayloadCheckSum() != 0);
+
     return p;
 }
 
+bool MsgPacket::isView() {
+    return !m_ownsBuffer;
+}
+
 bool MsgPacket::readstream(std::istream& in, MsgPacket& p) {
     uint8_t* header = p.getPacket();
 
@@ -609,45 +972,167 @@ bool MsgPacket::readstream(std::istream& in, MsgPacket& p) {
     return true;
 }
 
+#ifdef HAVE_ZLIB
+
+// reusable per-thread zlib contexts (avoids the allocations of deflateInit / inflateInit)
+struct ZStreamContext {
+    z_stream deflater;
+    z_stream inflater;
+    int level = -1;
+    bool inflaterReady = false;
+
+    ~ZStreamContext() {
+        if(level != -1) {
+            deflateEnd(&deflater);
+        }
+
+        if(inflaterReady) {
+            inflateEnd(&inflater);
+        }
+    }
+
+    z_stream* getDeflater(int compressionLevel) {
+        if(level == compressionLevel) {
+            deflateReset(&deflater);
+            return &deflater;
+        }
+
+        if(level != -1) {
+            deflateEnd(&deflater);
+            level = -1;
+        }
+
+        memset(&deflater, 0, sizeof(deflater));
+
+        if(deflateInit(&deflater, compressionLevel) != Z_OK) {
+            return NULL;
+        }
+
+        level = compressionLevel;
+        return &deflater;
+    }
+
+    z_stream* getInflater() {
+        if(inflaterReady) {
+            inflateReset(&inflater);
+            return &inflater;
+        }
+
+        memset(&inflater, 0, sizeof(inflater));
+
+        if(inflateInit(&inflater) != Z_OK) {
+            return NULL;
+        }
+
+        inflaterReady = true;
+        return &inflater;
+    }
+};
+
+static thread_local ZStreamContext zcontext;
+
+#endif
+
 bool MsgPacket::compress(int level) {
 #ifndef HAVE_ZLIB
     return false;
 #else
 
-    if(level <= 0 || level > 9 || m_freezed) {
+    if(level <= 0 || level > 9 || m_freezed || !m_ownsBuffer) {
         return false;
     }
 
+    // the compressor needs the file data in memory
+    if(hasFileSegments()) {
+        flatten();
+
+        if(hasFileSegments()) {
+            return false;
+        }
+    }
+
     uint32_t uncompressedsize = getPayloadLength();
 
     if(uncompressedsize == 0) {
         return true;
     }
 
-    uint8_t* compressed = (uint8_t*)malloc(uncompressedsize);
-    uLongf compressedsize = uncompressedsize;
+    z_stream* z = zcontext.getDeflater(level);
 
-    if(compressed == NULL) {
-        return NULL;
+    if(z == NULL) {
+        return false;
     }
 
-    if(::compress2(compressed, &compressedsize, getPayload(), uncompressedsize, level) != Z_OK) {
-        free(compressed);
+    // the compressed data goes directly into the new packet buffer,
+    // which grows on demand (starting at a typical ratio)
+    uint32_t capacity = 0;
+    uint32_t usage = HeaderLength;
+    uint8_t* buffer = PacketPool::allocate(HeaderLength + uncompressedsize / 4 + IncrementPacketSize, capacity);
+
+    if(buffer == NULL) {
         return false;
     }
 
-    clear();
-    uint8_t* data = reserve(compressedsize);
+    memcpy(buffer, m_packet, HeaderLength);
 
-    if(data == NULL) {
-        free(compressed);
+    // feed the inline parts and the segments without flattening the packet
+    std::vector<std::pair<uint8_t*, uint32_t>> pieces;
+    uint32_t position = HeaderLength;
+
+    for(auto& seg : m_segments) {
+        pieces.push_back({m_packet + position, seg.position - position});
+        pieces.push_back({seg.data, seg.length});
+        position = seg.position;
+    }
+
+    pieces.push_back({m_packet + position, m_usage - position});
+
+    size_t piece = 0;
+    int rc = Z_OK;
+
+    for(;;) {
+        if(z->avail_in == 0 && piece < pieces.size()) {
+            z->next_in = pieces[piece].first;
+            z->avail_in = pieces[piece].second;
+            piece++;
+            continue;
+        }
+
+        if(usage == capacity) {
+            uint8_t* grown = PacketPool::reallocate(buffer, usage, capacity + capacity / 2, capacity);
+
+            if(grown == NULL) {
+                PacketPool::release(buffer);
+                return false;
+            }
+
+            buffer = grown;
+        }
+
+        z->next_out = buffer + usage;
+        z->avail_out = capacity - usage;
+
+        rc = deflate(z, (piece == pieces.size() && z->avail_in == 0) ? Z_FINISH : Z_NO_FLUSH);
+        usage = capacity - z->avail_out;
+
+        if(rc != Z_OK && rc != Z_BUF_ERROR) {
+            break;
+        }
+    }
+
+    if(rc != Z_STREAM_END) {
+        PacketPool::release(buffer);
         return false;
     }
 
-    memcpy(data, compressed, compressedsize);
-    free(compressed);
+    PacketPool::release(m_packet);
+    m_packet = buffer;
+    m_size = capacity;
+    m_usage = usage;
+    m_readposition = HeaderLength;
+    m_segments.clear();
+    m_segmentLength = 0;
 
-    m_freezed = false;
     writePacket<uint32_t>(UncompressedPayloadLengthPos, htobe32(uncompressedsize));
     freeze();
 
@@ -663,24 +1148,47 @@ bool MsgPacket::uncompress() {
 #ifndef HAVE_ZLIB
     return false;
 #else
-    uLongf uncompressedsize = be32toh(readPacket<uint32_t>(UncompressedPayloadLengthPos));
-    uint8_t* uncompressed = (uint8_t*)malloc(uncompressedsize);
+    uint32_t uncompressedsize = be32toh(readPacket<uint32_t>(UncompressedPayloadLengthPos));
+
+    if(uncompressedsize == 0) {
+        return true;
+    }
 
-    if(::uncompress(uncompressed, &uncompressedsize, getPayload(), getPayloadLength()) != Z_OK) {
-        free(uncompressed);
+    z_stream* z = zcontext.getInflater();
+
+    if(z == NULL) {
         return false;
     }
 
-    clear();
-    uint8_t* data = reserve(uncompressedsize);
+    // inflate directly into the new packet buffer
+    uint32_t capacity = 0;
+    uint8_t* buffer = PacketPool::allocate(HeaderLength + uncompressedsize, capacity);
 
-    if(data == NULL) {
-        free(uncompressed);
+    if(buffer == NULL) {
+        return false;
+    }
+
+    memcpy(buffer, m_packet, HeaderLength);
+
+    z->next_in = getPayload();
+    z->avail_in = getPayloadLength();
+    z->next_out = buffer + HeaderLength;
+    z->avail_out = uncompressedsize;
+
+    if(inflate(z, Z_FINISH) != Z_STREAM_END || z->avail_out != 0) {
+        PacketPool::release(buffer);
         return false;
     }
 
-    memcpy(data, uncompressed, uncompressedsize);
-    free(uncompressed);
+    if(m_ownsBuffer) {
+        PacketPool::release(m_packet);
+    }
+
+    m_packet = buffer;
+    m_size = capacity;
+    m_usage = HeaderLength + uncompressedsize;
+    m_readposition = HeaderLength;
+    m_ownsBuffer = true;
 
     writePacket<uint32_t>(UncompressedPayloadLengthPos, htobe32(0));
 
@@ -7,9 +7,12 @@
 #define MSGPACKET_H
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <pthread.h>
 #include <string.h>
 #include <string>
+#include <memory>
+#include <vector>
 
 #include <ostream>
 #include <istream>
@@ -140,6 +143,25 @@ public:
     */
     bool put_S64(int64_t ll);
 
+    /**
+    Insert unsigned variable length integer.
+    Adds an unsigned number to the payload of the packet (7 bits per byte,
+    least significant group first, the highest bit marks a following byte).
+
+    @param	ull		unsigned 64bit number
+    @return true on success / false on memory allocation error
+    */
+    bool put_VarU64(uint64_t ull);
+
+    /**
+    Insert signed variable length integer.
+    Adds a zigzag encoded signed number (small negative numbers take few bytes).
+
+    @param	ll		signed 64bit number
+    @return true on success / false on memory allocation error
+    */
+    bool put_VarS64(int64_t ll);
+
     /**
     Insert a binary large object.
     Adds a binary object to the payload of the packet.
@@ -150,6 +172,50 @@ public:
     */
     bool put_Blob(uint8_t source[], uint32_t length);
 
+    /**
+    Put a reference to external data into the packet.
+    The data is not copied but appended as a segment. The segment keeps a
+    reference to the packet owning the data and is sent with writev.
+
+    @param	owner		packet owning the data
+    @param	data		pointer to the data
+    @param	length		length of the data in bytes
+    @return true on success
+    */
+    bool put_Segment(const std::shared_ptr<MsgPacket>& owner, uint8_t* data, uint32_t length);
+
+    /**
+    Put a range of a file into the packet.
+    The data is not read but appended as a segment and sent with sendfile.
+    The segment keeps a reference to the file descriptor.
+
+    @param	file		file descriptor (closed with the last reference)
+    @param	offset		start of the range in the file
+    @param	length		length of the range in bytes
+    @return true on success
+    */
+    bool put_FileSegment(const std::shared_ptr<int>& file, off_t offset, uint32_t length);
+
+    /**
+    Check for file segments.
+    @return true if the packet references file data
+    */
+    bool hasFileSegments() const;
+
+    /**
+    Put the payload of another packet into the packet.
+    The payload (including its segments) is referenced, not copied.
+
+    @param	source		packet holding the payload
+    @return true on success
+    */
+    bool put_Payload(const std::shared_ptr<MsgPacket>& source);
+
+    /**
+    Merge all segments into the packet buffer.
+    */
+    void flatten();
+
     /**
     Reserve space.
     Creates a memory region in the payload of the packet.
@@ -256,6 +322,18 @@ public:
     */
     int64_t get_S64();
 
+    /**
+    Extract unsigned variable length integer.
+    @return unsigned number at current payload position
+    */
+    uint64_t get_VarU64();
+
+    /**
+    Extract signed variable length integer (zigzag encoded).
+    @return signed number at current payload position
+    */
+    int64_t get_VarS64();
+
     /**
     Extract binary large object.
     Copy "length" bytes from the current payload position to "dest". The internal payload pointer will be incremented
@@ -376,6 +454,15 @@ public:
     */
     void disablePayloadCheckSum();
 
+    /**
+    Validate the payload checksum.
+    Recalculates the checksum of the payload and compares it to the one
+    stored in the header. Packets without a payload checksum are always valid.
+
+    @return true if the payload is intact
+    */
+    bool validatePayloadCheckSum();
+
     /**
     Get protocol version.
     Return the user defined protocol version
@@ -438,6 +525,24 @@ public:
     */
     bool write(int fd, int timeout_ms = 3000);
 
+    /**
+    Write packet to socket without blocking.
+    Writes as much packet data as the socket accepts. Subsequent calls
+    continue at the position the previous call stopped at.
+
+    @param	fd		filedescriptor of the socket
+    @param	complete	set to true if the whole packet has been written
+    @return false on error
+    */
+    bool writeNonBlocking(int fd, bool& complete);
+
+    /**
+    Number of bytes already written to the socket.
+    */
+    uint32_t getWritePosition() const {
+        return m_writePosition;
+    }
+
     /**
     Receive packet from socket.
     Create a new packet from incoming socket data
@@ -455,12 +560,88 @@ public:
     @param	fd			filedescriptor of the socket
     @param	closed		set to true if connection has been closed
     @param	timeout_ms	read operation timeout in milliseconds
+    @param	dataTimeout_ms	timeout for the remaining data once the packet started (-1: timeout_ms)
     @return pointer to new packet or NULL on timeout
     */
-    static MsgPacket* read(int fd, bool& closed, int timeout_ms = 3000);
+    static MsgPacket* read(int fd, bool& closed, int timeout_ms = 3000, int dataTimeout_ms = -1);
+
+    /**
+    Receive packet into a caller-provided buffer.
+    Reads the packet straight into the buffer (growing it if needed) and
+    returns a view on it. The view is valid until the buffer is reused.
+
+    @param	fd			filedescriptor of the socket / file
+    @param	buffer		reusable receive buffer
+    @param	closed		set to true if connection has been closed
+    @param	timeout_ms	read operation timeout in milliseconds
+    @param	dataTimeout_ms	timeout for the remaining data once the packet started (-1: timeout_ms)
+    @return pointer to new packet view or NULL on timeout / error
+    */
+    static MsgPacket* read(int fd, std::vector<uint8_t>& buffer, bool& closed, int timeout_ms = 3000, int dataTimeout_ms = -1);
+
+    /**
+    Receive a packet header.
+    Synchronizes on the next packet and reads and validates its header.
+    The payload is left unread.
+
+    @param	fd			filedescriptor of the socket / file
+    @param	header		buffer for HeaderLength bytes
+    @param	closed		set to true if connection has been closed
+    @param	timeout_ms	read operation timeout in milliseconds
+    @param	dataTimeout_ms	timeout for the remaining data once the packet started (-1: timeout_ms)
+    @return true if a valid header has been read
+    */
+    static bool readHeader(int fd, uint8_t* header, bool& closed, int timeout_ms = 3000, int dataTimeout_ms = -1);
+
+    /**
+    Get payload length from a raw packet header.
+
+    @param	header		packet header
+    @return length of the payload in bytes
+    */
+    static uint32_t getPayloadLength(const uint8_t* header);
 
     static bool readstream(std::istream& in, MsgPacket& p);
 
+    /**
+    Create a packet view on existing data.
+    Creates a read-only packet referencing a complete (frozen) packet in
+    the given buffer. The buffer is not copied and must outlive the view.
+
+    @param	buffer		pointer to the packet header
+    @param	length		number of bytes available in the buffer
+    @return pointer to new packet view or NULL if there isn't a valid packet
+    */
+    static MsgPacket* view(uint8_t* buffer, uint32_t length);
+
+    /**
+    Check for a packet view.
+
+    @return true if the packet doesn't own its data
+    */
+    bool isView();
+
+    /**
+    Set trace information.
+    Marks the packet for latency tracing. The values are kept in memory
+    only and are not transmitted.
+
+    @param	channelUid	uid of the channel the packet belongs to
+    @param	timestamp	creation time of the (oldest) traced data in ms
+    */
+    void setTrace(uint32_t channelUid, int64_t timestamp) {
+        m_traceChannel = channelUid;
+        m_traceTime = timestamp;
+    }
+
+    uint32_t getTraceChannel() const {
+        return m_traceChannel;
+    }
+
+    int64_t getTraceTime() const {
+        return m_traceTime;
+    }
+
     enum {
         HeaderLength = 32,						/*!< Length (in bytes) of a packet header. */
         CheckSumPos = 28,						/*!< Checksum position (uint32_t) within the header data. */
@@ -477,6 +658,8 @@ public:
 
 protected:
 
+    MsgPacket(uint8_t* buffer, uint32_t length);
+
     void Init(uint16_t msgid, uint16_t type = 0, uint32_t uid = 0);
 
     /**
@@ -496,6 +679,8 @@ protected:
     */
     static uint32_t crc32(const uint8_t* buf, int size);
 
+    static uint32_t crc32Update(uint32_t crc, const uint8_t* buf, int size);
+
     static int read(int fd, uint8_t* data, int datalen, int timeout_ms);
 
 private:
@@ -514,8 +699,11 @@ private:
 
     bool checkPacketSize(uint32_t bytes);
 
+    uint32_t calcPayloadCheckSum();
+
+    bool readPayload(int fd, uint8_t* data, uint32_t length, int timeout_ms);
+
     static uint32_t globalUID;
-    static uint32_t crc32_tab[];
 
     uint8_t* m_packet;
     uint32_t m_size;
@@ -524,6 +712,27 @@ private:
 
     bool m_freezed;
     bool m_payloadchecksum;
+    bool m_ownsBuffer;
+
+    struct Segment {
+        std::shared_ptr<MsgPacket> owner;
+        uint8_t* data;
+        uint32_t length;
+        uint32_t position;
+        std::shared_ptr<int> file;
+        off_t offset;
+    };
+
+    static bool readFileSegment(const Segment& s, uint8_t* buffer);
+
+    static ssize_t writeFileSegment(int fd, const Segment& s, uint32_t skip, uint32_t length);
+
+    std::vector<Segment> m_segments;
+    uint32_t m_segmentLength;
+    uint32_t m_writePosition;
+
+    uint32_t m_traceChannel = 0;
+    int64_t m_traceTime = 0;
 
     enum {
         InitialPacketSize = 128,
@@ -565,6 +774,8 @@ class MsgPacket {
 +bool put_S32(int32_t l)
 +bool put_U64(uint64_t ull)
 +bool put_S64(int64_t ll)
++bool put_VarU64(uint64_t ull)
++bool put_VarS64(int64_t ll)
 +bool put_Blob(uint8_t source[], uint32_t length)
 .. data getters ..
 +const char* get_String()
@@ -575,6 +786,8 @@ class MsgPacket {
 +int32_t get_S32()
 +uint64_t get_U64()
 +int64_t get_S64()
++uint64_t get_VarU64()
++int64_t get_VarS64()
 +bool get_Blob(uint8_t dest[], uint32_t length)
 .. memory allocation ..
 +uint8_t* reserve(uint32_t length, bool fill, unsigned char c)
@@ -0,0 +1,155 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_MSGPACKETWRITER_H
+#define ROBOTV_MSGPACKETWRITER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#include "msgpacket.h"
+
+/**
+ * Bulk writer for message packets.
+ * Reserves the space of several fields at once and writes the fields to a
+ * cursor (big endian, like the put_ functions of MsgPacket) without
+ * further bounds checks or reallocations. Unused space is returned to the
+ * packet by commit() (or the destructor).
+ *
+ * The caller has to reserve enough space for all fields (see the size
+ * helpers) and must not modify the packet while the writer is active.
+ */
+class MsgPacketWriter {
+public:
+
+    /** Reserve space for the fields.
+     @param packet packet to write to
+     @param length maximum number of bytes written
+     */
+    MsgPacketWriter(MsgPacket* packet, uint32_t length) : m_packet(packet) {
+        m_cursor = packet->reserve(length);
+        m_end = (m_cursor != NULL) ? m_cursor + length : NULL;
+    }
+
+    ~MsgPacketWriter() {
+        commit();
+    }
+
+    /** Check if the space could be reserved */
+    bool valid() const {
+        return m_cursor != NULL;
+    }
+
+    /** Number of bytes left in the reserved space */
+    uint32_t remaining() const {
+        return m_end - m_cursor;
+    }
+
+    /** Return the unused space to the packet.
+     The writer can't be used afterwards.
+     */
+    void commit() {
+        if(m_packet == NULL) {
+            return;
+        }
+
+        if(m_cursor != NULL) {
+            m_packet->unreserve(remaining());
+        }
+
+        m_packet = NULL;
+        m_cursor = m_end = NULL;
+    }
+
+    void put_U8(uint8_t c) {
+        *m_cursor++ = c;
+    }
+
+    void put_U16(uint16_t us) {
+        m_cursor[0] = us >> 8;
+        m_cursor[1] = us;
+        m_cursor += 2;
+    }
+
+    void put_S16(int16_t s) {
+        put_U16((uint16_t)s);
+    }
+
+    void put_U32(uint32_t ul) {
+        m_cursor[0] = ul >> 24;
+        m_cursor[1] = ul >> 16;
+        m_cursor[2] = ul >> 8;
+        m_cursor[3] = ul;
+        m_cursor += 4;
+    }
+
+    void put_S32(int32_t l) {
+        put_U32((uint32_t)l);
+    }
+
+    void put_U64(uint64_t ull) {
+        put_U32((uint32_t)(ull >> 32));
+        put_U32((uint32_t)ull);
+    }
+
+    void put_S64(int64_t ll) {
+        put_U64((uint64_t)ll);
+    }
+
+    /** NULL terminated string (see sizeOf) */
+    void put_String(const char* string, uint32_t length) {
+        memcpy(m_cursor, string, length);
+        m_cursor += length;
+    }
+
+    void put_String(const std::string& string) {
+        put_String(string.c_str(), string.size() + 1);
+    }
+
+    void put_Blob(const uint8_t* source, uint32_t length) {
+        memcpy(m_cursor, source, length);
+        m_cursor += length;
+    }
+
+    /** Size of a string in the packet (including the terminating NULL) */
+    static uint32_t sizeOf(const char* string) {
+        return strlen(string) + 1;
+    }
+
+    static uint32_t sizeOf(const std::string& string) {
+        return string.size() + 1;
+    }
+
+private:
+
+    MsgPacket* m_packet;
+
+    uint8_t* m_cursor;
+
+    uint8_t* m_end;
+
+};
+
+#endif // ROBOTV_MSGPACKETWRITER_H
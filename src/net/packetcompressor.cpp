@@ -0,0 +1,81 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include "packetcompressor.h"
+#include "msgpacket.h"
+
+PacketCompressor::PacketCompressor(int workerCount) {
+    for(int i = 0; i < workerCount; i++) {
+        m_workers.push_back(new std::thread([&]() {
+            workerLoop();
+        }));
+    }
+}
+
+PacketCompressor::~PacketCompressor() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        m_condition.notify_all();
+    }
+
+    for(auto t : m_workers) {
+        t->join();
+        delete t;
+    }
+}
+
+PacketCompressor& PacketCompressor::instance() {
+    static PacketCompressor compressor;
+    return compressor;
+}
+
+void PacketCompressor::compress(MsgPacket* p, int level, Callback done) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back({p, level, done});
+    m_condition.notify_one();
+}
+
+void PacketCompressor::workerLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // pending jobs are finished on shutdown, their owners wait for them
+    while(m_running || !m_jobs.empty()) {
+        if(m_jobs.empty()) {
+            m_condition.wait(lock);
+            continue;
+        }
+
+        Job job = m_jobs.front();
+        m_jobs.pop_front();
+
+        lock.unlock();
+
+        job.packet->compress(job.level);
+        job.done(job.packet);
+
+        lock.lock();
+    }
+}
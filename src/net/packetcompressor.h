@@ -0,0 +1,86 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_PACKETCOMPRESSOR_H
+#define ROBOTV_PACKETCOMPRESSOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class MsgPacket;
+
+/**
+ * Background packet compression.
+ * Compresses the payload of packets on a small pool of worker threads,
+ * so the I/O workers of the reactor are not blocked by zlib.
+ */
+class PacketCompressor {
+public:
+
+    typedef std::function<void(MsgPacket*)> Callback;
+
+    /** Queue a packet for compression.
+     The packet must not be modified until the callback has been called.
+     @param p packet to compress
+     @param level compression level (1 - 9)
+     @param done called from a worker thread when the packet has been processed
+     */
+    void compress(MsgPacket* p, int level, Callback done);
+
+    static PacketCompressor& instance();
+
+    virtual ~PacketCompressor();
+
+protected:
+
+    PacketCompressor(int workerCount = 2);
+
+private:
+
+    struct Job {
+        MsgPacket* packet;
+        int level;
+        Callback done;
+    };
+
+    void workerLoop();
+
+    bool m_running = true;
+
+    std::vector<std::thread*> m_workers;
+
+    std::deque<Job> m_jobs;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_condition;
+
+};
+
+#endif // ROBOTV_PACKETCOMPRESSOR_H
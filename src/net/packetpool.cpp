@@ -0,0 +1,209 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "config/config.h"
+#include "packetpool.h"
+
+std::vector<PacketPool::Header*> PacketPool::m_global[PacketPool::ClassCount];
+std::mutex PacketPool::m_mutex;
+std::atomic<uint64_t> PacketPool::m_allocations(0);
+std::atomic<uint64_t> PacketPool::m_threadHits(0);
+std::atomic<uint64_t> PacketPool::m_globalHits(0);
+std::atomic<uint64_t> PacketPool::m_misses(0);
+std::atomic<uint64_t> PacketPool::m_releases(0);
+std::atomic<uint64_t> PacketPool::m_bytesInUse(0);
+
+static thread_local bool threadCacheDestroyed = false;
+
+PacketPool::ThreadCache::~ThreadCache() {
+    threadCacheDestroyed = true;
+
+    // hand cached buffers over to the global cache
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for(int c = 0; c < ClassCount; c++) {
+        for(auto h : free[c]) {
+            if(m_global[c].size() < GlobalCacheSize) {
+                m_global[c].push_back(h);
+            }
+            else {
+                ::free(h);
+            }
+        }
+    }
+}
+
+PacketPool::ThreadCache& PacketPool::threadCache() {
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+int PacketPool::sizeClass(uint32_t size) {
+    for(int c = 0; c < ClassCount; c++) {
+        if(size <= (1U << (c + MinClassShift))) {
+            return c;
+        }
+    }
+
+    return LargeClass;
+}
+
+uint8_t* PacketPool::allocate(uint32_t size, uint32_t& capacity) {
+    int c = sizeClass(size);
+    Header* h = NULL;
+
+    m_allocations++;
+
+    if(c != LargeClass) {
+        std::vector<Header*>* local = threadCacheDestroyed ? NULL : &threadCache().free[c];
+
+        // per-thread cache
+        if(local != NULL && !local->empty()) {
+            h = local->back();
+            local->pop_back();
+            m_threadHits++;
+        }
+        // global cache
+        else {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if(!m_global[c].empty()) {
+                h = m_global[c].back();
+                m_global[c].pop_back();
+                m_globalHits++;
+            }
+        }
+    }
+
+    if(h == NULL) {
+        uint32_t blockSize = (c != LargeClass) ? (1U << (c + MinClassShift)) : size;
+        h = (Header*)malloc(sizeof(Header) + blockSize);
+
+        if(h == NULL) {
+            return NULL;
+        }
+
+        h->sizeClass = c;
+        h->capacity = blockSize;
+        m_misses++;
+    }
+
+    capacity = h->capacity;
+    m_bytesInUse += capacity;
+
+    return (uint8_t*)(h + 1);
+}
+
+uint8_t* PacketPool::reallocate(uint8_t* buffer, uint32_t used, uint32_t size, uint32_t& capacity) {
+    if(buffer == NULL) {
+        return allocate(size, capacity);
+    }
+
+    Header* h = ((Header*)buffer) - 1;
+
+    if(size <= h->capacity) {
+        capacity = h->capacity;
+        return buffer;
+    }
+
+    // large buffers grow by at least a quarter, many small steps would copy them over and over
+    if(sizeClass(size) == LargeClass) {
+        size = std::max<uint32_t>(size, h->capacity + h->capacity / 4);
+    }
+
+    uint8_t* result = allocate(size, capacity);
+
+    if(result == NULL) {
+        return NULL;
+    }
+
+    memcpy(result, buffer, used);
+    release(buffer);
+
+    return result;
+}
+
+void PacketPool::release(uint8_t* buffer) {
+    if(buffer == NULL) {
+        return;
+    }
+
+    Header* h = ((Header*)buffer) - 1;
+
+    m_releases++;
+    m_bytesInUse -= h->capacity;
+
+    if(h->sizeClass == LargeClass) {
+        free(h);
+        return;
+    }
+
+    if(!threadCacheDestroyed) {
+        std::vector<Header*>& local = threadCache().free[h->sizeClass];
+
+        if(local.size() < ThreadCacheSize) {
+            local.push_back(h);
+            return;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if(m_global[h->sizeClass].size() < GlobalCacheSize) {
+            m_global[h->sizeClass].push_back(h);
+            return;
+        }
+    }
+
+    free(h);
+}
+
+PacketPool::Statistics PacketPool::statistics() {
+    return {
+        m_allocations,
+        m_threadHits,
+        m_globalHits,
+        m_misses,
+        m_releases,
+        m_bytesInUse
+    };
+}
+
+void PacketPool::logStatistics() {
+    Statistics s = statistics();
+
+    INFOLOG("packet pool: %lu allocations (%lu thread hits, %lu global hits, %lu misses), %lu releases, %lu bytes in use",
+            (unsigned long)s.allocations,
+            (unsigned long)s.threadHits,
+            (unsigned long)s.globalHits,
+            (unsigned long)s.misses,
+            (unsigned long)s.releases,
+            (unsigned long)s.bytesInUse);
+}
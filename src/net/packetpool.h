@@ -0,0 +1,132 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_PACKETPOOL_H
+#define ROBOTV_PACKETPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+	@short Size-class pool for packet buffers
+
+	Buffers are rounded up to power-of-two size classes (256 bytes - 1 MB).
+	Released buffers are kept in a small per-thread cache and a global
+	cache per class. Larger buffers are passed to malloc / free directly.
+*/
+
+class PacketPool {
+public:
+
+    struct Statistics {
+        uint64_t allocations;
+        uint64_t threadHits;
+        uint64_t globalHits;
+        uint64_t misses;
+        uint64_t releases;
+        uint64_t bytesInUse;
+    };
+
+    /**
+    Allocate a buffer.
+
+    @param	size		requested size in bytes
+    @param	capacity	set to the usable size of the buffer
+    @return pointer to the buffer or NULL
+    */
+    static uint8_t* allocate(uint32_t size, uint32_t& capacity);
+
+    /**
+    Resize a buffer.
+    The buffer is returned unchanged if it already fits. Buffers beyond the
+    largest size class grow by at least a quarter of their capacity.
+
+    @param	buffer		buffer to resize (may be NULL)
+    @param	used		number of bytes to preserve
+    @param	size		requested size in bytes
+    @param	capacity	set to the usable size of the buffer
+    @return pointer to the buffer or NULL (the old buffer is still valid)
+    */
+    static uint8_t* reallocate(uint8_t* buffer, uint32_t used, uint32_t size, uint32_t& capacity);
+
+    /**
+    Release a buffer.
+
+    @param	buffer		buffer to release (may be NULL)
+    */
+    static void release(uint8_t* buffer);
+
+    static Statistics statistics();
+
+    static void logStatistics();
+
+protected:
+
+    enum {
+        MinClassShift = 8,
+        MaxClassShift = 20,
+        ClassCount = MaxClassShift - MinClassShift + 1,
+        ThreadCacheSize = 32,
+        GlobalCacheSize = 256,
+        LargeClass = 0xFF
+    };
+
+    struct Header {
+        uint32_t sizeClass;
+        uint32_t capacity;
+        uint64_t reserved;
+    };
+
+    struct ThreadCache {
+        ~ThreadCache();
+
+        std::vector<Header*> free[ClassCount];
+    };
+
+    static int sizeClass(uint32_t size);
+
+    static ThreadCache& threadCache();
+
+    static std::vector<Header*> m_global[ClassCount];
+
+    static std::mutex m_mutex;
+
+    static std::atomic<uint64_t> m_allocations;
+
+    static std::atomic<uint64_t> m_threadHits;
+
+    static std::atomic<uint64_t> m_globalHits;
+
+    static std::atomic<uint64_t> m_misses;
+
+    static std::atomic<uint64_t> m_releases;
+
+    static std::atomic<uint64_t> m_bytesInUse;
+
+};
+
+#endif // ROBOTV_PACKETPOOL_H
@@ -23,10 +23,30 @@
  */
 
 #include <thread>
+#include <mutex>
 #include "recordings/artwork.h"
 
+// maximum number of titles in a single batched artwork query
+#define ARTWORK_BATCH_SIZE 500
+
+// maximum number of cached lookups (including misses)
+#define ARTWORK_CACHE_SIZE 8192
+
+std::atomic<uint32_t> Artwork::m_version{0};
+
+std::mutex Artwork::m_cacheMutex;
+
+Artwork::CacheList Artwork::m_cache;
+
+std::unordered_map<Artwork::Key, Artwork::CacheList::iterator, Artwork::KeyHash> Artwork::m_cacheIndex;
+
 Artwork::Artwork() : m_storage(roboTV::Storage::getInstance()) {
-    createDb();
+    // every client creates its own instance, check the schema only once
+    static std::once_flag schema;
+
+    std::call_once(schema, [ = ]() {
+        createDb();
+    });
 }
 
 Artwork::~Artwork() {
@@ -51,7 +71,82 @@ void Artwork::createDb() {
     }
 }
 
+bool Artwork::getCached(const Key& key, bool& found, Urls& urls) {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    auto i = m_cacheIndex.find(key);
+
+    if(i == m_cacheIndex.end()) {
+        return false;
+    }
+
+    // move to front (most recently used)
+    m_cache.splice(m_cache.begin(), m_cache, i->second);
+
+    found = i->second->found;
+    urls = i->second->urls;
+    return true;
+}
+
+void Artwork::putCached(const Key& key, bool found, const Urls& urls) {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    auto i = m_cacheIndex.find(key);
+
+    if(i != m_cacheIndex.end()) {
+        i->second->found = found;
+        i->second->urls = urls;
+        m_cache.splice(m_cache.begin(), m_cache, i->second);
+        return;
+    }
+
+    m_cache.push_front({key, found, urls});
+    m_cacheIndex[key] = m_cache.begin();
+
+    if(m_cache.size() > ARTWORK_CACHE_SIZE) {
+        m_cacheIndex.erase(m_cache.back().key);
+        m_cache.pop_back();
+    }
+}
+
+void Artwork::fillCache() {
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        m_cache.clear();
+        m_cacheIndex.clear();
+    }
+
+    sqlite3_stmt* s = m_storage.query(
+                          "SELECT contenttype, title, posterurl, backgroundurl FROM artwork ORDER BY timestamp DESC LIMIT %i;",
+                          ARTWORK_CACHE_SIZE);
+
+    if(s == NULL) {
+        return;
+    }
+
+    while(sqlite3_step(s) == SQLITE_ROW) {
+        const char* posterUrl = (const char*)sqlite3_column_text(s, 2);
+        const char* backdropUrl = (const char*)sqlite3_column_text(s, 3);
+
+        Urls urls;
+        urls.posterUrl = posterUrl ? posterUrl : "";
+        urls.backdropUrl = backdropUrl ? backdropUrl : "";
+
+        putCached(Key(sqlite3_column_int(s, 0), (const char*)sqlite3_column_text(s, 1)), true, urls);
+    }
+
+    sqlite3_finalize(s);
+}
+
 bool Artwork::get(int contentType, const std::string& title, std::string& posterUrl, std::string& backdropUrl) {
+    Key key(contentType, title);
+    bool found = false;
+    Urls urls;
+
+    if(getCached(key, found, urls)) {
+        posterUrl = urls.posterUrl;
+        backdropUrl = urls.backdropUrl;
+        return found;
+    }
+
     sqlite3_stmt* s = m_storage.query(
                           "SELECT posterurl, backgroundurl FROM artwork WHERE contenttype=%i AND title=%Q;",
                           contentType,
@@ -63,6 +158,7 @@ bool Artwork::get(int contentType, const std::string& title, std::string& poster
 
     if(sqlite3_step(s) != SQLITE_ROW) {
         sqlite3_finalize(s);
+        putCached(key, false, urls);
         return false;
     }
 
@@ -70,10 +166,96 @@ bool Artwork::get(int contentType, const std::string& title, std::string& poster
     backdropUrl = (const char*)sqlite3_column_text(s, 1);
 
     sqlite3_finalize(s);
+
+    urls.posterUrl = posterUrl;
+    urls.backdropUrl = backdropUrl;
+    putCached(key, true, urls);
+
     return true;
 }
 
+std::map<Artwork::Key, Artwork::Urls> Artwork::get(const std::set<Key>& keys) {
+    std::map<Key, Urls> result;
+    std::set<Key> missing;
+    std::set<std::string> titles;
+
+    for(const auto& k : keys) {
+        bool found = false;
+        Urls urls;
+
+        if(getCached(k, found, urls)) {
+            if(found) {
+                result[k] = urls;
+            }
+
+            continue;
+        }
+
+        missing.insert(k);
+        titles.insert(k.second);
+    }
+
+    auto i = titles.begin();
+
+    while(i != titles.end()) {
+        std::string sql = "SELECT contenttype, title, posterurl, backgroundurl FROM artwork WHERE title IN (";
+
+        for(int count = 0; i != titles.end() && count < ARTWORK_BATCH_SIZE; i++, count++) {
+            char* literal = sqlite3_mprintf("%Q", i->c_str());
+            sql += (count == 0) ? "" : ",";
+            sql += literal;
+            sqlite3_free(literal);
+        }
+
+        sql += ");";
+
+        sqlite3_stmt* s = m_storage.query("%s", sql.c_str());
+
+        if(s == NULL) {
+            continue;
+        }
+
+        while(sqlite3_step(s) == SQLITE_ROW) {
+            Key key(sqlite3_column_int(s, 0), (const char*)sqlite3_column_text(s, 1));
+
+            if(missing.find(key) == missing.end()) {
+                continue;
+            }
+
+            const char* posterUrl = (const char*)sqlite3_column_text(s, 2);
+            const char* backdropUrl = (const char*)sqlite3_column_text(s, 3);
+
+            Urls& urls = result[key];
+            urls.posterUrl = posterUrl ? posterUrl : "";
+            urls.backdropUrl = backdropUrl ? backdropUrl : "";
+
+            putCached(key, true, urls);
+            missing.erase(key);
+        }
+
+        sqlite3_finalize(s);
+    }
+
+    // remember pairs without artwork
+    for(const auto& k : missing) {
+        putCached(k, false, Urls());
+    }
+
+    return result;
+}
+
+uint32_t Artwork::getVersion() {
+    return m_version;
+}
+
 bool Artwork::set(int contentType, const std::string& title, const std::string& posterUrl, const std::string& backdropUrl, int externalId = 0) {
+    m_version++;
+
+    Key key(contentType, title);
+    bool found = false;
+    Urls urls;
+    bool cached = getCached(key, found, urls);
+
     // try to insert new record
     if(m_storage.exec(
                 "INSERT OR IGNORE INTO artwork(contenttype, title, posterurl, backgroundurl, externalId) VALUES(%i, %Q, %Q, %Q, %i);",
@@ -82,16 +264,33 @@ bool Artwork::set(int contentType, const std::string& title, const std::string&
                 posterUrl.c_str(),
                 backdropUrl.c_str(),
                 externalId) == SQLITE_OK) {
+
+        // a cached miss means the row has just been inserted
+        // (an existing row is kept as it is and is cached already)
+        if(cached && !found) {
+            urls.posterUrl = posterUrl;
+            urls.backdropUrl = backdropUrl;
+            putCached(key, true, urls);
+        }
+
         return true;
     }
 
-    return m_storage.exec(
-               "UPDATE artwork SET posterurl=%Q, backgroundurl=%Q, externalId=%i WHERE contenttype=%i AND title=%Q",
-               posterUrl.c_str(),
-               backdropUrl.c_str(),
-               externalId,
-               contentType,
-               title.c_str()) == SQLITE_OK;
+    if(m_storage.exec(
+                "UPDATE artwork SET posterurl=%Q, backgroundurl=%Q, externalId=%i WHERE contenttype=%i AND title=%Q",
+                posterUrl.c_str(),
+                backdropUrl.c_str(),
+                externalId,
+                contentType,
+                title.c_str()) != SQLITE_OK) {
+        return false;
+    }
+
+    urls.posterUrl = posterUrl;
+    urls.backdropUrl = backdropUrl;
+    putCached(key, true, urls);
+
+    return true;
 }
 
 void Artwork::cleanup(int afterDays) {
@@ -99,6 +298,8 @@ void Artwork::cleanup(int afterDays) {
         "DELETE FROM artwork WHERE julianday('now') - julianday(timestamp) > %i AND backgroundurl=''",
         afterDays
     );
+
+    fillCache();
 }
 
 void Artwork::triggerCleanup(int afterDays) {
@@ -26,29 +26,85 @@
 #define	ROBOTV_ARTWORK_H
 
 #include "db/storage.h"
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
 #include <string>
+#include <unordered_map>
 
 class Artwork {
 public:
 
+    typedef std::pair<int, std::string> Key;
+
+    struct Urls {
+        std::string posterUrl;
+        std::string backdropUrl;
+    };
+
     Artwork();
 
     virtual ~Artwork();
 
     bool get(int contentType, const std::string& title, std::string& posterUrl, std::string& backdropUrl);
 
+    /** Fetch artwork for a set of content type / title pairs.
+     Runs one query per chunk of titles instead of one query per pair.
+     @param keys content type / title pairs to look up
+     @return map with the urls of all pairs that have artwork
+     */
+    std::map<Key, Urls> get(const std::set<Key>& keys);
+
     bool set(int contentType, const std::string& title, const std::string& posterUrl, const std::string& backdropUrl, int externalId);
 
     void cleanup(int afterDays = 4);
 
     void triggerCleanup(int afterDays = 4);
 
+    /** Version counter incremented on every set() call. */
+    static uint32_t getVersion();
+
 private:
 
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<std::string>()(key.second) ^ (size_t)key.first;
+        }
+    };
+
+    struct CacheEntry {
+        Key key;
+        bool found;
+        Urls urls;
+    };
+
+    typedef std::list<CacheEntry> CacheList;
+
     void createDb();
 
+    /** Preload the cache with the most recently added artwork */
+    void fillCache();
+
+    /** Look up a pair in the (shared) LRU cache.
+     @return true if the pair is cached (found tells if there's artwork)
+     */
+    static bool getCached(const Key& key, bool& found, Urls& urls);
+
+    /** Add a lookup result (or a miss if found is false) to the cache */
+    static void putCached(const Key& key, bool found, const Urls& urls);
+
     roboTV::Storage& m_storage;
 
+    static std::atomic<uint32_t> m_version;
+
+    static std::mutex m_cacheMutex;
+
+    static CacheList m_cache;
+
+    static std::unordered_map<Key, CacheList::iterator, KeyHash> m_cacheIndex;
+
 };
 
 #endif	// ROBOTV_ARTWORK_H
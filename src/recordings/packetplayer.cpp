@@ -23,21 +23,38 @@
  */
 
 #include "config/config.h"
+#include "net/msgpacketwriter.h"
 #include "packetplayer.h"
+#include "recordingmarks.h"
 #include "tools/time.h"
+#include "tools/tracepoints.h"
 
-#define MIN_PACKET_SIZE (128 * 1024)
+// number of TS packets read and demuxed in one go
+#define PLAYER_BLOCK_PACKETS 64
 
-PacketPlayer::PacketPlayer(cRecording* rec) : RecPlayer(rec), m_demuxers(this) {
+// playback time kept in memory ahead of the current position
+#define PREFETCH_TIME_MS 10000
+
+// TS packets read past an I-frame in keyframe mode
+// (the parser emits the frame with the start of the next one)
+#define KEYFRAME_TAIL_PACKETS 16
+
+PacketPlayer::PacketPlayer(cRecording* rec) : RecPlayer(rec), m_demuxers(this), m_fileName(rec->FileName()), m_bytesRead(0), m_packetsSent(0), m_bytesSent(0), m_tablesParsed(0) {
     m_requestStreamChange = true;
     m_firstKeyFrameSeen = false;
-    m_index = new cIndexFile(rec->FileName(), false);
     m_recording = rec;
+
+    // playback is never live
+    m_batchPolicy.setLive(false);
+
+    Metrics::instance().add(this, "players", [ = ]() {
+        return getMetrics();
+    });
 }
 
 PacketPlayer::~PacketPlayer() {
+    Metrics::instance().remove(this);
     clearQueue();
-    delete m_index;
 }
 
 void PacketPlayer::sendStreamPacket(StreamPacket* p) {
@@ -47,6 +64,11 @@ void PacketPlayer::sendStreamPacket(StreamPacket* p) {
         m_firstKeyFrameSeen = true;
     }
 
+    // remember the PTS of the I-frames visited in keyframe mode
+    if(p->content == StreamInfo::scVIDEO && p->frameType == StreamInfo::ftIFRAME && m_keyFrameIndex >= 0) {
+        m_keyFramePts[m_keyFrameIndex] = p->rawPts;
+    }
+
     // skip non video / audio packets
     if(p->content != StreamInfo::scVIDEO && p->content != StreamInfo::scAUDIO) {
         return;
@@ -67,19 +89,28 @@ void PacketPlayer::sendStreamPacket(StreamPacket* p) {
     MsgPacket* packet = new MsgPacket(ROBOTV_STREAM_MUXPKT, ROBOTV_CHANNEL_STREAM);
     packet->disablePayloadCheckSum();
 
+    // U16 pid, S64 pts, S64 dts, U32 duration, U32 size, payload, S64 wallclock time
+    MsgPacketWriter writer(packet, sizeof(uint16_t) + 2 * sizeof(int64_t) + 2 * sizeof(uint32_t) + p->size + sizeof(int64_t));
+
+    if(!writer.valid()) {
+        ERRORLOG("unable to allocate stream packet (%i bytes)", p->size);
+        delete packet;
+        return;
+    }
+
     // write stream data
-    packet->put_U16(p->pid);
+    writer.put_U16(p->pid);
 
-    packet->put_S64(p->rawPts);
-    packet->put_S64(p->rawDts);
-    packet->put_U32(p->duration);
+    writer.put_S64(p->rawPts);
+    writer.put_S64(p->rawDts);
+    writer.put_U32(p->duration);
 
     // write frame type into unused header field clientid
     packet->setClientID((uint16_t)p->frameType);
 
     // write payload into stream packet
-    packet->put_U32(p->size);
-    packet->put_Blob(p->data, p->size);
+    writer.put_U32(p->size);
+    writer.put_Blob(p->data, p->size);
 
     int64_t currentTime = 0;
     int64_t currentPts = p->rawPts;
@@ -97,8 +128,12 @@ void PacketPlayer::sendStreamPacket(StreamPacket* p) {
     currentTime = m_startTime.count() + (currentPts - m_startPts) / 90;
 
     // add timestamp (wallclock time in ms starting at m_startTime)
-    packet->put_S64(currentTime);
+    writer.put_S64(currentTime);
+    writer.commit();
+
+    m_currentTime = currentTime;
 
+    m_queueMemory.add(packet->getPacketLength());
     m_queue.push_back(packet);
 }
 
@@ -111,27 +146,75 @@ MsgPacket* PacketPlayer::getNextPacket() {
     int pmtVersion = 0;
     int patVersion = 0;
 
-    int packet_count = 1;
-    int packet_size = TS_SIZE * packet_count;
+    // return pending packets of the previous block first
+    if(!m_requestStreamChange && m_queue.size() > 0) {
+        MsgPacket* packet = m_queue.front();
+        m_queue.pop_front();
+        m_queueMemory.add(-(int64_t)packet->getPacketLength());
 
-    unsigned char buffer[packet_size];
+        ROBOTV_TRACE2(player_packet, packet->getMsgID(), packet->getPacketLength());
+        return packet;
+    }
+
+    unsigned char buffer[TS_SIZE * PLAYER_BLOCK_PACKETS];
 
     // get next block (TS packets)
-    if(getBlock(buffer, m_position, packet_size) != packet_size) {
+    int packet_size = TS_SIZE * PLAYER_BLOCK_PACKETS;
+    uint64_t end = readEnd();
+
+    if(m_position + packet_size > end) {
+        packet_size = ((end - m_position) / TS_SIZE) * TS_SIZE;
+    }
+
+    {
+        LatencyTimer timer(m_readLatency);
+
+        // keyframe ranges are read directly, the prefetcher would read ahead sequentially
+        if(m_keyFrameEnd != 0) {
+            packet_size = (getBlockDirect(buffer, m_position, packet_size) / TS_SIZE) * TS_SIZE;
+        }
+        else {
+            packet_size = (getBlock(buffer, m_position, packet_size) / TS_SIZE) * TS_SIZE;
+        }
+    }
+
+    if(packet_size <= 0) {
         return NULL;
     }
 
+    m_bytesRead += packet_size;
+    auto demuxStart = std::chrono::steady_clock::now();
+
     // advance to next block
     m_position += packet_size;
 
-    // new PAT / PMT found ?
-    if(m_parser.ParsePatPmt(buffer, TS_SIZE)) {
+    // put packets into demuxer
+    // runs of packets are demuxed at once, PAT / PMT packets update the demuxers in between
+    int start = 0;
+
+    for(int offset = 0; offset < packet_size; offset += TS_SIZE) {
+        // skip all packets except changed PAT / PMT sections
+        if(!isTableUpdate(buffer + offset)) {
+            continue;
+        }
+
+        m_tablesParsed++;
+
+        // new PAT / PMT found ?
+        if(!m_parser.ParsePatPmt(buffer + offset, TS_SIZE)) {
+            continue;
+        }
+
         m_parser.GetVersions(m_patVersion, pmtVersion);
 
         if(pmtVersion > m_pmtVersion) {
             INFOLOG("found new PMT version (%i)", pmtVersion);
             m_pmtVersion = pmtVersion;
 
+            // demux packets of the previous PMT
+            m_demuxers.processTsBuffer(buffer + start, offset - start);
+            start = offset;
+
             // update demuxers from new PMT
             INFOLOG("updating demuxers");
             StreamBundle streamBundle = StreamBundle::createFromPatPmt(&m_parser);
@@ -141,13 +224,10 @@ MsgPacket* PacketPlayer::getNextPacket() {
         }
     }
 
-    // put packets into demuxer
-    uint8_t* p = buffer;
+    m_demuxers.processTsBuffer(buffer + start, packet_size - start);
+    m_demuxLatency.addSince(demuxStart);
 
-    for(int i = 0; i < packet_count; i++) {
-        m_demuxers.processTsPacket(p);
-        p += TS_SIZE;
-    }
+    ROBOTV_TRACE3(player_block, m_position - packet_size, packet_size, m_queue.size());
 
     // stream change needed / requested
     if(m_requestStreamChange) {
@@ -179,23 +259,143 @@ MsgPacket* PacketPlayer::getNextPacket() {
 
     MsgPacket* packet = m_queue.front();
     m_queue.pop_front();
+    m_queueMemory.add(-(int64_t)packet->getPacketLength());
 
+    ROBOTV_TRACE2(player_packet, packet->getMsgID(), packet->getPacketLength());
     return packet;
 }
 
+bool PacketPlayer::isTableUpdate(const uchar* packet) {
+    int pid = TsPid(packet);
+
+    if(pid != PATPID && !m_parser.IsPmtPid(pid)) {
+        return false;
+    }
+
+    // continuation of a skipped section
+    if(!TsPayloadStart(packet)) {
+        return (pid != m_skipTablePid);
+    }
+
+    // version of the section (behind the pointer field)
+    int offset = TsPayloadOffset(packet);
+
+    if(offset >= TS_SIZE || offset + 1 + packet[offset] + 6 > TS_SIZE) {
+        return true;
+    }
+
+    int version = (packet[offset + 1 + packet[offset] + 5] >> 1) & 0x1F;
+
+    int patVersion = -1;
+    int pmtVersion = -1;
+    m_parser.GetVersions(patVersion, pmtVersion);
+
+    if(version == (pid == PATPID ? patVersion : pmtVersion)) {
+        m_skipTablePid = pid;
+        return false;
+    }
+
+    m_skipTablePid = -1;
+    return true;
+}
+
 MsgPacket* PacketPlayer::getPacket() {
     MsgPacket* p = NULL;
 
     // process data until the next packet drops out
-    while(m_position < m_totalLength && p == NULL) {
+    while((m_position < readEnd() || (!m_requestStreamChange && m_queue.size() > 0)) && p == NULL) {
         p = getNextPacket();
     }
 
     return p;
 }
 
+uint64_t PacketPlayer::readEnd() const {
+    if(m_keyFrameEnd != 0 && m_keyFrameEnd < m_totalLength) {
+        return m_keyFrameEnd;
+    }
+
+    return m_totalLength;
+}
+
+MsgPacket* PacketPlayer::getKeyFrame() {
+    for(;;) {
+        MsgPacket* p = getPacket();
+
+        // range done -> jump to the next I-frame
+        if(p == NULL) {
+            if(!nextKeyFrame()) {
+                return NULL;
+            }
+
+            continue;
+        }
+
+        // pass stream changes and I-frames only
+        if(p->getMsgID() == ROBOTV_STREAM_MUXPKT && p->getClientID() != StreamInfo::FrameType::ftIFRAME) {
+            delete p;
+            continue;
+        }
+
+        return p;
+    }
+}
+
+bool PacketPlayer::nextKeyFrame() {
+    if(!m_index->ok()) {
+        return false;
+    }
+
+    // start at the current playback position
+    if(m_keyFrameIndex < 0) {
+        for(int i = 0; i < (int)m_segments.size(); i++) {
+            if(m_position >= m_segments[i].start && m_position < m_segments[i].end) {
+                m_keyFrameIndex = m_index->get(i + 1, m_position - m_segments[i].start) - 1;
+                break;
+            }
+        }
+
+        if(m_keyFrameIndex < -1) {
+            m_keyFrameIndex = -1;
+        }
+    }
+
+    uint16_t fileNumber = 0;
+    off_t fileOffset = 0;
+    int length = 0;
+
+    int index = m_index->getNextIFrame(m_keyFrameIndex, true, &fileNumber, &fileOffset, &length);
+
+    // end of the index (the frame length of a growing recording is still unknown)
+    if(index < 0 || length <= 0 || fileNumber == 0 || fileNumber > (int)m_segments.size()) {
+        return false;
+    }
+
+    m_keyFrameIndex = index;
+    m_keyFrameStart = m_segments[fileNumber - 1].start + fileOffset;
+    m_keyFrameEnd = m_keyFrameStart + length + KEYFRAME_TAIL_PACKETS * TS_SIZE;
+    m_position = m_keyFrameStart;
+
+    return true;
+}
+
+void PacketPlayer::setBatching(uint32_t latencyMs, uint32_t maxSize) {
+    m_batchPolicy.setLatency(latencyMs, latencyMs);
+    m_batchPolicy.setMaxSize(maxSize);
+}
+
 MsgPacket* PacketPlayer::requestPacket(bool keyFrameMode) {
     MsgPacket* p = NULL;
+    auto start = std::chrono::steady_clock::now();
+
+    // adapt the batch size to the average bitrate of the recording
+    int lengthSeconds = m_recording->LengthInSeconds();
+
+    if(lengthSeconds > 0) {
+        m_batchPolicy.setBitRate((m_totalLength * 8) / lengthSeconds);
+    }
+
+    uint32_t threshold = m_batchPolicy.threshold();
 
     // create payload packet
     if(m_streamPacket == NULL) {
@@ -203,17 +403,27 @@ MsgPacket* PacketPlayer::requestPacket(bool keyFrameMode) {
         m_streamPacket->disablePayloadCheckSum();
     }
 
-    while(p = getPacket()) {
+    // back to sequential playback, resume at the last I-frame
+    if(!keyFrameMode && m_keyFrameIndex >= 0) {
+        m_position = m_keyFrameStart;
+        m_keyFrameIndex = -1;
+        m_keyFrameEnd = 0;
+    }
 
-        if(keyFrameMode && p->getClientID() != StreamInfo::FrameType::ftIFRAME) {
-            delete p;
-            continue;
-        }
+    if(m_passthrough) {
+        return requestRawPacket(keyFrameMode);
+    }
+
+    while(p = (keyFrameMode ? getKeyFrame() : getPacket())) {
 
         // recheck recording duration
-        if(p->getClientID() == StreamInfo::FrameType::ftIFRAME && update()) {
-            int64_t durationMs = (int)(((double)m_index->Last() * 1000.0) / m_recording->FramesPerSecond());
-            m_endTime = m_startTime + std::chrono::milliseconds(durationMs);
+        if(p->getClientID() == StreamInfo::FrameType::ftIFRAME) {
+            updateEndTime();
+        }
+
+        // prefetch the next seconds of the recording (based on the index)
+        if(!keyFrameMode && p->getClientID() == StreamInfo::FrameType::ftIFRAME) {
+            setPrefetchLimit(filePositionFromClock(m_currentTime + PREFETCH_TIME_MS));
         }
 
         // add start / endtime
@@ -226,25 +436,97 @@ MsgPacket* PacketPlayer::requestPacket(bool keyFrameMode) {
         m_streamPacket->put_U16(p->getMsgID());
         m_streamPacket->put_U16(p->getClientID());
 
-        // add payload
+        // add payload (referenced, not copied)
         uint8_t* data = p->getPayload();
         int length = p->getPayloadLength();
-        m_streamPacket->put_Blob(data, length);
-
-        delete p;
+        m_streamPacket->put_Segment(std::shared_ptr<MsgPacket>(p), data, length);
 
         // send payload packet if it's big enough
-        if(m_streamPacket->getPayloadLength() >= MIN_PACKET_SIZE) {
+        if(m_streamPacket->getPayloadLength() >= threshold) {
             MsgPacket* result = m_streamPacket;
             m_streamPacket = NULL;
 
+            m_aggregateLatency.addSince(start);
+            m_packetsSent++;
+            m_bytesSent += result->getPayloadLength();
+
             return result;
         }
     }
 
+    // end of data reached, a running recording may have grown in the meantime
+    updateEndTime();
+
     return NULL;
 }
 
+MsgPacket* PacketPlayer::requestRawPacket(bool keyFrameMode) {
+    // keyframe mode sends the TS range of one I-frame per request
+    if(keyFrameMode && (m_keyFrameIndex < 0 || m_position >= readEnd()) && !nextKeyFrame()) {
+        return NULL;
+    }
+
+    uint64_t end = readEnd();
+
+    if(m_position >= end) {
+        updateEndTime();
+        return NULL;
+    }
+
+    uint64_t amount = std::max(m_batchPolicy.threshold(), (uint32_t)(TS_SIZE * PLAYER_BLOCK_PACKETS));
+    amount = (std::min(amount, end - m_position) / TS_SIZE) * TS_SIZE;
+
+    if(amount == 0) {
+        return NULL;
+    }
+
+    MsgPacket* packet = new MsgPacket();
+    packet->disablePayloadCheckSum();
+
+    packet->put_S64(startTime().count());
+    packet->put_S64(endTime().count());
+    packet->put_U64(m_position);
+    packet->put_U32(amount);
+
+    uint32_t length = putFileRange(packet, m_position, amount);
+
+    // the header announced the full range
+    if(length != amount) {
+        ERRORLOG("unable to reference %lu bytes at position %lu", amount, m_position);
+        delete packet;
+        return NULL;
+    }
+
+    m_position += length;
+    m_bytesRead += length;
+    m_packetsSent++;
+    m_bytesSent += packet->getPayloadLength();
+
+    return packet;
+}
+
+void PacketPlayer::updateEndTime() {
+    if(!update()) {
+        return;
+    }
+
+    int64_t durationMs = (int)(((double)m_index->last() * 1000.0) / m_recording->FramesPerSecond());
+    m_endTime = m_startTime + std::chrono::milliseconds(durationMs);
+}
+
+nlohmann::json PacketPlayer::getMetrics() {
+    return {
+        {"recording", m_fileName},
+        {"bytesRead", (uint64_t)m_bytesRead},
+        {"packetsSent", (uint64_t)m_packetsSent},
+        {"bytesSent", (uint64_t)m_bytesSent},
+        {"read", m_readLatency.toJson()},
+        {"demux", m_demuxLatency.toJson()},
+        {"tablesParsed", (uint64_t)m_tablesParsed},
+        {"aggregate", m_aggregateLatency.toJson()}
+    };
+}
+
 void PacketPlayer::clearQueue() {
     MsgPacket* p = NULL;
 
@@ -253,6 +535,8 @@ void PacketPlayer::clearQueue() {
         m_queue.pop_front();
         delete p;
     }
+
+    m_queueMemory.set(0);
 }
 
 void PacketPlayer::reset() {
@@ -263,73 +547,154 @@ void PacketPlayer::reset() {
     m_firstKeyFrameSeen = false;
     m_patVersion = -1;
     m_pmtVersion = -1;
+    m_skipTablePid = -1;
     m_position = 0;
+    m_keyFrameIndex = -1;
+    m_keyFrameEnd = 0;
 
     // remove pending packets
     clearQueue();
 }
 
-int64_t PacketPlayer::filePositionFromClock(int64_t wallclockTimeMs) {
+int PacketPlayer::keyFrameFromClock(int64_t wallclockTimeMs) {
     double offsetMs = wallclockTimeMs - m_startTime.count();
     double fps = m_recording->FramesPerSecond();
     int frames = (int)((offsetMs * fps) / 1000.0);
 
-    int index = m_index->GetClosestIFrame(frames);
+    return m_index->getClosestIFrame(frames);
+}
 
+int64_t PacketPlayer::filePositionFromClock(int64_t wallclockTimeMs) {
+    return filePositionFromIndex(keyFrameFromClock(wallclockTimeMs));
+}
+
+int64_t PacketPlayer::filePositionFromIndex(int index) {
     uint16_t fileNumber = 0;
     off_t fileOffset = 0;
 
-    m_index->Get(index, &fileNumber, &fileOffset);
+    m_index->get(index, &fileNumber, &fileOffset);
 
-    if(fileNumber == 0) {
+    // the segment table may lag behind the index of a growing recording
+    if(fileNumber == 0 || fileNumber > m_segments.size()) {
         return 0;
     }
 
-    return m_segments[--fileNumber]->start + fileOffset;
+    return m_segments[--fileNumber].start + fileOffset;
+}
+
+int64_t PacketPlayer::seekMark(int64_t wallclockTimeMs, int direction) {
+    std::shared_ptr<const RecordingMarks::Marks> marks = RecordingMarks::instance().get(m_recording);
+
+    if(!marks || direction == 0) {
+        return seek(wallclockTimeMs);
+    }
+
+    double fps = m_recording->FramesPerSecond();
+    int frame = (int)(((wallclockTimeMs - m_startTime.count()) * fps) / 1000.0);
+
+    // skip marks within a second of the current position
+    int tolerance = (int)fps;
+    int target = -1;
+
+    if(direction > 0) {
+        auto i = std::upper_bound(marks->positions.begin(), marks->positions.end(), frame + tolerance);
+
+        if(i != marks->positions.end()) {
+            target = *i;
+        }
+    }
+    else {
+        auto i = std::lower_bound(marks->positions.begin(), marks->positions.end(), frame - tolerance);
+
+        if(i != marks->positions.begin()) {
+            target = *(--i);
+        }
+    }
+
+    if(target < 0) {
+        return seek(wallclockTimeMs);
+    }
+
+    INFOLOG("seek to mark at frame %i", target);
+    return seek(m_startTime.count() + (int64_t)((target * 1000.0) / fps));
 }
 
 int64_t PacketPlayer::seek(int64_t wallclockTimeMs) {
-    // adujst position to TS packet borders
-    m_position = filePositionFromClock(wallclockTimeMs);
+    int index = keyFrameFromClock(wallclockTimeMs);
+    uint64_t position = filePositionFromIndex(index);
 
     // invalid position ?
-    if(m_position >= m_totalLength) {
+    if(position >= m_totalLength) {
         return -1;
     }
 
-    INFOLOG("seek: %lu / %lu", m_position, m_totalLength);
+    // the client demuxes the stream by itself
+    if(m_passthrough) {
+        INFOLOG("seek (passthrough): %lu / %lu", position, m_totalLength);
+        m_position = position;
+        m_keyFrameIndex = -1;
+        m_keyFrameEnd = 0;
+        return position;
+    }
+
+    INFOLOG("seek: %lu / %lu", position, m_totalLength);
 
     // reset parser
     reset();
+    m_position = position;
 
-    // first check for next video packet (PTS) after seek
-    MsgPacket* p = NULL;
-    int64_t pts = 0;
+    // PTS of this I-frame already known ?
+    auto i = m_keyFramePts.find(index);
 
-    for(;;) {
-        p = getPacket();
+    if(i != m_keyFramePts.end()) {
+        return i->second;
+    }
+
+    // demux up to the first video packet to get its PTS
+    // the packets are kept and sent out first
+    std::deque<MsgPacket*> packets;
+    int64_t pts = -1;
+
+    while(pts == -1) {
+        MsgPacket* p = getPacket();
 
         // exit if we have no more packets
         if(p == NULL) {
-            return -1;
+            break;
+        }
+
+        packets.push_back(p);
+
+        if(p->getMsgID() != ROBOTV_STREAM_MUXPKT) {
+            continue;
         }
 
         // get pid / pts
         int pid = p->get_U16();
-        pts = p->get_U64();
-
-        // delete packet
-        delete p;
+        int64_t rawPts = p->get_S64();
+        p->rewind();
 
         // check for video pid
         if(pid == m_parser.Vpid()) {
-            break;
+            pts = rawPts;
         }
     }
 
-    // reset again
-    reset();
-    m_position = filePositionFromClock(wallclockTimeMs);
+    if(pts == -1) {
+        for(auto p : packets) {
+            delete p;
+        }
+
+        return -1;
+    }
+
+    m_keyFramePts[index] = pts;
+
+    for(auto p : packets) {
+        m_queueMemory.add(p->getPacketLength());
+    }
+
+    m_queue.insert(m_queue.begin(), packets.begin(), packets.end());
 
     return pts;
 }
@@ -29,10 +29,16 @@
 #include "demuxer/demuxer.h"
 #include "demuxer/demuxerbundle.h"
 #include "net/msgpacket.h"
+#include "tools/batchpolicy.h"
+#include "tools/memorybudget.h"
+#include "tools/metrics.h"
 
 #include "vdr/remux.h"
+#include <atomic>
 #include <deque>
+#include <map>
 #include <chrono>
+#include <string>
 
 class PacketPlayer : public RecPlayer, protected TsDemuxer::Listener {
 public:
@@ -43,8 +49,30 @@ public:
 
     MsgPacket* requestPacket(bool keyFrameMode);
 
+    /** Set the batching policy requested by the client.
+     Passing 0 keeps the default value.
+     @param latencyMs latency budget (in ms)
+     @param maxSize maximum size of an aggregated packet
+     */
+    void setBatching(uint32_t latencyMs, uint32_t maxSize);
+
+    /** Stream the raw TS data of the recording.
+     The data isn't demuxed but sent directly from the segment files.
+     Seeks return the file position of the I-frame instead of its PTS.
+     */
+    void setPassthrough(bool passthrough) {
+        m_passthrough = passthrough;
+    }
+
     int64_t seek(int64_t position);
 
+    /** Seek to the next / previous cutting mark.
+     Falls back to a normal seek if the recording has no marks (in that direction).
+     @param wallclockTimeMs current position
+     @param direction > 0 next mark, < 0 previous mark
+     */
+    int64_t seekMark(int64_t wallclockTimeMs, int direction);
+
     const std::chrono::milliseconds& startTime() const {
         return m_startTime;
     }
@@ -59,8 +87,32 @@ protected:
 
     MsgPacket* getNextPacket();
 
+    /** Check if a TS packet carries a changed PAT / PMT section.
+     Only the PAT and the known PMT pids are looked at, sections with the
+     version the parser already holds are skipped by the version byte.
+     */
+    bool isTableUpdate(const uchar* packet);
+
     MsgPacket* getPacket();
 
+    /** Get the next I-frame in keyframe (trick-play) mode.
+     The index is used to jump from I-frame to I-frame, only the TS range
+     of each I-frame is read and demuxed.
+     */
+    MsgPacket* getKeyFrame();
+
+    /** Get the next range of raw TS data (passthrough mode) */
+    MsgPacket* requestRawPacket(bool keyFrameMode);
+
+    /** Move the read range to the next I-frame of the index */
+    bool nextKeyFrame();
+
+    /** Follow the growth of a running recording */
+    void updateEndTime();
+
+    /** End of the currently readable TS range */
+    uint64_t readEnd() const;
+
     void sendStreamPacket(StreamPacket* p);
 
     void requestStreamChange();
@@ -69,18 +121,38 @@ protected:
 
     int64_t filePositionFromClock(int64_t wallclockTimeMs);
 
+    /** Index of the I-frame closest to a wallclock time */
+    int keyFrameFromClock(int64_t wallclockTimeMs);
+
+    /** File position of an index entry */
+    int64_t filePositionFromIndex(int index);
+
+    nlohmann::json getMetrics();
+
 private:
 
     cPatPmtParser m_parser;
 
-    cIndexFile* m_index;
-
     cRecording* m_recording;
 
     DemuxerBundle m_demuxers;
 
     uint64_t m_position = 0;
 
+    /** End of the I-frame range in keyframe mode (0: sequential playback) */
+    uint64_t m_keyFrameEnd = 0;
+
+    /** Start position of the current I-frame in keyframe mode */
+    uint64_t m_keyFrameStart = 0;
+
+    /** Index of the current I-frame in keyframe mode (-1: none) */
+    int m_keyFrameIndex = -1;
+
+    /** PTS of the I-frames seen so far (index entry -> raw PTS) */
+    std::map<int, int64_t> m_keyFramePts;
+
+    bool m_passthrough = false;
+
     bool m_requestStreamChange;
 
     bool m_firstKeyFrameSeen;
@@ -89,8 +161,13 @@ private:
 
     int m_pmtVersion = -1;
 
+    /** PID of an unchanged section whose continuation packets are skipped */
+    int m_skipTablePid = -1;
+
     std::deque<MsgPacket*> m_queue;
 
+    MemoryAccount m_queueMemory{MemoryBudget::msPlayer};
+
     MsgPacket* m_streamPacket = NULL;
 
     std::chrono::milliseconds m_startTime;
@@ -99,6 +176,26 @@ private:
 
     int64_t m_startPts = 0;
 
+    int64_t m_currentTime = 0;
+
+    BatchPolicy m_batchPolicy;
+
+    std::string m_fileName;
+
+    std::atomic<uint64_t> m_bytesRead;
+
+    std::atomic<uint64_t> m_packetsSent;
+
+    std::atomic<uint64_t> m_bytesSent;
+
+    std::atomic<uint64_t> m_tablesParsed;
+
+    LatencyHistogram m_readLatency;
+
+    LatencyHistogram m_demuxLatency;
+
+    LatencyHistogram m_aggregateLatency;
+
 };
 
 #endif	// ROBOTV_PACKETPLAYER_H
@@ -0,0 +1,150 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <string.h>
+
+#include "recordingfolders.h"
+
+RecordingFolders::RecordingFolders() {
+}
+
+RecordingFolders& RecordingFolders::instance() {
+    static RecordingFolders folders;
+    return folders;
+}
+
+std::string RecordingFolders::folderOf(const cRecording* recording) {
+    const char* name = recording->Name();
+    const char* recname = strrchr(name, FOLDERDELIMCHAR);
+
+    if(recname == NULL) {
+        return "";
+    }
+
+    std::string folder;
+
+    for(const char* p = name; p < recname; p++) {
+        if(*p == FOLDERDELIMCHAR) {
+            folder += '/';
+        }
+        else if(*p == '_') {
+            folder += ' ';
+        }
+        else {
+            folder += *p;
+        }
+    }
+
+    folder.erase(0, folder.find_first_not_of('/'));
+    return folder;
+}
+
+void RecordingFolders::update() {
+    if(!Recordings.StateChanged(m_recordingsState) && !m_folders.empty()) {
+        return;
+    }
+
+    m_folders.clear();
+    m_folders[""];
+
+    for(cRecording* recording = Recordings.First(); recording; recording = Recordings.Next(recording)) {
+        std::string path = m_toUtf8.convert(folderOf(recording));
+
+        m_folders[path].recordings.push_back(recording);
+        m_folders[""].recordingCount++;
+
+        // register the folder with all its parents
+        size_t pos = 0;
+
+        while(!path.empty()) {
+            size_t next = path.find('/', pos);
+            std::string parent = (pos == 0) ? "" : path.substr(0, pos - 1);
+            std::string current = path.substr(0, next);
+
+            Folder& folder = m_folders[current];
+            folder.recordingCount++;
+            m_folders[parent].folders[current.substr(pos)] = current;
+
+            if(next == std::string::npos) {
+                break;
+            }
+
+            pos = next + 1;
+        }
+    }
+}
+
+bool RecordingFolders::list(const std::string& folder, uint32_t offset, uint32_t limit, Page& page) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    update();
+
+    std::string path = folder;
+
+    path.erase(0, path.find_first_not_of('/'));
+
+    while(!path.empty() && path.back() == '/') {
+        path.pop_back();
+    }
+
+    auto f = m_folders.find(path);
+
+    if(f == m_folders.end()) {
+        return false;
+    }
+
+    const Folder& current = f->second;
+
+    page.folderCount = current.folders.size();
+    page.recordingCount = current.recordings.size();
+
+    // subfolders
+    uint32_t index = 0;
+
+    for(auto& i : current.folders) {
+        if(index++ < offset) {
+            continue;
+        }
+
+        if(page.folders.size() >= limit) {
+            return true;
+        }
+
+        page.folders.push_back({i.first, m_folders[i.second].recordingCount});
+    }
+
+    // recordings
+    for(auto recording : current.recordings) {
+        if(index++ < offset) {
+            continue;
+        }
+
+        if(page.folders.size() + page.recordings.size() >= limit) {
+            break;
+        }
+
+        page.recordings.push_back(recording);
+    }
+
+    return true;
+}
@@ -0,0 +1,98 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_RECORDINGFOLDERS_H
+#define ROBOTV_RECORDINGFOLDERS_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vdr/recording.h>
+#include "tools/utf8conv.h"
+
+/** Folder index of the recordings.
+ The folders are taken from the recording names (split on
+ FOLDERDELIMCHAR, the same way list entries report their directory).
+ The index is rebuilt when VDR's recordings list changed, so clients
+ can browse the library folder by folder and page by page instead of
+ fetching the flat list of all recordings. Folder paths are UTF-8.
+ */
+class RecordingFolders {
+protected:
+
+    RecordingFolders();
+
+public:
+
+    struct SubFolder {
+        std::string name;
+        uint32_t recordingCount;
+    };
+
+    struct Page {
+        uint32_t folderCount = 0;
+        uint32_t recordingCount = 0;
+        std::vector<SubFolder> folders;
+        std::vector<cRecording*> recordings;
+    };
+
+    static RecordingFolders& instance();
+
+    /** List a page of a folder.
+     Subfolders (sorted by name) come before the recordings of the folder,
+     offset and limit apply to this combined sequence.
+     @param folder folder path ("a/b", empty for the root folder)
+     @param offset number of entries to skip
+     @param limit maximum number of entries
+     @param page receives the page (and the total counts of the folder)
+     @return false if the folder does not exist
+     */
+    bool list(const std::string& folder, uint32_t offset, uint32_t limit, Page& page);
+
+    /** Folder path of a recording (empty if in the root folder) */
+    static std::string folderOf(const cRecording* recording);
+
+private:
+
+    struct Folder {
+        std::map<std::string, std::string> folders;
+        std::vector<cRecording*> recordings;
+        uint32_t recordingCount = 0;
+    };
+
+    void update();
+
+    std::map<std::string, Folder> m_folders;
+
+    std::mutex m_mutex;
+
+    int m_recordingsState = -1;
+
+    Utf8Conv m_toUtf8;
+
+};
+
+#endif // ROBOTV_RECORDINGFOLDERS_H
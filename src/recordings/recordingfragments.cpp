@@ -0,0 +1,145 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <string.h>
+#include <vdr/menu.h>
+
+#include "config/config.h"
+#include "net/msgpacket.h"
+#include "tools/hash.h"
+#include "recordingfolders.h"
+#include "recordingfragments.h"
+
+RecordingFragments::RecordingFragments() {
+}
+
+RecordingFragments& RecordingFragments::instance() {
+    static RecordingFragments fragments;
+    return fragments;
+}
+
+void RecordingFragments::rebuild() {
+    std::lock_guard<std::mutex> lock(m_rebuildMutex);
+    std::map<uint32_t, Fragment> fragments;
+
+    for(cRecording* recording = Recordings.First(); recording; recording = Recordings.Next(recording)) {
+        // recordings in progress take their times from the timer
+        if(cRecordControls::GetRecordControl(recording->FileName()) != NULL) {
+            continue;
+        }
+
+        uint32_t uid = createStringHash(recording->FileName());
+        MsgPacket p;
+
+        Fragment& fragment = fragments[uid];
+        fragment.recording = recording;
+        fragment.content = serialize(recording, uid, m_toUtf8, &p);
+        fragment.data.assign(p.getPayload(), p.getPayload() + p.getPayloadLength());
+    }
+
+    INFOLOG("serialized %lu recordings", (unsigned long)fragments.size());
+
+    std::lock_guard<std::mutex> fragmentsLock(m_mutex);
+    m_fragments.swap(fragments);
+}
+
+bool RecordingFragments::put(const cRecording* recording, uint32_t uid, MsgPacket* response, int& content) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto i = m_fragments.find(uid);
+
+    if(i == m_fragments.end() || i->second.recording != recording) {
+        return false;
+    }
+
+    response->put_Blob(i->second.data.data(), i->second.data.size());
+    content = i->second.content;
+
+    return true;
+}
+
+int RecordingFragments::serialize(cRecording* recording, uint32_t uid, Utf8Conv& toUtf8, MsgPacket* response) {
+    RoboTVServerConfig& config = RoboTVServerConfig::instance();
+
+    const cEvent* event = recording->Info()->GetEvent();
+
+    time_t recordingStart = event->StartTime();
+    int recordingDuration = event->Duration();
+    int content = event->Contents();
+
+    cRecordControl* rc = cRecordControls::GetRecordControl(recording->FileName());
+
+    if(rc) {
+        recordingStart    = rc->Timer()->StartTime();
+        recordingDuration = rc->Timer()->StopTime() - recordingStart;
+    }
+    else {
+        recordingStart = recording->Start();
+    }
+
+    // recording_time
+    response->put_U32(recordingStart);
+
+    // duration
+    response->put_U32(recordingDuration);
+
+    // priority
+    response->put_U32(recording->Priority());
+
+    // lifetime
+    response->put_U32(recording->Lifetime());
+
+    // channel_name
+    response->put_String(toUtf8.convertToBuffer(recording->Info()->ChannelName() ? recording->Info()->ChannelName() : ""));
+
+    // title
+    const char* title = recording->Info()->Title();
+    response->put_String(toUtf8.convertToBuffer(title ? title : ""));
+
+    // subtitle
+    const char* subTitle = recording->Info()->ShortText();
+    response->put_String(toUtf8.convertToBuffer(subTitle ? subTitle : ""));
+
+    // description
+    const char* description = recording->Info()->Description();
+    response->put_String(toUtf8.convertToBuffer(description ? description : ""));
+
+    // directory
+    std::string directory = RecordingFolders::folderOf(recording);
+
+    if(!directory.empty() && !config.seriesFolder.empty()) {
+        if(directory.compare(0, config.seriesFolder.length(), config.seriesFolder) == 0) {
+            content = 0x15;
+        }
+    }
+
+    response->put_String(toUtf8.convertToBuffer(directory.c_str()));
+
+    // filename / uid of recording
+    char recid[9];
+    snprintf(recid, sizeof(recid), "%08x", uid);
+    response->put_String(recid);
+
+    return content;
+}
@@ -0,0 +1,88 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_RECORDINGFRAGMENTS_H
+#define ROBOTV_RECORDINGFRAGMENTS_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <vdr/recording.h>
+#include "tools/utf8conv.h"
+
+class MsgPacket;
+
+/** Pre-serialized list entries of the recordings.
+ The static part of every list entry (times, names, texts, directory and
+ uid) is serialized once when the recordings change. List requests only
+ copy the fragments and append the metadata from the database.
+ Recordings in progress are not cached (their times follow the timer).
+ */
+class RecordingFragments {
+protected:
+
+    RecordingFragments();
+
+public:
+
+    static RecordingFragments& instance();
+
+    /** Serialize all recordings (call after the recordings changed) */
+    void rebuild();
+
+    /** Append the fragment of a recording.
+     @param recording recording
+     @param uid uid of the recording
+     @param response packet to append to
+     @param content set to the content type of the recording
+     @return false if the recording is not in the snapshot
+     */
+    bool put(const cRecording* recording, uint32_t uid, MsgPacket* response, int& content);
+
+    /** Serialize the static part of a list entry.
+     @return content type of the recording
+     */
+    static int serialize(cRecording* recording, uint32_t uid, Utf8Conv& toUtf8, MsgPacket* response);
+
+private:
+
+    struct Fragment {
+        const cRecording* recording;
+        int content;
+        std::vector<uint8_t> data;
+    };
+
+    std::map<uint32_t, Fragment> m_fragments;
+
+    std::mutex m_mutex;
+
+    std::mutex m_rebuildMutex;
+
+    Utf8Conv m_toUtf8;
+
+};
+
+#endif // ROBOTV_RECORDINGFRAGMENTS_H
@@ -0,0 +1,243 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "recordingindex.h"
+#include "config/config.h"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <unistd.h>
+
+#ifndef __FreeBSD__
+#include <sys/inotify.h>
+#endif
+
+// minimum time between two rescans of a recording (ms)
+#define RESCAN_INTERVAL 10000
+
+std::mutex RecordingIndex::m_cacheMutex;
+
+std::map<std::string, std::weak_ptr<RecordingIndex>> RecordingIndex::m_cache;
+
+std::shared_ptr<RecordingIndex> RecordingIndex::get(cRecording* rec) {
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+    // drop entries of closed recordings
+    for(auto i = m_cache.begin(); i != m_cache.end();) {
+        if(i->second.expired()) {
+            i = m_cache.erase(i);
+        }
+        else {
+            i++;
+        }
+    }
+
+    std::shared_ptr<RecordingIndex> index = m_cache[rec->FileName()].lock();
+
+    if(index) {
+        DEBUGLOG("using cached index of '%s'", rec->FileName());
+        return index;
+    }
+
+    index = std::shared_ptr<RecordingIndex>(new RecordingIndex(rec));
+    m_cache[rec->FileName()] = index;
+
+    return index;
+}
+
+RecordingIndex::RecordingIndex(cRecording* rec) : m_recordingFilename(rec->FileName()), m_pesRecording(rec->IsPesRecording()) {
+    m_index = new cIndexFile(rec->FileName(), false);
+
+#ifndef __FreeBSD__
+    // watch the recording directory for new / growing segments
+    m_notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(m_notifyFd != -1 && inotify_add_watch(m_notifyFd, rec->FileName(), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) == -1) {
+        ERRORLOG("unable to watch '%s', falling back to periodic rescans", rec->FileName());
+        close(m_notifyFd);
+        m_notifyFd = -1;
+    }
+#endif
+
+    scan(0);
+}
+
+RecordingIndex::~RecordingIndex() {
+    if(m_notifyFd != -1) {
+        close(m_notifyFd);
+    }
+
+    delete m_index;
+}
+
+char* RecordingIndex::segmentFileName(int index, char* fileName, size_t size) const {
+    if(m_pesRecording) {
+        snprintf(fileName, size, "%s/%03i.vdr", m_recordingFilename.c_str(), index + 1);
+    }
+    else {
+        snprintf(fileName, size, "%s/%05i.ts", m_recordingFilename.c_str(), index + 1);
+    }
+
+    return fileName;
+}
+
+void RecordingIndex::scan(size_t first) {
+    struct stat s;
+    char fileName[512];
+
+    // keep the segments in front of the first one
+    std::vector<Segment> segments;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        segments.assign(m_segments.begin(), m_segments.begin() + std::min(first, m_segments.size()));
+    }
+
+    uint64_t totalLength = segments.empty() ? 0 : segments.back().end;
+
+    for(int i = segments.size(); ; i++) {
+        segmentFileName(i, fileName, sizeof(fileName));
+
+        if(stat(fileName, &s) == -1) {
+            break;
+        }
+
+        segments.push_back({totalLength, totalLength + s.st_size});
+        totalLength += s.st_size;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(totalLength == m_totalLength && segments.size() == m_segments.size()) {
+        return;
+    }
+
+    DEBUGLOG("recording scan: %lu bytes", totalLength);
+
+    m_segments = segments;
+    m_totalLength = totalLength;
+    m_generation++;
+}
+
+bool RecordingIndex::readEvents(bool& rescanAll) {
+    bool changed = false;
+    rescanAll = false;
+
+#ifndef __FreeBSD__
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for(;;) {
+        ssize_t length = read(m_notifyFd, buffer, sizeof(buffer));
+
+        if(length <= 0) {
+            break;
+        }
+
+        for(char* p = buffer; p < buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            struct inotify_event* event = (struct inotify_event*)p;
+
+            if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                rescanAll = true;
+            }
+
+            changed = true;
+        }
+    }
+#endif
+
+    return changed;
+}
+
+void RecordingIndex::update() {
+    std::lock_guard<std::mutex> lock(m_updateMutex);
+
+    // periodic rescan
+    if(m_notifyFd == -1) {
+        if(m_rescanTime.Elapsed() < RESCAN_INTERVAL) {
+            return;
+        }
+
+        m_rescanTime.Set(0);
+        scan(0);
+        return;
+    }
+
+    bool rescanAll = false;
+
+    if(!readEvents(rescanAll)) {
+        return;
+    }
+
+    // only the last segment grows, new ones are appended
+    size_t first = 0;
+
+    if(!rescanAll) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        first = m_segments.empty() ? 0 : m_segments.size() - 1;
+    }
+
+    scan(first);
+}
+
+uint64_t RecordingIndex::getSegments(std::vector<Segment>& segments, uint64_t& totalLength) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    segments = m_segments;
+    totalLength = m_totalLength;
+    return m_generation;
+}
+
+uint64_t RecordingIndex::generation() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_generation;
+}
+
+bool RecordingIndex::ok() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index->Ok();
+}
+
+int RecordingIndex::last() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index->Last();
+}
+
+int RecordingIndex::getClosestIFrame(int index) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index->GetClosestIFrame(index);
+}
+
+bool RecordingIndex::get(int index, uint16_t* fileNumber, off_t* fileOffset) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index->Get(index, fileNumber, fileOffset);
+}
+
+int RecordingIndex::get(uint16_t fileNumber, off_t fileOffset) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index->Get(fileNumber, fileOffset);
+}
+
+int RecordingIndex::getNextIFrame(int index, bool forward, uint16_t* fileNumber, off_t* fileOffset, int* length) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index->GetNextIFrame(index, forward, fileNumber, fileOffset, length);
+}
@@ -0,0 +1,124 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_RECORDINGINDEX_H
+#define ROBOTV_RECORDINGINDEX_H
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vdr/recording.h>
+#include <vdr/tools.h>
+
+class Segment {
+public:
+    uint64_t start;
+    uint64_t end;
+};
+
+/** Index file and segment table of a recording.
+ Players of the same recording share one instance, it's released
+ together with the last player. Access to the index file is serialized.
+ */
+class RecordingIndex {
+public:
+
+    /** Get the shared index of a recording */
+    static std::shared_ptr<RecordingIndex> get(cRecording* rec);
+
+    ~RecordingIndex();
+
+    /** Update the segments of a (growing) recording.
+     The recording directory is watched with inotify, the last segments are
+     rescanned only if files have been written. Without inotify all segments
+     are rescanned at most every 10 seconds. Updates are shared by all players.
+     */
+    void update();
+
+    /** Copy the segment table.
+     @param segments receives the segments
+     @param totalLength receives the total length of all segments
+     @return generation of the segment table (incremented on every change)
+     */
+    uint64_t getSegments(std::vector<Segment>& segments, uint64_t& totalLength);
+
+    /** Current generation of the segment table */
+    uint64_t generation();
+
+    char* segmentFileName(int index, char* fileName, size_t size) const;
+
+    bool ok();
+
+    int last();
+
+    int getClosestIFrame(int index);
+
+    bool get(int index, uint16_t* fileNumber, off_t* fileOffset);
+
+    int get(uint16_t fileNumber, off_t fileOffset);
+
+    int getNextIFrame(int index, bool forward, uint16_t* fileNumber, off_t* fileOffset, int* length);
+
+private:
+
+    RecordingIndex(cRecording* rec);
+
+    /** Scan the segments starting at the given segment */
+    void scan(size_t first);
+
+    /** Read pending inotify events.
+     @param rescanAll set if files have been removed
+     @return true if files of the recording changed
+     */
+    bool readEvents(bool& rescanAll);
+
+    std::string m_recordingFilename;
+
+    bool m_pesRecording;
+
+    std::mutex m_mutex;
+
+    std::mutex m_updateMutex;
+
+    int m_notifyFd = -1;
+
+    cIndexFile* m_index;
+
+    std::vector<Segment> m_segments;
+
+    uint64_t m_totalLength = 0;
+
+    uint64_t m_generation = 0;
+
+    cTimeMs m_rescanTime;
+
+    static std::mutex m_cacheMutex;
+
+    static std::map<std::string, std::weak_ptr<RecordingIndex>> m_cache;
+};
+
+#endif // ROBOTV_RECORDINGINDEX_H
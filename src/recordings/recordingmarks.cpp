@@ -0,0 +1,103 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <vdr/recording.h>
+
+#include "config/config.h"
+#include "recordingmarks.h"
+
+// maximum number of cached marks files
+#define RECORDING_MARKS_CACHE_SIZE 256
+
+RecordingMarks::RecordingMarks() {
+}
+
+RecordingMarks& RecordingMarks::instance() {
+    static RecordingMarks marks;
+    return marks;
+}
+
+std::string RecordingMarks::marksFile(const cRecording* recording) {
+    return std::string(recording->FileName()) + (recording->IsPesRecording() ? "/marks.vdr" : "/marks");
+}
+
+std::shared_ptr<const RecordingMarks::Marks> RecordingMarks::get(const cRecording* recording) {
+    std::string filename = marksFile(recording);
+    struct stat st;
+
+    if(stat(filename.c_str(), &st) != 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_marks.erase(filename);
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto i = m_marks.find(filename);
+
+        if(i != m_marks.end() && i->second->mtime == st.st_mtime && i->second->size == st.st_size) {
+            return i->second;
+        }
+    }
+
+    cMarks marks;
+
+    if(!marks.Load(recording->FileName(), recording->FramesPerSecond(), recording->IsPesRecording())) {
+        return nullptr;
+    }
+
+    std::shared_ptr<Marks> result = std::make_shared<Marks>();
+    result->mtime = st.st_mtime;
+    result->size = st.st_size;
+
+    for(cMark* m = marks.First(); m; m = marks.Next(m)) {
+        result->positions.push_back(m->Position());
+    }
+
+    std::sort(result->positions.begin(), result->positions.end());
+
+    cMark* end = NULL;
+    cMark* begin = NULL;
+
+    while((begin = marks.GetNextBegin(end)) != NULL) {
+        end = marks.GetNextEnd(begin);
+
+        if(end != NULL) {
+            result->scenes.push_back({ begin->Position(), end->Position(), (const char*)begin->ToText() });
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // marks of deleted recordings are dropped from time to time
+    if(m_marks.size() >= RECORDING_MARKS_CACHE_SIZE) {
+        m_marks.clear();
+    }
+
+    m_marks[filename] = result;
+    return result;
+}
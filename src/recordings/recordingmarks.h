@@ -0,0 +1,82 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_RECORDINGMARKS_H
+#define ROBOTV_RECORDINGMARKS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vdr/recording.h>
+
+/** Cache of the cutting marks of all recordings.
+ The marks file of a recording is loaded once and kept until its
+ modification time (or size) changes. The marks are shared by all
+ clients and players.
+ */
+class RecordingMarks {
+protected:
+
+    RecordingMarks();
+
+public:
+
+    struct Scene {
+        int begin;
+        int end;
+        std::string text;
+    };
+
+    struct Marks {
+        time_t mtime;
+        off_t size;
+        std::vector<Scene> scenes;
+        // positions (frame index) of all marks (ascending)
+        std::vector<int> positions;
+    };
+
+    static RecordingMarks& instance();
+
+    /** Get the marks of a recording.
+     @param recording recording
+     @return marks of the recording or an empty pointer if the recording has no marks
+     */
+    std::shared_ptr<const Marks> get(const cRecording* recording);
+
+private:
+
+    static std::string marksFile(const cRecording* recording);
+
+    std::map<std::string, std::shared_ptr<const Marks>> m_marks;
+
+    std::mutex m_mutex;
+
+};
+
+#endif // ROBOTV_RECORDINGMARKS_H
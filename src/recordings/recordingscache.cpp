@@ -24,23 +24,29 @@
 
 #define __STDC_FORMAT_MACROS // Required for format specifiers
 #include <inttypes.h>
+#include <thread>
 
 #include "config/config.h"
 #include "recordingscache.h"
 #include "tools/hash.h"
+#include "db/statement.h"
 
-RecordingsCache::RecordingsCache() : m_storage(roboTV::Storage::getInstance()) {
+RecordingsCache::RecordingsCache() : m_storage(roboTV::Storage::getInstance()), m_table(m_storage), m_gcRunning(false) {
     // create db schema
-    createDb();
+    m_table.createDb();
 
     // initialize cache
     update();
 }
 
 void RecordingsCache::update() {
+    std::vector<cRecording*> recordings;
+
     for(cRecording* recording = Recordings.First(); recording; recording = Recordings.Next(recording)) {
-        add(recording);
+        recordings.push_back(recording);
     }
+
+    add(recordings);
 }
 
 RecordingsCache::~RecordingsCache() {
@@ -52,238 +58,255 @@ RecordingsCache& RecordingsCache::instance() {
 }
 
 uint32_t RecordingsCache::add(cRecording* recording) {
-    cString filename = recording->FileName();
-    uint32_t uid = createStringHash(filename);
-
-    // try to update existing record
-    m_storage.exec(
-        "INSERT OR IGNORE INTO recordings(recid, filename) VALUES(%u, %Q);",
-        uid,
-        (const char*)filename);
-
-    // insert full text search entry
-    m_storage.exec(
-        "INSERT OR IGNORE INTO fts_recordings(docid, title, subject, description) VALUES(%u, %Q, %Q, %Q);",
-        uid,
-        !isempty(recording->Info()->Title()) ? recording->Info()->Title() : "",
-        !isempty(recording->Info()->ShortText()) ? recording->Info()->ShortText() : "",
-        !isempty(recording->Info()->Description()) ? recording->Info()->Description() : "");
-
-    return uid;
+    return add(std::vector<cRecording*>(1, recording)).front();
 }
 
-cRecording* RecordingsCache::lookup(const std::string& fileName) {
-    return Recordings.GetByName(fileName.c_str());
-}
+std::vector<uint32_t> RecordingsCache::add(const std::vector<cRecording*>& recordings) {
+    std::vector<uint32_t> uids;
+    std::vector<RecordingsTable::Row> rows;
 
-cRecording* RecordingsCache::lookup(uint32_t uid) {
-    DEBUGLOG("%s - lookup uid: %08x", __FUNCTION__, uid);
+    uids.reserve(recordings.size());
+    rows.reserve(recordings.size());
 
-    sqlite3_stmt* s = m_storage.query("SELECT filename FROM recordings WHERE recid=%u;", uid);
+    for(auto recording : recordings) {
+        const char* filename = recording->FileName();
+        uint32_t uid = createStringHash(filename);
+        uids.push_back(uid);
 
-    if(s == NULL) {
-        DEBUGLOG("%s - not found !", __FUNCTION__);
-        return NULL;
+        RecordingsTable::Row row;
+        row.uid = uid;
+        row.fileName = filename;
+        row.title = !isempty(recording->Info()->Title()) ? recording->Info()->Title() : "";
+        row.subject = !isempty(recording->Info()->ShortText()) ? recording->Info()->ShortText() : "";
+        row.description = !isempty(recording->Info()->Description()) ? recording->Info()->Description() : "";
+
+        rows.push_back(std::move(row));
     }
 
-    cString filename;
+    m_table.add(rows);
+    return uids;
+}
+
+std::map<uint32_t, RecordingsCache::Metadata> RecordingsCache::getMetadata() {
+    return m_table.getMetadata();
+}
+
+cRecording* RecordingsCache::lookup(const std::string& fileName) {
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    return findRecording(fileName.c_str());
+}
 
-    if(sqlite3_step(s) == SQLITE_ROW) {
-        filename = (const char*)sqlite3_column_text(s, 0);
+cRecording* RecordingsCache::findRecording(const char* fileName) {
+    if(Recordings.StateChanged(m_indexState) || m_index.empty()) {
+        m_index.clear();
+
+        for(cRecording* recording = Recordings.First(); recording; recording = Recordings.Next(recording)) {
+            m_index[recording->FileName()] = recording;
+        }
     }
 
-    sqlite3_finalize(s);
+    auto i = m_index.find(fileName);
+    return (i != m_index.end()) ? i->second : NULL;
+}
+
+cRecording* RecordingsCache::lookup(uint32_t uid) {
+    DEBUGLOG("%s - lookup uid: %08x", __FUNCTION__, uid);
 
-    if(isempty(filename)) {
+    std::string filename = m_table.getFileName(uid);
+
+    if(filename.empty()) {
         DEBUGLOG("%s - empty filename for uid: %08x !", __FUNCTION__, uid);
         return NULL;
     }
 
-    DEBUGLOG("%s - filename: %s", __FUNCTION__, (const char*)filename);
+    DEBUGLOG("%s - filename: %s", __FUNCTION__, filename.c_str());
 
-    cRecording* r = Recordings.GetByName(filename);
+    cRecording* r = lookup(filename);
     DEBUGLOG("%s - recording %s", __FUNCTION__, (r == NULL) ? "not found !" : "found");
 
     return r;
 }
 
 void RecordingsCache::setPlayCount(uint32_t uid, int count) {
-    m_storage.exec(
-        "UPDATE recordings SET playcount=%i WHERE recid=%u;",
-        count,
-        uid);
+    m_table.setPlayCount(uid, count);
+    m_snapshot.invalidate();
 }
 
 void RecordingsCache::setLastPlayedPosition(uint32_t uid, uint64_t position) {
-    m_storage.exec(
-        "UPDATE recordings SET position=%llu WHERE recid=%u;",
-        position,
-        uid);
+    m_table.setLastPlayedPosition(uid, position);
 }
 
 void RecordingsCache::setPosterUrl(uint32_t uid, const char* url) {
-    m_storage.exec(
-        "UPDATE recordings SET posterurl=%Q WHERE recid=%u;",
-        url,
-        uid);
+    m_table.setPosterUrl(uid, url);
+    m_snapshot.invalidate();
 }
 
 void RecordingsCache::setBackgroundUrl(uint32_t uid, const char* url) {
-    m_storage.exec(
-        "UPDATE recordings SET backgroundurl=%Q WHERE recid=%u;",
-        url,
-        uid);
+    m_table.setBackgroundUrl(uid, url);
+    m_snapshot.invalidate();
 }
 
 void RecordingsCache::setMovieID(uint32_t uid, uint32_t id) {
-    m_storage.exec(
-        "UPDATE recordings SET externalid=%u WHERE recid=%u;",
-        id,
-        uid);
+    m_table.setMovieID(uid, id);
+    m_snapshot.invalidate();
 }
 
 int RecordingsCache::getPlayCount(uint32_t uid) {
-    sqlite3_stmt* s = m_storage.query("SELECT playcount FROM recordings WHERE recid=%u;", uid);
-
-    if(s == NULL) {
-        return 0;
-    }
-
-    int count = 0;
-
-    if(sqlite3_step(s) == SQLITE_ROW) {
-        count = sqlite3_column_int(s, 0);
-    }
-
-    sqlite3_finalize(s);
-    return count;
+    return m_table.getPlayCount(uid);
 }
 
 cString RecordingsCache::getPosterUrl(uint32_t uid) {
-    cString url = "";
-    sqlite3_stmt* s = m_storage.query("SELECT posterurl FROM recordings WHERE recid=%u;", uid);
-
-    if(s == NULL) {
-        return url;
-    }
+    return cString(m_table.getPosterUrl(uid).c_str());
+}
 
-    if(sqlite3_step(s) == SQLITE_ROW) {
-        const char* u = (const char*)sqlite3_column_text(s, 0);
-        INFOLOG("posterurl for %u: %s", uid, u);
+cString RecordingsCache::getBackgroundUrl(uint32_t uid) {
+    return cString(m_table.getBackgroundUrl(uid).c_str());
+}
 
-        if(u != NULL) {
-            url = u;
-        }
-    }
+uint64_t RecordingsCache::getLastPlayedPosition(uint32_t uid) {
+    return m_table.getLastPlayedPosition(uid);
+}
 
-    sqlite3_finalize(s);
-    return url;
+static const char* textOrEmpty(const char* text) {
+    return !isempty(text) ? text : "";
 }
 
-cString RecordingsCache::getBackgroundUrl(uint32_t uid) {
-    cString url = "";
-    sqlite3_stmt* s = m_storage.query("SELECT backgroundurl FROM recordings WHERE recid=%u;", uid);
+static uint32_t searchHash(cRecording* recording) {
+    const cRecordingInfo* info = recording->Info();
 
-    if(s == NULL) {
-        return url;
-    }
+    cString text = cString::sprintf("%s\n%s\n%s",
+                                    textOrEmpty(info->Title()),
+                                    textOrEmpty(info->ShortText()),
+                                    textOrEmpty(info->Description()));
 
-    if(sqlite3_step(s) == SQLITE_ROW) {
-        const char* u = (const char*)sqlite3_column_text(s, 0);
+    // 0 marks rows that were never indexed
+    uint32_t hash = createStringHash(text);
+    return (hash != 0) ? hash : 1;
+}
 
-        if(u != NULL) {
-            url = u;
-        }
+void RecordingsCache::triggerGc() {
+    if(m_gcRunning.exchange(true)) {
+        return;
     }
 
-    sqlite3_finalize(s);
-    return url;
+    std::thread t([ = ]() {
+        gc();
+        m_gcRunning = false;
+    });
+
+    t.detach();
 }
 
-uint64_t RecordingsCache::getLastPlayedPosition(uint32_t uid) {
-    sqlite3_stmt* s = m_storage.query("SELECT position FROM recordings WHERE recid=%u;", uid);
+void RecordingsCache::gc() {
+    std::map<uint32_t, cRecording*> current;
 
-    if(s == NULL) {
-        return 0;
+    for(cRecording* recording = Recordings.First(); recording; recording = Recordings.Next(recording)) {
+        current[createStringHash(recording->FileName())] = recording;
     }
 
-    uint64_t position = 0;
+    // search index state of the cached recordings
+    std::map<uint32_t, uint32_t> indexed;
+    std::vector<uint32_t> outdated;
 
-    if(sqlite3_step(s) == SQLITE_ROW) {
-        position = sqlite3_column_int64(s, 0);
-    }
+    {
+        roboTV::Statement s(m_storage, "SELECT recid, ftshash FROM recordings;");
 
-    sqlite3_finalize(s);
-    return position;
-}
+        while(s.step()) {
+            uint32_t recid = (uint32_t)s.getInt64(0);
 
-void RecordingsCache::gc() {
-    m_storage.exec("DELETE FROM fts_recordings;");
+            if(current.find(recid) == current.end()) {
+                outdated.push_back(recid);
+            }
+            else {
+                indexed[recid] = (uint32_t)s.getInt64(1);
+            }
+        }
+    }
 
-    update();
+    bool transaction = m_storage.begin();
+    int reindexed = 0;
 
-    sqlite3_stmt* s = m_storage.query("SELECT recid, filename FROM recordings;");
+    {
+        roboTV::Statement remove(m_storage, "DELETE FROM recordings WHERE recid=?;");
+        roboTV::Statement removeSearch(m_storage, "DELETE FROM fts_recordings WHERE docid=?;");
+        roboTV::Statement insert(m_storage, "INSERT OR IGNORE INTO recordings(recid, filename) VALUES(?, ?);");
+        roboTV::Statement insertSearch(m_storage, "INSERT INTO fts_recordings(docid, title, subject, description) VALUES(?, ?, ?, ?);");
+        roboTV::Statement updateHash(m_storage, "UPDATE recordings SET ftshash=? WHERE recid=?;");
 
-    if(s == NULL) {
-        return;
-    }
+        // remove orphaned entries
+        for(auto recid : outdated) {
+            INFOLOG("removing outdated recording %08x from cache", recid);
 
-    // check all recordings in the cache
+            remove.bind(1, recid);
+            remove.exec();
+            remove.reset();
 
-    while(sqlite3_step(s) == SQLITE_ROW) {
-        uint32_t recid = (uint32_t)sqlite3_column_int(s, 0);
-        const char* filename = (const char*)sqlite3_column_text(s, 1);
+            removeSearch.bind(1, recid);
+            removeSearch.exec();
+            removeSearch.reset();
+        }
 
-        // remove orphaned entry
-        if(Recordings.GetByName(filename) == NULL) {
-            INFOLOG("removing outdated recording '%s' from cache", filename);
-            m_storage.exec("DELETE FROM recordings WHERE recid=%u;", recid);
+        // add new recordings / index changed texts
+        for(auto& i : current) {
+            uint32_t recid = i.first;
+            cRecording* recording = i.second;
+            uint32_t hash = searchHash(recording);
+            auto state = indexed.find(recid);
+
+            if(state != indexed.end() && state->second == hash) {
+                continue;
+            }
+
+            if(state == indexed.end()) {
+                insert.bind(1, recid).bind(2, recording->FileName());
+                insert.exec();
+                insert.reset();
+            }
+
+            removeSearch.bind(1, recid);
+            removeSearch.exec();
+            removeSearch.reset();
+
+            insertSearch.bind(1, recid)
+            .bind(2, textOrEmpty(recording->Info()->Title()))
+            .bind(3, textOrEmpty(recording->Info()->ShortText()))
+            .bind(4, textOrEmpty(recording->Info()->Description()));
+            insertSearch.exec();
+            insertSearch.reset();
+
+            updateHash.bind(1, hash).bind(2, recid);
+            updateHash.exec();
+            updateHash.reset();
+
+            reindexed++;
         }
     }
 
-    sqlite3_finalize(s);
-}
-
-void RecordingsCache::createDb() {
-    std::string schema =
-        "CREATE TABLE IF NOT EXISTS recordings (\n"
-        "  recid INTEGER PRIMARY KEY,\n"
-        "  filename TEXT NOT NULL,\n"
-        "  position BIGINT DEFAULT 0,\n"
-        "  playcount INTEGER DEFAULT 0,\n"
-        "  posterurl TEXT,\n"
-        "  backgroundurl TEXT,\n"
-        "  externalid INTEGER\n"
-        ");\n"
-        "CREATE INDEX IF NOT EXISTS recordings_externalid on recordings(externalid);\n"
-        "CREATE UNIQUE INDEX IF NOT EXISTS recordings_filename on recordings(filename);\n"
-        "CREATE VIRTUAL TABLE IF NOT EXISTS fts_recordings USING fts4(title, subject, description);\n";
-
-    if(m_storage.exec(schema) != SQLITE_OK) {
-        ERRORLOG("Unable to create database schema for recordings");
+    if(transaction) {
+        m_storage.commit();
     }
+
+    INFOLOG("recordings cache gc: %lu removed, %i indexed", (unsigned long)outdated.size(), reindexed);
 }
 
-void RecordingsCache::search(const char* searchTerm, std::function<void(uint32_t)> resultCallback) {
-    if(searchTerm == NULL) {
-        return;
-    }
+std::vector<RecordingsCache::Hit> RecordingsCache::search(const char* searchTerm, uint32_t offset, uint32_t limit) {
+    std::vector<Hit> result;
+    std::lock_guard<std::mutex> lock(m_indexMutex);
 
-    auto stmt = m_storage.query(
-                    "SELECT docid "
-                    "FROM fts_recordings "
-                    "WHERE fts_recordings MATCH %Q "
-                    "LIMIT 100",
-                    searchTerm);
+    for(auto& row : m_table.search(searchTerm, offset, limit)) {
+        cRecording* recording = findRecording(row.fileName.c_str());
 
-    if(stmt == NULL) {
-        return;
-    }
+        if(recording == NULL) {
+            continue;
+        }
+
+        Hit hit;
+        hit.uid = row.uid;
+        hit.recording = recording;
+        hit.metadata = row.metadata;
 
-    while(sqlite3_step(stmt) == SQLITE_ROW) {
-        uint32_t recid = (uint32_t)sqlite3_column_int(stmt, 0);
-        resultCallback(recid);
+        result.push_back(hit);
     }
 
-    sqlite3_finalize(stmt);
+    return result;
 }
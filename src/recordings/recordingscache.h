@@ -26,14 +26,31 @@
 #define ROBOTV_RECORDINGSCACHE_H
 
 #include <stdint.h>
+#include <atomic>
 #include <map>
-#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <vdr/thread.h>
 #include <vdr/tools.h>
 #include <vdr/recording.h>
 #include "db/storage.h"
+#include "recordingsnapshot.h"
+#include "recordingstable.h"
 
 class RecordingsCache {
+public:
+
+    typedef RecordingsTable::Metadata Metadata;
+
+    /** Resolved search result */
+    struct Hit {
+        uint32_t uid;
+        cRecording* recording;
+        Metadata metadata;
+    };
+
 protected:
 
     RecordingsCache();
@@ -46,6 +63,17 @@ public:
 
     uint32_t add(cRecording* recording);
 
+    /** Add recordings in one transaction.
+     @param recordings recordings to add
+     @return uids of the recordings (in the same order)
+     */
+    std::vector<uint32_t> add(const std::vector<cRecording*>& recordings);
+
+    /** Load the metadata of all recordings in one pass.
+     @return metadata by uid
+     */
+    std::map<uint32_t, Metadata> getMetadata();
+
     cRecording* lookup(uint32_t uid);
 
     cRecording* lookup(const std::string& fileName);
@@ -68,19 +96,55 @@ public:
 
     void setMovieID(uint32_t uid, uint32_t id);
 
+    /** Remove outdated recordings and update the search index.
+     Runs in one transaction. The search index is only updated for
+     added / removed recordings and recordings with changed texts.
+     */
     void gc();
 
-    void search(const char* searchTerm, std::function<void(uint32_t)> resultCallback);
+    /** Run gc() on a background thread (skipped if a gc is running) */
+    void triggerGc();
+
+    /** Ranked full text search in the recordings.
+     Results are ordered by relevance (bm25), titles weigh more than
+     subjects and subjects more than descriptions. All hits are resolved
+     in one pass (filename and metadata with a single joined query),
+     hits without a matching VDR recording are skipped.
+     @param searchTerm FTS4 match expression
+     @param offset number of results to skip
+     @param limit maximum number of results
+     @return resolved hits (ordered by relevance)
+     */
+    std::vector<Hit> search(const char* searchTerm, uint32_t offset = 0, uint32_t limit = 100);
+
+    RecordingsSnapshot& snapshot() {
+        return m_snapshot;
+    }
 
 protected:
 
     void update();
 
-    void createDb();
+    /** Find a recording by filename (lock m_indexMutex).
+     The filename index is rebuilt when VDR's recordings list changed.
+     */
+    cRecording* findRecording(const char* fileName);
 
 private:
 
     roboTV::Storage& m_storage;
+
+    RecordingsTable m_table;
+
+    RecordingsSnapshot m_snapshot;
+
+    std::atomic<bool> m_gcRunning;
+
+    std::mutex m_indexMutex;
+
+    std::unordered_map<std::string, cRecording*> m_index;
+
+    int m_indexState = -1;
 };
 
 
@@ -0,0 +1,143 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include "recordingsnapshot.h"
+#include "config/config.h"
+
+#include <time.h>
+#include <vdr/recording.h>
+
+// maximum number of removed recordings we remember
+#define SNAPSHOT_MAX_REMOVED 1000
+
+RecordingsSnapshot::RecordingsSnapshot() {
+    // generations of a previous server instance are never valid
+    m_generation = (uint64_t)time(NULL) << 16;
+    m_firstGeneration = m_generation;
+}
+
+bool RecordingsSnapshot::isOutdated() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    bool changed = Recordings.StateChanged(m_recordingsState);
+    return (changed || m_invalid);
+}
+
+void RecordingsSnapshot::invalidate() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_invalid = true;
+}
+
+uint64_t RecordingsSnapshot::update(const std::map<uint32_t, uint32_t>& fingerprints) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint64_t next = m_generation + 1;
+    bool modified = false;
+
+    // added / modified recordings
+    for(auto& i : fingerprints) {
+        auto e = m_entries.find(i.first);
+
+        if(e == m_entries.end()) {
+            m_entries[i.first] = { i.second, next, false };
+            modified = true;
+            continue;
+        }
+
+        if(e->second.removed) {
+            m_removedCount--;
+        }
+        else if(e->second.fingerprint == i.second) {
+            continue;
+        }
+
+        e->second = { i.second, next, false };
+        modified = true;
+    }
+
+    // removed recordings
+    for(auto& e : m_entries) {
+        if(e.second.removed || fingerprints.find(e.first) != fingerprints.end()) {
+            continue;
+        }
+
+        e.second = { 0, next, true };
+        m_removedCount++;
+        modified = true;
+    }
+
+    // forget removed recordings (clients with older generations get the full list)
+    if(m_removedCount > SNAPSHOT_MAX_REMOVED) {
+        for(auto e = m_entries.begin(); e != m_entries.end();) {
+            if(e->second.removed) {
+                e = m_entries.erase(e);
+            }
+            else {
+                e++;
+            }
+        }
+
+        m_removedCount = 0;
+        m_firstGeneration = next;
+    }
+
+    if(modified) {
+        m_generation = next;
+        INFOLOG("recordings snapshot generation %llu", (unsigned long long)m_generation);
+    }
+
+    m_invalid = false;
+    return m_generation;
+}
+
+bool RecordingsSnapshot::getChanges(uint64_t generation, std::vector<uint32_t>& changed, std::vector<uint32_t>& removed, uint64_t& current) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    current = m_generation;
+    bool full = (generation < m_firstGeneration || generation > m_generation);
+
+    for(auto& e : m_entries) {
+        if(full) {
+            if(!e.second.removed) {
+                changed.push_back(e.first);
+            }
+
+            continue;
+        }
+
+        if(e.second.generation <= generation) {
+            continue;
+        }
+
+        if(e.second.removed) {
+            removed.push_back(e.first);
+        }
+        else {
+            changed.push_back(e.first);
+        }
+    }
+
+    return !full;
+}
@@ -0,0 +1,91 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_RECORDINGSNAPSHOT_H
+#define ROBOTV_RECORDINGSNAPSHOT_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/** Generation numbered snapshot of the recordings list.
+ Every recording is tracked with a fingerprint of its serialized list
+ entry. Each update that adds, modifies or removes recordings creates a
+ new generation, so clients can fetch the changes since the generation
+ they already know.
+ */
+class RecordingsSnapshot {
+public:
+
+    RecordingsSnapshot();
+
+    /** Check if the snapshot needs an update.
+     @return true if the recordings or their metadata changed since the last update
+     */
+    bool isOutdated();
+
+    /** Mark the snapshot as outdated (e.g. metadata changed) */
+    void invalidate();
+
+    /** Update the snapshot.
+     @param fingerprints fingerprint of every recording (by uid)
+     @return current generation
+     */
+    uint64_t update(const std::map<uint32_t, uint32_t>& fingerprints);
+
+    /** Get the changes since a generation.
+     @param generation generation known by the client
+     @param changed added / modified recordings
+     @param removed removed recordings
+     @param current current generation
+     @return false if the generation is unknown (the full list is needed)
+     */
+    bool getChanges(uint64_t generation, std::vector<uint32_t>& changed, std::vector<uint32_t>& removed, uint64_t& current);
+
+private:
+
+    struct Entry {
+        uint32_t fingerprint;
+        uint64_t generation;
+        bool removed;
+    };
+
+    std::mutex m_mutex;
+
+    std::map<uint32_t, Entry> m_entries;
+
+    uint64_t m_generation;
+
+    uint64_t m_firstGeneration;
+
+    int m_recordingsState = -1;
+
+    bool m_invalid = true;
+
+    int m_removedCount = 0;
+};
+
+#endif // ROBOTV_RECORDINGSNAPSHOT_H
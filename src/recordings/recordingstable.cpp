@@ -0,0 +1,243 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "config/config.h"
+#include "db/statement.h"
+#include "recordingstable.h"
+
+RecordingsTable::RecordingsTable(roboTV::Database& storage) : m_storage(storage) {
+}
+
+RecordingsTable::~RecordingsTable() {
+}
+
+void RecordingsTable::createDb() {
+    std::string schema =
+        "CREATE TABLE IF NOT EXISTS recordings (\n"
+        "  recid INTEGER PRIMARY KEY,\n"
+        "  filename TEXT NOT NULL,\n"
+        "  position BIGINT DEFAULT 0,\n"
+        "  playcount INTEGER DEFAULT 0,\n"
+        "  posterurl TEXT,\n"
+        "  backgroundurl TEXT,\n"
+        "  externalid INTEGER,\n"
+        "  ftshash INTEGER DEFAULT 0 NOT NULL\n"
+        ");\n"
+        "CREATE INDEX IF NOT EXISTS recordings_externalid on recordings(externalid);\n"
+        "CREATE UNIQUE INDEX IF NOT EXISTS recordings_filename on recordings(filename);\n"
+        "CREATE VIRTUAL TABLE IF NOT EXISTS fts_recordings USING fts4(title, subject, description);\n";
+
+    if(m_storage.exec(schema) != SQLITE_OK) {
+        ERRORLOG("Unable to create database schema for recordings");
+    }
+
+    // update older version of table (all recordings get indexed again)
+    if(!m_storage.tableHasColumn("recordings", "ftshash")) {
+        m_storage.exec("ALTER TABLE recordings ADD COLUMN ftshash INTEGER DEFAULT 0 NOT NULL");
+    }
+}
+
+void RecordingsTable::add(const std::vector<Row>& rows) {
+    bool transaction = m_storage.begin();
+
+    {
+        roboTV::Statement insert(m_storage, "INSERT OR IGNORE INTO recordings(recid, filename) VALUES(?, ?);");
+        roboTV::Statement insertSearch(m_storage, "INSERT OR IGNORE INTO fts_recordings(docid, title, subject, description) VALUES(?, ?, ?, ?);");
+
+        for(auto& row : rows) {
+            // try to update existing record
+            insert.bind(1, row.uid).bind(2, row.fileName);
+            insert.exec();
+            insert.reset();
+
+            // insert full text search entry
+            insertSearch.bind(1, row.uid)
+            .bind(2, row.title)
+            .bind(3, row.subject)
+            .bind(4, row.description);
+            insertSearch.exec();
+            insertSearch.reset();
+        }
+    }
+
+    if(transaction) {
+        m_storage.commit();
+    }
+}
+
+std::map<uint32_t, RecordingsTable::Metadata> RecordingsTable::getMetadata() {
+    std::map<uint32_t, Metadata> result;
+    roboTV::Statement s(m_storage, "SELECT recid, playcount, posterurl, backgroundurl FROM recordings;");
+
+    while(s.step()) {
+        Metadata& m = result[(uint32_t)s.getInt64(0)];
+        m.playCount = s.getInt(1);
+
+        const char* poster = s.getText(2);
+        const char* background = s.getText(3);
+
+        m.posterUrl = (poster != NULL) ? poster : "";
+        m.backgroundUrl = (background != NULL) ? background : "";
+    }
+
+    return result;
+}
+
+std::string RecordingsTable::getFileName(uint32_t uid) {
+    roboTV::Statement s(m_storage, "SELECT filename FROM recordings WHERE recid=?;");
+
+    if(!s.bind(1, uid).step()) {
+        return "";
+    }
+
+    const char* filename = s.getText(0);
+    return (filename != NULL) ? filename : "";
+}
+
+void RecordingsTable::setPlayCount(uint32_t uid, int count) {
+    m_storage.exec(
+        "UPDATE recordings SET playcount=%i WHERE recid=%u;",
+        count,
+        uid);
+}
+
+void RecordingsTable::setLastPlayedPosition(uint32_t uid, uint64_t position) {
+    m_storage.exec(
+        "UPDATE recordings SET position=%llu WHERE recid=%u;",
+        position,
+        uid);
+}
+
+void RecordingsTable::setPosterUrl(uint32_t uid, const char* url) {
+    m_storage.exec(
+        "UPDATE recordings SET posterurl=%Q WHERE recid=%u;",
+        url,
+        uid);
+}
+
+void RecordingsTable::setBackgroundUrl(uint32_t uid, const char* url) {
+    m_storage.exec(
+        "UPDATE recordings SET backgroundurl=%Q WHERE recid=%u;",
+        url,
+        uid);
+}
+
+void RecordingsTable::setMovieID(uint32_t uid, uint32_t id) {
+    m_storage.exec(
+        "UPDATE recordings SET externalid=%u WHERE recid=%u;",
+        id,
+        uid);
+}
+
+int RecordingsTable::getPlayCount(uint32_t uid) {
+    roboTV::Statement s(m_storage, "SELECT playcount FROM recordings WHERE recid=?;");
+
+    if(!s.bind(1, uid).step()) {
+        return 0;
+    }
+
+    return s.getInt(0);
+}
+
+std::string RecordingsTable::getPosterUrl(uint32_t uid) {
+    std::string url;
+    roboTV::Statement s(m_storage, "SELECT posterurl FROM recordings WHERE recid=?;");
+
+    if(s.bind(1, uid).step()) {
+        const char* u = s.getText(0);
+        INFOLOG("posterurl for %u: %s", uid, u);
+
+        if(u != NULL) {
+            url = u;
+        }
+    }
+
+    return url;
+}
+
+std::string RecordingsTable::getBackgroundUrl(uint32_t uid) {
+    std::string url;
+    roboTV::Statement s(m_storage, "SELECT backgroundurl FROM recordings WHERE recid=?;");
+
+    if(s.bind(1, uid).step()) {
+        const char* u = s.getText(0);
+
+        if(u != NULL) {
+            url = u;
+        }
+    }
+
+    return url;
+}
+
+uint64_t RecordingsTable::getLastPlayedPosition(uint32_t uid) {
+    roboTV::Statement s(m_storage, "SELECT position FROM recordings WHERE recid=?;");
+
+    if(!s.bind(1, uid).step()) {
+        return 0;
+    }
+
+    return s.getInt64(0);
+}
+
+std::vector<RecordingsTable::Hit> RecordingsTable::search(const char* searchTerm, uint32_t offset, uint32_t limit) {
+    std::vector<Hit> result;
+
+    if(searchTerm == NULL) {
+        return result;
+    }
+
+    roboTV::Statement s(m_storage,
+                        "SELECT docid, filename, playcount, posterurl, backgroundurl "
+                        "FROM fts_recordings "
+                        "JOIN recordings ON recordings.recid = fts_recordings.docid "
+                        "WHERE fts_recordings MATCH ? "
+                        "ORDER BY bm25(matchinfo(fts_recordings, 'pcnalx'), 4.0, 2.0, 1.0) "
+                        "LIMIT ? OFFSET ?");
+
+    s.bind(1, searchTerm)
+    .bind(2, limit)
+    .bind(3, offset);
+
+    while(s.step()) {
+        const char* filename = s.getText(1);
+        const char* poster = s.getText(3);
+        const char* background = s.getText(4);
+
+        if(filename == NULL) {
+            continue;
+        }
+
+        Hit hit;
+        hit.uid = (uint32_t)s.getInt64(0);
+        hit.fileName = filename;
+        hit.metadata.playCount = s.getInt(2);
+        hit.metadata.posterUrl = (poster != NULL) ? poster : "";
+        hit.metadata.backgroundUrl = (background != NULL) ? background : "";
+
+        result.push_back(hit);
+    }
+
+    return result;
+}
@@ -0,0 +1,117 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_RECORDINGSTABLE_H
+#define ROBOTV_RECORDINGSTABLE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "db/database.h"
+
+/** Rows of the recordings cache.
+ Metadata of every recording (play count, position, artwork) by uid and
+ the full text search index of the recording texts. This part doesn't
+ depend on VDR, the RecordingsCache maps the rows to VDR's recordings.
+ */
+class RecordingsTable {
+public:
+
+    struct Metadata {
+        int playCount = 0;
+        std::string posterUrl;
+        std::string backgroundUrl;
+    };
+
+    struct Row {
+        uint32_t uid;
+        std::string fileName;
+        std::string title;
+        std::string subject;
+        std::string description;
+    };
+
+    struct Hit {
+        uint32_t uid;
+        std::string fileName;
+        Metadata metadata;
+    };
+
+    RecordingsTable(roboTV::Database& storage);
+
+    virtual ~RecordingsTable();
+
+    void createDb();
+
+    /** Add rows (and their search entries) in one transaction.
+     Existing rows are kept.
+     */
+    void add(const std::vector<Row>& rows);
+
+    /** Load the metadata of all recordings in one pass.
+     @return metadata by uid
+     */
+    std::map<uint32_t, Metadata> getMetadata();
+
+    /** Filename of a recording (empty if not found) */
+    std::string getFileName(uint32_t uid);
+
+    int getPlayCount(uint32_t uid);
+
+    void setPlayCount(uint32_t uid, int count);
+
+    uint64_t getLastPlayedPosition(uint32_t uid);
+
+    void setLastPlayedPosition(uint32_t uid, uint64_t position);
+
+    std::string getPosterUrl(uint32_t uid);
+
+    void setPosterUrl(uint32_t uid, const char* url);
+
+    std::string getBackgroundUrl(uint32_t uid);
+
+    void setBackgroundUrl(uint32_t uid, const char* url);
+
+    void setMovieID(uint32_t uid, uint32_t id);
+
+    /** Ranked full text search.
+     Results are ordered by relevance (bm25), titles weigh more than
+     subjects and subjects more than descriptions. Filename and metadata
+     of all hits are read with a single joined query.
+     @param searchTerm FTS4 match expression
+     @param offset number of results to skip
+     @param limit maximum number of results
+     @return hits (ordered by relevance)
+     */
+    std::vector<Hit> search(const char* searchTerm, uint32_t offset = 0, uint32_t limit = 100);
+
+private:
+
+    roboTV::Database& m_storage;
+
+};
+
+#endif // ROBOTV_RECORDINGSTABLE_H
@@ -24,87 +24,86 @@
 
 #include "recplayer.h"
 #include "config/config.h"
+#include "tools/ioengine.h"
+#include "tools/time.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 
 #ifndef O_NOATIME
 #define O_NOATIME 0
 #endif
 
-RecPlayer::RecPlayer(cRecording* rec) {
+// size of a prefetched chunk
+#define PREFETCH_CHUNK_SIZE (1024 * 1024)
+
+// minimum amount of data kept ahead of the read position
+#define PREFETCH_MIN_SIZE (4 * 1024 * 1024)
+
+// maximum amount of data kept ahead of the read position
+#define PREFETCH_MAX_SIZE (32 * 1024 * 1024)
+
+RecPlayer::RecPlayer(cRecording* rec) : m_stallTime(0) {
     m_file = -1;
     m_fileOpen = -1;
-    m_rescanInterval = 0;
-    m_recordingFilename = strdup(rec->FileName());
     m_totalLength = 0;
-    m_pesrecording = rec->IsPesRecording();
+    m_index = RecordingIndex::get(rec);
 
     scan();
-    m_rescanTime.Set(0);
-}
 
-RecPlayer::~RecPlayer() {
-    cleanup();
-    closeFile();
-    free(m_recordingFilename);
+    m_prefetchThread = std::thread([&]() {
+        prefetch();
+    });
 }
 
-void RecPlayer::cleanup() {
-    for(int i = 0; i != m_segments.Size(); i++) {
-        delete m_segments[i];
+RecPlayer::~RecPlayer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        m_cond.notify_all();
     }
 
-    m_segments.Clear();
-}
+    m_prefetchThread.join();
 
-void RecPlayer::scan() {
-    struct stat s;
-    uint64_t len = m_totalLength;
-    m_totalLength = 0;
-
-    cleanup();
-
-    for(int i = 0; ; i++) {
-        fileNameFromIndex(i);
+    INFOLOG("prefetch: %llu hits / %llu misses / %lli ms stalled",
+            (unsigned long long)m_hits, (unsigned long long)m_misses, (long long)m_stallTime.count());
 
-        if(stat(m_fileName, &s) == -1) {
-            break;
-        }
+    for(auto& i : m_chunks) {
+        free(i.second.data);
+    }
 
-        Segment* segment = new Segment();
-        segment->start = m_totalLength;
-        segment->end = segment->start + s.st_size;
+    closeFile();
+}
 
-        m_segments.Append(segment);
+void RecPlayer::scan() {
+    std::vector<Segment> segments;
+    uint64_t totalLength = 0;
+    uint64_t generation = m_index->getSegments(segments, totalLength);
 
-        m_totalLength += s.st_size;
-    }
+    // the prefetch thread reads the segments
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-    if(len != m_totalLength) {
-        INFOLOG("recording scan: %lu bytes", m_totalLength);
-    }
+    m_segments.swap(segments);
+    m_totalLength = totalLength;
+    m_generation = generation;
+    m_cond.notify_all();
 }
 
 bool RecPlayer::update() {
-    // do not rescan too often
-    if(m_rescanTime.Elapsed() < m_rescanInterval) {
+    m_index->update();
+
+    // segments unchanged since the last sync
+    if(m_index->generation() == m_generation) {
         return false;
     }
 
-    m_rescanInterval = 10000; // 10s rescan interval
-    m_rescanTime.Set(0);
     scan();
-
     return true;
 }
 
-char* RecPlayer::fileNameFromIndex(int index) {
-    if(m_pesrecording) {
-        snprintf(m_fileName, sizeof(m_fileName), "%s/%03i.vdr", m_recordingFilename, index + 1);
-    }
-    else {
-        snprintf(m_fileName, sizeof(m_fileName), "%s/%05i.ts", m_recordingFilename, index + 1);
-    }
-
-    return m_fileName;
+char* RecPlayer::fileNameFromIndex(int index, char* fileName, size_t size) {
+    return m_index->segmentFileName(index, fileName, size);
 }
 
 bool RecPlayer::openFile(int index) {
@@ -114,7 +113,7 @@ bool RecPlayer::openFile(int index) {
 
     closeFile();
 
-    fileNameFromIndex(index);
+    fileNameFromIndex(index, m_fileName, sizeof(m_fileName));
     INFOLOG("openFile called for index %i (%s)", index, m_fileName);
 
     // first try to open with NOATIME flag
@@ -132,6 +131,11 @@ bool RecPlayer::openFile(int index) {
         return false;
     }
 
+#ifndef __FreeBSD__
+    // we read the file sequentially
+    posix_fadvise(m_file, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
     m_fileOpen = index;
     return true;
 }
@@ -148,10 +152,129 @@ void RecPlayer::closeFile() {
     m_fileOpen = -1;
 }
 
+bool RecPlayer::openDirectFile(int index) {
+    if(index == m_directFileOpen) {
+        return true;
+    }
+
+    m_directFile.reset();
+    m_directFileOpen = -1;
+
+    char fileName[512];
+    fileNameFromIndex(index, fileName, sizeof(fileName));
+
+    int fd = open(fileName, O_RDONLY | O_NOATIME);
+
+    if(fd == -1) {
+        fd = open(fileName, O_RDONLY);
+    }
+
+    if(fd == -1) {
+        ERRORLOG("unable to open file: %s", fileName);
+        return false;
+    }
+
+    // packets referencing the file keep it open
+    m_directFile = std::shared_ptr<int>(new int(fd), [](int* fd) {
+        close(*fd);
+        delete fd;
+    });
+
+    m_directFileOpen = index;
+    return true;
+}
+
+bool RecPlayer::findSegment(uint64_t position, int amount, int& segmentNumber, uint64_t& filePosition, int& length) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for(int i = 0; i < (int)m_segments.size(); i++) {
+        if((position >= m_segments[i].start) && (position < m_segments[i].end)) {
+            segmentNumber = i;
+            filePosition = position - m_segments[i].start;
+            length = std::min((uint64_t)amount, m_segments[i].end - position);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t RecPlayer::putFileRange(MsgPacket* packet, uint64_t position, uint32_t amount) {
+    uint32_t bytes = 0;
+
+    while(bytes < amount) {
+        int segmentNumber = -1;
+        uint64_t filePosition = 0;
+        int length = 0;
+
+        if(!findSegment(position, amount - bytes, segmentNumber, filePosition, length) || !openDirectFile(segmentNumber)) {
+            break;
+        }
+
+        if(!packet->put_FileSegment(m_directFile, filePosition, length)) {
+            break;
+        }
+
+        bytes += length;
+        position += length;
+    }
+
+    return bytes;
+}
+
+int RecPlayer::getBlockDirect(unsigned char* buffer, uint64_t position, int amount) {
+    int bytes = 0;
+
+    while(bytes < amount) {
+        int segmentNumber = -1;
+        uint64_t filePosition = 0;
+        int length = 0;
+
+        if(!findSegment(position, amount - bytes, segmentNumber, filePosition, length) || !openDirectFile(segmentNumber)) {
+            break;
+        }
+
+        int bytes_read = IoEngine::pread(*m_directFile, buffer + bytes, length, filePosition);
+
+        if(bytes_read <= 0) {
+            break;
+        }
+
+        bytes += bytes_read;
+        position += bytes_read;
+    }
+
+    return bytes;
+}
+
 uint64_t RecPlayer::getLengthBytes() {
     return m_totalLength;
 }
 
+void RecPlayer::setPrefetchLimit(uint64_t position) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(position != m_prefetchLimit) {
+        m_prefetchLimit = position;
+        m_cond.notify_all();
+    }
+}
+
+uint64_t RecPlayer::getPrefetchHits() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+uint64_t RecPlayer::getPrefetchMisses() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
+
+std::chrono::milliseconds RecPlayer::getStallTime() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stallTime;
+}
+
 int RecPlayer::getBlock(unsigned char* buffer, uint64_t position, int amount) {
     // dont let the block be larger than 256 kb
     if(amount > 256 * 1024) {
@@ -170,52 +293,189 @@ int RecPlayer::getBlock(unsigned char* buffer, uint64_t position, int amount) {
         amount = m_totalLength - position;
     }
 
-    // work out what block "position" is in
-    int segmentNumber = -1;
+    std::unique_lock<std::mutex> lock(m_mutex);
 
-    for(int i = 0; i < m_segments.Size(); i++) {
-        if((position >= m_segments[i]->start) && (position < m_segments[i]->end)) {
-            segmentNumber = i;
-            break;
+    int bytes = 0;
+    bool stalled = false;
+
+    while(bytes < amount) {
+        uint64_t p = position + bytes;
+        uint64_t chunk = p / PREFETCH_CHUNK_SIZE;
+
+        // move the prefetch window
+        if(chunk != m_readChunk) {
+            m_readChunk = chunk;
+            evictChunks();
+            m_cond.notify_all();
         }
+
+        // wait for the prefetch thread
+        if(!isAvailable(p)) {
+            if(m_failedChunk == (int64_t)chunk) {
+                m_failedChunk = -1;
+                break;
+            }
+
+            std::chrono::milliseconds start = roboTV::currentTimeMillis();
+            stalled = true;
+
+            m_cond.notify_all();
+            m_cond.wait(lock, [&]() {
+                return isAvailable(p) || m_failedChunk == (int64_t)chunk || !m_running;
+            });
+
+            m_stallTime += roboTV::currentTimeMillis() - start;
+            continue;
+        }
+
+        Chunk& c = m_chunks[chunk];
+        int offset = p - chunk * PREFETCH_CHUNK_SIZE;
+        int length = std::min(amount - bytes, c.length - offset);
+
+        memcpy(buffer + bytes, c.data + offset, length);
+        bytes += length;
     }
 
-    // segment not found / invalid position
-    if(segmentNumber == -1) {
-        return 0;
+    if(stalled) {
+        m_misses++;
+    }
+    else {
+        m_hits++;
     }
 
-    // open file (if not already open)
-    if(!openFile(segmentNumber)) {
-        return 0;
+    return bytes;
+}
+
+bool RecPlayer::isAvailable(uint64_t position) {
+    auto i = m_chunks.find(position / PREFETCH_CHUNK_SIZE);
+    return (i != m_chunks.end() && position % PREFETCH_CHUNK_SIZE < (uint64_t)i->second.length);
+}
+
+void RecPlayer::evictChunks() {
+    uint64_t last = m_readChunk + PREFETCH_MAX_SIZE / PREFETCH_CHUNK_SIZE;
+
+    // drop chunks outside of the prefetch window (already played / seek)
+    for(auto i = m_chunks.begin(); i != m_chunks.end();) {
+        if(i->first < m_readChunk || i->first > last) {
+            free(i->second.data);
+            i = m_chunks.erase(i);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+bool RecPlayer::nextChunk(uint64_t& chunk) {
+    if(m_totalLength == 0) {
+        return false;
     }
 
-    // work out position in current file
-    uint64_t filePosition = position - m_segments[segmentNumber]->start;
+    // range to keep in memory
+    uint64_t start = m_readChunk * PREFETCH_CHUNK_SIZE;
+    uint64_t end = std::max(m_prefetchLimit, start + PREFETCH_MIN_SIZE);
+    end = std::min(std::min(end, start + PREFETCH_MAX_SIZE), m_totalLength);
 
-    // seek to position
-    if(lseek(m_file, filePosition, SEEK_SET) == -1) {
-        ERRORLOG("unable to seek to position: %lu", filePosition);
-        return 0;
+    for(chunk = m_readChunk; chunk * PREFETCH_CHUNK_SIZE < end; chunk++) {
+        if((int64_t)chunk == m_failedChunk) {
+            continue;
+        }
+
+        auto i = m_chunks.find(chunk);
+
+        if(i == m_chunks.end()) {
+            return true;
+        }
+
+        // the recording has grown since the chunk has been read
+        uint64_t chunkEnd = chunk * PREFETCH_CHUNK_SIZE + i->second.length;
+
+        if(i->second.length < PREFETCH_CHUNK_SIZE && chunkEnd < m_totalLength) {
+            free(i->second.data);
+            m_chunks.erase(i);
+            return true;
+        }
     }
 
-    // try to read the block
-    int bytes_read = read(m_file, buffer, amount);
-    DEBUGLOG("read %i bytes from file %i at position %llu", bytes_read, segmentNumber, filePosition);
+    return false;
+}
 
-    if(bytes_read <= 0) {
-        return 0;
+void RecPlayer::prefetch() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(m_running) {
+        uint64_t chunk = 0;
+
+        if(!nextChunk(chunk)) {
+            m_cond.wait(lock);
+            continue;
+        }
+
+        // read the chunk without holding the lock
+        lock.unlock();
+
+        uint8_t* data = (uint8_t*)malloc(PREFETCH_CHUNK_SIZE);
+        int length = (data != NULL) ? readBlock(data, chunk * PREFETCH_CHUNK_SIZE, PREFETCH_CHUNK_SIZE) : 0;
+
+        lock.lock();
+
+        if(length <= 0) {
+            m_failedChunk = chunk;
+            free(data);
+        }
+        // still needed ?
+        else if(chunk >= m_readChunk && chunk <= m_readChunk + PREFETCH_MAX_SIZE / PREFETCH_CHUNK_SIZE) {
+            if(m_failedChunk == (int64_t)chunk) {
+                m_failedChunk = -1;
+            }
+
+            m_chunks[chunk] = {data, length};
+        }
+        else {
+            free(data);
+        }
+
+        m_cond.notify_all();
     }
+}
+
+int RecPlayer::readBlock(unsigned char* buffer, uint64_t position, int amount) {
+    int bytes = 0;
+
+    while(bytes < amount) {
+        int segmentNumber = -1;
+        uint64_t filePosition = 0;
+        int length = 0;
+
+        // work out what block "position" is in
+        if(!findSegment(position, amount - bytes, segmentNumber, filePosition, length)) {
+            break;
+        }
+
+        // open file (if not already open)
+        if(!openFile(segmentNumber)) {
+            break;
+        }
+
+        // try to read the block
+        int bytes_read = IoEngine::pread(m_file, buffer + bytes, length, filePosition);
+        DEBUGLOG("read %i bytes from file %i at position %llu", bytes_read, segmentNumber, filePosition);
+
+        if(bytes_read <= 0) {
+            break;
+        }
 
 #ifndef __FreeBSD__
-    // Tell linux not to bother keeping the data in the FS cache
-    posix_fadvise(m_file, filePosition, bytes_read, POSIX_FADV_DONTNEED);
+        // Tell linux not to bother keeping the data in the FS cache
+        posix_fadvise(m_file, filePosition, bytes_read, POSIX_FADV_DONTNEED);
+
+        // but start reading the next chunk
+        posix_fadvise(m_file, filePosition + bytes_read, PREFETCH_CHUNK_SIZE, POSIX_FADV_WILLNEED);
 #endif
 
-    // divide and conquer
-    if(bytes_read < amount) {
-        bytes_read += getBlock(&buffer[bytes_read], position + bytes_read, amount - bytes_read);
+        bytes += bytes_read;
+        position += bytes_read;
     }
 
-    return bytes_read;
+    return bytes;
 }
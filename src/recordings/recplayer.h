@@ -28,12 +28,16 @@
 #include <stdio.h>
 #include <vdr/tools.h>
 #include <vdr/recording.h>
+#include "recordings/recordingindex.h"
+#include "net/msgpacket.h"
 
-class Segment {
-public:
-    uint64_t start;
-    uint64_t end;
-};
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 class RecPlayer {
 public:
@@ -46,9 +50,35 @@ public:
 
     int getBlock(unsigned char* buffer, uint64_t position, int amount);
 
-    bool openFile(int index);
+    /** Read a block bypassing the prefetch buffer.
+     Used for random access (keyframe trick-play). The prefetch window
+     is left untouched and the file is read with a separate descriptor.
+     @return number of bytes read
+     */
+    int getBlockDirect(unsigned char* buffer, uint64_t position, int amount);
 
-    void closeFile();
+    /** Reference a range of the recording in a packet.
+     The range is appended as file segments and sent with sendfile,
+     the data is never copied into user space.
+     @return number of bytes referenced
+     */
+    uint32_t putFileRange(MsgPacket* packet, uint64_t position, uint32_t amount);
+
+    /** Set the end of the prefetch range.
+     The prefetch thread keeps the data between the current read position
+     and this position in memory (within the limits of the prefetch buffer).
+     @param position end position of the prefetch range (in bytes)
+     */
+    void setPrefetchLimit(uint64_t position);
+
+    /** Number of blocks served without waiting for the file */
+    uint64_t getPrefetchHits();
+
+    /** Number of blocks we had to wait for */
+    uint64_t getPrefetchMisses();
+
+    /** Time spent waiting for the file */
+    std::chrono::milliseconds getStallTime();
 
 protected:
 
@@ -56,19 +86,39 @@ protected:
 
     uint64_t m_totalLength;
 
-    cVector<Segment*> m_segments;
+    std::vector<Segment> m_segments;
+
+    /** Index and segment table shared with other players of the recording */
+    std::shared_ptr<RecordingIndex> m_index;
 
 private:
 
+    struct Chunk {
+        uint8_t* data;
+        int length;
+    };
+
     void scan();
 
-    void cleanup();
+    char* fileNameFromIndex(int index, char* fileName, size_t size);
+
+    bool openFile(int index);
+
+    void closeFile();
+
+    bool openDirectFile(int index);
 
-    char* fileNameFromIndex(int index);
+    bool findSegment(uint64_t position, int amount, int& segmentNumber, uint64_t& filePosition, int& length);
 
-    void checkBufferSize(int s);
+    int readBlock(unsigned char* buffer, uint64_t position, int amount);
 
-    bool m_pesrecording;
+    void prefetch();
+
+    bool nextChunk(uint64_t& chunk);
+
+    bool isAvailable(uint64_t position);
+
+    void evictChunks();
 
     char m_fileName[512];
 
@@ -76,11 +126,33 @@ private:
 
     int m_fileOpen;
 
-    char* m_recordingFilename;
+    std::shared_ptr<int> m_directFile;
+
+    int m_directFileOpen = -1;
+
+    uint64_t m_generation = 0;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_cond;
+
+    std::thread m_prefetchThread;
+
+    bool m_running = true;
+
+    std::map<uint64_t, Chunk> m_chunks;
+
+    uint64_t m_readChunk = 0;
+
+    uint64_t m_prefetchLimit = 0;
+
+    int64_t m_failedChunk = -1;
+
+    uint64_t m_hits = 0;
 
-    cTimeMs m_rescanTime;
+    uint64_t m_misses = 0;
 
-    uint32_t m_rescanInterval;
+    std::chrono::milliseconds m_stallTime;
 };
 
 #endif // ROBOTV_RECPLAYER_H
@@ -0,0 +1,62 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "chunkedresponse.h"
+#include "net/msgpacket.h"
+#include "robotv/robotvcommand.h"
+
+thread_local ChunkedResponse* ChunkedResponse::m_current = NULL;
+
+ChunkedResponse::ChunkedResponse(MsgPacket* response, Sink sink, uint32_t chunkSize) :
+    m_response(response), m_sink(sink), m_chunkSize(chunkSize), m_previous(m_current) {
+    m_current = this;
+}
+
+ChunkedResponse::~ChunkedResponse() {
+    m_current = m_previous;
+}
+
+bool ChunkedResponse::isDue(MsgPacket* response) {
+    ChunkedResponse* current = m_current;
+
+    return (current != NULL &&
+            current->m_response == response &&
+            response->getPayloadLength() >= current->m_chunkSize &&
+            !response->hasFileSegments());
+}
+
+bool ChunkedResponse::flush(MsgPacket* response) {
+    if(!isDue(response)) {
+        return false;
+    }
+
+    MsgPacket* chunk = new MsgPacket(response->getMsgID(), ROBOTV_CHANNEL_RESPONSE_CHUNK, response->getUID());
+    chunk->setProtocolVersion(response->getProtocolVersion());
+    chunk->put_Blob(response->getPayload(), response->getPayloadLength());
+
+    response->clear();
+    m_current->m_sink(chunk);
+
+    return true;
+}
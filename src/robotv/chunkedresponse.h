@@ -0,0 +1,87 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_CHUNKEDRESPONSE_H
+#define ROBOTV_CHUNKEDRESPONSE_H
+
+#include <stdint.h>
+#include <functional>
+
+class MsgPacket;
+
+/**
+ * Progressive delivery of large responses.
+ * While a request is processed, the client installs a ChunkedResponse
+ * for the response on the processing thread. List handlers call flush()
+ * between their entries: once the payload reached the chunk size it is
+ * sent ahead as a ROBOTV_CHANNEL_RESPONSE_CHUNK packet (same message id
+ * and uid as the request) and the response starts over empty. The final
+ * ROBOTV_CHANNEL_REQUEST_RESPONSE packet marks the end, the payloads of
+ * all chunks and the final packet joined form the complete response.
+ * Without an installed ChunkedResponse (e.g. clients not supporting
+ * chunks, batched requests) flush() does nothing.
+ */
+class ChunkedResponse {
+public:
+
+    typedef std::function<void(MsgPacket*)> Sink;
+
+    enum {
+        DefaultChunkSize = 64 * 1024
+    };
+
+    /** Install for the current thread (until destroyed)
+     @param response the response being built
+     @param sink sends a chunk (takes over the packet)
+     @param chunkSize payload size of a chunk
+     */
+    ChunkedResponse(MsgPacket* response, Sink sink, uint32_t chunkSize = DefaultChunkSize);
+
+    virtual ~ChunkedResponse();
+
+    /** Check if flush() would send a chunk */
+    static bool isDue(MsgPacket* response);
+
+    /** Send the payload collected so far as a chunk (if due).
+     @return true if a chunk was sent
+     */
+    static bool flush(MsgPacket* response);
+
+private:
+
+    MsgPacket* m_response;
+
+    Sink m_sink;
+
+    uint32_t m_chunkSize;
+
+    ChunkedResponse* m_previous;
+
+    static thread_local ChunkedResponse* m_current;
+
+    ChunkedResponse(const ChunkedResponse& orig);
+
+};
+
+#endif // ROBOTV_CHUNKEDRESPONSE_H
@@ -35,16 +35,14 @@ ArtworkController::ArtworkController(const ArtworkController& orig) {
 ArtworkController::~ArtworkController() {
 }
 
-bool ArtworkController::process(MsgPacket* request, MsgPacket* response) {
-    switch(request->getMsgID()) {
-        case ROBOTV_ARTWORK_GET:
-            return processGet(request, response);
+void ArtworkController::registerHandlers(RequestTable& table) {
+    table.add(ROBOTV_ARTWORK_GET, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGet(request, response);
+    });
 
-        case ROBOTV_ARTWORK_SET:
-            return processSet(request, response);
-    }
-
-    return false;
+    table.add(ROBOTV_ARTWORK_SET, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSet(request, response);
+    });
 }
 
 bool ArtworkController::processGet(MsgPacket* request, MsgPacket* response) {
@@ -37,7 +37,7 @@ public:
 
     virtual ~ArtworkController();
 
-    bool process(MsgPacket* request, MsgPacket* response);
+    void registerHandlers(RequestTable& table);
 
 protected:
 
@@ -22,13 +22,71 @@
  *
  */
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <live/channelcache.h>
 #include "channelcontroller.h"
 #include "net/msgpacket.h"
+#include "robotv/chunkedresponse.h"
 #include "robotv/robotvcommand.h"
 #include "tools/hash.h"
 #include "tools/urlencode.h"
 
+// maximum age of a cached channel list in seconds
+#define CHANNELLIST_CACHE_TTL 300
+
+// maximum number of cached channel lists (distinct filter settings)
+#define CHANNELLIST_CACHE_SIZE 32
+
+// maximum number of cached service references / logo urls
+#define CHANNELREF_CACHE_SIZE 16384
+
+struct ChannelListCacheEntry {
+    uint64_t channelsHash = 0;
+    uint32_t enabledVersion = 0;
+    time_t created = 0;
+    int channelCount = 0;
+    std::vector<uint8_t> payload;
+};
+
+static std::mutex channelListCacheMutex;
+
+static std::map<std::string, ChannelListCacheEntry> channelListCache;
+
+// service reference and logo url of a channel (by channel uid)
+struct ChannelRefCacheEntry {
+    int source = 0;
+    int sid = 0;
+    int tid = 0;
+    int nid = 0;
+    int vpid = 0;
+    int apid = 0;
+    int vtype = 0;
+    bool logoValid = false;
+    std::string serviceRef;
+    std::string baseUrl;
+    std::string logoUrl;
+
+    bool matches(const cChannel* channel) const {
+        return
+            !serviceRef.empty() &&
+            source == channel->Source() &&
+            sid == channel->Sid() &&
+            tid == channel->Tid() &&
+            nid == channel->Nid() &&
+            vpid == channel->Vpid() &&
+            apid == channel->Apid(0) &&
+            vtype == channel->Vtype();
+    }
+};
+
+static std::mutex channelRefCacheMutex;
+
+static std::unordered_map<uint32_t, ChannelRefCacheEntry> channelRefCache;
+
 ChannelController::ChannelController() {
 }
 
@@ -38,15 +96,10 @@ ChannelController::ChannelController(const ChannelController& orig) {
 ChannelController::~ChannelController() {
 }
 
-bool ChannelController::process(MsgPacket* request, MsgPacket* response) {
-
-    switch(request->getMsgID()) {
-        case ROBOTV_CHANNELS_GETCHANNELS:
-            return processGetChannels(request, response);
-            break;
-    }
-
-    return false;
+void ChannelController::registerHandlers(RequestTable& table) {
+    table.add(ROBOTV_CHANNELS_GETCHANNELS, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetChannels(request, response);
+    });
 }
 
 bool ChannelController::processGetChannels(MsgPacket* request, MsgPacket* response) {
@@ -94,7 +147,17 @@ bool ChannelController::processGetChannels(MsgPacket* request, MsgPacket* respon
     }
 
     m_languageIndex = I18nLanguageIndex(language);
-    m_channelCount = channelCount();
+
+    // the channel list only depends on the filter settings, the channel
+    // setup and the enabled channels. serve identical requests from the cache.
+    uint64_t channelsHash = c.checkUpdates();
+    uint32_t enabledVersion = channelCache.getEnabledVersion();
+    std::string key = createCacheKey(type);
+
+    if(getCachedList(key, channelsHash, enabledVersion, response)) {
+        INFOLOG("client got %i channels (cached)", m_channelCount);
+        return true;
+    }
 
     if(!c.lock(false)) {
         return true;
@@ -102,6 +165,9 @@ bool ChannelController::processGetChannels(MsgPacket* request, MsgPacket* respon
 
     cChannels* channels = c.get();
     std::string groupName;
+    uint32_t offset = response->getPayloadLength();
+    std::vector<uint8_t> payload;
+    m_channelCount = 0;
 
     for(cChannel* channel = channels->First(); channel; channel = channels->Next(channel)) {
 
@@ -120,32 +186,116 @@ bool ChannelController::processGetChannels(MsgPacket* request, MsgPacket* respon
         }
 
         addChannelToPacket(channel, response, groupName.c_str());
+        m_channelCount++;
+
+        // keep the list for the cache before a chunk is sent ahead
+        if(ChunkedResponse::isDue(response)) {
+            payload.insert(payload.end(), response->getPayload() + offset, response->getPayload() + response->getPayloadLength());
+            offset = 0;
+            ChunkedResponse::flush(response);
+        }
     }
 
     c.unlock();
 
+    ChannelListCacheEntry entry;
+    entry.channelsHash = channelsHash;
+    entry.enabledVersion = enabledVersion;
+    entry.created = time(NULL);
+    entry.channelCount = m_channelCount;
+    entry.payload.swap(payload);
+    entry.payload.insert(entry.payload.end(), response->getPayload() + offset, response->getPayload() + response->getPayloadLength());
+
+    {
+        std::lock_guard<std::mutex> lock(channelListCacheMutex);
+
+        if(channelListCache.size() >= CHANNELLIST_CACHE_SIZE) {
+            channelListCache.clear();
+        }
+
+        channelListCache[key] = std::move(entry);
+    }
+
     INFOLOG("client got %i channels", m_channelCount);
     return true;
 }
 
-int ChannelController::channelCount() {
-    RoboTVChannels& c = RoboTVChannels::instance();
-    c.lock(false);
-    cChannels* channels = c.get();
-    int count = 0;
+std::string ChannelController::createCacheKey(int type) {
+    std::vector<int> caids(m_caids.begin(), m_caids.end());
+    std::sort(caids.begin(), caids.end());
 
-    for(cChannel* channel = channels->First(); channel; channel = channels->Next(channel)) {
-        if(isChannelWanted(channel, false)) {
-            count++;
-        }
+    std::string key = std::to_string(type) + ":" +
+                      std::to_string(m_languageIndex) + ":" +
+                      std::to_string(m_wantFta) + ":" +
+                      std::to_string(m_filterLanguage) + ":" +
+                      std::to_string(RoboTVServerConfig::instance().filterChannels);
 
-        if(isChannelWanted(channel, true)) {
-            count++;
-        }
+    for(int caid : caids) {
+        key += ":" + std::to_string(caid);
     }
 
-    c.unlock();
-    return count;
+    return key;
+}
+
+bool ChannelController::getCachedList(const std::string& key, uint64_t channelsHash, uint32_t enabledVersion, MsgPacket* response) {
+    std::lock_guard<std::mutex> lock(channelListCacheMutex);
+
+    auto i = channelListCache.find(key);
+
+    if(i == channelListCache.end()) {
+        return false;
+    }
+
+    ChannelListCacheEntry& entry = i->second;
+
+    if(entry.channelsHash != channelsHash ||
+       entry.enabledVersion != enabledVersion ||
+       time(NULL) - entry.created > CHANNELLIST_CACHE_TTL) {
+        channelListCache.erase(i);
+        return false;
+    }
+
+    response->put_Blob(entry.payload.data(), entry.payload.size());
+    m_channelCount = entry.channelCount;
+    return true;
+}
+
+void ChannelController::invalidateCache() {
+    {
+        std::lock_guard<std::mutex> lock(channelListCacheMutex);
+        channelListCache.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(channelRefCacheMutex);
+    channelRefCache.clear();
+}
+
+ChannelRefCacheEntry& ChannelController::getChannelRefs(const cChannel* channel) {
+    uint32_t uid = createChannelUid(channel);
+    auto i = channelRefCache.find(uid);
+
+    if(i != channelRefCache.end() && i->second.matches(channel)) {
+        return i->second;
+    }
+
+    // drop entries of deleted channels
+    if(channelRefCache.size() >= CHANNELREF_CACHE_SIZE) {
+        channelRefCache.clear();
+    }
+
+    ChannelRefCacheEntry& entry = channelRefCache[uid];
+
+    entry.source = channel->Source();
+    entry.sid = channel->Sid();
+    entry.tid = channel->Tid();
+    entry.nid = channel->Nid();
+    entry.vpid = channel->Vpid();
+    entry.apid = channel->Apid(0);
+    entry.vtype = channel->Vtype();
+    entry.serviceRef = formatServiceReference(channel);
+    entry.logoValid = false;
+
+    return entry;
 }
 
 bool ChannelController::isChannelWanted(cChannel* channel, int type) {
@@ -239,6 +389,11 @@ bool ChannelController::isChannelWanted(cChannel* channel, int type) {
 }
 
 std::string ChannelController::createServiceReference(const cChannel* channel) {
+    std::lock_guard<std::mutex> lock(channelRefCacheMutex);
+    return getChannelRefs(channel).serviceRef;
+}
+
+std::string ChannelController::formatServiceReference(const cChannel* channel) {
     int hash = 0;
 
     if(cSource::IsSat(channel->Source())) {
@@ -290,7 +445,20 @@ std::string ChannelController::createLogoUrl(const cChannel* channel, const std:
         return "";
     }
 
-    std::string filename = createServiceReference(channel);
+    std::lock_guard<std::mutex> lock(channelRefCacheMutex);
+    ChannelRefCacheEntry& entry = getChannelRefs(channel);
+
+    if(!entry.logoValid || entry.baseUrl != baseUrl) {
+        entry.baseUrl = baseUrl;
+        entry.logoUrl = formatLogoUrl(entry.serviceRef, baseUrl);
+        entry.logoValid = true;
+    }
+
+    return entry.logoUrl;
+}
+
+std::string ChannelController::formatLogoUrl(const std::string& serviceRef, const std::string& baseUrl) {
+    std::string filename = serviceRef;
 
     if(baseUrl.size() > 4 && baseUrl.substr(0, 4) == "http") {
         filename = urlEncode(filename);
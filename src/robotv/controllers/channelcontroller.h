@@ -33,6 +33,8 @@
 
 class MsgPacket;
 
+struct ChannelRefCacheEntry;
+
 class ChannelController : public Controller {
 public:
 
@@ -40,28 +42,44 @@ public:
 
     virtual ~ChannelController();
 
-    bool process(MsgPacket* request, MsgPacket* response);
+    void registerHandlers(RequestTable& table);
 
     void addChannelToPacket(const cChannel* channel, MsgPacket* packet, const char* group = NULL);
 
+    /** Logo url of a channel (cached until the channel or the base url changes) */
     static std::string createLogoUrl(const cChannel* channel, const std::string& baseUrl);
 
+    /** Service reference of a channel (cached until the channel changes) */
     static std::string createServiceReference(const cChannel* channel);
 
     static bool isRadio(const cChannel* channel);
 
+    /** Drop all cached channel lists.
+     Called whenever the parameters of a channel change.
+     */
+    static void invalidateCache();
+
 protected:
 
     bool processGetChannels(MsgPacket* request, MsgPacket* response);
 
 private:
 
-    int channelCount();
+    std::string createCacheKey(int type);
+
+    bool getCachedList(const std::string& key, uint64_t channelsHash, uint32_t enabledVersion, MsgPacket* response);
 
     bool isChannelWanted(cChannel* channel, int type = 0);
 
     std::string createLogoUrl(const cChannel* channel);
 
+    /** Cache entry of a channel (lock the reference cache before calling) */
+    static ChannelRefCacheEntry& getChannelRefs(const cChannel* channel);
+
+    static std::string formatServiceReference(const cChannel* channel);
+
+    static std::string formatLogoUrl(const std::string& serviceRef, const std::string& baseUrl);
+
     ChannelController(const ChannelController& orig);
 
     std::list<int> m_caids;
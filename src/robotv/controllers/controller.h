@@ -25,14 +25,17 @@
 #ifndef ROBOTV_CONTROLLER_H
 #define ROBOTV_CONTROLLER_H
 
-class MsgPacket;
+#include "requesttable.h"
 
 class Controller {
 public:
 
     virtual ~Controller() = default;
 
-    virtual bool process(MsgPacket* request, MsgPacket* response) = 0;
+    /** Register the request handlers of this controller.
+     @param table opcode table of the client
+     */
+    virtual void registerHandlers(RequestTable& table) = 0;
 
 };
 
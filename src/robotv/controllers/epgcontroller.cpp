@@ -22,15 +22,55 @@
  *
  */
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
 #include "epgcontroller.h"
 #include "net/msgpacket.h"
+#include "robotv/chunkedresponse.h"
 #include "robotv/robotvcommand.h"
 #include "robotv/robotvchannels.h"
 #include "tools/hash.h"
 #include "db/storage.h"
+#include "epg/epgindex.h"
 #include "timercontroller.h"
+#include "robotv/robotvclient.h"
 
-EpgController::EpgController() {
+// maximum number of cached schedules (channels)
+#define EPG_SCHEDULE_CACHE_SIZE 512
+
+// maximum number of channels in a bulk request
+#define EPG_BULK_MAX_CHANNELS 2000
+
+// send a chunk of a bulk response when its payload exceeds this size
+#define EPG_BULK_CHUNK_SIZE (256 * 1024)
+
+// maximum number of results of a single search request
+#define EPG_SEARCH_MAX_RESULTS 200
+
+struct ScheduleCacheEvent {
+    uint32_t startTime;
+    uint32_t duration;
+    uint32_t maxEndTime; // latest end time of all events up to this one
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct ScheduleCacheEntry {
+    time_t modification = 0;
+    uint32_t artworkVersion = 0;
+    std::vector<uint8_t> payload;
+    std::vector<ScheduleCacheEvent> events;
+};
+
+static std::mutex scheduleCacheMutex;
+
+static std::map<uint32_t, std::shared_ptr<const ScheduleCacheEntry>> scheduleCache;
+
+EpgController::EpgController(RoboTvClient* parent) : m_parent(parent) {
 }
 
 EpgController::EpgController(const EpgController& orig) {
@@ -39,16 +79,18 @@ EpgController::EpgController(const EpgController& orig) {
 EpgController::~EpgController() {
 }
 
-bool EpgController::process(MsgPacket* request, MsgPacket* response) {
-    switch(request->getMsgID()) {
-        case ROBOTV_EPG_GETFORCHANNEL:
-            return processGet(request, response);
+void EpgController::registerHandlers(RequestTable& table) {
+    table.add(ROBOTV_EPG_GETFORCHANNEL, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGet(request, response);
+    });
 
-        case ROBOTV_EPG_SEARCH:
-            return processSearch(request, response);
-    }
+    table.add(ROBOTV_EPG_SEARCH, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSearch(request, response);
+    });
 
-    return false;
+    table.add(ROBOTV_EPG_GETFORCHANNELS, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetBulk(request, response);
+    });
 }
 
 bool EpgController::processGet(MsgPacket* request, MsgPacket* response) {
@@ -96,79 +138,275 @@ bool EpgController::processGet(MsgPacket* request, MsgPacket* response) {
         return true;
     }
 
-    for(const cEvent* event = Schedule->Events()->First(); event; event = Schedule->Events()->Next(event)) {
+    uint32_t now = (uint32_t)time(NULL);
+    std::shared_ptr<const ScheduleCacheEntry> entry = getScheduleEntry(channelUid, Schedule, now);
 
-        // collect data
-        const char* eventTitle = event->Title();
-        const char* eventSubTitle = event->ShortText();
-        const char* eventDescription  = event->Description();
-        uint32_t eventId = event->EventID();
-        uint32_t eventTime = event->StartTime();
-        uint32_t eventDuration = event->Duration();
-        uint32_t eventContent = event->Contents();
-        uint32_t eventRating = event->ParentalRating();
+    c.unlock();
 
-        //in the past filter
-        if((eventTime + eventDuration) < (uint32_t)time(NULL)) {
-            continue;
+    putScheduleEntry(*entry, now, startTime, duration, response);
+    return true;
+}
+
+bool EpgController::processGetBulk(MsgPacket* request, MsgPacket* response) {
+    uint32_t startTime = request->get_U32();
+    uint32_t duration = request->get_U32();
+    uint32_t count = request->get_U32();
+
+    if(count > EPG_BULK_MAX_CHANNELS) {
+        ERRORLOG("bulk epg request for %u channels rejected", count);
+        response->put_U32(0);
+        return true;
+    }
+
+    std::vector<uint32_t> channelUids;
+    channelUids.reserve(count);
+
+    for(uint32_t i = 0; i < count; i++) {
+        channelUids.push_back(request->get_U32());
+    }
+
+    // take the locks once for all channels
+    RoboTVChannels& c = RoboTVChannels::instance();
+    c.lock(false);
+
+    cSchedulesLock MutexLock;
+    const cSchedules* schedules = cSchedules::Schedules(MutexLock);
+    uint32_t now = (uint32_t)time(NULL);
+
+    std::vector<std::pair<uint32_t, std::shared_ptr<const ScheduleCacheEntry>>> entries;
+    entries.reserve(channelUids.size());
+
+    for(uint32_t channelUid : channelUids) {
+        const cChannel* channel = findChannelByUid(channelUid);
+        const cSchedule* schedule = NULL;
+
+        if(channel != NULL && schedules != NULL) {
+            schedule = schedules->GetSchedule(channel->GetChannelID());
         }
 
-        //start time filter
-        if((eventTime + eventDuration) <= startTime) {
-            continue;
+        entries.push_back({channelUid, (schedule == NULL) ? nullptr : getScheduleEntry(channelUid, schedule, now)});
+    }
+
+    c.unlock();
+
+    // stream the response in chunks.
+    // every chunk starts with a flag (0 - last chunk, 1 - more chunks follow)
+    // followed by: channeluid, number of events, events (as in GETFORCHANNEL)
+    MsgPacket* chunk = new MsgPacket(request->getMsgID(), ROBOTV_CHANNEL_REQUEST_RESPONSE, request->getUID());
+    chunk->setProtocolVersion(response->getProtocolVersion());
+    chunk->put_U32(1);
+
+    for(size_t i = 0; i < entries.size(); i++) {
+        chunk->put_U32(entries[i].first);
+
+        if(entries[i].second == nullptr) {
+            chunk->put_U32(0);
+        }
+        else {
+            chunk->put_U32(countScheduleEntry(*entries[i].second, now, startTime, duration));
+            putScheduleEntry(*entries[i].second, now, startTime, duration, chunk);
         }
 
-        //duration filter
-        if(duration != 0 && eventTime >= (startTime + duration)) {
+        if(chunk->getPayloadLength() < EPG_BULK_CHUNK_SIZE || i == entries.size() - 1) {
             continue;
         }
 
-        if(!eventTitle) {
-            eventTitle = "";
+        m_parent->queueMessage(chunk);
+
+        chunk = new MsgPacket(request->getMsgID(), ROBOTV_CHANNEL_REQUEST_RESPONSE, request->getUID());
+        chunk->setProtocolVersion(response->getProtocolVersion());
+        chunk->put_U32(1);
+    }
+
+    // the last chunk is the response itself
+    uint32_t length = chunk->getPayloadLength() - sizeof(uint32_t);
+
+    response->put_U32(0);
+    response->put_Blob(chunk->getPayload() + sizeof(uint32_t), length);
+
+    delete chunk;
+    return true;
+}
+
+std::shared_ptr<const ScheduleCacheEntry> EpgController::getScheduleEntry(uint32_t channelUid, const cSchedule* schedule, uint32_t now) {
+    time_t modification = schedule->Modification();
+    uint32_t artworkVersion = Artwork::getVersion();
+
+    {
+        std::lock_guard<std::mutex> lock(scheduleCacheMutex);
+        auto i = scheduleCache.find(channelUid);
+
+        if(i != scheduleCache.end() &&
+           i->second->modification == modification &&
+           i->second->artworkVersion == artworkVersion) {
+            return i->second;
         }
+    }
+
+    std::shared_ptr<ScheduleCacheEntry> entry = std::make_shared<ScheduleCacheEntry>();
+    entry->modification = modification;
+    entry->artworkVersion = artworkVersion;
+    createScheduleEntry(schedule, now, *entry);
 
-        if(!eventSubTitle) {
-            eventSubTitle = "";
+    std::lock_guard<std::mutex> lock(scheduleCacheMutex);
+
+    if(scheduleCache.size() >= EPG_SCHEDULE_CACHE_SIZE) {
+        scheduleCache.clear();
+    }
+
+    scheduleCache[channelUid] = entry;
+    return entry;
+}
+
+static bool isInWindow(const ScheduleCacheEvent& event, uint32_t now, uint32_t startTime, uint32_t duration) {
+    //in the past filter
+    if((event.startTime + event.duration) < now) {
+        return false;
+    }
+
+    //start time filter
+    if((event.startTime + event.duration) <= startTime) {
+        return false;
+    }
+
+    //duration filter
+    if(duration != 0 && event.startTime >= (startTime + duration)) {
+        return false;
+    }
+
+    return true;
+}
+
+static std::vector<ScheduleCacheEvent>::const_iterator findWindow(const ScheduleCacheEntry& entry, uint32_t now, uint32_t startTime) {
+    // events are sorted by start time. skip all events that ended before the window.
+    uint32_t threshold = std::max(now, startTime + 1);
+
+    return std::lower_bound(entry.events.begin(), entry.events.end(), threshold, [](const ScheduleCacheEvent& e, uint32_t t) {
+        return e.maxEndTime < t;
+    });
+}
+
+uint32_t EpgController::countScheduleEntry(const ScheduleCacheEntry& entry, uint32_t now, uint32_t startTime, uint32_t duration) {
+    uint32_t count = 0;
+
+    for(auto i = findWindow(entry, now, startTime); i != entry.events.end(); i++) {
+        if(duration != 0 && i->startTime >= (startTime + duration)) {
+            break;
         }
 
-        if(!eventDescription) {
-            eventDescription = "";
+        if(isInWindow(*i, now, startTime, duration)) {
+            count++;
         }
+    }
+
+    return count;
+}
+
+void EpgController::putScheduleEntry(const ScheduleCacheEntry& entry, uint32_t now, uint32_t startTime, uint32_t duration, MsgPacket* response) {
+    for(auto i = findWindow(entry, now, startTime); i != entry.events.end(); i++) {
+        if(duration != 0 && i->startTime >= (startTime + duration)) {
+            break;
+        }
+
+        if(isInWindow(*i, now, startTime, duration)) {
+            response->put_Blob((uint8_t*)entry.payload.data() + i->offset, i->length);
+            ChunkedResponse::flush(response);
+        }
+    }
+}
+
+void EpgController::createScheduleEntry(const cSchedule* schedule, uint32_t now, ScheduleCacheEntry& entry) {
+    struct EventData {
+        const cEvent* event;
+        std::string title;
+        std::string subTitle;
+        std::string description;
+    };
+
+    std::vector<EventData> events;
+    std::set<Artwork::Key> keys;
+
+    // collect upcoming events
+    for(const cEvent* event = schedule->Events()->First(); event; event = schedule->Events()->Next(event)) {
+        if((uint32_t)(event->StartTime() + event->Duration()) < now) {
+            continue;
+        }
+
+        EventData data;
+        data.event = event;
+        m_toUtf8.convert(event->Title() ? event->Title() : "", data.title);
+        m_toUtf8.convert(event->ShortText() ? event->ShortText() : "", data.subTitle);
+        m_toUtf8.convert(event->Description() ? event->Description() : "", data.description);
+
+        keys.insert(Artwork::Key(event->Contents(), data.title));
+        events.push_back(std::move(data));
+    }
+
+    // the window index needs the events sorted by start time
+    std::stable_sort(events.begin(), events.end(), [](const EventData& a, const EventData& b) {
+        return a.event->StartTime() < b.event->StartTime();
+    });
+
+    // fetch artwork for all events at once
+    std::map<Artwork::Key, Artwork::Urls> artwork = m_artwork.get(keys);
+
+    MsgPacket p;
+    uint32_t maxEndTime = 0;
+    entry.events.clear();
+    entry.events.reserve(events.size());
+
+    for(const EventData& data : events) {
+        const cEvent* event = data.event;
+        ScheduleCacheEvent e;
+
+        e.startTime = event->StartTime();
+        e.duration = event->Duration();
+        e.offset = p.getPayloadLength();
+
+        maxEndTime = std::max(maxEndTime, e.startTime + e.duration);
+        e.maxEndTime = maxEndTime;
 
-        response->put_U32(eventId);
-        response->put_U32(eventTime);
-        response->put_U32(eventDuration);
-        response->put_U32(eventContent);
-        response->put_U32(eventRating);
+        p.put_U32(event->EventID());
+        p.put_U32(e.startTime);
+        p.put_U32(e.duration);
+        p.put_U32(event->Contents());
+        p.put_U32(event->ParentalRating());
 
-        response->put_String(m_toUtf8.convert(eventTitle));
-        response->put_String(m_toUtf8.convert(eventSubTitle));
-        response->put_String(m_toUtf8.convert(eventDescription));
+        p.put_String(data.title);
+        p.put_String(data.subTitle);
+        p.put_String(data.description);
 
         // add epg artwork
-        std::string posterUrl;
-        std::string backgroundUrl;
+        auto a = artwork.find(Artwork::Key(event->Contents(), data.title));
 
-        if(m_artwork.get(eventContent, m_toUtf8.convert(eventTitle), posterUrl, backgroundUrl)) {
-            response->put_String(posterUrl.c_str());
-            response->put_String(backgroundUrl.c_str());
+        if(a != artwork.end()) {
+            p.put_String(a->second.posterUrl);
+            p.put_String(a->second.backdropUrl);
         }
         else {
-            response->put_String("x");
-            response->put_String("x");
+            p.put_String("x");
+            p.put_String("x");
         }
+
+        e.length = p.getPayloadLength() - e.offset;
+        entry.events.push_back(e);
     }
 
-    c.unlock();
-    return true;
+    entry.payload.assign(p.getPayload(), p.getPayload() + p.getPayloadLength());
 }
 
 bool EpgController::processSearch(MsgPacket* request, MsgPacket* response) {
-    cSchedulesLock MutexLock;
-
     std::string searchTerm = request->get_String();
-    time_t now = time(NULL);
+    uint32_t offset = 0;
+    uint32_t limit = EPG_SEARCH_MAX_RESULTS;
+
+    // optional pagination
+    if(!request->eop()) {
+        offset = request->get_U32();
+        limit = std::min(request->get_U32(), (uint32_t)EPG_SEARCH_MAX_RESULTS);
+    }
 
+    cSchedulesLock MutexLock;
     const cSchedules* schedules = cSchedules::Schedules(MutexLock);
 
     if(schedules == nullptr) {
@@ -179,18 +417,23 @@ bool EpgController::processSearch(MsgPacket* request, MsgPacket* response) {
     c.lock(false);
     cChannels* channels = c.get();
 
-    searchEpg(searchTerm, [&](tEventID eventId, time_t timeStamp, tChannelID channelId) {
-        if(timeStamp < now) {
-            return;
+    // schedules of all matching channels (cSchedules::GetSchedule is a linear search)
+    std::map<std::string, const cSchedule*> scheduleMap;
+
+    searchEpg(searchTerm, offset, limit, [&](const SearchResult& result) {
+        auto i = scheduleMap.find(result.channelId);
+
+        if(i == scheduleMap.end()) {
+            i = scheduleMap.insert({result.channelId, schedules->GetSchedule(tChannelID::FromString(result.channelId.c_str()))}).first;
         }
 
-        const cSchedule* schedule = schedules->GetSchedule(channelId);
+        const cSchedule* schedule = i->second;
 
         if(schedule == nullptr) {
             return;
         }
 
-        const cEvent* event = schedule->GetEvent(eventId, timeStamp);
+        const cEvent* event = schedule->GetEvent(result.eventId, result.timeStamp);
 
         if(event == nullptr) {
             return;
@@ -198,37 +441,22 @@ bool EpgController::processSearch(MsgPacket* request, MsgPacket* response) {
 
         TimerController::event2Packet(event, response);
 
-        cChannel* channel = channels->GetByChannelID(channelId);
-        response->put_String(channel ? channel->Name() : "");
-        response->put_U32(createChannelUid(channel));
+        // rows indexed before the channel uid was stored
+        if(result.channelUid == 0) {
+            cChannel* channel = channels->GetByChannelID(event->ChannelID());
+            response->put_String(channel ? channel->Name() : "");
+            response->put_U32(createChannelUid(channel));
+            return;
+        }
+
+        response->put_String(result.channelName);
+        response->put_U32(result.channelUid);
     });
 
     c.unlock();
     return true;
 }
 
-bool EpgController::searchEpg(const std::string& searchTerm, std::function<void(tEventID, time_t, tChannelID)> callback) {
-    roboTV::Storage& storage = roboTV::Storage::getInstance();
-
-    sqlite3_stmt* s = storage.query(
-                          "SELECT epgindex.eventid,epgindex.timestamp,epgindex.channelid "
-                          "FROM epgindex JOIN epgsearch ON epgindex.docid=epgsearch.docid "
-                          "WHERE epgsearch MATCH %Q",
-                          searchTerm.c_str()
-                      );
-
-    if(s == nullptr) {
-        return false;
-    }
-
-    while(sqlite3_step(s) == SQLITE_ROW) {
-        tEventID eventId = sqlite3_column_int(s, 0);
-        time_t timeStamp = (time_t)sqlite3_column_int64(s, 1);
-        tChannelID channelId = tChannelID::FromString((const char*)sqlite3_column_text(s, 2));
-
-        callback(eventId, timeStamp, channelId);
-    }
-
-    sqlite3_finalize(s);
-    return true;
+bool EpgController::searchEpg(const std::string& searchTerm, uint32_t offset, uint32_t limit, std::function<void(const SearchResult&)> callback) {
+    return EpgIndex::search(roboTV::Storage::getInstance(), searchTerm, time(NULL), offset, limit, callback);
 }
@@ -25,20 +25,26 @@
 #ifndef ROBOTV_EPGCONTROLLER_H
 #define ROBOTV_EPGCONTROLLER_H
 
+#include <memory>
 #include <tools/utf8conv.h>
 #include "controller.h"
+#include "epg/epgindex.h"
 #include "recordings/artwork.h"
 #include "vdr/tools.h"
 #include "vdr/epg.h"
 
+struct ScheduleCacheEntry;
+
+class RoboTvClient;
+
 class EpgController : public Controller {
 public:
 
-    EpgController();
+    EpgController(RoboTvClient* parent);
 
     virtual ~EpgController();
 
-    bool process(MsgPacket* request, MsgPacket* response);
+    void registerHandlers(RequestTable& table);
 
 protected:
 
@@ -46,15 +52,36 @@ protected:
 
     bool processSearch(MsgPacket* request, MsgPacket* response);
 
+    bool processGetBulk(MsgPacket* request, MsgPacket* response);
+
 private:
 
-    bool searchEpg(const std::string& searchTerm, std::function<void(tEventID, time_t, tChannelID)> callback);
+    typedef EpgIndex::Result SearchResult;
+
+    /** Ranked full text search in the EPG index.
+     Matches are ordered by relevance (bm25), titles weigh twice as much as subjects.
+     @param searchTerm FTS4 match expression
+     @param offset number of results to skip
+     @param limit maximum number of results
+     @param callback called for every result
+     */
+    bool searchEpg(const std::string& searchTerm, uint32_t offset, uint32_t limit, std::function<void(const SearchResult&)> callback);
+
+    std::shared_ptr<const ScheduleCacheEntry> getScheduleEntry(uint32_t channelUid, const cSchedule* schedule, uint32_t now);
+
+    uint32_t countScheduleEntry(const ScheduleCacheEntry& entry, uint32_t now, uint32_t startTime, uint32_t duration);
+
+    void createScheduleEntry(const cSchedule* schedule, uint32_t now, ScheduleCacheEntry& entry);
+
+    void putScheduleEntry(const ScheduleCacheEntry& entry, uint32_t now, uint32_t startTime, uint32_t duration, MsgPacket* response);
 
     EpgController(const EpgController& orig);
 
     Utf8Conv m_toUtf8;
 
     Artwork m_artwork;
+
+    RoboTvClient* m_parent;
 };
 
 #endif // ROBOTV_EPGCONTROLLER_H
@@ -22,12 +22,17 @@
  *
  */
 
+#include <algorithm>
 #include "logincontroller.h"
+#include "net/bandwidthshaper.h"
 #include "net/msgpacket.h"
 #include "config/config.h"
+#include "live/peerregistry.h"
 #include "robotv/robotvcommand.h"
+#include "robotv/robotvclient.h"
+#include "robotv/sessionstore.h"
 
-LoginController::LoginController() {
+LoginController::LoginController(RoboTvClient* parent) : m_parent(parent) {
 }
 
 LoginController::LoginController(const LoginController& orig) {
@@ -36,16 +41,14 @@ LoginController::LoginController(const LoginController& orig) {
 LoginController::~LoginController() {
 }
 
-bool LoginController::process(MsgPacket* request, MsgPacket* response) {
-    switch(request->getMsgID()) {
-        case ROBOTV_LOGIN:
-            return processLogin(request, response);
+void LoginController::registerHandlers(RequestTable& table) {
+    table.add(ROBOTV_LOGIN, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processLogin(request, response);
+    });
 
-        case ROBOTV_GETCONFIG:
-            return processGetConfig(request, response);
-    }
-
-    return false;
+    table.add(ROBOTV_GETCONFIG, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetConfig(request, response);
+    });
 }
 
 bool LoginController::processLogin(MsgPacket* request, MsgPacket* response) {
@@ -54,6 +57,50 @@ bool LoginController::processLogin(MsgPacket* request, MsgPacket* response) {
     const char* clientName = request->get_String();
     m_statusInterfaceEnabled = request->get_U8();
 
+    // optional: push-mode live streaming
+    bool pushRequested = !request->eop();
+
+    if(pushRequested) {
+        m_pushStreamingEnabled = request->get_U8();
+    }
+
+    // optional: client is able to uncompress responses
+    bool compressionRequested = !request->eop();
+
+    if(compressionRequested) {
+        m_compressionEnabled = (request->get_U8() != 0) && (m_compressionLevel > 0);
+        m_compressionLevel = std::min(m_compressionLevel, 9);
+    }
+
+    // optional: resumable session (token of the previous connection or 0)
+    bool sessionRequested = !request->eop();
+    uint64_t resumeToken = 0;
+
+    if(sessionRequested) {
+        resumeToken = request->get_U64();
+    }
+
+    // optional: client wants to know its bandwidth budget
+    bool bandwidthRequested = !request->eop();
+
+    if(bandwidthRequested) {
+        request->get_U8();
+    }
+
+    // optional: client follows redirects to other servers of the cluster
+    bool redirectRequested = !request->eop();
+
+    if(redirectRequested) {
+        m_redirectEnabled = request->get_U8();
+    }
+
+    // optional: client accepts large responses in chunks
+    bool chunksRequested = !request->eop();
+
+    if(chunksRequested) {
+        m_chunkedResponsesEnabled = request->get_U8();
+    }
+
     if(m_protocolVersion > ROBOTV_PROTOCOLVERSION || m_protocolVersion < 7) {
         ERRORLOG("Client '%s' has unsupported protocol version '%u', terminating client", clientName, m_protocolVersion);
         return false;
@@ -61,6 +108,14 @@ bool LoginController::processLogin(MsgPacket* request, MsgPacket* response) {
 
     INFOLOG("Welcome client '%s' with protocol version '%u'", clientName, m_protocolVersion);
 
+    if(m_pushStreamingEnabled) {
+        INFOLOG("Client '%s' requested push-mode live streaming", clientName);
+    }
+
+    if(m_compressionEnabled) {
+        INFOLOG("Client '%s' requested compressed responses (level %i)", clientName, m_compressionLevel);
+    }
+
     // Send the login reply
     time_t timeNow = time(NULL);
     struct tm* timeStruct = localtime(&timeNow);
@@ -72,6 +127,50 @@ bool LoginController::processLogin(MsgPacket* request, MsgPacket* response) {
     response->put_String("roboTV VDR Server");
     response->put_String(ROBOTV_VERSION);
 
+    // acknowledge push-mode
+    if(pushRequested) {
+        response->put_U8(m_pushStreamingEnabled);
+    }
+
+    // acknowledge compression (level used, 0 = disabled)
+    if(compressionRequested) {
+        response->put_U8(m_compressionEnabled ? m_compressionLevel : 0);
+    }
+
+    // session token and the resumed streams (1 = live, 2 = recording)
+    if(sessionRequested) {
+        int resumed = (resumeToken != 0) ? m_parent->resumeSession(resumeToken) : 0;
+        m_sessionToken = (resumed != 0) ? resumeToken : SessionStore::instance().createToken();
+
+        response->put_U64(m_sessionToken);
+        response->put_U8(resumed);
+    }
+
+    // stream data rates (bytes per second, 0 = unlimited): live, timeshift, recording
+    if(bandwidthRequested) {
+        response->put_U32(BandwidthShaper::clientRate(BandwidthShaper::tcLive));
+        response->put_U32(BandwidthShaper::clientRate(BandwidthShaper::tcTimeShift));
+        response->put_U32(BandwidthShaper::clientRate(BandwidthShaper::tcRecording));
+    }
+
+    // servers of the cluster (name, address, port, free tuners)
+    if(redirectRequested) {
+        std::vector<PeerRegistry::Peer> peers = PeerRegistry::instance().getPeers();
+        response->put_U8(peers.size());
+
+        for(auto& peer : peers) {
+            response->put_String(peer.name);
+            response->put_String(peer.host);
+            response->put_U16(peer.port);
+            response->put_U8(peer.freeDevices);
+        }
+    }
+
+    // acknowledge chunked responses
+    if(chunksRequested) {
+        response->put_U8(m_chunkedResponsesEnabled);
+    }
+
     m_loggedIn = true;
     return true;
 }
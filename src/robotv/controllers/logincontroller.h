@@ -29,15 +29,16 @@
 #include "controller.h"
 
 class MsgPacket;
+class RoboTvClient;
 
 class LoginController : public Controller {
 public:
 
-    LoginController();
+    LoginController(RoboTvClient* parent);
 
     virtual ~LoginController();
 
-    bool process(MsgPacket* request, MsgPacket* response);
+    void registerHandlers(RequestTable& table);
 
     bool statusEnabled() const {
         return m_statusInterfaceEnabled;
@@ -47,10 +48,34 @@ public:
         return m_protocolVersion;
     }
 
+    /** Negotiated compression level of responses (0 = no compression) */
+    int compressionLevel() const {
+        return m_compressionEnabled ? m_compressionLevel : 0;
+    }
+
     bool loggedIn() const {
         return m_loggedIn;
     }
 
+    bool pushStreamingEnabled() const {
+        return m_pushStreamingEnabled;
+    }
+
+    /** Token of the resumable session (0 = not requested by the client) */
+    uint64_t sessionToken() const {
+        return m_sessionToken;
+    }
+
+    /** Client follows redirects to other servers of the cluster */
+    bool redirectEnabled() const {
+        return m_redirectEnabled;
+    }
+
+    /** Client accepts large responses in chunks (ROBOTV_CHANNEL_RESPONSE_CHUNK) */
+    bool chunkedResponsesEnabled() const {
+        return m_chunkedResponsesEnabled;
+    }
+
 protected:
 
     bool processLogin(MsgPacket* request, MsgPacket* response);
@@ -65,10 +90,22 @@ private:
 
     int m_compressionLevel = 0;
 
+    bool m_compressionEnabled = false;
+
     bool m_loggedIn = false;
 
     bool m_statusInterfaceEnabled = false;
 
+    bool m_pushStreamingEnabled = false;
+
+    bool m_redirectEnabled = false;
+
+    bool m_chunkedResponsesEnabled = false;
+
+    uint64_t m_sessionToken = 0;
+
+    RoboTvClient* m_parent;
+
 };
 
 #endif // ROBOTV_LOGINCONTROLLER_H
@@ -22,15 +22,28 @@
  *
  */
 
+#include <algorithm>
 #include "moviecontroller.h"
 #include "net/msgpacket.h"
 #include "robotv/robotvcommand.h"
 #include "tools/recid2uid.h"
 #include "config/config.h"
+#include "robotv/chunkedresponse.h"
+#include "recordings/recordingfolders.h"
+#include "recordings/recordingfragments.h"
+#include "recordings/recordingmarks.h"
 #include "recordings/recordingscache.h"
+#include "tools/crc32.h"
+#include "tools/hash.h"
 #include "vdr/videodir.h"
 #include "vdr/menu.h"
 
+// maximum number of results of a single search request
+#define SEARCH_MAX_RESULTS 100
+
+// maximum number of entries of a single folder page
+#define FOLDER_MAX_ENTRIES 500
+
 MovieController::MovieController() {
 }
 
@@ -40,40 +53,54 @@ MovieController::MovieController(const MovieController& orig) {
 MovieController::~MovieController() {
 }
 
-bool MovieController::process(MsgPacket* request, MsgPacket* response) {
-    switch(request->getMsgID()) {
-        case ROBOTV_RECORDINGS_DISKSIZE:
-            return processGetDiskSpace(request, response);
+void MovieController::registerHandlers(RequestTable& table) {
+    table.add(ROBOTV_RECORDINGS_DISKSIZE, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetDiskSpace(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_GETLIST:
-            return processGetList(request, response);
+    table.add(ROBOTV_RECORDINGS_GETLIST, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetList(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_RENAME:
-            return processRename(request, response);
+    table.add(ROBOTV_RECORDINGS_RENAME, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processRename(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_DELETE:
-            return processDelete(request, response);
+    table.add(ROBOTV_RECORDINGS_DELETE, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processDelete(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_SETPLAYCOUNT:
-            return processSetPlayCount(request, response);
+    table.add(ROBOTV_RECORDINGS_SETPLAYCOUNT, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSetPlayCount(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_SETPOSITION:
-            return processSetPosition(request, response);
+    table.add(ROBOTV_RECORDINGS_SETPOSITION, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSetPosition(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_SETURLS:
-            return processSetUrls(request, response);
+    table.add(ROBOTV_RECORDINGS_SETURLS, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSetUrls(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_GETPOSITION:
-            return processGetPosition(request, response);
+    table.add(ROBOTV_RECORDINGS_GETPOSITION, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetPosition(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_GETMARKS:
-            return processGetMarks(request, response);
+    table.add(ROBOTV_RECORDINGS_GETMARKS, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetMarks(request, response);
+    });
 
-        case ROBOTV_RECORDINGS_SEARCH:
-            return processSearch(request, response);
-    }
+    table.add(ROBOTV_RECORDINGS_SEARCH, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSearch(request, response);
+    });
+
+    table.add(ROBOTV_RECORDINGS_GETCHANGES, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetChanges(request, response);
+    });
 
-    return false;
+    table.add(ROBOTV_RECORDINGS_GETFOLDER, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetFolder(request, response);
+    });
 }
 
 bool MovieController::processGetDiskSpace(MsgPacket* request, MsgPacket* response) {
@@ -89,14 +116,94 @@ bool MovieController::processGetDiskSpace(MsgPacket* request, MsgPacket* respons
 }
 
 bool MovieController::processGetList(MsgPacket* request, MsgPacket* response) {
+    std::vector<cRecording*> recordings;
+
     for(cRecording* recording = Recordings.First(); recording; recording = Recordings.Next(recording)) {
-        recordingToPacket(recording, response);
+        recordings.push_back(recording);
     }
 
+    recordingsToPacket(recordings, response);
     return true;
 
 }
 
+bool MovieController::processGetChanges(MsgPacket* request, MsgPacket* response) {
+    RecordingsCache& cache = RecordingsCache::instance();
+    RecordingsSnapshot& snapshot = cache.snapshot();
+
+    uint64_t generation = request->get_U64();
+
+    std::vector<cRecording*> recordings;
+    std::map<uint32_t, cRecording*> current;
+
+    for(cRecording* recording = Recordings.First(); recording; recording = Recordings.Next(recording)) {
+        recordings.push_back(recording);
+    }
+
+    std::map<uint32_t, RecordingsCache::Metadata> metadata;
+
+    // update snapshot (fingerprint of the serialized entries)
+    if(snapshot.isOutdated()) {
+        std::vector<uint32_t> uids = cache.add(recordings);
+        std::map<uint32_t, uint32_t> fingerprints;
+        metadata = cache.getMetadata();
+
+        for(size_t i = 0; i < recordings.size(); i++) {
+            MsgPacket entry;
+            recordingToPacket(recordings[i], uids[i], metadata[uids[i]], &entry);
+
+            fingerprints[uids[i]] = crc32(entry.getPayload(), entry.getPayloadLength());
+            current[uids[i]] = recordings[i];
+        }
+
+        snapshot.update(fingerprints);
+    }
+    else {
+        for(auto recording : recordings) {
+            current[createStringHash(recording->FileName())] = recording;
+        }
+    }
+
+    std::vector<uint32_t> changed;
+    std::vector<uint32_t> removed;
+
+    bool delta = snapshot.getChanges(generation, changed, removed, generation);
+
+    if(metadata.empty() && !changed.empty()) {
+        metadata = cache.getMetadata();
+    }
+
+    response->put_U64(generation);
+    response->put_U8(delta ? 0 : 1);
+
+    // removed recordings
+    char recid[9];
+    response->put_U32(removed.size());
+
+    for(auto uid : removed) {
+        snprintf(recid, sizeof(recid), "%08x", uid);
+        response->put_String(recid);
+    }
+
+    // added / modified recordings
+    std::vector<uint32_t> entries;
+
+    for(auto uid : changed) {
+        if(current.find(uid) != current.end()) {
+            entries.push_back(uid);
+        }
+    }
+
+    response->put_U32(entries.size());
+
+    for(auto uid : entries) {
+        recordingToPacket(current[uid], uid, metadata[uid], response);
+        ChunkedResponse::flush(response);
+    }
+
+    return true;
+}
+
 bool MovieController::processRename(MsgPacket* request, MsgPacket* response) {
     uint32_t uid = 0;
     const char* recid = request->get_String();
@@ -215,9 +322,9 @@ bool MovieController::processGetMarks(MsgPacket* request, MsgPacket* response) {
         return true;
     }
 
-    cMarks marks;
+    std::shared_ptr<const RecordingMarks::Marks> marks = RecordingMarks::instance().get(recording);
 
-    if(!marks.Load(recording->FileName(), recording->FramesPerSecond(), recording->IsPesRecording())) {
+    if(!marks) {
         INFOLOG("no marks found for: '%s'", recording->FileName());
         response->put_U32(ROBOTV_RET_NOTSUPPORTED);
         return true;
@@ -226,18 +333,11 @@ bool MovieController::processGetMarks(MsgPacket* request, MsgPacket* response) {
     response->put_U32(ROBOTV_RET_OK);
     response->put_U64(recording->FramesPerSecond() * 10000);
 
-    cMark* end = NULL;
-    cMark* begin = NULL;
-
-    while((begin = marks.GetNextBegin(end)) != NULL) {
-        end = marks.GetNextEnd(begin);
-
-        if(end != NULL) {
-            response->put_String("SCENE");
-            response->put_U64(begin->Position());
-            response->put_U64(end->Position());
-            response->put_String(begin->ToText());
-        }
+    for(const auto& scene : marks->scenes) {
+        response->put_String("SCENE");
+        response->put_U64(scene.begin);
+        response->put_U64(scene.end);
+        response->put_String(scene.text);
     }
 
     return true;
@@ -263,126 +363,88 @@ bool MovieController::processSearch(MsgPacket* request, MsgPacket* response) {
     RecordingsCache& cache = RecordingsCache::instance();
 
     const char* searchTerm = request->get_String();
+    uint32_t offset = 0;
+    uint32_t limit = SEARCH_MAX_RESULTS;
 
-    cache.search(searchTerm, [&](uint32_t recid) {
-        cRecording* recording = cache.lookup(recid);
-
-        if(recording == NULL) {
-            return;
-        }
+    // optional pagination
+    if(!request->eop()) {
+        offset = request->get_U32();
+        limit = std::min(request->get_U32(), (uint32_t)SEARCH_MAX_RESULTS);
+    }
 
-        recordingToPacket(recording, response);
-    });
+    // hits are resolved (recording and metadata) in one pass
+    for(auto& hit : cache.search(searchTerm, offset, limit)) {
+        recordingToPacket(hit.recording, hit.uid, hit.metadata, response);
+    }
 
     return true;
 }
 
-void MovieController::recordingToPacket(cRecording* recording, MsgPacket* response) {
-    RecordingsCache& cache = RecordingsCache::instance();
-    RoboTVServerConfig& config = RoboTVServerConfig::instance();
-
-    const cEvent* event = recording->Info()->GetEvent();
+bool MovieController::processGetFolder(MsgPacket* request, MsgPacket* response) {
+    const char* folder = request->get_String();
+    uint32_t offset = 0;
+    uint32_t limit = FOLDER_MAX_ENTRIES;
 
-    time_t recordingStart = event->StartTime();
-    int recordingDuration = event->Duration();
-    int content = event->Contents();
-
-    cRecordControl* rc = cRecordControls::GetRecordControl(recording->FileName());
-
-    if(rc) {
-        recordingStart    = rc->Timer()->StartTime();
-        recordingDuration = rc->Timer()->StopTime() - recordingStart;
-    }
-    else {
-        recordingStart = recording->Start();
+    // optional pagination
+    if(!request->eop()) {
+        offset = request->get_U32();
+        limit = std::min(request->get_U32(), (uint32_t)FOLDER_MAX_ENTRIES);
     }
 
-    // recording_time
-    response->put_U32(recordingStart);
+    RecordingFolders::Page page;
 
-    // duration
-    response->put_U32(recordingDuration);
-
-    // priority
-    response->put_U32(recording->Priority());
-
-    // lifetime
-    response->put_U32(recording->Lifetime());
-
-    // channel_name
-    response->put_String(recording->Info()->ChannelName() ? m_toUtf8.convert(recording->Info()->ChannelName()) : "");
-
-    char* fullname = strdup(recording->Name());
-    char* recname = strrchr(fullname, FOLDERDELIMCHAR);
-    char* directory = NULL;
-
-    if(recname == NULL) {
-        recname = fullname;
-    }
-    else {
-        *recname = 0;
-        recname++;
-        directory = fullname;
+    if(!RecordingFolders::instance().list(folder, offset, limit, page)) {
+        response->put_U32(ROBOTV_RET_DATAINVALID);
+        return true;
     }
 
-    // title
-    const char* title = recording->Info()->Title();
-    response->put_String(title ? m_toUtf8.convert(title) : "");
-
-    // subtitle
-    const char* subTitle = recording->Info()->ShortText();
-    response->put_String(subTitle ? m_toUtf8.convert(subTitle) : "");
+    response->put_U32(ROBOTV_RET_OK);
+    response->put_U32(page.folderCount);
+    response->put_U32(page.recordingCount);
 
-    // description
-    const char* description = recording->Info()->Description();
-    response->put_String(description ? m_toUtf8.convert(description) : "");
+    response->put_U32(page.folders.size());
 
-    // directory
-    if(directory != NULL) {
-        char* p = directory;
+    for(auto& f : page.folders) {
+        response->put_String(f.name.c_str());
+        response->put_U32(f.recordingCount);
+    }
 
-        while(*p != 0) {
-            if(*p == FOLDERDELIMCHAR) {
-                *p = '/';
-            }
+    response->put_U32(page.recordings.size());
+    recordingsToPacket(page.recordings, response);
 
-            if(*p == '_') {
-                *p = ' ';
-            }
+    return true;
+}
 
-            p++;
-        }
+void MovieController::recordingsToPacket(const std::vector<cRecording*>& recordings, MsgPacket* response) {
+    RecordingsCache& cache = RecordingsCache::instance();
 
-        while(*directory == '/') {
-            directory++;
-        }
-    }
+    // register all recordings at once and fetch the metadata in one query
+    std::vector<uint32_t> uids = cache.add(recordings);
+    std::map<uint32_t, RecordingsCache::Metadata> metadata = cache.getMetadata();
 
-    if(!isempty(directory) && !config.seriesFolder.empty()) {
-        if(strncmp(directory, config.seriesFolder.c_str(), config.seriesFolder.length()) == 0) {
-            content = 0x15;
-        }
+    for(size_t i = 0; i < recordings.size(); i++) {
+        recordingToPacket(recordings[i], uids[i], metadata[uids[i]], response);
+        ChunkedResponse::flush(response);
     }
+}
 
-    response->put_String((isempty(directory)) ? "" : m_toUtf8.convert(directory));
+void MovieController::recordingToPacket(cRecording* recording, uint32_t uid, const RecordingsCache::Metadata& metadata, MsgPacket* response) {
+    int content = 0;
 
-    // filename / uid of recording
-    uint32_t uid = RecordingsCache::instance().add(recording);
-    char recid[9];
-    snprintf(recid, sizeof(recid), "%08x", uid);
-    response->put_String(recid);
+    // copy the pre-serialized entry (if available)
+    if(!RecordingFragments::instance().put(recording, uid, response, content)) {
+        content = RecordingFragments::serialize(recording, uid, m_toUtf8, response);
+    }
 
     // playcount
-    response->put_U32(cache.getPlayCount(uid));
+    response->put_U32(metadata.playCount);
 
     // content
     response->put_U32(content);
 
     // thumbnail url - for future use
-    response->put_String((const char*)cache.getPosterUrl(uid));
+    response->put_String(metadata.posterUrl.c_str());
 
     // icon url - for future use
-    response->put_String((const char*)cache.getBackgroundUrl(uid));
-
-    free(fullname);
+    response->put_String(metadata.backgroundUrl.c_str());
 }
@@ -29,6 +29,9 @@
 #include "vdr/recording.h"
 #include "vdr/tools.h"
 #include "controller.h"
+#include "recordings/recordingscache.h"
+
+#include <vector>
 
 class MsgPacket;
 
@@ -39,7 +42,7 @@ public:
 
     virtual ~MovieController();
 
-    bool process(MsgPacket* request, MsgPacket* response);
+    void registerHandlers(RequestTable& table);
 
 protected:
 
@@ -47,6 +50,14 @@ protected:
 
     bool processGetList(MsgPacket* request, MsgPacket* response);
 
+    /** Get the changes of the recordings list.
+     Request: U64 generation known by the client (0 - full list)
+     Response: U64 current generation, U8 full list flag,
+     U32 count + recids of removed recordings,
+     U32 count + entries (GETLIST format) of added / modified recordings
+     */
+    bool processGetChanges(MsgPacket* request, MsgPacket* response);
+
     bool processRename(MsgPacket* request, MsgPacket* response);
 
     bool processDelete(MsgPacket* request, MsgPacket* response);
@@ -63,11 +74,22 @@ protected:
 
     bool processSearch(MsgPacket* request, MsgPacket* response);
 
+    /** List a page of a recordings folder.
+     Request: String folder ("a/b", empty for the root folder),
+     optional U32 offset + U32 limit (subfolders come before recordings)
+     Response: U32 status, U32 total subfolders, U32 total recordings,
+     U32 count + (String name, U32 recordings incl. subfolders) of the subfolders,
+     U32 count + entries (GETLIST format) of the recordings
+     */
+    bool processGetFolder(MsgPacket* request, MsgPacket* response);
+
 private:
 
     MovieController(const MovieController& orig);
 
-    void recordingToPacket(cRecording* recording, MsgPacket* response);
+    void recordingsToPacket(const std::vector<cRecording*>& recordings, MsgPacket* response);
+
+    void recordingToPacket(cRecording* recording, uint32_t uid, const RecordingsCache::Metadata& metadata, MsgPacket* response);
 
     Utf8Conv m_toUtf8;
 
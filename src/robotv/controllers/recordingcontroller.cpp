@@ -38,25 +38,41 @@ RecordingController::~RecordingController() {
     delete m_recPlayer;
 }
 
-bool RecordingController::process(MsgPacket* request, MsgPacket* response) {
-    switch(request->getMsgID()) {
-        case ROBOTV_RECSTREAM_OPEN:
-            return processOpen(request, response);
-
-        case ROBOTV_RECSTREAM_CLOSE:
-            return processClose(request, response);
-
-        case ROBOTV_RECSTREAM_REQUEST:
-            return processRequest(request, response);
+void RecordingController::registerHandlers(RequestTable& table) {
+    table.add(ROBOTV_RECSTREAM_OPEN, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processOpen(request, response);
+    });
+
+    table.add(ROBOTV_RECSTREAM_CLOSE, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processClose(request, response);
+    });
+
+    table.add(ROBOTV_RECSTREAM_REQUEST, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processRequest(request, response);
+    });
+
+    table.add(ROBOTV_RECSTREAM_SEEK, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSeek(request, response);
+    });
+
+    table.add(ROBOTV_RECSTREAM_PAUSE, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processPause(request, response);
+    });
+}
 
-        case ROBOTV_RECSTREAM_SEEK:
-            return processSeek(request, response);
+PacketPlayer* RecordingController::park() {
+    PacketPlayer* player = m_recPlayer;
+    m_recPlayer = NULL;
+    return player;
+}
 
-        case ROBOTV_RECSTREAM_PAUSE:
-            return processPause(request, response);
+void RecordingController::resume(PacketPlayer* player) {
+    if(player == NULL) {
+        return;
     }
 
-    return false;
+    delete m_recPlayer;
+    m_recPlayer = player;
 }
 
 bool RecordingController::processOpen(MsgPacket* request, MsgPacket* response) {
@@ -67,11 +83,29 @@ bool RecordingController::processOpen(MsgPacket* request, MsgPacket* response) {
     DEBUGLOG("lookup recid: %s (uid: %u)", recid, uid);
     recording = RecordingsCache::instance().lookup(uid);
 
+    // optional: batching policy (latency budget in ms, max packet size)
+    uint32_t batchLatency = 0;
+    uint32_t batchMaxSize = 0;
+
+    if(!request->eop()) {
+        batchLatency = request->get_U32();
+        batchMaxSize = request->get_U32();
+    }
+
+    // optional: raw TS passthrough (the client demuxes by itself)
+    bool passthrough = false;
+
+    if(!request->eop()) {
+        passthrough = request->get_U8();
+    }
+
     if(recording && m_recPlayer == NULL) {
         m_recPlayer = new PacketPlayer(recording);
+        m_recPlayer->setBatching(batchLatency, batchMaxSize);
 
         delete m_recPlayer->requestPacket(false);
         m_recPlayer->reset();
+        m_recPlayer->setPassthrough(passthrough);
 
         uint32_t length = (m_recPlayer->endTime().count() - m_recPlayer->startTime().count()) / 1000;
 
@@ -107,17 +141,26 @@ bool RecordingController::processRequest(MsgPacket* request, MsgPacket* response
 
     bool keyFrameMode = request->get_U8();
 
+    // throttled - answer without data
+    if(!m_parent->bandwidth().admit(BandwidthShaper::tcRecording)) {
+        return true;
+    }
+
     MsgPacket* p = m_recPlayer->requestPacket(keyFrameMode);
 
     if(p == NULL) {
         return true;
     }
 
-    int packetLen = p->getPayloadLength();
-    uint8_t* packetData = p->consume(packetLen);
+    // raw TS data is sent with sendfile, it's never read for a checksum
+    if(p->hasFileSegments()) {
+        response->disablePayloadCheckSum();
+    }
 
-    response->put_Blob(packetData, packetLen);
-    delete p;
+    // reference the aggregated payload (sent with writev)
+    std::shared_ptr<MsgPacket> packet(p);
+    m_parent->bandwidth().consume(BandwidthShaper::tcRecording, packet->getPayloadLength());
+    response->put_Payload(packet);
 
     return true;
 }
@@ -128,7 +171,15 @@ bool RecordingController::processSeek(MsgPacket* request, MsgPacket* response) {
     }
 
     int64_t position = request->get_S64();
-    int64_t pts = m_recPlayer->seek(position);
+
+    // optional: seek to the next (1) / previous (-1) cutting mark
+    int32_t mark = 0;
+
+    if(!request->eop()) {
+        mark = request->get_S32();
+    }
+
+    int64_t pts = (mark != 0) ? m_recPlayer->seekMark(position, mark) : m_recPlayer->seek(position);
 
     response->put_S64(pts);
     return true;
@@ -38,7 +38,15 @@ public:
 
     virtual ~RecordingController();
 
-    bool process(MsgPacket* request, MsgPacket* response);
+    void registerHandlers(RequestTable& table);
+
+    /** Release the recording stream of a disconnected client (for resuming).
+     @return the player (NULL if not playing)
+     */
+    PacketPlayer* park();
+
+    /** Continue a parked recording stream */
+    void resume(PacketPlayer* player);
 
 protected:
 
@@ -0,0 +1,102 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <mutex>
+
+#include "requesttable.h"
+#include "config/config.h"
+#include "net/msgpacket.h"
+
+RequestTable::Stats RequestTable::m_stats[RequestTable::MaxOpcode];
+
+RequestTable::RequestTable() : m_handlers(MaxOpcode) {
+    static std::once_flag registered;
+
+    std::call_once(registered, []() {
+        Metrics::instance().add(&m_stats, "requests", []() {
+            return getMetrics();
+        });
+    });
+}
+
+void RequestTable::add(uint16_t opcode, Handler handler) {
+    add(opcode, handler, true);
+}
+
+void RequestTable::addNotification(uint16_t opcode, Handler handler) {
+    add(opcode, handler, false);
+}
+
+void RequestTable::add(uint16_t opcode, Handler handler, bool reply) {
+    if(opcode >= MaxOpcode) {
+        ERRORLOG("opcode %u out of range", (unsigned int)opcode);
+        return;
+    }
+
+    m_handlers[opcode].push_back({handler, reply});
+}
+
+bool RequestTable::has(uint16_t opcode) const {
+    return (opcode < MaxOpcode && !m_handlers[opcode].empty());
+}
+
+RequestTable::Result RequestTable::dispatch(MsgPacket* request, MsgPacket* response) {
+    uint16_t opcode = request->getMsgID();
+
+    if(!has(opcode)) {
+        return NotHandled;
+    }
+
+    Stats& stats = m_stats[opcode];
+    LatencyTimer timer(stats.latency);
+    stats.calls++;
+
+    for(auto& entry : m_handlers[opcode]) {
+        if(entry.handler(request, response)) {
+            return entry.reply ? Reply : NoReply;
+        }
+    }
+
+    return NotHandled;
+}
+
+nlohmann::json RequestTable::getMetrics() {
+    nlohmann::json opcodes = nlohmann::json::array();
+
+    for(int opcode = 0; opcode < MaxOpcode; opcode++) {
+        const Stats& stats = m_stats[opcode];
+
+        if(stats.calls == 0) {
+            continue;
+        }
+
+        opcodes.push_back({
+            {"opcode", opcode},
+            {"calls", stats.calls.load()},
+            {"latency", stats.latency.toJson()}
+        });
+    }
+
+    return opcodes;
+}
@@ -0,0 +1,109 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_REQUESTTABLE_H
+#define ROBOTV_REQUESTTABLE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "tools/metrics.h"
+
+class MsgPacket;
+
+/**
+ * Opcode -> handler table of a client.
+ * The controllers register their handlers once, requests are dispatched
+ * with a single lookup. Several handlers may share an opcode (e.g. the
+ * stream requests of live and recording streams), they are tried in
+ * registration order until one handles the request.
+ * Requests registered with addNotification() are handled without a reply.
+ * Calls and latencies per opcode (of all clients) are exported in the
+ * "requests" metrics group.
+ */
+class RequestTable {
+public:
+
+    typedef std::function<bool(MsgPacket*, MsgPacket*)> Handler;
+
+    enum Result {
+        NotHandled,
+        Reply,
+        NoReply
+    };
+
+    RequestTable();
+
+    /** Register a handler.
+     @param opcode message id of the request
+     @param handler returns true if the response should be sent
+     */
+    void add(uint16_t opcode, Handler handler);
+
+    /** Register a handler for a request that isn't answered (e.g. flow control).
+     @param opcode message id of the request
+     @param handler returns true if the request was handled (the response is discarded)
+     */
+    void addNotification(uint16_t opcode, Handler handler);
+
+    bool has(uint16_t opcode) const;
+
+    /** Dispatch a request.
+     @return Reply if the response should be sent, NoReply if the request
+             was handled without a reply, NotHandled otherwise
+     */
+    Result dispatch(MsgPacket* request, MsgPacket* response);
+
+private:
+
+    enum {
+        MaxOpcode = 256
+    };
+
+    struct Stats {
+        std::atomic<uint64_t> calls;
+        LatencyHistogram latency;
+
+        Stats() : calls(0) {
+        }
+    };
+
+    struct Entry {
+        Handler handler;
+        bool reply;
+    };
+
+    void add(uint16_t opcode, Handler handler, bool reply);
+
+    static nlohmann::json getMetrics();
+
+    std::vector<std::vector<Entry>> m_handlers;
+
+    static Stats m_stats[MaxOpcode];
+
+};
+
+#endif // ROBOTV_REQUESTTABLE_H
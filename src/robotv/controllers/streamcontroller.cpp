@@ -26,8 +26,19 @@
 #include "config/config.h"
 #include "robotv/robotvchannels.h"
 #include "robotv/robotvclient.h"
+#include "live/liverecorder.h"
+#include "live/peerregistry.h"
 #include "tools/hash.h"
 
+#include <algorithm>
+#include <set>
+
+// credit (in bytes) granted without client interaction after opening a stream
+#define PUSH_INITIAL_CREDIT (1024 * 1024)
+
+// maximum size of a single pushed packet
+#define PUSH_MAX_PACKET_SIZE (128 * 1024)
+
 StreamController::StreamController(RoboTvClient* parent) :
     m_languageIndex(-1),
     m_langStreamType(StreamInfo::stAC3),
@@ -39,32 +50,48 @@ StreamController::StreamController(const StreamController& orig) {
 
 StreamController::~StreamController() {
     stopStreaming();
+    releaseStandby();
 }
 
-bool StreamController::process(MsgPacket* request, MsgPacket* response) {
+void StreamController::registerHandlers(RequestTable& table) {
     /** OPCODE 20 - 39: RoboTV network functions for live streaming */
 
-    switch(request->getMsgID()) {
-        case ROBOTV_CHANNELSTREAM_OPEN:
-            return processOpen(request, response);
+    table.add(ROBOTV_CHANNELSTREAM_OPEN, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processOpen(request, response);
+    });
 
-        case ROBOTV_CHANNELSTREAM_CLOSE:
-            return processClose(request, response);
+    table.add(ROBOTV_CHANNELSTREAM_CLOSE, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processClose(request, response);
+    });
 
-        case ROBOTV_CHANNELSTREAM_REQUEST:
-            return processRequest(request, response);
+    table.add(ROBOTV_CHANNELSTREAM_REQUEST, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processRequest(request, response);
+    });
 
-        case ROBOTV_CHANNELSTREAM_PAUSE:
-            return processPause(request, response);
+    table.add(ROBOTV_CHANNELSTREAM_PAUSE, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processPause(request, response);
+    });
 
-        case ROBOTV_CHANNELSTREAM_SIGNAL:
-            return processSignal(request, response);
+    table.add(ROBOTV_CHANNELSTREAM_SIGNAL, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSignal(request, response);
+    });
 
-        case ROBOTV_CHANNELSTREAM_SEEK:
-            return processSeek(request, response);
-    }
+    table.add(ROBOTV_CHANNELSTREAM_SEEK, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSeek(request, response);
+    });
 
-    return false;
+    // credit grants aren't answered
+    table.addNotification(ROBOTV_CHANNELSTREAM_CREDIT, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processCredit(request, response);
+    });
+
+    table.add(ROBOTV_CHANNELSTREAM_RECORD, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processRecord(request, response);
+    });
+
+    table.add(ROBOTV_CHANNELSTREAM_SELECT, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processSelect(request, response);
+    });
 }
 
 bool StreamController::processOpen(MsgPacket* request, MsgPacket* response) {
@@ -87,12 +114,34 @@ bool StreamController::processOpen(MsgPacket* request, MsgPacket* response) {
         m_langStreamType = (StreamInfo::Type)request->get_U8();
     }
 
+    // optional: batching policy (latency budgets in ms, max packet size)
+    uint32_t batchLatency = 0;
+    uint32_t batchTimeshiftLatency = 0;
+    uint32_t batchMaxSize = 0;
+
+    if(!request->eop()) {
+        batchLatency = request->get_U32();
+        batchTimeshiftLatency = request->get_U32();
+        batchMaxSize = request->get_U32();
+    }
+
+    // optional: raw TS passthrough (the client demuxes by itself)
+    bool passthrough = false;
+
+    if(!request->eop()) {
+        passthrough = request->get_U8();
+    }
+
     if(m_languageIndex != -1) {
         INFOLOG("Preferred language: %s / type: %i", I18nLanguageCode(m_languageIndex), (int)m_langStreamType);
     }
 
     stopStreaming();
 
+    // the first packets of a stream may be pushed right away
+    m_credit = PUSH_INITIAL_CREDIT;
+    m_keyFrameMode = false;
+
     RoboTVChannels& c = RoboTVChannels::instance();
     c.lock(false);
     const cChannel* channel = NULL;
@@ -113,11 +162,38 @@ bool StreamController::processOpen(MsgPacket* request, MsgPacket* response) {
         return true;
     }
 
+    // another server of the cluster receives the channel or has a free tuner
+    std::string redirectHost;
+    int redirectPort = 0;
+
+    if(m_parent->redirectEnabled() && PeerRegistry::instance().findRedirect(channel, priority, redirectHost, redirectPort)) {
+        releaseStandby();
+
+        response->put_U32(ROBOTV_RET_REDIRECT);
+        response->put_String(redirectHost);
+        response->put_U16(redirectPort);
+        return true;
+    }
+
     int status = startStreaming(
                      request->getProtocolVersion(),
                      channel,
                      priority,
-                     waitForKeyFrame);
+                     waitForKeyFrame,
+                     passthrough);
+
+    if(m_streamer != NULL) {
+        m_streamer->setBatching(batchLatency, batchTimeshiftLatency, batchMaxSize);
+    }
+
+    // the previous standby hubs are released after the new channel has been
+    // acquired, so zapping to a neighbour just moves the cursor
+    if(status == ROBOTV_RET_OK && !passthrough) {
+        updateStandby(channel);
+    }
+    else {
+        releaseStandby();
+    }
 
     if(status == ROBOTV_RET_OK) {
         INFOLOG("--------------------------------------");
@@ -133,6 +209,7 @@ bool StreamController::processOpen(MsgPacket* request, MsgPacket* response) {
 
 bool StreamController::processClose(MsgPacket* request, MsgPacket* response) {
     stopStreaming();
+    releaseStandby();
     return true;
 }
 
@@ -142,6 +219,12 @@ bool StreamController::processRequest(MsgPacket* request, MsgPacket* response) {
     }
 
     bool keyFrameMode = request->get_U8();
+    BandwidthShaper::TrafficClass trafficClass = getTrafficClass(keyFrameMode);
+
+    // throttled - answer without data
+    if(!m_parent->bandwidth().admit(trafficClass)) {
+        return true;
+    }
 
     MsgPacket* p = m_streamer->requestPacket(keyFrameMode);
 
@@ -149,12 +232,12 @@ bool StreamController::processRequest(MsgPacket* request, MsgPacket* response) {
         return true;
     }
 
-    int packetLen = p->getPayloadLength();
-    uint8_t* packetData = p->consume(packetLen);
+    // reference the aggregated payload (sent with writev)
+    std::shared_ptr<MsgPacket> packet(p);
+    m_parent->bandwidth().consume(trafficClass, packet->getPayloadLength());
 
-    response->setMsgID(p->getMsgID());
-    response->put_Blob(packetData, packetLen);
-    delete p;
+    response->setMsgID(packet->getMsgID());
+    response->put_Payload(packet);
 
     return true;
 }
@@ -182,32 +265,132 @@ bool StreamController::processSignal(MsgPacket* request, MsgPacket* response) {
 }
 
 void StreamController::processChannelChange(const cChannel* Channel) {
-    std::lock_guard<std::mutex> lock(m_lock);
+    std::lock_guard<ProfiledMutex> lock(m_lock);
 
     if(m_streamer != NULL) {
         m_streamer->processChannelChange(Channel);
     }
 }
 
-int StreamController::startStreaming(int version, const cChannel* channel, int32_t priority, bool waitForKeyFrame) {
-    std::lock_guard<std::mutex> lock(m_lock);
+int StreamController::startStreaming(int version, const cChannel* channel, int32_t priority, bool waitForKeyFrame, bool passthrough) {
+    std::lock_guard<ProfiledMutex> lock(m_lock);
 
-    m_streamer = new LiveStreamer(m_parent, channel, priority);
+    m_streamer = new LiveStreamer(m_parent, channel, priority, passthrough);
     m_streamer->setLanguage(m_languageIndex, m_langStreamType);
+    m_streamer->setProtocolVersion(version);
     m_streamer->setWaitForKeyFrame(waitForKeyFrame);
 
+    // wake up the client when new data can be pushed
+    if(m_parent->pushStreamingEnabled()) {
+        RoboTvClient* parent = m_parent;
+        m_streamer->setNotify([parent]() {
+            parent->wakeup();
+        });
+    }
+
     return m_streamer->switchChannel(channel);
 }
 
+LiveStreamer* StreamController::park() {
+    std::lock_guard<ProfiledMutex> lock(m_lock);
+
+    LiveStreamer* streamer = m_streamer;
+    m_streamer = NULL;
+
+    if(streamer != NULL) {
+        streamer->setNotify(nullptr);
+        streamer->setParent(NULL);
+    }
+
+    return streamer;
+}
+
+void StreamController::resume(LiveStreamer* streamer) {
+    if(streamer == NULL) {
+        return;
+    }
+
+    stopStreaming();
+
+    std::lock_guard<ProfiledMutex> lock(m_lock);
+
+    m_streamer = streamer;
+    m_streamer->setParent(m_parent);
+
+    m_credit = PUSH_INITIAL_CREDIT;
+    m_keyFrameMode = false;
+
+    if(m_parent->pushStreamingEnabled()) {
+        RoboTvClient* parent = m_parent;
+        m_streamer->setNotify([parent]() {
+            parent->wakeup();
+        });
+    }
+}
+
 void StreamController::stopStreaming() {
-    std::lock_guard<std::mutex> lock(m_lock);
+    std::lock_guard<ProfiledMutex> lock(m_lock);
 
-    delete m_streamer;
+    // the teardown of the queue and the timeshift store doesn't delay zapping
+    LiveStreamer::destroy(m_streamer);
     m_streamer = NULL;
 }
 
+void StreamController::updateStandby(const cChannel* channel) {
+    std::vector<LiveHub*> previous;
+    previous.swap(m_standbyHubs);
+
+    int count = RoboTVServerConfig::instance().standbyChannels;
+    LiveHub* current = LiveHub::find(createChannelUid(channel));
+    cDevice* device = (current != NULL) ? current->getDevice() : NULL;
+
+    if(count > 0 && device != NULL) {
+        // the current channel stays in standby as well (zapping back)
+        std::vector<const cChannel*> neighbours = { channel };
+
+        RoboTVChannels& c = RoboTVChannels::instance();
+        c.lock(false);
+
+        // next and previous channels (skipping group separators)
+        for(int direction = 1; direction >= -1; direction -= 2) {
+            const cChannel* neighbour = channel;
+
+            for(int i = 0; i < count && neighbour != NULL; i++) {
+                neighbour = c.get()->GetByNumber(neighbour->Number() + direction, direction);
+
+                if(neighbour != NULL && neighbour != channel) {
+                    neighbours.push_back(neighbour);
+                }
+            }
+        }
+
+        c.unlock();
+
+        // only channels on the tuned transponder, no tuner is switched for standby
+        for(auto neighbour : neighbours) {
+            LiveHub* hub = LiveHub::acquireStandby(neighbour, device);
+
+            if(hub != NULL) {
+                m_standbyHubs.push_back(hub);
+            }
+        }
+    }
+
+    for(auto hub : previous) {
+        LiveHub::releaseStandby(hub);
+    }
+}
+
+void StreamController::releaseStandby() {
+    for(auto hub : m_standbyHubs) {
+        LiveHub::releaseStandby(hub);
+    }
+
+    m_standbyHubs.clear();
+}
+
 bool StreamController::processSeek(MsgPacket* request, MsgPacket* response) {
-    std::lock_guard<std::mutex> lock(m_lock);
+    std::lock_guard<ProfiledMutex> lock(m_lock);
 
     if(m_streamer == NULL) {
         return false;
@@ -219,3 +402,116 @@ bool StreamController::processSeek(MsgPacket* request, MsgPacket* response) {
     response->put_S64(pts);
     return true;
 }
+
+bool StreamController::processCredit(MsgPacket* request, MsgPacket* response) {
+    if(m_streamer == NULL) {
+        return false;
+    }
+
+    m_credit += request->get_U32();
+
+    if(!request->eop()) {
+        m_keyFrameMode = request->get_U8();
+    }
+
+    return true;
+}
+
+bool StreamController::processSelect(MsgPacket* request, MsgPacket* response) {
+    std::lock_guard<ProfiledMutex> lock(m_lock);
+
+    if(m_streamer == NULL) {
+        return false;
+    }
+
+    // pids of the played audio / subtitle streams (none: all streams)
+    std::set<int> pids;
+    int count = request->get_U8();
+
+    for(int i = 0; i < count; i++) {
+        pids.insert(request->get_U32());
+    }
+
+    INFOLOG("%i stream(s) selected", count);
+    m_streamer->selectStreams(pids);
+
+    response->put_U32(ROBOTV_RET_OK);
+    return true;
+}
+
+bool StreamController::processRecord(MsgPacket* request, MsgPacket* response) {
+    uint32_t uid = 0;
+
+    {
+        std::lock_guard<ProfiledMutex> lock(m_lock);
+
+        if(m_streamer == NULL) {
+            response->put_U32(ROBOTV_RET_DATAINVALID);
+            return true;
+        }
+
+        uid = m_streamer->getChannelUid();
+    }
+
+    bool start = request->get_U8();
+    int64_t startPosition = 0;
+
+    if(!request->eop()) {
+        startPosition = request->get_S64();
+    }
+
+    if(!start) {
+        response->put_U32(LiveRecorder::stop(uid) ? ROBOTV_RET_OK : ROBOTV_RET_DATAUNKNOWN);
+        return true;
+    }
+
+    RoboTVChannels& c = RoboTVChannels::instance();
+    c.lock(false);
+    const cChannel* channel = findChannelByUid(uid);
+    c.unlock();
+
+    int status = ROBOTV_RET_DATAINVALID;
+    std::string fileName;
+
+    if(channel != NULL) {
+        fileName = LiveRecorder::start(channel, startPosition, status);
+    }
+
+    response->put_U32(status);
+    response->put_String(fileName);
+    return true;
+}
+
+void StreamController::pushPackets() {
+    if(m_streamer == NULL) {
+        return;
+    }
+
+    BandwidthShaper::TrafficClass trafficClass = getTrafficClass(m_keyFrameMode);
+
+    while(m_credit > 0 && m_parent->sendWindowAvailable() && m_parent->bandwidth().admit(trafficClass)) {
+        uint32_t maxLength = (uint32_t)std::min<int64_t>(m_credit, PUSH_MAX_PACKET_SIZE);
+        MsgPacket* p = m_streamer->requestPacket(m_keyFrameMode, maxLength, true);
+
+        if(p == NULL) {
+            break;
+        }
+
+        std::shared_ptr<MsgPacket> packet(p);
+        m_credit -= packet->getPayloadLength();
+        m_parent->bandwidth().consume(trafficClass, packet->getPayloadLength());
+
+        MsgPacket* msg = new MsgPacket(ROBOTV_STREAM_PUSHPKT, ROBOTV_CHANNEL_STREAM);
+        msg->put_Payload(packet);
+
+        m_parent->queueMessage(msg);
+    }
+}
+
+BandwidthShaper::TrafficClass StreamController::getTrafficClass(bool keyFrameMode) {
+    if(keyFrameMode || m_streamer->isTimeShifting()) {
+        return BandwidthShaper::tcTimeShift;
+    }
+
+    return BandwidthShaper::tcLive;
+}
@@ -26,9 +26,12 @@
 #define	ROBOTV_STREAMCONTROLLER_H
 
 #include <mutex>
+#include <vector>
 
 #include "live/livestreamer.h"
+#include "net/bandwidthshaper.h"
 #include "controller.h"
+#include "tools/lockprofiler.h"
 
 class RoboTvClient;
 class MsgPacket;
@@ -40,10 +43,24 @@ public:
 
     virtual ~StreamController();
 
-    bool process(MsgPacket* request, MsgPacket* response);
+    void registerHandlers(RequestTable& table);
 
     void processChannelChange(const cChannel* Channel);
 
+    /** Push pending stream packets to the client.
+     Used in push-mode only. Packets are queued on the client as long as
+     the credit granted by the client (ROBOTV_CHANNELSTREAM_CREDIT) lasts.
+     */
+    void pushPackets();
+
+    /** Release the live stream of a disconnected client (for resuming).
+     @return the streamer (NULL if not streaming)
+     */
+    LiveStreamer* park();
+
+    /** Continue a parked live stream */
+    void resume(LiveStreamer* streamer);
+
 protected:
 
     bool processOpen(MsgPacket* request, MsgPacket* response);
@@ -58,23 +75,43 @@ protected:
 
     bool processSeek(MsgPacket* request, MsgPacket* response);
 
+    bool processCredit(MsgPacket* request, MsgPacket* response);
+
+    bool processSelect(MsgPacket* request, MsgPacket* response);
+
+    bool processRecord(MsgPacket* request, MsgPacket* response);
+
 private:
 
     StreamController(const StreamController& orig);
 
-    int startStreaming(int version, const cChannel* channel, int32_t priority, bool waitforiframe = false);
+    int startStreaming(int version, const cChannel* channel, int32_t priority, bool waitforiframe = false, bool passthrough = false);
 
     void stopStreaming();
 
+    /** Keep the neighbouring channels of the streamed channel in warm standby */
+    void updateStandby(const cChannel* channel);
+
+    void releaseStandby();
+
+    /** Traffic class of the stream data (live or timeshift) */
+    BandwidthShaper::TrafficClass getTrafficClass(bool keyFrameMode);
+
     int m_languageIndex = -1;
 
     StreamInfo::Type m_langStreamType;
 
     LiveStreamer* m_streamer = NULL;
 
-    std::mutex m_lock;
+    std::vector<LiveHub*> m_standbyHubs;
+
+    ProfiledMutex m_lock{"stream"};
 
     RoboTvClient* m_parent;
+
+    int64_t m_credit = 0;
+
+    bool m_keyFrameMode = false;
 };
 
 #endif	// ROBOTV_STREAMCONTROLLER_H
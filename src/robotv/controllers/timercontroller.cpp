@@ -27,11 +27,37 @@
 #include "robotv/robotvcommand.h"
 #include "robotv/robotvchannels.h"
 #include "robotv/robotvclient.h"
+#include "tools/crc32.h"
 #include "tools/hash.h"
 #include "tools/utf8conv.h"
 #include "vdr/menu.h"
 
+#include <algorithm>
 #include <set>
+#include <stdlib.h>
+
+// maximum age of the timer snapshot (conflicts and events may change)
+#define TIMER_SNAPSHOT_MAX_AGE_MS 5000
+
+// maximum number of removed timers we remember
+#define TIMER_SNAPSHOT_MAX_REMOVED 256
+
+std::mutex TimerController::m_snapshotMutex;
+
+std::map<uint32_t, TimerController::SnapshotEntry> TimerController::m_snapshot;
+
+std::vector<uint32_t> TimerController::m_snapshotOrder;
+
+// generations of a previous server instance are never valid
+uint64_t TimerController::m_generation = (uint64_t)time(NULL) << 16;
+
+uint64_t TimerController::m_firstGeneration = TimerController::m_generation;
+
+uint64_t TimerController::m_snapshotTime = 0;
+
+int TimerController::m_timersState = -1;
+
+int TimerController::m_removedCount = 0;
 
 TimerController::TimerController(RoboTvClient* parent) : m_parent(parent) {
 }
@@ -42,31 +68,35 @@ TimerController::TimerController(const TimerController& orig) {
 TimerController::~TimerController() {
 }
 
-bool TimerController::process(MsgPacket* request, MsgPacket* response) {
-    switch(request->getMsgID()) {
-        case ROBOTV_TIMER_GET:
-            return processGet(request, response);
+void TimerController::registerHandlers(RequestTable& table) {
+    table.add(ROBOTV_TIMER_GET, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGet(request, response);
+    });
 
-        case ROBOTV_TIMER_GETLIST:
-            return processGetTimers(request, response);
+    table.add(ROBOTV_TIMER_GETLIST, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetTimers(request, response);
+    });
 
-        case ROBOTV_TIMER_ADD:
-            return processAdd(request, response);
+    table.add(ROBOTV_TIMER_ADD, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processAdd(request, response);
+    });
 
-        case ROBOTV_TIMER_DELETE:
-            return processDelete(request, response);
+    table.add(ROBOTV_TIMER_DELETE, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processDelete(request, response);
+    });
 
-        case ROBOTV_TIMER_UPDATE:
-            return processUpdate(request, response);
-            break;
-    }
+    table.add(ROBOTV_TIMER_UPDATE, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processUpdate(request, response);
+    });
 
-    return false;
+    table.add(ROBOTV_TIMER_GETCHANGES, [ = ](MsgPacket * request, MsgPacket * response) {
+        return processGetChanges(request, response);
+    });
 }
 
-void TimerController::timer2Packet(cTimer* timer, MsgPacket* p) {
+void TimerController::timer2Packet(cTimer* timer, MsgPacket* p, int conflicts) {
     Utf8Conv toUtf8;
-    int flags = checkTimerConflicts(timer);
+    int flags = (conflicts < 0) ? checkTimerConflicts(timer) : conflicts;
 
     p->put_U32(timer->Index());
     p->put_U32(timer->Flags() | flags);
@@ -146,19 +176,174 @@ bool TimerController::processGetTimers(MsgPacket* request, MsgPacket* response)
         return true;
     }
 
-    cTimer* timer;
-    int numTimers = Timers.Count();
+    updateSnapshot();
+
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+    response->put_U32(m_snapshotOrder.size());
+
+    for(auto uid : m_snapshotOrder) {
+        SnapshotEntry& e = m_snapshot[uid];
+        response->put_Blob(e.data.data(), e.data.size());
+    }
+
+    return true;
+}
+
+bool TimerController::processGetChanges(MsgPacket* request, MsgPacket* response) {
+    if(Timers.BeingEdited()) {
+        ERRORLOG("Unable to get timers - timers being edited at VDR");
+        response->put_U32(ROBOTV_RET_DATALOCKED);
+        return true;
+    }
+
+    uint64_t generation = request->get_U64();
+
+    updateSnapshot();
 
-    response->put_U32(numTimers);
+    std::vector<uint32_t> changed;
+    std::vector<uint32_t> removed;
 
-    for(int i = 0; i < numTimers; i++) {
-        timer = Timers.Get(i);
+    bool delta = getChanges(generation, changed, removed, generation);
+
+    response->put_U32(ROBOTV_RET_OK);
+    response->put_U64(generation);
+    response->put_U8(delta ? 0 : 1);
+
+    response->put_U32(removed.size());
+
+    for(auto uid : removed) {
+        response->put_U32(uid);
+    }
 
-        if(!timer) {
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+    response->put_U32(changed.size());
+
+    for(auto uid : changed) {
+        SnapshotEntry& e = m_snapshot[uid];
+        response->put_U32(uid);
+        response->put_Blob(e.data.data(), e.data.size());
+    }
+
+    return true;
+}
+
+uint64_t TimerController::updateSnapshot(bool force) {
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+
+    bool modified = Timers.Modified(m_timersState);
+
+    if(!force && !modified && cTimeMs::Now() - m_snapshotTime < TIMER_SNAPSHOT_MAX_AGE_MS) {
+        return m_generation;
+    }
+
+    uint64_t next = m_generation + 1;
+    bool changed = false;
+    std::set<uint32_t> current;
+
+    m_snapshotOrder.clear();
+
+    // conflicts of all timers in one pass
+    std::map<const cTimer*, int> conflicts = evaluateConflicts();
+
+    for(int i = 0; i < Timers.Count(); i++) {
+        cTimer* timer = Timers.Get(i);
+
+        if(timer == NULL) {
             continue;
         }
 
-        timer2Packet(timer, response);
+        uint32_t uid = createTimerUid(timer);
+
+        // duplicate timer
+        if(!current.insert(uid).second) {
+            continue;
+        }
+
+        m_snapshotOrder.push_back(uid);
+
+        MsgPacket entry;
+        timer2Packet(timer, &entry, conflicts[timer]);
+        uint32_t fingerprint = crc32(entry.getPayload(), entry.getPayloadLength());
+
+        auto e = m_snapshot.find(uid);
+
+        if(e != m_snapshot.end() && !e->second.removed && e->second.fingerprint == fingerprint) {
+            continue;
+        }
+
+        if(e != m_snapshot.end() && e->second.removed) {
+            m_removedCount--;
+        }
+
+        SnapshotEntry& s = m_snapshot[uid];
+        s.fingerprint = fingerprint;
+        s.generation = next;
+        s.removed = false;
+        s.data.assign(entry.getPayload(), entry.getPayload() + entry.getPayloadLength());
+
+        changed = true;
+    }
+
+    // removed timers
+    for(auto& e : m_snapshot) {
+        if(e.second.removed || current.find(e.first) != current.end()) {
+            continue;
+        }
+
+        e.second.fingerprint = 0;
+        e.second.generation = next;
+        e.second.removed = true;
+        e.second.data.clear();
+
+        m_removedCount++;
+        changed = true;
+    }
+
+    // forget removed timers (clients with older generations get all timers)
+    if(m_removedCount > TIMER_SNAPSHOT_MAX_REMOVED) {
+        for(auto e = m_snapshot.begin(); e != m_snapshot.end();) {
+            if(e->second.removed) {
+                e = m_snapshot.erase(e);
+            }
+            else {
+                e++;
+            }
+        }
+
+        m_removedCount = 0;
+        m_firstGeneration = next;
+    }
+
+    if(changed) {
+        m_generation = next;
+        DEBUGLOG("timer snapshot generation %llu", (unsigned long long)m_generation);
+    }
+
+    m_snapshotTime = cTimeMs::Now();
+    return m_generation;
+}
+
+bool TimerController::getChanges(uint64_t generation, std::vector<uint32_t>& changed, std::vector<uint32_t>& removed, uint64_t& current) {
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+
+    current = m_generation;
+    bool full = (generation < m_firstGeneration || generation > m_generation);
+
+    if(full) {
+        changed = m_snapshotOrder;
+        return false;
+    }
+
+    for(auto uid : m_snapshotOrder) {
+        if(m_snapshot[uid].generation > generation) {
+            changed.push_back(uid);
+        }
+    }
+
+    for(auto& e : m_snapshot) {
+        if(e.second.removed && e.second.generation > generation) {
+            removed.push_back(e.first);
+        }
     }
 
     return true;
@@ -233,6 +418,7 @@ bool TimerController::processAdd(MsgPacket* request, MsgPacket* response) {
             Timers.SetModified();
             INFOLOG("Timer %s added", *timer->ToDescr());
             response->put_U32(ROBOTV_RET_OK);
+            putConflicts(timer, response);
             return true;
         }
         else {
@@ -350,107 +536,155 @@ bool TimerController::processUpdate(MsgPacket* request, MsgPacket* response) {
     m_parent->sendTimerChange();
 
     response->put_U32(ROBOTV_RET_OK);
+    putConflicts(timer, response);
 
     return true;
 }
 
 int TimerController::checkTimerConflicts(cTimer* timer) {
+    std::map<const cTimer*, int> conflicts = evaluateConflicts(timer);
+    return conflicts[timer];
+}
+
+std::map<const cTimer*, int> TimerController::evaluateConflicts(cTimer* candidate) {
     RoboTVChannels& c = RoboTVChannels::instance();
     c.lock(false);
 
-    // check for timer conflicts
-    DEBUGLOG("Checking conflicts for: %s", (const char*)timer->ToText(true));
+    // active timers (and the candidate)
+    std::vector<ConflictEntry> entries;
+    std::map<uint64_t, uint64_t> deviceMasks;
+    bool candidateFound = false;
 
-    // order active timers by starttime
-    std::map<time_t, cTimer*> timeline;
-    int numTimers = Timers.Count();
+    for(int i = 0; i <= Timers.Count(); i++) {
+        cTimer* t = (i < Timers.Count()) ? Timers.Get(i) : candidate;
 
-    for(int i = 0; i < numTimers; i++) {
-        cTimer* t = Timers.Get(i);
-
-        // same timer -> skip
-        if(!t || timer->Index() == i) {
+        if(t == NULL || (i == Timers.Count() && candidateFound)) {
             continue;
         }
 
-        // timer not active -> skip
-        if(!(t->Flags() & tfActive)) {
+        if(t == candidate) {
+            candidateFound = true;
+        }
+        else if(!(t->Flags() & tfActive)) {
             continue;
         }
 
-        // this one is earlier -> no match
-        if(t->StopTime() <= timer->StartTime()) {
+        const cChannel* channel = t->Channel();
+
+        if(channel == NULL) {
             continue;
         }
 
-        // this one is later -> no match
-        if(t->StartTime() >= timer->StopTime()) {
-            continue;
+        ConflictEntry e;
+        e.timer = t;
+        e.start = t->StartTime();
+        e.stop = t->StopTime();
+        e.transponder = ((uint64_t)(uint32_t)channel->Source() << 32) | (uint32_t)channel->Transponder();
+
+        // devices able to receive the transponder (device class)
+        auto m = deviceMasks.find(e.transponder);
+
+        if(m == deviceMasks.end()) {
+            uint64_t mask = 0;
+
+            for(int d = 0; d < cDevice::NumDevices() && d < 64; d++) {
+                cDevice* device = cDevice::GetDevice(d);
+
+                if(device != NULL && device->ProvidesTransponder(channel)) {
+                    mask |= (1ULL << d);
+                }
+            }
+
+            m = deviceMasks.insert(std::make_pair(e.transponder, mask)).first;
         }
 
-        timeline[t->StartTime()] = t;
+        e.devices = m->second;
+        e.maxTransponders = 1;
+        entries.push_back(e);
     }
 
-    std::set<int> transponders;
-    transponders.insert(timer->Channel()->Transponder()); // we also count ourself
-    cTimer* to_check = timer;
+    c.unlock();
 
-    std::map<time_t, cTimer*>::iterator i;
+    // sweep over all start / stop times (stops first, adjacent timers don't overlap)
+    std::vector<std::pair<time_t, int>> events;
 
-    for(i = timeline.begin(); i != timeline.end(); i++) {
-        cTimer* t = i->second;
+    for(size_t i = 0; i < entries.size(); i++) {
+        events.push_back(std::make_pair(entries[i].start, (int)i + 1));
+        events.push_back(std::make_pair(entries[i].stop, -(int)i - 1));
+    }
 
-        // this one is earlier -> no match
-        if(t->StopTime() <= to_check->StartTime()) {
-            continue;
-        }
+    std::sort(events.begin(), events.end());
 
-        // this one is later -> no match
-        if(t->StartTime() >= to_check->StopTime()) {
+    // running timers by device class
+    std::map<uint64_t, std::vector<int>> running;
+
+    for(auto& ev : events) {
+        int index = std::abs(ev.second) - 1;
+        std::vector<int>& active = running[entries[index].devices];
+
+        if(ev.second < 0) {
+            active.erase(std::remove(active.begin(), active.end(), index), active.end());
             continue;
         }
 
-        // same transponder -> no conflict
-        if(t->Channel()->Transponder() == to_check->Channel()->Transponder()) {
-            continue;
+        active.push_back(index);
+
+        // number of transponders needed in this device class right now
+        std::set<uint64_t> transponders;
+
+        for(int i : active) {
+            transponders.insert(entries[i].transponder);
         }
 
-        // different source -> no conflict
-        if(t->Channel()->Source() != to_check->Channel()->Source()) {
-            continue;
+        for(int i : active) {
+            entries[i].maxTransponders = std::max(entries[i].maxTransponders, (int)transponders.size());
         }
+    }
 
-        DEBUGLOG("Possible conflict: %s", (const char*)t->ToText(true));
-        transponders.insert(t->Channel()->Transponder());
+    std::map<const cTimer*, int> result;
 
-        // now check conflicting timer
-        to_check = t;
+    for(auto& e : entries) {
+        int cflags = 0;
+
+        if(e.maxTransponders > __builtin_popcountll(e.devices)) {
+            DEBUGLOG("ERROR - Not enough devices: %s", (const char*)e.timer->ToText(true));
+            cflags += 2048;
+        }
+        else if(e.maxTransponders > 1) {
+            DEBUGLOG("Overlapping timers - Will record: %s", (const char*)e.timer->ToText(true));
+            cflags += 1024;
+        }
+
+        result[e.timer] = cflags;
     }
 
-    uint32_t number_of_devices_for_this_channel = 0;
+    return result;
+}
+
+void TimerController::putConflicts(cTimer* timer, MsgPacket* response) {
+    std::map<const cTimer*, int> conflicts = evaluateConflicts(timer);
+    int cflags = conflicts[timer];
+
+    response->put_U32(cflags);
 
-    for(int i = 0; i < cDevice::NumDevices(); i++) {
-        cDevice* device = cDevice::GetDevice(i);
+    // timers overlapping the timer that can't be recorded
+    std::vector<uint32_t> uids;
 
-        if(device != NULL && device->ProvidesTransponder(timer->Channel())) {
-            number_of_devices_for_this_channel++;
+    if(cflags & 2048) {
+        for(auto& i : conflicts) {
+            const cTimer* t = i.first;
+
+            if(t == timer || !(i.second & 2048) || t->StopTime() <= timer->StartTime() || t->StartTime() >= timer->StopTime()) {
+                continue;
+            }
+
+            uids.push_back(createTimerUid(t));
         }
     }
 
-    int cflags = 0;
+    response->put_U32(uids.size());
 
-    if(transponders.size() > number_of_devices_for_this_channel) {
-        DEBUGLOG("ERROR - Not enough devices");
-        cflags += 2048;
+    for(auto uid : uids) {
+        response->put_U32(uid);
     }
-    else if(transponders.size() > 1) {
-        DEBUGLOG("Overlapping timers - Will record");
-        cflags += 1024;
-    }
-    else {
-        DEBUGLOG("No conflicts");
-    }
-
-    c.unlock();
-    return cflags;
 }
@@ -28,6 +28,11 @@
 #include "vdr/timers.h"
 #include "controller.h"
 
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
 class RoboTvClient;
 class MsgPacket;
 
@@ -38,16 +43,67 @@ public:
 
     virtual ~TimerController();
 
-    bool process(MsgPacket* request, MsgPacket* response);
+    void registerHandlers(RequestTable& table);
 
     static void event2Packet(const cEvent* event, MsgPacket* p);
 
-    static void timer2Packet(cTimer* timer, MsgPacket* p);
+    /** Serialize a timer.
+     @param conflicts conflict flags of the timer (-1 - check the timer)
+     */
+    static void timer2Packet(cTimer* timer, MsgPacket* p, int conflicts = -1);
 
     static int checkTimerConflicts(cTimer* timer);
 
+    /** Evaluate the conflicts of all active timers.
+     Sweeps over the start and stop times of all timers once. For every
+     class of devices (devices able to receive the transponder) the number
+     of transponders needed at the same time is compared to the number of
+     devices.
+     @param candidate timer to check in addition (may be inactive or not in the list)
+     @return conflict flags by timer (1024 - overlapping, 2048 - not enough devices)
+     */
+    static std::map<const cTimer*, int> evaluateConflicts(cTimer* candidate = NULL);
+
+    /** Update the timer snapshot.
+     Every timer is kept serialized with the generation of its last change.
+     The timers are serialized again if they are modified, if the snapshot
+     is older than a few seconds (conflicts, events) or if forced.
+     @return current generation
+     */
+    static uint64_t updateSnapshot(bool force = false);
+
+    /** Get the timers changed since a generation.
+     @param generation generation known by the caller
+     @param changed uids of added / modified timers
+     @param removed uids of removed timers
+     @param current current generation
+     @return false if the generation is unknown (all timers are returned as changed)
+     */
+    static bool getChanges(uint64_t generation, std::vector<uint32_t>& changed, std::vector<uint32_t>& removed, uint64_t& current);
+
 private:
 
+    struct SnapshotEntry {
+        uint32_t fingerprint;
+        uint64_t generation;
+        bool removed;
+        std::vector<uint8_t> data;
+    };
+
+    struct ConflictEntry {
+        const cTimer* timer;
+        time_t start;
+        time_t stop;
+        uint64_t transponder;
+        uint64_t devices;
+        int maxTransponders;
+    };
+
+    bool processGetChanges(MsgPacket* request, MsgPacket* response);
+
+    /** Append the conflict flags and the uids of the conflicting timers */
+    static void putConflicts(cTimer* timer, MsgPacket* response);
+
     bool processGet(MsgPacket* request, MsgPacket* response);
 
     bool processGetTimers(MsgPacket* request, MsgPacket* response);
@@ -62,6 +118,23 @@ private:
 
     RoboTvClient* m_parent;
 
+    static std::mutex m_snapshotMutex;
+
+    static std::map<uint32_t, SnapshotEntry> m_snapshot;
+
+    // uids of all timers (in the order of the timer list)
+    static std::vector<uint32_t> m_snapshotOrder;
+
+    static uint64_t m_generation;
+
+    static uint64_t m_firstGeneration;
+
+    static uint64_t m_snapshotTime;
+
+    static int m_timersState;
+
+    static int m_removedCount;
+
 };
 
 #endif // ROBOTV_TIMERCONTROLLER_H
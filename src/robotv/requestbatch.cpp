@@ -0,0 +1,97 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "requestbatch.h"
+#include "robotvcommand.h"
+#include "config/config.h"
+#include "net/msgpacket.h"
+
+RequestBatch::RequestBatch(MsgPacket* envelope) : m_uid(envelope->getUID()) {
+    uint16_t count = envelope->get_U16();
+
+    if(count > MaxRequests) {
+        ERRORLOG("batch of %u requests rejected", (unsigned int)count);
+        return;
+    }
+
+    for(uint16_t i = 0; i < count; i++) {
+        uint16_t msgid = envelope->get_U16();
+        uint32_t length = envelope->get_U32();
+
+        MsgPacket* request = new MsgPacket(msgid, ROBOTV_CHANNEL_REQUEST_RESPONSE, m_uid);
+        uint8_t* payload = (length > 0) ? request->reserve(length) : NULL;
+
+        if(length > 0 && (payload == NULL || !envelope->get_Blob(payload, length))) {
+            ERRORLOG("malformed batch request (%u of %u)", (unsigned int)i + 1, (unsigned int)count);
+            delete request;
+            break;
+        }
+
+        request->rewind();
+        m_requests.push_back(request);
+    }
+
+    m_responses.resize(m_requests.size(), NULL);
+}
+
+RequestBatch::~RequestBatch() {
+    for(auto p : m_requests) {
+        delete p;
+    }
+
+    for(auto p : m_responses) {
+        delete p;
+    }
+}
+
+void RequestBatch::setResponse(size_t index, MsgPacket* response) {
+    delete m_responses[index];
+    m_responses[index] = response;
+}
+
+MsgPacket* RequestBatch::createResponse() {
+    MsgPacket* response = new MsgPacket(ROBOTV_BATCH, ROBOTV_CHANNEL_REQUEST_RESPONSE, m_uid);
+
+    response->put_U16(m_requests.size());
+
+    for(size_t i = 0; i < m_requests.size(); i++) {
+        MsgPacket* p = m_responses[i];
+
+        response->put_U16(m_requests[i]->getMsgID());
+        response->put_U8(p != NULL);
+
+        if(p == NULL) {
+            response->put_U32(0);
+            continue;
+        }
+
+        uint8_t* payload = p->getPayload();
+        uint32_t length = p->getPayloadLength();
+
+        response->put_U32(length);
+        response->put_Blob(payload, length);
+    }
+
+    return response;
+}
@@ -0,0 +1,83 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_REQUESTBATCH_H
+#define ROBOTV_REQUESTBATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class MsgPacket;
+
+/**
+ * Sub-requests of a ROBOTV_BATCH envelope.
+ * The envelope carries a list of requests (U16 count, then per request
+ * U16 message id, U32 payload length and the payload). The responses are
+ * returned in one envelope, in the order of the requests (U16 count, then
+ * per response U16 message id, U8 handled flag, U32 payload length and
+ * the payload).
+ */
+class RequestBatch {
+public:
+
+    enum {
+        MaxRequests = 64
+    };
+
+    /** Parse the sub-requests of an envelope
+     @param envelope the batch request (not taken over)
+     */
+    RequestBatch(MsgPacket* envelope);
+
+    virtual ~RequestBatch();
+
+    size_t size() const {
+        return m_requests.size();
+    }
+
+    MsgPacket* request(size_t index) {
+        return m_requests[index];
+    }
+
+    /** Set the response of a sub-request
+     @param index index of the sub-request
+     @param response the response (taken over), NULL if unhandled
+     */
+    void setResponse(size_t index, MsgPacket* response);
+
+    /** Create the envelope with all responses */
+    MsgPacket* createResponse();
+
+private:
+
+    uint32_t m_uid;
+
+    std::vector<MsgPacket*> m_requests;
+
+    std::vector<MsgPacket*> m_responses;
+
+};
+
+#endif // ROBOTV_REQUESTBATCH_H
@@ -0,0 +1,76 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "requestpool.h"
+
+RequestPool::RequestPool(int workerCount) {
+    for(int i = 0; i < workerCount; i++) {
+        m_workers.push_back(new std::thread([&]() {
+            workerLoop();
+        }));
+    }
+}
+
+RequestPool::~RequestPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        m_condition.notify_all();
+    }
+
+    for(auto t : m_workers) {
+        t->join();
+        delete t;
+    }
+}
+
+RequestPool& RequestPool::instance() {
+    static RequestPool pool;
+    return pool;
+}
+
+void RequestPool::run(Job job) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back(job);
+    m_condition.notify_one();
+}
+
+void RequestPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // pending jobs are finished on shutdown, their owners wait for them
+    while(m_running || !m_jobs.empty()) {
+        if(m_jobs.empty()) {
+            m_condition.wait(lock);
+            continue;
+        }
+
+        Job job = m_jobs.front();
+        m_jobs.pop_front();
+
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
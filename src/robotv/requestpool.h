@@ -0,0 +1,73 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_REQUESTPOOL_H
+#define ROBOTV_REQUESTPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Worker pool for slow client requests.
+ * Metadata requests (EPG, recordings, timers, channels, artwork) run on
+ * these threads, so the I/O workers of the reactor keep serving the
+ * stream requests in the meantime.
+ */
+class RequestPool {
+public:
+
+    typedef std::function<void()> Job;
+
+    /** Queue a job (runs on a worker thread) */
+    void run(Job job);
+
+    static RequestPool& instance();
+
+    virtual ~RequestPool();
+
+protected:
+
+    RequestPool(int workerCount = 4);
+
+private:
+
+    void workerLoop();
+
+    bool m_running = true;
+
+    std::vector<std::thread*> m_workers;
+
+    std::deque<Job> m_jobs;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_condition;
+
+};
+
+#endif // ROBOTV_REQUESTPOOL_H
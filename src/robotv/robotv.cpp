@@ -103,6 +103,9 @@ const char** PluginRoboTVServer::SVDRPHelpPages(void) {
     static const char* HelpPages[] = {
         "LSCJ\n"
         "    List all channels activated for roboTV in JSON format.",
+        "STAT [ clients | streamers | queues | hubs | players | latency | locks ]\n"
+        "    Dump the counters and latency histograms of the streaming\n"
+        "    pipeline in JSON format (all groups or the given one).",
         NULL
     };
 
@@ -111,6 +114,10 @@ const char** PluginRoboTVServer::SVDRPHelpPages(void) {
 
 cString PluginRoboTVServer::SVDRPCommand(const char* Command, const char* Option, int& ReplyCode) {
     // Process SVDRP commands this plugin implements
+    if(strcmp(Command, "STAT") == 0) {
+        return m_metrics.SVDRPCommand(Command, Option, ReplyCode);
+    }
+
     return m_channels.SVDRPCommand(Command, Option, ReplyCode);
 }
 
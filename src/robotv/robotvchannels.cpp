@@ -2,20 +2,45 @@
 #include "config/config.h"
 #include "tools/hash.h"
 #include "robotvchannels.h"
+#include "tools/lockprofiler.h"
+#include "tools/time.h"
 
-RoboTVChannels::RoboTVChannels() {
+RoboTVChannels::RoboTVChannels() : m_nextCheck(0), m_reorderRunning(false) {
     Channels.Lock(false);
-    m_channels = reorder(&Channels);
+    m_channels = &Channels;
+
+    if(!RoboTVServerConfig::instance().reorderCmd.empty()) {
+        cChannels* reordered = reorder(serialize(&Channels), Channels.Count());
+        m_channels = (reordered != NULL) ? reordered : &Channels;
+    }
+
     m_hash = getChannelsHash(&Channels);
+    buildIndex(m_channels);
     Channels.Unlock();
 }
 
+RoboTVChannels::~RoboTVChannels() {
+    std::lock_guard<std::mutex> lock(m_reorderMutex);
+
+    if(m_reorderThread.joinable()) {
+        m_reorderThread.join();
+    }
+}
+
 RoboTVChannels& RoboTVChannels::instance() {
     static RoboTVChannels channels;
     return channels;
 }
 
 uint64_t RoboTVChannels::checkUpdates() {
+    // walk the channel list at most once per interval, other callers get the last hash
+    int64_t now = roboTV::currentTimeMillis().count();
+    int64_t nextCheck = m_nextCheck;
+
+    if(now < nextCheck || !m_nextCheck.compare_exchange_strong(nextCheck, now + CheckInterval)) {
+        return getHash();
+    }
+
     cRwLock::Lock(false);
     Channels.Lock(false);
 
@@ -29,6 +54,18 @@ uint64_t RoboTVChannels::checkUpdates() {
         return oldHash;
     }
 
+    // reorder in the background, clients keep the current list meanwhile
+    if(!RoboTVServerConfig::instance().reorderCmd.empty()) {
+        std::string input = serialize(&Channels);
+        int count = Channels.Count();
+
+        Channels.Unlock();
+        cRwLock::Unlock();
+
+        startReorder(newHash, input, count);
+        return oldHash;
+    }
+
     cRwLock::Unlock();
     cRwLock::Lock(true);
 
@@ -37,8 +74,9 @@ uint64_t RoboTVChannels::checkUpdates() {
             delete m_channels;
         }
 
-        m_channels = reorder(&Channels);
+        m_channels = &Channels;
         m_hash = newHash;
+        buildIndex(m_channels);
     }
     else {
         // Seems another thread has already updated the hash.
@@ -50,15 +88,106 @@ uint64_t RoboTVChannels::checkUpdates() {
     return newHash;
 }
 
+void RoboTVChannels::startReorder(uint64_t hash, const std::string& input, int count) {
+    std::lock_guard<std::mutex> lock(m_reorderMutex);
+
+    // a running reorder picks up further changes with the next check
+    if(m_reorderRunning) {
+        return;
+    }
+
+    if(m_reorderThread.joinable()) {
+        m_reorderThread.join();
+    }
+
+    m_reorderRunning = true;
+
+    m_reorderThread = std::thread([ = ]() {
+        cChannels* reordered = reorder(input, count);
+
+        // fall back to the VDR channels
+        publish((reordered != NULL) ? reordered : &Channels, hash);
+        m_reorderRunning = false;
+    });
+}
+
+void RoboTVChannels::publish(cChannels* channels, uint64_t hash) {
+    cRwLock::Lock(true);
+
+    cChannels* oldChannels = m_channels;
+    m_channels = channels;
+    m_hash = hash;
+
+    if(channels == &Channels) {
+        Channels.Lock(false);
+        buildIndex(m_channels);
+        Channels.Unlock();
+    }
+    else {
+        buildIndex(m_channels);
+    }
+
+    cRwLock::Unlock();
+
+    // readers of the previous list are gone (they hold the read lock)
+    if(oldChannels != &Channels && oldChannels != channels) {
+        delete oldChannels;
+    }
+}
+
 cChannels* RoboTVChannels::get() {
     return m_channels;
 }
 
-cChannels* RoboTVChannels::reorder(cChannels* channels) {
+uint64_t RoboTVChannels::getHash() {
+    cRwLock::Lock(false);
+    uint64_t hash = m_hash;
+    cRwLock::Unlock();
+
+    return hash;
+}
+
+void RoboTVChannels::buildIndex(cChannels* channels) {
+    std::lock_guard<std::mutex> lock(m_indexMutex);
+    m_uidIndex.clear();
+
+    for(cChannel* c = channels->First(); c != NULL; c = channels->Next(c)) {
+        m_uidIndex[createChannelUid(c)] = c->GetChannelID();
+    }
+}
+
+cChannel* RoboTVChannels::getByUid(uint32_t uid) {
+    {
+        std::lock_guard<std::mutex> lock(m_indexMutex);
+        auto i = m_uidIndex.find(uid);
+
+        // the channel list uses a hash for channel ids
+        if(i != m_uidIndex.end()) {
+            cChannel* channel = m_channels->GetByChannelID(i->second);
+
+            if(channel != NULL) {
+                return channel;
+            }
+        }
+    }
+
+    // not indexed yet (channel list changed)
+    for(cChannel* c = m_channels->First(); c != NULL; c = m_channels->Next(c)) {
+        if(createChannelUid(c) == uid) {
+            std::lock_guard<std::mutex> lock(m_indexMutex);
+            m_uidIndex[uid] = c->GetChannelID();
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+cChannels* RoboTVChannels::reorder(const std::string& data, int count) {
     std::string reorderCmd = RoboTVServerConfig::instance().reorderCmd;
 
     if(reorderCmd.empty()) {
-        return channels;
+        return NULL;
     }
 
     pid_t pid;
@@ -68,14 +197,14 @@ cChannels* RoboTVChannels::reorder(cChannels* channels) {
 
     if(pipe(input) == -1) {
         ERRORLOG("Failed to create pipe");
-        return channels;
+        return NULL;
     }
 
     if(pipe(output) == -1) {
         ERRORLOG("Failed to create pipe");
         close(input[0]);
         close(input[1]);
-        return channels;
+        return NULL;
     }
 
     switch(pid = fork()) {
@@ -85,7 +214,7 @@ cChannels* RoboTVChannels::reorder(cChannels* channels) {
             close(input[1]);
             close(output[0]);
             close(output[1]);
-            return channels;
+            return NULL;
 
         case 0:
             // Close unused descriptors
@@ -97,7 +226,7 @@ cChannels* RoboTVChannels::reorder(cChannels* channels) {
             dup2(output[1], STDOUT_FILENO);
 
             INFOLOG(
-                "Reordering %i channels with command '%s'", channels->Count(), reorderCmd.c_str());
+                "Reordering %i channels with command '%s'", count, reorderCmd.c_str());
             status = system(reorderCmd.c_str());
 
             if(status != 0) {
@@ -120,14 +249,14 @@ cChannels* RoboTVChannels::reorder(cChannels* channels) {
 
             // Write channels
             f = fdopen(input[1], "w");
-            result = write(f, channels);
+            result = (fwrite(data.data(), 1, data.size(), f) == data.size());
             fclose(f);
-            close(input[1]);
 
             if(!result) {
                 ERRORLOG("Failed to write channels to the command's input");
                 close(output[0]);
-                return channels;
+                waitpid(pid, &status, 0);
+                return NULL;
             }
 
             // Load channels
@@ -141,13 +270,13 @@ cChannels* RoboTVChannels::reorder(cChannels* channels) {
             if(WEXITSTATUS(status) != 0) {
                 ERRORLOG("Returning original channels due to reorder failure");
                 delete reordered;
-                return channels;
+                return NULL;
             }
 
             if(!result) {
                 ERRORLOG("Failed to read channels from the command's output");
                 delete reordered;
-                return channels;
+                return NULL;
             }
 
             INFOLOG("Loaded %i channels", reordered->Count());
@@ -207,9 +336,43 @@ bool RoboTVChannels::write(FILE* f, cChannels* channels) {
     return true;
 }
 
+std::string RoboTVChannels::serialize(cChannels* channels) {
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* f = open_memstream(&buffer, &size);
+
+    if(f == NULL) {
+        return "";
+    }
+
+    write(f, channels);
+    fclose(f);
+
+    std::string result(buffer, size);
+    free(buffer);
+
+    return result;
+}
+
+#ifdef ROBOTV_LOCK_PROFILER
+// start of the current hold (readers hold the lock concurrently)
+static thread_local std::chrono::steady_clock::time_point channelsLocked;
+#endif
+
 bool RoboTVChannels::lock(bool Write, int TimeoutMs) {
+#ifdef ROBOTV_LOCK_PROFILER
+    static LockStats* stats = LockStats::get("channels");
+    auto start = std::chrono::steady_clock::now();
+#endif
+
     if(cRwLock::Lock(Write, TimeoutMs)) {
         if(get()->Lock(Write, TimeoutMs)) {
+#ifdef ROBOTV_LOCK_PROFILER
+            // a read-write lock can't be probed, waits of a microsecond and more count as contended
+            channelsLocked = std::chrono::steady_clock::now();
+            uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(channelsLocked - start).count();
+            stats->acquired(waitUs, waitUs > 0);
+#endif
             return true;
         }
         else {
@@ -221,6 +384,12 @@ bool RoboTVChannels::lock(bool Write, int TimeoutMs) {
 }
 
 void RoboTVChannels::unlock(void) {
+#ifdef ROBOTV_LOCK_PROFILER
+    static LockStats* stats = LockStats::get("channels");
+    auto now = std::chrono::steady_clock::now();
+    stats->released(std::chrono::duration_cast<std::chrono::microseconds>(now - channelsLocked).count());
+#endif
+
     get()->Unlock();
     cRwLock::Unlock();
 }
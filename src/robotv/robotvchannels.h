@@ -7,6 +7,12 @@
 
 #include <vdr/channels.h>
 
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
 class RoboTVChannels: public cRwLock {
 private:
 
@@ -14,18 +20,60 @@ private:
 
     uint64_t m_hash;
 
-    cChannels* reorder(cChannels* channels);
+    /**
+     * Minimum time between two walks of the channel list (ms).
+     * VDR has no channel change counter we could poll without
+     * consuming its save flag.
+     */
+    enum { CheckInterval = 1000 };
+
+    // time of the next channel list check (ms)
+    std::atomic<int64_t> m_nextCheck;
+
+    /**
+     * Run the ReorderCmd on a serialized channel list.
+     * Returns the reordered list or NULL on failure.
+     */
+    cChannels* reorder(const std::string& data, int count);
+
+    /**
+     * Reorder the channels on the reorder thread.
+     * The current list is kept until the reordered list is published.
+     */
+    void startReorder(uint64_t hash, const std::string& input, int count);
+
+    /**
+     * Swap in a new channel list (the previous list is deleted).
+     */
+    void publish(cChannels* channels, uint64_t hash);
 
     bool read(FILE* f, cChannels* channels);
 
     bool write(FILE* f, cChannels* channels);
 
+    std::string serialize(cChannels* channels);
+
     uint64_t getChannelsHash(cChannels* channels);
 
+    void buildIndex(cChannels* channels);
+
+    // channel uid -> channel id
+    std::unordered_map<uint32_t, tChannelID> m_uidIndex;
+
+    std::mutex m_indexMutex;
+
+    std::thread m_reorderThread;
+
+    std::atomic<bool> m_reorderRunning;
+
+    std::mutex m_reorderMutex;
+
 protected:
 
     RoboTVChannels();
 
+    virtual ~RoboTVChannels();
+
 public:
 
     static RoboTVChannels& instance();
@@ -36,7 +84,13 @@ public:
      * parameter is specified - reorder the VDR Channels list with the ReorderCmd
      * command and cache the reordered list.
      *
-     * Returns the calculated hash value.
+     * The ReorderCmd runs in the background. Until the reordered list is
+     * published the previous list (and its hash) stays in place.
+     *
+     * The list is checked at most once per CheckInterval, calls in between
+     * return the hash of the last check.
+     *
+     * Returns the hash value of the current list.
      *
      * TODO: Think about replacing hash with checksum.
      */
@@ -55,6 +109,15 @@ public:
      */
     uint64_t getHash();
 
+    /**
+     * Find a channel by its uid (hash of the channel id).
+     * Uses the uid index, channels not found in the index are searched
+     * in the channel list and added to the index.
+     *
+     * NOTE: Lock before calling this method.
+     */
+    cChannel* getByUid(uint32_t uid);
+
     /**
      * Lock both this instance an the referencing channels list.
      */
@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <map>
+#include <memory>
 
 #include <vdr/recording.h>
 #include <vdr/plugin.h>
@@ -35,37 +36,110 @@
 #include "robotvcommand.h"
 #include "robotvclient.h"
 #include "robotvserver.h"
-
-RoboTvClient::RoboTvClient(int fd, unsigned int id) : m_id(id), m_socket(fd),
+#include "chunkedresponse.h"
+#include "requestbatch.h"
+#include "requestpool.h"
+#include "sessionstore.h"
+#include "net/packetcompressor.h"
+#include "live/latencytrace.h"
+#include "tools/time.h"
+#include "tools/tracepoints.h"
+
+// maximum amount of queued data (push-mode stops pushing above)
+#define SEND_WINDOW (4 * 1024 * 1024)
+
+// compress responses with a larger payload (if enabled by the client)
+#define COMPRESSION_THRESHOLD 4096
+
+RoboTvClient::RoboTvClient(int fd, unsigned int id, IoReactor* reactor) : m_id(id), m_socket(fd),
+    m_reactor(reactor),
+    m_wakeupFd(-1),
+    m_connected(true),
+    m_requests(0),
+    m_bytesReceived(0),
+    m_bytesSent(0),
+    m_packetsSent(0),
     m_streamController(this),
     m_recordingController(this),
-    m_timerController(this) {
-
-    m_controllers = {
-        &m_streamController,
-        &m_recordingController,
-        &m_channelController,
-        &m_timerController,
-        &m_movieController,
-        &m_loginController,
-        &m_epgController,
-        &m_artworkController
-    };
+    m_timerController(this),
+    m_loginController(this),
+    m_epgController(this) {
+
+    // live streams first, stream requests without a live streamer
+    // fall through to the recording player
+    m_streamController.registerHandlers(m_streamRequests);
+    m_recordingController.registerHandlers(m_streamRequests);
+    m_loginController.registerHandlers(m_streamRequests);
+
+    m_channelController.registerHandlers(m_metadataRequests);
+    m_timerController.registerHandlers(m_metadataRequests);
+    m_movieController.registerHandlers(m_metadataRequests);
+    m_epgController.registerHandlers(m_metadataRequests);
+    m_artworkController.registerHandlers(m_metadataRequests);
+
+    {
+        std::lock_guard<std::mutex> lock(m_wakeupLock);
+        m_wakeupFd = m_reactor->add(m_socket, this);
+
+        if(m_wakeupFd == -1) {
+            m_connected = false;
+        }
+    }
 
-    Start();
+    Metrics::instance().add(this, "clients", [ = ]() {
+        return getMetrics();
+    });
 }
 
 RoboTvClient::~RoboTvClient() {
+    Metrics::instance().remove(this);
+
+    // stop event processing
+    m_connected = false;
+
+    // background compressions and metadata requests may still wake us up
+    {
+        std::lock_guard<std::mutex> lock(m_wakeupLock);
+        m_wakeupFd = -1;
+    }
+
+    m_reactor->remove(this);
+
+    // drop queued metadata requests and wait for a running one
+    {
+        std::unique_lock<std::mutex> lock(m_metadataLock);
+
+        m_metadataQueue.clear();
+
+        m_metadataCond.wait(lock, [&]() {
+            return !m_metadataBusy;
+        });
+    }
+
+    // keep the streams for a reconnect
+    if(m_loginController.sessionToken() != 0) {
+        SessionStore::Session session;
+        session.streamer = m_streamController.park();
+        session.player = m_recordingController.park();
+        SessionStore::instance().park(m_loginController.sessionToken(), session);
+    }
+
+    INFOLOG("Client with ID %u: %lu send stalls (%lu ms)", m_id, m_stalls, m_stallTime);
+
     // shutdown connection
     shutdown(m_socket, SHUT_RDWR);
-    Cancel(10);
 
     // close connection
     close(m_socket);
 
     // delete messagequeue
     {
-        std::lock_guard<std::mutex> lock(m_queueLock);
+        std::unique_lock<std::mutex> lock(m_queueLock);
+
+        // wait for running background compressions
+        m_compressCond.wait(lock, [&]() {
+            return m_compressing.empty();
+        });
 
         while(!m_queue.empty()) {
             MsgPacket* p = m_queue.front();
@@ -77,42 +151,124 @@ RoboTvClient::~RoboTvClient() {
     DEBUGLOG("done");
 }
 
-void RoboTvClient::Action(void) {
-    bool bClosed(false);
+bool RoboTvClient::processEvents() {
+    // continue sending pending messages
+    sendQueue();
 
-    while(Running()) {
+    // process all available requests
+    bool closed = false;
 
-        // send pending messages
-        {
-            std::lock_guard<std::mutex> lock(m_queueLock);
+    auto start = std::chrono::steady_clock::now();
 
-            while(!m_queue.empty()) {
-                MsgPacket* p = m_queue.front();
+    MsgPacket* request = NULL;
 
-                if(!p->write(m_socket, m_timeout)) {
-                    break;
-                }
+    while((request = MsgPacket::read(m_socket, closed, 0, m_timeout)) != NULL) {
+        m_receiveLatency.addSince(start);
+        m_bytesReceived += request->getPacketLength();
+        m_requests++;
 
-                m_queue.pop_front();
-                delete p;
-            }
+        // slow requests must not delay the stream
+        if(request->getMsgID() == ROBOTV_BATCH) {
+            processBatch(request);
+            delete request;
+        }
+        else if(isStreamRequest(request)) {
+            processRequest(request, m_streamRequests);
+            delete request;
+        }
+        else {
+            dispatchMetadata(request);
+        }
+
+        start = std::chrono::steady_clock::now();
+    }
+
+    if(closed) {
+        m_connected = false;
+        return false;
+    }
+
+    // push live stream data (push-mode)
+    if(m_loginController.pushStreamingEnabled()) {
+        m_streamController.pushPackets();
+    }
+
+    // send responses
+    sendQueue();
+    return m_connected;
+}
+
+void RoboTvClient::sendQueue() {
+    std::lock_guard<ProfiledMutex> lock(m_queueLock);
+
+    while(!m_queue.empty()) {
+        MsgPacket* p = m_queue.front();
+        bool complete = false;
+
+        // packet is still being compressed
+        if(m_compressing.find(p) != m_compressing.end()) {
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bool success = p->writeNonBlocking(m_socket, complete);
+        m_sendLatency.addSince(start);
+
+        if(!success) {
+            ERRORLOG("Client with ID %u: failed to send message", m_id);
+            m_connected = false;
+            return;
         }
 
-        m_request = MsgPacket::read(m_socket, bClosed, 10);
+        // socket full - continue when it gets writable
+        if(!complete) {
+            if(m_stallStart == 0) {
+                m_stallStart = roboTV::currentTimeMillis().count();
+            }
 
-        if(bClosed) {
-            delete m_request;
-            m_request = NULL;
-            break;
+            return;
         }
 
-        if(m_request != NULL) {
-            processRequest();
-            delete m_request;
+        if(m_stallStart != 0) {
+            m_stallTime += roboTV::currentTimeMillis().count() - m_stallStart;
+            m_stalls++;
+            m_stallStart = 0;
         }
+
+        m_queuedBytes -= p->getPacketLength();
+        m_sendMemory.set(m_queuedBytes);
+        m_bytesSent += p->getPacketLength();
+        m_packetsSent++;
+
+        if(p->getTraceTime() != 0) {
+            LatencyTrace::addSince(p->getTraceChannel(), LatencyTrace::stSend, p->getTraceTime());
+        }
+
+        m_queue.pop_front();
+        delete p;
     }
 }
 
+bool RoboTvClient::sendWindowAvailable() {
+    std::lock_guard<ProfiledMutex> lock(m_queueLock);
+    return m_queuedBytes < SEND_WINDOW;
+}
+
+uint64_t RoboTvClient::getStallTime() {
+    std::lock_guard<ProfiledMutex> lock(m_queueLock);
+    return m_stallTime;
+}
+
+uint64_t RoboTvClient::getStalls() {
+    std::lock_guard<ProfiledMutex> lock(m_queueLock);
+    return m_stalls;
+}
+
+bool RoboTvClient::wantWrite() {
+    std::lock_guard<ProfiledMutex> lock(m_queueLock);
+    return !m_queue.empty() && m_compressing.find(m_queue.front()) == m_compressing.end();
+}
+
 void RoboTvClient::Recording(const cDevice* Device, const char* Name, const char* FileName, bool On) {
     // check if we should ignore this notification
     if(!m_loginController.statusEnabled()) {
@@ -150,7 +306,9 @@ void RoboTvClient::TimerChange(const cTimer* Timer, eTimerChange Change) {
 }
 
 void RoboTvClient::ChannelChange(const cChannel* Channel) {
-    if(!Running()) {
+    ChannelController::invalidateCache();
+
+    if(!m_connected) {
         return;
     }
 
@@ -171,9 +329,42 @@ void RoboTvClient::sendTimerChange() {
         return;
     }
 
+    TimerController::updateSnapshot(true);
+
+    std::vector<uint32_t> changed;
+    std::vector<uint32_t> removed;
+    uint64_t generation = 0;
+
+    bool delta = TimerController::getChanges(m_timerGeneration, changed, removed, generation);
+
+    // nothing changed for the client
+    if(delta && changed.empty() && removed.empty()) {
+        return;
+    }
+
+    m_timerGeneration = generation;
+
     INFOLOG("Sending timer change request to client #%i ...", m_id);
     MsgPacket* resp = new MsgPacket(ROBOTV_STATUS_TIMERCHANGE, ROBOTV_CHANNEL_STATUS);
 
+    resp->put_U64(generation);
+    resp->put_U8(delta ? 0 : 1);
+
+    if(!delta) {
+        resp->put_U32(0);
+    }
+    else {
+        resp->put_U32(changed.size() + removed.size());
+
+        for(auto uid : changed) {
+            resp->put_U32(uid);
+        }
+
+        for(auto uid : removed) {
+            resp->put_U32(uid);
+        }
+    }
+
     queueMessage(resp);
 }
 
@@ -191,8 +382,8 @@ void RoboTvClient::onRecording(const cEvent* event, bool on) {
 
     resp->put_U32(event ? event->Index() : -1);
     resp->put_U32(on);
-    resp->put_String(m_toUtf8.convert(event ? event->Title() : ""));
-    resp->put_String(m_toUtf8.convert(event ? event->Description() : ""));
+    resp->put_String(m_toUtf8.convertToBuffer(event ? event->Title() : ""));
+    resp->put_String(m_toUtf8.convertToBuffer(event ? event->Description() : ""));
 
     if(event != NULL) {
         TimerController::event2Packet(event, resp);
@@ -210,30 +401,261 @@ void RoboTvClient::sendStatusMessage(const char* Message) {
     queueMessage(resp);
 }
 
-bool RoboTvClient::processRequest() {
+bool RoboTvClient::processRequest(MsgPacket* request, RequestTable& table) {
+    MsgPacket* response = createResponse(request, table, m_loginController.chunkedResponsesEnabled());
+
+    if(response == NULL) {
+        return false;
+    }
+
+    // sent at the end of the current event processing pass
+    std::lock_guard<ProfiledMutex> lock(m_queueLock);
+    enqueue(response);
+    return true;
+}
+
+MsgPacket* RoboTvClient::createResponse(MsgPacket* request, RequestTable& table, bool chunked) {
+    auto start = std::chrono::steady_clock::now();
+    ROBOTV_TRACE4(request_start, m_id, request->getMsgID(), request->getUID(), request->getPayloadLength());
 
     // set protocol version for all messages
     // except login, because login defines the
     // protocol version
 
-    if(m_request->getMsgID() != ROBOTV_LOGIN) {
-        m_request->setProtocolVersion(m_loginController.protocolVersion());
+    if(request->getMsgID() != ROBOTV_LOGIN) {
+        request->setProtocolVersion(m_loginController.protocolVersion());
+    }
+
+    MsgPacket* response = new MsgPacket(request->getMsgID(), ROBOTV_CHANNEL_REQUEST_RESPONSE, request->getUID());
+    response->setProtocolVersion(m_loginController.protocolVersion());
+
+    // large lists are sent ahead in chunks while they are serialized
+    std::unique_ptr<ChunkedResponse> chunks;
+
+    if(chunked) {
+        chunks.reset(new ChunkedResponse(response, [ = ](MsgPacket * chunk) {
+            queueMessage(chunk);
+        }));
+    }
+
+    RequestTable::Result result = table.dispatch(request, response);
+
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    ROBOTV_TRACE5(request_done, m_id, request->getMsgID(), request->getUID(), response->getPayloadLength(), us);
+    m_processLatency.add(us);
+
+    if(result == RequestTable::Reply) {
+        return response;
+    }
+
+    delete response;
+    return NULL;
+}
+
+void RoboTvClient::processBatch(MsgPacket* request) {
+    std::shared_ptr<RequestBatch> batch = std::make_shared<RequestBatch>(request);
+    bool metadata = false;
+
+    for(size_t i = 0; i < batch->size(); i++) {
+        MsgPacket* p = batch->request(i);
+
+        if(isStreamRequest(p)) {
+            batch->setResponse(i, createResponse(p, m_streamRequests));
+        }
+        else {
+            metadata = true;
+        }
     }
 
-    m_response = new MsgPacket(m_request->getMsgID(), ROBOTV_CHANNEL_REQUEST_RESPONSE, m_request->getUID());
-    m_response->setProtocolVersion(m_loginController.protocolVersion());
+    auto send = [ = ]() {
+        MsgPacket* response = batch->createResponse();
+        response->setProtocolVersion(m_loginController.protocolVersion());
 
-    for(auto i : m_controllers) {
-        if(i->process(m_request, m_response)) {
-            queueMessage(m_response);
-            return true;
+        std::lock_guard<ProfiledMutex> lock(m_queueLock);
+        enqueue(response);
+    };
+
+    if(!metadata) {
+        send();
+        return;
+    }
+
+    dispatchMetadata([ = ]() {
+        for(size_t i = 0; i < batch->size(); i++) {
+            MsgPacket* p = batch->request(i);
+
+            if(!isStreamRequest(p)) {
+                batch->setResponse(i, createResponse(p, m_metadataRequests));
+            }
         }
+
+        send();
+    });
+}
+
+bool RoboTvClient::isStreamRequest(MsgPacket* request) const {
+    // login, live and recording streams
+    return m_streamRequests.has(request->getMsgID());
+}
+
+void RoboTvClient::dispatchMetadata(MsgPacket* request) {
+    std::shared_ptr<MsgPacket> p(request);
+
+    dispatchMetadata([ = ]() {
+        processRequest(p.get(), m_metadataRequests);
+    });
+}
+
+void RoboTvClient::dispatchMetadata(RequestPool::Job job) {
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+
+    m_metadataQueue.push_back(job);
+
+    if(m_metadataBusy) {
+        return;
+    }
+
+    m_metadataBusy = true;
+
+    RequestPool::instance().run([ = ]() {
+        processMetadata();
+    });
+}
+
+void RoboTvClient::processMetadata() {
+    std::unique_lock<std::mutex> lock(m_metadataLock);
+
+    while(!m_metadataQueue.empty()) {
+        RequestPool::Job job = m_metadataQueue.front();
+        m_metadataQueue.pop_front();
+
+        lock.unlock();
+
+        job();
+
+        // responses are sent by the I/O worker
+        wakeup();
+
+        lock.lock();
+    }
+
+    m_metadataBusy = false;
+    m_metadataCond.notify_all();
+}
+
+nlohmann::json RoboTvClient::getMetrics() {
+    nlohmann::json j = {
+        {"id", m_id},
+        {"requests", (uint64_t)m_requests},
+        {"bytesReceived", (uint64_t)m_bytesReceived},
+        {"bytesSent", (uint64_t)m_bytesSent},
+        {"packetsSent", (uint64_t)m_packetsSent},
+        {"receive", m_receiveLatency.toJson()},
+        {"process", m_processLatency.toJson()},
+        {"send", m_sendLatency.toJson()}
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(m_metadataLock);
+        j["metadataQueued"] = m_metadataQueue.size();
+    }
+
+    std::lock_guard<ProfiledMutex> lock(m_queueLock);
+
+    j["queuedPackets"] = m_queue.size();
+    j["queuedBytes"] = m_queuedBytes;
+    j["stalls"] = m_stalls;
+    j["stallTimeMs"] = m_stallTime;
+
+    return j;
+}
+
+int RoboTvClient::resumeSession(uint64_t token) {
+    SessionStore::Session session;
+
+    if(!SessionStore::instance().take(token, session)) {
+        return 0;
     }
 
-    return false;
+    m_streamController.resume(session.streamer);
+    m_recordingController.resume(session.player);
+
+    return (session.streamer != NULL ? 1 : 0) | (session.player != NULL ? 2 : 0);
 }
 
 void RoboTvClient::queueMessage(MsgPacket* p) {
-    std::lock_guard<std::mutex> lock(m_queueLock);
+    {
+        std::lock_guard<ProfiledMutex> lock(m_queueLock);
+
+        if(p->getType() == ROBOTV_CHANNEL_STATUS && MemoryBudget::exceeded()) {
+            trimStatusBacklog();
+        }
+
+        enqueue(p);
+    }
+
+    wakeup();
+}
+
+void RoboTvClient::trimStatusBacklog() {
+    if(m_queue.empty()) {
+        return;
+    }
+
+    // the first packet may be partially sent
+    auto i = m_queue.begin();
+    i++;
+
+    while(i != m_queue.end()) {
+        MsgPacket* p = *i;
+
+        if(p->getType() != ROBOTV_CHANNEL_STATUS || m_compressing.find(p) != m_compressing.end()) {
+            i++;
+            continue;
+        }
+
+        MemoryBudget::shed(MemoryBudget::msSendQueue, p->getPacketLength());
+        m_queuedBytes -= p->getPacketLength();
+
+        i = m_queue.erase(i);
+        delete p;
+    }
+
+    m_sendMemory.set(m_queuedBytes);
+}
+
+void RoboTvClient::enqueue(MsgPacket* p) {
+    uint32_t length = p->getPacketLength();
+    int level = m_loginController.compressionLevel();
+
+    m_queuedBytes += length;
+    m_sendMemory.set(m_queuedBytes);
     m_queue.push_back(p);
+
+    // only responses (and their chunks) are compressed, never stream packets or file data
+    if(level == 0 ||
+       (p->getType() != ROBOTV_CHANNEL_REQUEST_RESPONSE && p->getType() != ROBOTV_CHANNEL_RESPONSE_CHUNK) ||
+       p->getPayloadLength() < COMPRESSION_THRESHOLD ||
+       p->isCompressed() ||
+       p->hasFileSegments()) {
+        return;
+    }
+
+    m_compressing.insert(p);
+
+    // the destructor waits for the callback (m_queueLock must be held until done)
+    PacketCompressor::instance().compress(p, level, [ = ](MsgPacket * packet) {
+        std::lock_guard<ProfiledMutex> lock(m_queueLock);
+        m_queuedBytes += packet->getPacketLength();
+        m_queuedBytes -= length;
+        m_sendMemory.set(m_queuedBytes);
+        m_compressing.erase(packet);
+        m_compressCond.notify_all();
+        wakeup();
+    });
+}
+
+void RoboTvClient::wakeup() {
+    std::lock_guard<std::mutex> lock(m_wakeupLock);
+    IoReactor::wakeup(m_wakeupFd);
 }
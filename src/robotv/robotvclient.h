@@ -29,7 +29,10 @@
 #include <string>
 #include <deque>
 #include <map>
+#include <set>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
 
 #include <vdr/tools.h>
 #include <vdr/receiver.h>
@@ -38,6 +41,11 @@
 #include "demuxer/streaminfo.h"
 #include "net/msgpacket.h"
 #include "recordings/artwork.h"
+#include "net/ioreactor.h"
+#include "net/bandwidthshaper.h"
+#include "tools/memorybudget.h"
+#include "tools/metrics.h"
+#include "requestpool.h"
 
 #include "controllers/streamcontroller.h"
 #include "controllers/recordingcontroller.h"
@@ -47,29 +55,72 @@
 #include "controllers/logincontroller.h"
 #include "controllers/epgcontroller.h"
 #include "controllers/artworkcontroller.h"
+#include "tools/lockprofiler.h"
 
 class cChannel;
 class cDevice;
 class PacketPlayer;
 
-class RoboTvClient : public cThread, public cStatus {
+class RoboTvClient : public IoReactor::Handler, public cStatus {
 private:
 
     unsigned int m_id;
 
     int m_socket;
 
-    MsgPacket* m_request = NULL;
+    IoReactor* m_reactor;
 
-    MsgPacket* m_response = NULL;
+    // wakeup filedescriptor of the connection (closed by IoReactor::remove)
+    int m_wakeupFd;
+
+    // keeps wakeup() from writing to the filedescriptor while it's closed
+    std::mutex m_wakeupLock;
+
+    std::atomic<bool> m_connected;
 
     Utf8Conv m_toUtf8;
 
     int m_timeout = 3000;
 
+    // timer generation of the last timer change notification
+    uint64_t m_timerGeneration = 0;
+
     std::deque<MsgPacket*> m_queue;
 
-    std::mutex m_queueLock;
+    ProfiledMutex m_queueLock{"client.queue"};
+
+    uint64_t m_queuedBytes = 0;
+
+    MemoryAccount m_sendMemory{MemoryBudget::msSendQueue};
+
+    BandwidthShaper m_bandwidth;
+
+    int64_t m_stallStart = 0;
+
+    uint64_t m_stallTime = 0;
+
+    uint64_t m_stalls = 0;
+
+    // queued packets waiting for compression
+    std::set<MsgPacket*> m_compressing;
+
+    std::condition_variable m_compressCond;
+
+    // Metrics
+
+    LatencyHistogram m_receiveLatency;
+
+    LatencyHistogram m_processLatency;
+
+    LatencyHistogram m_sendLatency;
+
+    std::atomic<uint64_t> m_requests;
+
+    std::atomic<uint64_t> m_bytesReceived;
+
+    std::atomic<uint64_t> m_bytesSent;
+
+    std::atomic<uint64_t> m_packetsSent;
 
     // Controllers
 
@@ -89,13 +140,69 @@ private:
 
     ArtworkController m_artworkController;
 
-    std::list<Controller*> m_controllers;
+    // stream lane (processed inline on the I/O worker)
+    RequestTable m_streamRequests;
+
+    // metadata lane (processed in order on the request pool)
+    RequestTable m_metadataRequests;
+
+    std::deque<RequestPool::Job> m_metadataQueue;
+
+    std::mutex m_metadataLock;
+
+    std::condition_variable m_metadataCond;
+
+    bool m_metadataBusy = false;
 
 protected:
 
-    bool processRequest();
+    /** Process a request and queue the response.
+     @param request the request
+     @param table opcode table of the request's lane
+     */
+    bool processRequest(MsgPacket* request, RequestTable& table);
+
+    /** Process a request.
+     @param chunked send large responses ahead in chunks (see ChunkedResponse)
+     @return the response, NULL if the request wasn't handled
+     */
+    MsgPacket* createResponse(MsgPacket* request, RequestTable& table, bool chunked = false);
+
+    /** Process a ROBOTV_BATCH envelope.
+     Stream requests of the batch (login, config) are processed first on
+     the I/O worker, the remaining requests in order on the metadata lane.
+     All responses are sent back in one envelope.
+     */
+    void processBatch(MsgPacket* request);
 
-    virtual void Action(void);
+    /** Queue a metadata request.
+     Metadata requests are processed one after another on the request pool,
+     the responses are matched by the client with the request UID.
+     */
+    void dispatchMetadata(MsgPacket* request);
+
+    void dispatchMetadata(RequestPool::Job job);
+
+    void processMetadata();
+
+    bool isStreamRequest(MsgPacket* request) const;
+
+    void sendQueue();
+
+    /** Drop queued status messages (the memory budget is exceeded).
+     Must be called with m_queueLock held.
+     */
+    void trimStatusBacklog();
+
+    /** Add a packet to the send queue.
+     Large responses are compressed in the background if the client
+     negotiated compression. The send queue stalls at packets that are
+     still being compressed, so the order of messages is kept.
+     Must be called with m_queueLock held.
+     */
+    void enqueue(MsgPacket* p);
+
+    nlohmann::json getMetrics();
 
     virtual void Recording(const cDevice* Device, const char* Name, const char* FileName, bool On);
     virtual void TimerChange(const cTimer* Timer, eTimerChange Change);
@@ -103,10 +210,20 @@ protected:
 
 public:
 
-    RoboTvClient(int fd, unsigned int id);
+    RoboTvClient(int fd, unsigned int id, IoReactor* reactor);
 
     virtual ~RoboTvClient();
 
+    // IoReactor::Handler implementation
+
+    bool processEvents();
+
+    bool wantWrite();
+
+    bool isConnected() const {
+        return m_connected;
+    }
+
     void onRecording(const cEvent* event, bool on);
 
     void sendMoviesChange();
@@ -115,8 +232,44 @@ public:
 
     void queueMessage(MsgPacket* p);
 
+    /** Free space in the send window.
+     @return true if less than the send window is queued for the client
+     */
+    bool sendWindowAvailable();
+
+    /** Total time (in ms) queued messages waited for the socket */
+    uint64_t getStallTime();
+
+    /** Number of times a message had to wait for the socket */
+    uint64_t getStalls();
+
+    void wakeup();
+
+    /** Rate limits of the stream data sent to the client */
+    BandwidthShaper& bandwidth() {
+        return m_bandwidth;
+    }
+
+    bool pushStreamingEnabled() const {
+        return m_loginController.pushStreamingEnabled();
+    }
+
+    int compressionLevel() const {
+        return m_loginController.compressionLevel();
+    }
+
+    bool redirectEnabled() const {
+        return m_loginController.redirectEnabled();
+    }
+
     void sendStatusMessage(const char* Message);
 
+    /** Continue the parked streams of a previous connection.
+     @param token session token of the previous connection
+     @return resumed streams (1 = live, 2 = recording, 0 = none)
+     */
+    int resumeSession(uint64_t token);
+
     unsigned int getId() const {
         return m_id;
     }
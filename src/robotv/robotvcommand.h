@@ -26,7 +26,10 @@
 #define ROBOTV_COMMAND_H
 
 /** Current RoboTV Protocol Version number */
-#define ROBOTV_PROTOCOLVERSION          7
+#define ROBOTV_PROTOCOLVERSION          8
+
+/** First protocol version with compact (delta encoded) stream packets */
+#define ROBOTV_PROTOCOLVERSION_COMPACT  8
 
 
 /** Packet types */
@@ -34,6 +37,7 @@
 #define ROBOTV_CHANNEL_STREAM           2
 #define ROBOTV_CHANNEL_STATUS           5
 #define ROBOTV_CHANNEL_SCAN             6
+#define ROBOTV_CHANNEL_RESPONSE_CHUNK   7
 
 
 /** Response packets operation codes */
@@ -45,6 +49,7 @@
 #define ROBOTV_PING                  7
 #define ROBOTV_GETCONFIG             8
 #define ROBOTV_CHANNELFILTER         9
+#define ROBOTV_BATCH                 10 // envelope of several requests
 
 /* OPCODE 20 - 39: RoboTV network functions for live streaming */
 #define ROBOTV_CHANNELSTREAM_OPEN    20
@@ -53,6 +58,14 @@
 #define ROBOTV_CHANNELSTREAM_PAUSE   23
 #define ROBOTV_CHANNELSTREAM_SIGNAL  24
 #define ROBOTV_CHANNELSTREAM_SEEK    25
+#define ROBOTV_CHANNELSTREAM_CREDIT  26
+#define ROBOTV_CHANNELSTREAM_SELECT  27
+#define ROBOTV_CHANNELSTREAM_RECORD  28
+
+/* ROBOTV_CHANNELSTREAM_RECORD - instant recording from the timeshift of the streamed channel
+ * request: U8 start (1) / stop (0), optional S64 wallclock time (ms) of the first frame (0 - latest keyframe)
+ * response: U32 return code, String file name of the recording (start only)
+ */
 
 /* OPCODE 40 - 59: RoboTV network functions for recording streaming */
 #define ROBOTV_RECSTREAM_OPEN        40
@@ -75,6 +88,14 @@
 #define ROBOTV_TIMER_ADD             83
 #define ROBOTV_TIMER_DELETE          84
 #define ROBOTV_TIMER_UPDATE          85
+#define ROBOTV_TIMER_GETCHANGES      86
+
+/* ROBOTV_TIMER_GETCHANGES - timers changed since a generation
+ * request: U64 generation (0 - all timers)
+ * response: U32 return code, U64 current generation, U8 full list (1) / delta (0),
+ * U32 count + U32 uid of every removed timer,
+ * U32 count + U32 uid and timer of every added / modified timer
+ */
 
 /* OPCODE 100 - 119: RoboTV network functions for recording access */
 #define ROBOTV_RECORDINGS_DISKSIZE     100
@@ -88,6 +109,8 @@
 #define ROBOTV_RECORDINGS_GETMARKS     108
 #define ROBOTV_RECORDINGS_SETURLS      109
 #define ROBOTV_RECORDINGS_SEARCH       112
+#define ROBOTV_RECORDINGS_GETCHANGES   113
+#define ROBOTV_RECORDINGS_GETFOLDER    114
 
 #define ROBOTV_ARTWORK_SET             110
 #define ROBOTV_ARTWORK_GET             111
@@ -95,6 +118,7 @@
 /* OPCODE 120 - 139: RoboTV network functions for epg access and manipulating */
 #define ROBOTV_EPG_GETFORCHANNEL     120
 #define ROBOTV_EPG_SEARCH             121
+#define ROBOTV_EPG_GETFORCHANNELS    122
 
 /* OPCODE 140 - 159: RoboTV network functions for channel scanning */
 #define ROBOTV_SCAN_SUPPORTED        140
@@ -112,6 +136,18 @@
 #define ROBOTV_STREAM_SIGNALINFO   5
 #define ROBOTV_STREAM_DETACH       7
 #define ROBOTV_STREAM_POSITIONS    8
+#define ROBOTV_STREAM_PUSHPKT      9
+#define ROBOTV_STREAM_TSPKT        10
+#define ROBOTV_STREAM_DELTAPKT     11
+#define ROBOTV_STREAM_MUXBATCH     12 // internal: coalesced audio frames (sent as single frames)
+#define ROBOTV_STREAM_LAYOUT       13 // internal: stream change in the timeshift store (sent as ROBOTV_STREAM_CHANGE)
+
+/* ROBOTV_STREAM_DELTAPKT - compact mux packet (protocol version 8+)
+ * U8 stream index (bit 7 set: U16 pid follows, first packet of the stream)
+ * varint pts delta (to the previous packet of the stream), varint dts - pts,
+ * varint duration, varint wallclock time delta, varint size, data
+ * Deltas start at 0 within every stream packet (aggregate).
+ */
 
 /** Stream status codes */
 #define ROBOTV_STREAM_STATUS_SIGNALLOST     111
@@ -126,9 +162,16 @@
 #define ROBOTV_STATUS_CHANNELSCAN      6
 #define ROBOTV_STATUS_CHANNELCHANGED   7
 
+/* ROBOTV_STATUS_TIMERCHANGE payload
+ * U64 generation, U8 full (1, the changes are unknown) / delta (0),
+ * U32 count + U32 uid of every added / modified / removed timer
+ * (since the previous notification)
+ */
+
 /** Packet return codes */
 #define ROBOTV_RET_OK              0
 #define ROBOTV_RET_RECRUNNING      1
+#define ROBOTV_RET_REDIRECT        2
 #define ROBOTV_RET_ENCRYPTED       994
 #define ROBOTV_RET_NOTSUPPORTED    995
 #define ROBOTV_RET_DATAUNKNOWN     996
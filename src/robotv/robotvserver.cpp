@@ -43,12 +43,36 @@
 #include "robotvclient.h"
 #include "robotvchannels.h"
 #include "live/channelcache.h"
+#include "live/channelprober.h"
+#include "live/liverecorder.h"
+#include "live/peerregistry.h"
+#include "recordings/recordingfragments.h"
 #include "recordings/recordingscache.h"
 #include "recordings/artwork.h"
 #include "net/os-config.h"
+#include "net/packetpool.h"
+#include "demuxer/parser.h"
+#include "db/storage.h"
+#include "sessionstore.h"
+#include "startup.h"
 
 //#define ENABLE_CHANNELTRIGGER 1
 
+// interval for merging the segments of the epg search index
+#define EPG_MERGE_INTERVAL_MS (10 * 60 * 1000)
+
+// interval for database maintenance (checkpoints, statistics)
+#define DATABASE_MAINTENANCE_INTERVAL_MS (60 * 1000)
+
+// interval for destroying expired sessions of disconnected clients
+#define SESSION_EXPIRE_INTERVAL_MS 1000
+
+// interval for checking the channel prober
+#define CHANNEL_PROBE_INTERVAL_MS 2000
+
+// interval for announcing the server to the peers of the cluster
+#define CLUSTER_ANNOUNCE_INTERVAL_MS 2000
+
 unsigned int RoboTVServer::m_idCnt = 0;
 
 class cAllowedHosts : public cSVDRPhosts {
@@ -69,7 +93,7 @@ public:
     }
 };
 
-RoboTVServer::RoboTVServer(int listenPort) : cThread("roboTV VDR Server"), m_config(RoboTVServerConfig::instance()) {
+RoboTVServer::RoboTVServer(int listenPort) : cThread("roboTV VDR Server"), m_config(RoboTVServerConfig::instance()), m_scheduler("roboTV") {
     m_ipv4Fallback = false;
     m_serverPort  = listenPort;
 
@@ -139,11 +163,18 @@ RoboTVServer::RoboTVServer(int listenPort) : cThread("roboTV VDR Server"), m_con
 
 RoboTVServer::~RoboTVServer() {
     Cancel(5);
+    m_scheduler.stop();
+    Startup::instance().join();
 
     for(ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++) {
         delete(*i);
     }
 
+    SessionStore::instance().clear();
+    LiveRecorder::stopAll();
+    ChannelProber::instance().stop();
+    PeerRegistry::instance().stop();
+
     INFOLOG("roboTV Server stopped");
 }
 
@@ -209,33 +240,159 @@ void RoboTVServer::clientConnected(int fd) {
         INFOLOG("Client %s:%i with ID %d connected.", inet_ntoa(((struct sockaddr_in*)&sin)->sin_addr), ((struct sockaddr_in*)&sin)->sin_port, m_idCnt);
     }
 
-    RoboTvClient* connection = new RoboTvClient(fd, m_idCnt);
+    RoboTvClient* connection = new RoboTvClient(fd, m_idCnt, &m_reactor);
+
+    std::lock_guard<std::mutex> lock(m_clientsMutex);
     m_clients.push_back(connection);
     m_idCnt++;
 }
 
+void RoboTVServer::maintainClients() {
+    std::lock_guard<std::mutex> lock(m_clientsMutex);
+
+    // remove disconnected clients
+    for(ClientList::iterator i = m_clients.begin(); i != m_clients.end();) {
+
+        if(!(*i)->isConnected()) {
+            INFOLOG("Client with ID %u seems to be disconnected, removing from client list", (*i)->getId());
+            delete(*i);
+            i = m_clients.erase(i);
+        }
+        else {
+            i++;
+        }
+    }
+
+    // reset inactivity timeout as long as there are clients connected
+    if(m_clients.size() > 0) {
+        ShutdownHandler.SetUserInactiveTimeout();
+    }
+}
+
+void RoboTVServer::announceCluster() {
+    {
+        std::lock_guard<std::mutex> lock(m_clientsMutex);
+        PeerRegistry::instance().setClientCount(m_clients.size());
+    }
+
+    PeerRegistry::instance().update();
+}
+
+void RoboTVServer::checkRecordings() {
+    // check for recording changes
+    Recordings.StateChanged(m_recState);
+
+    if(m_recState != m_recStateOld) {
+        m_recordingReloadTrigger = true;
+        m_recordingReloadTimer.Set(2000);
+        INFOLOG("Recordings state changed (%i)", m_recState);
+        m_recStateOld = m_recState;
+    }
+
+    // update recordings
+    if(!m_recordingReloadTrigger || !m_recordingReloadTimer.TimedOut()) {
+        return;
+    }
+
+    // start gc
+    INFOLOG("Starting garbage collection in recordings cache");
+    RecordingsCache::instance().triggerGc();
+
+    RecordingFragments::instance().rebuild();
+
+    // request clients to reload recordings
+    std::lock_guard<std::mutex> lock(m_clientsMutex);
+
+    if(!m_clients.empty()) {
+        INFOLOG("Requesting clients to reload recordings list");
+
+        for(ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++) {
+            (*i)->sendMoviesChange();
+        }
+    }
+
+    m_recordingReloadTrigger = false;
+}
+
+void RoboTVServer::cleanup() {
+    INFOLOG("removing outdated artwork");
+    m_artwork.triggerCleanup();
+    m_epgHandler.triggerCleanup();
+    PacketPool::logStatistics();
+    Parser::logStatistics();
+}
+
 void RoboTVServer::Action(void) {
     fd_set fds;
     struct timeval tv;
-    cTimeMs recordingReloadTimer;
 
-    bool recordingReloadTrigger = false;
-
-    // artwork
-    Artwork artwork;
-    cTimeMs artworkCleanupTimer;
+    Startup& startup = Startup::instance();
+    startup.begin("server");
 
     INFOLOG("removing outdated artwork");
-    artwork.triggerCleanup();
+    m_artwork.triggerCleanup();
 
     // get initial state of the recordings
-    int recState = -1;
-    int recStateOld = -1;
+    Recordings.StateChanged(m_recState);
+    m_recStateOld = m_recState;
+
+    // schema checks and cache warm-ups run in the background,
+    // clients are accepted right away
+    startup.run("channels", []() {
+        RoboTVChannels::instance();
+    });
+
+    startup.run("channelcache", []() {
+        ChannelCache::instance();
+    });
+
+    startup.run("recordings", []() {
+        RecordingsCache::instance();
+        RecordingFragments::instance().rebuild();
+    });
+
+    // periodic tasks run on the scheduler thread, the loop below only accepts connections
+    uint32_t maintenanceInterval = m_config.maintenanceInterval;
+    uint32_t cleanupInterval = m_config.cleanupInterval * 60 * 60 * 1000;
+
+    m_scheduler.add("clients", maintenanceInterval, [ = ]() {
+        maintainClients();
+    });
+
+    m_scheduler.add("recordings", maintenanceInterval, [ = ]() {
+        checkRecordings();
+    });
+
+    m_scheduler.add("cleanup", cleanupInterval, [ = ]() {
+        cleanup();
+    });
+
+    m_scheduler.add("epgmerge", EPG_MERGE_INTERVAL_MS, [ = ]() {
+        m_epgHandler.mergeSegments();
+    });
+
+    m_scheduler.add("database", DATABASE_MAINTENANCE_INTERVAL_MS, [ = ]() {
+        roboTV::Storage::getInstance().maintenance();
+    });
+
+    m_scheduler.add("sessions", SESSION_EXPIRE_INTERVAL_MS, [ = ]() {
+        SessionStore::instance().expire();
+    });
+
+    if(m_config.channelProbe) {
+        m_scheduler.add("prober", CHANNEL_PROBE_INTERVAL_MS, [ = ]() {
+            ChannelProber::instance().probe();
+        });
+    }
 
-    RecordingsCache& cache = RecordingsCache::instance();
-    Recordings.StateChanged(recState);
+    if(m_config.clusterPort != 0 && PeerRegistry::instance().start(m_config.clusterPort, m_config.clusterPeers)) {
+        m_scheduler.add("cluster", CLUSTER_ANNOUNCE_INTERVAL_MS, [ = ]() {
+            announceCluster();
+        });
+    }
 
-    recStateOld = recState;
+    m_scheduler.start();
+    startup.end("server");
 
     while(Running()) {
         FD_ZERO(&fds);
@@ -251,64 +408,8 @@ void RoboTVServer::Action(void) {
             continue;
         }
 
+        // no connect request -> continue waiting
         if(r == 0) {
-            // remove disconnected clients
-            for(ClientList::iterator i = m_clients.begin(); i != m_clients.end();) {
-
-                if(!(*i)->Active()) {
-                    INFOLOG("Client with ID %u seems to be disconnected, removing from client list", (*i)->getId());
-                    delete(*i);
-                    i = m_clients.erase(i);
-                }
-                else {
-                    i++;
-                }
-            }
-
-            // artwork cleanup (every 12 hours)
-            if(artworkCleanupTimer.Elapsed() >= 12 * 60 * 60 * 1000) {
-                INFOLOG("removing outdated artwork");
-                artwork.triggerCleanup();
-                m_epgHandler.triggerCleanup();
-
-                artworkCleanupTimer.Set(0);
-            }
-
-            // reset inactivity timeout as long as there are clients connected
-            if(m_clients.size() > 0) {
-                ShutdownHandler.SetUserInactiveTimeout();
-            }
-
-            // check for recording changes
-            Recordings.StateChanged(recState);
-
-            if(recState != recStateOld) {
-                recordingReloadTrigger = true;
-                recordingReloadTimer.Set(2000);
-                INFOLOG("Recordings state changed (%i)", recState);
-                recStateOld = recState;
-            }
-
-            // update recordings
-            if((recordingReloadTrigger && recordingReloadTimer.TimedOut())) {
-
-                // start gc
-                INFOLOG("Starting garbage collection in recordings cache");
-                cache.gc();
-
-                // request clients to reload recordings
-                if(!m_clients.empty()) {
-                    INFOLOG("Requesting clients to reload recordings list");
-
-                    for(ClientList::iterator i = m_clients.begin(); i != m_clients.end(); i++) {
-                        (*i)->sendMoviesChange();
-                    }
-                }
-
-                recordingReloadTrigger = false;
-            }
-
-            // no connect request -> continue waiting
             continue;
         }
 
@@ -322,5 +423,6 @@ void RoboTVServer::Action(void) {
         }
     }
 
+    m_scheduler.stop();
     return;
 }
@@ -26,10 +26,14 @@
 #define ROBOTV_SERVER_H
 
 #include <list>
+#include <mutex>
 #include <vdr/thread.h>
 #include <epg/epghandler.h>
 
 #include "config/config.h"
+#include "net/ioreactor.h"
+#include "recordings/artwork.h"
+#include "tools/scheduler.h"
 
 class RoboTvClient;
 
@@ -42,6 +46,15 @@ protected:
 
     void clientConnected(int fd);
 
+    void maintainClients();
+
+    void checkRecordings();
+
+    /** Announce the server to the peers of the cluster */
+    void announceCluster();
+
+    void cleanup();
+
     int m_serverPort;
 
     int m_serverFd;
@@ -52,10 +65,26 @@ protected:
 
     ClientList m_clients;
 
+    std::mutex m_clientsMutex;
+
+    IoReactor m_reactor;
+
     RoboTVServerConfig& m_config;
 
     EpgHandler m_epgHandler;
 
+    Artwork m_artwork;
+
+    Scheduler m_scheduler;
+
+    int m_recState = -1;
+
+    int m_recStateOld = -1;
+
+    bool m_recordingReloadTrigger = false;
+
+    cTimeMs m_recordingReloadTimer;
+
     static unsigned int m_idCnt;
 
 public:
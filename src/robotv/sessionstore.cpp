@@ -0,0 +1,163 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <vector>
+
+#include "sessionstore.h"
+#include "config/config.h"
+#include "live/livestreamer.h"
+#include "recordings/packetplayer.h"
+
+SessionStore::SessionStore() : m_random(std::random_device()()) {
+    Metrics::instance().add(this, "sessions", [ = ]() {
+        return getMetrics();
+    });
+}
+
+SessionStore::~SessionStore() {
+    Metrics::instance().remove(this);
+    clear();
+}
+
+SessionStore& SessionStore::instance() {
+    static SessionStore store;
+    return store;
+}
+
+uint64_t SessionStore::createToken() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t token = 0;
+
+    while(token == 0 || m_sessions.find(token) != m_sessions.end()) {
+        token = m_random();
+    }
+
+    return token;
+}
+
+void SessionStore::park(uint64_t token, const Session& session) {
+    Session s = session;
+    int gracePeriod = RoboTVServerConfig::instance().sessionGracePeriod;
+
+    if(s.streamer == NULL && s.player == NULL) {
+        return;
+    }
+
+    if(gracePeriod <= 0) {
+        destroy(s);
+        return;
+    }
+
+    Session previous;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto i = m_sessions.find(token);
+
+        if(i != m_sessions.end()) {
+            previous = i->second.session;
+        }
+
+        m_sessions[token] = { s, std::chrono::steady_clock::now() + std::chrono::seconds(gracePeriod) };
+        m_parked++;
+    }
+
+    destroy(previous);
+    INFOLOG("session %016llx parked for %i seconds", (unsigned long long)token, gracePeriod);
+}
+
+bool SessionStore::take(uint64_t token, Session& session) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto i = m_sessions.find(token);
+
+    if(i == m_sessions.end()) {
+        return false;
+    }
+
+    session = i->second.session;
+    m_sessions.erase(i);
+    m_resumed++;
+
+    INFOLOG("session %016llx resumed", (unsigned long long)token);
+    return true;
+}
+
+void SessionStore::expire() {
+    std::vector<Session> expired;
+    auto now = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for(auto i = m_sessions.begin(); i != m_sessions.end();) {
+            if(i->second.expires > now) {
+                i++;
+                continue;
+            }
+
+            INFOLOG("session %016llx expired", (unsigned long long)i->first);
+            expired.push_back(i->second.session);
+            i = m_sessions.erase(i);
+            m_expired++;
+        }
+    }
+
+    for(auto& session : expired) {
+        destroy(session);
+    }
+}
+
+void SessionStore::clear() {
+    std::map<uint64_t, Entry> sessions;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        sessions.swap(m_sessions);
+    }
+
+    for(auto& i : sessions) {
+        destroy(i.second.session);
+    }
+}
+
+void SessionStore::destroy(Session& session) {
+    LiveStreamer::destroy(session.streamer);
+    delete session.player;
+
+    session.streamer = NULL;
+    session.player = NULL;
+}
+
+nlohmann::json SessionStore::getMetrics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return {
+        {"sessions", m_sessions.size()},
+        {"parked", m_parked},
+        {"resumed", m_resumed},
+        {"expired", m_expired}
+    };
+}
@@ -0,0 +1,107 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_SESSIONSTORE_H
+#define ROBOTV_SESSIONSTORE_H
+
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+
+#include "tools/metrics.h"
+
+class LiveStreamer;
+class PacketPlayer;
+
+/**
+ * Parked streaming sessions of disconnected clients.
+ * Clients requesting a session token at login get their live streamer
+ * (with the timeshift and the read position) and recording player
+ * parked when the connection drops. Logging in again with the token
+ * within the grace period (SessionGracePeriod in robotv.conf) resumes
+ * the streams, expired sessions are destroyed.
+ */
+class SessionStore {
+public:
+
+    struct Session {
+        LiveStreamer* streamer = NULL;
+        PacketPlayer* player = NULL;
+    };
+
+    static SessionStore& instance();
+
+    /** Create a new (unique) session token */
+    uint64_t createToken();
+
+    /** Park the streams of a disconnected client.
+     The store takes the ownership of the streamer and the player.
+     */
+    void park(uint64_t token, const Session& session);
+
+    /** Take the parked streams of a session.
+     @return true if the session has been found
+     */
+    bool take(uint64_t token, Session& session);
+
+    /** Destroy sessions exceeding the grace period */
+    void expire();
+
+    /** Destroy all parked sessions */
+    void clear();
+
+protected:
+
+    SessionStore();
+
+    virtual ~SessionStore();
+
+    static void destroy(Session& session);
+
+    nlohmann::json getMetrics();
+
+private:
+
+    struct Entry {
+        Session session;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    std::map<uint64_t, Entry> m_sessions;
+
+    std::mutex m_mutex;
+
+    std::mt19937_64 m_random;
+
+    uint64_t m_parked = 0;
+
+    uint64_t m_resumed = 0;
+
+    uint64_t m_expired = 0;
+
+};
+
+#endif // ROBOTV_SESSIONSTORE_H
@@ -0,0 +1,118 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "startup.h"
+#include "config/config.h"
+
+Startup::Startup() : m_started(std::chrono::steady_clock::now()) {
+    Metrics::instance().add(this, "startup", [ = ]() {
+        return getMetrics();
+    });
+}
+
+Startup::~Startup() {
+    Metrics::instance().remove(this);
+    join();
+}
+
+Startup& Startup::instance() {
+    static Startup startup;
+    return startup;
+}
+
+void Startup::run(const std::string& name, Task task) {
+    begin(name);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_threads.push_back(std::thread([ = ]() {
+        task();
+        end(name);
+    }));
+}
+
+void Startup::begin(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_tasks[name].started = std::chrono::steady_clock::now();
+    m_pending++;
+}
+
+void Startup::end(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = std::chrono::steady_clock::now();
+    Entry& entry = m_tasks[name];
+
+    entry.durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - entry.started).count();
+
+    // report once (late tasks are exported in the metrics only)
+    if(--m_pending > 0 || m_totalMs >= 0) {
+        return;
+    }
+
+    m_totalMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - m_started).count();
+    report();
+}
+
+void Startup::join() {
+    std::vector<std::thread> threads;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        threads.swap(m_threads);
+    }
+
+    for(auto& t : threads) {
+        t.join();
+    }
+}
+
+void Startup::report() {
+    std::string tasks;
+
+    for(auto& i : m_tasks) {
+        if(!tasks.empty()) {
+            tasks += ", ";
+        }
+
+        tasks += i.first + " " + std::to_string(i.second.durationMs) + " ms";
+    }
+
+    INFOLOG("start-up finished after %lli ms (%s)", (long long)m_totalMs, tasks.c_str());
+}
+
+nlohmann::json Startup::getMetrics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    nlohmann::json tasks = nlohmann::json::object();
+
+    for(auto& i : m_tasks) {
+        tasks[i.first] = i.second.durationMs;
+    }
+
+    return {
+        {"totalMs", m_totalMs},
+        {"pending", m_pending},
+        {"tasks", tasks}
+    };
+}
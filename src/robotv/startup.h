@@ -0,0 +1,96 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_STARTUP_H
+#define ROBOTV_STARTUP_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tools/metrics.h"
+
+/**
+ * Plugin start-up phase.
+ * Schema checks and cache warm-ups run concurrently in the background
+ * while the server already accepts clients. Requests only wait for the
+ * caches they use (the caches are function-local singletons).
+ * The duration of every task is logged when the last one has finished
+ * and exported in the "startup" metrics group.
+ */
+class Startup {
+public:
+
+    typedef std::function<void()> Task;
+
+    static Startup& instance();
+
+    /** Run a task on its own thread */
+    void run(const std::string& name, Task task);
+
+    /** Mark a task (running elsewhere) as started */
+    void begin(const std::string& name);
+
+    /** Mark a task as finished */
+    void end(const std::string& name);
+
+    /** Wait for the tasks started with run() */
+    void join();
+
+protected:
+
+    Startup();
+
+    virtual ~Startup();
+
+    nlohmann::json getMetrics();
+
+private:
+
+    void report();
+
+    struct Entry {
+        std::chrono::steady_clock::time_point started;
+        int64_t durationMs = -1;
+    };
+
+    std::chrono::steady_clock::time_point m_started;
+
+    std::map<std::string, Entry> m_tasks;
+
+    std::vector<std::thread> m_threads;
+
+    int m_pending = 0;
+
+    int64_t m_totalMs = -1;
+
+    std::mutex m_mutex;
+
+};
+
+#endif // ROBOTV_STARTUP_H
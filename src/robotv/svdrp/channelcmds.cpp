@@ -28,8 +28,6 @@
 #include "tools/hash.h"
 #include "live/channelcache.h"
 
-using json = nlohmann::json;
-
 ChannelCmds::ChannelCmds() {
 }
 
@@ -57,81 +55,94 @@ cString ChannelCmds::processListChannelsJson(const char* Option, int& ReplyCode)
         return NULL;
     }
 
+    // take a snapshot and release the channels lock as soon as possible
     cChannels* channels = c.get();
-    json list = json::array();
+    std::vector<ChannelSnapshot> snapshot;
     std::string groupName;
 
+    snapshot.reserve(channels->Count());
+
     for(cChannel* channel = channels->First(); channel; channel = channels->Next(channel)) {
         if(channel->GroupSep()) {
-            groupName = m_toUtf8.convert(channel->Name());
+            groupName = channel->Name();
             continue;
         }
 
-        list.push_back(jsonFromChannel(channel, groupName.c_str(), channelCache.isEnabled(channel)));
+        snapshot.push_back({*channel, groupName});
     }
 
     c.Unlock();
 
-    return cString(list.dump().c_str());
-}
-
-json ChannelCmds::jsonFromChannel(const cChannel* channel, const char* groupName, bool enabled) {
-    json j = {
-        {"number", channel->Number()},
-        {"name", m_toUtf8.convert(channel->Name())},
-        {"shortName", m_toUtf8.convert(channel->ShortName())},
-        {"uid", createChannelUid(channel)},
-        {"logoUrl", ChannelController::createLogoUrl(channel, RoboTVServerConfig::instance().piconsUrl).c_str()},
-        {"serviceRef", ChannelController::createServiceReference(channel).c_str()},
-        {"provider", channel->Provider()},
-        {"group", groupName != NULL ? groupName : ""},
-        {"enabled", enabled}
-    };
+    // stream the channels into the reply
+    std::string buffer;
+    JsonWriter writer(buffer);
 
-    // caids
-    json caids = json::array();
-    int i = 0;
+    buffer.reserve(snapshot.size() * 512);
+    writer.beginArray();
 
-    while(channel->Ca(i) != 0) {
-        caids.push_back(channel->Ca(i++));
+    for(auto& i : snapshot) {
+        writeChannel(writer, &i.channel, m_toUtf8.convert(i.group.c_str()), channelCache.isEnabled(&i.channel));
     }
 
-    j["caids"] = caids;
+    writer.endArray();
 
-    // pids
-    json pids;
+    return cString(buffer.c_str());
+}
 
-    json video;
+void ChannelCmds::writeChannel(JsonWriter& writer, const cChannel* channel, const std::string& groupName, bool enabled) {
+    writer.beginObject();
 
-    video["pid"] = channel->Vpid();
-    video["type"] = channel->Vtype();
-    pids["video"] = video;
+    writer.member("number", channel->Number());
+    writer.member("name", m_toUtf8.convert(channel->Name()));
+    writer.member("shortName", m_toUtf8.convert(channel->ShortName()));
+    writer.member("uid", createChannelUid(channel));
+    writer.member("logoUrl", ChannelController::createLogoUrl(channel, RoboTVServerConfig::instance().piconsUrl));
+    writer.member("serviceRef", ChannelController::createServiceReference(channel));
+    writer.member("provider", channel->Provider());
+    writer.member("group", groupName);
+    writer.member("enabled", enabled);
 
-    json audio;
-    i = 0;
+    // caids
+    writer.key("caids");
+    writer.beginArray();
 
-    while(channel->Apid(i) != 0) {
-        audio.push_back(json({
-            {"pid", channel->Apid(i)},
-            {"type", channel->Atype(i)},
-            {"lang", channel->Alang(i)}
-        }));
-        i++;
+    for(int i = 0; channel->Ca(i) != 0; i++) {
+        writer.value(channel->Ca(i));
     }
 
-    i = 0;
+    writer.endArray();
+
+    // pids
+    writer.key("pids");
+    writer.beginObject();
+
+    writer.key("video");
+    writer.beginObject();
+    writer.member("pid", channel->Vpid());
+    writer.member("type", channel->Vtype());
+    writer.endObject();
+
+    writer.key("audio");
+    writer.beginArray();
+
+    for(int i = 0; channel->Apid(i) != 0; i++) {
+        writer.beginObject();
+        writer.member("pid", channel->Apid(i));
+        writer.member("type", channel->Atype(i));
+        writer.member("lang", channel->Alang(i));
+        writer.endObject();
+    }
 
-    while(channel->Dpid(i) != 0) {
-        audio.push_back(json({
-            {"pid", channel->Dpid(i)},
-            {"type", channel->Dtype(i)},
-            {"lang", channel->Dlang(i)}
-        }));
-        i++;
+    for(int i = 0; channel->Dpid(i) != 0; i++) {
+        writer.beginObject();
+        writer.member("pid", channel->Dpid(i));
+        writer.member("type", channel->Dtype(i));
+        writer.member("lang", channel->Dlang(i));
+        writer.endObject();
     }
 
-    pids["audio"] = audio;
-    j["pids"] = pids;
+    writer.endArray();
+    writer.endObject();
 
-    return j;
+    writer.endObject();
 }
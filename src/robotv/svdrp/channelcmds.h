@@ -26,7 +26,9 @@
 #define ROBOTV_CHANNELCMDS_H
 
 #include <tools/utf8conv.h>
-#include "tools/json.hpp"
+#include <string>
+#include <vector>
+#include "tools/jsonwriter.h"
 #include "vdr/channels.h"
 #include "vdr/tools.h"
 
@@ -43,7 +45,13 @@ private:
 
     cString processListChannelsJson(const char* Option, int& ReplyCode);
 
-    nlohmann::json jsonFromChannel(const cChannel* channel, const char* groupName = NULL, bool enabled = true);
+    /** Channel copied from the channel list (written after the lock is released) */
+    struct ChannelSnapshot {
+        cChannel channel;
+        std::string group;
+    };
+
+    void writeChannel(JsonWriter& writer, const cChannel* channel, const std::string& groupName, bool enabled);
 
     ChannelCmds(const ChannelCmds& orig);
 
@@ -0,0 +1,50 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include "metricscmds.h"
+#include "tools/metrics.h"
+
+MetricsCmds::MetricsCmds() {
+}
+
+MetricsCmds::MetricsCmds(const MetricsCmds& orig) {
+}
+
+MetricsCmds::~MetricsCmds() {
+}
+
+cString MetricsCmds::SVDRPCommand(const char* Command, const char* Option, int& ReplyCode) {
+    if(strcmp(Command, "STAT") == 0) {
+        return processStatistics(Option, ReplyCode);
+    }
+
+    ReplyCode = 500;
+    return NULL;
+}
+
+cString MetricsCmds::processStatistics(const char* Option, int& ReplyCode) {
+    std::string group = (Option != NULL) ? skipspace(Option) : "";
+    return cString(Metrics::instance().dump(group).dump().c_str());
+}
@@ -0,0 +1,81 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "batchpolicy.h"
+
+BatchPolicy::BatchPolicy() {
+}
+
+void BatchPolicy::setLatency(uint32_t liveMs, uint32_t timeshiftMs) {
+    if(liveMs > 0) {
+        m_latencyMs = liveMs;
+    }
+
+    if(timeshiftMs > 0) {
+        m_timeshiftLatencyMs = timeshiftMs;
+    }
+}
+
+void BatchPolicy::setMaxSize(uint32_t maxSize) {
+    if(maxSize == 0) {
+        return;
+    }
+
+    m_maxSize = (maxSize < MinSize) ? MinSize : maxSize;
+}
+
+void BatchPolicy::setBitRate(uint64_t bitsPerSecond) {
+    m_bitRate = bitsPerSecond;
+}
+
+void BatchPolicy::setLive(bool live) {
+    m_live = live;
+}
+
+void BatchPolicy::setAudioOnly(bool audioOnly) {
+    m_audioOnly = audioOnly;
+}
+
+uint32_t BatchPolicy::threshold() const {
+    uint32_t minSize = m_audioOnly ? AudioMinSize : MinSize;
+    uint32_t fallbackSize = m_audioOnly ? AudioFallbackSize : FallbackSize;
+
+    // unknown bitrate (yet)
+    if(m_bitRate == 0) {
+        return (fallbackSize < m_maxSize) ? fallbackSize : m_maxSize;
+    }
+
+    uint64_t latencyMs = m_live ? m_latencyMs : m_timeshiftLatencyMs;
+    uint64_t size = (m_bitRate / 8) * latencyMs / 1000;
+
+    if(size < minSize) {
+        return minSize;
+    }
+
+    if(size > m_maxSize) {
+        return m_maxSize;
+    }
+
+    return (uint32_t)size;
+}
@@ -0,0 +1,95 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_BATCHPOLICY_H
+#define ROBOTV_BATCHPOLICY_H
+
+#include <stdint.h>
+
+/**
+ * Aggregation policy for stream packets.
+ * Computes the payload size a batch of stream packets should reach
+ * before it is sent to the client, based on the bitrate of the stream,
+ * a latency budget and a maximum batch size.
+ */
+class BatchPolicy {
+public:
+
+    static const uint32_t DefaultLatencyMs = 200;
+
+    static const uint32_t DefaultTimeshiftLatencyMs = 1000;
+
+    static const uint32_t DefaultMaxSize = 2 * 1024 * 1024;
+
+    static const uint32_t MinSize = 8 * 1024;
+
+    static const uint32_t FallbackSize = 128 * 1024;
+
+    static const uint32_t AudioMinSize = 2 * 1024;
+
+    static const uint32_t AudioFallbackSize = 8 * 1024;
+
+    BatchPolicy();
+
+    /** Set the latency budget.
+     @param liveMs latency budget (in ms) while watching live
+     @param timeshiftMs latency budget (in ms) while in timeshift / playback
+     */
+    void setLatency(uint32_t liveMs, uint32_t timeshiftMs);
+
+    void setMaxSize(uint32_t maxSize);
+
+    void setBitRate(uint64_t bitsPerSecond);
+
+    void setLive(bool live);
+
+    /** Use the small batch sizes of audio-only streams (radio) */
+    void setAudioOnly(bool audioOnly);
+
+    bool isLive() const {
+        return m_live;
+    }
+
+    /** Batch size threshold.
+     @return the payload size (in bytes) a batch should reach before sending
+     */
+    uint32_t threshold() const;
+
+private:
+
+    uint32_t m_latencyMs = DefaultLatencyMs;
+
+    uint32_t m_timeshiftLatencyMs = DefaultTimeshiftLatencyMs;
+
+    uint32_t m_maxSize = DefaultMaxSize;
+
+    uint64_t m_bitRate = 0;
+
+    bool m_live = true;
+
+    bool m_audioOnly = false;
+
+};
+
+#endif // ROBOTV_BATCHPOLICY_H
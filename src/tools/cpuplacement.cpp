@@ -0,0 +1,285 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "cpuplacement.h"
+#include "config/config.h"
+
+std::mutex CpuPlacement::m_mutex;
+
+std::vector<CpuPlacement::Cluster> CpuPlacement::m_clusters;
+
+std::map<uint32_t, CpuPlacement::Placement> CpuPlacement::m_channels;
+
+std::atomic<bool> CpuPlacement::m_enabled(false);
+
+std::atomic<uint32_t> CpuPlacement::m_version(1);
+
+// cluster of the calling thread (-1 - not pinned)
+static thread_local int threadCluster = -1;
+
+// channel and placement version the calling thread was checked against
+static thread_local uint32_t threadChannel = 0;
+
+static thread_local uint32_t threadVersion = 0;
+
+std::vector<int> CpuPlacement::parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream s(list);
+    std::string range;
+
+    while(std::getline(s, range, ',')) {
+        if(range.empty()) {
+            continue;
+        }
+
+        int first = 0;
+        int last = 0;
+
+        if(sscanf(range.c_str(), "%i-%i", &first, &last) != 2) {
+            first = last = atoi(range.c_str());
+        }
+
+        for(int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            if(cpu >= 0) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+
+    return cpus;
+}
+
+void CpuPlacement::configure(const std::string& spec) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_clusters.clear();
+    m_enabled = false;
+
+    if(spec.empty() || spec == "off") {
+        return;
+    }
+
+    // one cluster per NUMA node
+    if(spec == "auto") {
+        for(int node = 0;; node++) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+
+            if(!std::getline(file, list)) {
+                break;
+            }
+
+            std::vector<int> cpus = parseCpuList(list);
+
+            if(!cpus.empty()) {
+                m_clusters.push_back({cpus, 0});
+            }
+        }
+
+        if(m_clusters.size() < 2) {
+            INFOLOG("cpu placement: single NUMA node, placement disabled");
+            m_clusters.clear();
+            return;
+        }
+    }
+    else {
+        std::stringstream s(spec);
+        std::string list;
+
+        while(std::getline(s, list, ';')) {
+            std::vector<int> cpus = parseCpuList(list);
+
+            if(!cpus.empty()) {
+                m_clusters.push_back({cpus, 0});
+            }
+        }
+
+        if(m_clusters.empty()) {
+            ERRORLOG("cpu placement: invalid CpuAffinity '%s'", spec.c_str());
+            return;
+        }
+    }
+
+    INFOLOG("cpu placement: %i clusters", (int)m_clusters.size());
+    m_enabled = true;
+    m_version++;
+
+    static std::once_flag registered;
+
+    std::call_once(registered, []() {
+        Metrics::instance().add(&m_clusters, "placement", []() {
+            return getMetrics();
+        });
+    });
+}
+
+void CpuPlacement::acquire(uint32_t channelUid) {
+    if(!m_enabled) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto i = m_channels.find(channelUid);
+
+    if(i != m_channels.end()) {
+        i->second.refCount++;
+        return;
+    }
+
+    int cluster = 0;
+
+    for(int c = 1; c < (int)m_clusters.size(); c++) {
+        if(m_clusters[c].channels < m_clusters[cluster].channels) {
+            cluster = c;
+        }
+    }
+
+    m_clusters[cluster].channels++;
+    m_channels[channelUid] = {cluster, 1};
+    m_version++;
+
+    INFOLOG("cpu placement: channel %08x on cluster %i", channelUid, cluster);
+}
+
+void CpuPlacement::release(uint32_t channelUid) {
+    if(!m_enabled) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto i = m_channels.find(channelUid);
+
+    if(i == m_channels.end() || --i->second.refCount > 0) {
+        return;
+    }
+
+    m_clusters[i->second.cluster].channels--;
+    m_channels.erase(i);
+    m_version++;
+}
+
+void CpuPlacement::attachThread(uint32_t channelUid) {
+    if(!m_enabled) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto i = m_channels.find(channelUid);
+
+    if(i == m_channels.end()) {
+        return;
+    }
+
+    // the thread serves another channel already, keep them together
+    if(threadCluster >= 0 && threadCluster < (int)m_clusters.size()) {
+        if(i->second.cluster != threadCluster) {
+            m_clusters[i->second.cluster].channels--;
+            m_clusters[threadCluster].channels++;
+            i->second.cluster = threadCluster;
+            m_version++;
+
+            INFOLOG("cpu placement: channel %08x moved to cluster %i (shared receiver)", channelUid, threadCluster);
+        }
+    }
+    else {
+        pin(i->second.cluster);
+    }
+
+    threadChannel = channelUid;
+    threadVersion = m_version;
+}
+
+void CpuPlacement::follow(uint32_t channelUid) {
+    if(!m_enabled || (threadChannel == channelUid && threadVersion == m_version)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int cluster = clusterOf(channelUid);
+
+    if(cluster >= 0 && cluster != threadCluster) {
+        pin(cluster);
+    }
+
+    threadChannel = channelUid;
+    threadVersion = m_version;
+}
+
+int CpuPlacement::clusterOf(uint32_t channelUid) {
+    auto i = m_channels.find(channelUid);
+    return (i != m_channels.end()) ? i->second.cluster : -1;
+}
+
+bool CpuPlacement::pin(int cluster) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    for(int cpu : m_clusters[cluster].cpus) {
+        CPU_SET(cpu, &set);
+    }
+
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    if(rc != 0) {
+        ERRORLOG("cpu placement: unable to set thread affinity (%s)", strerror(rc));
+        return false;
+    }
+
+    threadCluster = cluster;
+    return true;
+}
+
+nlohmann::json CpuPlacement::getMetrics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    nlohmann::json clusters = nlohmann::json::array();
+
+    for(auto& c : m_clusters) {
+        clusters.push_back({
+            {"cpus", c.cpus},
+            {"channels", c.channels}
+        });
+    }
+
+    nlohmann::json channels = nlohmann::json::object();
+
+    for(auto& i : m_channels) {
+        char uid[9];
+        snprintf(uid, sizeof(uid), "%08x", i.first);
+        channels[uid] = i.second.cluster;
+    }
+
+    return {
+        {"enabled", (bool)m_enabled},
+        {"clusters", clusters},
+        {"channels", channels}
+    };
+}
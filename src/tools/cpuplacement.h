@@ -0,0 +1,113 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_CPUPLACEMENT_H
+#define ROBOTV_CPUPLACEMENT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tools/metrics.h"
+
+/**
+ * Placement of the streaming threads on core clusters.
+ * Every received channel is assigned to a cluster of cores (by default
+ * the cores of a NUMA node). The receiver thread, the demuxer workers and
+ * the timeshift writer of the channel are kept on the cores of its
+ * cluster. Memory is allocated on the node of the first thread touching
+ * it, so the packet buffers and parser buffers of a channel stay local
+ * to its node.
+ *
+ * Configured with CpuAffinity in robotv.conf, disabled by default.
+ * The placement is exported (group "placement") by the SVDRP command STAT.
+ */
+class CpuPlacement {
+public:
+
+    /** Set up the clusters.
+     @param spec "off", "auto" (one cluster per NUMA node) or a list of
+     cpu lists separated by semicolons (e.g. "0-7,16-23;8-15,24-31")
+     */
+    static void configure(const std::string& spec);
+
+    static bool isEnabled() {
+        return m_enabled;
+    }
+
+    /** Assign a channel to the least loaded cluster (reference counted) */
+    static void acquire(uint32_t channelUid);
+
+    static void release(uint32_t channelUid);
+
+    /** Place the calling receiver thread.
+     A thread already serving another channel (a device receiving several
+     channels of a transponder) keeps its cluster, the channel moves to
+     that cluster. Otherwise the thread is moved to the channel's cluster.
+     */
+    static void attachThread(uint32_t channelUid);
+
+    /** Keep the calling thread on the cluster of a channel.
+     Cheap if the placement didn't change since the last call.
+     */
+    static void follow(uint32_t channelUid);
+
+    /** Parse a cpu list (e.g. "0-3,8,10-11") */
+    static std::vector<int> parseCpuList(const std::string& list);
+
+private:
+
+    struct Cluster {
+        std::vector<int> cpus;
+        int channels;
+    };
+
+    struct Placement {
+        int cluster;
+        int refCount;
+    };
+
+    static int clusterOf(uint32_t channelUid);
+
+    static bool pin(int cluster);
+
+    static nlohmann::json getMetrics();
+
+    static std::mutex m_mutex;
+
+    static std::vector<Cluster> m_clusters;
+
+    static std::map<uint32_t, Placement> m_channels;
+
+    static std::atomic<bool> m_enabled;
+
+    // incremented on every change of the placement
+    static std::atomic<uint32_t> m_version;
+
+};
+
+#endif // ROBOTV_CPUPLACEMENT_H
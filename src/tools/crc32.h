@@ -0,0 +1,43 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 1986 Gary S. Brown (CRC32 code)
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_CRC32_H
+#define ROBOTV_CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * CRC-32 (IEEE 802.3, as zlib).
+ * Uses the ARMv8 CRC32 instructions if available, slice-by-8 tables otherwise.
+ */
+uint32_t crc32(const uint8_t* buf, size_t size);
+
+/** Continue a CRC-32.
+ Start with 0xFFFFFFFF and invert the final value.
+ */
+uint32_t crc32Update(uint32_t crc, const uint8_t* buf, size_t size);
+
+#endif // ROBOTV_CRC32_H
@@ -30,6 +30,10 @@
 #include <vdr/channels.h>
 #include <vdr/timers.h>
 
+/**
+ * Uid of a channel (hash of the channel id).
+ * The uid is cached per channel and only recalculated if the channel id changed.
+ */
 uint32_t createChannelUid(const cChannel* channel);
 
 const cChannel* findChannelByUid(uint32_t channelUID);
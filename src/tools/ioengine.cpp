@@ -0,0 +1,291 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include "config/config.h"
+#include "ioengine.h"
+
+std::atomic<bool> IoEngine::m_enabled(false);
+
+IoEngine::IoEngine() {
+    m_running = setup();
+
+    if(m_running) {
+        INFOLOG("io_uring engine started (%u entries)", m_entries);
+
+        m_reaper = std::thread([&]() {
+            reap();
+        });
+    }
+
+    Metrics::instance().add(this, "io", [ = ]() {
+        return getMetrics();
+    });
+}
+
+IoEngine::~IoEngine() {
+    Metrics::instance().remove(this);
+
+    if(!m_running) {
+        return;
+    }
+
+    // wake up the reaper with a NOP (user_data 0)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&]() {
+            return m_inflight < m_entries;
+        });
+
+        unsigned tail = *m_sqTail;
+        unsigned index = tail & m_sqMask;
+
+        memset(&m_sqes[index], 0, sizeof(struct io_uring_sqe));
+        m_sqes[index].opcode = IORING_OP_NOP;
+        m_sqArray[index] = index;
+
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+        m_inflight++;
+    }
+
+    syscall(__NR_io_uring_enter, m_ringFd, m_entries, 0, 0, NULL, 0);
+    m_reaper.join();
+
+    munmap(m_sqes, m_sqesSize);
+
+    if(m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+
+    munmap(m_sqRing, m_sqRingSize);
+    close(m_ringFd);
+}
+
+IoEngine& IoEngine::instance() {
+    static IoEngine engine;
+    return engine;
+}
+
+void IoEngine::setEnabled(bool enabled) {
+    m_enabled = enabled;
+    INFOLOG("io_uring engine: %s", enabled ? "enabled" : "disabled");
+}
+
+ssize_t IoEngine::pread(int fd, void* buffer, size_t length, off_t offset) {
+    if(!m_enabled || !instance().m_running) {
+        return ::pread(fd, buffer, length, offset);
+    }
+
+    struct iovec v = {buffer, length};
+    return instance().submit(IORING_OP_READV, fd, &v, 1, offset);
+}
+
+ssize_t IoEngine::pwritev(int fd, const struct iovec* iov, int count, off_t offset) {
+    if(!m_enabled || !instance().m_running) {
+        return ::pwritev(fd, iov, count, offset);
+    }
+
+    return instance().submit(IORING_OP_WRITEV, fd, iov, count, offset);
+}
+
+bool IoEngine::setup() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    m_ringFd = syscall(__NR_io_uring_setup, QueueDepth, &params);
+
+    if(m_ringFd < 0) {
+        INFOLOG("io_uring not available (%s) - using synchronous I/O", strerror(errno));
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP);
+
+    if(singleMap) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_sqRing = mmap(NULL, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    m_cqRing = singleMap ? m_sqRing : mmap(NULL, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+
+    if(m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+        ERRORLOG("unable to map io_uring - using synchronous I/O");
+
+        if(sqes != MAP_FAILED) {
+            munmap(sqes, m_sqesSize);
+        }
+
+        if(m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+
+        if(m_sqRing != MAP_FAILED) {
+            munmap(m_sqRing, m_sqRingSize);
+        }
+
+        close(m_ringFd);
+        m_ringFd = -1;
+        return false;
+    }
+
+    uint8_t* sq = (uint8_t*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + params.sq_off.head);
+    m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+    m_sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    m_sqArray = (unsigned*)(sq + params.sq_off.array);
+    m_sqes = (struct io_uring_sqe*)sqes;
+    m_entries = params.sq_entries;
+
+    uint8_t* cq = (uint8_t*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + params.cq_off.head);
+    m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+    m_cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+ssize_t IoEngine::submit(uint8_t opcode, int fd, const struct iovec* iov, int count, off_t offset) {
+    Request request = {0, false};
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    // the completion ring must never overflow
+    m_cond.wait(lock, [&]() {
+        return m_inflight < m_entries;
+    });
+
+    unsigned tail = *m_sqTail;
+    unsigned index = tail & m_sqMask;
+    struct io_uring_sqe* sqe = &m_sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = count;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t)(uintptr_t)&request;
+    m_sqArray[index] = index;
+
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    m_inflight++;
+    m_submissions++;
+
+    // buffered I/O may complete inline - don't block the other clients.
+    // a single call submits the requests of all threads queued so far.
+    lock.unlock();
+
+    int rc = 0;
+
+    do {
+        rc = syscall(__NR_io_uring_enter, m_ringFd, m_entries, 0, 0, NULL, 0);
+    }
+    while(rc < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+    if(rc < 0) {
+        ERRORLOG("io_uring submission failed: %s", strerror(errno));
+    }
+
+    lock.lock();
+
+    if(rc > 0) {
+        m_batches++;
+    }
+
+    m_cond.wait(lock, [&]() {
+        return request.done;
+    });
+
+    if(request.result < 0) {
+        errno = -request.result;
+        return -1;
+    }
+
+    return request.result;
+}
+
+void IoEngine::reap() {
+    bool running = true;
+
+    while(running) {
+        int rc = syscall(__NR_io_uring_enter, m_ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if(rc < 0 && errno != EINTR) {
+            ERRORLOG("io_uring wait failed: %s", strerror(errno));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+
+        while(head != tail) {
+            struct io_uring_cqe* cqe = &m_cqes[head & m_cqMask];
+            Request* request = (Request*)(uintptr_t)cqe->user_data;
+
+            if(request == NULL) {
+                running = false;
+            }
+            else {
+                request->result = cqe->res;
+                request->done = true;
+            }
+
+            m_inflight--;
+            head++;
+        }
+
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        m_cond.notify_all();
+    }
+}
+
+nlohmann::json IoEngine::getMetrics() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return {
+        {"uring", m_running},
+        {"entries", m_entries},
+        {"inflight", m_inflight},
+        {"submissions", m_submissions},
+        {"batches", m_batches}
+    };
+}
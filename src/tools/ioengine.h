@@ -0,0 +1,142 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_IOENGINE_H
+#define ROBOTV_IOENGINE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "tools/metrics.h"
+
+struct iovec;
+
+/**
+	@short Shared io_uring engine for file I/O
+
+	Timeshift writes and recording reads are submitted to one io_uring
+	instance shared by all clients. Requests issued concurrently by
+	different threads are submitted with a single system call, completions
+	are reaped by one thread. Callers block until their request completed,
+	so the engine is a drop-in replacement for pread / pwritev.
+
+	The engine is disabled by default (IoUring = true in robotv.conf). If
+	the kernel doesn't support io_uring the synchronous calls are used.
+	Counters are exported in the "io" metrics group.
+*/
+
+class IoEngine {
+public:
+
+    static void setEnabled(bool enabled);
+
+    /** Read from a file at the given offset (see pread) */
+    static ssize_t pread(int fd, void* buffer, size_t length, off_t offset);
+
+    /** Write a vector to a file at the given offset (see pwritev) */
+    static ssize_t pwritev(int fd, const struct iovec* iov, int count, off_t offset);
+
+    virtual ~IoEngine();
+
+protected:
+
+    IoEngine();
+
+    static IoEngine& instance();
+
+    struct Request {
+        int result;
+        bool done;
+    };
+
+    bool setup();
+
+    ssize_t submit(uint8_t opcode, int fd, const struct iovec* iov, int count, off_t offset);
+
+    void reap();
+
+    nlohmann::json getMetrics();
+
+private:
+
+    static std::atomic<bool> m_enabled;
+
+    int m_ringFd = -1;
+
+    bool m_running = false;
+
+    // submission ring
+    void* m_sqRing = NULL;
+
+    size_t m_sqRingSize = 0;
+
+    unsigned* m_sqHead = NULL;
+
+    unsigned* m_sqTail = NULL;
+
+    unsigned m_sqMask = 0;
+
+    unsigned* m_sqArray = NULL;
+
+    struct io_uring_sqe* m_sqes = NULL;
+
+    size_t m_sqesSize = 0;
+
+    unsigned m_entries = 0;
+
+    // completion ring
+    void* m_cqRing = NULL;
+
+    size_t m_cqRingSize = 0;
+
+    unsigned* m_cqHead = NULL;
+
+    unsigned* m_cqTail = NULL;
+
+    unsigned m_cqMask = 0;
+
+    struct io_uring_cqe* m_cqes = NULL;
+
+    unsigned m_inflight = 0;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_cond;
+
+    std::thread m_reaper;
+
+    uint64_t m_submissions = 0;
+
+    uint64_t m_batches = 0;
+
+    enum {
+        QueueDepth = 64
+    };
+};
+
+#endif // ROBOTV_IOENGINE_H
@@ -0,0 +1,171 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "jsonwriter.h"
+
+JsonWriter::JsonWriter(std::string& buffer) : m_buffer(buffer), m_key(false) {
+}
+
+JsonWriter::~JsonWriter() {
+}
+
+void JsonWriter::separator() {
+    // object member value directly follows its key
+    if(m_key) {
+        m_key = false;
+        return;
+    }
+
+    if(m_first.empty()) {
+        return;
+    }
+
+    if(!m_first.back()) {
+        m_buffer += ',';
+    }
+
+    m_first.back() = false;
+}
+
+void JsonWriter::beginObject() {
+    separator();
+    m_buffer += '{';
+    m_first.push_back(true);
+}
+
+void JsonWriter::endObject() {
+    m_buffer += '}';
+    m_first.pop_back();
+}
+
+void JsonWriter::beginArray() {
+    separator();
+    m_buffer += '[';
+    m_first.push_back(true);
+}
+
+void JsonWriter::endArray() {
+    m_buffer += ']';
+    m_first.pop_back();
+}
+
+void JsonWriter::key(const char* name) {
+    separator();
+    string(name, strlen(name));
+    m_buffer += ':';
+    m_key = true;
+}
+
+void JsonWriter::value(const char* value) {
+    if(value == NULL) {
+        null();
+        return;
+    }
+
+    separator();
+    string(value, strlen(value));
+}
+
+void JsonWriter::value(const std::string& value) {
+    separator();
+    string(value.c_str(), value.size());
+}
+
+void JsonWriter::value(int64_t value) {
+    char buffer[24];
+    separator();
+    snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+    m_buffer += buffer;
+}
+
+void JsonWriter::value(uint64_t value) {
+    char buffer[24];
+    separator();
+    snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)value);
+    m_buffer += buffer;
+}
+
+void JsonWriter::value(bool value) {
+    separator();
+    m_buffer += value ? "true" : "false";
+}
+
+void JsonWriter::null() {
+    separator();
+    m_buffer += "null";
+}
+
+void JsonWriter::string(const char* value, size_t length) {
+    m_buffer += '"';
+
+    for(size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)value[i];
+
+        switch(c) {
+            case '"':
+                m_buffer += "\\\"";
+                break;
+
+            case '\\':
+                m_buffer += "\\\\";
+                break;
+
+            case '\b':
+                m_buffer += "\\b";
+                break;
+
+            case '\f':
+                m_buffer += "\\f";
+                break;
+
+            case '\n':
+                m_buffer += "\\n";
+                break;
+
+            case '\r':
+                m_buffer += "\\r";
+                break;
+
+            case '\t':
+                m_buffer += "\\t";
+                break;
+
+            default:
+                if(c < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    m_buffer += buffer;
+                }
+                else {
+                    m_buffer += (char)c;
+                }
+
+                break;
+        }
+    }
+
+    m_buffer += '"';
+}
@@ -0,0 +1,99 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_JSONWRITER_H
+#define ROBOTV_JSONWRITER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Streaming JSON emitter.
+ * Appends the serialized document directly to a string buffer without
+ * building a DOM. Separators are tracked per nesting level, so values
+ * are simply written in order (object members with key() first).
+ */
+class JsonWriter {
+public:
+
+    JsonWriter(std::string& buffer);
+
+    virtual ~JsonWriter();
+
+    void beginObject();
+
+    void endObject();
+
+    void beginArray();
+
+    void endArray();
+
+    /** Write the key of the next object member */
+    void key(const char* name);
+
+    void value(const char* value);
+
+    void value(const std::string& value);
+
+    void value(int64_t value);
+
+    void value(uint64_t value);
+
+    void value(int value) {
+        this->value((int64_t)value);
+    }
+
+    void value(uint32_t value) {
+        this->value((uint64_t)value);
+    }
+
+    void value(bool value);
+
+    void null();
+
+    /** Shortcut for key() followed by value() */
+    template<typename T>
+    void member(const char* name, const T& v) {
+        key(name);
+        value(v);
+    }
+
+private:
+
+    void separator();
+
+    void string(const char* value, size_t length);
+
+    std::string& m_buffer;
+
+    std::vector<bool> m_first;
+
+    bool m_key;
+
+    JsonWriter(const JsonWriter& orig);
+
+};
+
+#endif // ROBOTV_JSONWRITER_H
@@ -0,0 +1,93 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include "lockprofiler.h"
+
+#ifdef ROBOTV_LOCK_PROFILER
+
+#include <map>
+#include <string>
+
+static std::mutex statsMutex;
+
+static std::map<std::string, LockStats*> statsByName;
+
+LockStats::LockStats() : m_acquisitions(0), m_contentions(0) {
+}
+
+LockStats* LockStats::get(const char* name) {
+    static std::once_flag registered;
+
+    std::call_once(registered, []() {
+        Metrics::instance().add(&statsByName, "locks", []() {
+            return getMetrics();
+        });
+    });
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+
+    // kept until the plugin is unloaded (locks of all instances share them)
+    LockStats*& stats = statsByName[name];
+
+    if(stats == NULL) {
+        stats = new LockStats;
+    }
+
+    return stats;
+}
+
+void LockStats::acquired(uint64_t waitUs, bool contended) {
+    m_acquisitions++;
+
+    if(contended) {
+        m_contentions++;
+        m_wait.add(waitUs);
+    }
+}
+
+void LockStats::released(uint64_t holdUs) {
+    m_hold.add(holdUs);
+}
+
+nlohmann::json LockStats::toJson() const {
+    return {
+        {"acquisitions", m_acquisitions.load()},
+        {"contentions", m_contentions.load()},
+        {"wait", m_wait.toJson()},
+        {"hold", m_hold.toJson()}
+    };
+}
+
+nlohmann::json LockStats::getMetrics() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    nlohmann::json j = nlohmann::json::object();
+
+    for(auto& i : statsByName) {
+        j[i.first] = i.second->toJson();
+    }
+
+    return j;
+}
+
+#endif // ROBOTV_LOCK_PROFILER
@@ -0,0 +1,135 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_LOCKPROFILER_H
+#define ROBOTV_LOCKPROFILER_H
+
+#include <mutex>
+
+#ifdef ROBOTV_LOCK_PROFILER
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+#include "tools/metrics.h"
+
+/**
+ * Contention statistics of a named lock.
+ * All instances of a lock with the same name (e.g. the send queue locks of
+ * all clients) share their statistics. The locks are dumped in the "locks"
+ * metrics group (SVDRP command STAT locks).
+ */
+class LockStats {
+public:
+
+    static LockStats* get(const char* name);
+
+    /** Account an acquisition
+     @param waitUs time spent waiting for the lock
+     @param contended the lock was held by another thread
+     */
+    void acquired(uint64_t waitUs, bool contended);
+
+    void released(uint64_t holdUs);
+
+    nlohmann::json toJson() const;
+
+private:
+
+    LockStats();
+
+    static nlohmann::json getMetrics();
+
+    std::atomic<uint64_t> m_acquisitions;
+
+    std::atomic<uint64_t> m_contentions;
+
+    LatencyHistogram m_wait;
+
+    LatencyHistogram m_hold;
+
+};
+
+/**
+ * Mutex recording wait time, hold time and contention.
+ * Compiled in with ROBOTV_LOCK_PROFILER (make LOCK_PROFILER=1), a plain
+ * std::mutex otherwise. Waits on condition variables lock the std::mutex
+ * base directly and are not accounted.
+ */
+class ProfiledMutex : public std::mutex {
+public:
+
+    explicit ProfiledMutex(const char* name) : m_stats(LockStats::get(name)) {
+    }
+
+    void lock() {
+        auto start = std::chrono::steady_clock::now();
+        bool contended = !std::mutex::try_lock();
+
+        if(contended) {
+            std::mutex::lock();
+        }
+
+        m_locked = std::chrono::steady_clock::now();
+        m_stats->acquired(std::chrono::duration_cast<std::chrono::microseconds>(m_locked - start).count(), contended);
+    }
+
+    bool try_lock() {
+        if(!std::mutex::try_lock()) {
+            return false;
+        }
+
+        m_locked = std::chrono::steady_clock::now();
+        m_stats->acquired(0, false);
+        return true;
+    }
+
+    void unlock() {
+        auto now = std::chrono::steady_clock::now();
+        m_stats->released(std::chrono::duration_cast<std::chrono::microseconds>(now - m_locked).count());
+        std::mutex::unlock();
+    }
+
+private:
+
+    LockStats* m_stats;
+
+    std::chrono::steady_clock::time_point m_locked;
+
+};
+
+#else
+
+class ProfiledMutex : public std::mutex {
+public:
+
+    explicit ProfiledMutex(const char* name) {
+    }
+
+};
+
+#endif // ROBOTV_LOCK_PROFILER
+
+#endif // ROBOTV_LOCKPROFILER_H
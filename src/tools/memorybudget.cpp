@@ -0,0 +1,119 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <mutex>
+
+#include "memorybudget.h"
+#include "config/config.h"
+
+std::atomic<int64_t> MemoryBudget::m_usage[MemoryBudget::msCount];
+
+std::atomic<uint64_t> MemoryBudget::m_shed[MemoryBudget::msCount];
+
+std::atomic<int64_t> MemoryBudget::m_total(0);
+
+std::atomic<int64_t> MemoryBudget::m_peak(0);
+
+uint64_t MemoryBudget::m_limit = 0;
+
+static const char* subsystemNames[MemoryBudget::msCount] = {
+    "sendQueue",
+    "timeShift",
+    "parser",
+    "player"
+};
+
+void MemoryBudget::setLimit(uint64_t bytes) {
+    m_limit = bytes;
+    INFOLOG("memory budget: %lu bytes", (unsigned long)m_limit);
+}
+
+void MemoryBudget::add(Subsystem subsystem, int64_t bytes) {
+    registerMetrics();
+
+    m_usage[subsystem] += bytes;
+    int64_t total = (m_total += bytes);
+    int64_t peak = m_peak;
+
+    while(total > peak && !m_peak.compare_exchange_weak(peak, total)) {
+    }
+}
+
+bool MemoryBudget::exceeded() {
+    return (m_limit != 0 && m_total > (int64_t)m_limit);
+}
+
+void MemoryBudget::shed(Subsystem subsystem, uint64_t bytes) {
+    m_shed[subsystem] += bytes;
+}
+
+int64_t MemoryBudget::usage() {
+    return m_total;
+}
+
+void MemoryBudget::registerMetrics() {
+    static std::once_flag registered;
+
+    std::call_once(registered, []() {
+        Metrics::instance().add(&m_total, "memory", []() {
+            return getMetrics();
+        });
+    });
+}
+
+nlohmann::json MemoryBudget::getMetrics() {
+    nlohmann::json usage = nlohmann::json::object();
+    nlohmann::json shed = nlohmann::json::object();
+
+    for(int i = 0; i < msCount; i++) {
+        usage[subsystemNames[i]] = m_usage[i].load();
+        shed[subsystemNames[i]] = m_shed[i].load();
+    }
+
+    return {
+        {"limit", m_limit},
+        {"total", m_total.load()},
+        {"peak", m_peak.load()},
+        {"exceeded", exceeded()},
+        {"usage", usage},
+        {"shed", shed}
+    };
+}
+
+MemoryAccount::MemoryAccount(MemoryBudget::Subsystem subsystem) : m_subsystem(subsystem), m_bytes(0) {
+}
+
+MemoryAccount::~MemoryAccount() {
+    MemoryBudget::add(m_subsystem, -m_bytes);
+}
+
+void MemoryAccount::add(int64_t bytes) {
+    m_bytes += bytes;
+    MemoryBudget::add(m_subsystem, bytes);
+}
+
+void MemoryAccount::set(int64_t bytes) {
+    int64_t old = m_bytes.exchange(bytes);
+    MemoryBudget::add(m_subsystem, bytes - old);
+}
@@ -0,0 +1,115 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_MEMORYBUDGET_H
+#define ROBOTV_MEMORYBUDGET_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "tools/metrics.h"
+
+/**
+ * Global memory budget of the plugin.
+ * The buffers growing with the number of clients are accounted per
+ * subsystem (and per owner with a MemoryAccount). While the sum exceeds
+ * the budget (MaxMemorySize in robotv.conf) the subsystems shed memory:
+ * queued status messages are dropped, the in-memory timeshift windows
+ * shrink and idle parser buffers are released. The plugin runs inside
+ * VDR, running out of memory would take down recordings too.
+ * Usage is exported (group "memory") by the SVDRP command STAT.
+ */
+class MemoryBudget {
+public:
+
+    enum Subsystem {
+        msSendQueue,
+        msTimeShift,
+        msParser,
+        msPlayer,
+        msCount
+    };
+
+    /** Set the budget (0 - unlimited) */
+    static void setLimit(uint64_t bytes);
+
+    /** Account allocated (or released) memory */
+    static void add(Subsystem subsystem, int64_t bytes);
+
+    /** Check if the budget is exceeded (subsystems should shed memory) */
+    static bool exceeded();
+
+    /** Count memory shed by a subsystem */
+    static void shed(Subsystem subsystem, uint64_t bytes);
+
+    static int64_t usage();
+
+private:
+
+    static void registerMetrics();
+
+    static nlohmann::json getMetrics();
+
+    static std::atomic<int64_t> m_usage[msCount];
+
+    static std::atomic<uint64_t> m_shed[msCount];
+
+    static std::atomic<int64_t> m_total;
+
+    static std::atomic<int64_t> m_peak;
+
+    static uint64_t m_limit;
+
+};
+
+/**
+ * Memory of one owner (e.g. the send queue of a client).
+ * Changes are forwarded to the global budget, the remaining bytes are
+ * released with the account.
+ */
+class MemoryAccount {
+public:
+
+    MemoryAccount(MemoryBudget::Subsystem subsystem);
+
+    virtual ~MemoryAccount();
+
+    void add(int64_t bytes);
+
+    /** Set the current usage (the difference is accounted) */
+    void set(int64_t bytes);
+
+    int64_t bytes() const {
+        return m_bytes;
+    }
+
+private:
+
+    MemoryBudget::Subsystem m_subsystem;
+
+    std::atomic<int64_t> m_bytes;
+
+};
+
+#endif // ROBOTV_MEMORYBUDGET_H
@@ -0,0 +1,139 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <algorithm>
+
+#include "metrics.h"
+
+using json = nlohmann::json;
+
+LatencyHistogram::LatencyHistogram() : m_count(0), m_sum(0), m_max(0) {
+    for(int i = 0; i < Buckets; i++) {
+        m_buckets[i] = 0;
+    }
+}
+
+void LatencyHistogram::add(uint64_t us) {
+    // bucket i holds samples below 2^(i+1) us
+    int bucket = (us < 2) ? 0 : std::min(63 - __builtin_clzll(us), Buckets - 1);
+
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(us, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+
+    while(us > max && !m_max.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::addSince(const std::chrono::steady_clock::time_point& start) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    add(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+uint64_t LatencyHistogram::percentile(const uint64_t* buckets, uint64_t count, double p) const {
+    uint64_t rank = (uint64_t)(count * p);
+    uint64_t sum = 0;
+
+    for(int i = 0; i < Buckets; i++) {
+        sum += buckets[i];
+
+        if(sum > rank) {
+            return ((uint64_t)1 << (i + 1)) - 1;
+        }
+    }
+
+    return m_max;
+}
+
+json LatencyHistogram::toJson() const {
+    uint64_t buckets[Buckets];
+    uint64_t count = 0;
+    json list = json::array();
+
+    // use a consistent snapshot for the percentiles
+    for(int i = 0; i < Buckets; i++) {
+        buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        count += buckets[i];
+        list.push_back(buckets[i]);
+    }
+
+    uint64_t max = m_max;
+
+    return {
+        {"count", count},
+        {"sumUs", (uint64_t)m_sum},
+        {"maxUs", max},
+        {"p50Us", count ? std::min(percentile(buckets, count, 0.50), max) : 0},
+        {"p90Us", count ? std::min(percentile(buckets, count, 0.90), max) : 0},
+        {"p99Us", count ? std::min(percentile(buckets, count, 0.99), max) : 0},
+        {"buckets", list}
+    };
+}
+
+LatencyTimer::LatencyTimer(LatencyHistogram& histogram) : m_histogram(histogram), m_start(std::chrono::steady_clock::now()) {
+}
+
+LatencyTimer::~LatencyTimer() {
+    m_histogram.addSince(m_start);
+}
+
+Metrics::Metrics() {
+}
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+void Metrics::add(const void* owner, const std::string& group, Source source) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sources[owner] = { group, source };
+}
+
+void Metrics::remove(const void* owner) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sources.erase(owner);
+}
+
+json Metrics::dump(const std::string& group) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    json result = json::object();
+
+    for(auto& i : m_sources) {
+        if(!group.empty() && i.second.group != group) {
+            continue;
+        }
+
+        if(result.find(i.second.group) == result.end()) {
+            result[i.second.group] = json::array();
+        }
+
+        result[i.second.group].push_back(i.second.source());
+    }
+
+    return result;
+}
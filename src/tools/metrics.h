@@ -0,0 +1,145 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_METRICS_H
+#define ROBOTV_METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "tools/json.hpp"
+
+/**
+ * Lock-free latency histogram.
+ * Samples (in microseconds) are counted in power-of-two buckets, so adding
+ * a sample is cheap enough for the streaming hot paths.
+ */
+class LatencyHistogram {
+public:
+
+    static const int Buckets = 25;
+
+    LatencyHistogram();
+
+    void add(uint64_t us);
+
+    /** Add the time elapsed since start */
+    void addSince(const std::chrono::steady_clock::time_point& start);
+
+    uint64_t count() const {
+        return m_count;
+    }
+
+    /** Export the histogram.
+     Percentiles are approximated by the upper bound of their bucket.
+     @return count, sum, max and percentiles (in microseconds) and the buckets
+     */
+    nlohmann::json toJson() const;
+
+private:
+
+    uint64_t percentile(const uint64_t* buckets, uint64_t count, double p) const;
+
+    std::atomic<uint64_t> m_buckets[Buckets];
+
+    std::atomic<uint64_t> m_count;
+
+    std::atomic<uint64_t> m_sum;
+
+    std::atomic<uint64_t> m_max;
+
+};
+
+/**
+ * Scoped latency measurement.
+ * Adds the lifetime of the object to a histogram.
+ */
+class LatencyTimer {
+public:
+
+    LatencyTimer(LatencyHistogram& histogram);
+
+    ~LatencyTimer();
+
+private:
+
+    LatencyHistogram& m_histogram;
+
+    std::chrono::steady_clock::time_point m_start;
+
+};
+
+/**
+ * Registry of metric sources.
+ * Components register a callback exporting their counters and histograms.
+ * Sources are grouped by name and dumped as JSON (SVDRP command STAT).
+ */
+class Metrics {
+public:
+
+    typedef std::function<nlohmann::json()> Source;
+
+    static Metrics& instance();
+
+    /** Register a metric source.
+     The callback may be invoked from any thread until the source is removed.
+     @param owner the object owning the source (used as key)
+     @param group name of the group (e.g. "clients")
+     @param source callback exporting the metrics
+     */
+    void add(const void* owner, const std::string& group, Source source);
+
+    /** Remove a metric source.
+     Waits for a running dump. The callback won't be called afterwards.
+     */
+    void remove(const void* owner);
+
+    /** Export the metrics of all sources.
+     @param group dump only this group (empty - all groups)
+     @return JSON object with an array of sources per group
+     */
+    nlohmann::json dump(const std::string& group = "");
+
+private:
+
+    Metrics();
+
+    struct Entry {
+        std::string group;
+        Source source;
+    };
+
+    std::map<const void*, Entry> m_sources;
+
+    std::mutex m_mutex;
+
+};
+
+#endif // ROBOTV_METRICS_H
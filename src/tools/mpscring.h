@@ -0,0 +1,157 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_MPSCRING_H
+#define ROBOTV_MPSCRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+/**
+	@short Bounded lock-free multi-producer / single-consumer ring
+
+	All slots are allocated up front, push() and pop() never allocate
+	and never block. Producers claim a slot with a single CAS on the
+	enqueue position (an uncontended producer succeeds at the first
+	attempt), the consumer owns the dequeue position.
+*/
+
+template<typename T>
+class MpscRing {
+public:
+
+    /** @param capacity number of slots (rounded up to a power of two) */
+    MpscRing(size_t capacity) : m_enqueuePosition(0), m_dequeuePosition(0) {
+        size_t size = 2;
+
+        while(size < capacity) {
+            size <<= 1;
+        }
+
+        m_mask = size - 1;
+        m_cells = std::vector<Cell>(size);
+
+        for(size_t i = 0; i < size; i++) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /** Add an item (any thread).
+     @return false if the ring is full
+     */
+    bool push(const T& item) {
+        size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+        Cell* cell = NULL;
+
+        for(;;) {
+            cell = &m_cells[position & m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+
+            if(diff == 0) {
+                if(m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(diff < 0) {
+                return false;
+            }
+            else {
+                position = m_enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->item = item;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Remove the oldest item (consumer thread only).
+     @return false if the ring is empty
+     */
+    bool pop(T& item) {
+        size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+        Cell& cell = m_cells[position & m_mask];
+
+        if(cell.sequence.load(std::memory_order_acquire) != position + 1) {
+            return false;
+        }
+
+        item = cell.item;
+        cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+        m_dequeuePosition.store(position + 1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    /** Number of items in the ring (approximation if called concurrently) */
+    size_t size() const {
+        size_t enqueued = m_enqueuePosition.load(std::memory_order_relaxed);
+        size_t dequeued = m_dequeuePosition.load(std::memory_order_relaxed);
+        return (enqueued > dequeued) ? enqueued - dequeued : 0;
+    }
+
+    /** Check if there is an item to pop (consumer thread only) */
+    bool empty() const {
+        size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+        return m_cells[position & m_mask].sequence.load(std::memory_order_acquire) != position + 1;
+    }
+
+    size_t capacity() const {
+        return m_mask + 1;
+    }
+
+private:
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T item;
+
+        Cell() : sequence(0), item() {
+        }
+
+        Cell(const Cell& c) : sequence(c.sequence.load()), item(c.item) {
+        }
+    };
+
+    std::vector<Cell> m_cells;
+
+    size_t m_mask;
+
+    // producers and the consumer update different cache lines
+    char m_pad0[64];
+
+    std::atomic<size_t> m_enqueuePosition;
+
+    char m_pad1[64];
+
+    std::atomic<size_t> m_dequeuePosition;
+
+    char m_pad2[64];
+
+};
+
+#endif // ROBOTV_MPSCRING_H
@@ -0,0 +1,149 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <algorithm>
+#include "config/config.h"
+#include "tools/metrics.h"
+#include "scheduler.h"
+
+Scheduler::Scheduler(const std::string& name) : m_name(name) {
+    Metrics::instance().add(this, "scheduler", [ = ]() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        nlohmann::json j = nlohmann::json::object();
+
+        for(const Task& t : m_tasks) {
+            j[t.name] = {
+                {"intervalMs", t.intervalMs},
+                {"runs", t.runs},
+                {"lastMs", t.lastUs / 1000.0},
+                {"maxMs", t.maxUs / 1000.0},
+                {"avgMs", (t.runs > 0) ? (t.totalUs / 1000.0) / t.runs : 0},
+                {"maxLateMs", t.lateUs / 1000.0}
+            };
+        }
+
+        return j;
+    });
+}
+
+Scheduler::~Scheduler() {
+    Metrics::instance().remove(this);
+    stop();
+}
+
+void Scheduler::add(const std::string& name, uint32_t intervalMs, std::function<void()> task, bool runNow) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Task t;
+    t.name = name;
+    t.intervalMs = intervalMs;
+    t.run = task;
+    t.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(runNow ? 0 : intervalMs);
+    t.runs = 0;
+    t.lastUs = 0;
+    t.maxUs = 0;
+    t.totalUs = 0;
+    t.lateUs = 0;
+
+    m_tasks.push_back(t);
+}
+
+void Scheduler::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(m_thread != NULL) {
+        return;
+    }
+
+    m_running = true;
+    m_thread = new std::thread([ = ]() {
+        action();
+    });
+}
+
+void Scheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+
+    m_condition.notify_all();
+
+    if(m_thread != NULL) {
+        m_thread->join();
+        delete m_thread;
+        m_thread = NULL;
+    }
+}
+
+void Scheduler::action() {
+    INFOLOG("%s scheduler started with %lu tasks", m_name.c_str(), (unsigned long)m_tasks.size());
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while(m_running) {
+        if(m_tasks.empty()) {
+            m_condition.wait(lock);
+            continue;
+        }
+
+        // the task that is due next (there are only a few tasks)
+        size_t next = 0;
+
+        for(size_t i = 1; i < m_tasks.size(); i++) {
+            if(m_tasks[i].due < m_tasks[next].due) {
+                next = i;
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        if(m_tasks[next].due > now) {
+            m_condition.wait_until(lock, m_tasks[next].due);
+            continue;
+        }
+
+        Task& task = m_tasks[next];
+        uint64_t late = std::chrono::duration_cast<std::chrono::microseconds>(now - task.due).count();
+        std::function<void()> run = task.run;
+
+        task.due = now + std::chrono::milliseconds(task.intervalMs);
+
+        // run without the lock (metrics stay available)
+        lock.unlock();
+        run();
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
+        lock.lock();
+
+        Task& t = m_tasks[next];
+        t.runs++;
+        t.lastUs = us;
+        t.totalUs += us;
+        t.maxUs = std::max(t.maxUs, us);
+        t.lateUs = std::max(t.lateUs, late);
+    }
+
+    INFOLOG("%s scheduler stopped", m_name.c_str());
+}
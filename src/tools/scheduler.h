@@ -0,0 +1,96 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#ifndef ROBOTV_SCHEDULER_H
+#define ROBOTV_SCHEDULER_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+	@short Runs periodic tasks on a worker thread
+
+	Tasks run one after another on the worker, each task is scheduled
+	again one interval after its last run started. Run times per task
+	are exported in the "scheduler" metrics group.
+*/
+
+class Scheduler {
+public:
+
+    Scheduler(const std::string& name);
+
+    virtual ~Scheduler();
+
+    /** Add a periodic task (before start()).
+     @param name name of the task (metrics / log)
+     @param intervalMs interval in milliseconds
+     @param task function to run
+     @param runNow run the task right after start (else after one interval)
+     */
+    void add(const std::string& name, uint32_t intervalMs, std::function<void()> task, bool runNow = false);
+
+    void start();
+
+    /** Stop the worker (waits for a running task) */
+    void stop();
+
+protected:
+
+    void action();
+
+    struct Task {
+        std::string name;
+        uint32_t intervalMs;
+        std::function<void()> run;
+        std::chrono::steady_clock::time_point due;
+        uint64_t runs;
+        uint64_t lastUs;
+        uint64_t maxUs;
+        uint64_t totalUs;
+        uint64_t lateUs;
+    };
+
+    std::string m_name;
+
+    std::vector<Task> m_tasks;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_condition;
+
+    std::thread* m_thread = NULL;
+
+    bool m_running = false;
+
+};
+
+#endif // ROBOTV_SCHEDULER_H
@@ -0,0 +1,69 @@
+/*
+ *      vdr-plugin-robotv - roboTV server plugin for VDR
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#ifndef ROBOTV_TRACEPOINTS_H
+#define ROBOTV_TRACEPOINTS_H
+
+/**
+ * Static tracepoints (USDT) on the streaming hot paths.
+ * Compiled in with ROBOTV_TRACEPOINTS (make TRACEPOINTS=1, needs the
+ * systemtap sdt headers), the macros expand to nothing otherwise. An
+ * inactive probe costs a single nop, the arguments have to be cheap to
+ * evaluate (no allocations, no locking).
+ *
+ * All probes belong to the provider "robotv":
+ *
+ *   livehub_receive(channelUid, length)
+ *   demuxer_packet(pid, content, frameType, size, pts)
+ *   livequeue_queue(channelUid, content, length, pts)
+ *   livequeue_read(channelUid, length, latencyUs)
+ *   livequeue_seek(channelUid, positionMs, resultPts)
+ *   player_block(position, length, queued)
+ *   player_packet(msgId, length)
+ *   packet_write(fd, msgId, uid, written, complete)
+ *   request_start(clientId, msgId, uid, length)
+ *   request_done(clientId, msgId, uid, length, latencyUs)
+ *
+ * e.g.: bpftrace -e 'usdt:./libvdr-robotv.so:robotv:request_done { @[arg1] = hist(arg4); }'
+ */
+
+#ifdef ROBOTV_TRACEPOINTS
+
+#include <sys/sdt.h>
+
+#define ROBOTV_TRACE2(name, a1, a2) DTRACE_PROBE2(robotv, name, a1, a2)
+#define ROBOTV_TRACE3(name, a1, a2, a3) DTRACE_PROBE3(robotv, name, a1, a2, a3)
+#define ROBOTV_TRACE4(name, a1, a2, a3, a4) DTRACE_PROBE4(robotv, name, a1, a2, a3, a4)
+#define ROBOTV_TRACE5(name, a1, a2, a3, a4, a5) DTRACE_PROBE5(robotv, name, a1, a2, a3, a4, a5)
+
+#else
+
+#define ROBOTV_TRACE2(name, a1, a2)
+#define ROBOTV_TRACE3(name, a1, a2, a3)
+#define ROBOTV_TRACE4(name, a1, a2, a3, a4)
+#define ROBOTV_TRACE5(name, a1, a2, a3, a4, a5)
+
+#endif // ROBOTV_TRACEPOINTS
+
+#endif // ROBOTV_TRACEPOINTS_H
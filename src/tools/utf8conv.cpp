@@ -1,6 +1,47 @@
+#include <string.h>
+#include <stdint.h>
+
 #include "utf8conv.h"
 
+#define ASCII_MASK64 0x8080808080808080ULL
+
+#define ONES64 0x0101010101010101ULL
+
+// length of the leading 7 bit ASCII part of a string
+static size_t asciiLength(const char* s) {
+    const char* p = s;
+
+    // align to 8 bytes (aligned reads do not cross a page boundary)
+    while(((uintptr_t)p & 7) != 0) {
+        if(*p == 0 || (*p & 0x80)) {
+            return p - s;
+        }
+
+        p++;
+    }
+
+    // 8 bytes at once until a zero byte or a non-ASCII byte shows up
+    for(;;) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+
+        if((((v - ONES64) & ~v) | v) & ASCII_MASK64) {
+            break;
+        }
+
+        p += sizeof(v);
+    }
+
+    while(*p != 0 && !(*p & 0x80)) {
+        p++;
+    }
+
+    return p - s;
+}
+
 Utf8Conv::Utf8Conv() : cCharSetConv(nullptr, "UTF-8") {
+    // VDR uses NULL for UTF-8
+    m_utf8Source = (cCharSetConv::SystemCharacterTable() == NULL);
 }
 
 std::string Utf8Conv::convert(const std::string& from) {
@@ -8,10 +49,43 @@ std::string Utf8Conv::convert(const std::string& from) {
 }
 
 std::string Utf8Conv::convert(const char* from) {
-    std::string text = cCharSetConv::Convert(from);
     std::string result;
+    convert(from, result);
+    return result;
+}
+
+const std::string& Utf8Conv::convertToBuffer(const char* from) {
+    convert(from, m_buffer);
+    return m_buffer;
+}
 
-    utf8::replace_invalid(text.begin(), text.end(), std::back_inserter(result));
+void Utf8Conv::convert(const char* from, std::string& to) {
+    size_t length = asciiLength(from);
 
-    return result;
+    // plain ASCII is the same in all supported character tables
+    if(from[length] == 0) {
+        to.assign(from, length);
+        return;
+    }
+
+    length += strlen(from + length);
+
+    // valid UTF-8 doesn't need a conversion
+    if(m_utf8Source && utf8::is_valid(from, from + length)) {
+        to.assign(from, length);
+        return;
+    }
+
+    const char* text = cCharSetConv::Convert(from);
+    length = strlen(text);
+
+    if(utf8::is_valid(text, text + length)) {
+        to.assign(text, length);
+        return;
+    }
+
+    to.clear();
+    to.reserve(length);
+
+    utf8::replace_invalid(text, text + length, std::back_inserter(to));
 }
@@ -1,6 +1,8 @@
 #ifndef ROBOTV_UTF8CONF_H
 #define ROBOTV_UTF8CONF_H
 
+#include <string>
+
 #include "utf8.h"
 #include "vdr/tools.h"
 
@@ -13,6 +15,21 @@ public:
 
     std::string convert(const char* from);
 
+    /** Convert into a string (reuses the memory of the string) */
+    void convert(const char* from, std::string& to);
+
+    /** Convert into the buffer of the converter.
+     The result is valid until the next conversion.
+     */
+    const std::string& convertToBuffer(const char* from);
+
+private:
+
+    /** the system character table is UTF-8 */
+    bool m_utf8Source;
+
+    std::string m_buffer;
+
 };
 
 #endif // ROBOTV_UTF8CONF_H
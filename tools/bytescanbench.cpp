@@ -0,0 +1,224 @@
+/*
+ *      RoboTV start code search benchmark
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "demuxer/bytescan.h"
+#include "demuxer/demuxer.h"
+#include "demuxer/parser.h"
+
+using namespace std::chrono;
+
+static int iterations = 2000;
+static int bufferSize = 64 * 1024;
+static int distance = 4096;
+
+// results of the last run (keeps the compiler from dropping the work)
+static uint64_t sink = 0;
+
+class NullListener : public TsDemuxer::Listener {
+public:
+
+    void sendStreamPacket(StreamPacket* p) {
+    }
+
+    void requestStreamChange() {
+    }
+
+};
+
+// exposes the start code search of the parser
+class ScanParser : public Parser {
+public:
+
+    ScanParser(TsDemuxer* demuxer) : Parser(demuxer, 4096, 4096) {
+    }
+
+    void parse(unsigned char* data, int size, bool pusi) {
+    }
+
+    using Parser::findStartCode;
+
+    using Parser::findStartCodeScalar;
+
+};
+
+static void usage() {
+    printf("usage: bytescanbench [options]\n");
+    printf("  -n count      iterations per test (default: 2000)\n");
+    printf("  -s size       buffer size in bytes (default: 65536)\n");
+    printf("  -d distance   average distance of start codes / sync words in bytes (default: 4096)\n");
+}
+
+// run a test and report the time per buffer and the throughput
+static void run(const char* name, std::function<int()> test) {
+    int matches = 0;
+    auto start = steady_clock::now();
+
+    for(int i = 0; i < iterations; i++) {
+        matches = test();
+        sink += matches;
+    }
+
+    double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000000000.0;
+
+    printf("%-36s %9i %11.0f %9.1f\n",
+           name, matches, seconds * 1000000000.0 / iterations, (double)bufferSize * iterations / seconds / (1024 * 1024));
+
+    fflush(stdout);
+}
+
+// random payload (like compressed video) with markers at random positions
+static std::vector<uint8_t> createBuffer(const uint8_t* marker, int markerLength, int seed) {
+    std::vector<uint8_t> buffer(bufferSize);
+    std::mt19937 random(seed);
+
+    for(auto& b : buffer) {
+        b = random();
+    }
+
+    for(int i = random() % distance; i + markerLength < bufferSize; i += 1 + random() % (2 * distance)) {
+        memcpy(&buffer[i], marker, markerLength);
+    }
+
+    return buffer;
+}
+
+static int scalarZeroPair(const uint8_t* buffer, int offset, int length) {
+    for(int i = offset; i + 1 < length; i++) {
+        if(buffer[i] == 0 && buffer[i + 1] == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int scalarSyncWord(const uint8_t* buffer, int offset, int length, uint16_t syncWord, uint16_t mask) {
+    for(int i = offset; i + 1 < length; i++) {
+        if((((buffer[i] << 8) | buffer[i + 1]) & mask) == syncWord) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// count all matches of a search function in the buffer (skipping the match like the parsers do)
+static int countAll(const std::vector<uint8_t>& buffer, std::function<int(int)> find) {
+    int count = 0;
+    int o = 0;
+
+    while((o = find(o)) >= 0) {
+        count++;
+        o += 4;
+    }
+
+    return count;
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "n:s:d:h")) != -1) {
+        switch(c) {
+            case 'n':
+                iterations = std::max(1, atoi(optarg));
+                break;
+
+            case 's':
+                bufferSize = std::max(1024, atoi(optarg));
+                break;
+
+            case 'd':
+                distance = std::max(8, atoi(optarg));
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    NullListener listener;
+    TsDemuxer demuxer(&listener, StreamInfo::stH264, 0x100);
+    ScanParser parser(&demuxer);
+
+    static const uint8_t startCode[] = { 0x00, 0x00, 0x00, 0x01 };
+    static const uint8_t ac3Sync[] = { 0x0B, 0x77 };
+    static const uint8_t adtsSync[] = { 0xFF, 0xF1 };
+
+    std::vector<uint8_t> video = createBuffer(startCode, sizeof(startCode), 1);
+    std::vector<uint8_t> ac3 = createBuffer(ac3Sync, sizeof(ac3Sync), 2);
+    std::vector<uint8_t> adts = createBuffer(adtsSync, sizeof(adtsSync), 3);
+
+    uint8_t* v = video.data();
+    const uint8_t* a = ac3.data();
+    const uint8_t* d = adts.data();
+
+    struct Test {
+        const char* name;
+        std::function<int()> test;
+    };
+
+    std::vector<Test> tests = {
+        { "start code 0x00000001", [&]() { return countAll(video, [&](int o) { return parser.findStartCode(v, bufferSize, o, 0x00000001); }); } },
+        { "start code 0x00000001 (scalar)", [&]() { return countAll(video, [&](int o) { return parser.findStartCodeScalar(v, bufferSize, o, 0x00000001); }); } },
+        { "start code 0x000001 (H.265)", [&]() { return countAll(video, [&](int o) { return parser.findStartCode(v, bufferSize, o, 0x00000001, 0x00FFFFFF); }); } },
+        { "start code 0x000001 (H.265 scalar)", [&]() { return countAll(video, [&](int o) { return parser.findStartCodeScalar(v, bufferSize, o, 0x00000001, 0x00FFFFFF); }); } },
+        { "zero pair", [&]() { return countAll(video, [&](int o) { return findZeroPair(v, o, bufferSize); }); } },
+        { "zero pair (scalar)", [&]() { return countAll(video, [&](int o) { return scalarZeroPair(v, o, bufferSize); }); } },
+        { "sync word AC3", [&]() { return countAll(ac3, [&](int o) { return findSyncWord(a, o, bufferSize, 0x0B77, 0xFFFF); }); } },
+        { "sync word AC3 (scalar)", [&]() { return countAll(ac3, [&](int o) { return scalarSyncWord(a, o, bufferSize, 0x0B77, 0xFFFF); }); } },
+        { "sync word ADTS", [&]() { return countAll(adts, [&](int o) { return findSyncWord(d, o, bufferSize, 0xFFF0, 0xFFF6); }); } },
+        { "sync word ADTS (scalar)", [&]() { return countAll(adts, [&](int o) { return scalarSyncWord(d, o, bufferSize, 0xFFF0, 0xFFF6); }); } },
+    };
+
+    // every optimized search must find the same matches as its scalar counterpart
+    for(size_t i = 0; i < tests.size(); i += 2) {
+        if(tests[i].test() != tests[i + 1].test()) {
+            fprintf(stderr, "%s: result differs from the scalar search\n", tests[i].name);
+            return 1;
+        }
+    }
+
+    printf("%-36s %9s %11s %9s\n", "test", "matches", "ns/buffer", "MB/s");
+
+    for(auto& t : tests) {
+        run(t.name, t.test);
+    }
+
+    return (sink == 0) ? 1 : 0;
+}
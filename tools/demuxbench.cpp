@@ -0,0 +1,393 @@
+/*
+ *      RoboTV Demuxer Benchmark
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <vector>
+
+#include "demuxer/demuxer.h"
+#include "demuxer/demuxerbundle.h"
+#include "demuxer/streambundle.h"
+
+using namespace std::chrono;
+
+static int passes = 10;
+static bool parallel = false;
+static bool verbose = false;
+static FILE* out = stdout;
+
+// heap allocations of the process (operator new ends up in malloc)
+static std::atomic<uint64_t> allocations(0);
+
+extern "C" {
+
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+
+    void* malloc(size_t size) {
+        allocations++;
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) {
+        allocations++;
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* ptr, size_t size) {
+        allocations++;
+        return __libc_realloc(ptr, size);
+    }
+
+}
+
+// counts the parsed frames (the receiver would queue them)
+class CountingListener : public TsDemuxer::Listener {
+public:
+
+    void sendStreamPacket(StreamPacket* p) {
+        frames++;
+        bytes += p->size;
+    }
+
+    void requestStreamChange() {
+        streamChanges++;
+    }
+
+    std::atomic<uint64_t> frames{0};
+
+    std::atomic<uint64_t> bytes{0};
+
+    std::atomic<uint64_t> streamChanges{0};
+
+};
+
+static void usage() {
+    printf("usage: demuxbench [options] file.ts [file.ts ...]\n");
+    printf("  -n count      passes over the input (default: 10)\n");
+    printf("  -p            parse the streams on worker threads\n");
+    printf("  -v            show the demuxer log\n");
+}
+
+static bool readFile(const char* filename, std::vector<uint8_t>& data) {
+    std::ifstream in(filename, std::ios::binary);
+
+    if(!in) {
+        return false;
+    }
+
+    data.insert(data.end(), std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// collects the PSI section of a pid
+struct Section {
+    std::vector<uint8_t> data;
+
+    bool add(const uint8_t* packet) {
+        int offset = TsPayloadOffset(packet);
+
+        if(TsPayloadStart(packet)) {
+            data.clear();
+            offset += 1 + packet[offset];
+        }
+        else if(data.empty()) {
+            return false;
+        }
+
+        if(offset < TS_SIZE) {
+            data.insert(data.end(), packet + offset, packet + TS_SIZE);
+        }
+
+        return data.size() >= 3 && data.size() >= length();
+    }
+
+    size_t length() const {
+        return 3 + (((data[1] & 0x0F) << 8) | data[2]);
+    }
+};
+
+static StreamInfo::Type streamType(int type, const uint8_t* descriptors, int length, char* lang) {
+    StreamInfo::Type result = StreamInfo::stNONE;
+
+    switch(type) {
+        case 0x01:
+        case 0x02:
+            result = StreamInfo::stMPEG2VIDEO;
+            break;
+
+        case 0x03:
+        case 0x04:
+            result = StreamInfo::stMPEG2AUDIO;
+            break;
+
+        case 0x0f:
+            result = StreamInfo::stAAC;
+            break;
+
+        case 0x11:
+            result = StreamInfo::stLATM;
+            break;
+
+        case 0x1b:
+            result = StreamInfo::stH264;
+            break;
+
+        case 0x24:
+            result = StreamInfo::stH265;
+            break;
+
+        case 0x81:
+            result = StreamInfo::stAC3;
+            break;
+
+        case 0x87:
+            result = StreamInfo::stEAC3;
+            break;
+    }
+
+    for(int i = 0; i + 2 <= length; i += 2 + descriptors[i + 1]) {
+        int tag = descriptors[i];
+
+        if(tag == 0x0A && descriptors[i + 1] >= 3) {
+            memcpy(lang, &descriptors[i + 2], 3);
+            lang[3] = 0;
+        }
+
+        if(type != 0x06) {
+            continue;
+        }
+
+        if(tag == 0x6A) {
+            result = StreamInfo::stAC3;
+        }
+        else if(tag == 0x7A) {
+            result = StreamInfo::stEAC3;
+        }
+        else if(tag == 0x59) {
+            result = StreamInfo::stDVBSUB;
+        }
+        else if(tag == 0x56) {
+            result = StreamInfo::stTELETEXT;
+        }
+    }
+
+    return result;
+}
+
+// streams of the first program (PAT / PMT)
+static StreamBundle findStreams(const std::vector<uint8_t>& data) {
+    StreamBundle bundle;
+    Section pat;
+    Section pmt;
+    int pmtPid = -1;
+
+    for(size_t i = 0; i + TS_SIZE <= data.size(); i += TS_SIZE) {
+        const uint8_t* packet = &data[i];
+
+        if(packet[0] != TS_SYNC_BYTE || !TsHasPayload(packet)) {
+            continue;
+        }
+
+        int pid = TsPid(packet);
+
+        if(pid == 0 && pmtPid == -1 && pat.add(packet)) {
+            const uint8_t* s = pat.data.data();
+
+            for(size_t p = 8; p + 4 <= pat.length() - 4; p += 4) {
+                int program = (s[p] << 8) | s[p + 1];
+
+                if(program != 0) {
+                    pmtPid = ((s[p + 2] & 0x1F) << 8) | s[p + 3];
+                    break;
+                }
+            }
+        }
+        else if(pid == pmtPid && pmt.add(packet)) {
+            const uint8_t* s = pmt.data.data();
+            size_t end = pmt.length() - 4;
+            size_t p = 12 + (((s[10] & 0x0F) << 8) | s[11]);
+
+            while(p + 5 <= end) {
+                int type = s[p];
+                int esPid = ((s[p + 1] & 0x1F) << 8) | s[p + 2];
+                int length = ((s[p + 3] & 0x0F) << 8) | s[p + 4];
+                char lang[4] = "";
+
+                StreamInfo::Type t = streamType(type, &s[p + 5], std::min<int>(length, end - p - 5), lang);
+
+                if(t != StreamInfo::stNONE) {
+                    bundle.addStream(StreamInfo(esPid, t, lang));
+                }
+
+                p += 5 + length;
+            }
+
+            break;
+        }
+    }
+
+    return bundle;
+}
+
+static void report(const char* name, int pid, uint64_t packets, uint64_t frames, uint64_t allocs, double seconds) {
+    fprintf(out, "%-12s %6i %10llu %9llu %9.1f %11.0f %10llu %11.2f\n",
+            name, pid,
+            (unsigned long long)packets,
+            (unsigned long long)frames,
+            packets * TS_SIZE / seconds / (1024 * 1024),
+            packets / seconds,
+            (unsigned long long)allocs,
+            allocs * 1000.0 / std::max<uint64_t>(packets, 1));
+
+    fflush(out);
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "n:pvh")) != -1) {
+        switch(c) {
+            case 'n':
+                passes = std::max(1, atoi(optarg));
+                break;
+
+            case 'p':
+                parallel = true;
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if(optind >= argc) {
+        usage();
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+
+    for(int i = optind; i < argc; i++) {
+        if(!readFile(argv[i], data)) {
+            fprintf(stderr, "unable to read %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    StreamBundle streams = findStreams(data);
+
+    if(streams.empty()) {
+        fprintf(stderr, "no supported streams found (PAT / PMT missing ?)\n");
+        return 1;
+    }
+
+    // the demuxer logs to stdout (CONSOLEDEBUG), keep the report separate
+    out = fdopen(dup(STDOUT_FILENO), "w");
+
+    if(!verbose) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    fprintf(out, "%-12s %6s %10s %9s %9s %11s %10s %11s\n", "parser", "pid", "packets", "frames", "MB/s", "packets/s", "allocs", "allocs/1k");
+
+    // all streams through the demuxer bundle (like the receiver)
+    {
+        CountingListener listener;
+        DemuxerBundle bundle(&listener);
+
+        bundle.setParallel(parallel);
+        bundle.updateFrom(&streams);
+
+        uint64_t allocs = allocations;
+        auto start = steady_clock::now();
+
+        for(int i = 0; i < passes; i++) {
+            int offset = 0;
+
+            while(offset < (int)data.size()) {
+                int consumed = bundle.processTsBuffer(&data[offset], data.size() - offset);
+
+                if(consumed <= 0) {
+                    break;
+                }
+
+                offset += consumed;
+            }
+        }
+
+        // stop the workers (parallel mode) before taking the time
+        bundle.clear();
+
+        double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000000000.0;
+        report("bundle", 0, (data.size() / TS_SIZE) * passes, listener.frames, allocations - allocs, seconds);
+    }
+
+    // every stream on its own (packets of other pids are filtered before)
+    for(auto& i : streams) {
+        StreamInfo& info = i.second;
+        std::vector<uint8_t*> packets;
+
+        for(size_t o = 0; o + TS_SIZE <= data.size(); o += TS_SIZE) {
+            if(data[o] == TS_SYNC_BYTE && TsPid(&data[o]) == info.getPid()) {
+                packets.push_back(&data[o]);
+            }
+        }
+
+        CountingListener listener;
+        TsDemuxer demuxer(&listener, info);
+
+        uint64_t allocs = allocations;
+        auto start = steady_clock::now();
+
+        for(int p = 0; p < passes; p++) {
+            for(auto packet : packets) {
+                demuxer.processTsPacket(packet);
+            }
+        }
+
+        double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000000000.0;
+        report(info.typeName(), info.getPid(), packets.size() * passes, listener.frames, allocations - allocs, seconds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ *      RoboTV TS Packet Dispatch Benchmark
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <random>
+#include <vector>
+
+#include "demuxer/demuxer.h"
+#include "demuxer/demuxerbundle.h"
+#include "demuxer/streambundle.h"
+
+using namespace std::chrono;
+
+static int rounds = 50;
+static int bitrate = 80;
+static int pidCount = 40;
+static int streamCount = 8;
+static FILE* out = stdout;
+
+// results of the last run (keeps the compiler from dropping the work)
+static uint64_t sink = 0;
+
+class NullListener : public TsDemuxer::Listener {
+public:
+
+    void sendStreamPacket(StreamPacket* p) {
+        sink++;
+    }
+
+    void requestStreamChange() {
+    }
+
+};
+
+static void usage() {
+    printf("usage: dispatchbench [options]\n");
+    printf("  -n count      rounds over one second of the transponder (default: 50)\n");
+    printf("  -b mbit       transponder bitrate in Mbit/s (default: 80)\n");
+    printf("  -p count      pids on the transponder (default: 40)\n");
+    printf("  -s count      demuxed streams (default: 8)\n");
+}
+
+// one second of a transponder, the packets are spread over the pids at random.
+// there are no PES starts, so the parsers drop the payload and only the
+// dispatch and the TS header path are measured.
+static std::vector<uint8_t> createTransponder(const std::vector<int>& pids) {
+    int packets = (int)((int64_t)bitrate * 1000000 / 8 / TS_SIZE);
+    std::vector<uint8_t> data(packets * TS_SIZE);
+    std::mt19937 random(1);
+
+    for(int i = 0; i < packets; i++) {
+        uint8_t* p = &data[i * TS_SIZE];
+        int pid = pids[random() % pids.size()];
+
+        p[0] = TS_SYNC_BYTE;
+        p[1] = (pid >> 8) & TS_PID_MASK_HI;
+        p[2] = pid & 0xFF;
+        p[3] = TS_PAYLOAD_EXISTS | (i & 0x0F);
+
+        for(int j = 4; j < TS_SIZE; j++) {
+            p[j] = random();
+        }
+    }
+
+    return data;
+}
+
+// the dispatcher is a template parameter, so the call is inlined like in the receiver
+template<class Dispatch> static void run(const char* name, const std::vector<uint8_t>& data, Dispatch dispatch) {
+    int packets = data.size() / TS_SIZE;
+    uint8_t* buffer = (uint8_t*)data.data();
+
+    auto start = steady_clock::now();
+
+    for(int r = 0; r < rounds; r++) {
+        for(int i = 0; i < packets; i++) {
+            dispatch(buffer + i * TS_SIZE);
+        }
+    }
+
+    double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000000000.0;
+    double ns = seconds * 1000000000.0 / ((double)packets * rounds);
+
+    // cpu share needed to keep up with the transponder
+    fprintf(out, "%-32s %9.1f %12.0f %11.0f %8.2f%%\n",
+            name, ns, 1000000000.0 / ns, 1000000000.0 / ns * TS_SIZE * 8 / 1000000, ns * packets / 10000000.0);
+
+    fflush(out);
+}
+
+static void runAll(const char* title, const std::vector<uint8_t>& data, DemuxerBundle& bundle) {
+    // reference: the demuxers of the previous bundle (list walk per packet)
+    std::list<TsDemuxer*> list(bundle.begin(), bundle.end());
+
+    // reference: one demuxer pointer per pid
+    std::vector<TsDemuxer*> table(MAXPID, NULL);
+
+    for(auto dmx : bundle) {
+        table[dmx->getPid()] = dmx;
+    }
+
+    fprintf(out, "\n%s\n", title);
+    fprintf(out, "%-32s %9s %12s %11s %9s\n", "dispatch", "ns/packet", "packets/s", "max Mbit/s", "cpu");
+
+    run("list lookup", data, [&](uint8_t* p) {
+        int pid = TsPid(p);
+
+        for(auto dmx : list) {
+            if(dmx->getPid() == pid) {
+                sink += dmx->processTsPacket(p);
+                break;
+            }
+        }
+    });
+
+    run("pointer table", data, [&](uint8_t* p) {
+        TsDemuxer* dmx = table[TsPid(p)];
+
+        if(dmx != NULL) {
+            sink += dmx->processTsPacket(p);
+        }
+    });
+
+    run("bundle (pid slot table)", data, [&](uint8_t* p) {
+        sink += bundle.processTsPacket(p);
+    });
+
+    // the receiver hands over whole blocks
+    int packets = data.size() / TS_SIZE;
+    auto start = steady_clock::now();
+
+    for(int r = 0; r < rounds; r++) {
+        sink += bundle.processTsBuffer(data.data(), data.size());
+    }
+
+    double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000000000.0;
+    double ns = seconds * 1000000000.0 / ((double)packets * rounds);
+
+    fprintf(out, "%-32s %9.1f %12.0f %11.0f %8.2f%%\n",
+            "bundle (block)", ns, 1000000000.0 / ns, 1000000000.0 / ns * TS_SIZE * 8 / 1000000, ns * packets / 10000000.0);
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "n:b:p:s:h")) != -1) {
+        switch(c) {
+            case 'n':
+                rounds = std::max(1, atoi(optarg));
+                break;
+
+            case 'b':
+                bitrate = std::max(1, atoi(optarg));
+                break;
+
+            case 'p':
+                pidCount = std::max(1, atoi(optarg));
+                break;
+
+            case 's':
+                streamCount = std::min(200, std::max(1, atoi(optarg)));
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    pidCount = std::max(pidCount, streamCount);
+
+    // the demuxer logs to stdout (CONSOLEDEBUG), keep the report separate
+    out = fdopen(dup(STDOUT_FILENO), "w");
+
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    // pids of the transponder, the first ones are demuxed (video, audio, subtitles)
+    std::vector<int> pids;
+    std::vector<int> demuxed;
+    StreamBundle streams;
+
+    for(int i = 0; i < pidCount; i++) {
+        pids.push_back(0x100 + i * 7);
+    }
+
+    for(int i = 0; i < streamCount; i++) {
+        StreamInfo::Type type = (i == 0) ? StreamInfo::stH264 : (i % 4 == 3) ? StreamInfo::stDVBSUB : (i % 2) ? StreamInfo::stAC3 : StreamInfo::stMPEG2AUDIO;
+        streams.addStream(StreamInfo(pids[i], type));
+        demuxed.push_back(pids[i]);
+    }
+
+    std::vector<uint8_t> transponder = createTransponder(pids);
+    std::vector<uint8_t> streamsOnly = createTransponder(demuxed);
+
+    NullListener listener;
+    DemuxerBundle bundle(&listener);
+    bundle.updateFrom(&streams);
+
+    fprintf(out, "%i Mbit/s, %i packets per second, %i pids, %i demuxed streams, %i rounds\n",
+            bitrate, (int)(transponder.size() / TS_SIZE), pidCount, streamCount, rounds);
+
+    runAll("mixed transponder", transponder, bundle);
+    runAll("only demuxed pids", streamsOnly, bundle);
+
+    bundle.clear();
+
+    return (sink == 0) ? 1 : 0;
+}
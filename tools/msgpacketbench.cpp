@@ -0,0 +1,372 @@
+/*
+ *      RoboTV MsgPacket Benchmark
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "net/msgpacket.h"
+#include "net/msgpacketwriter.h"
+#include "robotv/robotvcommand.h"
+
+using namespace std::chrono;
+
+static int iterations = 100000;
+static int frameSize = 16384;
+static int rowCount = 1000;
+static int compressionLevel = 3;
+
+// results of the last run (keeps the compiler from dropping the work)
+static uint64_t sink = 0;
+
+static void usage() {
+    printf("usage: msgpacketbench [options]\n");
+    printf("  -n count      iterations per test (default: 100000)\n");
+    printf("  -f size       payload size of a stream packet in bytes (default: 16384)\n");
+    printf("  -r rows       rows of a list response (default: 1000)\n");
+    printf("  -z level      compression level (default: 3)\n");
+}
+
+// run a test and report the time per iteration and the throughput
+static void run(const char* name, int count, uint64_t bytes, std::function<void()> test) {
+    auto start = steady_clock::now();
+
+    for(int i = 0; i < count; i++) {
+        test();
+    }
+
+    double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000000000.0;
+
+    printf("%-28s %9i %11.0f %11.1f %9.1f\n",
+           name, count, seconds * 1000000000.0 / count, count / seconds, bytes * count / seconds / (1024 * 1024));
+
+    fflush(stdout);
+}
+
+// a stream packet the way LiveHub builds it (one put per field)
+static MsgPacket* buildStreamPacket(const std::vector<uint8_t>& data, int64_t pts) {
+    MsgPacket* packet = new MsgPacket(ROBOTV_STREAM_MUXPKT, ROBOTV_CHANNEL_STREAM);
+
+    packet->put_U16(0x100);
+    packet->put_S64(pts);
+    packet->put_S64(pts);
+    packet->put_U32(3600);
+    packet->setClientID(1);
+    packet->put_U32(data.size());
+    packet->put_Blob((uint8_t*)data.data(), data.size());
+    packet->put_S64(pts / 90);
+
+    return packet;
+}
+
+// the same packet written with a single reservation
+static MsgPacket* buildStreamPacketBulk(const std::vector<uint8_t>& data, int64_t pts) {
+    MsgPacket* packet = new MsgPacket(ROBOTV_STREAM_MUXPKT, ROBOTV_CHANNEL_STREAM);
+    MsgPacketWriter writer(packet, sizeof(uint16_t) + 2 * sizeof(int64_t) + 2 * sizeof(uint32_t) + data.size() + sizeof(int64_t));
+
+    writer.put_U16(0x100);
+    writer.put_S64(pts);
+    writer.put_S64(pts);
+    writer.put_U32(3600);
+    packet->setClientID(1);
+    writer.put_U32(data.size());
+    writer.put_Blob(data.data(), data.size());
+    writer.put_S64(pts / 90);
+    writer.commit();
+
+    return packet;
+}
+
+struct Row {
+    uint32_t start;
+    uint32_t duration;
+    uint32_t priority;
+    uint32_t lifetime;
+    std::string channelName;
+    std::string title;
+    std::string subject;
+    std::string description;
+    std::string directory;
+    std::string uid;
+    uint32_t playCount;
+    uint64_t position;
+};
+
+static std::vector<Row> createRows() {
+    std::vector<Row> rows;
+    std::mt19937 random(1);
+
+    for(int i = 0; i < rowCount; i++) {
+        Row r;
+        r.start = 1500000000 + random() % 10000000;
+        r.duration = 1800 + random() % 7200;
+        r.priority = 50;
+        r.lifetime = 99;
+        r.channelName = "Channel " + std::to_string(random() % 500);
+        r.title = "Title of recording " + std::to_string(i);
+        r.subject = "Subject " + std::to_string(random());
+        r.description = std::string(100 + random() % 400, 'x');
+        r.directory = "Series/Folder " + std::to_string(random() % 50);
+        r.uid = std::to_string(random());
+        r.playCount = random() % 5;
+        r.position = random();
+
+        rows.push_back(r);
+    }
+
+    return rows;
+}
+
+// a list response (recordings) with one put per field
+static MsgPacket* buildList(const std::vector<Row>& rows) {
+    MsgPacket* packet = new MsgPacket(ROBOTV_RECORDINGS_GETLIST, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+
+    for(auto& r : rows) {
+        packet->put_U32(r.start);
+        packet->put_U32(r.duration);
+        packet->put_U32(r.priority);
+        packet->put_U32(r.lifetime);
+        packet->put_String(r.channelName);
+        packet->put_String(r.title);
+        packet->put_String(r.subject);
+        packet->put_String(r.description);
+        packet->put_String(r.directory);
+        packet->put_String(r.uid);
+        packet->put_U32(r.playCount);
+        packet->put_U64(r.position);
+    }
+
+    return packet;
+}
+
+// the same list with one reservation per row
+static MsgPacket* buildListBulk(const std::vector<Row>& rows) {
+    MsgPacket* packet = new MsgPacket(ROBOTV_RECORDINGS_GETLIST, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+
+    for(auto& r : rows) {
+        MsgPacketWriter writer(packet,
+                               5 * sizeof(uint32_t) + sizeof(uint64_t) +
+                               MsgPacketWriter::sizeOf(r.channelName) +
+                               MsgPacketWriter::sizeOf(r.title) +
+                               MsgPacketWriter::sizeOf(r.subject) +
+                               MsgPacketWriter::sizeOf(r.description) +
+                               MsgPacketWriter::sizeOf(r.directory) +
+                               MsgPacketWriter::sizeOf(r.uid));
+
+        writer.put_U32(r.start);
+        writer.put_U32(r.duration);
+        writer.put_U32(r.priority);
+        writer.put_U32(r.lifetime);
+        writer.put_String(r.channelName);
+        writer.put_String(r.title);
+        writer.put_String(r.subject);
+        writer.put_String(r.description);
+        writer.put_String(r.directory);
+        writer.put_String(r.uid);
+        writer.put_U32(r.playCount);
+        writer.put_U64(r.position);
+    }
+
+    return packet;
+}
+
+static uint64_t parseList(MsgPacket* packet) {
+    uint64_t sum = 0;
+    packet->rewind();
+
+    while(!packet->eop()) {
+        sum += packet->get_U32();
+        sum += packet->get_U32();
+        sum += packet->get_U32();
+        sum += packet->get_U32();
+
+        for(int i = 0; i < 6; i++) {
+            sum += packet->get_String()[0];
+        }
+
+        sum += packet->get_U32();
+        sum += packet->get_U64();
+    }
+
+    return sum;
+}
+
+// both variants have to produce the same bytes
+static bool compare(MsgPacket* a, MsgPacket* b) {
+    return a->getPayloadLength() == b->getPayloadLength() &&
+           memcmp(a->getPayload(), b->getPayload(), a->getPayloadLength()) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "n:f:r:z:h")) != -1) {
+        switch(c) {
+            case 'n':
+                iterations = std::max(1, atoi(optarg));
+                break;
+
+            case 'f':
+                frameSize = std::max(1, atoi(optarg));
+                break;
+
+            case 'r':
+                rowCount = std::max(1, atoi(optarg));
+                break;
+
+            case 'z':
+                compressionLevel = std::min(9, std::max(1, atoi(optarg)));
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    std::vector<uint8_t> frame(frameSize);
+    std::mt19937 random(2);
+
+    for(auto& b : frame) {
+        b = random() & 0x3F;
+    }
+
+    std::vector<Row> rows = createRows();
+    int listIterations = std::max(1, iterations / rowCount);
+
+    MsgPacket* stream = buildStreamPacket(frame, 900000);
+    MsgPacket* list = buildList(rows);
+
+    MsgPacket* streamBulk = buildStreamPacketBulk(frame, 900000);
+    MsgPacket* listBulk = buildListBulk(rows);
+
+    if(!compare(stream, streamBulk) || !compare(list, listBulk)) {
+        fprintf(stderr, "bulk writer output differs\n");
+        return 1;
+    }
+
+    delete streamBulk;
+    delete listBulk;
+
+    uint32_t streamLength = stream->getPayloadLength();
+    uint32_t listLength = list->getPayloadLength();
+
+    printf("%-28s %9s %11s %11s %9s\n", "test", "count", "ns/op", "ops/s", "MB/s");
+
+    // build
+    run("build stream packet", iterations, streamLength, [&]() {
+        MsgPacket* p = buildStreamPacket(frame, sink);
+        sink += p->getPayloadLength();
+        delete p;
+    });
+
+    run("build stream packet (bulk)", iterations, streamLength, [&]() {
+        MsgPacket* p = buildStreamPacketBulk(frame, sink);
+        sink += p->getPayloadLength();
+        delete p;
+    });
+
+    run("build list", listIterations, listLength, [&]() {
+        MsgPacket* p = buildList(rows);
+        sink += p->getPayloadLength();
+        delete p;
+    });
+
+    run("build list (bulk)", listIterations, listLength, [&]() {
+        MsgPacket* p = buildListBulk(rows);
+        sink += p->getPayloadLength();
+        delete p;
+    });
+
+    // parse
+    run("parse stream packet", iterations, streamLength, [&]() {
+        stream->rewind();
+        sink += stream->get_U16();
+        sink += stream->get_S64();
+        sink += stream->get_S64();
+        sink += stream->get_U32();
+        uint32_t size = stream->get_U32();
+        sink += stream->consume(size)[0];
+        sink += stream->get_S64();
+    });
+
+    run("parse list", listIterations, listLength, [&]() {
+        sink += parseList(list);
+    });
+
+    // checksum
+    run("checksum stream packet", iterations, streamLength, [&]() {
+        MsgPacket* p = buildStreamPacketBulk(frame, sink);
+        p->freeze();
+        sink += p->getPayloadCheckSum();
+        delete p;
+    });
+
+    stream->freeze();
+
+    run("validate stream packet", iterations, streamLength, [&]() {
+        sink += stream->validatePayloadCheckSum();
+    });
+
+    // compression
+    int compressed = 0;
+
+    run("compress list", listIterations, listLength, [&]() {
+        MsgPacket* p = buildListBulk(rows);
+        p->compress(compressionLevel);
+        compressed = p->getPayloadLength();
+        delete p;
+    });
+
+    list->compress(compressionLevel);
+    list->freeze();
+
+    std::string wire((const char*)list->getPacket(), list->getPacketLength());
+
+    run("read + uncompress list", listIterations, listLength, [&]() {
+        std::istringstream in(wire);
+        MsgPacket p;
+        in >> p;
+        p.uncompress();
+        sink += p.getPayloadLength();
+    });
+
+    printf("\ncompression ratio (list, level %i): %.2f\n", compressionLevel, listLength / (double)std::max(1, compressed));
+
+    delete stream;
+    delete list;
+
+    return (sink == 0) ? 1 : 0;
+}
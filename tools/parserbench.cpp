@@ -0,0 +1,242 @@
+/*
+ *      RoboTV Audio Parser Benchmark
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+// Feeds synthetic MPEG audio, AC3 and ADTS streams through the frame parsers.
+// Only the public TsDemuxer interface is used, so the same benchmark can be
+// built against older revisions of the demuxer to compare the parser loops.
+// The checksum over the emitted frames (size and PTS) must not change
+// between revisions.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "demuxer/demuxer.h"
+#include "demuxer/parser.h"
+#include "vdr/remux.h"
+
+using namespace std::chrono;
+
+static int rounds = 20;
+static int frameCount = 20000;
+static int corruptInterval = 50;
+static FILE* out = stdout;
+
+// collects the frames the parser emits
+class HashListener : public TsDemuxer::Listener {
+public:
+
+    void sendStreamPacket(StreamPacket* p) {
+        frames++;
+        hash = (hash ^ (uint64_t)p->size) * 1099511628211ULL;
+        hash = (hash ^ (uint64_t)p->pts) * 1099511628211ULL;
+    }
+
+    void requestStreamChange() {
+    }
+
+    uint64_t frames = 0;
+
+    uint64_t hash = 1469598103934665603ULL;
+
+};
+
+struct Codec {
+    const char* name;
+    StreamInfo::Type type;
+    int streamId;
+    int frameSize;
+    std::vector<uint8_t> header;
+};
+
+static void usage() {
+    printf("usage: parserbench [options]\n");
+    printf("  -n count      rounds per test (default: 20)\n");
+    printf("  -f count      frames per stream (default: 20000)\n");
+    printf("  -c interval   truncate every n-th frame in the resync test (default: 50)\n");
+}
+
+// split a PES packet into TS packets (the last one is padded with an adaptation field)
+static void packetize(std::vector<uint8_t>& ts, const std::vector<uint8_t>& pes, int pid, int& cc) {
+    for(size_t o = 0; o < pes.size(); o += TS_SIZE - 4) {
+        int payload = std::min<int>(pes.size() - o, TS_SIZE - 4);
+        int stuffing = TS_SIZE - 4 - payload;
+        size_t p = ts.size();
+
+        ts.resize(p + TS_SIZE, 0xFF);
+        ts[p + 0] = TS_SYNC_BYTE;
+        ts[p + 1] = ((o == 0) ? TS_PAYLOAD_START : 0) | ((pid >> 8) & TS_PID_MASK_HI);
+        ts[p + 2] = pid & 0xFF;
+        ts[p + 3] = TS_PAYLOAD_EXISTS | (cc++ & 0x0F);
+
+        if(stuffing > 0) {
+            ts[p + 3] |= TS_ADAPT_FIELD_EXISTS;
+            ts[p + 4] = stuffing - 1;
+
+            if(stuffing > 1) {
+                ts[p + 5] = 0;
+            }
+        }
+
+        memcpy(&ts[p + 4 + stuffing], &pes[o], payload);
+    }
+}
+
+// one frame per PES packet, every n-th frame is truncated to force resyncs
+static std::vector<uint8_t> createStream(const Codec& codec, int corrupt) {
+    std::vector<uint8_t> ts;
+    std::mt19937 random(42);
+    int64_t pts = 90000;
+    int cc = 0;
+
+    for(int n = 0; n < frameCount; n++) {
+        std::vector<uint8_t> frame(codec.frameSize);
+
+        for(auto& b : frame) {
+            b = random();
+        }
+
+        std::copy(codec.header.begin(), codec.header.end(), frame.begin());
+
+        if(corrupt > 0 && n % corrupt == corrupt / 2) {
+            frame.resize(frame.size() / 2);
+        }
+
+        std::vector<uint8_t> pes = {
+            0x00, 0x00, 0x01, (uint8_t)codec.streamId,
+            (uint8_t)((frame.size() + 8) >> 8), (uint8_t)(frame.size() + 8),
+            0x80, 0x80, 0x05,
+            (uint8_t)(0x21 | ((pts >> 29) & 0x0E)),
+            (uint8_t)(pts >> 22),
+            (uint8_t)(((pts >> 14) & 0xFE) | 1),
+            (uint8_t)(pts >> 7),
+            (uint8_t)((pts << 1) | 1)
+        };
+
+        pes.insert(pes.end(), frame.begin(), frame.end());
+        packetize(ts, pes, 0x100, cc);
+
+        pts += 2160;
+    }
+
+    return ts;
+}
+
+static void run(const Codec& codec, const char* mode, int corrupt) {
+    std::vector<uint8_t> ts = createStream(codec, corrupt);
+    int packets = ts.size() / TS_SIZE;
+    double best = 0;
+    HashListener result;
+    uint64_t resyncs = Parser::getResyncCount(codec.type);
+
+    for(int r = 0; r < rounds; r++) {
+        HashListener listener;
+        TsDemuxer demuxer(&listener, codec.type, 0x100);
+
+        auto start = steady_clock::now();
+
+        for(int i = 0; i < packets; i++) {
+            demuxer.processTsPacket(&ts[i * TS_SIZE]);
+        }
+
+        double seconds = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1000000000.0;
+
+        if(r == 0 || seconds < best) {
+            best = seconds;
+        }
+
+        result.frames = listener.frames;
+        result.hash = listener.hash;
+    }
+
+    resyncs = (Parser::getResyncCount(codec.type) - resyncs) / rounds;
+
+    fprintf(out, "%-12s %-7s %8llu %8llu %10.1f %9.1f  %016llx\n",
+            codec.name, mode,
+            (unsigned long long)result.frames,
+            (unsigned long long)resyncs,
+            best * 1000000000.0 / std::max<uint64_t>(result.frames, 1),
+            ts.size() / best / (1024 * 1024),
+            (unsigned long long)result.hash);
+
+    fflush(out);
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "n:f:c:h")) != -1) {
+        switch(c) {
+            case 'n':
+                rounds = std::max(1, atoi(optarg));
+                break;
+
+            case 'f':
+                frameCount = std::max(10, atoi(optarg));
+                break;
+
+            case 'c':
+                corruptInterval = std::max(2, atoi(optarg));
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    // the parsers log to stdout (CONSOLEDEBUG), keep the report separate
+    out = fdopen(dup(STDOUT_FILENO), "w");
+
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+
+    std::vector<Codec> codecs = {
+        // MPEG-1 layer II, 192 kbit/s, 48 kHz
+        { "MPEG2AUDIO", StreamInfo::stMPEG2AUDIO, 0xC0, 576, { 0xFF, 0xFD, 0xA4, 0x04 } },
+        // AC3, 384 kbit/s, 48 kHz
+        { "AC3", StreamInfo::stAC3, 0xBD, 1536, { 0x0B, 0x77, 0x00, 0x00, 0x1C, 0x40, 0x40 } },
+        // ADTS AAC-LC, 48 kHz, 400 byte frames
+        { "AAC", StreamInfo::stAAC, 0xC0, 400, { 0xFF, 0xF1, 0x4C, 0x80, 400 >> 3, ((400 & 7) << 5) | 0x1F, 0xFC } },
+    };
+
+    fprintf(out, "%-12s %-7s %8s %8s %10s %9s  %s\n", "parser", "mode", "frames", "resyncs", "ns/frame", "MB/s", "checksum");
+
+    for(auto& codec : codecs) {
+        run(codec, "clean", 0);
+        run(codec, "resync", corruptInterval);
+    }
+
+    return 0;
+}
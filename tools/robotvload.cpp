@@ -0,0 +1,436 @@
+/*
+ *      RoboTV Load Generator
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "net/msgpacket.h"
+#include "robotv/robotvcommand.h"
+#include "tools/json.hpp"
+
+using namespace std::chrono;
+using json = nlohmann::json;
+
+// a live channel (uid or number) or a recording (recid)
+struct Target {
+    bool recording;
+    std::string id;
+};
+
+struct ClientStats {
+    uint64_t requests = 0;
+    uint64_t emptyResponses = 0;
+    uint64_t bytes = 0;
+    uint64_t otherPackets = 0;
+    bool failed = false;
+    std::vector<uint32_t> latencies;
+};
+
+static std::string host = "localhost";
+static int port = 34892;
+static int svdrpPort = 6419;
+static int clientCount = 1;
+static int intervalMs = 20;
+static int durationSeconds = 30;
+static int timeoutMs = 5000;
+static std::vector<Target> targets;
+static std::atomic<bool> running(true);
+
+static void usage() {
+    printf("usage: robotvload [options]\n");
+    printf("  -H host       roboTV server (default: localhost)\n");
+    printf("  -p port       roboTV port (default: 34892)\n");
+    printf("  -S port       SVDRP port for server side counters (default: 6419, 0: disabled)\n");
+    printf("  -n clients    number of concurrent clients (default: 1)\n");
+    printf("  -c channels   comma separated list of channel uids / numbers to stream\n");
+    printf("  -r recordings comma separated list of recording ids to play\n");
+    printf("  -i ms         interval between stream requests per client (default: 20, 0: back-to-back)\n");
+    printf("  -t seconds    duration of the test (default: 30)\n");
+    printf("\nclients are assigned round-robin to the given channels and recordings\n");
+}
+
+static void addTargets(const char* list, bool recording) {
+    std::stringstream s(list);
+    std::string id;
+
+    while(std::getline(s, id, ',')) {
+        if(!id.empty()) {
+            targets.push_back({recording, id});
+        }
+    }
+}
+
+static int connectTo(const std::string& hostName, int portNumber) {
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if(getaddrinfo(hostName.c_str(), std::to_string(portNumber).c_str(), &hints, &result) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+
+    for(struct addrinfo* a = result; a != NULL; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+
+        if(fd == -1) {
+            continue;
+        }
+
+        if(connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            int val = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+            break;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(result);
+    return fd;
+}
+
+// send a request and wait for the matching response (other packets are skipped)
+static MsgPacket* request(int fd, MsgPacket& req, ClientStats& stats) {
+    req.setProtocolVersion(ROBOTV_PROTOCOLVERSION);
+
+    if(!req.write(fd, timeoutMs)) {
+        return NULL;
+    }
+
+    bool closed = false;
+    MsgPacket* p = NULL;
+
+    while((p = MsgPacket::read(fd, closed, timeoutMs)) != NULL) {
+        if(p->getType() == ROBOTV_CHANNEL_REQUEST_RESPONSE && p->getUID() == req.getUID()) {
+            return p;
+        }
+
+        stats.otherPackets++;
+        delete p;
+    }
+
+    return NULL;
+}
+
+static bool login(int fd, ClientStats& stats) {
+    MsgPacket req(ROBOTV_LOGIN, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+
+    req.put_U8(0);              // compression level
+    req.put_String("robotvload");
+    req.put_U8(0);              // status interface
+    req.put_U8(0);              // push-mode
+
+    MsgPacket* resp = request(fd, req, stats);
+    delete resp;
+
+    return (resp != NULL);
+}
+
+static bool openStream(int fd, const Target& target, ClientStats& stats) {
+    MsgPacket req(target.recording ? ROBOTV_RECSTREAM_OPEN : ROBOTV_CHANNELSTREAM_OPEN, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+
+    if(target.recording) {
+        req.put_String(target.id.c_str());
+    }
+    else {
+        req.put_U32(strtoul(target.id.c_str(), NULL, 0));
+    }
+
+    MsgPacket* resp = request(fd, req, stats);
+
+    if(resp == NULL) {
+        return false;
+    }
+
+    uint32_t status = resp->get_U32();
+    delete resp;
+
+    if(status != ROBOTV_RET_OK) {
+        fprintf(stderr, "unable to open %s %s (status %u)\n", target.recording ? "recording" : "channel", target.id.c_str(), status);
+        return false;
+    }
+
+    return true;
+}
+
+static void clientLoop(const Target& target, ClientStats& stats) {
+    int fd = connectTo(host, port);
+
+    if(fd == -1 || !login(fd, stats) || !openStream(fd, target, stats)) {
+        stats.failed = true;
+
+        if(fd != -1) {
+            close(fd);
+        }
+
+        return;
+    }
+
+    auto next = steady_clock::now();
+
+    while(running) {
+        MsgPacket req(ROBOTV_CHANNELSTREAM_REQUEST, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+        req.put_U8(0); // keyframe mode
+
+        auto start = steady_clock::now();
+        MsgPacket* resp = request(fd, req, stats);
+
+        if(resp == NULL) {
+            stats.failed = true;
+            break;
+        }
+
+        stats.latencies.push_back(duration_cast<microseconds>(steady_clock::now() - start).count());
+        stats.requests++;
+        stats.bytes += resp->getPacketLength();
+
+        if(resp->getPayloadLength() == 0) {
+            stats.emptyResponses++;
+        }
+
+        delete resp;
+
+        next += milliseconds(intervalMs);
+        std::this_thread::sleep_until(next);
+    }
+
+    MsgPacket req(target.recording ? ROBOTV_RECSTREAM_CLOSE : ROBOTV_CHANNELSTREAM_CLOSE, ROBOTV_CHANNEL_REQUEST_RESPONSE);
+    delete request(fd, req, stats);
+
+    close(fd);
+}
+
+// fetch the pipeline metrics of the server (SVDRP command STAT of the plugin)
+static bool svdrpStat(json& result) {
+    int fd = connectTo(host, svdrpPort);
+
+    if(fd == -1) {
+        return false;
+    }
+
+    std::string command = "PLUG robotv STAT\r\nQUIT\r\n";
+
+    if(::write(fd, command.c_str(), command.size()) != (ssize_t)command.size()) {
+        close(fd);
+        return false;
+    }
+
+    std::string reply;
+    char buffer[4096];
+    ssize_t rc;
+
+    while((rc = ::read(fd, buffer, sizeof(buffer))) > 0) {
+        reply.append(buffer, rc);
+    }
+
+    close(fd);
+
+    // the reply lines of the plugin command start with "900"
+    std::stringstream s(reply);
+    std::string line;
+    std::string data;
+
+    while(std::getline(s, line)) {
+        if(line.compare(0, 3, "900") == 0 && line.size() > 4) {
+            data += line.substr(4);
+        }
+    }
+
+    if(data.empty()) {
+        return false;
+    }
+
+    try {
+        result = json::parse(data);
+    }
+    catch(...) {
+        return false;
+    }
+
+    return true;
+}
+
+static uint64_t sumOf(const json& j, const char* group, const char* key) {
+    uint64_t sum = 0;
+
+    if(j.find(group) == j.end()) {
+        return 0;
+    }
+
+    for(auto& entry : j[group]) {
+        if(entry.find(key) != entry.end()) {
+            sum += entry[key].get<uint64_t>();
+        }
+    }
+
+    return sum;
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "H:p:S:n:c:r:i:t:h")) != -1) {
+        switch(c) {
+            case 'H':
+                host = optarg;
+                break;
+
+            case 'p':
+                port = atoi(optarg);
+                break;
+
+            case 'S':
+                svdrpPort = atoi(optarg);
+                break;
+
+            case 'n':
+                clientCount = std::max(1, atoi(optarg));
+                break;
+
+            case 'c':
+                addTargets(optarg, false);
+                break;
+
+            case 'r':
+                addTargets(optarg, true);
+                break;
+
+            case 'i':
+                intervalMs = std::max(0, atoi(optarg));
+                break;
+
+            case 't':
+                durationSeconds = std::max(1, atoi(optarg));
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if(targets.empty()) {
+        usage();
+        return 1;
+    }
+
+    std::vector<ClientStats> stats(clientCount);
+    std::vector<std::thread*> clients;
+
+    printf("starting %i clients on %s:%i\n", clientCount, host.c_str(), port);
+    auto start = steady_clock::now();
+
+    for(int i = 0; i < clientCount; i++) {
+        const Target& target = targets[i % targets.size()];
+        ClientStats& s = stats[i];
+
+        clients.push_back(new std::thread([&target, &s]() {
+            clientLoop(target, s);
+        }));
+    }
+
+    std::this_thread::sleep_for(seconds(durationSeconds));
+
+    // server side counters (taken while all streams are still open)
+    json serverStats;
+    bool haveServerStats = (svdrpPort > 0) && svdrpStat(serverStats);
+
+    running = false;
+
+    for(auto t : clients) {
+        t->join();
+        delete t;
+    }
+
+    double elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count() / 1000.0;
+
+    // summary
+    ClientStats total;
+    int failed = 0;
+
+    for(auto& s : stats) {
+        total.requests += s.requests;
+        total.emptyResponses += s.emptyResponses;
+        total.bytes += s.bytes;
+        total.otherPackets += s.otherPackets;
+        total.latencies.insert(total.latencies.end(), s.latencies.begin(), s.latencies.end());
+        failed += s.failed ? 1 : 0;
+    }
+
+    std::sort(total.latencies.begin(), total.latencies.end());
+
+    auto percentile = [&](double p) {
+        if(total.latencies.empty()) {
+            return 0.0;
+        }
+
+        size_t index = std::min(total.latencies.size() - 1, (size_t)(total.latencies.size() * p));
+        return total.latencies[index] / 1000.0;
+    };
+
+    printf("\n");
+    printf("clients:          %i (%i failed)\n", clientCount, failed);
+    printf("duration:         %.1f s\n", elapsed);
+    printf("requests:         %lu (%.1f/s, %lu empty)\n", (unsigned long)total.requests, total.requests / elapsed, (unsigned long)total.emptyResponses);
+    printf("throughput:       %.2f MB/s (%.2f Mbit/s)\n", total.bytes / elapsed / (1024 * 1024), total.bytes * 8 / elapsed / 1000000);
+    printf("latency (ms):     p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n", percentile(0.5), percentile(0.9), percentile(0.99), percentile(1.0));
+    printf("other packets:    %lu\n", (unsigned long)total.otherPackets);
+
+    if(haveServerStats) {
+        printf("server drops:     %lu frames, %lu B-frames, %lu resyncs, %lu timeshift packets\n",
+               (unsigned long)sumOf(serverStats, "streamers", "droppedFrames"),
+               (unsigned long)sumOf(serverStats, "streamers", "droppedBFrames"),
+               (unsigned long)sumOf(serverStats, "streamers", "resyncs"),
+               (unsigned long)sumOf(serverStats, "queues", "droppedPackets"));
+        printf("server stalls:    %lu\n", (unsigned long)sumOf(serverStats, "clients", "stalls"));
+    }
+    else if(svdrpPort > 0) {
+        printf("server counters:  not available (SVDRP %s:%i)\n", host.c_str(), svdrpPort);
+    }
+
+    return (failed == clientCount) ? 1 : 0;
+}
@@ -0,0 +1,442 @@
+/*
+ *      RoboTV Storage Benchmark
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "db/database.h"
+#include "demuxer/streaminfo.h"
+#include "epg/epgindex.h"
+#include "live/channelcachetable.h"
+#include "recordings/recordingstable.h"
+#include "tools/metrics.h"
+
+using namespace std::chrono;
+
+// words of the synthetic titles, subjects and descriptions
+static const char* words[] = {
+    "news", "weather", "sports", "football", "tennis", "documentary", "nature", "ocean",
+    "history", "crime", "detective", "murder", "comedy", "family", "children", "cartoon",
+    "movie", "thriller", "western", "science", "space", "planet", "travel", "europe",
+    "kitchen", "cooking", "garden", "music", "concert", "opera", "quiz", "show",
+    "talk", "politics", "economy", "report", "animals", "wildlife", "arctic", "desert",
+    "war", "love", "summer", "winter", "city", "island", "mountain", "river",
+    NULL
+};
+
+static std::string storageDir = "/tmp";
+static int channelCount = 500;
+static int dayCount = 14;
+static int recordingCount = 5000;
+static int queryCount = 500;
+static int batchSize = 5000;
+static bool keepDb = false;
+static bool verbose = false;
+
+static FILE* out = stdout;
+
+// failed consistency checks
+static int failures = 0;
+
+static void usage() {
+    printf("usage: storagebench [options]\n");
+    printf("  -d dir        directory of the temporary database (default: /tmp)\n");
+    printf("  -c channels   number of EPG channels (default: 500)\n");
+    printf("  -D days       days of EPG per channel (default: 14)\n");
+    printf("  -r count      number of recordings (default: 5000)\n");
+    printf("  -q queries    number of queries per test (default: 500)\n");
+    printf("  -b size       EPG events written per transaction (default: 5000)\n");
+    printf("  -k            keep the database\n");
+    printf("  -v            show the log output of the storage layer\n");
+}
+
+static double secondsSince(const steady_clock::time_point& start) {
+    return duration_cast<microseconds>(steady_clock::now() - start).count() / 1000000.0;
+}
+
+static std::string sentence(std::mt19937& random, int length) {
+    static int wordCount = 0;
+
+    while(wordCount == 0 || words[wordCount] != NULL) {
+        wordCount++;
+    }
+
+    std::string result;
+
+    for(int i = 0; i < length; i++) {
+        result += (i == 0) ? "" : " ";
+        result += words[random() % wordCount];
+    }
+
+    return result;
+}
+
+static void report(const char* test, uint64_t count, double seconds) {
+    fprintf(out, "%-24s %9lu %11.0f %9s %9s %9s %9s\n",
+            test, (unsigned long)count, seconds > 0 ? count / seconds : 0, "-", "-", "-", "-");
+    fflush(out);
+}
+
+static void report(const char* test, const LatencyHistogram& latency, double seconds) {
+    nlohmann::json l = latency.toJson();
+
+    fprintf(out, "%-24s %9lu %11.0f %7luus %7luus %7luus %7luus\n",
+            test, (unsigned long)latency.count(), seconds > 0 ? latency.count() / seconds : 0,
+            (unsigned long)l["p50Us"].get<uint64_t>(),
+            (unsigned long)l["p90Us"].get<uint64_t>(),
+            (unsigned long)l["p99Us"].get<uint64_t>(),
+            (unsigned long)l["maxUs"].get<uint64_t>());
+    fflush(out);
+}
+
+// run a test count times and record the latency of every run
+static void measure(const char* test, int count, std::function<void(int)> run) {
+    LatencyHistogram latency;
+    auto start = steady_clock::now();
+
+    for(int i = 0; i < count; i++) {
+        auto runStart = steady_clock::now();
+        run(i);
+        latency.addSince(runStart);
+    }
+
+    report(test, latency, secondsSince(start));
+}
+
+// synthetic EPG (events of 15 - 120 minutes, starting now)
+static std::deque<EpgIndex::Entry> createEpg(time_t now) {
+    std::deque<EpgIndex::Entry> epg;
+    std::mt19937 random(1);
+    std::hash<std::string> hash;
+
+    for(int c = 0; c < channelCount; c++) {
+        std::string channelId = "S19.2E-1-1079-" + std::to_string(28000 + c);
+        std::string channelName = "Channel " + std::to_string(c + 1);
+        uint32_t eventId = 1;
+
+        for(time_t t = now + 60; t < now + dayCount * 86400; t += (15 + random() % 8 * 15) * 60) {
+            EpgIndex::Entry e;
+            e.docId = (int)hash(channelId + "-" + std::to_string(eventId));
+            e.eventId = eventId++;
+            e.timestamp = (uint64_t)t;
+            e.channelId = channelId;
+            e.channelName = channelName;
+            e.channelUid = (uint32_t)hash(channelId);
+            e.title = sentence(random, 1 + random() % 3);
+            e.subject = sentence(random, 2 + random() % 6);
+            e.hash = (uint32_t)hash(e.title + "\n" + e.subject + "\n" + std::to_string(e.timestamp) + "\n" + channelName);
+
+            epg.push_back(e);
+        }
+    }
+
+    return epg;
+}
+
+// ingest events the way the EpgHandler does (content check, batched writes)
+static uint64_t ingest(EpgIndex& index, const std::deque<EpgIndex::Entry>& epg) {
+    std::deque<EpgIndex::Entry> batch;
+    uint64_t written = 0;
+
+    for(const auto& e : epg) {
+        if(!index.changed(e)) {
+            continue;
+        }
+
+        batch.push_back(e);
+
+        if((int)batch.size() >= batchSize) {
+            index.write(batch);
+            written += batch.size();
+            batch.clear();
+        }
+    }
+
+    if(!batch.empty()) {
+        index.write(batch);
+        written += batch.size();
+    }
+
+    return written;
+}
+
+static void benchEpg(roboTV::Database& db) {
+    time_t now = time(NULL);
+    std::deque<EpgIndex::Entry> epg = createEpg(now);
+
+    EpgIndex index(db);
+    index.createDb();
+    index.loadState();
+
+    auto start = steady_clock::now();
+    uint64_t written = ingest(index, epg);
+    report("epg ingest", written, secondsSince(start));
+
+    // a second pass (unchanged events) has to be skipped by the content hash
+    start = steady_clock::now();
+    written = ingest(index, epg);
+    report("epg ingest (unchanged)", epg.size(), secondsSince(start));
+
+    if(written != 0) {
+        fprintf(stderr, "%lu unchanged epg events written\n", (unsigned long)written);
+        failures++;
+    }
+
+    start = steady_clock::now();
+    index.mergeSegments();
+    report("epg merge segments", 1, secondsSince(start));
+
+    std::mt19937 random(2);
+    int results = 0;
+
+    measure("epg search (word)", queryCount, [&](int i) {
+        std::string term = sentence(random, 1);
+        EpgIndex::search(db, term, now, 0, 100, [&](const EpgIndex::Result & r) {
+            results++;
+        });
+    });
+
+    measure("epg search (2 words)", queryCount, [&](int i) {
+        std::string term = sentence(random, 2);
+        EpgIndex::search(db, term, now, 0, 100, [&](const EpgIndex::Result & r) {
+            results++;
+        });
+    });
+
+    measure("epg search (prefix)", queryCount, [&](int i) {
+        std::string term = sentence(random, 1).substr(0, 3) + "*";
+        EpgIndex::search(db, term, now, 0, 100, [&](const EpgIndex::Result & r) {
+            results++;
+        });
+    });
+
+    if(results == 0) {
+        fprintf(stderr, "epg search didn't find any events\n");
+        failures++;
+    }
+}
+
+static void benchRecordings(roboTV::Database& db) {
+    RecordingsTable table(db);
+    table.createDb();
+
+    std::vector<RecordingsTable::Row> rows;
+    std::mt19937 random(3);
+    std::hash<std::string> hash;
+
+    for(int i = 0; i < recordingCount; i++) {
+        RecordingsTable::Row row;
+        row.fileName = "/video/" + sentence(random, 2) + "/" + std::to_string(i) + ".rec";
+        row.uid = (uint32_t)hash(row.fileName);
+        row.title = sentence(random, 1 + random() % 3);
+        row.subject = sentence(random, 2 + random() % 4);
+        row.description = sentence(random, 20 + random() % 60);
+
+        rows.push_back(row);
+    }
+
+    auto start = steady_clock::now();
+    table.add(rows);
+    report("recordings add", rows.size(), secondsSince(start));
+
+    measure("recordings metadata", 10, [&](int i) {
+        table.getMetadata();
+    });
+
+    measure("recordings set playcount", queryCount, [&](int i) {
+        table.setPlayCount(rows[random() % rows.size()].uid, i);
+    });
+
+    measure("recordings set position", queryCount, [&](int i) {
+        table.setLastPlayedPosition(rows[random() % rows.size()].uid, (uint64_t)i * 1000);
+    });
+
+    measure("recordings get position", queryCount, [&](int i) {
+        table.getLastPlayedPosition(rows[random() % rows.size()].uid);
+    });
+
+    measure("recordings filename", queryCount, [&](int i) {
+        table.getFileName(rows[random() % rows.size()].uid);
+    });
+
+    int results = 0;
+
+    measure("recordings search", queryCount, [&](int i) {
+        results += table.search(sentence(random, 1).c_str()).size();
+    });
+
+    if(results == 0) {
+        fprintf(stderr, "recordings search didn't find any recordings\n");
+        failures++;
+    }
+}
+
+// streams of a typical HD channel
+static std::vector<StreamInfo> createStreams(int channel) {
+    std::vector<StreamInfo> streams;
+
+    streams.push_back(StreamInfo(100 + channel, StreamInfo::stH264));
+    streams.push_back(StreamInfo(200 + channel, StreamInfo::stMPEG2AUDIO, "deu"));
+    streams.push_back(StreamInfo(300 + channel, StreamInfo::stAC3, "eng"));
+    streams.push_back(StreamInfo(400 + channel, StreamInfo::stDVBSUB, "deu"));
+    streams.push_back(StreamInfo(500 + channel, StreamInfo::stTELETEXT));
+
+    return streams;
+}
+
+static void benchChannelCache(roboTV::Database& db) {
+    ChannelCacheTable table(db);
+    table.createDb();
+
+    std::mt19937 random(4);
+    int errors = 0;
+
+    measure("channelcache write", channelCount, [&](int i) {
+        table.write(i + 1, createStreams(i));
+    });
+
+    measure("channelcache read", queryCount, [&](int i) {
+        int channel = random() % channelCount;
+        errors += (table.read(channel + 1).size() != 5) ? 1 : 0;
+    });
+
+    measure("channelcache enable", channelCount, [&](int i) {
+        table.setEnabled(i + 1, (i % 2) == 0);
+    });
+
+    measure("channelcache load enabled", 10, [&](int i) {
+        errors += ((int)table.getEnabled().size() != (channelCount + 1) / 2) ? 1 : 0;
+    });
+
+    if(errors > 0) {
+        fprintf(stderr, "%i channel cache lookups returned wrong results\n", errors);
+        failures++;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "d:c:D:r:q:b:kvh")) != -1) {
+        switch(c) {
+            case 'd':
+                storageDir = optarg;
+                break;
+
+            case 'c':
+                channelCount = std::max(1, atoi(optarg));
+                break;
+
+            case 'D':
+                dayCount = std::max(1, atoi(optarg));
+                break;
+
+            case 'r':
+                recordingCount = std::max(1, atoi(optarg));
+                break;
+
+            case 'q':
+                queryCount = std::max(1, atoi(optarg));
+                break;
+
+            case 'b':
+                batchSize = std::max(1, atoi(optarg));
+                break;
+
+            case 'k':
+                keepDb = true;
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    // the storage layer logs to stdout (CONSOLEDEBUG), keep the report separate
+    out = fdopen(dup(STDOUT_FILENO), "w");
+
+    if(!verbose) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    std::string dir = storageDir + "/storagebench-XXXXXX";
+
+    if(mkdtemp(&dir[0]) == NULL) {
+        fprintf(stderr, "unable to create directory in %s\n", storageDir.c_str());
+        return 1;
+    }
+
+    std::string fileName = dir + "/storage.db";
+    roboTV::Database db;
+
+    if(!db.open(fileName)) {
+        fprintf(stderr, "unable to open database %s\n", fileName.c_str());
+        return 1;
+    }
+
+    fprintf(out, "%-24s %9s %11s %9s %9s %9s %9s\n", "test", "count", "ops/s", "p50", "p90", "p99", "max");
+
+    benchEpg(db);
+    benchRecordings(db);
+    benchChannelCache(db);
+
+    fprintf(out, "\ndatabase size: %.1f MB (wal: %.1f MB)\n",
+            db.getDatabaseSize() / (1024.0 * 1024.0),
+            db.getWalSize() / (1024.0 * 1024.0));
+
+    db.close();
+
+    if(keepDb) {
+        fprintf(out, "database kept in %s\n", fileName.c_str());
+    }
+    else {
+        unlink(fileName.c_str());
+        unlink((fileName + "-wal").c_str());
+        unlink((fileName + "-shm").c_str());
+        rmdir(dir.c_str());
+    }
+
+    return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,479 @@
+/*
+ *      RoboTV Timeshift Benchmark
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "live/livequeue.h"
+#include "live/timeshiftstore.h"
+#include "net/msgpacket.h"
+#include "robotv/robotvcommand.h"
+#include "tools/metrics.h"
+#include "tools/time.h"
+
+using namespace std::chrono;
+
+// synthetic stream profile (video bitrate, framerate, audio bitrate)
+struct Profile {
+    const char* name;
+    uint32_t videoBitRate;
+    int frameRate;
+    uint32_t audioBitRate;
+};
+
+static const Profile profiles[] = {
+    { "sd", 4000000, 25, 192000 },
+    { "hd", 12000000, 50, 384000 },
+    { "uhd", 30000000, 50, 640000 },
+    { NULL, 0, 0, 0 }
+};
+
+// a reader of the timeshift store (LiveQueue)
+struct Reader {
+    LiveQueue* queue;
+    std::thread* thread;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool lagging;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t gaps;
+    uint64_t errors;
+    int64_t lastSeq;
+    double seconds;
+};
+
+struct Result {
+    double writeRate;
+    double readRate;
+    uint64_t wraps;
+    uint64_t drops;
+    uint64_t gaps;
+    uint64_t errors;
+    uint64_t seekErrors;
+    nlohmann::json seek;
+};
+
+static std::string storageDir = "/tmp";
+static std::vector<std::string> backendList = { "file", "mmap", "ram" };
+static std::vector<std::string> profileList = { "sd", "hd", "uhd" };
+static std::vector<int> gopList = { 12, 50 };
+static std::vector<int> bufferList = { 64, 256 };
+static double wrapFactor = 3;
+static int seekCount = 200;
+static uint32_t channelUid = 0xFFFF0000;
+static bool verbose = false;
+
+static std::vector<std::string> split(const char* list) {
+    std::vector<std::string> result;
+    std::stringstream s(list);
+    std::string item;
+
+    while(std::getline(s, item, ',')) {
+        if(!item.empty()) {
+            result.push_back(item);
+        }
+    }
+
+    return result;
+}
+
+static std::vector<int> splitInt(const char* list) {
+    std::vector<int> result;
+
+    for(auto& item : split(list)) {
+        result.push_back(std::max(1, atoi(item.c_str())));
+    }
+
+    return result;
+}
+
+static void usage() {
+    printf("usage: timeshiftbench [options]\n");
+    printf("  -d dir        directory of the timeshift files (default: /tmp)\n");
+    printf("  -m backends   storage backends: file,mmap,ram (default: all)\n");
+    printf("  -p profiles   stream profiles: sd,hd,uhd (default: all)\n");
+    printf("  -g gops       GOP lengths in frames (default: 12,50)\n");
+    printf("  -b sizes      buffer sizes in MB (default: 64,256)\n");
+    printf("  -w factor     amount of data written in multiples of the buffer size (default: 3)\n");
+    printf("  -s seeks      number of random seeks (default: 200)\n");
+    printf("  -v            show the log output of the timeshift store\n");
+}
+
+// frame type within the GOP (I BB P BB P ...)
+static StreamInfo::FrameType frameType(int index, int gop) {
+    if(index % gop == 0) {
+        return StreamInfo::ftIFRAME;
+    }
+
+    return (index % gop % 3 == 0) ? StreamInfo::ftPFRAME : StreamInfo::ftBFRAME;
+}
+
+static int frameWeight(StreamInfo::FrameType type) {
+    switch(type) {
+        case StreamInfo::ftIFRAME:
+            return 8;
+
+        case StreamInfo::ftPFRAME:
+            return 3;
+
+        default:
+            return 1;
+    }
+}
+
+// build a stream packet the way LiveHub does
+// pts and dts carry the sequence number, the payload is filled with its lowest byte
+static MsgPacket* createPacket(int64_t seq, StreamInfo::FrameType type, std::vector<uint8_t>& data, uint32_t size) {
+    MsgPacket* packet = new MsgPacket(ROBOTV_STREAM_MUXPKT, ROBOTV_CHANNEL_STREAM);
+
+    packet->put_U16(type == StreamInfo::ftUNKNOWN ? 0x101 : 0x100);
+    packet->put_S64(seq);
+    packet->put_S64(seq);
+    packet->put_U32(0);
+    packet->setClientID((uint16_t)type);
+
+    memset(data.data(), (uint8_t)seq, size);
+    packet->put_U32(size);
+    packet->put_Blob(data.data(), size);
+
+    packet->put_S64(roboTV::currentTimeMillis().count());
+    return packet;
+}
+
+// check sequence and payload of a stream packet
+static bool validatePacket(MsgPacket* p, int64_t& seq) {
+    if(p->getMsgID() != ROBOTV_STREAM_MUXPKT) {
+        return false;
+    }
+
+    p->get_U16();
+    seq = p->get_S64();
+
+    if(p->get_S64() != seq) {
+        return false;
+    }
+
+    p->get_U32();
+    uint32_t size = p->get_U32();
+
+    if(size + sizeof(int64_t) != p->getPayloadLength() - (sizeof(uint16_t) + 2 * sizeof(int64_t) + 2 * sizeof(uint32_t))) {
+        return false;
+    }
+
+    const uint8_t* data = p->getPayload() + sizeof(uint16_t) + 2 * sizeof(int64_t) + 2 * sizeof(uint32_t);
+    uint8_t c = (uint8_t)seq;
+
+    return (size == 0) || (data[0] == c && data[size / 2] == c && data[size - 1] == c);
+}
+
+static void readerLoop(Reader* reader, std::atomic<bool>& writing, std::atomic<uint64_t>& written, uint64_t lagBytes) {
+    // the lagging reader starts when the writer already overran it
+    while(reader->lagging && writing && written < lagBytes) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+
+    auto start = steady_clock::now();
+    auto lastPacket = start;
+
+    for(;;) {
+        MsgPacket* p = reader->queue->read();
+
+        if(p == NULL) {
+            // writer finished and nothing left to read
+            if(!writing && steady_clock::now() - lastPacket > milliseconds(500)) {
+                break;
+            }
+
+            std::unique_lock<std::mutex> lock(reader->mutex);
+            reader->condition.wait_for(lock, milliseconds(10));
+            continue;
+        }
+
+        int64_t seq = 0;
+
+        if(!validatePacket(p, seq) || seq <= reader->lastSeq) {
+            reader->errors++;
+        }
+        else {
+            reader->gaps += (reader->lastSeq >= 0 && seq > reader->lastSeq + 1) ? 1 : 0;
+            reader->lastSeq = seq;
+        }
+
+        reader->packets++;
+        reader->bytes += p->getPacketLength();
+        lastPacket = steady_clock::now();
+
+        delete p;
+    }
+
+    reader->seconds = duration_cast<microseconds>(lastPacket - start).count() / 1000000.0;
+}
+
+static Result run(const Profile& profile, int gop, TimeShiftStore::StorageMode mode, bool ram, uint64_t bufferSize) {
+    Result result;
+
+    TimeShiftStore::setBufferSize(bufferSize);
+    TimeShiftStore::setStorageMode(mode);
+    TimeShiftStore::setMemorySize(ram ? bufferSize : 0);
+
+    uint32_t uid = channelUid++;
+
+    // writer (as LiveHub)
+    TimeShiftStore* store = TimeShiftStore::acquire(uid);
+    store->claimWriter(&result);
+
+    // a reader following the live edge and one overrun by the writer
+    std::atomic<bool> writing(true);
+    std::atomic<uint64_t> written(0);
+    Reader readers[2];
+
+    for(int i = 0; i < 2; i++) {
+        Reader* r = &readers[i];
+
+        r->queue = new LiveQueue(uid);
+        r->lagging = (i == 1);
+        r->packets = r->bytes = r->gaps = r->errors = 0;
+        r->lastSeq = -1;
+        r->seconds = 0;
+
+        r->queue->setNotify([r]() {
+            r->condition.notify_one();
+        });
+
+        r->thread = new std::thread([&, r]() {
+            readerLoop(r, writing, written, bufferSize + bufferSize / 2);
+        });
+    }
+
+    // write synthetic stream
+    int weights = 0;
+
+    for(int i = 0; i < gop; i++) {
+        weights += frameWeight(frameType(i, gop));
+    }
+
+    uint32_t unitSize = profile.videoBitRate / 8 / profile.frameRate * gop / weights;
+    uint32_t audioSize = profile.audioBitRate / 8 / profile.frameRate;
+    uint64_t total = bufferSize * wrapFactor;
+
+    std::vector<uint8_t> data(unitSize * frameWeight(StreamInfo::ftIFRAME));
+    int64_t seq = 0;
+
+    auto start = steady_clock::now();
+
+    for(int frame = 0; written < total; frame++) {
+        StreamInfo::FrameType type = frameType(frame, gop);
+        uint32_t size = unitSize * frameWeight(type);
+
+        // don't overflow the writer queue (packets would be dropped)
+        while(store->getQueueDepth() > 200) {
+            std::this_thread::yield();
+        }
+
+        store->queue(createPacket(seq, type, data, size), StreamInfo::scVIDEO, seq);
+        seq++;
+
+        store->queue(createPacket(seq, StreamInfo::ftUNKNOWN, data, audioSize), StreamInfo::scAUDIO, seq);
+        seq++;
+
+        written += size + audioSize;
+    }
+
+    while(store->getQueueDepth() > 0) {
+        std::this_thread::yield();
+    }
+
+    result.writeRate = written / (duration_cast<microseconds>(steady_clock::now() - start).count() / 1000000.0);
+    writing = false;
+
+    for(auto& r : readers) {
+        r.thread->join();
+        delete r.thread;
+    }
+
+    result.readRate = (readers[0].seconds > 0) ? readers[0].bytes / readers[0].seconds : 0;
+    result.gaps = readers[0].gaps + readers[1].gaps;
+    result.errors = readers[0].errors + readers[1].errors;
+    result.wraps = ram ? 0 : written / bufferSize;
+
+    // random seeks within the timeshift window
+    LatencyHistogram seekLatency;
+    result.seekErrors = 0;
+
+    LiveQueue seeker(uid);
+    std::mt19937 random(uid);
+
+    int64_t begin = seeker.getTimeshiftStartPosition();
+    int64_t end = roboTV::currentTimeMillis().count();
+
+    for(int i = 0; i < seekCount; i++) {
+        int64_t position = begin + (int64_t)(random() % (uint64_t)std::max<int64_t>(1, end - begin + 1));
+
+        auto seekStart = steady_clock::now();
+        int64_t pts = seeker.seek(position);
+        MsgPacket* p = seeker.read();
+        seekLatency.addSince(seekStart);
+
+        // the first packet has to be the keyframe found by the seek
+        int64_t seq = -1;
+
+        if(p == NULL || !validatePacket(p, seq) || seq != pts || p->getClientID() != StreamInfo::ftIFRAME) {
+            result.seekErrors++;
+        }
+
+        delete p;
+    }
+
+    result.seek = seekLatency.toJson();
+    result.drops = store->getDroppedPackets();
+
+    for(auto& r : readers) {
+        delete r.queue;
+    }
+
+    store->releaseWriter(&result);
+    TimeShiftStore::release(store);
+
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    int c;
+
+    while((c = getopt(argc, argv, "d:m:p:g:b:w:s:vh")) != -1) {
+        switch(c) {
+            case 'd':
+                storageDir = optarg;
+                break;
+
+            case 'm':
+                backendList = split(optarg);
+                break;
+
+            case 'p':
+                profileList = split(optarg);
+                break;
+
+            case 'g':
+                gopList = splitInt(optarg);
+                break;
+
+            case 'b':
+                bufferList = splitInt(optarg);
+                break;
+
+            case 'w':
+                wrapFactor = std::max(1.0, atof(optarg));
+                break;
+
+            case 's':
+                seekCount = std::max(1, atoi(optarg));
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    // the store logs to stdout (CONSOLEDEBUG), keep the report separate
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+
+    if(!verbose) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+
+    TimeShiftStore::setTimeShiftDir(storageDir);
+
+    fprintf(out, "%-6s %8s %-5s %5s %11s %11s %9s %9s %9s %6s %7s %6s %7s\n",
+           "mode", "buffer", "prof", "gop", "write MB/s", "read MB/s", "seek p50", "seek p99", "seek max", "wraps", "drops", "gaps", "errors");
+
+    int failures = 0;
+
+    for(auto& backend : backendList) {
+        bool ram = (backend == "ram");
+        TimeShiftStore::StorageMode mode = (backend == "mmap") ? TimeShiftStore::smMmap : TimeShiftStore::smFile;
+
+        if(!ram && mode == TimeShiftStore::smFile && backend != "file") {
+            fprintf(stderr, "unknown storage backend: %s\n", backend.c_str());
+            return 1;
+        }
+
+        for(int bufferMb : bufferList) {
+            for(auto& name : profileList) {
+                const Profile* profile = profiles;
+
+                while(profile->name != NULL && name != profile->name) {
+                    profile++;
+                }
+
+                if(profile->name == NULL) {
+                    fprintf(stderr, "unknown profile: %s\n", name.c_str());
+                    return 1;
+                }
+
+                for(int gop : gopList) {
+                    Result r = run(*profile, gop, mode, ram, (uint64_t)bufferMb * 1024 * 1024);
+
+                    fprintf(out, "%-6s %6iMB %-5s %5i %11.1f %11.1f %7luus %7luus %7luus %6lu %7lu %6lu %7lu\n",
+                           backend.c_str(), bufferMb, profile->name, gop,
+                           r.writeRate / (1024 * 1024), r.readRate / (1024 * 1024),
+                           (unsigned long)r.seek["p50Us"].get<uint64_t>(),
+                           (unsigned long)r.seek["p99Us"].get<uint64_t>(),
+                           (unsigned long)r.seek["maxUs"].get<uint64_t>(),
+                           (unsigned long)r.wraps, (unsigned long)r.drops, (unsigned long)r.gaps,
+                           (unsigned long)(r.errors + r.seekErrors));
+
+                    fflush(out);
+                    failures += (r.errors + r.seekErrors > 0) ? 1 : 0;
+                }
+            }
+        }
+    }
+
+    return (failures > 0) ? 1 : 0;
+}
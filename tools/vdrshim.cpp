@@ -0,0 +1,87 @@
+/*
+ *      VDR symbols used by the demuxer benchmarks
+ *
+ *      Copyright (C) 2016 Alexander Pipelka
+ *
+ *      https://github.com/pipelka/vdr-plugin-robotv
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+// The demuxer only needs a handful of out-of-line VDR functions. The tools
+// are not linked against VDR, so they are provided here (cBitStream is
+// implemented the same way as in VDR's tools.c).
+
+#include "vdr/config.h"
+#include "vdr/remux.h"
+#include "vdr/tools.h"
+
+int cBitStream::GetBit(void) {
+    if(index >= length) {
+        return 1;
+    }
+
+    int r = (data[index >> 3] >> (7 - (index & 7))) & 1;
+    ++index;
+
+    return r;
+}
+
+uint32_t cBitStream::GetBits(int n) {
+    uint32_t r = 0;
+
+    while(n--) {
+        r |= GetBit() << n;
+    }
+
+    return r;
+}
+
+void cBitStream::ByteAlign(void) {
+    int n = index % 8;
+
+    if(n > 0) {
+        SkipBits(8 - n);
+    }
+}
+
+void cBitStream::WordAlign(void) {
+    int n = index % 16;
+
+    if(n > 0) {
+        SkipBits(16 - n);
+    }
+}
+
+bool cBitStream::SetLength(int Length) {
+    if(Length > length) {
+        return false;
+    }
+
+    length = Length;
+    return true;
+}
+
+// the benchmarks build their stream bundles without VDR's PAT / PMT parser
+bool cPatPmtParser::GetVersions(int& PatVersion, int& PmtVersion) const {
+    return false;
+}
+
+// no language preferences
+int I18nLanguageIndex(const char* Code) {
+    return -1;
+}